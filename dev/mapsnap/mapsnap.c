@@ -0,0 +1,407 @@
+/*
+ * Pattern file compiler for haproxy
+ *
+ * Compiles a map or ACL pattern file into a snapshot that haproxy maps in
+ * memory instead of parsing it. See include/haproxy/mapsnap-t.h for the
+ * format.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <haproxy/mapsnap.h>
+
+/* same as haproxy's default tune.bufsize, which limits the line length */
+#define LINE_SIZE 16384
+
+/* same placement parameters as for the perfect hash of string trees */
+#define BUCKET_LOAD 2
+#define MAX_BUCKET  32
+#define MAX_SEEDS   64
+
+struct key {
+	uint64_t hash;      /* hash of the key */
+	uint32_t ent;       /* first entry holding this key */
+};
+
+static struct mapsnap_ent *ents;
+static uint32_t nb_ents, ents_room;
+static char *str;
+static uint64_t str_len, str_room;
+static struct key *keys;
+static uint32_t nb_keys;
+static uint32_t *disp;
+static struct mapsnap_slot *slots;
+static uint32_t nb_buckets;
+static int quiet;
+
+__attribute__((noreturn, format(printf, 1, 2)))
+static void die(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	exit(1);
+}
+
+static void usage(const char *name)
+{
+	die("Usage: %s [-a|-m] [-q] <input> <output>\n"
+	    "Compiles pattern file <input> into snapshot <output>, which haproxy\n"
+	    "loads in place of the text file when it is referenced instead.\n"
+	    "  -a   one-column file, as loaded by ACLs (acl ... -f)\n"
+	    "  -m   two-column file, as loaded by maps (default)\n"
+	    "  -q   do not report statistics\n", name);
+}
+
+static void *xrealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (!ptr)
+		die("out of memory\n");
+	return ptr;
+}
+
+/* appends zero-terminated string <s> of length <len> to the strings area and
+ * returns its offset.
+ */
+static uint64_t add_str(const char *s, size_t len)
+{
+	uint64_t ofs = str_len;
+
+	if (str_len + len + 1 > str_room) {
+		str_room = (str_len + len + 1) * 2;
+		str = xrealloc(str, str_room);
+	}
+	memcpy(str + str_len, s, len);
+	str[str_len + len] = 0;
+	str_len += len + 1;
+	return ofs;
+}
+
+static void add_ent(const char *key, const char *val, uint32_t line)
+{
+	struct mapsnap_ent *ent;
+
+	if (nb_ents == ents_room) {
+		ents_room = ents_room ? ents_room * 2 : 1024;
+		ents = xrealloc(ents, (size_t)ents_room * sizeof(*ents));
+	}
+	ent = &ents[nb_ents++];
+	ent->klen = strlen(key);
+	ent->key = add_str(key, ent->klen);
+	ent->val = val ? add_str(val, strlen(val)) : 0;
+	ent->line = line;
+}
+
+/* Reads <file> with the same rules as pat_ref_read_from_file_smp() if <smp>
+ * is set, otherwise pat_ref_read_from_file().
+ */
+static void read_file(const char *name, int smp)
+{
+	static char buf[LINE_SIZE];
+	char *c, *key_beg, *key_end, *value_beg, *value_end;
+	uint32_t line = 0;
+	FILE *file;
+
+	file = fopen(name, "r");
+	if (!file)
+		die("failed to open pattern file <%s> : %s\n", name, strerror(errno));
+
+	/* the strings area starts with an empty string used as the value
+	 * of one-column files.
+	 */
+	add_str("", 0);
+
+	while (fgets(buf, sizeof(buf), file) != NULL) {
+		line++;
+		c = buf;
+
+		if (*c == '#')
+			continue;
+
+		while (*c == ' ' || *c == '\t')
+			c++;
+
+		if (!smp) {
+			key_beg = c;
+			while (*c && *c != '\n' && *c != '\r')
+				c++;
+			*c = 0;
+			if (c == key_beg)
+				continue;
+			add_ent(key_beg, NULL, line);
+			continue;
+		}
+
+		if (*c == '\0' || *c == '\r' || *c == '\n')
+			continue;
+
+		key_beg = c;
+		while (*c && *c != ' ' && *c != '\t' && *c != '\n' && *c != '\r')
+			c++;
+		key_end = c;
+
+		while (*c == ' ' || *c == '\t')
+			c++;
+
+		value_beg = c;
+		while (*c && *c != '\n' && *c != '\r')
+			c++;
+		value_end = c;
+
+		while (value_end > value_beg && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+			value_end--;
+
+		*key_end = '\0';
+		*value_end = '\0';
+		add_ent(key_beg, value_beg, line);
+	}
+
+	if (ferror(file))
+		die("error encountered while reading <%s> : %s\n", name, strerror(errno));
+	fclose(file);
+}
+
+/* Collects the distinct keys into <keys>, keeping the first entry of each
+ * key, as haproxy does for duplicate keys.
+ */
+static void collect_keys(void)
+{
+	uint32_t *tbl, size, i, pos;
+
+	for (size = 1024; size < nb_ents * 2; size *= 2)
+		;
+	tbl = calloc(size, sizeof(*tbl));
+	keys = malloc((size_t)(nb_ents ? nb_ents : 1) * sizeof(*keys));
+	if (!tbl || !keys)
+		die("out of memory\n");
+
+	/* open addressing on entry number + 1 */
+	for (i = 0; i < nb_ents; i++) {
+		uint64_t hash = XXH3(str + ents[i].key, ents[i].klen, 0);
+
+		for (pos = hash & (size - 1); tbl[pos]; pos = (pos + 1) & (size - 1)) {
+			const struct mapsnap_ent *ent = &ents[tbl[pos] - 1];
+
+			if (ent->klen == ents[i].klen &&
+			    memcmp(str + ent->key, str + ents[i].key, ent->klen) == 0)
+				break;
+		}
+		if (tbl[pos])
+			continue;
+		tbl[pos] = i + 1;
+		keys[nb_keys++].ent = i;
+	}
+	free(tbl);
+}
+
+/* Tries to build the perfect hash of the keys with seed <seed>. Returns
+ * non-zero on success.
+ */
+static int build_hash(uint64_t seed)
+{
+	uint32_t *order, *start, *buckets, sizes[MAX_BUCKET + 2] = { };
+	uint32_t pos[MAX_BUCKET], i, j, b, first, cnt, d;
+	uint64_t max_disp;
+	unsigned char *taken;
+	int ret = 0;
+
+	nb_buckets = (nb_keys + BUCKET_LOAD - 1) / BUCKET_LOAD;
+	free(disp);
+	free(slots);
+	disp = calloc(nb_buckets, sizeof(*disp));
+	slots = calloc(nb_keys, sizeof(*slots));
+	order = malloc((size_t)nb_keys * sizeof(*order));
+	start = calloc((size_t)nb_buckets + 1, sizeof(*start));
+	buckets = malloc((size_t)nb_buckets * sizeof(*buckets));
+	taken = calloc(nb_keys, 1);
+	if (!disp || !slots || !order || !start || !buckets || !taken)
+		die("out of memory\n");
+
+	/* sort the keys by bucket, then the buckets by decreasing size */
+	for (i = 0; i < nb_keys; i++) {
+		keys[i].hash = XXH3(str + ents[keys[i].ent].key, ents[keys[i].ent].klen, seed);
+		start[mapsnap_hash_bucket(keys[i].hash, nb_buckets) + 1]++;
+	}
+
+	for (b = 0; b < nb_buckets; b++) {
+		if (start[b + 1] > MAX_BUCKET)
+			goto out;
+		start[b + 1] += start[b];
+	}
+
+	for (i = 0; i < nb_keys; i++)
+		order[start[mapsnap_hash_bucket(keys[i].hash, nb_buckets)]++] = i;
+	for (b = nb_buckets; b; b--)
+		start[b] = start[b - 1];
+	start[0] = 0;
+
+	for (b = 0; b < nb_buckets; b++)
+		sizes[MAX_BUCKET - (start[b + 1] - start[b]) + 1]++;
+	for (i = 1; i < MAX_BUCKET + 2; i++)
+		sizes[i] += sizes[i - 1];
+	for (b = 0; b < nb_buckets; b++)
+		buckets[sizes[MAX_BUCKET - (start[b + 1] - start[b])]++] = b;
+
+	/* place the largest buckets first */
+	max_disp = (uint64_t)nb_keys * 32 + 1024;
+	if (max_disp > 0xffffffffULL)
+		max_disp = 0xffffffffULL;
+
+	for (i = 0; i < nb_buckets; i++) {
+		b = buckets[i];
+		first = start[b];
+		cnt = start[b + 1] - first;
+		if (!cnt)
+			break;
+
+		for (d = 0; ; d++) {
+			if (d >= max_disp)
+				goto out;
+
+			for (j = 0; j < cnt; j++) {
+				uint32_t k;
+
+				pos[j] = mapsnap_hash_pos(keys[order[first + j]].hash, d, nb_keys);
+				if (taken[pos[j]])
+					break;
+				for (k = 0; k < j && pos[k] != pos[j]; k++)
+					;
+				if (k < j)
+					break;
+			}
+			if (j == cnt)
+				break;
+		}
+
+		for (j = 0; j < cnt; j++) {
+			const struct key *key = &keys[order[first + j]];
+
+			taken[pos[j]] = 1;
+			slots[pos[j]].ent = key->ent;
+			slots[pos[j]].check = key->hash >> 32;
+		}
+		disp[b] = d;
+	}
+	ret = 1;
+ out:
+	free(order);
+	free(start);
+	free(buckets);
+	free(taken);
+	return ret;
+}
+
+/* writes <len> bytes from <area> to <file>, followed by zeroes up to the next
+ * multiple of 8 bytes.
+ */
+static void write_area(FILE *file, const void *area, uint64_t len)
+{
+	static const char pad[8];
+
+	if ((len && fwrite(area, len, 1, file) != 1) ||
+	    ((-len & 7) && fwrite(pad, -len & 7, 1, file) != 1))
+		die("write error : %s\n", strerror(errno));
+}
+
+int main(int argc, char **argv)
+{
+	struct mapsnap_hdr hdr = { };
+	const char *name = argv[0];
+	char *tmp;
+	uint64_t seed;
+	FILE *file;
+	int smp = 1;
+
+	for (argc--, argv++; argc && **argv == '-'; argc--, argv++) {
+		if (strcmp(*argv, "-a") == 0)
+			smp = 0;
+		else if (strcmp(*argv, "-m") == 0)
+			smp = 1;
+		else if (strcmp(*argv, "-q") == 0)
+			quiet = 1;
+		else
+			usage(name);
+	}
+	if (argc != 2)
+		usage(name);
+
+	read_file(argv[0], smp);
+	collect_keys();
+
+	/* the seed is deterministic so that compiling the same file twice
+	 * produces the same snapshot.
+	 */
+	for (seed = 0; nb_keys && !build_hash(seed); seed++) {
+		if (seed == MAX_SEEDS)
+			die("failed to build the hash of the keys\n");
+	}
+
+	memcpy(hdr.magic, MAPSNAP_MAGIC, sizeof(hdr.magic));
+	hdr.version    = MAPSNAP_VERSION;
+	hdr.endian     = MAPSNAP_ENDIAN;
+	hdr.flags      = smp ? MAPSNAP_F_SMP : 0;
+	hdr.nb_ents    = nb_ents;
+	hdr.nb_keys    = nb_keys;
+	hdr.nb_buckets = nb_keys ? nb_buckets : 0;
+	hdr.seed       = seed;
+	hdr.ents_ofs   = (sizeof(hdr) + 7) & -8ULL;
+	hdr.disp_ofs   = hdr.ents_ofs + (((uint64_t)nb_ents * sizeof(*ents) + 7) & -8ULL);
+	hdr.slots_ofs  = hdr.disp_ofs + (((uint64_t)hdr.nb_buckets * sizeof(*disp) + 7) & -8ULL);
+	hdr.str_ofs    = hdr.slots_ofs + (((uint64_t)nb_keys * sizeof(*slots) + 7) & -8ULL);
+	hdr.str_len    = str_len;
+	hdr.size       = hdr.str_ofs + ((str_len + 7) & -8ULL);
+
+	/* running processes map the output file, so it must never be
+	 * rewritten in place but replaced.
+	 */
+	tmp = malloc(strlen(argv[1]) + 32);
+	if (!tmp)
+		die("out of memory\n");
+	sprintf(tmp, "%s.tmp.%d", argv[1], (int)getpid());
+	file = fopen(tmp, "w");
+	if (!file)
+		die("failed to create <%s> : %s\n", tmp, strerror(errno));
+
+	write_area(file, &hdr, sizeof(hdr));
+	write_area(file, ents, (uint64_t)nb_ents * sizeof(*ents));
+	write_area(file, disp, (uint64_t)hdr.nb_buckets * sizeof(*disp));
+	write_area(file, slots, (uint64_t)nb_keys * sizeof(*slots));
+	write_area(file, str, str_len);
+
+	if (fclose(file) != 0 || rename(tmp, argv[1]) != 0) {
+		unlink(tmp);
+		die("failed to write <%s> : %s\n", argv[1], strerror(errno));
+	}
+
+	if (!quiet)
+		printf("%u entries, %u keys, %llu bytes\n",
+		       nb_ents, nb_keys, (unsigned long long)hdr.size);
+	return 0;
+}
@@ -0,0 +1,325 @@
+/*
+ * libslz throughput benchmark
+ *
+ * Measures the speed of the CRC32 implementations and of the encoder on HTML
+ * and JSON corpora, either read from files or generated, and checks that the
+ * accelerated CRC32 implementation selected for this CPU gives the same
+ * results as the portable one.
+ *
+ * Build with :
+ *   make dev/slz/slz-bench
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* the static functions and the selected CRC32 function are needed */
+#include "../../src/slz.c"
+
+/* size of the generated corpora */
+#define GEN_SIZE (1024 * 1024)
+
+struct corpus {
+	const char *name;
+	unsigned char *data;
+	long len;
+};
+
+static const char *words[] = {
+	"the", "server", "request", "response", "content", "length", "cache",
+	"proxy", "header", "value", "stream", "connection", "buffer", "data",
+	"compression", "backend", "frontend", "timeout", "status", "error",
+	"user", "session", "token", "product", "price", "description", "page",
+};
+
+static unsigned int rnd_state = 2463534242U;
+
+/* xorshift32, to generate the same corpora on all runs */
+static unsigned int rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state;
+}
+
+static const char *rnd_word(void)
+{
+	return words[rnd() % (sizeof(words) / sizeof(*words))];
+}
+
+/* Generates an HTML page made of nested lists of links and paragraphs */
+static long gen_html(char *out, long size)
+{
+	long len = 0;
+	int i, n;
+
+	len += snprintf(out + len, size - len,
+	                "<!DOCTYPE html>\n<html lang=\"en\">\n<head><meta charset=\"utf-8\">"
+	                "<title>%s %s</title></head>\n<body>\n", rnd_word(), rnd_word());
+
+	while (len < size - 1024) {
+		len += snprintf(out + len, size - len, "<div class=\"%s-%s\">\n<ul>\n", rnd_word(), rnd_word());
+		for (i = rnd() % 8 + 1; i > 0; i--)
+			len += snprintf(out + len, size - len,
+			                "  <li><a href=\"/%s/%s/%u.html\" title=\"%s %s\">%s</a></li>\n",
+			                rnd_word(), rnd_word(), rnd() % 100000, rnd_word(), rnd_word(), rnd_word());
+		len += snprintf(out + len, size - len, "</ul>\n<p>");
+		for (n = rnd() % 40 + 10; n > 0; n--)
+			len += snprintf(out + len, size - len, "%s ", rnd_word());
+		len += snprintf(out + len, size - len, "</p>\n</div>\n");
+	}
+	len += snprintf(out + len, size - len, "</body>\n</html>\n");
+	return len;
+}
+
+/* Generates a JSON array of objects such as those returned by APIs */
+static long gen_json(char *out, long size)
+{
+	long len = 0;
+
+	len += snprintf(out + len, size - len, "[");
+	while (len < size - 1024) {
+		len += snprintf(out + len, size - len,
+		                "{\"id\":%u,\"name\":\"%s-%s\",\"%s\":%u.%02u,\"active\":%s,"
+		                "\"tags\":[\"%s\",\"%s\"],\"%s\":{\"%s\":\"%08x\",\"count\":%u}},\n",
+		                rnd() % 1000000, rnd_word(), rnd_word(), rnd_word(), rnd() % 1000, rnd() % 100,
+		                (rnd() & 1) ? "true" : "false", rnd_word(), rnd_word(),
+		                rnd_word(), rnd_word(), rnd(), rnd() % 100);
+	}
+	len += snprintf(out + len, size - len, "{}]\n");
+	return len;
+}
+
+static int load_file(struct corpus *c, const char *name)
+{
+	FILE *f;
+	long size = 0, ret;
+
+	f = fopen(name, "r");
+	if (!f) {
+		perror(name);
+		return 0;
+	}
+
+	c->name = name;
+	c->data = NULL;
+	c->len = 0;
+	do {
+		if (c->len == size) {
+			size = size ? size * 2 : GEN_SIZE;
+			c->data = realloc(c->data, size);
+			if (!c->data) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		ret = fread(c->data + c->len, 1, size - c->len, f);
+		c->len += ret;
+	} while (ret > 0);
+
+	fclose(f);
+	return 1;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Checks that the selected CRC32 function gives the same results as the
+ * portable one on all offsets and lengths of the beginning of the corpus, and
+ * on the whole corpus. Returns non-zero on success.
+ */
+static int check_crc(const struct corpus *c)
+{
+	int ofs, len;
+
+	for (ofs = 0; ofs < 64 && ofs < c->len; ofs++) {
+		for (len = 0; len < 1024 && ofs + len <= c->len; len++) {
+			if (slz_crc32_fct(0, c->data + ofs, len) != slz_crc32_by1(0, c->data + ofs, len) ||
+			    slz_crc32_fct(0x12345678, c->data + ofs, len) != slz_crc32_by1(0x12345678, c->data + ofs, len)) {
+				printf("%s: crc32 mismatch at offset %d, length %d\n", c->name, ofs, len);
+				return 0;
+			}
+		}
+	}
+
+	if (slz_crc32_fct(0, c->data, c->len) != slz_crc32_by4(0, c->data, c->len)) {
+		printf("%s: crc32 mismatch on the whole corpus\n", c->name);
+		return 0;
+	}
+	return 1;
+}
+
+/* Returns the throughput in MB/s of CRC32 function <fct> on corpus <c>,
+ * processed in blocks of <bsize> bytes <loops> times.
+ */
+static double bench_crc(uint32_t (*fct)(uint32_t, const unsigned char *, int),
+                        const struct corpus *c, long bsize, int loops)
+{
+	uint32_t crc = 0;
+	double start;
+	long ofs;
+	int l;
+
+	start = now();
+	for (l = 0; l < loops; l++)
+		for (ofs = 0; ofs < c->len; ofs += bsize)
+			crc = fct(crc, c->data + ofs, (c->len - ofs < bsize) ? c->len - ofs : bsize);
+
+	/* prevents the loop from being optimized away */
+	if (crc == 0x5a5a5a5a)
+		putchar(0);
+	return (double)c->len * loops / (now() - start) / 1e6;
+}
+
+/* Returns the throughput in MB/s of the encoder on corpus <c> in format <fmt>,
+ * fed by blocks of <bsize> bytes <loops> times, and sets <olen> to the size of
+ * the compressed output.
+ */
+static double bench_encode(const struct corpus *c, int fmt, long bsize, int loops, long *olen)
+{
+	struct slz_stream strm;
+	unsigned char *out;
+	double start;
+	long ofs, len;
+	int l;
+
+	/* the encoder may expand data by 5 bytes per 65535 plus the envelope */
+	out = malloc(bsize + bsize / 8 + 64);
+	if (!out) {
+		perror("malloc");
+		exit(1);
+	}
+
+	start = now();
+	for (l = 0; l < loops; l++) {
+		*olen = 0;
+		slz_init(&strm, 1, fmt);
+		for (ofs = 0; ofs < c->len; ofs += bsize) {
+			len = (c->len - ofs < bsize) ? c->len - ofs : bsize;
+			*olen += slz_encode(&strm, out, c->data + ofs, len, ofs + len < c->len);
+		}
+		*olen += slz_finish(&strm, out);
+	}
+	free(out);
+	return (double)c->len * loops / (now() - start) / 1e6;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-l loops] [-b bsize] [-f gzip|zlib|deflate] [file...]\n"
+	       "  -l loops : number of passes over each corpus (default 100)\n"
+	       "  -b bsize : size of the blocks passed to the encoder (default 16384)\n"
+	       "  -f fmt   : format to encode (default gzip)\n"
+	       "Without file, HTML and JSON corpora of %d kB are generated.\n",
+	       name, GEN_SIZE / 1024);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct corpus corpora[64];
+	int nbcorpora = 0;
+	int loops = 100, fmt = SLZ_FMT_GZIP;
+	long bsize = 16384, olen;
+	double crc_by4, crc_best, enc;
+	int opt, i, err = 0;
+
+	while ((opt = getopt(argc, argv, "l:b:f:h")) != -1) {
+		switch (opt) {
+		case 'l':
+			loops = atoi(optarg);
+			break;
+		case 'b':
+			bsize = atol(optarg);
+			break;
+		case 'f':
+			if (strcmp(optarg, "gzip") == 0)
+				fmt = SLZ_FMT_GZIP;
+			else if (strcmp(optarg, "zlib") == 0)
+				fmt = SLZ_FMT_ZLIB;
+			else if (strcmp(optarg, "deflate") == 0)
+				fmt = SLZ_FMT_DEFLATE;
+			else
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (loops <= 0 || bsize <= 0)
+		usage(argv[0]);
+
+	for (i = optind; i < argc && nbcorpora < sizeof(corpora) / sizeof(*corpora); i++)
+		nbcorpora += load_file(&corpora[nbcorpora], argv[i]);
+
+	if (optind == argc) {
+		corpora[0].name = "generated-html";
+		corpora[0].data = malloc(GEN_SIZE);
+		corpora[1].name = "generated-json";
+		corpora[1].data = malloc(GEN_SIZE);
+		if (!corpora[0].data || !corpora[1].data) {
+			perror("malloc");
+			exit(1);
+		}
+		corpora[0].len = gen_html((char *)corpora[0].data, GEN_SIZE);
+		corpora[1].len = gen_json((char *)corpora[1].data, GEN_SIZE);
+		nbcorpora = 2;
+	}
+
+	printf("crc32: %s\n",
+	       slz_crc32_fct == slz_crc32_by4 ? "portable" :
+#if defined(SLZ_HAVE_CRC32_CLMUL)
+	       slz_crc32_fct == slz_crc32_clmul ? "pclmul" :
+#elif defined(SLZ_HAVE_CRC32_ARMV8)
+	       slz_crc32_fct == slz_crc32_armv8 ? "armv8" :
+#endif
+	       "unknown");
+
+	printf("%-20s %10s %12s %12s %12s %7s\n",
+	       "corpus", "size", "crc32-by4", "crc32-best", "encode", "ratio");
+
+	for (i = 0; i < nbcorpora; i++) {
+		if (!check_crc(&corpora[i])) {
+			err = 1;
+			continue;
+		}
+
+		crc_by4  = bench_crc(slz_crc32_by4, &corpora[i], bsize, loops);
+		crc_best = bench_crc(slz_crc32_fct, &corpora[i], bsize, loops);
+		enc      = bench_encode(&corpora[i], fmt, bsize, loops, &olen);
+
+		printf("%-20s %10ld %7.0f MB/s %7.0f MB/s %7.0f MB/s %6.1f%%\n",
+		       corpora[i].name, corpora[i].len, crc_by4, crc_best, enc,
+		       corpora[i].len ? olen * 100.0 / corpora[i].len : 0.0);
+	}
+	return err;
+}
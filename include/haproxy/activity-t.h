@@ -122,6 +122,13 @@ struct activity {
 	unsigned int pool_fail;    // failed a pool allocation
 	unsigned int buf_wait;     // waited on a buffer allocation
 	unsigned int check_started;// number of times a check was started on this thread
+	unsigned int poll_saved;   // polling changes submitted along with the wait (io_uring)
+	unsigned int comp_offload; // compression jobs submitted to the compression threads
+	unsigned int comp_wait;    // streams waiting for a compression job slot
+	unsigned int crypto_offload;// private key operations submitted to the crypto threads
+	unsigned int crypto_inline;// private key operations not offloaded (not called from an async job)
+	unsigned int crypto_queue_us;// average queue time of the offloaded operations over last 1024 ones
+	unsigned int crypto_lat_us;// average latency of the offloaded operations over last 1024 ones
 #if defined(DEBUG_DEV)
 	/* keep these ones at the end */
 	unsigned int ctr0;         // general purposee debug counter
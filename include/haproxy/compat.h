@@ -337,6 +337,13 @@ typedef struct { } empty_t;
 #define queue _queue
 #endif
 
+/* recvmmsg() is available on Linux since glibc 2.12 and in musl, and on
+ * FreeBSD since 11.0.
+ */
+#if defined(__linux__) || (defined(__FreeBSD__) && __FreeBSD_version >= 1100000)
+#define HA_HAVE_RECVMMSG
+#endif
+
 /* Define a flag indicating if MPTCP is available */
 #ifdef __linux__
 #define HA_HAVE_MPTCP 1
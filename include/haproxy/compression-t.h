@@ -32,6 +32,14 @@
 #include <zlib.h>
 #endif
 
+#if defined(USE_ZSTD)
+#include <zstd.h>
+#endif
+
+#if defined(USE_BROTLI)
+#include <brotli/encode.h>
+#endif
+
 #include <haproxy/buf-t.h>
 
 /* Direction index */
@@ -44,10 +52,19 @@
 #define COMP_FL_OFFLOAD		0x00000001 /* Compression offload */
 #define COMP_FL_DIR_REQ		0x00000002 /* Compress requests */
 #define COMP_FL_DIR_RES		0x00000004 /* Compress responses */
+#define COMP_FL_DICT		0x00000008 /* Compression dictionary transport (RFC9842) */
+
+/* Length of the hash identifying a compression dictionary (SHA-256) */
+#define COMP_DICT_HASH_LEN	32
+
+/* Compression algorithm flags */
+
+#define COMP_ALGO_FL_THREADSAFE	0x00000001 /* add_data/flush/finish may run out of haproxy threads */
 
 struct comp {
 	struct comp_algo *algos_res; /* Algos available for response */
 	struct comp_algo *algo_req;  /* Algo to use for request */
+	struct comp_algo *algos_dict; /* Dictionary-based algos available for response */
 	struct comp_type *types_req; /* Types to be compressed for requests */
 	struct comp_type *types_res; /* Types to be compressed for responses */
 	unsigned int minsize_res;    /* Min response body size to be compressed */
@@ -69,9 +86,28 @@ struct comp_ctx {
 	void *zlib_pending_buf;
 	void *zlib_head;
 #endif
+#if defined(USE_ZSTD)
+	ZSTD_CCtx *zstd;        /* zstd stream, or NULL */
+	size_t zstd_mem;        /* memory accounted for <zstd> */
+#endif
+#if defined(USE_BROTLI)
+	BrotliEncoderState *brotli; /* brotli stream, or NULL */
+	size_t brotli_mem;          /* memory allocated for <brotli> */
+#endif
+	struct comp_dict *dict; /* dictionary owned by the context, or NULL */
+	int dict_hdr;           /* the dictionary header remains to be emitted */
 	int cur_lvl;
 };
 
+/* A dictionary for the dictionary-based content-codings, which is a previous
+ * response body identified by its hash (RFC9842).
+ */
+struct comp_dict {
+	size_t len;                             /* length of <data> */
+	unsigned char hash[COMP_DICT_HASH_LEN]; /* SHA-256 of <data> */
+	char data[VAR_ARRAY];
+};
+
 /* Thanks to MSIE/IIS, the "deflate" name is ambiguous, as according to the RFC
  * it's a zlib-wrapped deflate stream, but MSIE only understands a raw deflate
  * stream. For this reason some people prefer to emit a raw deflate stream on
@@ -90,7 +126,12 @@ struct comp_algo {
 	int (*flush)(struct comp_ctx *comp_ctx, struct buffer *out);
 	int (*finish)(struct comp_ctx *comp_ctx, struct buffer *out);
 	int (*end)(struct comp_ctx **comp_ctx);
+	unsigned int flags; /* COMP_ALGO_FL_* */
 	struct comp_algo *next;
+	/* only for the dictionary-based algorithms, which take ownership of
+	 * <dict> on success.
+	 */
+	int (*init_dict)(struct comp_ctx **comp_ctx, int level, struct comp_dict *dict);
 };
 
 struct comp_type {
@@ -29,10 +29,12 @@ extern unsigned int compress_min_idle;
 
 int comp_append_type(struct comp_type **types, const char *type);
 int comp_append_algo(struct comp_algo **algos, const char *algo);
+int comp_append_dict_algo(struct comp_algo **algos, const char *algo);
+const struct comp_algo *comp_get_algo(const char *name);
 
-#ifdef USE_ZLIB
+#if defined(USE_ZLIB) || defined(USE_ZSTD) || defined(USE_BROTLI)
 extern long zlib_used_memory;
-#endif /* USE_ZLIB */
+#endif /* USE_ZLIB || USE_ZSTD || USE_BROTLI */
 
 #endif /* _HAPROXY_COMP_H */
 
@@ -457,6 +457,23 @@
 #define DEFAULT_SSL_CTX_CACHE 1000
 #endif
 
+/* max number of resident SSL contexts loaded from lazy crt-lists */
+#ifndef DEFAULT_SSL_LAZY_CTX_CACHE
+#define DEFAULT_SSL_LAZY_CTX_CACHE 10000
+#endif
+
+/* record size used by dynamic record sizing at the beginning of a transfer.
+ * 1369 bytes fill a 1400-byte TCP segment once the TLS overhead is added.
+ */
+#ifndef DEFAULT_SSL_DYNREC_SIZE
+#define DEFAULT_SSL_DYNREC_SIZE 1369
+#endif
+
+/* idle time (ms) after which dynamic record sizing starts over */
+#ifndef DEFAULT_SSL_DYNREC_IDLE
+#define DEFAULT_SSL_DYNREC_IDLE 1000
+#endif
+
 /* approximate stream size (for maxconn estimate) */
 #ifndef STREAM_MAX_COST
 #define STREAM_MAX_COST (sizeof(struct stream) + \
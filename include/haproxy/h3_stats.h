@@ -12,6 +12,10 @@ struct h3_counters;
 
 void h3_inc_err_cnt(void *ctx, int error_code);
 void h3_inc_frame_type_cnt(struct h3_counters *ctrs, int frm_type);
+void h3_add_qpack_tbl_cnt(struct h3_counters *ctrs, int enc, unsigned int ins, unsigned int evict);
+void h3_add_qpack_enc_bytes(struct h3_counters *ctrs, unsigned long long raw, unsigned long long enc);
+void h3_inc_qpack_blocked_cnt(struct h3_counters *ctrs);
+void h3_add_data_sent_cnt(struct h3_counters *ctrs, int urg, unsigned long long bytes);
 
 #endif /* USE_QUIC */
 #endif /* _HAPROXY_H3_STATS_H */
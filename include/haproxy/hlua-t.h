@@ -257,6 +257,8 @@ struct hlua_patref_iterator_context {
 	struct bref bref;       /* back-reference from the pat_ref_elt being accessed
 	                         * during listing */
 	struct pat_ref_gen *gen; /* the generation we are iterating over */
+	const struct mapsnap *snap; /* snapshot being iterated over, or NULL */
+	unsigned int snap_idx;  /* next snapshot entry */
 };
 
 #else /* USE_LUA */
@@ -32,10 +32,20 @@
 #include <import/ist.h>
 #include <haproxy/api.h>
 #include <haproxy/buf-t.h>
+#include <haproxy/hpack-tbl-t.h>
 #include <haproxy/http-t.h>
 
+/* return values for hpack_encode_header_dht() */
+enum {
+	HPACK_ENC_FAIL = 0,           /* not enough room in the output buffer */
+	HPACK_ENC_DONE,               /* field emitted, table unchanged */
+	HPACK_ENC_INSERT,             /* field emitted, must be inserted into the table */
+};
+
 int hpack_encode_header(struct buffer *out, const struct ist n,
 			const struct ist v);
+int hpack_encode_header_dht(struct buffer *out, const struct hpack_dht *dht,
+                            const struct ist n, const struct ist v, int *saved);
 
 /* Returns the number of bytes required to encode the string length <len>. The
  * number of usable bits is an integral multiple of 7 plus 6 for the last byte.
@@ -79,6 +89,56 @@ static inline int hpack_encode_len(char *out, int pos, int len)
 	return pos;
 }
 
+/* Returns the number of bytes required to encode integer <val> using an
+ * <bits>-bit prefix (RFC7541#5.1). <bits> must be between 1 and 8.
+ */
+static inline int hpack_int_to_bytes(int bits, uint32_t val)
+{
+	uint32_t max = (1U << bits) - 1;
+	int bytes = 1;
+
+	if (val < max)
+		return bytes;
+
+	for (val -= max, bytes++; val >= 128; val >>= 7)
+		bytes++;
+	return bytes;
+}
+
+/* Encodes integer <val> using an <bits>-bit prefix into <out>+<pos>, with the
+ * upper bits of the first byte set to <opcode>, and returns the new position.
+ * The caller is responsible for checking for available room using
+ * hpack_int_to_bytes() first.
+ */
+static inline int hpack_encode_int(char *out, int pos, uint8_t opcode, int bits, uint32_t val)
+{
+	uint32_t max = (1U << bits) - 1;
+
+	if (val < max) {
+		out[pos++] = opcode | val;
+		return pos;
+	}
+
+	out[pos++] = opcode | max;
+	for (val -= max; val >= 128; val >>= 7)
+		out[pos++] = val | 128;
+	out[pos++] = val;
+	return pos;
+}
+
+/* Tries to encode a dynamic table size update (RFC7541#6.3) announcing <size>
+ * into the aligned buffer <out>. Returns non-zero on success, 0 on failure
+ * (buffer full).
+ */
+static inline int hpack_encode_dtsu(struct buffer *out, uint32_t size)
+{
+	if (out->data + hpack_int_to_bytes(5, size) > out->size)
+		return 0;
+
+	out->data = hpack_encode_int(out->area, out->data, 0x20, 5, size);
+	return 1;
+}
+
 /* Tries to encode header field index <idx> with short value <val> into the
  * aligned buffer <out>. Returns non-zero on success, 0 on failure (buffer
  * full). The caller is responsible for ensuring that the length of <val> is
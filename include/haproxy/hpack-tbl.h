@@ -51,6 +51,7 @@ extern struct pool_head *pool_head_hpack_tbl;
 
 int __hpack_dht_make_room(struct hpack_dht *dht, unsigned int needed);
 int hpack_dht_insert(struct hpack_dht *dht, struct ist name, struct ist value);
+int hpack_dht_resize(struct hpack_dht *dht, uint32_t size);
 
 #ifdef DEBUG_HPACK
 void hpack_dht_dump(FILE *out, const struct hpack_dht *dht);
@@ -59,6 +59,7 @@ char *http_extract_cookie_value(char *hdr, const char *hdr_end,
 char *http_extract_next_cookie_name(char *hdr_beg, char *hdr_end, int is_req,
                                     char **ptr, size_t *len);
 int http_parse_qvalue(const char *qvalue, const char **end);
+int http_parse_priority(const struct ist value, int *urg, int *incr);
 const char *http_find_url_param_pos(const char **chunks,
                                     const char* url_param_name,
                                     size_t url_param_name_l, char delim, char insensitive);
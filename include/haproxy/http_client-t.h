@@ -38,6 +38,7 @@ struct httpclient {
 #ifdef USE_OPENSSL
 	struct server *srv_ssl;               /* server for SSL connections */
 #endif
+	struct server *srv;                   /* server used instead of the proxy's ones, or NULL */
 };
 
 /* Action (FA) to do */
@@ -44,6 +44,7 @@ struct xprt_ops;
 struct proxy;
 struct fe_counters;
 struct connection;
+struct ssl_lazy_index;
 
 /* listener state */
 enum li_state {
@@ -178,6 +179,7 @@ struct bind_conf {
 	struct eb_root sni_ctx;    /* sni_ctx tree of all known certs full-names sorted by name */
 	struct eb_root sni_w_ctx;  /* sni_ctx tree of all known certs wildcards sorted by name */
 	struct tls_keys_ref *keys_ref; /* TLS ticket keys reference */
+	struct ssl_lazy_index *lazy_crt; /* certificates loaded on demand (crt-list-lazy), or NULL */
 
 	char *ca_sign_file;        /* CAFile used to generate and sign server certificates */
 	char *ca_sign_pass;        /* CAKey passphrase */
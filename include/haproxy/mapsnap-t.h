@@ -0,0 +1,68 @@
+#ifndef _HAPROXY_MAPSNAP_T_H
+#define _HAPROXY_MAPSNAP_T_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/* A snapshot is the result of the compilation of a pattern file by
+ * dev/mapsnap/mapsnap. It is mapped read-only in memory and used as is, so
+ * that neither parsing nor allocation is needed at load time, and all
+ * processes using it share the same pages from the page cache. It is made of
+ * a header followed by four areas whose offsets are relative to the beginning
+ * of the file and aligned to 8 bytes :
+ *   - the entries, in the order of the source file, including duplicate keys
+ *   - the displacement of each bucket of the perfect hash of the keys
+ *   - the slots of the perfect hash, one per distinct key
+ *   - the zero-terminated keys and values, ending with a zero
+ * All integers are stored in the native byte order of the machine which
+ * compiled the file, which must match the one loading it.
+ */
+#define MAPSNAP_MAGIC      "HAPMSNAP"  /* 8 bytes, no trailing zero */
+#define MAPSNAP_VERSION    1
+#define MAPSNAP_ENDIAN     0x01020304  /* reads differently on another endianness */
+
+/* snapshot flags */
+#define MAPSNAP_F_SMP      0x00000001  /* two-column file: entries have a value */
+
+struct mapsnap_hdr {
+	char magic[8];         /* MAPSNAP_MAGIC */
+	uint32_t version;      /* MAPSNAP_VERSION */
+	uint32_t endian;       /* MAPSNAP_ENDIAN */
+	uint32_t flags;        /* MAPSNAP_F_* */
+	uint32_t nb_ents;      /* number of entries */
+	uint32_t nb_keys;      /* number of distinct keys, and of hash slots */
+	uint32_t nb_buckets;   /* number of hash buckets */
+	uint64_t seed;         /* hash seed */
+	uint64_t ents_ofs;     /* struct mapsnap_ent[nb_ents] */
+	uint64_t disp_ofs;     /* uint32_t[nb_buckets] */
+	uint64_t slots_ofs;    /* struct mapsnap_slot[nb_keys] */
+	uint64_t str_ofs;      /* strings */
+	uint64_t str_len;      /* length of the strings area */
+	uint64_t size;         /* total size of the file */
+};
+
+/* one line of the source file */
+struct mapsnap_ent {
+	uint64_t key;          /* offset of the key in the strings area */
+	uint64_t val;          /* offset of the value in the strings area */
+	uint32_t klen;         /* length of the key */
+	uint32_t line;         /* line number in the source file */
+};
+
+/* a slot of the perfect hash, referencing the first entry of a key */
+struct mapsnap_slot {
+	uint32_t ent;          /* entry number */
+	uint32_t check;        /* upper 32 bits of the hash of the key */
+};
+
+/* a snapshot mapped in memory */
+struct mapsnap {
+	const struct mapsnap_hdr *hdr;    /* start of the mapping */
+	const struct mapsnap_ent *ents;
+	const uint32_t *disp;
+	const struct mapsnap_slot *slots;
+	const char *str;
+	unsigned int gen_id;              /* generation of the entries in their reference */
+};
+
+#endif /* _HAPROXY_MAPSNAP_T_H */
@@ -0,0 +1,70 @@
+#ifndef _HAPROXY_MAPSNAP_H
+#define _HAPROXY_MAPSNAP_H
+
+#include <string.h>
+
+#include <haproxy/mapsnap-t.h>
+#include <haproxy/xxhash.h>
+
+/* The perfect hash of the keys is the same as the one built for large string
+ * trees: keys are hashed with XXH3 and a seed, the upper 32 bits of the hash
+ * select a bucket, and the whole hash combined with the bucket's displacement
+ * selects a slot.
+ */
+
+/* Returns the slot of a key of hash <hash> for displacement <disp> in a table
+ * of <nb_keys> slots.
+ */
+static inline uint32_t mapsnap_hash_pos(uint64_t hash, uint32_t disp, uint32_t nb_keys)
+{
+	return (hash ^ (disp * 0x9E3779B97F4A7C15ULL)) % nb_keys;
+}
+
+/* Returns the bucket of a key of hash <hash> among <nb_buckets> */
+static inline uint32_t mapsnap_hash_bucket(uint64_t hash, uint32_t nb_buckets)
+{
+	return ((hash >> 32) * nb_buckets) >> 32;
+}
+
+/* Returns the key of entry <ent> of snapshot <snap> */
+static inline const char *mapsnap_key(const struct mapsnap *snap, const struct mapsnap_ent *ent)
+{
+	return snap->str + ent->key;
+}
+
+/* Returns the value of entry <ent> of snapshot <snap>, or NULL if the snapshot
+ * has no values.
+ */
+static inline const char *mapsnap_val(const struct mapsnap *snap, const struct mapsnap_ent *ent)
+{
+	return (snap->hdr->flags & MAPSNAP_F_SMP) ? snap->str + ent->val : NULL;
+}
+
+/* Returns the first entry of snapshot <snap> whose key is <key> of length
+ * <len>, which must be zero-terminated, or NULL if there is none.
+ */
+static inline const struct mapsnap_ent *mapsnap_lookup(const struct mapsnap *snap, const char *key, size_t len)
+{
+	const struct mapsnap_hdr *hdr = snap->hdr;
+	const struct mapsnap_slot *slot;
+	const struct mapsnap_ent *ent;
+	uint64_t hash;
+
+	if (!hdr->nb_keys)
+		return NULL;
+
+	hash = XXH3(key, len, hdr->seed);
+	slot = &snap->slots[mapsnap_hash_pos(hash, snap->disp[mapsnap_hash_bucket(hash, hdr->nb_buckets)], hdr->nb_keys)];
+	if (slot->check != (uint32_t)(hash >> 32))
+		return NULL;
+
+	ent = &snap->ents[slot->ent];
+	if (ent->klen != len || memcmp(mapsnap_key(snap, ent), key, len) != 0)
+		return NULL;
+	return ent;
+}
+
+int mapsnap_open(int fd, const char *path, struct mapsnap **snap, char **err);
+void mapsnap_close(struct mapsnap *snap);
+
+#endif /* _HAPROXY_MAPSNAP_H */
@@ -136,6 +136,10 @@ static forceinline char *h2c_show_flags(char *buf, size_t len, const char *delim
 #define H2_SF_MORE_HTX_DATA     0x00200000  // more data expected from HTX
 #define H2_SF_EXPECT_RXDATA     0x00400000  // more data expected from the peer
 
+/* list the stream is queued on when attached, send_list if none of these */
+#define H2_SF_IN_FCTL_LIST      0x00800000  // the stream is queued on the fctl_list
+#define H2_SF_IN_BLK_LIST       0x01000000  // the stream is queued on the blocked_list
+
 
 /* This function is used to report flags in debugging tools. Please reflect
  * below any single-bit flag addition above in the same order via the
@@ -153,7 +157,8 @@ static forceinline char *h2s_show_flags(char *buf, size_t len, const char *delim
 	_(H2_SF_BODY_TUNNEL, _(H2_SF_NOTIFIED, _(H2_SF_HEADERS_SENT,
 	_(H2_SF_OUTGOING_DATA, _(H2_SF_HEADERS_RCVD, _(H2_SF_WANT_SHUTR,
 	_(H2_SF_WANT_SHUTW, _(H2_SF_EXT_CONNECT_SENT, _(H2_SF_EXT_CONNECT_RCVD,
-	_(H2_SF_TUNNEL_ABRT, _(H2_SF_MORE_HTX_DATA, _(H2_SF_EXPECT_RXDATA))))))))))))))))))))));
+	_(H2_SF_TUNNEL_ABRT, _(H2_SF_MORE_HTX_DATA, _(H2_SF_EXPECT_RXDATA,
+	_(H2_SF_IN_FCTL_LIST, _(H2_SF_IN_BLK_LIST))))))))))))))))))))))));
 	/* epilogue */
 	_(~0U);
 	return buf;
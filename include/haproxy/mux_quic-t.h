@@ -152,6 +152,8 @@ struct qcs {
 	struct sedesc *sd;
 	uint32_t flags;      /* QC_SF_* */
 	enum qcs_state st;   /* QC_SS_* state */
+	uint8_t urg;         /* RFC9218 urgency (0..7) */
+	uint8_t incr;        /* RFC9218 incremental flag (0 or 1) */
 	void *ctx;           /* app-ops context */
 
 	struct {
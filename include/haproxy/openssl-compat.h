@@ -455,6 +455,11 @@ static inline unsigned long ERR_peek_error_func(const char **func)
 #define TLS_TICKET_HASH_FUNCT EVP_sha256
 #endif /* OPENSSL_NO_SHA256 */
 
+/* BoringSSL and AWS-LC report a retried certificate selection callback this way */
+#if !defined(SSL_ERROR_WANT_CLIENT_HELLO_CB) && defined(SSL_ERROR_PENDING_CERTIFICATE)
+#define SSL_ERROR_WANT_CLIENT_HELLO_CB SSL_ERROR_PENDING_CERTIFICATE
+#endif
+
 #ifndef SSL_OP_CIPHER_SERVER_PREFERENCE                 /* needs OpenSSL >= 0.9.7 */
 #define SSL_OP_CIPHER_SERVER_PREFERENCE 0
 #endif
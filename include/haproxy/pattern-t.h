@@ -27,6 +27,7 @@
 
 #include <haproxy/api-t.h>
 #include <haproxy/event_hdl-t.h>
+#include <haproxy/mapsnap-t.h>
 #include <haproxy/regex-t.h>
 #include <haproxy/sample_data-t.h>
 #include <haproxy/thread-t.h>
@@ -72,6 +73,7 @@ enum {
 enum {
 	PAT_SF_TREE        = 1 << 0,       /* some patterns are arranged in a tree */
 	PAT_SF_REGFREE     = 1 << 1,       /* run regex_free() on the pointer */
+	PAT_SF_SNAP        = 1 << 2,       /* pattern found in a snapshot, without ref */
 };
 
 /* ACL match methods */
@@ -120,6 +122,8 @@ struct pat_ref {
 	int unique_id; /* Each pattern reference have unique id. */
 	unsigned long long revision; /* updated for each update */
 	unsigned long long entry_cnt; /* the total number of entries */
+	unsigned long long removals; /* number of entry removals, which invalidate indexes */
+	struct mapsnap *snap; /* read-only entries loaded from a snapshot, or NULL */
 	THREAD_ALIGN();
 	__decl_thread(HA_RWLOCK_T lock); /* Lock used to protect pat ref elements */
 	event_hdl_sub_list e_subs;       /* event_hdl: pat_ref's subscribers list (atomically updated) */
@@ -199,6 +203,133 @@ struct pattern {
 	struct pat_ref_elt *ref;
 };
 
+/* One node of the Aho-Corasick automaton used to look up substrings and
+ * suffixes. Children are chained as a list of siblings, except for the
+ * root's which are directly indexed. Ranks are the position of a pattern in
+ * the expression's list plus one, so that 0 means "none".
+ */
+struct pat_acm_node {
+	uint32_t child;    /* first child, 0 if none */
+	uint32_t next;     /* next sibling, 0 if none */
+	uint32_t fail;     /* node of the longest proper suffix, 0 for the root */
+	uint32_t best;     /* lowest rank of patterns ending here or along <fail>,
+	                    * or only here for regex literals */
+	unsigned char c;   /* byte leading to this node */
+};
+
+/* Aho-Corasick automaton indexing the string patterns of an expression. It
+ * is built from the patterns of a single generation, and is only used as
+ * long as the reference's revision and current generation are those it was
+ * built for. Otherwise the pattern list is walked until it gets rebuilt.
+ * For regex patterns, it indexes a literal string each regex requires, and
+ * only serves to select the regex which are worth running.
+ */
+struct pat_acm {
+	struct pat_acm_node *nodes;  /* node 0 is the root, NULL when not built */
+	uint32_t *root;              /* 256 transitions from the root, 0 if none */
+	struct pattern **pats;       /* patterns indexed by rank - 1 */
+	uint32_t *same;              /* regex: next rank with the same literal, by rank - 1 */
+	uint32_t *dict;              /* regex: next node along <fail> ending a literal, by node */
+	long *always;                /* regex: bitmap of the ranks - 1 without a literal */
+	uint32_t nb_nodes;           /* number of nodes */
+	uint32_t nb_pats;            /* number of patterns */
+	int reg;                     /* indexes regex literals */
+	unsigned long long revision; /* reference's revision it was built for */
+	unsigned int gen_id;         /* generation it was built for */
+	unsigned int next_build;     /* date before which no rebuild may happen */
+};
+
+/* Number of address bits covered by a node of the IP prefix trie, so that
+ * its slots fit in a 64-bit map.
+ */
+#define PAT_LPM_STRIDE 6
+
+/* Set on trie entries designating a node instead of a leaf */
+#define PAT_LPM_NODE   0x80000000U
+
+/* Node of the compressed multibit trie used to look up IP prefixes, covering
+ * PAT_LPM_STRIDE bits of the address. Slot <i> leads to another node if bit
+ * <i> of <children> is set, otherwise to a leaf. Children are stored
+ * contiguously from <node_base>. Consecutive slots with the same leaf share it,
+ * so bit <i> of <leaves> is set when slot <i> holds a different leaf than the
+ * previous leaf slot. Leaves are stored contiguously from <leaf_base>.
+ */
+struct pat_lpm_node {
+	uint64_t children;   /* slots leading to a node */
+	uint64_t leaves;     /* slots starting a new leaf */
+	uint32_t node_base;  /* index of the first child node */
+	uint32_t leaf_base;  /* index of the first leaf */
+};
+
+/* Longest prefix match table for one address family. The first <dbits> bits
+ * of the address index <direct>, whose entries are either a leaf or, when
+ * PAT_LPM_NODE is set, the index of a node. A leaf is an index in <elts> plus
+ * one, 0 meaning that no prefix matches.
+ */
+struct pat_lpm_tbl {
+	uint32_t *direct;            /* 1 << <dbits> entries, NULL when not built */
+	struct pat_lpm_node *nodes;  /* trie nodes */
+	uint32_t *leaves;            /* leaves referenced by the nodes */
+	struct pattern_tree **elts;  /* tree entries indexed by leaf - 1 */
+	uint32_t nb_nodes;           /* number of nodes */
+	uint32_t nb_leaves;          /* number of leaves */
+	uint32_t nb_elts;            /* number of distinct prefixes */
+	int dbits;                   /* number of bits directly indexed */
+};
+
+struct pat_lpm_job;
+
+/* Index of the IPv4 and IPv6 prefix trees of an expression, built from the
+ * entries of a single generation. As for the automaton above, it is only used
+ * as long as the reference's revision and current generation are those it was
+ * built for. Otherwise the trees are looked up until <task> rebuilds it.
+ */
+struct pat_lpm {
+	struct pat_lpm_tbl v4;       /* IPv4 prefixes */
+	struct pat_lpm_tbl v6;       /* IPv6 prefixes */
+	struct task *task;           /* task rebuilding it when outdated */
+	struct pat_lpm_job *job;     /* rebuild in progress, or NULL */
+	unsigned long long revision; /* reference's revision it was built for */
+	unsigned int gen_id;         /* generation it was built for */
+	unsigned int next_build;     /* date before which no rebuild may happen */
+};
+
+/* Slot of the perfect hash of exact strings. <check> holds the upper bits of
+ * the key's hash so that most misses are detected without reading the entry.
+ */
+struct pat_phash_slot {
+	struct pattern_tree *elt;    /* tree entry holding the key */
+	uint32_t check;              /* upper 32 bits of the key's hash */
+};
+
+struct pat_phash_job;
+
+/* Minimal perfect hash of the exact string tree of an expression, built from
+ * the entries of a single generation. Keys are spread over <nb_buckets>
+ * buckets, and those of bucket <b> are placed in <slots> at positions derived
+ * from their hash and from displacement <disp[b]>, chosen so that no two keys
+ * share a slot. The tree entries remain referenced, so that "set map" applies
+ * to it. It is fully usable while the reference's revision and current
+ * generation are those it was built for. If entries were only added since,
+ * the keys it holds are still valid but misses must be checked in the tree,
+ * until <task> rebuilds it.
+ */
+struct pat_phash {
+	uint32_t *disp;                 /* displacement of each bucket, NULL when not built */
+	struct pat_phash_slot *slots;   /* one slot per key */
+	uint32_t nb_keys;               /* number of distinct keys */
+	uint32_t nb_buckets;            /* number of buckets */
+	uint64_t seed;                  /* hash seed */
+	struct task *task;              /* task rebuilding it when outdated */
+	struct pat_phash_job *job;      /* rebuild in progress, or NULL */
+	unsigned long long revision;    /* reference's revision it was built for */
+	unsigned long long removals;    /* reference's removals it was built for */
+	unsigned int gen_id;            /* generation it was built for */
+	unsigned int next_build;        /* date before which no rebuild may happen */
+	unsigned long long lookup_ns;   /* total time of the sampled lookups */
+	unsigned long long lookups;     /* number of sampled lookups */
+};
+
 /* This struct is just used for chaining patterns */
 struct pattern_list {
 	void *from_ref;    // pattern_tree linked from pat_ref_elt, ends with NULL
@@ -223,6 +354,9 @@ struct pattern_expr {
 	struct list patterns;         /* list of acl_patterns */
 	struct eb_root pattern_tree;  /* may be used for lookup in large datasets */
 	struct eb_root pattern_tree_2;  /* may be used for different types */
+	struct pat_acm *acm;          /* automaton for sub/end/reg lookups, or NULL */
+	struct pat_lpm *lpm;          /* index of the IP trees, or NULL */
+	struct pat_phash *phash;      /* perfect hash of the string tree, or NULL */
 	int mflags;                     /* flags relative to the parsing or matching method. */
 	uint32_t refcount;            /* refcount used to know if the expr can be deleted or not */
 	__decl_thread(HA_RWLOCK_T lock);               /* lock used to protect patterns */
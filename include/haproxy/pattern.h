@@ -78,6 +78,7 @@ int pat_idx_list_regm(struct pattern_expr *expr, struct pattern *pat, char **err
 int pat_idx_tree_ip(struct pattern_expr *expr, struct pattern *pat, char **err);
 int pat_idx_tree_str(struct pattern_expr *expr, struct pattern *pat, char **err);
 int pat_idx_tree_pfx(struct pattern_expr *expr, struct pattern *pat, char **err);
+int pat_idx_acm_str(struct pattern_expr *expr, struct pattern *pat, char **err);
 
 /*
  *
@@ -197,6 +198,8 @@ int pat_ref_push(struct pat_ref_elt *elt, struct pattern_expr *expr, int patflag
 int pat_ref_add(struct pat_ref *ref, const char *pattern, const char *sample, char **err);
 int pat_ref_set(struct pat_ref *ref, const char *pattern, const char *sample, char **err);
 int pat_ref_set_elt_duplicate(struct pat_ref *ref, struct pat_ref_elt *elt, const char *value, char **err);
+void pat_ref_show_index(struct pat_ref *ref, struct buffer *out);
+int pat_ref_snap_holds(const struct pat_ref *ref, unsigned int gen_id, const char *key);
 int pat_ref_gen_set(struct pat_ref *ref, unsigned int gen_id, const char *key, const char *value, char **err);
 int pat_ref_set_by_id(struct pat_ref *ref, struct pat_ref_elt *refelt, const char *value, char **err);
 int pat_ref_delete(struct pat_ref *ref, const char *key);
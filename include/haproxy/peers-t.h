@@ -31,6 +31,7 @@
 
 #include <haproxy/api-t.h>
 #include <haproxy/dict-t.h>
+#include <haproxy/freq_ctr-t.h>
 #include <haproxy/stick_table-t.h>
 #include <haproxy/thread-t.h>
 
@@ -169,6 +170,14 @@ struct peer {
 	uint32_t new_conn;            /* new connection after reconnection timeout expiration counter */
 	uint32_t proto_err;           /* protocol errors counter */
 	uint32_t coll;                /* connection collisions counter */
+	uint32_t ssl_sess_tx;         /* TLS sessions sent counter */
+	uint32_t ssl_sess_rx;         /* TLS sessions received counter */
+	uint32_t ssl_sess_drop;       /* TLS sessions evicted from the queue before being sent */
+	uint32_t ssl_keys_tx;         /* TLS ticket keys sent counter */
+	uint32_t ssl_keys_rx;         /* TLS ticket keys received and applied counter */
+	unsigned int ssl_sess_pushed; /* sequence number of the last TLS session sent */
+	unsigned int ssl_keys_pushed; /* version of the last TLS ticket keys sent */
+	struct freq_ctr ssl_tx_rate;  /* bytes of TLS sessions sent per second */
 	struct appctx *appctx;        /* the appctx running it */
 	struct shared_table *remote_table;
 	struct shared_table *last_local_table; /* Last table that emit update messages during a teach process */
@@ -234,6 +243,31 @@ struct dcache {
 	size_t max_entries;
 };
 
+/* flags for the "ssl-sync" peers section keyword */
+#define PEERS_SSL_SYNC_SESS      0x00000001 /* replicate new TLS sessions */
+#define PEERS_SSL_SYNC_TLSKEYS   0x00000002 /* synchronize TLS ticket keys */
+
+/* one TLS session queued for replication */
+struct peers_ssl_sess {
+	unsigned int seq;             /* sequence number of this entry */
+	unsigned int len;             /* length of <data> */
+	unsigned char *data;          /* padded session id followed by the ASN1 encoded session */
+};
+
+/* TLS sessions and ticket keys replication settings and state */
+struct peers_ssl_sync {
+	struct peers *peers;          /* peers section carrying the sync, NULL if disabled */
+	unsigned int flags;           /* PEERS_SSL_SYNC_* */
+	unsigned int max_rate;        /* per-peer bandwidth limit in bytes per second (0=none) */
+	unsigned int rotate;          /* TLS ticket keys rotation interval in ms (0=none) */
+	unsigned int qsize;           /* number of sessions in the queue */
+	unsigned int seq;             /* sequence number of the last queued session */
+	unsigned int keys_ver;        /* incremented on each local TLS ticket keys update */
+	struct peers_ssl_sess *queue; /* ring of the last <qsize> sessions */
+	struct task *rotate_task;     /* task rotating the TLS ticket keys */
+	__decl_thread(HA_SPINLOCK_T lock); /* protects the queue */
+};
+
 struct peers_keyword {
 	const char *kw;
 	int (*parse)(
@@ -39,6 +39,10 @@ int peers_alloc_dcache(struct peers *peers);
 int peers_register_table(struct peers *, struct stktable *table);
 void peers_setup_frontend(struct proxy *fe);
 void peers_register_keywords(struct peers_kw_list *pkwl);
+#ifdef USE_OPENSSL
+void peers_ssl_sess_push(const unsigned char *sid, const unsigned char *data, int len);
+void peers_ssl_tlskeys_updated(void);
+#endif
 
 #endif /* _HAPROXY_PEERS_H */
 
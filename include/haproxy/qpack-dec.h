@@ -22,6 +22,7 @@
 #define _HAPROXY_QPACK_DEC_H
 
 #include <inttypes.h>
+#include <sys/types.h>
 
 struct buffer;
 struct http_hdr;
@@ -37,19 +38,32 @@ enum {
 	QPACK_RET_TRUNCATED, /* truncated stream */
 	QPACK_RET_HUFFMAN,   /* huffman decoding error */
 	QPACK_RET_TOO_LARGE, /* decoded request/response is too large */
+	QPACK_RET_BLOCKED,   /* field section references entries not received yet */
 };
 
+struct qpack_dht;
+struct qpack_enc;
+
 struct qpack_dec {
+	/* Dynamic table, NULL until the encoder sets a non-null capacity */
+	struct qpack_dht *dht;
+	/* Advertised SETTINGS_QPACK_MAX_TABLE_CAPACITY */
+	uint64_t max_cap;
 	/* Insert count */
 	uint64_t ic;
 	/* Known received count */
 	uint64_t krc;
+	/* Insertions and evictions not yet reported to the stats */
+	unsigned int st_ins;
+	unsigned int st_evict;
 };
 
-int qpack_decode_fs(const unsigned char *buf, uint64_t len, struct buffer *tmp,
-                    struct http_hdr *list, int list_size);
-int qpack_decode_enc(struct buffer *buf, int fin, void *ctx);
-int qpack_decode_dec(struct buffer *buf, int fin, void *ctx);
+int qpack_decode_fs(struct qpack_dec *dec, const unsigned char *buf, uint64_t len,
+                    struct buffer *tmp, struct http_hdr *list, int list_size,
+                    uint64_t *ric);
+ssize_t qpack_decode_enc(struct qpack_dec *dec, struct buffer *buf, int fin);
+ssize_t qpack_decode_dec(struct qpack_enc *enc, struct buffer *buf, int fin);
+void qpack_dec_release(struct qpack_dec *dec);
 
 int qpack_err_decode(const int value);
 
@@ -3,8 +3,46 @@
 
 #include <haproxy/http-t.h>
 #include <haproxy/istbuf.h>
+#include <haproxy/list-t.h>
 
 struct buffer;
+struct qpack_dht;
+
+/* Maximum number of field sections referencing the dynamic table which may
+ * remain unacknowledged by the peer decoder. Beyond this, new field sections
+ * are encoded without dynamic table references.
+ */
+#define QPACK_ENC_MAX_SECTIONS 64
+
+/* A field section emitted with dynamic table references, which remains pinned
+ * until the peer decoder acknowledges it or cancels its stream.
+ */
+struct qpack_enc_sec {
+	struct list list;  /* element of qpack_enc <sections>, oldest first */
+	uint64_t id;       /* stream ID */
+	uint64_t ric;      /* Required Insert Count, 0 if no reference */
+	uint64_t min;      /* smallest absolute index referenced */
+};
+
+/* QPACK encoder context, one per connection. Only entries acknowledged by the
+ * peer decoder are referenced so that its streams are never blocked.
+ */
+struct qpack_enc {
+	struct qpack_dht *dht;     /* dynamic table, NULL when not in use */
+	struct buffer *ins;        /* encoder stream buffer for the current section, or NULL */
+	struct qpack_enc_sec *sec; /* field section being encoded, or NULL */
+	struct list sections;      /* unacknowledged field sections */
+	uint64_t max_cap;          /* peer SETTINGS_QPACK_MAX_TABLE_CAPACITY */
+	uint64_t ic;               /* insert count */
+	uint64_t krc;              /* known received count */
+	uint64_t base;             /* Base of the field section being encoded */
+	unsigned int nb_sections;  /* number of elements in <sections> */
+	/* activity not yet reported to the stats */
+	unsigned int st_ins;       /* dynamic table insertions */
+	unsigned int st_evict;     /* dynamic table evictions */
+	unsigned long long st_raw; /* size of header fields before encoding */
+	unsigned long long st_enc; /* size of the encoded header fields */
+};
 
 int qpack_encode_field_section_line(struct buffer *out);
 int qpack_encode_int_status(struct buffer *out, unsigned int status);
@@ -14,4 +52,22 @@ int qpack_encode_path(struct buffer *out, const struct ist path);
 int qpack_encode_auth(struct buffer *out, const struct ist auth);
 int qpack_encode_header(struct buffer *out, const struct ist n, const struct ist v);
 
+void qpack_enc_init(struct qpack_enc *enc);
+void qpack_enc_release(struct qpack_enc *enc);
+int qpack_enc_set_capacity(struct qpack_enc *enc, uint64_t max_cap, uint32_t cap,
+                           struct buffer *ins);
+void qpack_enc_start_section(struct qpack_enc *enc, struct buffer *ins);
+int qpack_encode_header_dht(struct qpack_enc *enc, struct buffer *out,
+                            const struct ist n, const struct ist v);
+int qpack_enc_end_section(struct qpack_enc *enc, struct buffer *out);
+void qpack_enc_commit_section(struct qpack_enc *enc, uint64_t id);
+
+int qpack_enc_section_ack(struct qpack_enc *enc, uint64_t id);
+void qpack_enc_stream_cancel(struct qpack_enc *enc, uint64_t id);
+int qpack_enc_insert_count_inc(struct qpack_enc *enc, uint64_t inc);
+
+int qpack_encode_section_ack(struct buffer *out, uint64_t id);
+int qpack_encode_stream_cancel(struct buffer *out, uint64_t id);
+int qpack_encode_insert_count_inc(struct buffer *out, uint64_t inc);
+
 #endif /* QPACK_ENC_H_ */
@@ -50,6 +50,7 @@ extern struct pool_head *pool_head_qpack_tbl;
 
 int __qpack_dht_make_room(struct qpack_dht *dht, unsigned int needed);
 int qpack_dht_insert(struct qpack_dht *dht, struct ist name, struct ist value);
+int qpack_dht_resize(struct qpack_dht *dht, uint32_t size);
 
 #ifdef DEBUG_QPACK
 void qpack_dht_dump(FILE *out, const struct qpack_dht *dht);
@@ -117,6 +118,22 @@ static inline struct ist qpack_idx_to_value(const struct qpack_dht *dht, uint32_
 	return qpack_get_value(dht, dte);
 }
 
+/* return a pointer to the entry inserted <age> insertions before the most
+ * recent one (0 designates the most recent entry), or NULL if this entry is
+ * not in the table anymore. QPACK relative and absolute indexes are easily
+ * converted to such an age by their users.
+ */
+static inline const struct qpack_dte *qpack_dht_get_by_age(const struct qpack_dht *dht, uint64_t age)
+{
+	unsigned int slot;
+
+	if (age >= dht->used)
+		return NULL;
+
+	slot = (dht->head >= age) ? dht->head - age : dht->wrap + dht->head - age;
+	return &dht->dte[slot];
+}
+
 /* returns the slot number of the oldest entry (tail). Must not be used on an
  * empty table.
  */
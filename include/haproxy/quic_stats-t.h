@@ -51,6 +51,12 @@ enum {
 	QUIC_ST_STREAMS_BLOCKED_BIDI,
 	QUIC_ST_STREAMS_BLOCKED_UNI,
 	QUIC_ST_NCBUF_GAP_LIMIT,
+	/* Datagrams reception on listener sockets */
+	QUIC_ST_RX_CALLS,
+	QUIC_ST_RX_DGRAMS,
+	QUIC_ST_RX_DGRAMS_PER_CALL,
+	QUIC_ST_RX_BATCH_FULL,
+	QUIC_ST_RX_GRO_DGRAMS,
 	QUIC_STATS_COUNT /* must be the last */
 };
 
@@ -99,6 +105,11 @@ struct quic_counters {
 	long long streams_blocked_bidi;      /* total number of times STREAMS_BLOCKED_BIDI frame was received */
 	long long streams_blocked_uni;       /* total number of times STREAMS_BLOCKED_UNI frame was received */
 	long long ncbuf_gap_limit;           /* total number of times we failed to add data to ncbuf due to gap size limit */
+	/* Datagrams reception on listener sockets */
+	long long rx_calls;       /* total number of receive syscalls which returned data */
+	long long rx_dgrams;      /* total number of datagrams received */
+	long long rx_batch_full;  /* total number of receive syscalls which filled the whole batch */
+	long long rx_gro_dgrams;  /* total number of datagrams extracted from UDP GRO coalesced buffers */
 };
 
 #endif /* USE_QUIC */
@@ -23,10 +23,16 @@
 #define QUIC_DFLT_BE_STREAM_DATA_RATIO     90
 #define QUIC_DFLT_FE_STREAM_MAX_CONCURRENT 100
 #define QUIC_DFLT_BE_STREAM_MAX_CONCURRENT 100
+/* Default number of datagrams received per syscall on listener sockets */
+#define QUIC_DFLT_FE_RX_BATCH              32
+/* Maximum number of datagrams received per syscall on listener sockets */
+#define QUIC_MAX_FE_RX_BATCH               64
 
 
 #define QUIC_TUNE_FE_LISTEN_OFF    0x00000001
 #define QUIC_TUNE_FE_SOCK_PER_CONN 0x00000002
+#define QUIC_TUNE_FE_RX_UDP_GRO    0x00000004
+#define QUIC_TUNE_FE_PRIO_OFF      0x00000008
 
 #define QUIC_TUNE_FB_TX_PACING  0x00000001
 #define QUIC_TUNE_FB_TX_UDP_GSO 0x00000002
@@ -44,6 +50,7 @@ struct quic_tune {
 		uint stream_data_ratio;
 		uint stream_max_concurrent;
 		uint stream_rxbuf;
+		uint rx_batch; /* max number of datagrams per receive syscall */
 		uint opts;    /* QUIC_TUNE_FE_* options specific to FE side */
 		uint fb_opts; /* QUIC_TUNE_FB_* options shared by both side */
 	} fe;
@@ -45,6 +45,7 @@ extern THREAD_LOCAL pcre2_match_data *local_pcre2_match;
  * The function return 1 is success case, else return 0 and err is filled.
  */
 struct my_regex *regex_comp(const char *str, int cs, int cap, char **err);
+int regex_find_literal(const char *str, int cs, char *out, int size);
 int exp_replace(char *dst, unsigned int dst_size, char *src, const char *str, const regmatch_t *matches);
 const char *check_replace_string(const char *str);
 int regex_exec_match(const struct my_regex *preg, const char *subject,
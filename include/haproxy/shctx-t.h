@@ -34,25 +34,56 @@
 
 #define SHCTX_F_REMOVING 0x1      /* Removing flag, does not accept new */
 
+/* eviction policies */
+#define SHCTX_POLICY_LRU      0   /* evict the least recently released rows (default) */
+#define SHCTX_POLICY_TINYLFU  1   /* TinyLFU admission and segmented LRU eviction */
+
+/* shared_block flags, only set on the first block of a row */
+#define SHCTX_BLK_F_HIT       0x1 /* the row was used again since it was released */
+#define SHCTX_BLK_F_PROTECTED 0x2 /* the row is in the protected segment */
+
+#define SHCTX_SKETCH_DEPTH    4   /* number of rows of the frequency sketch */
+#define SHCTX_SKETCH_MAX      15  /* max value of the sketch counters */
+
 /* generic shctx struct */
 struct shared_block {
 	struct list list;
 	unsigned int len;          /* data length for the row */
 	unsigned int block_count;  /* number of blocks */
 	unsigned int refcount;
+	unsigned int key;          /* hash of the row's key for the admission policy, or 0 */
 	struct shared_block *last_reserved;
 	struct shared_block *last_append;
+	unsigned int flags;        /* SHCTX_BLK_F_* */
 	unsigned char data[VAR_ARRAY];
 };
 
+/* count-min sketch estimating the access frequency of the keys of a shared
+ * context. The counters are halved every <period> increments so that the
+ * estimates follow the recent popularity of the keys.
+ */
+struct shctx_sketch {
+	unsigned int mask;           /* number of counters per row - 1 */
+	unsigned int period;         /* number of increments between two agings */
+	unsigned int samples;        /* number of increments since last aging */
+	unsigned char counters[VAR_ARRAY]; /* SHCTX_SKETCH_DEPTH rows of <mask> + 1 counters */
+};
+
 struct shared_context {
 	__decl_thread(HA_RWLOCK_T lock);
 	struct list avail;  /* list for active and free blocks */
-	unsigned int nbav;  /* number of available blocks */
+	unsigned int nbav;  /* number of available blocks, including protected ones */
 	unsigned int max_obj_size;   /* maximum object size (in bytes). */
 	void (*free_block)(struct shared_block *first, void *data);
 	void (*reserve_finish)(struct shared_context *shctx);
 	void *cb_data;
+	int policy;                  /* SHCTX_POLICY_* */
+	struct list protected;       /* rows used again after they were stored, oldest first (TinyLFU) */
+	unsigned int nbprot;         /* number of blocks in the protected list */
+	unsigned int maxprot;        /* max number of blocks in the protected list */
+	struct shctx_sketch *sketch; /* access frequency of the keys (TinyLFU) */
+	unsigned long long evicted;  /* number of rows evicted to make room for new data */
+	unsigned long long rejected; /* number of new rows rejected by the admission policy */
 	short int block_size;
 	ALWAYS_ALIGN(64);  /* The following member needs to be aligned to 64 in the
 			      cache's case because the cache struct contains an explicitly
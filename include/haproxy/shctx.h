@@ -22,8 +22,12 @@
 int shctx_init(struct shared_context **orig_shctx,
                int maxblocks, int blocksize, unsigned int maxobjsz,
                int extra, __maybe_unused const char *name);
+int shctx_set_policy(struct shared_context *shctx, int policy);
+void shctx_key_access(struct shared_context *shctx, unsigned int key);
 struct shared_block *shctx_row_reserve_hot(struct shared_context *shctx,
                                            struct shared_block *last, int data_len);
+struct shared_block *shctx_row_reserve_key(struct shared_context *shctx,
+                                           unsigned int key, int data_len);
 void shctx_row_detach(struct shared_context *shctx, struct shared_block *first);
 void shctx_row_reattach(struct shared_context *shctx, struct shared_block *first);
 int shctx_row_data_append(struct shared_context *shctx,
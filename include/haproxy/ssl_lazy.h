@@ -0,0 +1,46 @@
+/*
+ * include/haproxy/ssl_lazy.h
+ * This file contains definitions for the on-demand loading of the
+ * certificates of lazy crt-lists.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _HAPROXY_SSL_LAZY_H
+#define _HAPROXY_SSL_LAZY_H
+#ifdef USE_OPENSSL
+
+#include <haproxy/list.h>
+#include <haproxy/listener-t.h>
+#include <haproxy/openssl-compat.h>
+#include <haproxy/ssl_sock-t.h>
+
+int ssl_lazy_load_crt_list(char *file, struct bind_conf *bind_conf, char **err);
+SSL_CTX *ssl_lazy_get_ctx(struct bind_conf *bind_conf, char *servername, struct ssl_bind_conf **conf,
+                          struct ssl_sock_ctx *waiter, int *retry);
+void ssl_lazy_free_index(struct bind_conf *bind_conf);
+void __ssl_lazy_unsubscribe(struct ssl_sock_ctx *ctx);
+
+/* Removes <ctx> from the handshakes waiting for a lazy certificate, if it is
+ * still there. Only the thread owning <ctx> subscribes or unsubscribes it.
+ */
+static inline void ssl_lazy_unsubscribe(struct ssl_sock_ctx *ctx)
+{
+	if (LIST_INLIST(&ctx->lazy_wait))
+		__ssl_lazy_unsubscribe(ctx);
+}
+
+#endif /* USE_OPENSSL */
+#endif /* _HAPROXY_SSL_LAZY_H */
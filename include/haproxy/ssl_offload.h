@@ -0,0 +1,32 @@
+/*
+ * include/haproxy/ssl_offload.h
+ * This file contains definitions for the offload of TLS private key
+ * operations to crypto threads.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _HAPROXY_SSL_OFFLOAD_H
+#define _HAPROXY_SSL_OFFLOAD_H
+#ifdef USE_OPENSSL
+
+#include <haproxy/openssl-compat.h>
+
+int ssl_offload_use_pkey(SSL_CTX *ctx, EVP_PKEY *pkey);
+int ssl_offload_async_fd(void);
+void ssl_offload_async_wait(int efd);
+
+#endif /* USE_OPENSSL */
+#endif /* _HAPROXY_SSL_OFFLOAD_H */
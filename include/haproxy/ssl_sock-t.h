@@ -51,6 +51,10 @@
 #define SSL_SOCK_RECV_HEARTBEAT     0x00000008
 #define SSL_SOCK_SEND_MORE          0x00000010  /* set MSG_MORE at lower levels */
 
+/* record size classes reported by the ssl stats module */
+#define SSL_REC_SMALL               1500
+#define SSL_REC_MEDIUM              8192
+
 /* bits 0xFFFFFF00 are reserved to store verify errors.
  * The CA en CRT error codes will be stored on 7 bits each
  * (since the max verify error code does not exceed 127)
@@ -174,6 +178,8 @@ struct tls_keys_ref {
 	union tls_sess_key *tlskeys;
 	int tls_ticket_enc_index;
 	int key_size_bits;
+	unsigned int generation; /* incremented on each update, used to synchronize peers */
+	unsigned int last_update; /* date of the last update (ticks) */
 	__decl_thread(HA_RWLOCK_T lock); /* lock used to protect the ref */
 };
 
@@ -272,6 +278,9 @@ struct ssl_sock_ctx {
 #ifdef HA_USE_KTLS
 	char record_type;             /* Record type to use if not just sending application data */
 #endif
+	unsigned int dynrec_sent;     /* bytes sent since the last dynamic record size reset */
+	unsigned int last_send;       /* date of the last successful send, for dynamic record sizing */
+	struct list lazy_wait;        /* element of the handshakes waiting for a lazy certificate */
 
 #ifdef USE_QUIC
 	struct quic_conn *qc;
@@ -286,6 +295,8 @@ struct global_ssl {
 	int  skip_self_issued_ca;
 
 	int  async;                 /* whether we use ssl async mode */
+	int  crypto_threads;        /* number of threads performing the private key operations */
+	int  loader_threads;        /* number of threads prefetching the lazy certificates */
 
 	char *listen_default_ciphers;
 	char *connect_default_ciphers;
@@ -314,8 +325,13 @@ struct global_ssl {
 	unsigned int life_time;   /* SSL session lifetime in seconds */
 	unsigned int max_record; /* SSL max record size */
 	unsigned int hard_max_record; /* SSL max record size hard limit */
+	unsigned int dynrec_threshold; /* bytes sent with small records before growing them, 0=off */
+	unsigned int dynrec_size;     /* record size used during the dynamic record slow start */
+	unsigned int dynrec_idle;     /* idle time (ms) after which records are shrunk again */
 	unsigned int default_dh_param; /* SSL maximum DH parameter size */
 	int ctx_cache; /* max number of entries in the ssl_ctx cache. */
+	int lazy_ctx_cache; /* max number of resident contexts of the lazy crt-lists */
+	int cache_policy; /* eviction policy of the session cache, SHCTX_POLICY_* */
 	int capture_buffer_size; /* Size of the capture buffer. */
 	int keylog; /* activate keylog  */
 	int extra_files; /* which files not defined in the configuration file are we looking for */
@@ -357,6 +373,10 @@ struct ssl_counters {
 	long long failed_handshake;
 	long long ocsp_staple;
 	long long failed_ocsp_staple;
+	long long rec_small;          /* records of at most SSL_REC_SMALL bytes */
+	long long rec_medium;         /* records of at most SSL_REC_MEDIUM bytes */
+	long long rec_large;          /* larger records */
+	long long dynrec_reset;       /* record size resets after an idle period */
 };
 
 struct passphrase_cb_data {
@@ -93,10 +93,14 @@ void ssl_sock_update_counters(SSL *ssl,
                               struct ssl_counters *counters,
                               struct ssl_counters *counters_px, int backend);
 void ssl_sock_handle_hs_error(struct connection *conn);
+int ssl_sock_store_peer_sess(unsigned char *s_id, unsigned char *data, int data_len);
 #if (defined SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB && TLS_TICKETS_NO > 0)
 int ssl_sock_update_tlskey_ref(struct tls_keys_ref *ref,
 				struct buffer *tlskey);
 int ssl_sock_update_tlskey(char *filename, struct buffer *tlskey, char **err);
+int ssl_sock_rotate_tlskey_ref(struct tls_keys_ref *ref);
+size_t ssl_sock_dump_tlskeys_ref(struct tls_keys_ref *ref, char *out, size_t size, unsigned int *gen);
+int ssl_sock_load_tlskeys_ref(struct tls_keys_ref *ref, const char *keys, size_t len, unsigned int gen);
 struct tls_keys_ref *tlskeys_ref_lookup(const char *filename);
 struct tls_keys_ref *tlskeys_ref_lookupid(int unique_id);
 #endif
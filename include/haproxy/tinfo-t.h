@@ -233,8 +233,10 @@ struct thread_ctx {
 	struct buffer *last_dump_buffer;        /* Copy of last buffer used for a dump; may be NULL or invalid; for post-mortem only */
 	unsigned long long total_streams;       /* Total number of streams created on this thread */
 	unsigned int stream_cnt;                /* Number of streams attached to this thread */
+	unsigned int comp_jobs;                 /* Number of compression jobs submitted by this thread in flight */
+	unsigned int crypto_jobs;               /* Number of private key operations submitted by this thread in flight */
 
-	// around 68 bytes here for shared variables
+	// around 60 bytes here for shared variables
 
 	ALWAYS_ALIGN(128);
 };
@@ -0,0 +1,52 @@
+#ifndef _HAPROXY_WORKQ_T_H
+#define _HAPROXY_WORKQ_T_H
+
+#ifdef USE_THREAD
+#include <pthread.h>
+#endif
+
+#include <haproxy/api-t.h>
+#include <haproxy/list-t.h>
+
+struct tasklet;
+
+/* A job to be processed out of the event loop by a work queue. It is usually
+ * embedded into a larger structure carrying the job's arguments and results.
+ */
+struct workq_job {
+	struct list list;                        /* element of the work queue's list of jobs */
+	struct tasklet *tl;                      /* calls ->done on the submitting thread, or NULL */
+	void (*process)(struct workq_job *job);  /* called from a worker thread */
+	int (*done)(struct workq_job *job);      /* called on the submitting thread once processed,
+						  * returns 0 if it released the job.
+						  */
+};
+
+/* A work queue is a set of threads which are not part of the haproxy threads,
+ * and which process in order the jobs submitted to them. They are meant for
+ * blocking operations (disk I/O, expensive computations) which must not stall
+ * the event loop. They start with the haproxy threads.
+ */
+struct workq {
+	struct list list;                  /* element of the list of work queues */
+	char *name;                        /* name used in error reports */
+	int nbthreads;                     /* number of worker threads */
+	struct list jobs;                  /* queued jobs, oldest first */
+	unsigned int queued;               /* number of queued jobs */
+	unsigned long long processed;      /* number of processed jobs */
+	int state;                         /* WORKQ_ST_* */
+#ifdef USE_THREAD
+	pthread_t *threads;                /* the worker threads */
+	pthread_mutex_t lock;              /* protects the fields above */
+	pthread_cond_t cond;               /* signaled when a job is queued or on stop */
+#endif
+};
+
+/* work queue states */
+enum workq_state {
+	WORKQ_ST_INIT = 0,                 /* not started yet */
+	WORKQ_ST_RUNNING,                  /* threads started */
+	WORKQ_ST_STOPPING,                 /* threads must leave */
+};
+
+#endif /* _HAPROXY_WORKQ_T_H */
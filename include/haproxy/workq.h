@@ -0,0 +1,28 @@
+#ifndef _HAPROXY_WORKQ_H
+#define _HAPROXY_WORKQ_H
+
+#include <haproxy/atomic.h>
+#include <haproxy/workq-t.h>
+
+/* Worker threads are not haproxy threads: the ->process callbacks must only
+ * rely on the C library and system calls, and never use pools, trash chunks,
+ * locks, tasks or anything else bound to the current haproxy thread. They may
+ * only use atomic operations on shared data. The notification of the end of
+ * a job is performed by the work queue using the job's tasklet.
+ */
+
+struct workq *workq_new(const char *name, int nbthreads, char **err);
+int workq_job_init(struct workq_job *job, void (*process)(struct workq_job *),
+                   int (*done)(struct workq_job *));
+void workq_job_deinit(struct workq_job *job);
+void workq_submit(struct workq *wq, struct workq_job *job);
+
+/* Returns the number of jobs queued on <wq> which were not picked by a worker
+ * thread yet. It is only meant to be reported.
+ */
+static inline unsigned int workq_queued(const struct workq *wq)
+{
+	return HA_ATOMIC_LOAD(&wq->queued);
+}
+
+#endif /* _HAPROXY_WORKQ_H */
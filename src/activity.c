@@ -1758,6 +1758,7 @@ static int cli_io_handler_show_activity(struct appctx *appctx)
 		case __LINE__: SHOW_VAL("poll_exp:",     activity[thr].poll_exp, _tot); break;
 		case __LINE__: SHOW_VAL("poll_drop_fd:", activity[thr].poll_drop_fd, _tot); break;
 		case __LINE__: SHOW_VAL("poll_skip_fd:", activity[thr].poll_skip_fd, _tot); break;
+		case __LINE__: SHOW_VAL("poll_saved:",   activity[thr].poll_saved, _tot); break;
 		case __LINE__: SHOW_VAL("conn_dead:",    activity[thr].conn_dead, _tot); break;
 		case __LINE__: SHOW_VAL("stream_calls:", activity[thr].stream_calls, _tot); break;
 		case __LINE__: SHOW_VAL("pool_fail:",    activity[thr].pool_fail, _tot); break;
@@ -1778,6 +1779,14 @@ static int cli_io_handler_show_activity(struct appctx *appctx)
 		case __LINE__: SHOW_VAL("check_started:",activity[thr].check_started, _tot); break;
 		case __LINE__: SHOW_VAL("check_active:", _HA_ATOMIC_LOAD(&ha_thread_ctx[thr].active_checks), _tot); break;
 		case __LINE__: SHOW_VAL("check_running:",_HA_ATOMIC_LOAD(&ha_thread_ctx[thr].running_checks), _tot); break;
+		case __LINE__: SHOW_VAL("comp_offload:", activity[thr].comp_offload, _tot); break;
+		case __LINE__: SHOW_VAL("comp_wait:",    activity[thr].comp_wait, _tot); break;
+		case __LINE__: SHOW_VAL("comp_jobs:",    _HA_ATOMIC_LOAD(&ha_thread_ctx[thr].comp_jobs), _tot); break;
+		case __LINE__: SHOW_VAL("crypto_offload:", activity[thr].crypto_offload, _tot); break;
+		case __LINE__: SHOW_VAL("crypto_inline:",  activity[thr].crypto_inline, _tot); break;
+		case __LINE__: SHOW_VAL("crypto_jobs:",    _HA_ATOMIC_LOAD(&ha_thread_ctx[thr].crypto_jobs), _tot); break;
+		case __LINE__: SHOW_VAL("crypto_queue_us:", swrate_avg(activity[thr].crypto_queue_us, TIME_STATS_SAMPLES), (_tot + _nbt/2) / _nbt); break;
+		case __LINE__: SHOW_VAL("crypto_lat_us:",  swrate_avg(activity[thr].crypto_lat_us, TIME_STATS_SAMPLES), (_tot + _nbt/2) / _nbt); break;
 
 #if defined(DEBUG_DEV)
 			/* keep these ones at the end */
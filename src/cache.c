@@ -10,31 +10,45 @@
  * 2 of the License, or (at your option) any later version.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
 #include <import/eb32tree.h>
+#include <import/ebsttree.h>
 #include <import/sha1.h>
 
 #include <haproxy/action-t.h>
 #include <haproxy/api.h>
 #include <haproxy/applet.h>
+#include <haproxy/backend.h>
 #include <haproxy/cfgparse.h>
 #include <haproxy/channel.h>
 #include <haproxy/cli.h>
+#include <haproxy/compression.h>
 #include <haproxy/errors.h>
 #include <haproxy/filters.h>
 #include <haproxy/hash.h>
 #include <haproxy/http.h>
 #include <haproxy/http_ana.h>
+#include <haproxy/http_client.h>
 #include <haproxy/http_htx.h>
 #include <haproxy/http_rules.h>
 #include <haproxy/htx.h>
+#include <haproxy/log.h>
 #include <haproxy/net_helper.h>
 #include <haproxy/proxy.h>
+#include <haproxy/queue.h>
 #include <haproxy/sample.h>
 #include <haproxy/sc_strm.h>
+#include <haproxy/server.h>
 #include <haproxy/shctx.h>
 #include <haproxy/stconn.h>
 #include <haproxy/stream.h>
+#include <haproxy/task.h>
 #include <haproxy/tools.h>
+#include <haproxy/workq.h>
 #include <haproxy/xxhash.h>
 
 #define CACHE_FLT_F_IMPLICIT_DECL  0x00000001 /* The cache filtre was implicitly declared (ie without
@@ -66,6 +80,176 @@ struct cache {
 	unsigned int max_secondary_entries;  /* maximum number of secondary entries with the same primary hash */
 	uint8_t vary_processing_enabled;     /* boolean : manage Vary header (disabled by default) */
 	char id[33];             /* cache name */
+	char *disk_dir;          /* directory of the disk tier's file (disk-dir), or NULL */
+	unsigned long long disk_size;        /* size of the disk tier in bytes (disk-max-size) */
+	struct cache_disk *disk;             /* disk tier, or NULL */
+	unsigned long long hits;             /* lookups served from memory */
+	unsigned long long misses;           /* lookups not found in memory */
+	unsigned int coalesce_timeout;       /* max time to wait for another fill (coalesce-timeout), 0 if disabled */
+	struct eb_root fills;                /* fills in progress, indexed by the first 32 bits of their hash */
+	__decl_thread(HA_SPINLOCK_T fill_lock); /* protects the fills and their waiters */
+	unsigned long long coalesced;        /* lookups which waited for another fill */
+	unsigned long long coalesce_hits;    /* lookups served once the fill they waited for ended */
+	unsigned long long coalesce_timeouts; /* lookups which gave up waiting */
+	unsigned int swr;                    /* default stale-while-revalidate period (seconds) */
+	unsigned int sie;                    /* default stale-if-error period (seconds) */
+	unsigned long long revalidations;    /* background revalidations started */
+	unsigned long long reval_failures;   /* revalidations which got an error or no response */
+	unsigned long long stale_hits;       /* stale objects served while being revalidated */
+	unsigned long long stale_error_hits; /* stale objects served after a failed revalidation */
+	int policy;                          /* eviction policy (eviction-policy), SHCTX_POLICY_* */
+	char *purge_hdr;                     /* response header listing the purge tags (purge-tags-header), or NULL */
+	uint8_t purge_prefix;                /* index the objects by path for purges (purge-by-prefix) */
+	struct eb_root purge_objs;           /* purge records, indexed by the first 32 bits of their hash */
+	struct eb_root purge_exp;            /* purge records, indexed by expiration date */
+	struct eb_root purge_tags;           /* purge tags of the records */
+	struct eb_root purge_paths;          /* paths and directories of the records */
+	unsigned int purge_records;          /* number of purge records */
+	__decl_thread(HA_SPINLOCK_T purge_lock); /* protects the purge index above */
+	unsigned long long purged;           /* objects deleted by purges */
+	uint8_t comp_storage;                /* store the compressible objects compressed (compressed-storage) */
+	unsigned long long comp_objects;     /* objects stored compressed */
+	unsigned long long comp_in;          /* payload bytes compressed when stored */
+	unsigned long long comp_out;         /* compressed payload bytes stored */
+	unsigned long long inflated;         /* compressed objects delivered decompressed */
+};
+
+/* The purge index of a cache tells which primary keys match a tag or a path
+ * prefix. It holds a record per primary key of the objects stored since the
+ * index was enabled, with the object's tags, its path and the directories of
+ * the path ("/", "/a/", "/a/b/" for "/a/b/c"). Records are not tied to
+ * the objects themselves, which may move between the memory and the disk
+ * tier: a record is dropped once its objects are expired, or evicted without
+ * a disk tier. A purge then deletes all the objects of the primary keys of
+ * the matching records from all tiers.
+ */
+struct cache_purge_obj {
+	struct eb32_node eb;                 /* node in the cache's purge_objs tree */
+	struct eb32_node exp;                /* node in the cache's purge_exp tree */
+	struct list refs;                    /* tag and path references (cache_purge_ref) */
+	struct list list;                    /* element of the list of records being purged */
+	char hash[20];                       /* primary key of the objects */
+};
+
+/* a tag, a path or a directory of a purge record */
+struct cache_purge_ref {
+	struct list list;                    /* element of the record's references */
+	struct cache_purge_obj *obj;         /* the record */
+	int type;                            /* CACHE_PURGE_TAG or CACHE_PURGE_PATH */
+	struct ebmb_node node;               /* node in the cache's purge_tags or purge_paths tree,
+					      * followed by the tag or path. Must be last.
+					      */
+};
+
+#define CACHE_PURGE_TAG         0            /* the reference is a tag */
+#define CACHE_PURGE_PATH        1            /* the reference is a path or directory */
+#define CACHE_PURGE_MAX_TAGS    64           /* max tags indexed per object */
+#define CACHE_PURGE_MAX_DIRS    16           /* max directories indexed per object */
+#define CACHE_PURGE_MAX_EXPIRE  16           /* expired records dropped per index update */
+
+/* A fill in progress: the first stream missing an object fetches it from the
+ * server while the following ones looking for the same primary key wait for
+ * the response to be stored, instead of all hitting the server at once.
+ */
+struct cache_fill {
+	struct eb32_node eb;                 /* node in the cache's fills tree */
+	char hash[20];                       /* primary key of the object */
+	struct list waiters;                 /* cache_st of the waiting streams */
+};
+
+/* The disk tier of a cache. Objects evicted from the memory are written to a
+ * file used as a circular log, and read back into the memory when requested
+ * again. The index of the records is kept in memory, and the file is
+ * unlinked as soon as created, so that it only lives as long as the process.
+ * All I/O is performed by a single worker thread, which processes the
+ * requests in order: a record may only be read after it was written, and the
+ * reads of records which are overwritten later complete before the write.
+ */
+struct cache_disk {
+	int fd;                              /* file descriptor of the file */
+	unsigned long long size;             /* size of the file */
+	unsigned long long head;             /* offset of the next record */
+	unsigned long long used;             /* bytes used by the indexed records */
+	unsigned long long seq;              /* sequence number of the next record */
+	unsigned int records;                /* number of indexed records */
+	struct eb_root index;                /* records indexed by the first 32 bits of their hash */
+	struct list order;                   /* records in file order, oldest first */
+	__decl_thread(HA_SPINLOCK_T lock);   /* protects the fields above */
+	struct workq *wq;                    /* work queue performing the I/O */
+	unsigned long long pending;          /* bytes waiting to be written */
+	unsigned long long hits;             /* lookups served by promoting a record */
+	unsigned long long misses;           /* lookups found in no tier */
+	unsigned long long demoted;          /* objects written to the disk */
+	unsigned long long dropped;          /* objects not written for lack of write bandwidth */
+	unsigned long long errors;           /* I/O errors and invalid records */
+};
+
+/* A background revalidation of a stale object, performed with the httpclient
+ * on the thread of the stream which found it stale. A "200 OK" response is
+ * stored as a new object, and a "304 Not Modified" one refreshes the stale
+ * object. The streams which may only use the stale object if it cannot be
+ * revalidated wait for the revalidation's fill.
+ */
+struct cache_reval {
+	struct cache *cache;
+	struct cache_entry *old;             /* the stale entry, only compared to the indexed one */
+	struct cache_fill *fill;             /* fill waited for by the streams, or NULL */
+	struct shared_block *first;          /* row of the new object, or NULL */
+	unsigned int status;                 /* status code of the response, 0 if none */
+	unsigned int complete;               /* the whole response was received */
+	unsigned int maxage;                 /* max-age of a "304 Not Modified" response */
+	unsigned int swr;                    /* stale periods of a "304 Not Modified" response */
+	unsigned int sie;
+	unsigned int secondary_key_signature;
+	char hash[20];
+	char secondary_key[HTTP_CACHE_SEC_KEY_LEN];
+};
+
+/* a record of the disk tier, in memory */
+struct cache_disk_entry {
+	struct eb32_node eb;                 /* node in the index */
+	struct list list;                    /* element of the list of records in file order */
+	unsigned long long ofs;              /* offset of the record in the file */
+	unsigned long long seq;              /* sequence number of the record */
+	unsigned int len;                    /* length of the object's row */
+	unsigned int expire;                 /* expiration date of the object */
+	unsigned int secondary_key_signature;
+	char hash[20];
+	char secondary_key[HTTP_CACHE_SEC_KEY_LEN];
+};
+
+/* header of a record in the disk tier's file, followed by the object's row */
+struct cache_disk_hdr {
+	unsigned long long seq;              /* sequence number of the record */
+	unsigned int len;                    /* length of the object's row */
+	unsigned int magic;                  /* CACHE_DISK_MAGIC */
+};
+
+/* an I/O request to the disk tier, followed by the record to write or read */
+struct cache_disk_io {
+	struct workq_job job;
+	struct cache_disk *disk;
+	struct stream *strm;                 /* stream waiting for a read, NULL once abandoned */
+	unsigned long long ofs;              /* offset of the record in the file */
+	unsigned long long seq;              /* expected sequence number of a read record */
+	unsigned int len;                    /* length of the record */
+	unsigned int done:1;                 /* the read was processed */
+	unsigned int error:1;                /* the I/O failed */
+	struct cache_disk_hdr hdr[0];        /* the record */
+};
+
+#define CACHE_DISK_MAGIC        0x4443484bU  /* "KHCD" */
+#define CACHE_DISK_ALIGN        64           /* alignment of records in the file */
+#define CACHE_DISK_MAX_PENDING  (32U << 20)  /* bytes which may be waiting to be written */
+#define CACHE_DISK_SYNC_MAX     (16U << 10)  /* largest row copied upon eviction, under the shctx lock */
+
+#define CACHE_MAX_RANGES        8            /* max byte ranges served from a cached object */
+#define CACHE_RANGE_CTYPE_LEN   48           /* max Content-Type length of multipart range responses */
+
+/* a byte range of the payload of a cached object, bounds included */
+struct cache_range {
+	unsigned int start;
+	unsigned int end;
 };
 
 /* the appctx context of a cache applet, stored in appctx->svcctx */
@@ -77,9 +261,33 @@ struct cache_appctx {
 	unsigned int offset;             /* start offset of remaining data relative to beginning of the next block */
 	unsigned int rem_data;           /* Remaining bytes for the last data block (HTX only, 0 means process next block) */
 	unsigned int send_notmodified:1; /* In case of conditional request, we might want to send a "304 Not Modified" response instead of the stored data. */
-	unsigned int unused:31;
+	unsigned int range_unsatisfiable:1; /* the requested ranges are out of the payload, send a 416 */
+	unsigned int range_part_sent:1;  /* the headers of the current part of a multipart response were sent */
+	unsigned int inflate:1;          /* the compressed payload must be delivered decompressed */
+	unsigned int unused:28;
 	/* 4 bytes hole here */
 	struct shared_block *next;       /* The next block of data to be sent for this cache entry. */
+
+	/* byte ranges to send, if any. The row is read at <row_pos> (<next>,
+	 * <offset>), and the current HTX data block of the payload, whose data
+	 * start at <blk_row> in the row, covers the payload bytes from
+	 * <blk_start> to <blk_end> (excluded).
+	 */
+	unsigned int nb_ranges;          /* number of ranges, 0 to send the whole object */
+	unsigned int cur_range;          /* range being sent */
+	unsigned int range_pos;          /* next payload byte of the current range */
+	unsigned int payload_pos;        /* row position of the first payload HTX block */
+	unsigned int row_pos;            /* row position of the next byte to read */
+	unsigned int blk_row;            /* row position of the current HTX data block's data */
+	unsigned int blk_start;          /* payload offset of the current HTX data block */
+	unsigned int blk_end;            /* payload offset of the end of this block */
+	unsigned int ctype_len;          /* length of <ctype> */
+	unsigned long long boundary;     /* multipart boundary */
+	struct cache_range ranges[CACHE_MAX_RANGES];
+	char ctype[CACHE_RANGE_CTYPE_LEN]; /* Content-Type of the multipart parts */
+#if defined(USE_ZLIB)
+	z_stream *zstrm;                 /* decompression of a compressed payload, or NULL */
+#endif
 };
 
 /* cache config for filters */
@@ -186,6 +394,14 @@ static inline void cache_wrunlock(struct cache_tree *cache)
 struct cache_st {
 	struct shared_block *first_block;
 	struct list detached_head;
+	struct cache_disk_io *disk_io;  /* pending read from the disk tier */
+	struct cache_fill *fill;        /* fill in progress owned by the stream */
+	struct cache_fill *waiting;     /* fill the stream is waiting for */
+	struct list fill_list;          /* element of the waiters of <waiting> */
+	struct stream *strm;            /* the stream, woken up when <waiting> ends */
+	char *purge_path;               /* path of a missed object, for the purge index */
+	struct comp_ctx *comp_ctx;      /* compression of the stored payload, or NULL */
+	unsigned int coalesced:1;       /* the stream already waited for a fill */
 };
 
 #define DEFAULT_MAX_SECONDARY_ENTRY 10
@@ -193,9 +409,14 @@ struct cache_st {
 struct cache_entry {
 	unsigned int complete;    /* An entry won't be valid until complete is not null. */
 	unsigned int latest_validation;     /* latest validation date */
-	unsigned int expire;      /* expiration date (wall clock time) */
+	unsigned int expire;      /* expiration date (wall clock time), after the stale periods */
+	unsigned int fresh_until; /* date until which the entry is fresh (wall clock time) */
+	unsigned int swr;         /* stale-while-revalidate period after <fresh_until> (seconds) */
+	unsigned int sie;         /* stale-if-error period after <fresh_until> (seconds) */
+	unsigned int revalidating; /* a background revalidation is in progress */
 	unsigned int age;         /* Origin server "Age" header value */
 	unsigned int body_size;         /* Size of the body */
+	unsigned int compressed;  /* the payload was compressed with gzip by the cache */
 	int refcount;
 
 	struct eb32_node eb;     /* ebtree node used to hold the cache object */
@@ -224,12 +445,18 @@ struct cache_entry {
 
 #define CACHE_BLOCKSIZE 1024
 #define CACHE_ENTRY_MAX_AGE 2147483648U
+#define CACHE_ENTRY_MAX_STALE (365U * 86400U)  /* one year */
 
 static struct list caches = LIST_HEAD_INIT(caches);
 static struct list caches_config = LIST_HEAD_INIT(caches_config); /* cache config to init */
 static struct cache *tmp_cache_config = NULL;
+#if defined(USE_ZLIB)
+static const struct comp_algo *cache_comp_algo = NULL; /* algorithm of compressed-storage */
+#endif
 
 DECLARE_STATIC_TYPED_POOL(pool_head_cache_st, "cache_st", struct cache_st);
+DECLARE_STATIC_TYPED_POOL(pool_head_cache_fill, "cache_fill", struct cache_fill);
+DECLARE_STATIC_TYPED_POOL(pool_head_cache_reval, "cache_reval", struct cache_reval);
 
 static struct eb32_node *insert_entry(struct cache *cache, struct cache_tree *tree, struct cache_entry *new_entry);
 static void delete_entry(struct cache_entry *del_entry);
@@ -414,6 +641,22 @@ static inline struct cache_tree *get_cache_tree_from_hash(struct cache *cache, u
 	return &cache->trees[hash % CACHE_TREE_NUM];
 }
 
+/* Returns 1 if <cache_tree> holds an entry of primary key <hash>, otherwise
+ * 0. Must be called under the cache lock.
+ */
+static int cache_tree_has_hash(struct cache_tree *cache_tree, const char *hash)
+{
+	struct cache_entry *entry;
+	struct eb32_node *node;
+
+	for (node = eb32_lookup(&cache_tree->entries, read_u32(hash)); node; node = eb32_next_dup(node)) {
+		entry = eb32_entry(node, struct cache_entry, eb);
+		if (memcmp(entry->hash, hash, sizeof(entry->hash)) == 0)
+			return 1;
+	}
+	return 0;
+}
+
 
 /*
  * Remove all expired entries from a list of duplicates.
@@ -569,621 +812,2313 @@ static inline struct shared_block *block_ptr(struct cache_entry *entry)
 }
 
 
+/* Returns the context of the cache filter of <cconf> in stream <s>, or NULL */
+static struct cache_st *cache_strm_ctx(struct stream *s, struct cache_flt_conf *cconf)
+{
+	struct filter *filter;
 
-static int
-cache_store_init(struct proxy *px, struct flt_conf *fconf)
+	list_for_each_entry(filter, &s->strm_flt.filters, list) {
+		if (FLT_ID(filter) == cache_store_flt_id && FLT_CONF(filter) == cconf)
+			return filter->ctx;
+	}
+	return NULL;
+}
+
+/* Returns the size in the disk tier's file of the record of a row of <len>
+ * bytes.
+ */
+static inline unsigned long long cache_disk_reclen(unsigned int len)
 {
-	fconf->flags |= FLT_CFG_FL_HTX;
+	return (sizeof(struct cache_disk_hdr) + len + CACHE_DISK_ALIGN - 1) & -(unsigned long long)CACHE_DISK_ALIGN;
+}
+
+/* Reads (<wr>==0) or writes (<wr>!=0) <len> bytes at <buf> from/to offset
+ * <ofs> of file <fd>. Returns 0 on success, -1 on error. Called from the
+ * worker thread.
+ */
+static int cache_disk_pio(int fd, void *buf, size_t len, off_t ofs, int wr)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = wr ? pwrite(fd, buf, len, ofs) : pread(fd, buf, len, ofs);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		buf += ret;
+		len -= ret;
+		ofs += ret;
+	}
 	return 0;
 }
 
-static void
-cache_store_deinit(struct proxy *px, struct flt_conf *fconf)
+/* Writes a demoted record, then releases the I/O request. Called from the
+ * worker thread.
+ */
+static void cache_disk_write(struct workq_job *job)
 {
-	struct cache_flt_conf *cconf = fconf->conf;
+	struct cache_disk_io *io = container_of(job, struct cache_disk_io, job);
+	struct cache_disk *disk = io->disk;
 
-	if (!(cconf->flags & CACHE_FLT_INIT))
-		free(cconf->c.name);
-	free(cconf);
+	if (cache_disk_pio(disk->fd, io->hdr, io->len, io->ofs, 1) < 0)
+		HA_ATOMIC_INC(&disk->errors);
+	HA_ATOMIC_SUB(&disk->pending, io->len);
+	free(io);
 }
 
-static int
-cache_store_check(struct proxy *px, struct flt_conf *fconf)
+/* Reads a record to be promoted. Called from the worker thread. */
+static void cache_disk_read(struct workq_job *job)
 {
-	struct cache_flt_conf *cconf = fconf->conf;
-	struct flt_conf *f;
-	struct cache *cache;
-	int comp = 0;
+	struct cache_disk_io *io = container_of(job, struct cache_disk_io, job);
 
-	/* Find the cache corresponding to the name in the filter config.  The
-	*  cache will not be referenced now in the filter config because it is
-	*  not fully allocated. This step will be performed during the cache
-	*  post_check.
-	*/
-	list_for_each_entry(cache, &caches_config, list) {
-		if (strcmp(cache->id, cconf->c.name) == 0)
-			goto found;
+	if (cache_disk_pio(io->disk->fd, io->hdr, io->len, io->ofs, 0) < 0)
+		io->error = 1;
+}
+
+/* Releases read request <io>, or marks it as abandoned so that it is released
+ * once processed.
+ */
+static void cache_disk_io_release(struct cache_disk_io *io)
+{
+	if (!io->done) {
+		io->strm = NULL;
+		return;
 	}
+	workq_job_deinit(&io->job);
+	free(io);
+}
 
-	ha_alert("config: %s '%s': unable to find the cache '%s' referenced by the filter 'cache'.\n",
-		 proxy_type_str(px), px->id, (char *)cconf->c.name);
+/* Called on the thread of the stream which requested a read once it is
+ * processed, to wake the stream up or to release the request if it was
+ * abandoned. Returns 0 if it was released.
+ */
+static int cache_disk_read_done(struct workq_job *job)
+{
+	struct cache_disk_io *io = container_of(job, struct cache_disk_io, job);
+
+	io->done = 1;
+	if (!io->strm) {
+		cache_disk_io_release(io);
+		return 0;
+	}
+	task_wakeup(io->strm->task, TASK_WOKEN_MSG);
 	return 1;
+}
 
-  found:
-	/* Here <cache> points on the cache the filter must use and <cconf>
-	 * points on the cache filter configuration. */
+/* Removes record <ent> from the index of <disk>, which must be locked. */
+static void cache_disk_evict(struct cache_disk *disk, struct cache_disk_entry *ent)
+{
+	eb32_delete(&ent->eb);
+	LIST_DELETE(&ent->list);
+	disk->used -= cache_disk_reclen(ent->len);
+	disk->records--;
+	free(ent);
+}
 
-	/* Check all filters for proxy <px> to know if the compression is
-	 * enabled and if it is after the cache. When the compression is before
-	 * the cache, an error is returned. Also check if the cache filter must
-	 * be explicitly declaired or not. */
-	list_for_each_entry(f, &px->filter_configs, list) {
-		if (f == fconf) {
-			/* The compression filter must be evaluated after the cache. */
-			if (comp) {
-				ha_alert("config: %s '%s': unable to enable the compression filter before "
-					 "the cache '%s'.\n", proxy_type_str(px), px->id, cache->id);
-				return 1;
-			}
+/* Allocates <reclen> bytes in the file of <disk> for a new record, after the
+ * last one or at the beginning of the file, and evicts the records it
+ * overlaps. Returns the offset of the new record. Must be called under the
+ * disk tier's lock.
+ */
+static unsigned long long cache_disk_alloc(struct cache_disk *disk, unsigned long long reclen)
+{
+	struct cache_disk_entry *ent, *back;
+	unsigned long long ofs;
+
+	if (disk->head + reclen > disk->size) {
+		/* wrap and drop the records up to the end of the file, which
+		 * are the oldest ones.
+		 */
+		list_for_each_entry_safe(ent, back, &disk->order, list) {
+			if (ent->ofs < disk->head)
+				break;
+			cache_disk_evict(disk, ent);
 		}
-		else if (f->id == http_comp_req_flt_id || f->id == http_comp_res_flt_id)
-			comp = 1;
-		else if (f->id == fcgi_flt_id)
+		disk->head = 0;
+	}
+
+	ofs = disk->head;
+	list_for_each_entry_safe(ent, back, &disk->order, list) {
+		if (ent->ofs < ofs || ent->ofs >= ofs + reclen)
+			break;
+		cache_disk_evict(disk, ent);
+	}
+	disk->head += reclen;
+	return ofs;
+}
+
+/* Looks up in <disk> a record of an object of primary key <hash>. If <exact>
+ * is set, the record must be the one of the object of vary signature
+ * <signature> and secondary key <secondary_key>. Otherwise <secondary_key> is
+ * the full secondary key of a request, or NULL if unknown, and the record
+ * must be suitable to respond to this request. Expired records are ignored.
+ * Must be called under the disk tier's lock.
+ */
+static struct cache_disk_entry *cache_disk_get(struct cache_disk *disk, const char *hash,
+                                               unsigned int signature, const char *secondary_key,
+                                               int exact)
+{
+	char key[HTTP_CACHE_SEC_KEY_LEN];
+	struct cache_disk_entry *ent;
+	struct eb32_node *node;
+
+	for (node = eb32_lookup(&disk->index, read_u32(hash)); node; node = eb32_next_dup(node)) {
+		ent = eb32_entry(node, struct cache_disk_entry, eb);
+		if (memcmp(ent->hash, hash, sizeof(ent->hash)) != 0 || ent->expire <= date.tv_sec)
+			continue;
+
+		if (exact) {
+			if (ent->secondary_key_signature == signature &&
+			    (!signature || memcmp(ent->secondary_key, secondary_key, sizeof(key)) == 0))
+				return ent;
 			continue;
-		else if ((f->id != fconf->id) && (cconf->flags & CACHE_FLT_F_IMPLICIT_DECL)) {
-			/* Implicit declaration is only allowed with the
-			 * compression and fcgi. For other filters, an implicit
-			 * declaration is required. */
-			ha_alert("config: %s '%s': require an explicit filter declaration "
-				 "to use the cache '%s'.\n", proxy_type_str(px), px->id, cache->id);
-			return 1;
 		}
 
+		if (!ent->secondary_key_signature)
+			return ent;
+		if (!secondary_key)
+			continue;
+		memcpy(key, secondary_key, sizeof(key));
+		http_request_reduce_secondary_key(ent->secondary_key_signature, key);
+		if (secondary_key_cmp(ent->secondary_key, key) == 0)
+			return ent;
 	}
-	return 0;
+	return NULL;
 }
 
-static int
-cache_store_strm_init(struct stream *s, struct filter *filter)
+/* Removes from the disk tier of <cache> all the records of the objects of
+ * primary key <hash>.
+ */
+static void cache_disk_forget(struct cache *cache, const char *hash)
 {
-	struct cache_st *st;
-
-	st = pool_alloc(pool_head_cache_st);
-	if (st == NULL)
-		return -1;
+	struct cache_disk *disk = cache->disk;
+	struct cache_disk_entry *ent;
+	struct eb32_node *node, *next;
 
-	st->first_block = NULL;
-	filter->ctx     = st;
+	if (!disk)
+		return;
 
-	/* Register post-analyzer on AN_RES_WAIT_HTTP */
-	filter->post_analyzers |= AN_RES_WAIT_HTTP;
-	return 1;
+	HA_SPIN_LOCK(CACHE_LOCK, &disk->lock);
+	node = eb32_lookup(&disk->index, read_u32(hash));
+	while (node) {
+		next = eb32_next_dup(node);
+		ent = eb32_entry(node, struct cache_disk_entry, eb);
+		if (memcmp(ent->hash, hash, sizeof(ent->hash)) == 0)
+			cache_disk_evict(disk, ent);
+		node = next;
+	}
+	HA_SPIN_UNLOCK(CACHE_LOCK, &disk->lock);
 }
 
-static void
-cache_store_strm_deinit(struct stream *s, struct filter *filter)
+/* Writes the object of row <first> of <cache> to the disk tier, unless it is
+ * already there. Nothing is done if too much data are already waiting to be
+ * written. The row's blocks must remain intact during the call, so it is
+ * either called under the shctx lock for a row being evicted, which must then
+ * not exceed CACHE_DISK_SYNC_MAX bytes to keep the lock short, or for a hot
+ * row whose storage just completed.
+ */
+static void cache_disk_demote(struct cache *cache, struct shared_block *first)
 {
-	struct cache_st *st = filter->ctx;
-	struct cache_flt_conf *cconf = FLT_CONF(filter);
-	struct cache *cache = cconf->c.cache;
+	struct cache_entry *object = (struct cache_entry *)first->data;
 	struct shared_context *shctx = shctx_ptr(cache);
+	struct cache_disk *disk = cache->disk;
+	struct cache_disk_entry *ent;
+	struct cache_disk_io *io;
+	unsigned long long reclen;
+	int stored;
 
-	/* Everything should be released in the http_end filter, but we need to do it
-	 * there too, in case of errors */
-	if (st && st->first_block) {
-		struct cache_entry *object = (struct cache_entry *)st->first_block->data;
-		if (!object->complete) {
-			/* The stream was closed but the 'complete' flag was not
-			 * set which means that cache_store_http_end was not
-			 * called. The stream must have been closed before we
-			 * could store the full answer in the cache.
-			 */
-			release_entry_unlocked(&cache->trees[object->eb.key % CACHE_TREE_NUM], object);
-		}
-		shctx_wrlock(shctx);
-		shctx_row_reattach(shctx, st->first_block);
-		shctx_wrunlock(shctx);
-	}
-	if (st) {
-		pool_free(pool_head_cache_st, st);
-		filter->ctx = NULL;
+	if (object->expire <= date.tv_sec)
+		return;
+
+	reclen = cache_disk_reclen(first->len);
+	if (reclen > disk->size)
+		return;
+
+	HA_SPIN_LOCK(CACHE_LOCK, &disk->lock);
+	stored = !!cache_disk_get(disk, object->hash, object->secondary_key_signature, object->secondary_key, 1);
+	HA_SPIN_UNLOCK(CACHE_LOCK, &disk->lock);
+	if (stored)
+		return;
+
+	if (HA_ATOMIC_ADD_FETCH(&disk->pending, reclen) > CACHE_DISK_MAX_PENDING)
+		goto drop;
+
+	io = malloc(sizeof(*io) + reclen);
+	ent = malloc(sizeof(*ent));
+	if (!io || !ent || !workq_job_init(&io->job, cache_disk_write, NULL)) {
+		free(io);
+		free(ent);
+		goto drop;
 	}
+
+	memset(io->hdr, 0, reclen);
+	shctx_row_data_get(shctx, first, (unsigned char *)(io->hdr + 1), 0, first->len);
+	io->disk = disk;
+	io->len = reclen;
+	io->hdr->len = first->len;
+	io->hdr->magic = CACHE_DISK_MAGIC;
+
+	memset(ent, 0, sizeof(*ent));
+	ent->len = first->len;
+	ent->expire = object->expire;
+	ent->eb.key = read_u32(object->hash);
+	ent->secondary_key_signature = object->secondary_key_signature;
+	memcpy(ent->hash, object->hash, sizeof(ent->hash));
+	memcpy(ent->secondary_key, object->secondary_key, sizeof(ent->secondary_key));
+
+	/* the write is queued under the lock so that no read of this record
+	 * may be queued before it.
+	 */
+	HA_SPIN_LOCK(CACHE_LOCK, &disk->lock);
+	ent->ofs = io->ofs = cache_disk_alloc(disk, reclen);
+	ent->seq = io->hdr->seq = disk->seq++;
+	eb32_insert(&disk->index, &ent->eb);
+	LIST_APPEND(&disk->order, &ent->list);
+	disk->used += reclen;
+	disk->records++;
+	workq_submit(disk->wq, &io->job);
+	HA_SPIN_UNLOCK(CACHE_LOCK, &disk->lock);
+
+	HA_ATOMIC_INC(&disk->demoted);
+	return;
+
+  drop:
+	HA_ATOMIC_SUB(&disk->pending, reclen);
+	HA_ATOMIC_INC(&disk->dropped);
 }
 
-static int
-cache_store_post_analyze(struct stream *s, struct filter *filter, struct channel *chn,
-			 unsigned an_bit)
+/* Looks up in the disk tier of the cache of <cconf> an object suitable to
+ * respond to the request of stream <s>, and queues the read of its record.
+ * Returns 1 if the stream must wait for the read, otherwise 0.
+ */
+static int cache_disk_fetch(struct stream *s, struct cache_flt_conf *cconf)
 {
+	struct cache *cache = cconf->c.cache;
+	struct cache_disk *disk = cache->disk;
 	struct http_txn *txn = s->txn;
-	struct http_msg *msg = &txn->rsp;
-	struct cache_st *st = filter->ctx;
+	struct cache_disk_entry *ent;
+	struct cache_disk_io *io;
+	struct cache_st *st;
+	unsigned long long ofs = 0, seq = 0;
+	unsigned int len = 0;
 
-	if (an_bit != AN_RES_WAIT_HTTP)
-		goto end;
+	st = cache_strm_ctx(s, cconf);
+	if (!st || st->disk_io)
+		return 0;
 
-	/* Here we need to check if any compression filter precedes the cache
-	 * filter. This is only possible when the compression is configured in
-	 * the frontend while the cache filter is configured on the
-	 * backend. This case cannot be detected during HAProxy startup. So in
-	 * such cases, the cache is disabled.
+	HA_SPIN_LOCK(CACHE_LOCK, &disk->lock);
+	ent = cache_disk_get(disk, txn->cache_hash, 0,
+	                     (txn->flags & TX_CACHE_HAS_SEC_KEY) ? txn->cache_secondary_hash : NULL, 0);
+	if (ent) {
+		ofs = ent->ofs;
+		seq = ent->seq;
+		len = ent->len;
+	}
+	HA_SPIN_UNLOCK(CACHE_LOCK, &disk->lock);
+
+	if (!ent)
+		return 0;
+
+	/* the record may be overwritten before it is read, which its sequence
+	 * number will reveal.
 	 */
-	if (st && (msg->flags & HTTP_MSGF_COMPRESSING)) {
-		pool_free(pool_head_cache_st, st);
-		filter->ctx = NULL;
+	io = malloc(sizeof(*io) + cache_disk_reclen(len));
+	if (!io)
+		return 0;
+	if (!workq_job_init(&io->job, cache_disk_read, cache_disk_read_done)) {
+		free(io);
+		return 0;
 	}
 
-  end:
+	io->disk = disk;
+	io->strm = s;
+	io->ofs = ofs;
+	io->seq = seq;
+	io->len = cache_disk_reclen(len);
+	io->done = io->error = 0;
+	st->disk_io = io;
+	workq_submit(disk->wq, &io->job);
 	return 1;
 }
 
-static int
-cache_store_http_headers(struct stream *s, struct filter *filter, struct http_msg *msg)
+/* Inserts into the memory of <cache> the object read by request <io>. Returns
+ * 1 if it was inserted or if another version of this object is present,
+ * otherwise 0.
+ */
+static int cache_disk_promote(struct cache *cache, struct cache_disk_io *io)
 {
-	struct cache_st *st = filter->ctx;
+	struct shared_context *shctx = shctx_ptr(cache);
+	struct cache_disk *disk = cache->disk;
+	struct cache_entry *object, *old;
+	struct cache_tree *cache_tree;
+	struct shared_block *first;
+	unsigned int key;
 
-	if (!(msg->chn->flags & CF_ISRESP) || !st)
-		return 1;
+	if (io->error || io->hdr->magic != CACHE_DISK_MAGIC || io->hdr->seq != io->seq ||
+	    cache_disk_reclen(io->hdr->len) != io->len) {
+		HA_ATOMIC_INC(&disk->errors);
+		return 0;
+	}
 
-	if (st->first_block)
-		register_data_filter(s, msg->chn, filter);
+	object = (struct cache_entry *)(io->hdr + 1);
+	if (object->expire <= date.tv_sec)
+		return 0;
+
+	first = shctx_row_reserve_hot(shctx, NULL, io->hdr->len);
+	if (!first)
+		return 0;
+	first->key = read_u32(object->hash);
+
+	shctx_row_data_append(shctx, first, (unsigned char *)object, io->hdr->len);
+
+	/* the stored entry is not indexed */
+	object = (struct cache_entry *)first->data;
+	key = read_u32(object->hash);
+	memset(&object->eb, 0, sizeof(object->eb));
+	object->eb.key = key;
+	object->complete = 0;
+	object->refcount = 0;
+	object->revalidating = 0;
+	object->secondary_entries_count = 0;
+	object->last_clear_ts = 0;
+
+	cache_tree = &cache->trees[key % CACHE_TREE_NUM];
+	cache_wrlock(cache_tree);
+	old = get_entry(cache_tree, object->hash, 1);
+	if (old && object->secondary_key_signature)
+		old = get_secondary_entry(cache_tree, old, object->secondary_key, 1);
+	if (old || insert_entry(cache, cache_tree, object) != &object->eb) {
+		object->eb.key = 0;
+		cache_wrunlock(cache_tree);
+		shctx_wrlock(shctx);
+		first->len = 0;
+		shctx_row_reattach(shctx, first);
+		shctx_wrunlock(shctx);
+		return !!old;
+	}
+	cache_wrunlock(cache_tree);
+
+	/* its record may have been overwritten in the mean time */
+	if (first->len > CACHE_DISK_SYNC_MAX)
+		cache_disk_demote(cache, first);
+
+	shctx_wrlock(shctx);
+	object->complete = 1;
+	shctx_row_reattach(shctx, first);
+	shctx_wrunlock(shctx);
 	return 1;
 }
 
-static inline void disable_cache_entry(struct cache_st *st,
-                                       struct filter *filter, struct shared_context *shctx)
+/* Creates the disk tier of <cache> in its disk-dir directory. Returns 1 on
+ * success, 0 on error with <err> filled.
+ */
+static int cache_disk_new(struct cache *cache, char **err)
 {
-	struct cache_entry *object;
-	struct cache *cache = (struct cache*)shctx->data;
+	struct cache_disk *disk;
+	char *path = NULL;
+	int fd = -1;
+
+	disk = calloc(1, sizeof(*disk));
+	if (!disk || !memprintf(&path, "%s/haproxy-cache-XXXXXX", cache->disk_dir)) {
+		memprintf(err, "out of memory");
+		goto fail;
+	}
 
-	object = (struct cache_entry *)st->first_block->data;
-	filter->ctx = NULL; /* disable cache  */
-	release_entry_unlocked(&cache->trees[object->eb.key % CACHE_TREE_NUM], object);
-	shctx_wrlock(shctx);
-	shctx_row_reattach(shctx, st->first_block);
-	shctx_wrunlock(shctx);
-	pool_free(pool_head_cache_st, st);
+	/* the file is removed immediately so that nothing else may use it,
+	 * including a new process after a reload.
+	 */
+	fd = mkstemp(path);
+	if (fd < 0) {
+		memprintf(err, "cannot create a file in '%s' : %s", cache->disk_dir, strerror(errno));
+		goto fail;
+	}
+	unlink(path);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	if (ftruncate(fd, cache->disk_size) < 0) {
+		memprintf(err, "cannot set the size of the file in '%s' : %s", cache->disk_dir, strerror(errno));
+		goto fail;
+	}
+
+	chunk_printf(&trash, "cache '%s'", cache->id);
+	disk->wq = workq_new(trash.area, 1, err);
+	if (!disk->wq)
+		goto fail;
+
+	disk->fd = fd;
+	disk->size = cache->disk_size;
+	disk->index = EB_ROOT;
+	LIST_INIT(&disk->order);
+	HA_SPIN_INIT(&disk->lock);
+	cache->disk = disk;
+	free(path);
+	return 1;
+
+  fail:
+	if (fd >= 0)
+		close(fd);
+	free(path);
+	free(disk);
+	return 0;
 }
 
-static int
-cache_store_http_payload(struct stream *s, struct filter *filter, struct http_msg *msg,
-			 unsigned int offset, unsigned int len)
+/* Returns the fill in progress of primary key <hash> in <cache>, or NULL. Must
+ * be called under the fill lock.
+ */
+static struct cache_fill *cache_fill_get(struct cache *cache, const char *hash)
 {
-	struct cache_flt_conf *cconf = FLT_CONF(filter);
-	struct shared_context *shctx = shctx_ptr(cconf->c.cache);
-	struct cache_st *st = filter->ctx;
-	struct htx *htx = htxbuf(&msg->chn->buf);
-	struct htx_blk *blk;
-	struct shared_block *fb;
-	struct htx_ret htxret;
-	unsigned int orig_len, to_forward;
-	int ret;
+	struct eb32_node *node;
+	struct cache_fill *fill;
 
-	if (!len)
-		return len;
+	for (node = eb32_lookup(&cache->fills, read_u32(hash)); node; node = eb32_next_dup(node)) {
+		fill = eb32_entry(node, struct cache_fill, eb);
+		if (memcmp(fill->hash, hash, sizeof(fill->hash)) == 0)
+			return fill;
+	}
+	return NULL;
+}
 
-	if (!st->first_block) {
-		unregister_data_filter(s, msg->chn, filter);
-		return len;
+/* Creates and indexes a fill of primary key <hash> in <cache>. Must be called
+ * under the fill lock. Returns the fill or NULL on memory allocation error.
+ */
+static struct cache_fill *cache_fill_new(struct cache *cache, const char *hash)
+{
+	struct cache_fill *fill;
+
+	fill = pool_alloc(pool_head_cache_fill);
+	if (fill) {
+		memcpy(fill->hash, hash, sizeof(fill->hash));
+		fill->eb.key = read_u32(fill->hash);
+		LIST_INIT(&fill->waiters);
+		eb32_insert(&cache->fills, &fill->eb);
 	}
+	return fill;
+}
 
-	orig_len = len;
-	to_forward = 0;
+/* Registers stream <s>, whose cache context is <st>, as a waiter of the fill
+ * <fill> of <cache>. Must be called under the fill lock. The stream waits at
+ * most "coalesce-timeout" if set, otherwise until the fill ends.
+ */
+static void cache_fill_add_waiter(struct cache *cache, struct cache_fill *fill,
+                                  struct cache_st *st, struct stream *s)
+{
+	st->coalesced = 1;
+	LIST_APPEND(&fill->waiters, &st->fill_list);
+	HA_ATOMIC_STORE(&st->waiting, fill);
+	_HA_ATOMIC_INC(&cache->coalesced);
+	s->req.analyse_exp = (cache->coalesce_timeout ?
+			      tick_add(now_ms, MS_TO_TICKS(cache->coalesce_timeout)) :
+			      TICK_ETERNITY);
+}
 
-	htxret = htx_find_offset(htx, offset);
-	blk = htxret.blk;
-	offset = htxret.ret;
-	for (; blk && len; blk = htx_get_next_blk(htx, blk)) {
-		enum htx_blk_type type = htx_get_blk_type(blk);
-		uint32_t info, sz = htx_get_blksz(blk);
-		struct ist v;
+/* Called when stream <s>, whose cache context is <st>, missed its object in
+ * <cache>. If another stream is already fetching the same object, <s> waits
+ * for it and ACT_RET_YIELD is returned. Otherwise <s> starts a new fill that
+ * the next streams will wait for, and ACT_RET_CONT is returned so that the
+ * request is forwarded to the server. A stream only waits once, and never
+ * when request coalescing is disabled.
+ */
+static enum act_return cache_fill_join(struct cache *cache, struct cache_st *st,
+                                       struct stream *s, int flags)
+{
+	struct cache_fill *fill;
 
-		switch (type) {
-			case HTX_BLK_UNUSED:
-				break;
+	if (!cache->coalesce_timeout || !st || st->fill || st->coalesced || (flags & ACT_OPT_FINAL))
+		return ACT_RET_CONT;
 
-			case HTX_BLK_DATA:
-				v = htx_get_blk_value(htx, blk);
-				v = istadv(v, offset);
-				v = isttrim(v, len);
+	HA_SPIN_LOCK(CACHE_LOCK, &cache->fill_lock);
+	fill = cache_fill_get(cache, s->txn->cache_hash);
+	if (fill) {
+		cache_fill_add_waiter(cache, fill, st, s);
+		HA_SPIN_UNLOCK(CACHE_LOCK, &cache->fill_lock);
+		return ACT_RET_YIELD;
+	}
 
-				info = (type << 28) + v.len;
-				fb = shctx_row_reserve_hot(shctx, st->first_block, sizeof(info)+v.len);
-				if (!fb)
-					goto no_cache;
-				ret = shctx_row_data_append(shctx, st->first_block, (unsigned char *)&info, sizeof(info));
-				if (ret < 0)
-					goto no_cache;
-				ret = shctx_row_data_append(shctx, st->first_block, (unsigned char *)istptr(v), istlen(v));
-				if (ret < 0)
-					goto no_cache;
-				ASSUME_NONNULL((struct cache_entry *)st->first_block->data)->body_size += v.len;
-				to_forward += v.len;
-				len -= v.len;
-				break;
+	st->fill = cache_fill_new(cache, s->txn->cache_hash);
+	HA_SPIN_UNLOCK(CACHE_LOCK, &cache->fill_lock);
+	return ACT_RET_CONT;
+}
 
-			default:
-				/* Here offset must always be 0 because only
-				 * DATA blocks can be partially transferred. */
-				if (offset)
-					goto no_cache;
-				if (sz > len)
-					goto end;
+/* Makes stream <s>, whose cache context is <st>, wait for the fill in
+ * progress of its object in <cache>, if any, even when request coalescing is
+ * disabled. Returns 1 if the stream must wait, otherwise 0.
+ */
+static int cache_fill_wait(struct cache *cache, struct cache_st *st,
+                           struct stream *s, int flags)
+{
+	struct cache_fill *fill;
 
-				fb = shctx_row_reserve_hot(shctx, st->first_block, sizeof(blk->info)+sz);
-				if (!fb)
-					goto no_cache;
-				ret = shctx_row_data_append(shctx, st->first_block, (unsigned char *)&(blk->info), sizeof(blk->info));
-				if (ret < 0)
-					goto no_cache;
-				ret = shctx_row_data_append(shctx, st->first_block, (unsigned char *)htx_get_blk_ptr(htx, blk), sz);
-				if (ret < 0)
-					goto no_cache;
-				to_forward += sz;
-				len -= sz;
-				break;
-		}
+	if (!st || st->fill || st->coalesced || (flags & ACT_OPT_FINAL))
+		return 0;
 
-		offset = 0;
+	HA_SPIN_LOCK(CACHE_LOCK, &cache->fill_lock);
+	fill = cache_fill_get(cache, s->txn->cache_hash);
+	if (fill)
+		cache_fill_add_waiter(cache, fill, st, s);
+	HA_SPIN_UNLOCK(CACHE_LOCK, &cache->fill_lock);
+	return !!fill;
+}
+
+/* Stops waiting for a fill of <cache> for cache context <st>. Returns 1 if it
+ * was still waiting, or 0 if the fill already ended.
+ */
+static int cache_fill_leave(struct cache *cache, struct cache_st *st)
+{
+	int ret = 0;
+
+	HA_SPIN_LOCK(CACHE_LOCK, &cache->fill_lock);
+	if (st->waiting) {
+		LIST_DEL_INIT(&st->fill_list);
+		HA_ATOMIC_STORE(&st->waiting, NULL);
+		ret = 1;
 	}
+	HA_SPIN_UNLOCK(CACHE_LOCK, &cache->fill_lock);
+	return ret;
+}
 
-  end:
-	return to_forward;
+/* Ends and releases fill <fill> of <cache>, if not NULL. The waiting streams
+ * are woken up to look the object up again: they find it if it was stored,
+ * otherwise they forward their request to the server. A waiter may see its
+ * wait end before its task is woken up, so a stream which ever waited must
+ * always go through cache_fill_leave() before being freed, in order not to
+ * vanish under the lock.
+ */
+static void cache_fill_release(struct cache *cache, struct cache_fill *fill)
+{
+	struct cache_st *waiter, *back;
 
-  no_cache:
-	disable_cache_entry(st, filter, shctx);
-	unregister_data_filter(s, msg->chn, filter);
-	return orig_len;
+	if (!fill)
+		return;
+
+	HA_SPIN_LOCK(CACHE_LOCK, &cache->fill_lock);
+	eb32_delete(&fill->eb);
+	list_for_each_entry_safe(waiter, back, &fill->waiters, fill_list) {
+		LIST_DEL_INIT(&waiter->fill_list);
+		HA_ATOMIC_STORE(&waiter->waiting, NULL);
+		task_wakeup(waiter->strm->task, TASK_WOKEN_MSG);
+	}
+	HA_SPIN_UNLOCK(CACHE_LOCK, &cache->fill_lock);
+
+	pool_free(pool_head_cache_fill, fill);
 }
 
-static int
-cache_store_http_end(struct stream *s, struct filter *filter,
-                     struct http_msg *msg)
+/* Ends the fill of <cache> owned by cache context <st>, if any */
+static void cache_fill_end(struct cache *cache, struct cache_st *st)
 {
-	struct cache_st *st = filter->ctx;
-	struct cache_flt_conf *cconf = FLT_CONF(filter);
-	struct cache *cache = cconf->c.cache;
-	struct shared_context *shctx = shctx_ptr(cache);
-	struct cache_entry *object;
+	cache_fill_release(cache, st->fill);
+	st->fill = NULL;
+}
 
-	if (!(msg->chn->flags & CF_ISRESP))
-		return 1;
+/* Ends the fill of <cache> owned by any cache filter of stream <s>. The fill
+ * is owned by the filter of the "cache-use" rule, which may differ from the
+ * one of the "cache-store" rule.
+ */
+static void cache_fill_end_strm(struct stream *s, struct cache *cache)
+{
+	struct cache_flt_conf *cconf;
+	struct filter *filter;
 
-	if (st && st->first_block) {
+	list_for_each_entry(filter, &s->strm_flt.filters, list) {
+		if (FLT_ID(filter) != cache_store_flt_id || !filter->ctx)
+			continue;
+		cconf = FLT_CONF(filter);
+		if (cconf->c.cache == cache)
+			cache_fill_end(cache, filter->ctx);
+	}
+}
 
-		object = (struct cache_entry *)st->first_block->data;
+/* Returns non-zero if <cache> maintains a purge index */
+static inline int cache_purge_enabled(const struct cache *cache)
+{
+	return cache->purge_hdr || cache->purge_prefix;
+}
 
-		shctx_wrlock(shctx);
-		/* The whole payload was cached, the entry can now be used. */
-		object->complete = 1;
-		/* remove from the hotlist */
-		shctx_row_reattach(shctx, st->first_block);
-		shctx_wrunlock(shctx);
+/* Returns the purge record of primary key <hash> in <cache>, or NULL. Must be
+ * called under the purge lock.
+ */
+static struct cache_purge_obj *cache_purge_get(struct cache *cache, const char *hash)
+{
+	struct eb32_node *node;
+	struct cache_purge_obj *obj;
 
+	for (node = eb32_lookup(&cache->purge_objs, read_u32(hash)); node; node = eb32_next_dup(node)) {
+		obj = eb32_entry(node, struct cache_purge_obj, eb);
+		if (memcmp(obj->hash, hash, sizeof(obj->hash)) == 0)
+			return obj;
 	}
-	if (st) {
-		pool_free(pool_head_cache_st, st);
-		filter->ctx = NULL;
+	return NULL;
+}
+
+/* Releases the references of type <type> of purge record <obj> of <cache>, or
+ * all of them if <type> is negative. Must be called under the purge lock.
+ */
+static void cache_purge_unref(struct cache *cache, struct cache_purge_obj *obj, int type)
+{
+	struct cache_purge_ref *ref, *back;
+
+	list_for_each_entry_safe(ref, back, &obj->refs, list) {
+		if (type >= 0 && ref->type != type)
+			continue;
+		ebmb_delete(&ref->node);
+		LIST_DELETE(&ref->list);
+		free(ref);
 	}
+}
 
-	return 1;
+/* Removes purge record <obj> and its references from the purge index of
+ * <cache>, without releasing it. Must be called under the purge lock.
+ */
+static void cache_purge_unlink(struct cache *cache, struct cache_purge_obj *obj)
+{
+	cache_purge_unref(cache, obj, -1);
+	eb32_delete(&obj->eb);
+	eb32_delete(&obj->exp);
+	cache->purge_records--;
 }
 
- /*
-  * This intends to be used when checking HTTP headers for some
-  * word=value directive. Return a pointer to the first character of value, if
-  * the word was not found or if there wasn't any value assigned to it return NULL
-  */
-char *directive_value(const char *sample, int slen, const char *word, int wlen)
+/* Releases at most <max> purge records of <cache> whose objects are all
+ * expired. Must be called under the purge lock.
+ */
+static void cache_purge_expire(struct cache *cache, int max)
 {
-	int st = 0;
+	struct cache_purge_obj *obj;
+	struct eb32_node *node;
 
-	if (slen < wlen)
+	while (max-- && (node = eb32_first(&cache->purge_exp)) && node->key <= date.tv_sec) {
+		obj = eb32_entry(node, struct cache_purge_obj, exp);
+		cache_purge_unlink(cache, obj);
+		free(obj);
+	}
+}
+
+/* Allocates a purge reference of type <type> to <key> and appends it to
+ * <list>. Returns 1 on success, 0 on memory allocation error.
+ */
+static int cache_purge_new_ref(struct list *list, int type, struct ist key)
+{
+	struct cache_purge_ref *ref;
+
+	ref = malloc(sizeof(*ref) + istlen(key) + 1);
+	if (!ref)
 		return 0;
 
-	while (wlen) {
-		char c = *sample ^ *word;
-		if (c && c != ('A' ^ 'a'))
-			return NULL;
-		sample++;
-		word++;
-		slen--;
-		wlen--;
+	ref->obj = NULL;
+	ref->type = type;
+	memcpy(ref->node.key, istptr(key), istlen(key));
+	ref->node.key[istlen(key)] = 0;
+	LIST_APPEND(list, &ref->list);
+	return 1;
+}
+
+/* Records in the purge index of <cache> that objects of primary key <hash>,
+ * expiring at <expire>, are stored. Their path <path> with its directories,
+ * and the tags found in the headers of response <htx> replace the ones indexed
+ * for this primary key, unless they are respectively IST_NULL and NULL. The
+ * tags are the words of the "purge-tags-header" headers, delimited by spaces
+ * or commas.
+ */
+static void cache_purge_index(struct cache *cache, const char *hash, struct ist path,
+                              struct htx *htx, unsigned int expire)
+{
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	struct list refs = LIST_HEAD_INIT(refs);
+	struct cache_purge_ref *ref, *back;
+	struct cache_purge_obj *obj;
+	const char *p, *end, *word;
+	int tags = 0, dirs = 0;
+
+	if (!cache_purge_enabled(cache))
+		return;
+
+	if (!cache->purge_prefix)
+		path = IST_NULL;
+	if (!cache->purge_hdr)
+		htx = NULL;
+
+	if (isttest(path)) {
+		/* the directories are delimited by the slashes before the
+		 * query string, the path itself may be one of them.
+		 */
+		end = istend(path);
+		for (p = istptr(path); p < end && *p != '?' && dirs < CACHE_PURGE_MAX_DIRS; p++) {
+			if (*p != '/' || p + 1 == end)
+				continue;
+			if (!cache_purge_new_ref(&refs, CACHE_PURGE_PATH, ist2(istptr(path), p + 1 - istptr(path))))
+				goto end;
+			dirs++;
+		}
+		if (!cache_purge_new_ref(&refs, CACHE_PURGE_PATH, path))
+			goto end;
 	}
 
-	while (slen) {
-		if (st == 0) {
-			if (*sample != '=')
-				return NULL;
-			sample++;
-			slen--;
-			st = 1;
-			continue;
-		} else {
-			return (char *)sample;
+	while (htx && tags < CACHE_PURGE_MAX_TAGS &&
+	       http_find_header(htx, ist(cache->purge_hdr), &ctx, 1)) {
+		p = istptr(ctx.value);
+		end = istend(ctx.value);
+		while (p < end && tags < CACHE_PURGE_MAX_TAGS) {
+			while (p < end && (HTTP_IS_LWS(*p) || *p == ','))
+				p++;
+			word = p;
+			while (p < end && !HTTP_IS_LWS(*p) && *p != ',')
+				p++;
+			if (p == word)
+				continue;
+			if (!cache_purge_new_ref(&refs, CACHE_PURGE_TAG, ist2(word, p - word)))
+				goto end;
+			tags++;
 		}
 	}
 
-	return NULL;
+	HA_SPIN_LOCK(CACHE_LOCK, &cache->purge_lock);
+	cache_purge_expire(cache, CACHE_PURGE_MAX_EXPIRE);
+	obj = cache_purge_get(cache, hash);
+	if (!obj) {
+		if (LIST_ISEMPTY(&refs) || !(obj = malloc(sizeof(*obj)))) {
+			HA_SPIN_UNLOCK(CACHE_LOCK, &cache->purge_lock);
+			goto end;
+		}
+		memcpy(obj->hash, hash, sizeof(obj->hash));
+		obj->eb.key = read_u32(obj->hash);
+		obj->exp.key = expire;
+		LIST_INIT(&obj->refs);
+		LIST_INIT(&obj->list);
+		eb32_insert(&cache->purge_objs, &obj->eb);
+		cache->purge_records++;
+	}
+	else {
+		if (htx)
+			cache_purge_unref(cache, obj, CACHE_PURGE_TAG);
+		if (isttest(path))
+			cache_purge_unref(cache, obj, CACHE_PURGE_PATH);
+		/* other objects of this primary key may expire later */
+		eb32_delete(&obj->exp);
+		obj->exp.key = MAX(obj->exp.key, expire);
+	}
+	eb32_insert(&cache->purge_exp, &obj->exp);
+
+	list_for_each_entry_safe(ref, back, &refs, list) {
+		LIST_DELETE(&ref->list);
+		LIST_APPEND(&obj->refs, &ref->list);
+		ref->obj = obj;
+		ebst_insert((ref->type == CACHE_PURGE_PATH) ? &cache->purge_paths : &cache->purge_tags,
+		            &ref->node);
+	}
+
+	if (LIST_ISEMPTY(&obj->refs)) {
+		cache_purge_unlink(cache, obj);
+		free(obj);
+	}
+	HA_SPIN_UNLOCK(CACHE_LOCK, &cache->purge_lock);
+
+  end:
+	list_for_each_entry_safe(ref, back, &refs, list) {
+		LIST_DELETE(&ref->list);
+		free(ref);
+	}
+}
+
+/* Removes from the purge index of <cache> the record of primary key <hash>,
+ * whose objects are gone.
+ */
+static void cache_purge_forget(struct cache *cache, const char *hash)
+{
+	struct cache_purge_obj *obj;
+
+	HA_SPIN_LOCK(CACHE_LOCK, &cache->purge_lock);
+	obj = cache_purge_get(cache, hash);
+	if (obj) {
+		cache_purge_unlink(cache, obj);
+		free(obj);
+	}
+	HA_SPIN_UNLOCK(CACHE_LOCK, &cache->purge_lock);
+}
+
+/* Deletes from all the tiers of <cache> the objects tagged with <str> if
+ * <type> is CACHE_PURGE_TAG, or whose path or one of its directories is <str>
+ * if it is CACHE_PURGE_PATH. The objects being delivered remain so until the
+ * end. The cost only depends on the number of matching objects. Returns the
+ * number of purged primary keys.
+ */
+static unsigned int cache_purge(struct cache *cache, int type, const char *str)
+{
+	struct list objs = LIST_HEAD_INIT(objs);
+	struct cache_purge_obj *obj, *back;
+	struct cache_purge_ref *ref;
+	struct cache_entry *entry;
+	struct cache_tree *tree;
+	struct eb32_node *node, *next;
+	struct ebmb_node *rnode;
+	unsigned int count = 0;
+
+	HA_SPIN_LOCK(CACHE_LOCK, &cache->purge_lock);
+	rnode = ebst_lookup((type == CACHE_PURGE_PATH) ? &cache->purge_paths : &cache->purge_tags, str);
+	for (; rnode; rnode = ebmb_next_dup(rnode)) {
+		ref = ebmb_entry(rnode, struct cache_purge_ref, node);
+		if (!LIST_INLIST(&ref->obj->list))
+			LIST_APPEND(&objs, &ref->obj->list);
+	}
+
+	list_for_each_entry(obj, &objs, list)
+		cache_purge_unlink(cache, obj);
+	HA_SPIN_UNLOCK(CACHE_LOCK, &cache->purge_lock);
+
+	list_for_each_entry_safe(obj, back, &objs, list) {
+		tree = get_cache_tree_from_hash(cache, read_u32(obj->hash));
+		cache_wrlock(tree);
+		node = eb32_lookup(&tree->entries, read_u32(obj->hash));
+		while (node) {
+			next = eb32_next_dup(node);
+			entry = eb32_entry(node, struct cache_entry, eb);
+			if (memcmp(entry->hash, obj->hash, sizeof(entry->hash)) == 0) {
+				/* unindexed immediately since it may still be referenced */
+				delete_entry(entry);
+				release_entry_locked(tree, entry);
+			}
+			node = next;
+		}
+		cache_wrunlock(tree);
+		cache_disk_forget(cache, obj->hash);
+
+		LIST_DELETE(&obj->list);
+		free(obj);
+		count++;
+	}
+
+	_HA_ATOMIC_ADD(&cache->purged, count);
+	return count;
+}
+
+/* Returns the path recorded for the purge index of <cache> by the filter of
+ * the "cache-use" rule of stream <s>, or IST_NULL.
+ */
+static struct ist cache_purge_path(struct stream *s, struct cache *cache)
+{
+	struct cache_flt_conf *cconf;
+	struct filter *filter;
+	struct cache_st *st;
+
+	list_for_each_entry(filter, &s->strm_flt.filters, list) {
+		if (FLT_ID(filter) != cache_store_flt_id || !(st = filter->ctx))
+			continue;
+		cconf = FLT_CONF(filter);
+		if (cconf->c.cache == cache && st->purge_path)
+			return ist(st->purge_path);
+	}
+	return IST_NULL;
+}
+
+
+
+static int
+cache_store_init(struct proxy *px, struct flt_conf *fconf)
+{
+	fconf->flags |= FLT_CFG_FL_HTX;
+	return 0;
+}
+
+static void
+cache_store_deinit(struct proxy *px, struct flt_conf *fconf)
+{
+	struct cache_flt_conf *cconf = fconf->conf;
+
+	if (!(cconf->flags & CACHE_FLT_INIT))
+		free(cconf->c.name);
+	free(cconf);
+}
+
+static int
+cache_store_check(struct proxy *px, struct flt_conf *fconf)
+{
+	struct cache_flt_conf *cconf = fconf->conf;
+	struct flt_conf *f;
+	struct cache *cache;
+	int comp = 0;
+
+	/* Find the cache corresponding to the name in the filter config.  The
+	*  cache will not be referenced now in the filter config because it is
+	*  not fully allocated. This step will be performed during the cache
+	*  post_check.
+	*/
+	list_for_each_entry(cache, &caches_config, list) {
+		if (strcmp(cache->id, cconf->c.name) == 0)
+			goto found;
+	}
+
+	ha_alert("config: %s '%s': unable to find the cache '%s' referenced by the filter 'cache'.\n",
+		 proxy_type_str(px), px->id, (char *)cconf->c.name);
+	return 1;
+
+  found:
+	/* Here <cache> points on the cache the filter must use and <cconf>
+	 * points on the cache filter configuration. */
+
+	/* Check all filters for proxy <px> to know if the compression is
+	 * enabled and if it is after the cache. When the compression is before
+	 * the cache, an error is returned. Also check if the cache filter must
+	 * be explicitly declaired or not. */
+	list_for_each_entry(f, &px->filter_configs, list) {
+		if (f == fconf) {
+			/* The compression filter must be evaluated after the cache. */
+			if (comp) {
+				ha_alert("config: %s '%s': unable to enable the compression filter before "
+					 "the cache '%s'.\n", proxy_type_str(px), px->id, cache->id);
+				return 1;
+			}
+		}
+		else if (f->id == http_comp_req_flt_id || f->id == http_comp_res_flt_id)
+			comp = 1;
+		else if (f->id == fcgi_flt_id)
+			continue;
+		else if ((f->id != fconf->id) && (cconf->flags & CACHE_FLT_F_IMPLICIT_DECL)) {
+			/* Implicit declaration is only allowed with the
+			 * compression and fcgi. For other filters, an implicit
+			 * declaration is required. */
+			ha_alert("config: %s '%s': require an explicit filter declaration "
+				 "to use the cache '%s'.\n", proxy_type_str(px), px->id, cache->id);
+			return 1;
+		}
+
+	}
+	return 0;
+}
+
+static int
+cache_store_strm_init(struct stream *s, struct filter *filter)
+{
+	struct cache_st *st;
+
+	st = pool_alloc(pool_head_cache_st);
+	if (st == NULL)
+		return -1;
+
+	st->first_block = NULL;
+	st->disk_io     = NULL;
+	st->fill        = NULL;
+	st->waiting     = NULL;
+	LIST_INIT(&st->fill_list);
+	st->strm        = s;
+	st->purge_path  = NULL;
+	st->comp_ctx    = NULL;
+	st->coalesced   = 0;
+	filter->ctx     = st;
+
+	/* Register post-analyzer on AN_RES_WAIT_HTTP */
+	filter->post_analyzers |= AN_RES_WAIT_HTTP;
+	return 1;
+}
+
+/* Releases the filter context <st> of a stream */
+static void cache_st_free(struct cache_st *st)
+{
+#if defined(USE_ZLIB)
+	if (st->comp_ctx)
+		cache_comp_algo->end(&st->comp_ctx);
+#endif
+	free(st->purge_path);
+	pool_free(pool_head_cache_st, st);
+}
+
+static void
+cache_store_strm_deinit(struct stream *s, struct filter *filter)
+{
+	struct cache_st *st = filter->ctx;
+	struct cache_flt_conf *cconf = FLT_CONF(filter);
+	struct cache *cache = cconf->c.cache;
+	struct shared_context *shctx = shctx_ptr(cache);
+
+	/* Everything should be released in the http_end filter, but we need to do it
+	 * there too, in case of errors */
+	if (st && st->first_block) {
+		struct cache_entry *object = (struct cache_entry *)st->first_block->data;
+		if (!object->complete) {
+			/* The stream was closed but the 'complete' flag was not
+			 * set which means that cache_store_http_end was not
+			 * called. The stream must have been closed before we
+			 * could store the full answer in the cache.
+			 */
+			release_entry_unlocked(&cache->trees[object->eb.key % CACHE_TREE_NUM], object);
+		}
+		shctx_wrlock(shctx);
+		shctx_row_reattach(shctx, st->first_block);
+		shctx_wrunlock(shctx);
+	}
+	if (st) {
+		if (st->disk_io)
+			cache_disk_io_release(st->disk_io);
+		/* always synchronize with a fill release in progress */
+		if (st->coalesced)
+			cache_fill_leave(cache, st);
+		cache_fill_end(cache, st);
+		cache_st_free(st);
+		filter->ctx = NULL;
+	}
+}
+
+static int
+cache_store_post_analyze(struct stream *s, struct filter *filter, struct channel *chn,
+			 unsigned an_bit)
+{
+	struct http_txn *txn = s->txn;
+	struct http_msg *msg = &txn->rsp;
+	struct cache_st *st = filter->ctx;
+	struct cache_flt_conf *cconf = FLT_CONF(filter);
+
+	if (an_bit != AN_RES_WAIT_HTTP)
+		goto end;
+
+	/* Here we need to check if any compression filter precedes the cache
+	 * filter. This is only possible when the compression is configured in
+	 * the frontend while the cache filter is configured on the
+	 * backend. This case cannot be detected during HAProxy startup. So in
+	 * such cases, the cache is disabled.
+	 */
+	if (st && (msg->flags & HTTP_MSGF_COMPRESSING)) {
+		cache_fill_end(cconf->c.cache, st);
+		cache_st_free(st);
+		filter->ctx = NULL;
+	}
+
+  end:
+	return 1;
+}
+
+static int
+cache_store_http_headers(struct stream *s, struct filter *filter, struct http_msg *msg)
+{
+	struct cache_st *st = filter->ctx;
+
+	if (!(msg->chn->flags & CF_ISRESP) || !st)
+		return 1;
+
+	if (st->first_block)
+		register_data_filter(s, msg->chn, filter);
+	return 1;
+}
+
+static inline void disable_cache_entry(struct cache_st *st,
+                                       struct filter *filter, struct shared_context *shctx)
+{
+	struct cache_entry *object;
+	struct cache *cache = (struct cache*)shctx->data;
+
+	object = (struct cache_entry *)st->first_block->data;
+	filter->ctx = NULL; /* disable cache  */
+	release_entry_unlocked(&cache->trees[object->eb.key % CACHE_TREE_NUM], object);
+	shctx_wrlock(shctx);
+	shctx_row_reattach(shctx, st->first_block);
+	shctx_wrunlock(shctx);
+	cache_st_free(st);
+}
+
+#if defined(USE_ZLIB)
+/* Compresses <data> with the compression context of filter context <st> and
+ * appends the output to the row of the object as DATA blocks. When <finish> is
+ * set, the compressed stream is terminated and the context released. Returns 0
+ * on error.
+ */
+static int cache_store_compressed(struct cache *cache, struct cache_st *st, struct ist data, int finish)
+{
+	struct shared_context *shctx = shctx_ptr(cache);
+	struct cache_entry *object = (struct cache_entry *)st->first_block->data;
+	struct buffer *buf;
+	uint32_t info;
+	int end = finish;
+	int len, ret = 0;
+
+	buf = alloc_trash_chunk();
+	if (!buf)
+		return 0;
+
+	_HA_ATOMIC_ADD(&cache->comp_in, istlen(data));
+	while (istlen(data) || end) {
+		b_reset(buf);
+		if (istlen(data)) {
+			/* the data are only flushed once the whole payload was
+			 * compressed, the output being produced as the
+			 * compressor's buffers fill up.
+			 */
+			len = cache_comp_algo->add_data(st->comp_ctx, istptr(data), istlen(data), buf);
+			if (len < 0)
+				goto out;
+			data = istadv(data, len);
+		}
+		else {
+			if (cache_comp_algo->finish(st->comp_ctx, buf) < 0)
+				goto out;
+			/* a full buffer may mean the end is not written yet */
+			end = !b_room(buf);
+		}
+
+		if (!b_data(buf))
+			continue;
+
+		info = (HTX_BLK_DATA << 28) + b_data(buf);
+		if (!shctx_row_reserve_hot(shctx, st->first_block, sizeof(info) + b_data(buf)) ||
+		    shctx_row_data_append(shctx, st->first_block, (unsigned char *)&info, sizeof(info)) < 0 ||
+		    shctx_row_data_append(shctx, st->first_block, (unsigned char *)b_orig(buf), b_data(buf)) < 0)
+			goto out;
+		object->body_size += b_data(buf);
+		_HA_ATOMIC_ADD(&cache->comp_out, b_data(buf));
+	}
+
+	if (finish) {
+		cache_comp_algo->end(&st->comp_ctx);
+		_HA_ATOMIC_INC(&cache->comp_objects);
+	}
+	ret = 1;
+  out:
+	free_trash_chunk(buf);
+	return ret;
+}
+#else
+/* the compressed-storage requires zlib, so there is never any compression
+ * context without it.
+ */
+static inline int cache_store_compressed(struct cache *cache, struct cache_st *st, struct ist data, int finish)
+{
+	return 0;
+}
+#endif
+
+static int
+cache_store_http_payload(struct stream *s, struct filter *filter, struct http_msg *msg,
+			 unsigned int offset, unsigned int len)
+{
+	struct cache_flt_conf *cconf = FLT_CONF(filter);
+	struct shared_context *shctx = shctx_ptr(cconf->c.cache);
+	struct cache_st *st = filter->ctx;
+	struct htx *htx = htxbuf(&msg->chn->buf);
+	struct htx_blk *blk;
+	struct shared_block *fb;
+	struct htx_ret htxret;
+	unsigned int orig_len, to_forward;
+	int ret;
+
+	if (!len)
+		return len;
+
+	if (!st->first_block) {
+		unregister_data_filter(s, msg->chn, filter);
+		return len;
+	}
+
+	orig_len = len;
+	to_forward = 0;
+
+	htxret = htx_find_offset(htx, offset);
+	blk = htxret.blk;
+	offset = htxret.ret;
+	for (; blk && len; blk = htx_get_next_blk(htx, blk)) {
+		enum htx_blk_type type = htx_get_blk_type(blk);
+		uint32_t info, sz = htx_get_blksz(blk);
+		struct ist v;
+
+		switch (type) {
+			case HTX_BLK_UNUSED:
+				break;
+
+			case HTX_BLK_DATA:
+				v = htx_get_blk_value(htx, blk);
+				v = istadv(v, offset);
+				v = isttrim(v, len);
+
+				if (st->comp_ctx) {
+					if (!cache_store_compressed(cconf->c.cache, st, v, 0))
+						goto no_cache;
+					to_forward += v.len;
+					len -= v.len;
+					break;
+				}
+
+				info = (type << 28) + v.len;
+				fb = shctx_row_reserve_hot(shctx, st->first_block, sizeof(info)+v.len);
+				if (!fb)
+					goto no_cache;
+				ret = shctx_row_data_append(shctx, st->first_block, (unsigned char *)&info, sizeof(info));
+				if (ret < 0)
+					goto no_cache;
+				ret = shctx_row_data_append(shctx, st->first_block, (unsigned char *)istptr(v), istlen(v));
+				if (ret < 0)
+					goto no_cache;
+				ASSUME_NONNULL((struct cache_entry *)st->first_block->data)->body_size += v.len;
+				to_forward += v.len;
+				len -= v.len;
+				break;
+
+			default:
+				/* Here offset must always be 0 because only
+				 * DATA blocks can be partially transferred. */
+				if (offset)
+					goto no_cache;
+				if (sz > len)
+					goto end;
+
+				/* the compressed payload ends before the trailers */
+				if (st->comp_ctx && !cache_store_compressed(cconf->c.cache, st, IST_NULL, 1))
+					goto no_cache;
+
+				fb = shctx_row_reserve_hot(shctx, st->first_block, sizeof(blk->info)+sz);
+				if (!fb)
+					goto no_cache;
+				ret = shctx_row_data_append(shctx, st->first_block, (unsigned char *)&(blk->info), sizeof(blk->info));
+				if (ret < 0)
+					goto no_cache;
+				ret = shctx_row_data_append(shctx, st->first_block, (unsigned char *)htx_get_blk_ptr(htx, blk), sz);
+				if (ret < 0)
+					goto no_cache;
+				to_forward += sz;
+				len -= sz;
+				break;
+		}
+
+		offset = 0;
+	}
+
+  end:
+	return to_forward;
+
+  no_cache:
+	cache_fill_end_strm(s, cconf->c.cache);
+	disable_cache_entry(st, filter, shctx);
+	unregister_data_filter(s, msg->chn, filter);
+	return orig_len;
+}
+
+static int
+cache_store_http_end(struct stream *s, struct filter *filter,
+                     struct http_msg *msg)
+{
+	struct cache_st *st = filter->ctx;
+	struct cache_flt_conf *cconf = FLT_CONF(filter);
+	struct cache *cache = cconf->c.cache;
+	struct shared_context *shctx = shctx_ptr(cache);
+	struct cache_entry *object;
+
+	if (!(msg->chn->flags & CF_ISRESP))
+		return 1;
+
+	if (st && st->first_block) {
+
+		object = (struct cache_entry *)st->first_block->data;
+
+		if (st->comp_ctx && !cache_store_compressed(cache, st, IST_NULL, 1)) {
+			cache_fill_end_strm(s, cache);
+			disable_cache_entry(st, filter, shctx);
+			return 1;
+		}
+
+		/* Objects too large to be copied to the disk tier when
+		 * evicted are written now, while the row is still ours.
+		 */
+		if (cache->disk && st->first_block->len > CACHE_DISK_SYNC_MAX)
+			cache_disk_demote(cache, st->first_block);
+
+		shctx_wrlock(shctx);
+		/* The whole payload was cached, the entry can now be used. */
+		object->complete = 1;
+		/* remove from the hotlist */
+		shctx_row_reattach(shctx, st->first_block);
+		shctx_wrunlock(shctx);
+
+	}
+
+	/* the streams waiting for the object may now use it */
+	cache_fill_end_strm(s, cache);
+
+	if (st) {
+		cache_st_free(st);
+		filter->ctx = NULL;
+	}
+
+	return 1;
+}
+
+ /*
+  * This intends to be used when checking HTTP headers for some
+  * word=value directive. Return a pointer to the first character of value, if
+  * the word was not found or if there wasn't any value assigned to it return NULL
+  */
+char *directive_value(const char *sample, int slen, const char *word, int wlen)
+{
+	int st = 0;
+
+	if (slen < wlen)
+		return 0;
+
+	while (wlen) {
+		char c = *sample ^ *word;
+		if (c && c != ('A' ^ 'a'))
+			return NULL;
+		sample++;
+		word++;
+		slen--;
+		wlen--;
+	}
+
+	while (slen) {
+		if (st == 0) {
+			if (*sample != '=')
+				return NULL;
+			sample++;
+			slen--;
+			st = 1;
+			continue;
+		} else {
+			return (char *)sample;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Return the maxage in seconds of an HTTP response.
+ * The returned value will always take the cache's configuration into account
+ * (cache->maxage) but the actual max age of the response will be set in the
+ * true_maxage parameter. It will be used to determine if a response is already
+ * stale or not.
+ * Compute the maxage using either:
+ *  - the assigned max-age of the cache
+ *  - the s-maxage directive
+ *  - the max-age directive
+ *  - (Expires - Data) headers
+ *  - the default-max-age of the cache
+ *
+ */
+int http_calc_maxage(struct htx *htx, struct cache *cache, int *true_maxage)
+{
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	long smaxage = -1;
+	long maxage = -1;
+	int expires = -1;
+	struct tm tm = {};
+	time_t expires_val = 0;
+	char *endptr = NULL;
+	int offset = 0;
+
+	/* The Cache-Control max-age and s-maxage directives should be followed by
+	 * a positive numerical value (see RFC 7234#5.2.1.1). According to the
+	 * specs, a sender "should not" generate a quoted-string value but we will
+	 * still accept this format since it isn't strictly forbidden. */
+	while (http_find_header(htx, ist("cache-control"), &ctx, 0)) {
+		char *value;
+
+		value = directive_value(ctx.value.ptr, ctx.value.len, "s-maxage", 8);
+		if (value) {
+			struct buffer *chk = get_trash_chunk();
+
+			chunk_memcat(chk, value, ctx.value.len - 8 + 1);
+			chunk_memcat(chk, "", 1);
+			offset = (*chk->area == '"') ? 1 : 0;
+			smaxage = strtol(chk->area + offset, &endptr, 10);
+			if (unlikely(smaxage < 0 || endptr == chk->area + offset))
+				return -1;
+		}
+
+		value = directive_value(ctx.value.ptr, ctx.value.len, "max-age", 7);
+		if (value) {
+			struct buffer *chk = get_trash_chunk();
+
+			chunk_memcat(chk, value, ctx.value.len - 7 + 1);
+			chunk_memcat(chk, "", 1);
+			offset = (*chk->area == '"') ? 1 : 0;
+			maxage = strtol(chk->area + offset, &endptr, 10);
+			if (unlikely(maxage < 0 || endptr == chk->area + offset))
+				return -1;
+		}
+	}
+
+	/* Look for Expires header if no s-maxage or max-age Cache-Control data
+	 * was found. */
+	if (maxage == -1 && smaxage == -1) {
+		ctx.blk = NULL;
+		if (http_find_header(htx, ist("expires"), &ctx, 1)) {
+			if (parse_http_date(istptr(ctx.value), istlen(ctx.value), &tm)) {
+				expires_val = my_timegm(&tm);
+				/* A request having an expiring date earlier
+				 * than the current date should be considered as
+				 * stale. */
+				expires = (expires_val >= date.tv_sec) ?
+					(expires_val - date.tv_sec) : 0;
+			}
+			else {
+				/* Following RFC 7234#5.3, an invalid date
+				 * format must be treated as a date in the past
+				 * so the cache entry must be seen as already
+				 * expired. */
+				expires = 0;
+			}
+		}
+	}
+
+
+	if (smaxage > 0) {
+		if (true_maxage)
+			*true_maxage = smaxage;
+		return MIN(smaxage, cache->maxage);
+	}
+
+	if (maxage > 0) {
+		if (true_maxage)
+			*true_maxage = maxage;
+		return MIN(maxage, cache->maxage);
+	}
+
+	if (expires >= 0) {
+		if (true_maxage)
+			*true_maxage = expires;
+		return MIN(expires, cache->maxage);
+	}
+
+	return cache->maxage;
+
+}
+
+/* Returns the value of the numeric Cache-Control directive <word> of length
+ * <wlen> if it is the directive in <value>, or -1 if it is not or if its
+ * value is invalid.
+ */
+static long cache_directive_num(struct ist value, const char *word, int wlen)
+{
+	struct buffer *chk;
+	char *v, *endptr;
+	long ret;
+
+	v = directive_value(istptr(value), istlen(value), word, wlen);
+	if (!v)
+		return -1;
+
+	chk = get_trash_chunk();
+	chunk_memcat(chk, v, istlen(value) - wlen - 1);
+	chunk_memcat(chk, "", 1);
+	v = chk->area + (*chk->area == '"');
+	ret = strtol(v, &endptr, 10);
+	if (ret < 0 || endptr == v)
+		return -1;
+	return ret;
+}
+
+/* Computes the stale-while-revalidate and stale-if-error periods (RFC 5861)
+ * of the response in <htx> into <swr> and <sie>. The defaults of <cache> are
+ * used for the missing directives, and no stale period is allowed when the
+ * response must be revalidated.
+ */
+static void http_calc_stale(struct htx *htx, struct cache *cache, unsigned int *swr, unsigned int *sie)
+{
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	long val;
+
+	*swr = cache->swr;
+	*sie = cache->sie;
+	while (http_find_header(htx, ist("cache-control"), &ctx, 0)) {
+		if (isteqi(ctx.value, ist("must-revalidate")) ||
+		    isteqi(ctx.value, ist("proxy-revalidate"))) {
+			*swr = *sie = 0;
+			return;
+		}
+		if ((val = cache_directive_num(ctx.value, "stale-while-revalidate", 22)) >= 0)
+			*swr = MIN(val, CACHE_ENTRY_MAX_STALE);
+		else if ((val = cache_directive_num(ctx.value, "stale-if-error", 14)) >= 0)
+			*sie = MIN(val, CACHE_ENTRY_MAX_STALE);
+	}
+}
+
+
+static void cache_free_blocks(struct shared_block *first, void *data)
+{
+	struct cache_entry *object = (struct cache_entry *)first->data;
+	struct cache *cache = (struct cache *)data;
+	struct cache_tree *cache_tree;
+
+	if (object->eb.key) {
+		/* larger objects were written when stored */
+		if (cache->disk && object->complete && first->len <= CACHE_DISK_SYNC_MAX)
+			cache_disk_demote(cache, first);
+		object->complete = 0;
+		cache_tree = &cache->trees[object->eb.key % CACHE_TREE_NUM];
+		retain_entry(object);
+		HA_SPIN_LOCK(CACHE_LOCK, &cache_tree->cleanup_lock);
+		LIST_INSERT(&cache_tree->cleanup_list, &object->cleanup_list);
+		HA_SPIN_UNLOCK(CACHE_LOCK, &cache_tree->cleanup_lock);
+	}
+}
+
+static void cache_reserve_finish(struct shared_context *shctx)
+{
+	struct cache_entry *object, *back;
+	struct cache *cache = (struct cache *)shctx->data;
+	struct cache_tree *cache_tree;
+	int cache_tree_idx = 0;
+
+	for (; cache_tree_idx < CACHE_TREE_NUM; ++cache_tree_idx) {
+		cache_tree = &cache->trees[cache_tree_idx];
+
+		cache_wrlock(cache_tree);
+		HA_SPIN_LOCK(CACHE_LOCK, &cache_tree->cleanup_lock);
+
+		list_for_each_entry_safe(object, back, &cache_tree->cleanup_list, cleanup_list) {
+			LIST_DELETE(&object->cleanup_list);
+			/*
+			 * At this point we locked the cache tree in write mode
+			 * so no new thread could retain the current entry
+			 * because the only two places where it can happen is in
+			 * the cache_use case which is under cache_rdlock and
+			 * the reserve_hot case which would require the
+			 * corresponding block to still be in the avail list,
+			 * which is impossible (we reserved it for a thread and
+			 * took it out of the avail list already). The only two
+			 * references are then the default one (upon cache_entry
+			 * creation) and the one in this cleanup list.
+			 */
+			BUG_ON(object->refcount > 2);
+			delete_entry(object);
+
+			/* without a disk tier, the purge record of the
+			 * object is useless once no variant remains.
+			 */
+			if (cache_purge_enabled(cache) && !cache->disk &&
+			    !cache_tree_has_hash(cache_tree, object->hash))
+				cache_purge_forget(cache, object->hash);
+		}
+
+		HA_SPIN_UNLOCK(CACHE_LOCK, &cache_tree->cleanup_lock);
+		cache_wrunlock(cache_tree);
+	}
+}
+
+
+/* As per RFC 7234#4.3.2, in case of "If-Modified-Since" conditional request, the
+ * date value should be compared to a date determined by in a previous response (for
+ * the same entity). This date could either be the "Last-Modified" value, or the "Date"
+ * value of the response's reception time (by decreasing order of priority). */
+static time_t get_last_modified_time(struct htx *htx)
+{
+	time_t last_modified = 0;
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	struct tm tm = {};
+
+	if (http_find_header(htx, ist("last-modified"), &ctx, 1)) {
+		if (parse_http_date(istptr(ctx.value), istlen(ctx.value), &tm)) {
+			last_modified = my_timegm(&tm);
+		}
+	}
+
+	if (!last_modified) {
+		ctx.blk = NULL;
+		if (http_find_header(htx, ist("date"), &ctx, 1)) {
+			if (parse_http_date(istptr(ctx.value), istlen(ctx.value), &tm)) {
+				last_modified = my_timegm(&tm);
+			}
+		}
+	}
+
+	/* Fallback on the current time if no "Last-Modified" or "Date" header
+	 * was found. */
+	if (!last_modified)
+		last_modified = date.tv_sec;
+
+	return last_modified;
+}
+
+/*
+ * Checks the vary header's value. The headers on which vary should be applied
+ * must be explicitly supported in the vary_information array (see cache.c). If
+ * any other header is mentioned, we won't store the response.
+ * Returns 1 if Vary-based storage can work, 0 otherwise.
+ */
+static int http_check_vary_header(struct htx *htx, unsigned int *vary_signature)
+{
+	unsigned int vary_idx;
+	unsigned int vary_info_count;
+	const struct vary_hashing_information *vary_info;
+	struct http_hdr_ctx ctx = { .blk = NULL };
+
+	int retval = 1;
+
+	*vary_signature = 0;
+
+	vary_info_count = sizeof(vary_information)/sizeof(*vary_information);
+	while (retval && http_find_header(htx, ist("Vary"), &ctx, 0)) {
+		for (vary_idx = 0; vary_idx < vary_info_count; ++vary_idx) {
+			vary_info = &vary_information[vary_idx];
+			if (isteqi(ctx.value, vary_info->hdr_name)) {
+				*vary_signature |= vary_info->value;
+				break;
+			}
+		}
+		retval = (vary_idx < vary_info_count);
+	}
+
+	return retval;
+}
+
+
+/*
+ * Look for the accept-encoding part of the secondary_key and replace the
+ * encoding bitmap part of the hash with the actual encoding of the response,
+ * extracted from the content-encoding header value.
+ * Responses that have an unknown encoding will not be cached if they also
+ * "vary" on the accept-encoding value. When <compressed> is set, the payload
+ * is compressed by the cache, which may deliver it to any client, so the
+ * bitmap is cleared to match all the accepted encodings.
+ * Returns 0 if we found a known encoding in the response, -1 otherwise.
+ */
+static int set_secondary_key_encoding(struct htx *htx, unsigned int vary_signature, char *secondary_key,
+                                      int compressed)
+{
+	unsigned int resp_encoding_bitmap = 0;
+	const struct vary_hashing_information *info = vary_information;
+	unsigned int offset = 0;
+	unsigned int count = 0;
+	unsigned int hash_info_count = sizeof(vary_information)/sizeof(*vary_information);
+	unsigned int encoding_value;
+	struct http_hdr_ctx ctx = { .blk = NULL };
+
+	/* We must not set the accept encoding part of the secondary signature
+	 * if the response does not vary on 'Accept Encoding'. */
+	if (!(vary_signature & VARY_ACCEPT_ENCODING))
+		return 0;
+
+	/* Look for the accept-encoding part of the secondary_key. */
+	while (count < hash_info_count && info->value != VARY_ACCEPT_ENCODING) {
+		offset += info->hash_length;
+		++info;
+		++count;
+	}
+
+	if (count == hash_info_count)
+		return -1;
+
+	if (compressed) {
+		write_u32(secondary_key + offset, 0);
+		return 0;
+	}
+
+	while (http_find_header(htx, ist("content-encoding"), &ctx, 0)) {
+		if (parse_encoding_value(ctx.value, &encoding_value, NULL))
+			return -1; /* Do not store responses with an unknown encoding */
+		resp_encoding_bitmap |= encoding_value;
+	}
+
+	if (!resp_encoding_bitmap)
+		resp_encoding_bitmap |= VARY_ENCODING_IDENTITY;
+
+	/* Rewrite the bitmap part of the hash with the new bitmap that only
+	 * corresponds the the response's encoding. */
+	write_u32(secondary_key + offset, resp_encoding_bitmap);
+
+	return 0;
+}
+
+
+/*
+ * This function will store the headers of the response in a buffer and then
+ * register a filter to store the data
+ */
+/*
+ * Fills the cache entry <object> with the Age and Last-Modified information
+ * of the response in <htx>, whose Age header is removed, then dumps the
+ * response's start line and headers into the trash in the format of the
+ * cache rows, recording the position of the ETag value. <true_maxage> is the
+ * max age announced by the response.
+ * Returns 1 on success, or 0 if the response must not be stored.
+ */
+#if defined(USE_ZLIB)
+/* Tells whether the response in <htx> of stream <s> may be stored compressed
+ * in cache <cache>. The criteria are those of the compression filter: the
+ * response must not be encoded already nor forbid transformations, must not
+ * carry several or invalid ETags, and must have a Content-Type listed by the
+ * "compression type" directive of the backend or the frontend if any, which is
+ * not a multipart one. The "compression minsize-res" directive is respected as
+ * well. Returns non-zero if so.
+ */
+static int cache_may_compress(struct stream *s, struct cache *cache, struct htx *htx)
+{
+	struct http_msg *msg = &s->txn->rsp;
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	struct comp_type *comp_type = NULL;
+	unsigned int minsize = 0;
+
+	if (!cache->comp_storage || !cache_comp_algo)
+		return 0;
+
+	if (!(msg->flags & HTTP_MSGF_XFER_LEN) || (msg->flags & HTTP_MSGF_BODYLESS))
+		return 0;
+
+	if ((msg->flags & HTTP_MSGF_CNT_LEN) &&
+	    ((s->be->comp && (minsize = s->be->comp->minsize_res)) ||
+	     (strm_fe(s)->comp && (minsize = strm_fe(s)->comp->minsize_res))) &&
+	    s->scb->sedesc->kip < minsize)
+		return 0;
+
+	if (http_find_header(htx, ist("content-encoding"), &ctx, 1))
+		return 0;
+
+	ctx.blk = NULL;
+	while (http_find_header(htx, ist("cache-control"), &ctx, 0)) {
+		if (word_match(ctx.value.ptr, ctx.value.len, "no-transform", 12))
+			return 0;
+	}
+
+	ctx.blk = NULL;
+	if (http_find_header(htx, ist("etag"), &ctx, 1) &&
+	    (http_get_etag_type(ctx.value) == ETAG_INVALID ||
+	     http_find_header(htx, ist("etag"), &ctx, 1)))
+		return 0;
+
+	if (s->be->comp && s->be->comp->types_res)
+		comp_type = s->be->comp->types_res;
+	else if (strm_fe(s)->comp)
+		comp_type = strm_fe(s)->comp->types_res;
+
+	ctx.blk = NULL;
+	if (!http_find_header(htx, ist("content-type"), &ctx, 1))
+		return !comp_type;
+
+	if (istmatchi(ctx.value, ist("multipart")))
+		return 0;
+
+	if (!comp_type)
+		return 1;
+
+	for (; comp_type; comp_type = comp_type->next) {
+		if (ctx.value.len >= comp_type->name_len &&
+		    strncasecmp(ctx.value.ptr, comp_type->name, comp_type->name_len) == 0)
+			return 1;
+	}
+	return 0;
+}
+#endif
+
+/* Copies the headers of the response in <htx> into the empty buffer <buf> and
+ * turns them into those of a gzip-compressed response, as the compression
+ * filter does: the Content-Length header is replaced by chunking, a strong
+ * ETag is made weak, and "Vary: Accept-Encoding" and "Content-Encoding: gzip"
+ * are added. Returns the new HTX message, or NULL on error.
+ */
+static struct htx *cache_compressed_headers(struct htx *htx, struct buffer *buf)
+{
+	struct htx *copy = htx_from_buf(buf);
+	struct http_hdr_ctx ctx;
+	struct htx_blk *blk, *new;
+	struct htx_sl *sl;
+	int32_t pos;
+
+	for (pos = htx_get_first(htx); pos != -1; pos = htx_get_next(htx, pos)) {
+		enum htx_blk_type type;
+		uint32_t sz;
+
+		blk = htx_get_blk(htx, pos);
+		type = htx_get_blk_type(blk);
+		sz = htx_get_blksz(blk);
+		new = htx_add_blk(copy, type, sz);
+		if (!new)
+			return NULL;
+		new->info = blk->info;
+		memcpy(htx_get_blk_ptr(copy, new), htx_get_blk_ptr(htx, blk), sz);
+		if (type == HTX_BLK_EOH)
+			break;
+	}
+
+	sl = http_get_stline(copy);
+	if (!sl)
+		return NULL;
+
+	ctx.blk = NULL;
+	while (http_find_header(copy, ist("content-length"), &ctx, 1))
+		http_remove_header(copy, &ctx);
+	sl->flags &= ~HTX_SL_F_CLEN;
+
+	if (!(sl->flags & HTX_SL_F_CHNK)) {
+		if (!http_add_header(copy, ist("Transfer-Encoding"), ist("chunked")))
+			return NULL;
+		sl->flags |= HTX_SL_F_XFER_ENC | HTX_SL_F_CHNK;
+	}
+
+	ctx.blk = NULL;
+	if (http_find_header(copy, ist("etag"), &ctx, 1) && *ctx.value.ptr == '"') {
+		struct ist v = ist2(trash.area, 0);
+
+		if (istcat(&v, ist("W/"), trash.size) == -1 || istcat(&v, ctx.value, trash.size) == -1 ||
+		    !http_replace_header_value(copy, &ctx, v))
+			return NULL;
+	}
+
+	ctx.blk = NULL;
+	while (http_find_header(copy, ist("vary"), &ctx, 0)) {
+		if (isteqi(ctx.value, ist("accept-encoding")))
+			break;
+	}
+	if (!ctx.blk && !http_add_header(copy, ist("Vary"), ist("Accept-Encoding")))
+		return NULL;
+
+	if (!http_add_header(copy, ist("Content-Encoding"),
+			     ist("gzip")))
+		return NULL;
+
+	return copy;
+}
+
+static int cache_dump_headers(struct htx *htx, struct cache_entry *object, int true_maxage)
+{
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	struct buffer *buf = NULL;
+	size_t hdrs_len = 0;
+	int32_t pos;
+	int ret = 0;
+
+	if (http_find_header(htx, ist("Age"), &ctx, 0)) {
+		long long hdr_age;
+		if (!strl2llrc(ctx.value.ptr, ctx.value.len, &hdr_age) && hdr_age > 0) {
+			if (unlikely(hdr_age > CACHE_ENTRY_MAX_AGE))
+				hdr_age = CACHE_ENTRY_MAX_AGE;
+			/* A response with an Age value greater than its
+			 * announced max age is stale and should not be stored. */
+			object->age = hdr_age;
+			if (unlikely(object->age > true_maxage))
+				return 0;
+		}
+		else
+			return 0;
+		http_remove_header(htx, &ctx);
+	}
+
+	/* Build a last-modified time that will be stored in the cache_entry and
+	 * compared to a future If-Modified-Since client header. */
+	object->last_modified = get_last_modified_time(htx);
+
+	/* the headers of a compressed object are those of the compressed
+	 * response, while the response itself is forwarded as is.
+	 */
+	if (object->compressed) {
+		buf = alloc_trash_chunk();
+		if (!buf)
+			return 0;
+		htx = cache_compressed_headers(htx, buf);
+		if (!htx)
+			goto end;
+	}
+
+	chunk_reset(&trash);
+	for (pos = htx_get_first(htx); pos != -1; pos = htx_get_next(htx, pos)) {
+		struct htx_blk *blk = htx_get_blk(htx, pos);
+		enum htx_blk_type type = htx_get_blk_type(blk);
+		uint32_t sz = htx_get_blksz(blk);
+
+		hdrs_len += sizeof(*blk) + sz;
+		chunk_memcat(&trash, (char *)&blk->info, sizeof(blk->info));
+		chunk_memcat(&trash, htx_get_blk_ptr(htx, blk), sz);
+
+		/* Look for optional ETag header.
+		 * We need to store the offset of the ETag value in order for
+		 * future conditional requests to be able to perform ETag
+		 * comparisons. */
+		if (type == HTX_BLK_HDR) {
+			struct ist header_name = htx_get_blk_name(htx, blk);
+			if (isteq(header_name, ist("etag"))) {
+				object->etag_length = sz - istlen(header_name);
+				object->etag_offset = sizeof(struct cache_entry) + b_data(&trash) - sz + istlen(header_name);
+			}
+		}
+		if (type == HTX_BLK_EOH)
+			break;
+	}
+
+	/* Do not cache objects if the headers are too big. */
+	if (hdrs_len > htx->size - global.tune.maxrewrite)
+		goto end;
+
+	ret = 1;
+  end:
+	free_trash_chunk(buf);
+	return ret;
+}
+
+/* Releases the row of the new object of revalidation <reval>, if any */
+static void cache_reval_drop_row(struct cache_reval *reval)
+{
+	struct shared_context *shctx = shctx_ptr(reval->cache);
+
+	if (!reval->first)
+		return;
+
+	reval->first->len = 0;
+	shctx_wrlock(shctx);
+	shctx_row_reattach(shctx, reval->first);
+	shctx_wrunlock(shctx);
+	reval->first = NULL;
 }
 
-/*
- * Return the maxage in seconds of an HTTP response.
- * The returned value will always take the cache's configuration into account
- * (cache->maxage) but the actual max age of the response will be set in the
- * true_maxage parameter. It will be used to determine if a response is already
- * stale or not.
- * Compute the maxage using either:
- *  - the assigned max-age of the cache
- *  - the s-maxage directive
- *  - the max-age directive
- *  - (Expires - Data) headers
- *  - the default-max-age of the cache
- *
+/* httpclient callback called once the headers of the response to revalidation
+ * <hc->caller> were received. The freshness of a "304 Not Modified" response
+ * is recorded, and a cacheable "200 OK" response starts a new object, which
+ * must have the same secondary key as the stale one. The headers are consumed.
  */
-int http_calc_maxage(struct stream *s, struct cache *cache, int *true_maxage)
+static void cache_reval_res_headers(struct httpclient *hc)
 {
-	struct htx *htx = htxbuf(&s->res.buf);
+	struct cache_reval *reval = hc->caller;
+	struct htx *htx = htxbuf(&hc->res.buf);
 	struct http_hdr_ctx ctx = { .blk = NULL };
-	long smaxage = -1;
-	long maxage = -1;
-	int expires = -1;
-	struct tm tm = {};
-	time_t expires_val = 0;
-	char *endptr = NULL;
-	int offset = 0;
-
-	/* The Cache-Control max-age and s-maxage directives should be followed by
-	 * a positive numerical value (see RFC 7234#5.2.1.1). According to the
-	 * specs, a sender "should not" generate a quoted-string value but we will
-	 * still accept this format since it isn't strictly forbidden. */
-	while (http_find_header(htx, ist("cache-control"), &ctx, 0)) {
-		char *value;
-
-		value = directive_value(ctx.value.ptr, ctx.value.len, "s-maxage", 8);
-		if (value) {
-			struct buffer *chk = get_trash_chunk();
-
-			chunk_memcat(chk, value, ctx.value.len - 8 + 1);
-			chunk_memcat(chk, "", 1);
-			offset = (*chk->area == '"') ? 1 : 0;
-			smaxage = strtol(chk->area + offset, &endptr, 10);
-			if (unlikely(smaxage < 0 || endptr == chk->area + offset))
-				return -1;
-		}
+	struct shared_context *shctx;
+	struct cache_entry *object;
+	struct cache *cache;
+	struct htx_sl *sl;
+	unsigned int vary_signature = 0;
+	int effective_maxage, true_maxage = 0;
 
-		value = directive_value(ctx.value.ptr, ctx.value.len, "max-age", 7);
-		if (value) {
-			struct buffer *chk = get_trash_chunk();
+	sl = http_get_stline(htx);
+	if (!reval || !sl)
+		goto end;
 
-			chunk_memcat(chk, value, ctx.value.len - 7 + 1);
-			chunk_memcat(chk, "", 1);
-			offset = (*chk->area == '"') ? 1 : 0;
-			maxage = strtol(chk->area + offset, &endptr, 10);
-			if (unlikely(maxage < 0 || endptr == chk->area + offset))
-				return -1;
-		}
-	}
+	cache = reval->cache;
+	shctx = shctx_ptr(cache);
+	reval->status = sl->info.res.status;
+	if (htx->flags & HTX_FL_EOM)
+		reval->complete = 1;
 
-	/* Look for Expires header if no s-maxage or max-age Cache-Control data
-	 * was found. */
-	if (maxage == -1 && smaxage == -1) {
-		ctx.blk = NULL;
-		if (http_find_header(htx, ist("expires"), &ctx, 1)) {
-			if (parse_http_date(istptr(ctx.value), istlen(ctx.value), &tm)) {
-				expires_val = my_timegm(&tm);
-				/* A request having an expiring date earlier
-				 * than the current date should be considered as
-				 * stale. */
-				expires = (expires_val >= date.tv_sec) ?
-					(expires_val - date.tv_sec) : 0;
-			}
-			else {
-				/* Following RFC 7234#5.3, an invalid date
-				 * format must be treated as a date in the past
-				 * so the cache entry must be seen as already
-				 * expired. */
-				expires = 0;
-			}
-		}
+	if (reval->status == 304) {
+		reval->maxage = http_calc_maxage(htx, cache, NULL);
+		http_calc_stale(htx, cache, &reval->swr, &reval->sie);
+		goto end;
 	}
 
+	if (reval->status != 200 ||
+	    http_find_header(htx, ist("set-cookie"), &ctx, 1) ||
+	    (http_check_htx_response_for_cacheability(htx, TX_CACHEABLE | TX_CACHE_COOK) &
+	     (TX_CACHEABLE | TX_CACHE_COOK)) != (TX_CACHEABLE | TX_CACHE_COOK))
+		goto end;
 
-	if (smaxage > 0) {
-		if (true_maxage)
-			*true_maxage = smaxage;
-		return MIN(smaxage, cache->maxage);
+	ctx.blk = NULL;
+	if (cache->vary_processing_enabled) {
+		if (!http_check_vary_header(htx, &vary_signature) ||
+		    vary_signature != reval->secondary_key_signature)
+			goto end;
 	}
+	else if (http_find_header(htx, ist("Vary"), &ctx, 0))
+		goto end;
 
-	if (maxage > 0) {
-		if (true_maxage)
-			*true_maxage = maxage;
-		return MIN(maxage, cache->maxage);
-	}
+	reval->first = shctx_row_reserve_key(shctx, read_u32(reval->hash), sizeof(struct cache_entry));
+	if (!reval->first)
+		goto end;
 
-	if (expires >= 0) {
-		if (true_maxage)
-			*true_maxage = expires;
-		return MIN(expires, cache->maxage);
+	/* the object is only indexed once complete, with a key */
+	object = (struct cache_entry *)reval->first->data;
+	memset(object, 0, sizeof(*object));
+	reval->first->len = sizeof(struct cache_entry);
+	reval->first->last_append = NULL;
+	memcpy(object->hash, reval->hash, sizeof(object->hash));
+	object->secondary_key_signature = vary_signature;
+	if (vary_signature) {
+		memcpy(object->secondary_key, reval->secondary_key, HTTP_CACHE_SEC_KEY_LEN);
+		if (set_secondary_key_encoding(htx, vary_signature, object->secondary_key, 0))
+			goto drop;
 	}
 
-	return cache->maxage;
+	effective_maxage = http_calc_maxage(htx, cache, &true_maxage);
+	http_calc_stale(htx, cache, &object->swr, &object->sie);
+	if (!cache_dump_headers(htx, object, true_maxage))
+		goto drop;
 
-}
+	if (!shctx_row_reserve_hot(shctx, reval->first, trash.data) ||
+	    shctx_row_data_append(shctx, reval->first, (unsigned char *)trash.area, trash.data) < 0)
+		goto drop;
 
+	object->latest_validation = date.tv_sec;
+	object->fresh_until = date.tv_sec + effective_maxage;
+	object->expire = object->fresh_until + MAX(object->swr, object->sie);
+	cache_purge_index(cache, reval->hash, IST_NULL, htx, object->expire);
 
-static void cache_free_blocks(struct shared_block *first, void *data)
-{
-	struct cache_entry *object = (struct cache_entry *)first->data;
-	struct cache *cache = (struct cache *)data;
-	struct cache_tree *cache_tree;
+  end:
+	htx_reset(htx);
+	htx_to_buf(htx, &hc->res.buf);
+	return;
 
-	if (object->eb.key) {
-		object->complete = 0;
-		cache_tree = &cache->trees[object->eb.key % CACHE_TREE_NUM];
-		retain_entry(object);
-		HA_SPIN_LOCK(CACHE_LOCK, &cache_tree->cleanup_lock);
-		LIST_INSERT(&cache_tree->cleanup_list, &object->cleanup_list);
-		HA_SPIN_UNLOCK(CACHE_LOCK, &cache_tree->cleanup_lock);
-	}
+  drop:
+	cache_reval_drop_row(reval);
+	goto end;
 }
 
-static void cache_reserve_finish(struct shared_context *shctx)
+/* httpclient callback called when some payload of the response to
+ * revalidation <hc->caller> was received. It is appended to the new object
+ * if any, then consumed.
+ */
+static void cache_reval_res_payload(struct httpclient *hc)
 {
-	struct cache_entry *object, *back;
-	struct cache *cache = (struct cache *)shctx->data;
-	struct cache_tree *cache_tree;
-	int cache_tree_idx = 0;
+	struct cache_reval *reval = hc->caller;
+	struct htx *htx = htxbuf(&hc->res.buf);
+	struct shared_context *shctx;
+	struct cache_entry *object;
+	struct htx_blk *blk;
 
-	for (; cache_tree_idx < CACHE_TREE_NUM; ++cache_tree_idx) {
-		cache_tree = &cache->trees[cache_tree_idx];
+	if (!reval)
+		goto end;
 
-		cache_wrlock(cache_tree);
-		HA_SPIN_LOCK(CACHE_LOCK, &cache_tree->cleanup_lock);
+	if (htx->flags & HTX_FL_EOM)
+		reval->complete = 1;
 
-		list_for_each_entry_safe(object, back, &cache_tree->cleanup_list, cleanup_list) {
-			LIST_DELETE(&object->cleanup_list);
-			/*
-			 * At this point we locked the cache tree in write mode
-			 * so no new thread could retain the current entry
-			 * because the only two places where it can happen is in
-			 * the cache_use case which is under cache_rdlock and
-			 * the reserve_hot case which would require the
-			 * corresponding block to still be in the avail list,
-			 * which is impossible (we reserved it for a thread and
-			 * took it out of the avail list already). The only two
-			 * references are then the default one (upon cache_entry
-			 * creation) and the one in this cleanup list.
-			 */
-			BUG_ON(object->refcount > 2);
-			delete_entry(object);
-		}
+	if (!reval->first)
+		goto end;
 
-		HA_SPIN_UNLOCK(CACHE_LOCK, &cache_tree->cleanup_lock);
-		cache_wrunlock(cache_tree);
+	shctx = shctx_ptr(reval->cache);
+	object = (struct cache_entry *)reval->first->data;
+	for (blk = htx_get_head_blk(htx); blk; blk = htx_get_next_blk(htx, blk)) {
+		enum htx_blk_type type = htx_get_blk_type(blk);
+		uint32_t sz = htx_get_blksz(blk);
+
+		if (type == HTX_BLK_UNUSED)
+			continue;
+
+		if (!shctx_row_reserve_hot(shctx, reval->first, sizeof(blk->info) + sz) ||
+		    shctx_row_data_append(shctx, reval->first, (unsigned char *)&blk->info, sizeof(blk->info)) < 0 ||
+		    shctx_row_data_append(shctx, reval->first, htx_get_blk_ptr(htx, blk), sz) < 0) {
+			cache_reval_drop_row(reval);
+			break;
+		}
+		if (type == HTX_BLK_DATA)
+			object->body_size += sz;
 	}
-}
 
+  end:
+	htx_reset(htx);
+	htx_to_buf(htx, &hc->res.buf);
+}
 
-/* As per RFC 7234#4.3.2, in case of "If-Modified-Since" conditional request, the
- * date value should be compared to a date determined by in a previous response (for
- * the same entity). This date could either be the "Last-Modified" value, or the "Date"
- * value of the response's reception time (by decreasing order of priority). */
-static time_t get_last_modified_time(struct htx *htx)
+/* httpclient callback called once revalidation <hc->caller> is over. A new
+ * object replaces the stale one, a "304 Not Modified" response refreshes it,
+ * an error or the lack of response keeps it for "stale-if-error", and any
+ * other response discards it. The waiting streams are then woken up.
+ */
+static void cache_reval_res_end(struct httpclient *hc)
 {
-	time_t last_modified = 0;
-	struct http_hdr_ctx ctx = { .blk = NULL };
-	struct tm tm = {};
+	struct cache_reval *reval = hc->caller;
+	struct cache_entry *cur, *object = NULL;
+	struct shared_context *shctx;
+	struct cache_tree *tree;
+	struct cache *cache;
+	int failed;
 
-	if (http_find_header(htx, ist("last-modified"), &ctx, 1)) {
-		if (parse_http_date(istptr(ctx.value), istlen(ctx.value), &tm)) {
-			last_modified = my_timegm(&tm);
+	/* the httpclient is released once this callback returns */
+	hc->flags |= HTTPCLIENT_FA_AUTOKILL;
+	hc->caller = NULL;
+	if (!reval)
+		return;
+
+	cache = reval->cache;
+	shctx = shctx_ptr(cache);
+	tree = get_cache_tree_from_hash(cache, read_u32(reval->hash));
+	failed = (!reval->complete || reval->status < 200 || reval->status >= 500);
+
+	cache_wrlock(tree);
+	cur = get_entry(tree, reval->hash, 0);
+	if (cur && reval->secondary_key_signature)
+		cur = get_secondary_entry(tree, cur, reval->secondary_key, 0);
+
+	/* the stale entry may have been replaced or evicted in the mean time */
+	if (cur != reval->old)
+		cur = NULL;
+	if (cur)
+		HA_ATOMIC_STORE(&cur->revalidating, 0);
+
+	if (failed) {
+		/* the stale entry may still be used */
+	}
+	else if (reval->status == 304) {
+		if (cur) {
+			cur->latest_validation = date.tv_sec;
+			cur->age = 0;
+			cur->fresh_until = date.tv_sec + reval->maxage;
+			cur->swr = reval->swr;
+			cur->sie = reval->sie;
+			cur->expire = cur->fresh_until + MAX(cur->swr, cur->sie);
+			cache_purge_index(cache, reval->hash, IST_NULL, NULL, cur->expire);
 		}
 	}
+	else {
+		/* the stale entry is superseded or must not be used anymore. It
+		 * is unindexed immediately since it may still be referenced.
+		 */
+		if (cur) {
+			delete_entry(cur);
+			release_entry_locked(tree, cur);
+		}
 
-	if (!last_modified) {
-		ctx.blk = NULL;
-		if (http_find_header(htx, ist("date"), &ctx, 1)) {
-			if (parse_http_date(istptr(ctx.value), istlen(ctx.value), &tm)) {
-				last_modified = my_timegm(&tm);
+		if (reval->first) {
+			object = (struct cache_entry *)reval->first->data;
+			cur = get_entry(tree, reval->hash, 1);
+			if (cur && reval->secondary_key_signature)
+				cur = get_secondary_entry(tree, cur, reval->secondary_key, 1);
+			if (cur && !cur->complete) {
+				/* another response is being stored */
+				object = NULL;
+			}
+			else {
+				if (cur)
+					release_entry_locked(tree, cur);
+				object->eb.key = read_u32(reval->hash);
+				if (insert_entry(cache, tree, object) != &object->eb) {
+					object->eb.key = 0;
+					object = NULL;
+				}
 			}
 		}
 	}
+	cache_wrunlock(tree);
 
-	/* Fallback on the current time if no "Last-Modified" or "Date" header
-	 * was found. */
-	if (!last_modified)
-		last_modified = date.tv_sec;
+	if (object) {
+		if (cache->disk && reval->first->len > CACHE_DISK_SYNC_MAX)
+			cache_disk_demote(cache, reval->first);
+		shctx_wrlock(shctx);
+		object->complete = 1;
+		shctx_row_reattach(shctx, reval->first);
+		shctx_wrunlock(shctx);
+		reval->first = NULL;
+	}
+	cache_reval_drop_row(reval);
 
-	return last_modified;
+	if (failed)
+		_HA_ATOMIC_INC(&cache->reval_failures);
+
+	cache_fill_release(cache, reval->fill);
+	pool_free(pool_head_cache_reval, reval);
 }
 
-/*
- * Checks the vary header's value. The headers on which vary should be applied
- * must be explicitly supported in the vary_information array (see cache.c). If
- * any other header is mentioned, we won't store the response.
- * Returns 1 if Vary-based storage can work, 0 otherwise.
+/* Returns the server of backend <be> a revalidation may be sent to, or NULL if
+ * none. The load balancing algorithm is not involved, so that its state is left
+ * untouched: the usable server serving the fewest streams relative to its
+ * weight is picked among the active ones, or among the backup ones if none is
+ * active. The servers whose port depends on the client's one are ignored.
  */
-static int http_check_vary_header(struct htx *htx, unsigned int *vary_signature)
+static struct server *cache_reval_server(struct proxy *be)
 {
-	unsigned int vary_idx;
-	unsigned int vary_info_count;
-	const struct vary_hashing_information *vary_info;
-	struct http_hdr_ctx ctx = { .blk = NULL };
-
-	int retval = 1;
+	struct server *srv, *best = NULL;
+	int backup = !be->srv_act;
 
-	*vary_signature = 0;
-
-	vary_info_count = sizeof(vary_information)/sizeof(*vary_information);
-	while (retval && http_find_header(htx, ist("Vary"), &ctx, 0)) {
-		for (vary_idx = 0; vary_idx < vary_info_count; ++vary_idx) {
-			vary_info = &vary_information[vary_idx];
-			if (isteqi(ctx.value, vary_info->hdr_name)) {
-				*vary_signature |= vary_info->value;
-				break;
-			}
-		}
-		retval = (vary_idx < vary_info_count);
+	for (srv = be->srv; srv; srv = srv->next) {
+		if (!(srv->flags & SRV_F_BACKUP) != !backup ||
+		    ((srv->flags & SRV_F_MAPPORTS) && is_inet_addr(&srv->addr)) ||
+		    !srv_currently_usable(srv) || !server_has_room(srv))
+			continue;
+		if (!best || (unsigned long long)srv->served * best->cur_eweight <
+		             (unsigned long long)best->served * srv->cur_eweight)
+			best = srv;
 	}
-
-	return retval;
+	return best;
 }
 
-
 /*
- * Look for the accept-encoding part of the secondary_key and replace the
- * encoding bitmap part of the hash with the actual encoding of the response,
- * extracted from the content-encoding header value.
- * Responses that have an unknown encoding will not be cached if they also
- * "vary" on the accept-encoding value.
- * Returns 0 if we found a known encoding in the response, -1 otherwise.
+ * Starts the background revalidation of the stale entry <res> of <cache>
+ * found by stream <s>, unless one is already in progress. The request is sent
+ * by the httpclient to a server of the stream's backend picked by
+ * cache_reval_server(), with this server's own transport settings, and with
+ * the Host and path of the stream's request, the headers the entry varies on,
+ * and its ETag if any. A fill is registered for the entry's primary key so
+ * that streams may wait for the revalidation.
+ * Returns 1 if a revalidation is in progress, otherwise 0, notably when no
+ * server is available.
  */
-static int set_secondary_key_encoding(struct htx *htx, unsigned int vary_signature, char *secondary_key)
+static int cache_reval_start(struct stream *s, struct cache *cache, struct cache_entry *res)
 {
-	unsigned int resp_encoding_bitmap = 0;
-	const struct vary_hashing_information *info = vary_information;
-	unsigned int offset = 0;
-	unsigned int count = 0;
-	unsigned int hash_info_count = sizeof(vary_information)/sizeof(*vary_information);
-	unsigned int encoding_value;
+	static const struct {
+		struct ist name;
+		unsigned int bit;
+	} vary_hdrs[] = {
+		{ IST("accept-encoding"), VARY_ACCEPT_ENCODING },
+		{ IST("referer"),         VARY_REFERER },
+		{ IST("origin"),          VARY_ORIGIN },
+	};
+	struct http_hdr hdrs[sizeof(vary_hdrs) / sizeof(*vary_hdrs) + 2];
+	struct htx *htx = htxbuf(&s->req.buf);
 	struct http_hdr_ctx ctx = { .blk = NULL };
+	struct http_uri_parser parser;
+	struct cache_reval *reval = NULL;
+	struct httpclient *hc = NULL;
+	struct buffer *url, *etag;
+	struct server *srv;
+	struct htx_sl *sl;
+	struct ist path;
+	int i, nbhdrs = 0;
 
-	/* We must not set the accept encoding part of the secondary signature
-	 * if the response does not vary on 'Accept Encoding'. */
-	if (!(vary_signature & VARY_ACCEPT_ENCODING))
-		return 0;
-
-	/* Look for the accept-encoding part of the secondary_key. */
-	while (count < hash_info_count && info->value != VARY_ACCEPT_ENCODING) {
-		offset += info->hash_length;
-		++info;
-		++count;
-	}
+	if (HA_ATOMIC_XCHG(&res->revalidating, 1))
+		return 1;
 
-	if (count == hash_info_count)
-		return -1;
+	srv = cache_reval_server(s->be);
+	sl = http_get_stline(htx);
+	if (!srv || !sl || !http_find_header(htx, ist("host"), &ctx, 1))
+		goto fail;
+
+	parser = http_uri_parser_init(htx_sl_req_uri(sl));
+	path = http_parse_path(&parser);
+	if (!isttest(path) || *istptr(path) != '/')
+		goto fail;
+
+	url = get_trash_chunk();
+	if (!chunk_printf(url, "http://%.*s%.*s",
+			  (int)istlen(ctx.value), istptr(ctx.value), (int)istlen(path), istptr(path)))
+		goto fail;
+
+	reval = pool_zalloc(pool_head_cache_reval);
+	if (!reval)
+		goto fail;
+
+	reval->cache = cache;
+	reval->old = res;
+	reval->secondary_key_signature = res->secondary_key_signature;
+	memcpy(reval->hash, res->hash, sizeof(reval->hash));
+	memcpy(reval->secondary_key, res->secondary_key, HTTP_CACHE_SEC_KEY_LEN);
+
+	hc = httpclient_new(reval, HTTP_METH_GET, ist2(b_orig(url), b_data(url)));
+	if (!hc)
+		goto fail;
+
+	hc->options |= HTTPCLIENT_O_RES_HTX;
+	hc->ops.res_headers = cache_reval_res_headers;
+	hc->ops.res_payload = cache_reval_res_payload;
+	hc->ops.res_end = cache_reval_res_end;
+	httpclient_set_timeout(hc, s->be->timeout.server);
+	httpclient_set_server(hc, srv);
+
+	if (res->etag_length) {
+		etag = get_trash_chunk();
+		if (res->etag_length <= b_size(etag) &&
+		    shctx_row_data_get(shctx_ptr(cache), block_ptr(res), (unsigned char *)b_orig(etag),
+		                       res->etag_offset, res->etag_length) == 0)
+			hdrs[nbhdrs++] = (struct http_hdr){ ist("If-None-Match"), ist2(b_orig(etag), res->etag_length) };
+	}
 
-	while (http_find_header(htx, ist("content-encoding"), &ctx, 0)) {
-		if (parse_encoding_value(ctx.value, &encoding_value, NULL))
-			return -1; /* Do not store responses with an unknown encoding */
-		resp_encoding_bitmap |= encoding_value;
+	for (i = 0; i < sizeof(vary_hdrs) / sizeof(*vary_hdrs); i++) {
+		if (!(res->secondary_key_signature & vary_hdrs[i].bit))
+			continue;
+		ctx.blk = NULL;
+		if (http_find_header(htx, vary_hdrs[i].name, &ctx, 1))
+			hdrs[nbhdrs++] = (struct http_hdr){ vary_hdrs[i].name, ctx.value };
 	}
+	hdrs[nbhdrs] = (struct http_hdr){ IST_NULL, IST_NULL };
 
-	if (!resp_encoding_bitmap)
-		resp_encoding_bitmap |= VARY_ENCODING_IDENTITY;
+	if (httpclient_req_gen(hc, hc->req.url, HTTP_METH_GET, hdrs, IST_NULL) != 0)
+		goto fail;
 
-	/* Rewrite the bitmap part of the hash with the new bitmap that only
-	 * corresponds the the response's encoding. */
-	write_u32(secondary_key + offset, resp_encoding_bitmap);
+	HA_SPIN_LOCK(CACHE_LOCK, &cache->fill_lock);
+	if (!cache_fill_get(cache, reval->hash))
+		reval->fill = cache_fill_new(cache, reval->hash);
+	HA_SPIN_UNLOCK(CACHE_LOCK, &cache->fill_lock);
 
+	if (!httpclient_start(hc))
+		goto fail;
+
+	_HA_ATOMIC_INC(&cache->revalidations);
+	return 1;
+
+  fail:
+	httpclient_destroy(hc);
+	if (reval) {
+		cache_fill_release(cache, reval->fill);
+		pool_free(pool_head_cache_reval, reval);
+	}
+	HA_ATOMIC_STORE(&res->revalidating, 0);
 	return 0;
 }
 
-
-/*
- * This function will store the headers of the response in a buffer and then
- * register a filter to store the data
- */
 enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 					struct session *sess, struct stream *s, int flags)
 {
@@ -1201,8 +3136,6 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 	unsigned int key = read_u32(txn->cache_hash);
 	struct htx *htx;
 	struct http_hdr_ctx ctx;
-	size_t hdrs_len = 0;
-	int32_t pos;
 	unsigned int vary_signature = 0;
 	struct cache_tree *cache_tree = NULL;
 
@@ -1241,6 +3174,7 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 				if (old)
 					release_entry_locked(cache_tree, old);
 				cache_wrunlock(cache_tree);
+				cache_disk_forget(cache, txn->cache_hash);
 			}
 		}
 		goto out;
@@ -1317,7 +3251,10 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 	}
 	cache_wrunlock(cache_tree);
 
-	first = shctx_row_reserve_hot(shctx, NULL, sizeof(struct cache_entry));
+	/* the new response supersedes the demoted ones */
+	cache_disk_forget(cache, txn->cache_hash);
+
+	first = shctx_row_reserve_key(shctx, key, sizeof(struct cache_entry));
 	if (!first) {
 		goto out;
 	}
@@ -1334,6 +3271,7 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 	 * the same resource). This way the second access will find an existing
 	 * but not yet usable entry in the tree and will avoid storing its data. */
 	object->expire = date.tv_sec + 2;
+	object->fresh_until = object->expire;
 
 	memcpy(object->hash, txn->cache_hash, sizeof(object->hash));
 	if (vary_signature)
@@ -1355,56 +3293,19 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 	/* Determine the entry's maximum age (taking into account the cache's
 	 * configuration) as well as the response's explicit max age (extracted
 	 * from cache-control directives or the expires header). */
-	effective_maxage = http_calc_maxage(s, cache, &true_maxage);
-
-	ctx.blk = NULL;
-	if (http_find_header(htx, ist("Age"), &ctx, 0)) {
-		long long hdr_age;
-		if (!strl2llrc(ctx.value.ptr, ctx.value.len, &hdr_age) && hdr_age > 0) {
-			if (unlikely(hdr_age > CACHE_ENTRY_MAX_AGE))
-				hdr_age = CACHE_ENTRY_MAX_AGE;
-			/* A response with an Age value greater than its
-			 * announced max age is stale and should not be stored. */
-			object->age = hdr_age;
-			if (unlikely(object->age > true_maxage))
-				goto out;
-		}
-		else
-			goto out;
-		http_remove_header(htx, &ctx);
-	}
-
-	/* Build a last-modified time that will be stored in the cache_entry and
-	 * compared to a future If-Modified-Since client header. */
-	object->last_modified = get_last_modified_time(htx);
-
-	chunk_reset(&trash);
-	for (pos = htx_get_first(htx); pos != -1; pos = htx_get_next(htx, pos)) {
-		struct htx_blk *blk = htx_get_blk(htx, pos);
-		enum htx_blk_type type = htx_get_blk_type(blk);
-		uint32_t sz = htx_get_blksz(blk);
-
-		hdrs_len += sizeof(*blk) + sz;
-		chunk_memcat(&trash, (char *)&blk->info, sizeof(blk->info));
-		chunk_memcat(&trash, htx_get_blk_ptr(htx, blk), sz);
+	effective_maxage = http_calc_maxage(htx, cache, &true_maxage);
+	http_calc_stale(htx, cache, &object->swr, &object->sie);
 
-		/* Look for optional ETag header.
-		 * We need to store the offset of the ETag value in order for
-		 * future conditional requests to be able to perform ETag
-		 * comparisons. */
-		if (type == HTX_BLK_HDR) {
-			struct ist header_name = htx_get_blk_name(htx, blk);
-			if (isteq(header_name, ist("etag"))) {
-				object->etag_length = sz - istlen(header_name);
-				object->etag_offset = sizeof(struct cache_entry) + b_data(&trash) - sz + istlen(header_name);
-			}
-		}
-		if (type == HTX_BLK_EOH)
-			break;
-	}
+	/* the payload of a compressible response may be stored compressed, and
+	 * then delivered as is or decompressed depending on the clients.
+	 */
+#if defined(USE_ZLIB)
+	if (cache_ctx && cache_may_compress(s, cache, htx) &&
+	    cache_comp_algo->init(&cache_ctx->comp_ctx, global.tune.comp_maxlevel) == 0)
+		object->compressed = 1;
+#endif
 
-	/* Do not cache objects if the headers are too big. */
-	if (hdrs_len > htx->size - global.tune.maxrewrite)
+	if (!cache_dump_headers(htx, object, true_maxage))
 		goto out;
 
 	/* If the response has a secondary_key, fill its key part related to
@@ -1414,7 +3315,7 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 	 * We will not cache a response that has an unknown encoding (not
 	 * explicitly supported in parse_encoding_value function). */
 	if (cache->vary_processing_enabled && vary_signature)
-		if (set_secondary_key_encoding(htx, vary_signature, object->secondary_key))
+		if (set_secondary_key_encoding(htx, vary_signature, object->secondary_key, object->compressed))
 		    goto out;
 
 	if (!shctx_row_reserve_hot(shctx, first, trash.data)) {
@@ -1437,11 +3338,21 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 		LIST_INIT(&cache_ctx->detached_head);
 		/* store latest value and expiration time */
 		object->latest_validation = date.tv_sec;
-		object->expire = date.tv_sec + effective_maxage;
+		object->fresh_until = date.tv_sec + effective_maxage;
+		object->expire = object->fresh_until + MAX(object->swr, object->sie);
+		cache_purge_index(cache, object->hash, cache_purge_path(s, cache), htx, object->expire);
 		return ACT_RET_CONT;
 	}
 
 out:
+	/* the streams waiting for this response must not wait anymore */
+	cache_fill_end_strm(s, cache);
+
+#if defined(USE_ZLIB)
+	if (cache_ctx && cache_ctx->comp_ctx)
+		cache_comp_algo->end(&cache_ctx->comp_ctx);
+#endif
+
 	/* if does not cache */
 	if (first) {
 		first->len = 0;
@@ -1469,6 +3380,12 @@ static void http_cache_applet_release(struct appctx *appctx)
 	struct shared_context *shctx = shctx_ptr(ctx->cache);
 	struct shared_block *first = block_ptr(cache_ptr);
 
+#if defined(USE_ZLIB)
+	if (ctx->zstrm) {
+		inflateEnd(ctx->zstrm);
+		ha_free(&ctx->zstrm);
+	}
+#endif
 	release_entry(ctx->cache_tree, cache_ptr, 1);
 
 	shctx_wrlock(shctx);
@@ -1743,6 +3660,342 @@ static int htx_cache_add_age_hdr(struct appctx *appctx, struct htx *htx)
 	return 1;
 }
 
+/* Moves the row cursor of the cache applet context <ctx> to row position
+ * <pos>. The block chain is walked from the current position, or from the
+ * first block when seeking backwards.
+ */
+static void cache_row_seek(struct cache_appctx *ctx, unsigned int pos)
+{
+	struct shared_context *shctx = shctx_ptr(ctx->cache);
+	unsigned int skip;
+
+	if (pos < ctx->row_pos) {
+		ctx->next = block_ptr(ctx->entry);
+		ctx->offset = 0;
+		ctx->row_pos = 0;
+	}
+
+	skip = pos - ctx->row_pos;
+	while (skip >= shctx->block_size - ctx->offset) {
+		skip -= shctx->block_size - ctx->offset;
+		ctx->next = LIST_NEXT(&ctx->next->list, typeof(ctx->next), list);
+		ctx->offset = 0;
+	}
+	ctx->offset += skip;
+	ctx->row_pos = pos;
+}
+
+/* Copies <len> bytes from the row cursor of applet context <ctx> to <dst>,
+ * and moves the cursor after them.
+ */
+static void cache_row_read(struct cache_appctx *ctx, char *dst, unsigned int len)
+{
+	struct shared_context *shctx = shctx_ptr(ctx->cache);
+	unsigned int max;
+
+	while (len) {
+		max = MIN(len, shctx->block_size - ctx->offset);
+		memcpy(dst, ctx->next->data + ctx->offset, max);
+		dst += max;
+		len -= max;
+		ctx->offset += max;
+		ctx->row_pos += max;
+		if (ctx->offset == shctx->block_size) {
+			ctx->next = LIST_NEXT(&ctx->next->list, typeof(ctx->next), list);
+			ctx->offset = 0;
+		}
+	}
+}
+
+/* Makes the HTX data block following the current one in the payload of the
+ * cached entry the current block of applet context <ctx>, skipping the other
+ * blocks. Returns 0 if there is no more data block.
+ */
+static int cache_range_next_blk(struct cache_appctx *ctx)
+{
+	struct shared_block *first = block_ptr(ctx->entry);
+	unsigned int pos = ctx->blk_row + ctx->blk_end - ctx->blk_start;
+	enum htx_blk_type type;
+	uint32_t info, sz;
+
+	while (pos + sizeof(info) <= first->len) {
+		cache_row_seek(ctx, pos);
+		cache_row_read(ctx, (char *)&info, sizeof(info));
+
+		type = info >> 28;
+		sz = ((type == HTX_BLK_HDR || type == HTX_BLK_TLR)
+		      ? (info & 0xff) + ((info >> 8) & 0xfffff)
+		      : info & 0xfffffff);
+		pos += sizeof(info);
+		if (type == HTX_BLK_DATA) {
+			ctx->blk_row = pos;
+			ctx->blk_start = ctx->blk_end;
+			ctx->blk_end += sz;
+			return 1;
+		}
+		pos += sz;
+	}
+	return 0;
+}
+
+/* Fills <buf> with the headers of the part of multipart range response for
+ * range <idx> of applet context <ctx>, or with the closing delimiter if <idx>
+ * is the number of ranges.
+ */
+static void cache_range_part_hdr(struct cache_appctx *ctx, struct buffer *buf, unsigned int idx)
+{
+	if (idx == ctx->nb_ranges) {
+		chunk_printf(buf, "\r\n--%016llx--\r\n", ctx->boundary);
+		return;
+	}
+
+	chunk_printf(buf, "\r\n--%016llx\r\n", ctx->boundary);
+	if (ctx->ctype_len)
+		chunk_appendf(buf, "Content-Type: %.*s\r\n", ctx->ctype_len, ctx->ctype);
+	chunk_appendf(buf, "Content-Range: bytes %u-%u/%u\r\n\r\n",
+		      ctx->ranges[idx].start, ctx->ranges[idx].end, ctx->entry->body_size);
+}
+
+/* Turns the headers of the cached response in <htx> into those of a "206
+ * Partial Content" response for the ranges of the applet's context, or of a
+ * "416 Range Not Satisfiable" response. Several ranges make a multipart
+ * response, unless the object's Content-Type is too long to be repeated in
+ * the parts, in which case they are merged into a single range. Returns 0 on
+ * error.
+ */
+static int htx_cache_set_range_hdrs(struct appctx *appctx, struct htx *htx)
+{
+	struct cache_appctx *ctx = appctx->svcctx;
+	struct http_hdr_ctx hdr = { .blk = NULL };
+	struct buffer *buf = get_trash_chunk();
+	unsigned long long len = 0;
+	struct htx_sl *sl;
+	unsigned int i;
+	char *end;
+
+	while (http_find_header(htx, ist("content-length"), &hdr, 1))
+		http_remove_header(htx, &hdr);
+	hdr.blk = NULL;
+	while (http_find_header(htx, ist("transfer-encoding"), &hdr, 1))
+		http_remove_header(htx, &hdr);
+
+	sl = http_get_stline(htx);
+	if (!sl)
+		return 0;
+	sl->flags &= ~(HTX_SL_F_XFER_ENC | HTX_SL_F_CHNK);
+	sl->flags |= HTX_SL_F_XFER_LEN | HTX_SL_F_CLEN;
+
+	if (ctx->range_unsatisfiable) {
+		chunk_printf(buf, "bytes */%u", ctx->entry->body_size);
+		return (http_replace_res_status(htx, ist("416"), ist("Range Not Satisfiable")) &&
+			http_add_header(htx, ist("Content-Range"), ist2(b_orig(buf), b_data(buf))) &&
+			http_add_header(htx, ist("Content-Length"), ist("0")));
+	}
+
+	if (!http_replace_res_status(htx, ist("206"), ist("Partial Content")))
+		return 0;
+
+	if (ctx->nb_ranges > 1) {
+		ctx->ctype_len = 0;
+		hdr.blk = NULL;
+		if (http_find_header(htx, ist("content-type"), &hdr, 1)) {
+			if (istlen(hdr.value) > CACHE_RANGE_CTYPE_LEN) {
+				/* merge all ranges */
+				for (i = 1; i < ctx->nb_ranges; i++) {
+					ctx->ranges[0].start = MIN(ctx->ranges[0].start, ctx->ranges[i].start);
+					ctx->ranges[0].end = MAX(ctx->ranges[0].end, ctx->ranges[i].end);
+				}
+				ctx->nb_ranges = 1;
+				goto single;
+			}
+			memcpy(ctx->ctype, istptr(hdr.value), istlen(hdr.value));
+			ctx->ctype_len = istlen(hdr.value);
+			http_remove_header(htx, &hdr);
+		}
+
+		ctx->boundary = ha_random64();
+		for (i = 0; i <= ctx->nb_ranges; i++) {
+			cache_range_part_hdr(ctx, buf, i);
+			len += b_data(buf);
+			if (i < ctx->nb_ranges)
+				len += ctx->ranges[i].end - ctx->ranges[i].start + 1;
+		}
+
+		chunk_printf(buf, "multipart/byteranges; boundary=%016llx", ctx->boundary);
+		if (!http_add_header(htx, ist("Content-Type"), ist2(b_orig(buf), b_data(buf))))
+			return 0;
+	}
+	else {
+	  single:
+		chunk_printf(buf, "bytes %u-%u/%u", ctx->ranges[0].start, ctx->ranges[0].end,
+			     ctx->entry->body_size);
+		if (!http_add_header(htx, ist("Content-Range"), ist2(b_orig(buf), b_data(buf))))
+			return 0;
+		len = ctx->ranges[0].end - ctx->ranges[0].start + 1;
+	}
+
+	end = ulltoa(len, b_orig(buf), b_size(buf));
+	if (!end || !http_add_header(htx, ist("Content-Length"), ist2(b_orig(buf), end - b_orig(buf))))
+		return 0;
+
+	/* the payload starts where the headers end */
+	ctx->payload_pos = ctx->row_pos = sizeof(*ctx->entry) + ctx->sent;
+	ctx->blk_row = ctx->payload_pos;
+	ctx->blk_start = ctx->blk_end = 0;
+	ctx->cur_range = 0;
+	ctx->range_pos = ctx->ranges[0].start;
+	ctx->range_part_sent = 0;
+	return 1;
+}
+
+/* Sends the ranges of the payload of the cached entry of applet context
+ * <appctx> into <htx>, by seeking into the row for each of them. Returns 1
+ * once everything was sent, 0 if there is not enough room in <htx>, and -1
+ * on error.
+ */
+static int htx_cache_dump_ranges(struct appctx *appctx, struct htx *htx)
+{
+	struct cache_appctx *ctx = appctx->svcctx;
+	struct shared_context *shctx = shctx_ptr(ctx->cache);
+	struct buffer *buf = get_trash_chunk();
+	struct cache_range *range;
+	unsigned int len, max;
+	size_t sz;
+
+	while (ctx->cur_range < ctx->nb_ranges) {
+		range = &ctx->ranges[ctx->cur_range];
+
+		if (ctx->nb_ranges > 1 && !ctx->range_part_sent) {
+			cache_range_part_hdr(ctx, buf, ctx->cur_range);
+			if (!htx_add_data_atonce(htx, ist2(b_orig(buf), b_data(buf))))
+				return 0;
+			ctx->range_part_sent = 1;
+		}
+
+		while (ctx->range_pos <= range->end) {
+			if (ctx->range_pos < ctx->blk_start) {
+				ctx->blk_row = ctx->payload_pos;
+				ctx->blk_start = ctx->blk_end = 0;
+			}
+			while (ctx->range_pos >= ctx->blk_end) {
+				if (!cache_range_next_blk(ctx))
+					return -1;
+			}
+
+			cache_row_seek(ctx, ctx->blk_row + ctx->range_pos - ctx->blk_start);
+			len = MIN(range->end + 1, ctx->blk_end) - ctx->range_pos;
+			while (len) {
+				max = MIN(len, shctx->block_size - ctx->offset);
+				sz = htx_add_data(htx, ist2(ctx->next->data + ctx->offset, max));
+				ctx->offset += sz;
+				ctx->row_pos += sz;
+				ctx->range_pos += sz;
+				len -= sz;
+				if (ctx->offset == shctx->block_size) {
+					ctx->next = LIST_NEXT(&ctx->next->list, typeof(ctx->next), list);
+					ctx->offset = 0;
+				}
+				if (sz < max)
+					return 0;
+			}
+		}
+
+		ctx->cur_range++;
+		ctx->range_part_sent = 0;
+		if (ctx->cur_range < ctx->nb_ranges)
+			ctx->range_pos = ctx->ranges[ctx->cur_range].start;
+	}
+
+	if (ctx->nb_ranges > 1 && ctx->cur_range == ctx->nb_ranges) {
+		cache_range_part_hdr(ctx, buf, ctx->nb_ranges);
+		if (!htx_add_data_atonce(htx, ist2(b_orig(buf), b_data(buf))))
+			return 0;
+		ctx->cur_range++;
+	}
+	return 1;
+}
+
+#if defined(USE_ZLIB)
+/* Sends the payload of the compressed cached entry of applet context <appctx>
+ * into <htx>, decompressed. The compressed data are read from the row the same
+ * way as ranges, <range_pos> being the offset of the next compressed byte.
+ * Returns 1 once everything was sent, 0 if there is not enough room in <htx>,
+ * and -1 on error.
+ */
+static int htx_cache_dump_inflate(struct appctx *appctx, struct htx *htx)
+{
+	struct cache_appctx *ctx = appctx->svcctx;
+	struct shared_context *shctx = shctx_ptr(ctx->cache);
+	struct buffer *buf = get_trash_chunk();
+	z_stream *strm = ctx->zstrm;
+	unsigned int len, room;
+	int ret;
+
+	if (!strm) {
+		strm = calloc(1, sizeof(*strm));
+		if (!strm)
+			return -1;
+		if (inflateInit2(strm, MAX_WBITS + 16) != Z_OK) {
+			free(strm);
+			return -1;
+		}
+		ctx->zstrm = strm;
+
+		/* the payload starts where the headers end */
+		ctx->payload_pos = ctx->row_pos = sizeof(*ctx->entry) + ctx->sent;
+		ctx->blk_row = ctx->payload_pos;
+		ctx->blk_start = ctx->blk_end = 0;
+		ctx->range_pos = 0;
+	}
+
+	while (1) {
+		room = MIN(htx_free_data_space(htx), b_size(buf));
+		if (!room)
+			return 0;
+
+		while (ctx->range_pos >= ctx->blk_end) {
+			/* the compressed stream is truncated */
+			if (!cache_range_next_blk(ctx))
+				return -1;
+		}
+
+		cache_row_seek(ctx, ctx->blk_row + ctx->range_pos - ctx->blk_start);
+		len = MIN(ctx->blk_end - ctx->range_pos, shctx->block_size - ctx->offset);
+
+		strm->next_in = (unsigned char *)ctx->next->data + ctx->offset;
+		strm->avail_in = len;
+		strm->next_out = (unsigned char *)b_orig(buf);
+		strm->avail_out = room;
+		ret = inflate(strm, Z_NO_FLUSH);
+		if (ret != Z_OK && ret != Z_STREAM_END)
+			return -1;
+
+		ctx->range_pos += len - strm->avail_in;
+		if (strm->avail_out < room &&
+		    !htx_add_data_atonce(htx, ist2(b_orig(buf), room - strm->avail_out)))
+			return -1;
+
+		if (ret == Z_STREAM_END)
+			return 1;
+	}
+}
+#endif /* USE_ZLIB */
+
+/* Sends the payload of the cached entry of applet context <appctx> into <htx>
+ * either by ranges or decompressed. Returns 1 once everything was sent, 0 if
+ * there is not enough room in <htx>, and -1 on error.
+ */
+static int htx_cache_dump_payload(struct appctx *appctx, struct htx *htx)
+{
+#if defined(USE_ZLIB)
+	struct cache_appctx *ctx = appctx->svcctx;
+
+	if (ctx->inflate)
+		return htx_cache_dump_inflate(appctx, htx);
+#endif
+	return htx_cache_dump_ranges(appctx, htx);
+}
+
 static size_t http_cache_fastfwd(struct appctx *appctx, struct buffer *buf, size_t count, unsigned int flags)
 {
 	struct cache_appctx *ctx = appctx->svcctx;
@@ -1828,11 +4081,27 @@ static void http_cache_io_handler(struct appctx *appctx)
 			}
 		}
 
+		if ((ctx->nb_ranges || ctx->range_unsatisfiable) && !htx_cache_set_range_hdrs(appctx, res_htx))
+			goto error;
+
+		/* a compressed payload delivered decompressed has no encoding */
+		if (ctx->inflate) {
+			struct http_hdr_ctx hdr = { .blk = NULL };
+
+			while (http_find_header(res_htx, ist("content-encoding"), &hdr, 1))
+				http_remove_header(res_htx, &hdr);
+		}
+
 		/* Skip response body for HEAD requests or in case of "304 Not
-		 * Modified" response. */
+		 * Modified" or "416 Range Not Satisfiable" response. Ranges and
+		 * decompressed payloads are sent without fast-forwarding.
+		 */
 		meth = htx_sl_req_meth(http_get_stline(htxbuf(&appctx->inbuf)));
-		if (find_http_meth(istptr(meth), istlen(meth)) == HTTP_METH_HEAD || ctx->send_notmodified)
+		if (find_http_meth(istptr(meth), istlen(meth)) == HTTP_METH_HEAD || ctx->send_notmodified ||
+		    ctx->range_unsatisfiable)
 			appctx->st0 = HTX_CACHE_EOM;
+		else if (ctx->nb_ranges || ctx->inflate)
+			appctx->st0 = HTX_CACHE_DATA;
 		else {
 			if (!(global.tune.no_zero_copy_fwd & NO_ZERO_COPY_FWD_APPLET))
 				se_fl_set(appctx->sedesc, SE_FL_MAY_FASTFWD_PROD);
@@ -1843,6 +4112,18 @@ static void http_cache_io_handler(struct appctx *appctx)
 		}
 	}
 
+	if (appctx->st0 == HTX_CACHE_DATA && (ctx->nb_ranges || ctx->inflate)) {
+		int done = htx_cache_dump_payload(appctx, res_htx);
+
+		if (done < 0)
+			goto error;
+		if (!done) {
+			applet_fl_set(appctx, APPCTX_FL_OUTBLK_FULL);
+			goto out;
+		}
+		appctx->st0 = HTX_CACHE_EOM;
+	}
+
 	if (appctx->st0 == HTX_CACHE_DATA) {
 		if (len) {
 			ret = htx_cache_dump_msg(appctx, res_htx, len, HTX_BLK_UNUSED);
@@ -2075,30 +4356,174 @@ static int should_send_notmodified_response(struct cache *cache, struct htx *htx
 			}
 		}
 
-		if (http_compare_etags(cache_entry_etag, ctx.value) == 1) {
-			retval = 1;
-			break;
-		}
-	}
+		if (http_compare_etags(cache_entry_etag, ctx.value) == 1) {
+			retval = 1;
+			break;
+		}
+	}
+
+	/* If the request did not contain an "If-None-Match" header, we look for
+	 * an "If-Modified-Since" header (see RFC 7232#3.3). */
+	if (retval == 0 && if_none_match_found == 0) {
+		ctx.blk = NULL;
+		if (http_find_header(htx, ist("if-modified-since"), &ctx, 1)) {
+			if (parse_http_date(istptr(ctx.value), istlen(ctx.value), &tm)) {
+				if_modified_since = my_timegm(&tm);
+
+				/* We send a "304 Not Modified" response if the
+				 * entry's last modified date is earlier than
+				 * the one found in the "If-Modified-Since"
+				 * header. */
+				retval = (entry->last_modified <= if_modified_since);
+			}
+		}
+	}
+
+	return retval;
+}
+
+/* Returns 1 if the "If-Range" header value <value> of a request matches the
+ * cached entry <entry>, meaning that the requested ranges may be served from
+ * it. Only strong ETags and exact dates match (RFC 9110#13.1.5).
+ */
+static int cache_if_range_match(struct cache *cache, struct cache_entry *entry, struct ist value)
+{
+	struct buffer *etag;
+	struct tm tm = {};
+
+	if (istlen(value) && (*istptr(value) == '"' || istmatch(value, ist("W/")))) {
+		if (http_get_etag_type(value) != ETAG_STRONG || !entry->etag_length)
+			return 0;
+
+		etag = get_trash_chunk();
+		if (entry->etag_length > b_size(etag) ||
+		    shctx_row_data_get(shctx_ptr(cache), block_ptr(entry), (unsigned char *)b_orig(etag),
+		                       entry->etag_offset, entry->etag_length) != 0)
+			return 0;
+		return isteq(ist2(b_orig(etag), entry->etag_length), value);
+	}
+
+	if (!parse_http_date(istptr(value), istlen(value), &tm))
+		return 0;
+	return (my_timegm(&tm) == entry->last_modified);
+}
+
+/* Parses the decimal number at the beginning of <value> into <ret>, capped to
+ * UINT_MAX. Returns the number of digits, 0 if there is no number.
+ */
+static size_t cache_range_num(struct ist value, unsigned long long *ret)
+{
+	size_t i;
+
+	*ret = 0;
+	for (i = 0; i < istlen(value) && isdigit((unsigned char)istptr(value)[i]); i++) {
+		*ret = *ret * 10 + istptr(value)[i] - '0';
+		if (*ret > UINT_MAX)
+			*ret = (unsigned long long)UINT_MAX + 1;
+	}
+	return i;
+}
+
+/* Looks for a "Range" header in the request in <htx> which may be served from
+ * the cached entry <entry> of <cache>, and fills the ranges of the applet
+ * context <ctx> accordingly (RFC 9110#14). The header is ignored if it is
+ * invalid, if it does not apply because of an "If-Range" header, or if there
+ * are more than CACHE_MAX_RANGES ranges, in which case the whole object is
+ * sent. If no range overlaps the payload, a 416 response will be sent.
+ */
+static void cache_parse_range(struct cache *cache, struct htx *htx, struct cache_entry *entry,
+                              struct cache_appctx *ctx)
+{
+	struct http_hdr_ctx hdr = { .blk = NULL };
+	unsigned long long first, last;
+	unsigned int size = entry->body_size;
+	struct ist value, spec;
+	int nb_specs = 0;
+	size_t len;
+
+	ctx->nb_ranges = 0;
+	ctx->range_unsatisfiable = 0;
+
+	if (!http_find_header(htx, ist("range"), &hdr, 1))
+		return;
+	value = hdr.value;
+	if (http_find_header(htx, ist("range"), &hdr, 1))
+		return;
+
+	hdr.blk = NULL;
+	if (http_find_header(htx, ist("if-range"), &hdr, 1) &&
+	    !cache_if_range_match(cache, entry, hdr.value))
+		return;
 
-	/* If the request did not contain an "If-None-Match" header, we look for
-	 * an "If-Modified-Since" header (see RFC 7232#3.3). */
-	if (retval == 0 && if_none_match_found == 0) {
-		ctx.blk = NULL;
-		if (http_find_header(htx, ist("if-modified-since"), &ctx, 1)) {
-			if (parse_http_date(istptr(ctx.value), istlen(ctx.value), &tm)) {
-				if_modified_since = my_timegm(&tm);
+	if (!istmatchi(value, ist("bytes=")))
+		return;
+	value = istadv(value, 6);
 
-				/* We send a "304 Not Modified" response if the
-				 * entry's last modified date is earlier than
-				 * the one found in the "If-Modified-Since"
-				 * header. */
-				retval = (entry->last_modified <= if_modified_since);
+	while (istlen(value)) {
+		spec = istsplit(&value, ',');
+		spec = http_trim_trailing_spht(http_trim_leading_spht(spec));
+		if (!istlen(spec))
+			continue;
+
+		nb_specs++;
+		if (*istptr(spec) == '-') {
+			/* suffix range: the last <last> bytes */
+			spec = istnext(spec);
+			len = cache_range_num(spec, &last);
+			if (!len || len != istlen(spec))
+				goto invalid;
+			if (!last || !size)
+				continue;
+			first = (last < size) ? size - last : 0;
+			last = size - 1;
+		}
+		else {
+			len = cache_range_num(spec, &first);
+			if (!len || len == istlen(spec) || istptr(spec)[len] != '-')
+				goto invalid;
+			spec = istadv(spec, len + 1);
+			if (!istlen(spec))
+				last = size - 1;
+			else {
+				len = cache_range_num(spec, &last);
+				if (len != istlen(spec) || last < first)
+					goto invalid;
 			}
+			if (first >= size)
+				continue;
+			if (last >= size)
+				last = size - 1;
 		}
+
+		if (ctx->nb_ranges == CACHE_MAX_RANGES)
+			goto invalid;
+		ctx->ranges[ctx->nb_ranges].start = first;
+		ctx->ranges[ctx->nb_ranges].end = last;
+		ctx->nb_ranges++;
 	}
 
-	return retval;
+	if (nb_specs && !ctx->nb_ranges)
+		ctx->range_unsatisfiable = 1;
+	return;
+
+  invalid:
+	ctx->nb_ranges = 0;
+}
+
+/* Tells whether the request in <htx> explicitly accepts the gzip encoding. The
+ * compressed objects are decompressed for the other ones.
+ */
+static int cache_accepts_gzip(struct htx *htx)
+{
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	char bitmap[sizeof(uint32_t)];
+	unsigned int len;
+
+	if (!http_find_header(htx, ist("accept-encoding"), &ctx, 0))
+		return 0;
+	if (accept_encoding_normalizer(htx, ist("accept-encoding"), bitmap, &len) != 0)
+		return 0;
+	return !!(read_u32(bitmap) & VARY_ENCODING_GZIP);
 }
 
 enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *px,
@@ -2111,9 +4536,29 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 	struct cache *cache = cconf->c.cache;
 	struct shared_context *shctx = shctx_ptr(cache);
 	struct shared_block *entry_block;
+	struct cache_st *st;
+	int promoted = 0;
+	int coalesced = 0;
+	int stale = 0;
+	int reval;
 
 	struct cache_tree *cache_tree = NULL;
 
+	/* The action is only called again after it yielded while waiting for
+	 * the read of an object from the disk tier, or for the end of the fill
+	 * started by another stream.
+	 */
+	if (!(flags & ACT_OPT_FIRST)) {
+		st = cache_strm_ctx(s, cconf);
+		if (!st)
+			return ACT_RET_CONT;
+		if (st->disk_io)
+			goto resume_disk;
+		if (st->coalesced)
+			goto resume_fill;
+		return ACT_RET_CONT;
+	}
+
 	/* Ignore cache for HTTP/1.0 requests and for requests other than GET
 	 * and HEAD */
 	if (!(txn->req.flags & HTTP_MSGF_VER_11) ||
@@ -2146,6 +4591,9 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 	if (!cache_tree)
 		return ACT_RET_CONT;
 
+	shctx_key_access(shctx, read_u32(s->txn->cache_hash));
+
+  lookup:
 	cache_rdlock(cache_tree);
 	res = get_entry(cache_tree, s->txn->cache_hash, 0);
 	/* We must not use an entry that is not complete but the check will be
@@ -2206,10 +4654,46 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 		 * can't use the cache's entry and must forward the request to
 		 * the server. */
 		if (!res) {
-			return ACT_RET_CONT;
+			goto miss;
 		} else if (!res->complete) {
 			release_entry(cache_tree, res, 1);
-			return ACT_RET_CONT;
+			goto miss;
+		}
+
+		/* A stale entry may be served while it is revalidated in the
+		 * background, or if its revalidation failed or could not even
+		 * be attempted. Otherwise the stream waits for the
+		 * revalidation to know whether the entry may still be used.
+		 */
+		if (res->fresh_until <= date.tv_sec) {
+			if (date.tv_sec < res->fresh_until + res->swr) {
+				cache_reval_start(s, cache, res);
+				_HA_ATOMIC_INC(&cache->stale_hits);
+				stale = 1;
+			}
+			else if (coalesced) {
+				_HA_ATOMIC_INC(&cache->stale_error_hits);
+				stale = 1;
+			}
+			else if (!(reval = cache_reval_start(s, cache, res)) &&
+				 date.tv_sec < res->fresh_until + res->sie) {
+				/* no server may even be tried */
+				_HA_ATOMIC_INC(&cache->stale_error_hits);
+				stale = 1;
+			}
+			else {
+				int waiting;
+
+				waiting = (reval && cache_fill_wait(cache, cache_strm_ctx(s, cconf), s, flags));
+				release_entry(cache_tree, res, 1);
+				shctx_wrlock(shctx);
+				shctx_row_reattach(shctx, entry_block);
+				shctx_wrunlock(shctx);
+				if (!waiting)
+					goto miss;
+				_HA_ATOMIC_INC(&cache->misses);
+				return ACT_RET_YIELD;
+			}
 		}
 
 		s->target = &http_cache_applet.obj_type;
@@ -2224,6 +4708,19 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 			ctx->sent = 0;
 			ctx->send_notmodified =
                                 should_send_notmodified_response(cache, htxbuf(&s->req.buf), res);
+			ctx->nb_ranges = 0;
+			ctx->range_unsatisfiable = 0;
+			/* the ranges of a compressed object are ignored, as they
+			 * may designate either representation.
+			 */
+			if (!ctx->send_notmodified && txn->meth == HTTP_METH_GET && !res->compressed)
+				cache_parse_range(cache, htxbuf(&s->req.buf), res, ctx);
+			ctx->inflate = res->compressed && !cache_accepts_gzip(htxbuf(&s->req.buf));
+#if defined(USE_ZLIB)
+			ctx->zstrm = NULL;
+#endif
+			if (ctx->inflate)
+				_HA_ATOMIC_INC(&cache->inflated);
 
 			if (px == strm_fe(s)) {
 				if (px->fe_counters.shared.tg)
@@ -2233,6 +4730,13 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 				if (px->be_counters.shared.tg)
 					_HA_ATOMIC_INC(&px->be_counters.shared.tg[tgid - 1]->p.http.cache_hits);
 			}
+			if (stale) {
+				/* already counted */
+			}
+			else if (coalesced)
+				_HA_ATOMIC_INC(&cache->coalesce_hits);
+			else if (!promoted)
+				_HA_ATOMIC_INC(&cache->hits);
 			return ACT_RET_CONT;
 		} else {
 			s->target = NULL;
@@ -2245,14 +4749,86 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 	}
 	cache_rdunlock(cache_tree);
 
+  miss:
+	/* the path of the object is only known while processing the request */
+	if (cache->purge_prefix) {
+		st = cache_strm_ctx(s, cconf);
+		if (st && !st->purge_path) {
+			struct htx_sl *sl = http_get_stline(htxbuf(&s->req.buf));
+			struct http_uri_parser parser;
+			struct ist path;
+
+			if (sl) {
+				parser = http_uri_parser_init(htx_sl_req_uri(sl));
+				path = http_parse_path(&parser);
+				if (isttest(path))
+					st->purge_path = my_strndup(istptr(path), istlen(path));
+			}
+		}
+	}
+
+	/* An object promoted from the disk tier may have been evicted or
+	 * replaced in the mean time, and the fill a stream waited for may not
+	 * have been stored.
+	 */
+	if (promoted || coalesced)
+		return ACT_RET_CONT;
+
 	/* Shared context does not need to be locked while we calculate the
 	 * secondary hash. */
-	if (!res && cache->vary_processing_enabled) {
+	if (cache->vary_processing_enabled) {
 		/* Build a complete secondary hash until the server response
 		 * tells us which fields should be kept (if any). */
 		http_request_prebuild_full_secondary_key(s);
 	}
-	return ACT_RET_CONT;
+
+	_HA_ATOMIC_INC(&cache->misses);
+	if (cache->disk) {
+		if (!(flags & ACT_OPT_FINAL) && cache_disk_fetch(s, cconf))
+			return ACT_RET_YIELD;
+		_HA_ATOMIC_INC(&cache->disk->misses);
+	}
+	return cache_fill_join(cache, cache_strm_ctx(s, cconf), s, flags);
+
+  resume_disk:
+	if (!st->disk_io->done) {
+		if (!(flags & ACT_OPT_FINAL))
+			return ACT_RET_YIELD;
+		/* the stream cannot wait anymore */
+		cache_disk_io_release(st->disk_io);
+		st->disk_io = NULL;
+		return ACT_RET_CONT;
+	}
+
+	promoted = cache_disk_promote(cache, st->disk_io);
+	cache_disk_io_release(st->disk_io);
+	st->disk_io = NULL;
+	if (!promoted) {
+		_HA_ATOMIC_INC(&cache->disk->misses);
+		return cache_fill_join(cache, st, s, flags);
+	}
+
+	_HA_ATOMIC_INC(&cache->disk->hits);
+	cache_tree = get_cache_tree_from_hash(cache, read_u32(s->txn->cache_hash));
+	goto lookup;
+
+  resume_fill:
+	if (HA_ATOMIC_LOAD(&st->waiting)) {
+		if (!(flags & ACT_OPT_FINAL) && !tick_is_expired(s->req.analyse_exp, now_ms))
+			return ACT_RET_YIELD;
+
+		/* the fill takes too long, forward the request */
+		if (cache_fill_leave(cache, st)) {
+			s->req.analyse_exp = TICK_ETERNITY;
+			_HA_ATOMIC_INC(&cache->coalesce_timeouts);
+			return ACT_RET_CONT;
+		}
+	}
+
+	s->req.analyse_exp = TICK_ETERNITY;
+	coalesced = 1;
+	cache_tree = get_cache_tree_from_hash(cache, read_u32(s->txn->cache_hash));
+	goto lookup;
 }
 
 
@@ -2269,6 +4845,83 @@ enum act_parse_ret parse_cache_use(const char **args, int *orig_arg, struct prox
 	return ACT_RET_PRS_OK;
 }
 
+/* Purges from the cache the objects whose tag or path prefix is the result of
+ * the rule's expression.
+ */
+enum act_return http_action_req_cache_purge(struct act_rule *rule, struct proxy *px,
+                                            struct session *sess, struct stream *s, int flags)
+{
+	struct cache_flt_conf *cconf = rule->arg.act.p[0];
+	struct sample *smp;
+	struct buffer *str;
+
+	smp = sample_fetch_as_type(px, sess, s, SMP_OPT_DIR_REQ|SMP_OPT_FINAL, rule->arg.act.p[1], SMP_T_STR);
+	if (!smp || !smp->data.u.str.data)
+		return ACT_RET_CONT;
+
+	str = alloc_trash_chunk();
+	if (!str)
+		return ACT_RET_CONT;
+
+	if (smp->data.u.str.data < b_size(str) &&
+	    chunk_memcpy(str, smp->data.u.str.area, smp->data.u.str.data)) {
+		str->area[str->data] = 0;
+		cache_purge(cconf->c.cache, (long)rule->arg.act.p[2], str->area);
+	}
+	free_trash_chunk(str);
+	return ACT_RET_CONT;
+}
+
+static void release_cache_purge(struct act_rule *rule)
+{
+	release_sample_expr(rule->arg.act.p[1]);
+}
+
+/* Parses "cache-purge <cache> { tag | prefix } <expr>" */
+enum act_parse_ret parse_cache_purge(const char **args, int *orig_arg, struct proxy *proxy,
+                                     struct act_rule *rule, char **err)
+{
+	struct sample_expr *expr;
+	int cur_arg;
+	long type;
+
+	rule->action       = ACT_CUSTOM;
+	rule->action_ptr   = http_action_req_cache_purge;
+
+	if (!parse_cache_rule(proxy, args[*orig_arg], rule, err))
+		return ACT_RET_PRS_ERR;
+
+	cur_arg = *orig_arg + 1;
+	if (strcmp(args[cur_arg], "tag") == 0)
+		type = CACHE_PURGE_TAG;
+	else if (strcmp(args[cur_arg], "prefix") == 0)
+		type = CACHE_PURGE_PATH;
+	else {
+		memprintf(err, "expects 'tag' or 'prefix' after the cache name");
+		return ACT_RET_PRS_ERR;
+	}
+
+	cur_arg++;
+	expr = sample_parse_expr((char **)args, &cur_arg, proxy->conf.args.file, proxy->conf.args.line,
+	                         err, &proxy->conf.args, NULL);
+	if (!expr)
+		return ACT_RET_PRS_ERR;
+
+	if (!(expr->fetch->val & ((proxy->cap & PR_CAP_FE) ? SMP_VAL_FE_HRQ_HDR : SMP_VAL_BE_HRQ_HDR))) {
+		memprintf(err,
+			  "fetch method '%s' extracts information from '%s', none of which is available here",
+			  args[cur_arg-1], sample_src_names(expr->fetch->use));
+		release_sample_expr(expr);
+		return ACT_RET_PRS_ERR;
+	}
+
+	rule->arg.act.p[1] = expr;
+	rule->arg.act.p[2] = (void *)type;
+	rule->release_ptr  = release_cache_purge;
+	*orig_arg = cur_arg;
+	return ACT_RET_PRS_OK;
+}
+
 int cfg_parse_cache(const char *file, int linenum, char **args, int kwm)
 {
 	int err_code = 0;
@@ -2424,6 +5077,192 @@ int cfg_parse_cache(const char *file, int linenum, char **args, int kwm)
 			goto out;
 		}
 		tmp_cache_config->max_secondary_entries = max_sec_entries;
+	} else if (strcmp(args[0], "disk-dir") == 0) {
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		if (!*args[1]) {
+			ha_alert("parsing [%s:%d]: '%s' expects a directory.\n",
+				 file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+
+		free(tmp_cache_config->disk_dir);
+		tmp_cache_config->disk_dir = strdup(args[1]);
+		if (!tmp_cache_config->disk_dir) {
+			ha_alert("parsing [%s:%d]: out of memory.\n", file, linenum);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+	} else if (strcmp(args[0], "disk-max-size") == 0) {
+		unsigned long long maxsize;
+		char *err;
+
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		maxsize = strtoull(args[1], &err, 10);
+		if (err == args[1] || *err != '\0' || !maxsize || maxsize > (1ULL << 24)) {
+			ha_alert("parsing [%s:%d]: '%s' expects a size in megabytes between 1 and %llu.\n",
+				 file, linenum, args[0], 1ULL << 24);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+
+		/* size in megabytes */
+		tmp_cache_config->disk_size = maxsize << 20;
+	} else if (strcmp(args[0], "coalesce-timeout") == 0) {
+		const char *res;
+		unsigned int timeout;
+
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		if (!*args[1]) {
+			ha_alert("parsing [%s:%d]: '%s' expects a timeout.\n",
+				 file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+
+		res = parse_time_err(args[1], &timeout, TIME_UNIT_MS);
+		if (res == PARSE_TIME_OVER) {
+			ha_alert("parsing [%s:%d]: timer overflow in argument <%s> to <%s>, maximum value is 2147483647 ms (~24.8 days).\n",
+				 file, linenum, args[1], args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		else if (res == PARSE_TIME_UNDER) {
+			ha_alert("parsing [%s:%d]: timer underflow in argument <%s> to <%s>, minimum non-null value is 1 ms.\n",
+				 file, linenum, args[1], args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		else if (res) {
+			ha_alert("parsing [%s:%d]: unsupported character '%c' in '%s' (wants an integer delay).\n",
+				 file, linenum, *res, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		tmp_cache_config->coalesce_timeout = timeout;
+	} else if (strcmp(args[0], "eviction-policy") == 0) {
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		if (strcmp(args[1], "lru") == 0)
+			tmp_cache_config->policy = SHCTX_POLICY_LRU;
+		else if (strcmp(args[1], "tinylfu") == 0)
+			tmp_cache_config->policy = SHCTX_POLICY_TINYLFU;
+		else {
+			ha_alert("parsing [%s:%d]: '%s' expects \"lru\" or \"tinylfu\".\n",
+				 file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+	} else if (strcmp(args[0], "stale-while-revalidate") == 0 ||
+		   strcmp(args[0], "stale-if-error") == 0) {
+		unsigned long period;
+		char *err;
+
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		period = strtoul(args[1], &err, 10);
+		if (err == args[1] || *err != '\0') {
+			ha_alert("parsing [%s:%d]: '%s' expects a period in seconds.\n",
+				 file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+
+		if (period > CACHE_ENTRY_MAX_STALE)
+			period = CACHE_ENTRY_MAX_STALE;
+
+		if (strcmp(args[0], "stale-while-revalidate") == 0)
+			tmp_cache_config->swr = period;
+		else
+			tmp_cache_config->sie = period;
+	} else if (strcmp(args[0], "purge-tags-header") == 0) {
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		if (!*args[1]) {
+			ha_alert("parsing [%s:%d]: '%s' expects a header name.\n",
+				 file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+
+		free(tmp_cache_config->purge_hdr);
+		tmp_cache_config->purge_hdr = strdup(args[1]);
+		if (!tmp_cache_config->purge_hdr) {
+			ha_alert("parsing [%s:%d]: out of memory.\n", file, linenum);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+	} else if (strcmp(args[0], "purge-by-prefix") == 0) {
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		if (strcmp(args[1], "on") == 0)
+			tmp_cache_config->purge_prefix = 1;
+		else if (strcmp(args[1], "off") == 0)
+			tmp_cache_config->purge_prefix = 0;
+		else {
+			ha_alert("parsing [%s:%d]: '%s' expects \"on\" or \"off\".\n",
+				 file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+	} else if (strcmp(args[0], "compressed-storage") == 0) {
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		if (strcmp(args[1], "on") == 0)
+			tmp_cache_config->comp_storage = 1;
+		else if (strcmp(args[1], "off") == 0)
+			tmp_cache_config->comp_storage = 0;
+		else {
+			ha_alert("parsing [%s:%d]: '%s' expects \"on\" or \"off\".\n",
+				 file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+
+		if (tmp_cache_config->comp_storage) {
+#if defined(USE_ZLIB)
+			cache_comp_algo = comp_get_algo("gzip");
+			if (!cache_comp_algo) {
+				ha_alert("parsing [%s:%d]: '%s' requires the gzip compression algorithm.\n",
+					 file, linenum, args[0]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+#else
+			/* decompression relies on zlib */
+			ha_alert("parsing [%s:%d]: '%s' requires HAProxy to be built with USE_ZLIB.\n",
+				 file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+#endif
+		}
 	}
 	else if (*args[0] != 0) {
 		ha_alert("parsing [%s:%d] : unknown keyword '%s' in 'cache' section\n", file, linenum, args[0]);
@@ -2459,6 +5298,13 @@ int cfg_post_parse_section_cache()
 			goto out;
 		}
 
+		if (!tmp_cache_config->disk_dir != !tmp_cache_config->disk_size) {
+			ha_alert("\"disk-dir\" and \"disk-max-size\" must be both set to enable the disk tier of cache '%s'\n",
+				 tmp_cache_config->id);
+			err_code |= ERR_FATAL | ERR_ALERT;
+			goto out;
+		}
+
 		/* add to the list of cache to init and reinit tmp_cache_config
 		 * for next cache section, if any.
 		 */
@@ -2467,6 +5313,10 @@ int cfg_post_parse_section_cache()
 		return err_code;
 	}
 out:
+	if (tmp_cache_config) {
+		free(tmp_cache_config->disk_dir);
+		free(tmp_cache_config->purge_hdr);
+	}
 	ha_free(&tmp_cache_config);
 	return err_code;
 
@@ -2479,6 +5329,7 @@ int post_check_cache()
 	struct shared_context *shctx;
 	int ret_shctx;
 	int err_code = ERR_NONE;
+	char *err = NULL;
 	int i;
 
 	list_for_each_entry_safe(cache_config, back, &caches_config, list) {
@@ -2498,6 +5349,11 @@ int post_check_cache()
 		shctx->free_block = cache_free_blocks;
 		shctx->reserve_finish = cache_reserve_finish;
 		shctx->cb_data = (void*)shctx->data;
+		if (!shctx_set_policy(shctx, cache_config->policy)) {
+			ha_alert("Unable to allocate the eviction policy of cache '%s'.\n", cache_config->id);
+			err_code |= ERR_FATAL | ERR_ALERT;
+			goto out;
+		}
 		/* the cache structure is stored in the shctx and added to the
 		 * caches list, we can remove the entry from the caches_config
 		 * list */
@@ -2513,6 +5369,20 @@ int post_check_cache()
 			LIST_INIT(&cache->trees[i].cleanup_list);
 			HA_SPIN_INIT(&cache->trees[i].cleanup_lock);
 		}
+		cache->fills = EB_ROOT;
+		HA_SPIN_INIT(&cache->fill_lock);
+		cache->purge_objs = EB_ROOT;
+		cache->purge_exp = EB_ROOT;
+		cache->purge_tags = EB_ROOT;
+		cache->purge_paths = EB_ROOT;
+		HA_SPIN_INIT(&cache->purge_lock);
+
+		if (cache->disk_dir && !cache_disk_new(cache, &err)) {
+			ha_alert("Unable to create the disk tier of cache '%s' : %s.\n", cache->id, err);
+			ha_free(&err);
+			err_code |= ERR_FATAL | ERR_ALERT;
+			goto out;
+		}
 
 		/* Find all references for this cache in the existing filters
 		 * (over all proxies) and reference it in matching filters.
@@ -3001,12 +5871,52 @@ static int cli_io_handler_show_cache(struct appctx *appctx)
 		struct shared_context *shctx = shctx_ptr(cache);
 		int cache_tree_index = 0;
 		struct cache_tree *cache_tree = NULL;
+		unsigned long long hits, lookups;
 
 		next_key = ctx->next_key;
 		if (!next_key) {
 			shctx_rdlock(shctx);
 			chunk_printf(buf, "%p: %s (shctx:%p, available blocks:%d)\n", cache, cache->id, shctx_ptr(cache), shctx_ptr(cache)->nbav);
 			shctx_rdunlock(shctx);
+			chunk_appendf(buf, "  memory: hits:%llu misses:%llu\n",
+				      HA_ATOMIC_LOAD(&cache->hits), HA_ATOMIC_LOAD(&cache->misses));
+			hits = HA_ATOMIC_LOAD(&cache->hits);
+			lookups = hits + HA_ATOMIC_LOAD(&cache->misses);
+			shctx_rdlock(shctx);
+			chunk_appendf(buf, "  policy: %s hit-ratio:%llu.%02llu%% evicted:%llu rejected:%llu protected-blocks:%u\n",
+				      (cache->policy == SHCTX_POLICY_TINYLFU) ? "tinylfu" : "lru",
+				      lookups ? hits * 100 / lookups : 0, lookups ? hits * 10000 / lookups % 100 : 0,
+				      shctx->evicted, shctx->rejected, shctx->nbprot);
+			shctx_rdunlock(shctx);
+			if (cache->disk) {
+				struct cache_disk *disk = cache->disk;
+
+				HA_SPIN_LOCK(CACHE_LOCK, &disk->lock);
+				chunk_appendf(buf, "  disk: size:%llu used:%llu records:%u",
+					      disk->size, disk->used, disk->records);
+				HA_SPIN_UNLOCK(CACHE_LOCK, &disk->lock);
+				chunk_appendf(buf, " hits:%llu misses:%llu demoted:%llu dropped:%llu errors:%llu\n",
+					      HA_ATOMIC_LOAD(&disk->hits), HA_ATOMIC_LOAD(&disk->misses),
+					      HA_ATOMIC_LOAD(&disk->demoted), HA_ATOMIC_LOAD(&disk->dropped),
+					      HA_ATOMIC_LOAD(&disk->errors));
+			}
+			if (cache->coalesce_timeout)
+				chunk_appendf(buf, "  coalescing: waits:%llu hits:%llu timeouts:%llu\n",
+					      HA_ATOMIC_LOAD(&cache->coalesced), HA_ATOMIC_LOAD(&cache->coalesce_hits),
+					      HA_ATOMIC_LOAD(&cache->coalesce_timeouts));
+			chunk_appendf(buf, "  stale: revalidations:%llu failed:%llu stale-hits:%llu error-hits:%llu\n",
+				      HA_ATOMIC_LOAD(&cache->revalidations), HA_ATOMIC_LOAD(&cache->reval_failures),
+				      HA_ATOMIC_LOAD(&cache->stale_hits), HA_ATOMIC_LOAD(&cache->stale_error_hits));
+			if (cache_purge_enabled(cache)) {
+				HA_SPIN_LOCK(CACHE_LOCK, &cache->purge_lock);
+				chunk_appendf(buf, "  purge: records:%u", cache->purge_records);
+				HA_SPIN_UNLOCK(CACHE_LOCK, &cache->purge_lock);
+				chunk_appendf(buf, " purged:%llu\n", HA_ATOMIC_LOAD(&cache->purged));
+			}
+			if (cache->comp_storage)
+				chunk_appendf(buf, "  compression: objects:%llu in:%llu out:%llu inflated:%llu\n",
+					      HA_ATOMIC_LOAD(&cache->comp_objects), HA_ATOMIC_LOAD(&cache->comp_in),
+					      HA_ATOMIC_LOAD(&cache->comp_out), HA_ATOMIC_LOAD(&cache->inflated));
 			if (applet_putchk(appctx, buf) == -1) {
 				goto yield;
 			}
@@ -3037,9 +5947,10 @@ static int cli_io_handler_show_cache(struct appctx *appctx)
 					chunk_printf(buf, "%p hash:%u vary:0x", entry, read_u32(entry->hash));
 					for (i = 0; i < HTTP_CACHE_SEC_KEY_LEN; ++i)
 						chunk_appendf(buf, "%02x", (unsigned char)entry->secondary_key[i]);
-					chunk_appendf(buf, " size:%u (%u blocks), refcount:%u, expire:%d\n",
+					chunk_appendf(buf, " size:%u (%u blocks), refcount:%u, expire:%d%s\n",
 						      block_ptr(entry)->len, block_ptr(entry)->block_count,
-						      block_ptr(entry)->refcount, entry->expire - (int)date.tv_sec);
+						      block_ptr(entry)->refcount, entry->expire - (int)date.tv_sec,
+						      entry->compressed ? " compressed" : "");
 				}
 
 				ctx->next_key = next_key;
@@ -3061,6 +5972,46 @@ static int cli_io_handler_show_cache(struct appctx *appctx)
 	return 0;
 }
 
+/* Parses "purge cache <name> { tag <tag> | prefix <prefix> }" and purges the
+ * matching objects.
+ */
+static int cli_parse_purge_cache(char **args, char *payload, struct appctx *appctx, void *private)
+{
+	struct cache *cache;
+	unsigned int count;
+	char *msg = NULL;
+	int type;
+
+	if (!cli_has_level(appctx, ACCESS_LVL_ADMIN))
+		return 1;
+
+	if (!*args[2] || !*args[4])
+		return cli_err(appctx, "Usage: purge cache <name> { tag <tag> | prefix <prefix> }.\n");
+
+	if (strcmp(args[3], "tag") == 0)
+		type = CACHE_PURGE_TAG;
+	else if (strcmp(args[3], "prefix") == 0)
+		type = CACHE_PURGE_PATH;
+	else
+		return cli_err(appctx, "Usage: purge cache <name> { tag <tag> | prefix <prefix> }.\n");
+
+	list_for_each_entry(cache, &caches, list) {
+		if (strcmp(cache->id, args[2]) == 0)
+			goto found;
+	}
+	return cli_err(appctx, "No such cache.\n");
+
+  found:
+	if ((type == CACHE_PURGE_TAG && !cache->purge_hdr) ||
+	    (type == CACHE_PURGE_PATH && !cache->purge_prefix))
+		return cli_err(appctx, (type == CACHE_PURGE_TAG) ?
+			       "This cache does not index tags (see 'purge-tags-header').\n" :
+			       "This cache does not index paths (see 'purge-by-prefix').\n");
+
+	count = cache_purge(cache, type, args[4]);
+	return cli_dynmsg(appctx, LOG_INFO, memprintf(&msg, "%u objects purged.\n", count));
+}
+
 
 /*
  * boolean, returns true if response was built out of a cache entry.
@@ -3121,6 +6072,7 @@ static struct flt_kw_list filter_kws = { "CACHE", { }, {
 INITCALL1(STG_REGISTER, flt_register_keywords, &filter_kws);
 
 static struct cli_kw_list cli_kws = {{},{
+	{ { "purge", "cache", NULL }, "purge cache <name> tag|prefix <str>     : delete the objects with this tag or path prefix", cli_parse_purge_cache, NULL, NULL, NULL },
 	{ { "show", "cache", NULL }, "show cache                              : show cache status", cli_parse_show_cache, cli_io_handler_show_cache, NULL, NULL },
 	{{},}
 }};
@@ -3138,6 +6090,7 @@ INITCALL1(STG_REGISTER, http_res_keywords_register, &http_res_actions);
 
 static struct action_kw_list http_req_actions = {
 	.kw = {
+		{ "cache-purge", parse_cache_purge },
 		{ "cache-use", parse_cache_use },
 		{ NULL, NULL }
 	}
@@ -189,6 +189,8 @@ static int cfg_eval_cond_enabled(const char *str)
 		return !!(global.tune.options & GTUNE_USE_POLL);
 	else if (strcmp(str, "EPOLL") == 0)
 		return !!(global.tune.options & GTUNE_USE_EPOLL);
+	else if (strcmp(str, "URING") == 0)
+		return !!(global.tune.options & GTUNE_USE_URING);
 	else if (strcmp(str, "KQUEUE") == 0)
 		return !!(global.tune.options & GTUNE_USE_EPOLL);
 	else if (strcmp(str, "EVPORTS") == 0)
@@ -1049,6 +1049,9 @@ static int cfg_parse_global_disable_poller(char **args, int section_type,
 	} else if (strcmp(args[0], "nopoll") == 0) {
 		global.tune.options &= ~GTUNE_USE_POLL;
 
+	} else if (strcmp(args[0], "nouring") == 0) {
+		global.tune.options &= ~GTUNE_USE_URING;
+
 	} else {
 		BUG_ON(1, "Triggered in cfg_parse_global_disable_poller() by unsupported keyword.");
 		return -1;
@@ -1856,6 +1859,7 @@ static struct cfg_kw_list cfg_kws = {ILH, {
 	{ CFG_GLOBAL, "nokqueue", cfg_parse_global_disable_poller, KWF_DISCOVERY },
 	{ CFG_GLOBAL, "noktls", cfg_parse_global_disable_ktls, KWF_DISCOVERY },
 	{ CFG_GLOBAL, "nopoll", cfg_parse_global_disable_poller, KWF_DISCOVERY },
+	{ CFG_GLOBAL, "nouring", cfg_parse_global_disable_poller, KWF_DISCOVERY },
 	{ CFG_GLOBAL, "pidfile", cfg_parse_global_pidfile, KWF_DISCOVERY },
 	{ CFG_GLOBAL, "prealloc-fd", cfg_parse_prealloc_fd },
 	{ CFG_GLOBAL, "presetenv", cfg_parse_global_env_opts, KWF_DISCOVERY },
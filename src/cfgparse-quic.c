@@ -33,6 +33,7 @@ struct quic_tune quic_tune = {
 		.stream_data_ratio = QUIC_DFLT_FE_STREAM_DATA_RATIO,
 		.stream_max_concurrent = QUIC_DFLT_FE_STREAM_MAX_CONCURRENT,
 		.stream_rxbuf      = 0,
+		.rx_batch          = QUIC_DFLT_FE_RX_BATCH,
 		.fb_opts = QUIC_TUNE_FB_TX_PACING|QUIC_TUNE_FB_TX_UDP_GSO,
 		.opts = QUIC_TUNE_FE_SOCK_PER_CONN,
 	},
@@ -457,6 +458,14 @@ static int cfg_parse_quic_tune_setting(char **args, int section_type,
 	else if (strcmp(suffix, "fe.sec.retry-threshold") == 0) {
 		quic_tune.fe.sec_retry_threshold = arg;
 	}
+	else if (strcmp(suffix, "fe.rx.batch") == 0) {
+		if (arg > QUIC_MAX_FE_RX_BATCH) {
+			memprintf(err, "'%s' expects an integer argument between 1 and %d.",
+			          args[0], QUIC_MAX_FE_RX_BATCH);
+			return -1;
+		}
+		quic_tune.fe.rx_batch = arg;
+	}
 	else if (strcmp(suffix, "be.stream.data-ratio") == 0 ||
 	         strcmp(suffix, "fe.stream.data-ratio") == 0) {
 		uint *ptr = (suffix[0] == 'b') ? &quic_tune.be.stream_data_ratio :
@@ -678,6 +687,18 @@ static int cfg_parse_quic_tune_on_off(char **args, int section_type, struct prox
 		else
 			*ptr &= ~QUIC_TUNE_FB_TX_PACING;
 	}
+	else if (strcmp(suffix, "fe.priorities") == 0) {
+		if (on)
+			quic_tune.fe.opts &= ~QUIC_TUNE_FE_PRIO_OFF;
+		else
+			quic_tune.fe.opts |= QUIC_TUNE_FE_PRIO_OFF;
+	}
+	else if (strcmp(suffix, "fe.rx.udp-gro") == 0) {
+		if (on)
+			quic_tune.fe.opts |= QUIC_TUNE_FE_RX_UDP_GRO;
+		else
+			quic_tune.fe.opts &= ~QUIC_TUNE_FE_RX_UDP_GRO;
+	}
 	else if (strcmp(suffix, "be.tx.udp-gso") == 0 ||
 	         strcmp(suffix, "fe.tx.udp-gso") == 0) {
 		uint *ptr = (suffix[0] == 'b') ? &quic_tune.be.fb_opts :
@@ -711,6 +732,9 @@ static struct cfg_kw_list cfg_kws = {ILH, {
 	{ CFG_GLOBAL, "tune.quic.fe.cc.max-win-size", cfg_parse_quic_tune_setting },
 	{ CFG_GLOBAL, "tune.quic.fe.cc.reorder-ratio", cfg_parse_quic_tune_setting },
 	{ CFG_GLOBAL, "tune.quic.fe.max-idle-timeout", cfg_parse_quic_time },
+	{ CFG_GLOBAL, "tune.quic.fe.priorities", cfg_parse_quic_tune_on_off },
+	{ CFG_GLOBAL, "tune.quic.fe.rx.batch", cfg_parse_quic_tune_setting },
+	{ CFG_GLOBAL, "tune.quic.fe.rx.udp-gro", cfg_parse_quic_tune_on_off },
 	{ CFG_GLOBAL, "tune.quic.fe.sec.glitches-threshold", cfg_parse_quic_tune_setting },
 	{ CFG_GLOBAL, "tune.quic.fe.sec.retry-threshold", cfg_parse_quic_tune_setting },
 	{ CFG_GLOBAL, "tune.quic.fe.sock-per-conn", cfg_parse_quic_tune_sock_per_conn },
@@ -39,11 +39,13 @@
 #include <haproxy/listener.h>
 #include <haproxy/openssl-compat.h>
 #include <haproxy/quic_ssl-t.h>
+#include <haproxy/shctx-t.h>
 #include <haproxy/ssl_sock.h>
 #include <haproxy/ssl_utils.h>
 #include <haproxy/tools.h>
 #include <haproxy/ssl_ckch.h>
 #include <haproxy/ssl_crtlist.h>
+#include <haproxy/ssl_lazy.h>
 #include <haproxy/ssl_ocsp.h>
 #include <haproxy/ssl_sock.h>
 
@@ -135,7 +137,7 @@ static int ssl_parse_global_ssl_async(char **args, int section_type, struct prox
 {
 #ifdef SSL_MODE_ASYNC
 	global_ssl.async = 1;
-	global.ssl_used_async_engines = nb_engines;
+	global.ssl_used_async_engines = nb_engines + !!(global_ssl.crypto_threads || global_ssl.loader_threads);
 	return 0;
 #else
 	memprintf(err, "'%s': openssl library does not support async mode", args[0]);
@@ -143,6 +145,45 @@ static int ssl_parse_global_ssl_async(char **args, int section_type, struct prox
 #endif
 }
 
+/* parse the "tune.ssl.crypto-threads" and "tune.ssl.cert-loader-threads"
+ * keywords in global section.
+ * Returns <0 on alert, >0 on warning, 0 on success.
+ */
+static int ssl_parse_global_worker_threads(char **args, int section_type, struct proxy *curpx,
+                                           const struct proxy *defpx, const char *file, int line,
+                                           char **err)
+{
+#if defined(SSL_MODE_ASYNC) && defined(HAVE_VANILLA_OPENSSL)
+	int val;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	val = atoi(args[1]);
+	if (*args[1] == 0 || val < 0 || val > 64) {
+		memprintf(err, "'%s' expects a numeric value between 0 and 64.", args[0]);
+		return -1;
+	}
+
+	if (strcmp(args[0], "tune.ssl.cert-loader-threads") == 0)
+		global_ssl.loader_threads = val;
+	else
+		global_ssl.crypto_threads = val;
+
+	if (val) {
+		/* the handshakes are paused using the async mode, and each
+		 * of them may use one eventfd.
+		 */
+		global_ssl.async = 1;
+		global.ssl_used_async_engines = nb_engines + 1;
+	}
+	return 0;
+#else
+	memprintf(err, "'%s': the SSL library does not support the async mode", args[0]);
+	return -1;
+#endif
+}
+
 /* parse the "ssl-engine" keyword in global section.
  * Returns <0 on alert, >0 on warning, 0 on success.
  */
@@ -422,6 +463,8 @@ static int ssl_parse_global_int(char **args, int section_type, struct proxy *cur
 		target = (int *)&global_ssl.hard_max_record;
 	else if (strcmp(args[0], "tune.ssl.ssl-ctx-cache-size") == 0)
 		target = &global_ssl.ctx_cache;
+	else if (strcmp(args[0], "tune.ssl.lazy-ctx-cache-size") == 0)
+		target = &global_ssl.lazy_ctx_cache;
 	else if (strcmp(args[0], "maxsslconn") == 0)
 		target = &global.maxsslconn;
 	else if (strcmp(args[0], "tune.ssl.capture-buffer-size") == 0)
@@ -452,6 +495,61 @@ static int ssl_parse_global_int(char **args, int section_type, struct proxy *cur
 	return 0;
 }
 
+/* parse the "tune.ssl.dynrec.*" settings controlling dynamic record sizing.
+ * Returns <0 on alert, >0 on warning, 0 on success.
+ */
+static int ssl_parse_global_dynrec(char **args, int section_type, struct proxy *curpx,
+                                   const struct proxy *defpx, const char *file, int line,
+                                   char **err)
+{
+	unsigned int *target;
+	const char *res;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (*(args[1]) == 0) {
+		memprintf(err, "'%s' expects an argument.", args[0]);
+		return -1;
+	}
+
+	if (strcmp(args[0], "tune.ssl.dynrec.idle") == 0) {
+		res = parse_time_err(args[1], &global_ssl.dynrec_idle, TIME_UNIT_MS);
+		if (res == PARSE_TIME_OVER) {
+			memprintf(err, "timer overflow in argument '%s' to '%s' (maximum value is 2147483647 ms or ~24.8 days)",
+			          args[1], args[0]);
+			return -1;
+		}
+		else if (res == PARSE_TIME_UNDER) {
+			memprintf(err, "timer underflow in argument '%s' to '%s' (minimum non-null value is 1 ms)",
+			          args[1], args[0]);
+			return -1;
+		}
+		else if (res) {
+			memprintf(err, "unexpected character '%c' in argument to '%s'.", *res, args[0]);
+			return -1;
+		}
+		return 0;
+	}
+
+	if (strcmp(args[0], "tune.ssl.dynrec.size") == 0)
+		target = &global_ssl.dynrec_size;
+	else
+		target = &global_ssl.dynrec_threshold;
+
+	res = parse_size_err(args[1], target);
+	if (res) {
+		memprintf(err, "unexpected '%s' after size passed to '%s'", res, args[0]);
+		return -1;
+	}
+
+	if (global_ssl.dynrec_size < 1 || global_ssl.dynrec_size > SSL3_RT_MAX_PLAIN_LENGTH) {
+		memprintf(err, "'%s' expects a size between 1 and %d.", args[0], SSL3_RT_MAX_PLAIN_LENGTH);
+		return -1;
+	}
+	return 0;
+}
+
 static int ssl_parse_global_capture_buffer(char **args, int section_type, struct proxy *curpx,
                                            const struct proxy *defpx, const char *file, int line,
                                            char **err)
@@ -551,6 +649,28 @@ static int ssl_parse_certificate_compression(char **args, int section_type, stru
 }
 #endif
 
+/* parse "tune.ssl.cache-policy".
+ * Returns <0 on alert, >0 on warning, 0 on success.
+ */
+static int ssl_parse_global_cache_policy(char **args, int section_type, struct proxy *curpx,
+                                         const struct proxy *defpx, const char *file, int line,
+                                         char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[1], "lru") == 0)
+		global_ssl.cache_policy = SHCTX_POLICY_LRU;
+	else if (strcmp(args[1], "tinylfu") == 0)
+		global_ssl.cache_policy = SHCTX_POLICY_TINYLFU;
+	else {
+		memprintf(err, "'%s' expects either 'lru' or 'tinylfu' but got '%s'.", args[0], args[1]);
+		return -1;
+	}
+
+	return 0;
+}
+
 /* parse "ssl.force-private-cache".
  * Returns <0 on alert, >0 on warning, 0 on success.
  */
@@ -942,6 +1062,23 @@ static int bind_parse_crt_list(char **args, int cur_arg, struct proxy *px, struc
 	return err_code;
 }
 
+/* parse the "crt-list-lazy" bind keyword. Returns a set of ERR_* flags possibly with an error in <err>. */
+static int bind_parse_crt_list_lazy(char **args, int cur_arg, struct proxy *px, struct bind_conf *conf, char **err)
+{
+	int err_code;
+
+	if (!*args[cur_arg + 1]) {
+		memprintf(err, "'%s' : missing crt-list location", args[cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	err_code = ssl_lazy_load_crt_list(args[cur_arg + 1], conf, err);
+	if (err_code)
+		memprintf(err, "'%s' : %s", args[cur_arg], *err);
+
+	return err_code;
+}
+
 /* parse the "crl-file" bind keyword */
 static int ssl_bind_parse_crl_file(char **args, int cur_arg, struct proxy *px, struct ssl_bind_conf *conf, int from_cli, char **err)
 {
@@ -2704,6 +2841,7 @@ static struct bind_kw_list bind_kws = { "SSL", { }, {
 	{ "crt",                   bind_parse_crt,                1 }, /* load SSL certificates from this location */
 	{ "crt-ignore-err",        bind_parse_ignore_err,         1 }, /* set error IDs to ignore on verify depth == 0 */
 	{ "crt-list",              bind_parse_crt_list,           1 }, /* load a list of crt from this location */
+	{ "crt-list-lazy",         bind_parse_crt_list_lazy,      1 }, /* index a list of crt loaded on demand */
 	{ "curves",                bind_parse_curves,             1 }, /* set SSL curve suite */
 	{ "default-crt",           bind_parse_crt,                1 }, /* load SSL certificates from this location */
 	{ "ecdhe",                 bind_parse_ecdhe,              1 }, /* defines named curve for elliptic curve Diffie-Hellman */
@@ -2815,12 +2953,19 @@ static struct cfg_kw_list cfg_kws = {ILH, {
 	{ CFG_GLOBAL, "ssl-security-level", ssl_parse_security_level },
 	{ CFG_GLOBAL, "ssl-skip-self-issued-ca", ssl_parse_skip_self_issued_ca },
 	{ CFG_GLOBAL, "tune.ssl.cachesize", ssl_parse_global_int },
+	{ CFG_GLOBAL, "tune.ssl.cache-policy", ssl_parse_global_cache_policy },
 	{ CFG_GLOBAL, "tune.ssl.certificate-compression", ssl_parse_certificate_compression },
+	{ CFG_GLOBAL, "tune.ssl.cert-loader-threads", ssl_parse_global_worker_threads },
+	{ CFG_GLOBAL, "tune.ssl.crypto-threads", ssl_parse_global_worker_threads },
 	{ CFG_GLOBAL, "tune.ssl.default-dh-param", ssl_parse_global_default_dh },
+	{ CFG_GLOBAL, "tune.ssl.dynrec.idle", ssl_parse_global_dynrec },
+	{ CFG_GLOBAL, "tune.ssl.dynrec.size", ssl_parse_global_dynrec },
+	{ CFG_GLOBAL, "tune.ssl.dynrec.threshold", ssl_parse_global_dynrec },
 	{ CFG_GLOBAL, "tune.ssl.force-private-cache",  ssl_parse_global_private_cache },
 	{ CFG_GLOBAL, "tune.ssl.lifetime", ssl_parse_global_lifetime },
 	{ CFG_GLOBAL, "tune.ssl.maxrecord", ssl_parse_global_int },
 	{ CFG_GLOBAL, "tune.ssl.hard-maxrecord", ssl_parse_global_int },
+	{ CFG_GLOBAL, "tune.ssl.lazy-ctx-cache-size", ssl_parse_global_int },
 	{ CFG_GLOBAL, "tune.ssl.ssl-ctx-cache-size", ssl_parse_global_int },
 	{ CFG_GLOBAL, "tune.ssl.capture-cipherlist-size", ssl_parse_global_capture_buffer },
 	{ CFG_GLOBAL, "tune.ssl.capture-buffer-size", ssl_parse_global_capture_buffer },
@@ -53,13 +53,39 @@ static struct pool_head *zlib_pool_prev __read_mostly = NULL;
 static struct pool_head *zlib_pool_head __read_mostly = NULL;
 static struct pool_head *zlib_pool_pending_buf __read_mostly = NULL;
 
-long zlib_used_memory = 0;
-
 static int global_tune_zlibmemlevel = 8;            /* zlib memlevel */
 static int global_tune_zlibwindowsize = MAX_WBITS;  /* zlib window size */
 
 #endif
 
+#if defined(USE_ZLIB) || defined(USE_ZSTD) || defined(USE_BROTLI)
+/* memory used by all compression contexts, limited by global.maxzlibmem */
+long zlib_used_memory = 0;
+#endif
+
+#if defined(USE_ZSTD)
+/* Number of idle zstd contexts kept per thread. Setting up a zstd context is
+ * expensive since its tables are sized for the compression level, so they are
+ * reset and reused by the next streams instead of being released.
+ */
+#define ZSTD_CCTX_CACHE_SIZE 2
+
+static THREAD_LOCAL ZSTD_CCtx *zstd_cctx_cache[ZSTD_CCTX_CACHE_SIZE];
+static THREAD_LOCAL int zstd_cctx_cached = 0;
+
+static size_t zstd_peak_mem = 0; /* largest memory seen for a zstd stream */
+#endif
+
+#if defined(USE_BROTLI)
+/* log2 of the brotli window size. The default one (22) would require 4 MB per
+ * stream, while 18 (256 kB) is close to what zlib uses and still compresses
+ * better.
+ */
+#define BROTLI_LGWIN 18
+
+static size_t brotli_peak_mem = 0; /* largest memory seen for a brotli stream */
+#endif
+
 unsigned int compress_min_idle = 0;
 
 static int identity_init(struct comp_ctx **comp_ctx, int level);
@@ -90,6 +116,31 @@ static int deflate_end(struct comp_ctx **comp_ctx);
 
 #endif /* USE_ZLIB */
 
+#if defined(USE_ZSTD)
+
+static int zstd_init(struct comp_ctx **comp_ctx, int level);
+static int zstd_add_data(struct comp_ctx *comp_ctx, const char *in_data, int in_len, struct buffer *out);
+static int zstd_flush(struct comp_ctx *comp_ctx, struct buffer *out);
+static int zstd_finish(struct comp_ctx *comp_ctx, struct buffer *out);
+static int zstd_end(struct comp_ctx **comp_ctx);
+
+static int dcz_init(struct comp_ctx **comp_ctx, int level, struct comp_dict *dict);
+static int dcz_add_data(struct comp_ctx *comp_ctx, const char *in_data, int in_len, struct buffer *out);
+static int dcz_flush(struct comp_ctx *comp_ctx, struct buffer *out);
+static int dcz_finish(struct comp_ctx *comp_ctx, struct buffer *out);
+
+#endif /* USE_ZSTD */
+
+#if defined(USE_BROTLI)
+
+static int brotli_init(struct comp_ctx **comp_ctx, int level);
+static int brotli_add_data(struct comp_ctx *comp_ctx, const char *in_data, int in_len, struct buffer *out);
+static int brotli_flush(struct comp_ctx *comp_ctx, struct buffer *out);
+static int brotli_finish(struct comp_ctx *comp_ctx, struct buffer *out);
+static int brotli_end(struct comp_ctx **comp_ctx);
+
+#endif /* USE_BROTLI */
+
 
 const struct comp_algo comp_algos[] =
 {
@@ -99,10 +150,28 @@ const struct comp_algo comp_algos[] =
 	{ "raw-deflate", 11, "deflate",  7, rfc1951_init,  rfc195x_add_data,  rfc195x_flush,  rfc195x_finish,  rfc195x_end },
 	{ "gzip",         4, "gzip",     4, rfc1952_init,  rfc195x_add_data,  rfc195x_flush,  rfc195x_finish,  rfc195x_end },
 #elif defined(USE_ZLIB)
-	{ "deflate",      7, "deflate",  7, deflate_init,  deflate_add_data,  deflate_flush,  deflate_finish,  deflate_end },
-	{ "raw-deflate", 11, "deflate",  7, raw_def_init,  deflate_add_data,  deflate_flush,  deflate_finish,  deflate_end },
-	{ "gzip",         4, "gzip",     4, gzip_init,     deflate_add_data,  deflate_flush,  deflate_finish,  deflate_end },
+	{ "deflate",      7, "deflate",  7, deflate_init,  deflate_add_data,  deflate_flush,  deflate_finish,  deflate_end,  COMP_ALGO_FL_THREADSAFE },
+	{ "raw-deflate", 11, "deflate",  7, raw_def_init,  deflate_add_data,  deflate_flush,  deflate_finish,  deflate_end,  COMP_ALGO_FL_THREADSAFE },
+	{ "gzip",         4, "gzip",     4, gzip_init,     deflate_add_data,  deflate_flush,  deflate_finish,  deflate_end,  COMP_ALGO_FL_THREADSAFE },
 #endif /* USE_ZLIB */
+#if defined(USE_ZSTD)
+	{ "zstd",         4, "zstd",     4, zstd_init,     zstd_add_data,     zstd_flush,     zstd_finish,     zstd_end,     COMP_ALGO_FL_THREADSAFE },
+#endif
+#if defined(USE_BROTLI)
+	{ "br",           2, "br",       2, brotli_init,   brotli_add_data,   brotli_flush,   brotli_finish,   brotli_end,   COMP_ALGO_FL_THREADSAFE },
+#endif
+	{ NULL,       0, NULL,          0, NULL ,         NULL,              NULL,           NULL,           NULL }
+};
+
+/* The dictionary-based algorithms (RFC9842), which are only used when the
+ * client announces a dictionary known to haproxy. Note that "dcb" is not
+ * supported as it requires the raw dictionaries of brotli 1.1.
+ */
+static const struct comp_algo comp_dict_algos[] =
+{
+#if defined(USE_ZSTD)
+	{ "dcz",          3, "dcz",      3, NULL,          dcz_add_data,      dcz_flush,      dcz_finish,      zstd_end,     COMP_ALGO_FL_THREADSAFE, NULL, dcz_init },
+#endif
 	{ NULL,       0, NULL,          0, NULL ,         NULL,              NULL,           NULL,           NULL }
 };
 
@@ -131,22 +200,21 @@ int comp_append_type(struct comp_type **types, const char *type)
 	return 1;
 }
 
-/*
- * Add an algorithm in the configuration
- * Returns 0 in case of success, -1 if the <algo> is unmanaged, 1 in case of
- * allocation failure.
+/* Adds the algorithm <algo> of the <table> to the <algos> list. Returns 0 in
+ * case of success, -1 if the <algo> is unmanaged, 1 in case of allocation
+ * failure.
  */
-int comp_append_algo(struct comp_algo **algos, const char *algo)
+static int comp_append_algo_from(const struct comp_algo *table, struct comp_algo **algos, const char *algo)
 {
 	struct comp_algo *comp_algo;
 	int i;
 
-	for (i = 0; comp_algos[i].cfg_name; i++) {
-		if (strcmp(algo, comp_algos[i].cfg_name) == 0) {
+	for (i = 0; table[i].cfg_name; i++) {
+		if (strcmp(algo, table[i].cfg_name) == 0) {
 			comp_algo = calloc(1, sizeof(*comp_algo));
 			if (!comp_algo)
 				return 1;
-			memmove(comp_algo, &comp_algos[i], sizeof(struct comp_algo));
+			memmove(comp_algo, &table[i], sizeof(struct comp_algo));
 			comp_algo->next = *algos;
 			*algos = comp_algo;
 			return 0;
@@ -155,7 +223,37 @@ int comp_append_algo(struct comp_algo **algos, const char *algo)
 	return -1;
 }
 
-#if defined(USE_ZLIB) || defined(USE_SLZ)
+/*
+ * Add an algorithm in the configuration
+ * Returns 0 in case of success, -1 if the <algo> is unmanaged, 1 in case of
+ * allocation failure.
+ */
+int comp_append_algo(struct comp_algo **algos, const char *algo)
+{
+	return comp_append_algo_from(comp_algos, algos, algo);
+}
+
+/* Same as comp_append_algo() for the dictionary-based algorithms */
+int comp_append_dict_algo(struct comp_algo **algos, const char *algo)
+{
+	return comp_append_algo_from(comp_dict_algos, algos, algo);
+}
+
+/* Returns the compression algorithm whose configuration name is <name>, or
+ * NULL if it is not supported.
+ */
+const struct comp_algo *comp_get_algo(const char *name)
+{
+	int i;
+
+	for (i = 0; comp_algos[i].cfg_name; i++) {
+		if (strcmp(name, comp_algos[i].cfg_name) == 0)
+			return &comp_algos[i];
+	}
+	return NULL;
+}
+
+#if defined(USE_ZLIB) || defined(USE_SLZ) || defined(USE_ZSTD) || defined(USE_BROTLI)
 DECLARE_STATIC_TYPED_POOL(pool_comp_ctx, "comp_ctx", struct comp_ctx);
 
 /*
@@ -165,7 +263,9 @@ static inline int init_comp_ctx(struct comp_ctx **comp_ctx)
 {
 #ifdef USE_ZLIB
 	z_stream *strm;
+#endif
 
+#if defined(USE_ZLIB) || defined(USE_ZSTD) || defined(USE_BROTLI)
 	if (global.maxzlibmem > 0 && (global.maxzlibmem - zlib_used_memory) < sizeof(struct comp_ctx))
 		return -1;
 #endif
@@ -173,19 +273,32 @@ static inline int init_comp_ctx(struct comp_ctx **comp_ctx)
 	*comp_ctx = pool_alloc(pool_comp_ctx);
 	if (*comp_ctx == NULL)
 		return -1;
+
+#if defined(USE_ZLIB) || defined(USE_ZSTD) || defined(USE_BROTLI)
+	_HA_ATOMIC_ADD(&zlib_used_memory, sizeof(struct comp_ctx));
+	__ha_barrier_atomic_store();
+#endif
+
 #if defined(USE_SLZ)
 	(*comp_ctx)->direct_ptr = NULL;
 	(*comp_ctx)->direct_len = 0;
 	(*comp_ctx)->queued = BUF_NULL;
 #elif defined(USE_ZLIB)
-	_HA_ATOMIC_ADD(&zlib_used_memory, sizeof(struct comp_ctx));
-	__ha_barrier_atomic_store();
-
 	strm = &(*comp_ctx)->strm;
 	strm->zalloc = alloc_zlib;
 	strm->zfree = free_zlib;
 	strm->opaque = *comp_ctx;
 #endif
+#if defined(USE_ZSTD)
+	(*comp_ctx)->zstd = NULL;
+	(*comp_ctx)->zstd_mem = 0;
+#endif
+#if defined(USE_BROTLI)
+	(*comp_ctx)->brotli = NULL;
+	(*comp_ctx)->brotli_mem = 0;
+#endif
+	(*comp_ctx)->dict = NULL;
+	(*comp_ctx)->dict_hdr = 0;
 	return 0;
 }
 
@@ -197,10 +310,17 @@ static inline int deinit_comp_ctx(struct comp_ctx **comp_ctx)
 	if (!*comp_ctx)
 		return 0;
 
+#if defined(USE_ZSTD)
+	if ((*comp_ctx)->dict) {
+		_HA_ATOMIC_SUB(&zlib_used_memory, (long)(*comp_ctx)->dict->len);
+		ha_free(&(*comp_ctx)->dict);
+	}
+#endif
+
 	pool_free(pool_comp_ctx, *comp_ctx);
 	*comp_ctx = NULL;
 
-#ifdef USE_ZLIB
+#if defined(USE_ZLIB) || defined(USE_ZSTD) || defined(USE_BROTLI)
 	_HA_ATOMIC_SUB(&zlib_used_memory, sizeof(struct comp_ctx));
 	__ha_barrier_atomic_store();
 #endif
@@ -710,6 +830,416 @@ static int zlib_parse_global_windowsize(char **args, int section_type, struct pr
 
 #endif /* USE_ZLIB */
 
+#if defined(USE_ZSTD) || defined(USE_BROTLI)
+
+/* Returns non-zero if starting a new stream expected to use <mem> bytes would
+ * exceed global.maxzlibmem. Contrary to zlib, the zstd and brotli libraries
+ * cannot deal with allocation failures in the middle of a stream, so the limit
+ * is enforced when the stream starts, based on the largest memory usage that
+ * was observed for a stream of the same algorithm.
+ */
+static inline int comp_mem_exceeded(size_t mem)
+{
+	return global.maxzlibmem > 0 && (global.maxzlibmem - zlib_used_memory) < (long)mem;
+}
+
+#endif
+
+#if defined(USE_ZSTD)
+
+/**************************
+****  zstd algorithm   ****
+***************************/
+
+/* Updates the memory accounted for the zstd context of <comp_ctx>, which
+ * allocates its tables on first use and may grow them later.
+ */
+static inline void zstd_account(struct comp_ctx *comp_ctx)
+{
+	size_t mem = ZSTD_sizeof_CCtx(comp_ctx->zstd);
+
+	if (mem != comp_ctx->zstd_mem) {
+		_HA_ATOMIC_ADD(&zlib_used_memory, (long)(mem - comp_ctx->zstd_mem));
+		comp_ctx->zstd_mem = mem;
+		HA_ATOMIC_UPDATE_MAX(&zstd_peak_mem, mem);
+	}
+}
+
+static int zstd_init(struct comp_ctx **comp_ctx, int level)
+{
+	ZSTD_CCtx *cctx;
+
+	if (init_comp_ctx(comp_ctx) < 0)
+		return -1;
+
+	/* the memory of cached contexts is still accounted for */
+	if (zstd_cctx_cached) {
+		cctx = zstd_cctx_cache[--zstd_cctx_cached];
+		(*comp_ctx)->zstd_mem = ZSTD_sizeof_CCtx(cctx);
+	}
+	else if (comp_mem_exceeded(zstd_peak_mem))
+		goto fail;
+	else if (!(cctx = ZSTD_createCCtx()))
+		goto fail;
+
+	(*comp_ctx)->zstd = cctx;
+
+	/* the level may only be set before the first byte is compressed. Note
+	 * that levels up to 9 use a window of at most 8 MB as required by
+	 * RFC9659 for the zstd content-coding.
+	 */
+	if (ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level)))
+		goto fail;
+
+	zstd_account(*comp_ctx);
+	(*comp_ctx)->cur_lvl = level;
+	return 0;
+
+ fail:
+	zstd_end(comp_ctx);
+	return -1;
+}
+
+/* Return the size of consumed data or -1 */
+static int zstd_add_data(struct comp_ctx *comp_ctx, const char *in_data, int in_len, struct buffer *out)
+{
+	ZSTD_inBuffer in = { in_data, in_len, 0 };
+	ZSTD_outBuffer zout;
+	size_t ret;
+
+	if (in_len <= 0)
+		return 0;
+
+	while (in.pos < in.size) {
+		zout.dst = b_tail(out);
+		zout.size = b_room(out);
+		zout.pos = 0;
+		if (!zout.size)
+			break;
+
+		ret = ZSTD_compressStream2(comp_ctx->zstd, &zout, &in, ZSTD_e_continue);
+		if (ZSTD_isError(ret))
+			return -1;
+		b_add(out, zout.pos);
+	}
+
+	zstd_account(comp_ctx);
+	return in.pos;
+}
+
+/* Flushes the zstd stream, or ends the frame if <mode> is ZSTD_e_end. The
+ * level cannot be adjusted here since zstd does not support changing it in
+ * the middle of a frame. Returns the number of bytes emitted or -1.
+ */
+static int zstd_flush_or_finish(struct comp_ctx *comp_ctx, struct buffer *out, ZSTD_EndDirective mode)
+{
+	ZSTD_inBuffer in = { NULL, 0, 0 };
+	ZSTD_outBuffer zout;
+	int out_len = 0;
+	size_t ret;
+
+	do {
+		zout.dst = b_tail(out);
+		zout.size = b_room(out);
+		zout.pos = 0;
+
+		ret = ZSTD_compressStream2(comp_ctx->zstd, &zout, &in, mode);
+		if (ZSTD_isError(ret))
+			return -1;
+		b_add(out, zout.pos);
+		out_len += zout.pos;
+	} while (ret && zout.pos);
+
+	/* unflushed data would be lost */
+	if (ret)
+		return -1;
+
+	zstd_account(comp_ctx);
+	return out_len;
+}
+
+static int zstd_flush(struct comp_ctx *comp_ctx, struct buffer *out)
+{
+	return zstd_flush_or_finish(comp_ctx, out, ZSTD_e_flush);
+}
+
+static int zstd_finish(struct comp_ctx *comp_ctx, struct buffer *out)
+{
+	return zstd_flush_or_finish(comp_ctx, out, ZSTD_e_end);
+}
+
+/* Releases the zstd context to the thread's cache if possible */
+static int zstd_end(struct comp_ctx **comp_ctx)
+{
+	ZSTD_CCtx *cctx;
+
+	if (!*comp_ctx)
+		return 0;
+
+	cctx = (*comp_ctx)->zstd;
+	if (cctx) {
+		zstd_account(*comp_ctx);
+		if (zstd_cctx_cached < ZSTD_CCTX_CACHE_SIZE &&
+		    (global.maxzlibmem <= 0 || zlib_used_memory < global.maxzlibmem) &&
+		    !ZSTD_isError(ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters))) {
+			zstd_cctx_cache[zstd_cctx_cached++] = cctx;
+		}
+		else {
+			ZSTD_freeCCtx(cctx);
+			_HA_ATOMIC_SUB(&zlib_used_memory, (long)(*comp_ctx)->zstd_mem);
+		}
+	}
+
+	deinit_comp_ctx(comp_ctx);
+	return 0;
+}
+
+/* Releases the zstd contexts cached by the current thread */
+static void zstd_free_cctx_cache(void)
+{
+	ZSTD_CCtx *cctx;
+
+	while (zstd_cctx_cached) {
+		cctx = zstd_cctx_cache[--zstd_cctx_cached];
+		_HA_ATOMIC_SUB(&zlib_used_memory, (long)ZSTD_sizeof_CCtx(cctx));
+		ZSTD_freeCCtx(cctx);
+	}
+}
+
+REGISTER_PER_THREAD_FREE(zstd_free_cctx_cache);
+
+/* A "dcz" stream is a zstd stream compressed with a dictionary, preceded by
+ * a skippable zstd frame holding the hash of the dictionary (RFC9842).
+ */
+static const unsigned char dcz_magic[8] = { 0x5e, 0x2a, 0x4d, 0x18, 0x20, 0x00, 0x00, 0x00 };
+
+/* Emits the header of the dcz stream of <comp_ctx> into <out> if not done
+ * yet. Returns the number of bytes emitted or -1 if <out> lacks room.
+ */
+static int dcz_put_header(struct comp_ctx *comp_ctx, struct buffer *out)
+{
+	if (!comp_ctx->dict_hdr)
+		return 0;
+
+	if (b_room(out) < sizeof(dcz_magic) + COMP_DICT_HASH_LEN)
+		return -1;
+
+	b_putblk(out, (const char *)dcz_magic, sizeof(dcz_magic));
+	b_putblk(out, (const char *)comp_ctx->dict->hash, COMP_DICT_HASH_LEN);
+	comp_ctx->dict_hdr = 0;
+	return sizeof(dcz_magic) + COMP_DICT_HASH_LEN;
+}
+
+static int dcz_init(struct comp_ctx **comp_ctx, int level, struct comp_dict *dict)
+{
+	ZSTD_CCtx *cctx;
+	size_t max;
+	int wlog;
+
+	if (!dict->len || comp_mem_exceeded(dict->len) || zstd_init(comp_ctx, level) < 0)
+		return -1;
+
+	/* The dictionary is only referenced when it is within the window. The
+	 * decoders must support windows of 8 MB or 1.25 times the dictionary
+	 * size, whichever is larger, so the window is set to cover twice the
+	 * dictionary within this limit. It is reset with the context.
+	 */
+	cctx = (*comp_ctx)->zstd;
+	max = MAX((size_t)8 << 20, dict->len + dict->len / 4);
+	wlog = MIN(my_flsl(dict->len) + 1, my_flsl(max) - 1);
+	wlog = MIN(MAX(wlog, 10), 27);
+
+	if (ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, wlog)) ||
+	    ZSTD_isError(ZSTD_CCtx_refPrefix(cctx, dict->data, dict->len))) {
+		zstd_end(comp_ctx);
+		return -1;
+	}
+
+	(*comp_ctx)->dict = dict;
+	(*comp_ctx)->dict_hdr = 1;
+	_HA_ATOMIC_ADD(&zlib_used_memory, (long)dict->len);
+	zstd_account(*comp_ctx);
+	return 0;
+}
+
+/* Return the size of consumed data or -1 */
+static int dcz_add_data(struct comp_ctx *comp_ctx, const char *in_data, int in_len, struct buffer *out)
+{
+	if (dcz_put_header(comp_ctx, out) < 0)
+		return -1;
+	return zstd_add_data(comp_ctx, in_data, in_len, out);
+}
+
+static int dcz_flush(struct comp_ctx *comp_ctx, struct buffer *out)
+{
+	int hdr, ret;
+
+	hdr = dcz_put_header(comp_ctx, out);
+	ret = (hdr < 0) ? -1 : zstd_flush(comp_ctx, out);
+	return (ret < 0) ? -1 : hdr + ret;
+}
+
+static int dcz_finish(struct comp_ctx *comp_ctx, struct buffer *out)
+{
+	int hdr, ret;
+
+	hdr = dcz_put_header(comp_ctx, out);
+	ret = (hdr < 0) ? -1 : zstd_finish(comp_ctx, out);
+	return (ret < 0) ? -1 : hdr + ret;
+}
+
+#endif /* USE_ZSTD */
+
+#if defined(USE_BROTLI)
+
+/**************************
+****  brotli algorithm ****
+***************************/
+
+/* The brotli areas are allocated with a header storing their size so that
+ * they may be accounted for on release. It is as large as the usual malloc()
+ * alignment. Note that the encoder exits the process on allocation failures,
+ * hence the memory limit is only checked in brotli_init().
+ */
+#define BROTLI_AREA_HDR 16
+
+static void *alloc_brotli(void *opaque, size_t size)
+{
+	struct comp_ctx *ctx = opaque;
+	char *area;
+
+	area = malloc(BROTLI_AREA_HDR + size);
+	if (!area)
+		return NULL;
+
+	*(size_t *)area = size;
+	ctx->brotli_mem += size;
+	HA_ATOMIC_UPDATE_MAX(&brotli_peak_mem, ctx->brotli_mem);
+	_HA_ATOMIC_ADD(&zlib_used_memory, size);
+	return area + BROTLI_AREA_HDR;
+}
+
+static void free_brotli(void *opaque, void *ptr)
+{
+	struct comp_ctx *ctx = opaque;
+	char *area = ptr;
+
+	if (!area)
+		return;
+
+	area -= BROTLI_AREA_HDR;
+	ctx->brotli_mem -= *(size_t *)area;
+	_HA_ATOMIC_SUB(&zlib_used_memory, *(size_t *)area);
+	free(area);
+}
+
+static int brotli_init(struct comp_ctx **comp_ctx, int level)
+{
+	BrotliEncoderState *state;
+
+	if (comp_mem_exceeded(brotli_peak_mem) || init_comp_ctx(comp_ctx) < 0)
+		return -1;
+
+	state = BrotliEncoderCreateInstance(alloc_brotli, free_brotli, *comp_ctx);
+	if (!state) {
+		deinit_comp_ctx(comp_ctx);
+		return -1;
+	}
+
+	(*comp_ctx)->brotli = state;
+	if (!BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, level) ||
+	    !BrotliEncoderSetParameter(state, BROTLI_PARAM_LGWIN, BROTLI_LGWIN)) {
+		brotli_end(comp_ctx);
+		return -1;
+	}
+
+	(*comp_ctx)->cur_lvl = level;
+	return 0;
+}
+
+/* Return the size of consumed data or -1 */
+static int brotli_add_data(struct comp_ctx *comp_ctx, const char *in_data, int in_len, struct buffer *out)
+{
+	const uint8_t *next_in = (const uint8_t *)in_data;
+	size_t avail_in = in_len;
+	uint8_t *next_out;
+	size_t avail_out, room;
+
+	if (in_len <= 0)
+		return 0;
+
+	while (avail_in) {
+		room = avail_out = b_room(out);
+		next_out = (uint8_t *)b_tail(out);
+		if (!room)
+			break;
+
+		if (!BrotliEncoderCompressStream(comp_ctx->brotli, BROTLI_OPERATION_PROCESS,
+		                                 &avail_in, &next_in, &avail_out, &next_out, NULL))
+			return -1;
+		b_add(out, room - avail_out);
+	}
+
+	return in_len - avail_in;
+}
+
+/* Flushes the brotli stream, or terminates it if <op> is
+ * BROTLI_OPERATION_FINISH. The quality cannot be adjusted once the stream has
+ * started. Returns the number of bytes emitted or -1.
+ */
+static int brotli_flush_or_finish(struct comp_ctx *comp_ctx, struct buffer *out, BrotliEncoderOperation op)
+{
+	BrotliEncoderState *state = comp_ctx->brotli;
+	const uint8_t *next_in = NULL;
+	size_t avail_in = 0;
+	uint8_t *next_out;
+	size_t avail_out, room;
+	int out_len = 0;
+
+	while (1) {
+		room = avail_out = b_room(out);
+		next_out = (uint8_t *)b_tail(out);
+
+		if (!BrotliEncoderCompressStream(state, op, &avail_in, &next_in, &avail_out, &next_out, NULL))
+			return -1;
+		b_add(out, room - avail_out);
+		out_len += room - avail_out;
+
+		if (op == BROTLI_OPERATION_FINISH ? BrotliEncoderIsFinished(state) : !BrotliEncoderHasMoreOutput(state))
+			break;
+
+		/* the encoder cannot be fed again before pending data are emitted */
+		if (avail_out == room)
+			return -1;
+	}
+
+	return out_len;
+}
+
+static int brotli_flush(struct comp_ctx *comp_ctx, struct buffer *out)
+{
+	return brotli_flush_or_finish(comp_ctx, out, BROTLI_OPERATION_FLUSH);
+}
+
+static int brotli_finish(struct comp_ctx *comp_ctx, struct buffer *out)
+{
+	return brotli_flush_or_finish(comp_ctx, out, BROTLI_OPERATION_FINISH);
+}
+
+static int brotli_end(struct comp_ctx **comp_ctx)
+{
+	if (!*comp_ctx)
+		return 0;
+
+	if ((*comp_ctx)->brotli)
+		BrotliEncoderDestroyInstance((*comp_ctx)->brotli);
+
+	deinit_comp_ctx(comp_ctx);
+	return 0;
+}
+
+#endif /* USE_BROTLI */
+
 
 /* config keyword parsers */
 static struct cfg_kw_list cfg_kws = {ILH, {
@@ -734,6 +1264,14 @@ static void comp_register_build_opts(void)
 	memprintf(&ptr, "Built with libslz for stateless compression.");
 #else
 	memprintf(&ptr, "Built without compression support (neither USE_ZLIB nor USE_SLZ are set).");
+#endif
+#if defined(USE_ZSTD)
+	memprintf(&ptr, "%s\nBuilt with zstd version : " ZSTD_VERSION_STRING, ptr);
+	memprintf(&ptr, "%s\nRunning on zstd version : %s", ptr, ZSTD_versionString());
+#endif
+#if defined(USE_BROTLI)
+	memprintf(&ptr, "%s\nRunning on brotli version : %u.%u.%u", ptr,
+		  BrotliEncoderVersion() >> 24, (BrotliEncoderVersion() >> 12) & 0xfff, BrotliEncoderVersion() & 0xfff);
 #endif
 	memprintf(&ptr, "%s\nCompression algorithms supported :", ptr);
 
@@ -743,6 +1281,12 @@ static void comp_register_build_opts(void)
 	if (i == 0)
 		memprintf(&ptr, "%s none", ptr);
 
+	if (comp_dict_algos[0].cfg_name) {
+		memprintf(&ptr, "%s\nCompression dictionary algorithms supported :", ptr);
+		for (i = 0; comp_dict_algos[i].cfg_name; i++)
+			memprintf(&ptr, "%s%s %s", ptr, (i == 0 ? "" : ","), comp_dict_algos[i].cfg_name);
+	}
+
 	hap_register_build_opts(ptr, 1);
 }
 
@@ -0,0 +1,742 @@
+/*
+ * FD polling functions for Linux io_uring
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ *
+ * This poller relies on one-shot IORING_OP_POLL_ADD requests to emulate the
+ * level-triggered readiness notifications the FD layer expects. Each thread
+ * owns its own ring. All polling changes collected during a loop are queued
+ * in the submission queue and are submitted by the same io_uring_enter() call
+ * which waits for events, so that registering, modifying or removing an FD
+ * does not cost a system call of its own as epoll_ctl() does. A poll request
+ * holds a reference to the file, so FDs must be explicitly removed from the
+ * rings that poll them when they're closed. This is why, contrary to other
+ * pollers, other threads may queue requests into a ring, hence the lock.
+ *
+ * The kernel must support poll updates (Linux 5.13) and extended arguments
+ * for io_uring_enter(), otherwise the poller reports itself as unusable and
+ * the next one is used. No external library is needed.
+ */
+
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <linux/io_uring.h>
+
+#include <haproxy/activity.h>
+#include <haproxy/api.h>
+#include <haproxy/clock.h>
+#include <haproxy/fd.h>
+#include <haproxy/global.h>
+#include <haproxy/signal.h>
+#include <haproxy/ticks.h>
+#include <haproxy/task.h>
+#include <haproxy/thread.h>
+#include <haproxy/tools.h>
+
+#ifndef POLLRDHUP
+/* POLLRDHUP was defined late in libc, and it appeared in kernel 2.6.17 */
+#define POLLRDHUP 0x2000
+#endif
+
+/* number of entries in the submission queue. Changes beyond this number in a
+ * single loop require an extra system call to flush the queue. The completion
+ * queue is made larger since each polled FD may report an event.
+ */
+#define URING_SQ_ENTRIES 256
+#define URING_CQ_MIN_ENTRIES 4096
+
+/* user_data used by requests whose completion must be ignored (removals and
+ * updates). Poll requests use the FD in the lower 32 bits and the lowest 31
+ * bits of its generation in the upper ones.
+ */
+#define URING_UD_CTRL   (~0ULL)
+#define URING_GEN_MASK  0x7fffffffU
+
+struct uring_ring {
+	int fd;                      /* ring's fd, -1 if not initialized */
+	uint sq_entries;             /* number of SQ entries */
+	uint sq_mask;                /* mask to apply to the SQ tail */
+	uint cq_mask;                /* mask to apply to the CQ head */
+	uint *sq_head, *sq_tail;     /* shared with the kernel */
+	uint *cq_head, *cq_tail;     /* shared with the kernel */
+	struct io_uring_sqe *sqes;   /* SQ entries */
+	struct io_uring_cqe *cqes;   /* CQ entries */
+	void *sq_ptr, *cq_ptr;       /* mapped rings */
+	size_t sq_len, cq_len;       /* mapped rings' lengths */
+	size_t sqes_len;             /* mapped SQEs length */
+	__decl_thread(HA_SPINLOCK_T lock); /* protects the SQ against other threads */
+} THREAD_ALIGNED();
+
+/* private data */
+static struct uring_ring uring_rings[MAX_THREADS];
+static THREAD_LOCAL struct io_uring_cqe *uring_events = NULL;
+static THREAD_LOCAL uint uring_nb_events = 0;
+
+static inline long uring_setup(uint entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline long uring_enter(int fd, uint to_submit, uint min_complete, uint flags, void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+/* Unmaps and closes ring <r> if it was initialized. */
+static void uring_release(struct uring_ring *r)
+{
+	if (r->sqes)
+		munmap(r->sqes, r->sqes_len);
+	if (r->cq_ptr && r->cq_ptr != r->sq_ptr)
+		munmap(r->cq_ptr, r->cq_len);
+	if (r->sq_ptr)
+		munmap(r->sq_ptr, r->sq_len);
+	if (r->fd >= 0)
+		close(r->fd);
+	r->sqes = NULL;
+	r->sq_ptr = r->cq_ptr = NULL;
+	r->fd = -1;
+}
+
+/* Creates a ring with <sq_entries> SQ entries and <cq_entries> CQ entries and
+ * maps it into <r>. Returns non-zero on success, otherwise zero with <r> left
+ * uninitialized. Rings lacking the features this poller depends on are
+ * rejected.
+ */
+static int uring_init_ring(struct uring_ring *r, uint sq_entries, uint cq_entries)
+{
+	struct io_uring_params p;
+	uint *sq_array;
+	uint i;
+
+	memset(r, 0, sizeof(*r));
+	HA_SPIN_INIT(&r->lock);
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = cq_entries;
+	r->fd = uring_setup(sq_entries, &p);
+	if (r->fd < 0)
+		goto fail;
+
+	if ((p.features & (IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG)) !=
+	    (IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG))
+		goto fail;
+
+	r->sq_len = p.sq_off.array + p.sq_entries * sizeof(uint);
+	r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->sq_len = r->cq_len = MAX(r->sq_len, r->cq_len);
+
+	r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED) {
+		r->sq_ptr = NULL;
+		goto fail;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq_ptr = r->sq_ptr;
+	else {
+		r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ptr == MAP_FAILED) {
+			r->cq_ptr = NULL;
+			goto fail;
+		}
+	}
+
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		goto fail;
+	}
+
+	r->sq_entries = p.sq_entries;
+	r->sq_mask  = *(uint *)(r->sq_ptr + p.sq_off.ring_mask);
+	r->sq_head  =  (uint *)(r->sq_ptr + p.sq_off.head);
+	r->sq_tail  =  (uint *)(r->sq_ptr + p.sq_off.tail);
+	r->cq_mask  = *(uint *)(r->cq_ptr + p.cq_off.ring_mask);
+	r->cq_head  =  (uint *)(r->cq_ptr + p.cq_off.head);
+	r->cq_tail  =  (uint *)(r->cq_ptr + p.cq_off.tail);
+	r->cqes     =  (struct io_uring_cqe *)(r->cq_ptr + p.cq_off.cqes);
+
+	/* SQEs are always consumed in order, so the indirection array is
+	 * set once for all.
+	 */
+	sq_array = (uint *)(r->sq_ptr + p.sq_off.array);
+	for (i = 0; i < p.sq_entries; i++)
+		sq_array[i] = i;
+
+	return 1;
+ fail:
+	uring_release(r);
+	return 0;
+}
+
+/* Returns the number of SQEs queued into ring <r> and not yet consumed by the
+ * kernel.
+ */
+static inline uint uring_sq_pending(const struct uring_ring *r)
+{
+	return *r->sq_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+}
+
+/* Returns the number of CQEs available in ring <r>. Only the ring's owner may
+ * call it.
+ */
+static inline uint uring_cq_ready(const struct uring_ring *r)
+{
+	return __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE) - *r->cq_head;
+}
+
+/* Queues a request into the SQ of thread <thr>'s ring. <op> is the opcode,
+ * <fd> the file descriptor, <events> the poll mask, <flags> the poll flags
+ * (e.g. IORING_POLL_UPDATE_EVENTS), <addr> the user_data of the request to
+ * act on (zero for additions) and <ud> the request's own user_data. If the SQ is full, it is first
+ * flushed, which costs an extra system call. When queuing into another
+ * thread's ring, the request is submitted immediately so that the caller may
+ * rely on it being processed once this function returns. Returns non-zero on
+ * success, otherwise zero.
+ */
+static int uring_queue(int thr, uint8_t op, int fd, uint32_t events, uint flags, uint64_t addr, uint64_t ud)
+{
+	struct uring_ring *r = &uring_rings[thr];
+	struct io_uring_sqe *sqe;
+	uint tail;
+	int ret = 1;
+
+	if (r->fd < 0)
+		return 0;
+
+	HA_SPIN_LOCK(OTHER_LOCK, &r->lock);
+
+	if (uring_sq_pending(r) >= r->sq_entries) {
+		uring_enter(r->fd, uring_sq_pending(r), 0, 0, NULL, 0);
+		if (thr == tid)
+			activity[tid].poll_saved--;
+		if (uring_sq_pending(r) >= r->sq_entries) {
+			ret = 0;
+			goto leave;
+		}
+	}
+
+	tail = *r->sq_tail;
+	sqe = &r->sqes[tail & r->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->addr = addr;
+	sqe->len = flags;
+#if __BYTE_ORDER == __BIG_ENDIAN
+	events = (events << 16) | (events >> 16);
+#endif
+	sqe->poll32_events = events;
+	sqe->user_data = ud;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	if (thr != tid)
+		uring_enter(r->fd, uring_sq_pending(r), 0, 0, NULL, 0);
+ leave:
+	HA_SPIN_UNLOCK(OTHER_LOCK, &r->lock);
+	return ret;
+}
+
+/* returns the user_data used by poll requests for FD <fd> */
+static inline uint64_t uring_fd_ud(int fd)
+{
+	return ((uint64_t)(_HA_ATOMIC_LOAD(&fdtab[fd].generation) & URING_GEN_MASK) << 32) + fd;
+}
+
+/* returns the poll mask matching the polled_mask bits of FD <fd> for the
+ * current thread.
+ */
+static inline uint32_t uring_fd_events(int fd)
+{
+	uint32_t events = 0;
+
+	if (_HA_ATOMIC_LOAD(&polled_mask[fd].poll_recv) & ti->ltid_bit)
+		events |= POLLIN | POLLRDHUP;
+	if (_HA_ATOMIC_LOAD(&polled_mask[fd].poll_send) & ti->ltid_bit)
+		events |= POLLOUT;
+	return events;
+}
+
+/* Forgets that FD <fd> is polled by the current thread and schedules an
+ * update so that it gets registered again if needed. This is used when a
+ * request could not be queued or failed to be registered.
+ */
+static void uring_fd_reset(int fd)
+{
+	_HA_ATOMIC_AND(&polled_mask[fd].poll_recv, ~ti->ltid_bit);
+	_HA_ATOMIC_AND(&polled_mask[fd].poll_send, ~ti->ltid_bit);
+	updt_fd_polling(fd);
+}
+
+/*
+ * Remove the file descriptor from all the rings which poll it upon close.
+ * Poll requests hold a reference on the file, so the file would otherwise
+ * remain open until an event wakes them up. Removal from the current thread's
+ * ring is only submitted with the next wait, which is fine since the file is
+ * then released by the kernel during the same loop.
+ */
+static void __fd_clo(int fd)
+{
+	unsigned long m = _HA_ATOMIC_LOAD(&polled_mask[fd].poll_recv) | _HA_ATOMIC_LOAD(&polled_mask[fd].poll_send);
+	int tgrp = fd_tgid(fd);
+	uint64_t ud;
+	int i;
+
+	if (!m)
+		return;
+
+	ud = uring_fd_ud(fd);
+	for (i = ha_tgroup_info[tgrp-1].base; i < ha_tgroup_info[tgrp-1].base + ha_tgroup_info[tgrp-1].count; i++)
+		if (m & ha_thread_info[i].ltid_bit)
+			uring_queue(i, IORING_OP_POLL_REMOVE, -1, 0, 0, ud, URING_UD_CTRL);
+}
+
+static void _do_fixup_tgid_takeover(struct poller *poller, const int fd, const int old_ltid, const int old_tgid)
+{
+	unsigned long m = polled_mask[fd].poll_recv | polled_mask[fd].poll_send;
+
+	/* the old thread's ring still holds a reference to the file */
+	if (m & (1UL << old_ltid))
+		uring_queue(ha_tgroup_info[old_tgid-1].base + old_ltid, IORING_OP_POLL_REMOVE,
+		            -1, 0, 0, uring_fd_ud(fd), URING_UD_CTRL);
+
+	polled_mask[fd].poll_recv = 0;
+	polled_mask[fd].poll_send = 0;
+	fdtab[fd].update_mask = 0;
+}
+
+static void _update_fd(int fd)
+{
+	int en, opcode, ret;
+	uint flags = 0;
+	ulong pr, ps;
+
+	en = fdtab[fd].state;
+	pr = _HA_ATOMIC_LOAD(&polled_mask[fd].poll_recv);
+	ps = _HA_ATOMIC_LOAD(&polled_mask[fd].poll_send);
+
+	/* if we're already polling or are going to poll for this FD and it's
+	 * neither active nor ready, force it to be active so that we don't
+	 * needlessly unsubscribe then re-subscribe it.
+	 */
+	if (!(en & (FD_EV_READY_R | FD_EV_SHUT_R | FD_EV_ERR_RW | FD_POLL_ERR)) &&
+	    ((en & FD_EV_ACTIVE_W) || ((ps | pr) & ti->ltid_bit)))
+		en |= FD_EV_ACTIVE_R;
+
+	if ((ps | pr) & ti->ltid_bit) {
+		if (!(fdtab[fd].thread_mask & ti->ltid_bit) || !(en & FD_EV_ACTIVE_RW)) {
+			/* fd removed from poll list */
+			opcode = IORING_OP_POLL_REMOVE;
+			if (pr & ti->ltid_bit)
+				_HA_ATOMIC_AND(&polled_mask[fd].poll_recv, ~ti->ltid_bit);
+			if (ps & ti->ltid_bit)
+				_HA_ATOMIC_AND(&polled_mask[fd].poll_send, ~ti->ltid_bit);
+		}
+		else {
+			if (((en & FD_EV_ACTIVE_R) != 0) == ((pr & ti->ltid_bit) != 0) &&
+			    ((en & FD_EV_ACTIVE_W) != 0) == ((ps & ti->ltid_bit) != 0))
+				return;
+			if (en & FD_EV_ACTIVE_R) {
+				if (!(pr & ti->ltid_bit))
+					_HA_ATOMIC_OR(&polled_mask[fd].poll_recv, ti->ltid_bit);
+			} else {
+				if (pr & ti->ltid_bit)
+					_HA_ATOMIC_AND(&polled_mask[fd].poll_recv, ~ti->ltid_bit);
+			}
+			if (en & FD_EV_ACTIVE_W) {
+				if (!(ps & ti->ltid_bit))
+					_HA_ATOMIC_OR(&polled_mask[fd].poll_send, ti->ltid_bit);
+			} else {
+				if (ps & ti->ltid_bit)
+					_HA_ATOMIC_AND(&polled_mask[fd].poll_send, ~ti->ltid_bit);
+			}
+			/* fd status changed. If the request already fired,
+			 * the update fails and the completion re-arms it with
+			 * the new mask.
+			 */
+			opcode = IORING_OP_POLL_REMOVE;
+			flags = IORING_POLL_UPDATE_EVENTS;
+		}
+	}
+	else if ((fdtab[fd].thread_mask & ti->ltid_bit) && (en & FD_EV_ACTIVE_RW)) {
+		/* new fd in the poll list */
+		opcode = IORING_OP_POLL_ADD;
+		if (en & FD_EV_ACTIVE_R)
+			_HA_ATOMIC_OR(&polled_mask[fd].poll_recv, ti->ltid_bit);
+		if (en & FD_EV_ACTIVE_W)
+			_HA_ATOMIC_OR(&polled_mask[fd].poll_send, ti->ltid_bit);
+	}
+	else {
+		return;
+	}
+
+	/* each of these changes would have required its own epoll_ctl() */
+	if (opcode == IORING_OP_POLL_ADD)
+		ret = uring_queue(tid, opcode, fd, uring_fd_events(fd), 0, 0, uring_fd_ud(fd));
+	else
+		ret = uring_queue(tid, opcode, -1, uring_fd_events(fd), flags, uring_fd_ud(fd), URING_UD_CTRL);
+
+	if (ret)
+		activity[tid].poll_saved++;
+	else
+		uring_fd_reset(fd);
+}
+
+/*
+ * Linux io_uring() poller
+ */
+static void _do_poll(struct poller *p, int exp, int wake)
+{
+	struct uring_ring *r = &uring_rings[tid];
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	int status;
+	int fd;
+	int count;
+	int updt_idx;
+	int wait_time;
+	int old_fd;
+
+	/* first, scan the update list to find polling changes */
+	for (updt_idx = 0; updt_idx < fd_nbupdt; updt_idx++) {
+		fd = fd_updt[updt_idx];
+
+		if (!fd_grab_tgid(fd, tgid)) {
+			/* was reassigned */
+			activity[tid].poll_drop_fd++;
+			continue;
+		}
+
+		_HA_ATOMIC_AND(&fdtab[fd].update_mask, ~ti->ltid_bit);
+
+		if (fdtab[fd].owner)
+			_update_fd(fd);
+		else
+			activity[tid].poll_drop_fd++;
+
+		fd_drop_tgid(fd);
+	}
+	fd_nbupdt = 0;
+
+	/* Scan the shared update list */
+	for (old_fd = fd = update_list[tgid - 1].first; fd != -1; fd = fdtab[fd].update.next) {
+		if (fd == -2) {
+			fd = old_fd;
+			continue;
+		}
+		else if (fd <= -3)
+			fd = -fd -4;
+		if (fd == -1)
+			break;
+
+		if (!fd_grab_tgid(fd, tgid)) {
+			/* was reassigned */
+			activity[tid].poll_drop_fd++;
+			continue;
+		}
+
+		if (!(fdtab[fd].update_mask & ti->ltid_bit)) {
+			fd_drop_tgid(fd);
+			continue;
+		}
+
+		done_update_polling(fd);
+
+		if (fdtab[fd].owner)
+			_update_fd(fd);
+		else
+			activity[tid].poll_drop_fd++;
+
+		fd_drop_tgid(fd);
+	}
+
+	thread_idle_now();
+	thread_harmless_now();
+
+	/* Now let's wait for polled events, submitting pending changes at
+	 * the same time.
+	 */
+	wait_time = wake ? 0 : compute_poll_timeout(exp);
+	clock_entering_poll();
+
+	memset(&arg, 0, sizeof(arg));
+	arg.ts = (uint64_t)(uintptr_t)&ts;
+
+	do {
+		int timeout = (global.tune.options & GTUNE_BUSY_POLLING) ? 0 : wait_time;
+		uint to_submit;
+
+		ts.tv_sec  = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000;
+
+		HA_SPIN_LOCK(OTHER_LOCK, &r->lock);
+		to_submit = uring_sq_pending(r);
+		HA_SPIN_UNLOCK(OTHER_LOCK, &r->lock);
+
+		/* a negative return (ETIME, EINTR...) is not an error here */
+		uring_enter(r->fd, to_submit, timeout ? 1 : 0,
+		            IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+
+		status = uring_cq_ready(r);
+		clock_update_local_date(wait_time, (global.tune.options & GTUNE_BUSY_POLLING) ? 1 : status);
+
+		if (status) {
+			activity[tid].poll_io++;
+			break;
+		}
+		if (timeout || !wait_time)
+			break;
+		if (tick_isset(exp) && tick_is_expired(exp, now_ms))
+			break;
+	} while (1);
+
+	clock_update_global_date();
+	fd_leaving_poll(wait_time, status);
+
+	/* process polled events. The CQ is fully drained so that no stale
+	 * completion may be confused with a request armed during the next
+	 * loop. Events are copied first so that the CQ is released before
+	 * calling the handlers.
+	 */
+	while ((status = uring_cq_ready(r)) > 0) {
+		uint head = *r->cq_head;
+
+		if (status > uring_nb_events)
+			status = uring_nb_events;
+
+		for (count = 0; count < status; count++)
+			uring_events[count] = r->cqes[(head + count) & r->cq_mask];
+		__atomic_store_n(r->cq_head, head + status, __ATOMIC_RELEASE);
+
+		for (count = 0; count < status; count++) {
+			unsigned int n, e;
+			uint64_t ud = uring_events[count].user_data;
+			int res = uring_events[count].res;
+
+			if (ud == URING_UD_CTRL)
+				continue;
+
+			/* user_data contains the fd's generation in the 31 upper
+			 * bits and the fd in the 32 lower ones.
+			 */
+			fd = (uint32_t)ud;
+			if ((ud >> 32) != (_HA_ATOMIC_LOAD(&fdtab[fd].generation) & URING_GEN_MASK)) {
+				/* stale report for an older instance of this FD */
+				continue;
+			}
+
+			/* We've been taken over by another thread from another
+			 * thread group, the request is gone anyway.
+			 */
+			if (fd_tgid(fd) != tgid)
+				continue;
+
+			if (res < 0) {
+				/* removed or failed to register, let the next
+				 * update re-arm it if still needed.
+				 */
+				if (res != -ECANCELED)
+					uring_fd_reset(fd);
+				continue;
+			}
+
+			/* the request is one-shot, re-arm it with the current
+			 * mask to preserve the level-triggered semantics.
+			 */
+			if (fdtab[fd].thread_mask & ti->ltid_bit) {
+				uint32_t events = uring_fd_events(fd);
+
+				if (events && !uring_queue(tid, IORING_OP_POLL_ADD, fd, events, 0, 0, ud))
+					uring_fd_reset(fd);
+			}
+			else {
+				_HA_ATOMIC_AND(&polled_mask[fd].poll_recv, ~ti->ltid_bit);
+				_HA_ATOMIC_AND(&polled_mask[fd].poll_send, ~ti->ltid_bit);
+			}
+
+			e = res;
+			if ((e & POLLRDHUP) && !(cur_poller.flags & HAP_POLL_F_RDHUP))
+				_HA_ATOMIC_OR(&cur_poller.flags, HAP_POLL_F_RDHUP);
+
+#ifdef DEBUG_FD
+			_HA_ATOMIC_INC(&fdtab[fd].event_count);
+#endif
+			n = ((e & POLLIN)    ? FD_EV_READY_R : 0) |
+			    ((e & POLLOUT)   ? FD_EV_READY_W : 0) |
+			    ((e & POLLRDHUP) ? FD_EV_SHUT_R  : 0) |
+			    ((e & POLLHUP)   ? FD_EV_SHUT_RW : 0) |
+			    ((e & POLLERR)   ? FD_EV_ERR_RW  : 0);
+
+			fd_update_events(fd, n);
+		}
+	}
+	/* the caller will take care of cached events */
+}
+
+static int init_uring_per_thread()
+{
+	uring_nb_events = MAX(global.tune.maxpollevents, URING_SQ_ENTRIES);
+	uring_events = calloc(uring_nb_events, sizeof(*uring_events));
+	if (uring_events == NULL)
+		goto fail_alloc;
+	vma_set_name_id(uring_events, sizeof(*uring_events) * uring_nb_events,
+	                "ev_uring", "uring_events", tid + 1);
+
+	if (MAX_THREADS > 1 && tid) {
+		if (!uring_init_ring(&uring_rings[tid], URING_SQ_ENTRIES,
+		                     MAX(URING_CQ_MIN_ENTRIES, 4 * global.tune.maxpollevents)))
+			goto fail_ring;
+	}
+
+	/* we may have to unregister some events initially registered on the
+	 * original ring when it was alone, and/or to register events on the
+	 * new ring for this thread. Let's just mark them as updated, the
+	 * poller will do the rest.
+	 */
+	fd_reregister_all(tgid, ti->ltid_bit);
+
+	return 1;
+ fail_ring:
+	ha_free(&uring_events);
+ fail_alloc:
+	return 0;
+}
+
+static void deinit_uring_per_thread()
+{
+	if (MAX_THREADS > 1 && tid)
+		uring_release(&uring_rings[tid]);
+
+	ha_free(&uring_events);
+}
+
+/*
+ * Initialization of the io_uring() poller.
+ * Returns 0 in case of failure, non-zero in case of success. If it fails, it
+ * disables the poller by setting its pref to 0.
+ */
+static int _do_init(struct poller *p)
+{
+	p->private = NULL;
+
+	if (!uring_init_ring(&uring_rings[tid], URING_SQ_ENTRIES,
+	                     MAX(URING_CQ_MIN_ENTRIES, 4 * global.tune.maxpollevents)))
+		goto fail_ring;
+
+	hap_register_per_thread_init(init_uring_per_thread);
+	hap_register_per_thread_deinit(deinit_uring_per_thread);
+
+	return 1;
+
+ fail_ring:
+	p->pref = 0;
+	return 0;
+}
+
+/*
+ * Termination of the io_uring() poller.
+ * Memory is released and the poller is marked as unselectable.
+ */
+static void _do_term(struct poller *p)
+{
+	uring_release(&uring_rings[tid]);
+
+	p->private = NULL;
+	p->pref = 0;
+}
+
+/*
+ * Check that the poller works. Besides creating a ring, this checks that
+ * poll updates are supported by submitting one for a request which doesn't
+ * exist: kernels supporting them report ENOENT while older ones report
+ * EINVAL.
+ * Returns 1 if OK, otherwise 0.
+ */
+static int _do_test(struct poller *p)
+{
+	struct uring_ring r;
+	struct io_uring_sqe *sqe;
+	int ret = 0;
+
+	if (!uring_init_ring(&r, 1, 2))
+		return 0;
+
+	sqe = &r.sqes[0];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = 1;
+	sqe->len = IORING_POLL_UPDATE_EVENTS;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = URING_UD_CTRL;
+	__atomic_store_n(r.sq_tail, 1, __ATOMIC_RELEASE);
+
+	if (uring_enter(r.fd, 1, 1, IORING_ENTER_GETEVENTS, NULL, 0) == 1 &&
+	    uring_cq_ready(&r) == 1 && r.cqes[*r.cq_head & r.cq_mask].res == -ENOENT)
+		ret = 1;
+
+	uring_release(&r);
+	return ret;
+}
+
+/*
+ * Recreate the ring after a fork(). Returns 1 if OK, otherwise 0. The ring
+ * would otherwise be shared with the parent process.
+ */
+static int _do_fork(struct poller *p)
+{
+	uring_release(&uring_rings[tid]);
+	return uring_init_ring(&uring_rings[tid], URING_SQ_ENTRIES,
+	                       MAX(URING_CQ_MIN_ENTRIES, 4 * global.tune.maxpollevents));
+}
+
+/*
+ * Registers the poller.
+ */
+static void _do_register(void)
+{
+	struct poller *p;
+	int i;
+
+	if (nbpollers >= MAX_POLLERS)
+		return;
+
+	for (i = 0; i < MAX_THREADS; i++)
+		uring_rings[i].fd = -1;
+
+	p = &pollers[nbpollers++];
+
+	p->name = "io_uring";
+	p->pref = 250; /* below epoll: only used when epoll is disabled */
+	p->flags = HAP_POLL_F_ERRHUP; // note: RDHUP might be dynamically added
+	p->private = NULL;
+
+	p->clo  = __fd_clo;
+	p->test = _do_test;
+	p->init = _do_init;
+	p->term = _do_term;
+	p->poll = _do_poll;
+	p->fork = _do_fork;
+	p->fixup_tgid_takeover = _do_fixup_tgid_takeover;
+}
+
+INITCALL0(STG_REGISTER, _do_register);
+
+
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ * End:
+ */
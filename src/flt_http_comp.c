@@ -10,7 +10,10 @@
  *
  */
 
+#include <import/ebmbtree.h>
+
 #include <haproxy/api.h>
+#include <haproxy/base64.h>
 #include <haproxy/cfgparse.h>
 #include <haproxy/compression.h>
 #include <haproxy/dynbuf.h>
@@ -20,12 +23,17 @@
 #include <haproxy/http_htx.h>
 #include <haproxy/htx.h>
 #include <haproxy/list.h>
+#include <haproxy/openssl-compat.h>
 #include <haproxy/proxy.h>
 #include <haproxy/sample.h>
+#include <haproxy/shctx.h>
 #include <haproxy/stream.h>
+#include <haproxy/task.h>
 #include <haproxy/tools.h>
+#include <haproxy/workq.h>
 
 #define COMP_STATE_PROCESSING 0x01
+#define COMP_STATE_DICT       0x02  /* compressed with the dictionary announced by the client */
 
 const char *http_comp_req_flt_id = "comp-req filter";
 const char *http_comp_res_flt_id = "comp-res filter";
@@ -36,11 +44,61 @@ struct flt_ops comp_res_ops;
 struct comp_state {
 	struct comp_ctx  *comp_ctx;   /* compression context */
 	struct comp_algo *comp_algo;  /* compression algorithm if not NULL */
+	struct comp_job  *job;        /* compression job submitted for this stream, or NULL */
+	struct stream    *strm;       /* the stream, woken up by the compression jobs */
+	struct list       wait;       /* element of the list of streams waiting for a job slot */
+	struct comp_algo *dict_algo;  /* dictionary-based algorithm accepted by the client, or NULL */
+	struct comp_dict *capture;    /* response body being captured as a dictionary, or NULL */
+	size_t            capture_room; /* allocated length of <capture>'s data */
 	unsigned int      flags;      /* COMP_STATE_* */
+	unsigned char     dict_hash[COMP_DICT_HASH_LEN]; /* dictionary announced by the client */
+};
+
+/* A chunk of data compressed by the compression threads. The input data are
+ * copied so that the HTX message may be defragmented in the mean time, and the
+ * output is only inserted into the message once the job is done, by the
+ * stream. The job releases the compression context if the stream leaves
+ * before it is processed.
+ */
+struct comp_job {
+	struct workq_job job;
+	struct comp_state *st;        /* state of the stream, NULL once abandoned */
+	struct comp_algo *algo;       /* compression algorithm */
+	struct comp_ctx *ctx;         /* compression context, owned by the job once abandoned */
+	struct buffer in;             /* data to be compressed */
+	struct buffer out;            /* compressed data */
+	int last;                     /* the stream must be finished */
+	int ret;                      /* <0 if the compression failed */
+	int done;                     /* the job was processed */
 };
 
-/* Pools used to allocate comp_state structs */
+/* Pools used to allocate comp_state and comp_job structs */
 DECLARE_STATIC_TYPED_POOL(pool_head_comp_state, "comp_state", struct comp_state);
+DECLARE_STATIC_TYPED_POOL(pool_head_comp_job, "comp_job", struct comp_job);
+
+/* compression threads, only created if "tune.comp.threads" is set */
+static struct workq *comp_wq;
+static int comp_nbthreads = 0;
+static unsigned int comp_max_jobs = 32;
+
+/* streams of the current thread waiting for a job slot */
+static THREAD_LOCAL struct list comp_waiters;
+
+/* The dictionaries offered to the clients by the servers (RFC9842), indexed
+ * by their hash in a shared context. This context is only allocated if a
+ * proxy uses "compression dictionary".
+ */
+#define COMP_DICT_BLOCKSIZE 4096
+
+struct comp_dict_hdr {
+	struct ebmb_node node;                  /* indexed by <hash> */
+	unsigned char hash[COMP_DICT_HASH_LEN];
+};
+
+static struct shared_context *comp_dict_shctx = NULL;
+static struct eb_root *comp_dict_tree;
+static unsigned int comp_dict_cache_size = 16 << 20;
+static unsigned int comp_dict_max_size = 2 << 20;
 
 static int select_compression_request_header(struct comp_state *st,
 					     struct stream *s,
@@ -56,6 +114,13 @@ static int htx_compression_buffer_init(struct htx *htx, struct buffer *out);
 static int htx_compression_buffer_add_data(struct comp_state *st, const char *data, size_t len,
 					    struct buffer *out, int dir);
 static int htx_compression_buffer_end(struct comp_state *st, struct buffer *out, int end, int dir);
+static int comp_offload(struct comp_state *st, struct ist data, int last);
+static void comp_job_free(struct comp_job *job);
+
+static struct comp_dict *comp_dict_get(const unsigned char *hash);
+static void comp_dict_store(struct comp_state *st);
+static void comp_dict_prepare_capture(struct comp_state *st, struct stream *s, struct http_msg *msg);
+static void comp_dict_capture(struct comp_state *st, const char *data, size_t len);
 
 /***********************************************************************/
 static int
@@ -76,6 +141,12 @@ comp_strm_init(struct stream *s, struct filter *filter)
 
 	st->comp_algo = NULL;
 	st->comp_ctx = NULL;
+	st->job       = NULL;
+	st->strm      = s;
+	LIST_INIT(&st->wait);
+	st->dict_algo = NULL;
+	st->capture   = NULL;
+	st->capture_room = 0;
 	st->flags     = 0;
 	filter->ctx   = st;
 
@@ -95,9 +166,23 @@ comp_strm_deinit(struct stream *s, struct filter *filter)
 	if (!st)
 		return;
 
+	LIST_DEL_INIT(&st->wait);
+
+	/* a job still being processed takes the compression context with it */
+	if (st->job) {
+		if (st->job->done)
+			comp_job_free(st->job);
+		else {
+			st->job->st = NULL;
+			st->comp_ctx = NULL;
+		}
+		st->job = NULL;
+	}
+
 	/* release any possible compression context */
-	if (st->comp_algo)
+	if (st->comp_algo && st->comp_ctx)
 		st->comp_algo->end(&st->comp_ctx);
+	ha_free(&st->capture);
 	pool_free(pool_head_comp_state, st);
 	filter->ctx = NULL;
 }
@@ -243,14 +328,19 @@ comp_res_http_headers(struct stream *s, struct filter *filter, struct http_msg *
 	if (!(msg->chn->flags & CF_ISRESP))
 		select_compression_request_header(st, s, msg);
 	else {
+		/* the Use-As-Dictionary header may have been added by the
+		 * http-response rules, so it is only checked now.
+		 */
+		comp_dict_prepare_capture(st, s, msg);
+
 		/* Response headers have already been checked in
 		 * comp_res_http_post_analyze callback. */
-		if (st->comp_algo) {
-			if (!set_compression_header(st, s, msg))
-				goto end;
-			register_data_filter(s, msg->chn, filter);
+		if (st->comp_algo && set_compression_header(st, s, msg))
 			st->flags |= COMP_STATE_PROCESSING;
-		}
+
+		/* the body may also be captured as a dictionary */
+		if ((st->flags & COMP_STATE_PROCESSING) || st->capture)
+			register_data_filter(s, msg->chn, filter);
 	}
 
   end:
@@ -285,6 +375,7 @@ comp_http_payload(struct stream *s, struct filter *filter, struct http_msg *msg,
 	struct htx *htx = htxbuf(&msg->chn->buf);
 	struct htx_ret htxret = htx_find_offset(htx, offset);
 	struct htx_blk *blk, *next;
+	struct buffer *out;
 	int ret, consumed = 0, to_forward = 0, last = 0;
 
 	blk = htxret.blk;
@@ -321,38 +412,84 @@ comp_http_payload(struct stream *s, struct filter *filter, struct http_msg *msg,
 					v.len = b_size(&trash);
 				}
 
-				ret = htx_compression_buffer_add_data(st, v.ptr, v.len, &trash, dir);
-				if (ret < 0 || htx_compression_buffer_end(st, &trash, last, dir) < 0)
-					goto error;
+				if (st->job) {
+					/* the job compressed the beginning of this block */
+					if (!st->job->done)
+						goto end;
+					if (st->job->ret < 0 || b_data(&st->job->in) > v.len)
+						goto error;
+					ret = v.len = b_data(&st->job->in);
+					last = st->job->last;
+					out = &st->job->out;
+				}
+				else if (comp_offload(st, v, last))
+					goto end;
+				else {
+					out = &trash;
+					ret = htx_compression_buffer_add_data(st, v.ptr, v.len, out, dir);
+					if (ret < 0 || htx_compression_buffer_end(st, out, last, dir) < 0)
+						goto error;
+				}
 				BUG_ON(v.len != ret);
+				if (st->capture)
+					comp_dict_capture(st, v.ptr, v.len);
 
-				if (ret == sz && !b_data(&trash))
+				if (ret == sz && !b_data(out))
 					next = htx_remove_blk(htx, blk);
 				else {
-					blk = htx_replace_blk_value(htx, blk, v, ist2(b_head(&trash), b_data(&trash)));
+					blk = htx_replace_blk_value(htx, blk, v, ist2(b_head(out), b_data(out)));
 					next = htx_get_next_blk(htx, blk);
 				}
 
 				len -= ret;
 				consumed += ret;
-				to_forward += b_data(&trash);
+				to_forward += b_data(out);
 				if (last)
 					st->flags &= ~COMP_STATE_PROCESSING;
+				if (st->job) {
+					/* more data may have been appended to the block
+					 * while the job was processed.
+					 */
+					if (ret < sz - offset) {
+						next = blk;
+						offset += b_data(out);
+					}
+					comp_job_free(st->job);
+					st->job = NULL;
+					if (next == blk)
+						continue;
+				}
 				break;
 
 			case HTX_BLK_TLR:
 			case HTX_BLK_EOT:
-				if (htx_compression_buffer_end(st, &trash, 1, dir) < 0)
-					goto error;
-				if (b_data(&trash)) {
-					struct htx_blk *last = htx_add_last_data(htx, ist2(b_head(&trash), b_data(&trash)));
+				if (st->job) {
+					if (!st->job->done)
+						goto end;
+					if (st->job->ret < 0)
+						goto error;
+					out = &st->job->out;
+				}
+				else if (comp_offload(st, IST_NULL, 1))
+					goto end;
+				else {
+					out = &trash;
+					if (htx_compression_buffer_end(st, out, 1, dir) < 0)
+						goto error;
+				}
+				if (b_data(out)) {
+					struct htx_blk *last = htx_add_last_data(htx, ist2(b_head(out), b_data(out)));
 					if (!last)
 						goto error;
 					blk = htx_get_next_blk(htx, last);
 					if (!blk)
 						goto error;
 					next = htx_get_next_blk(htx, blk);
-					to_forward += b_data(&trash);
+					to_forward += b_data(out);
+				}
+				if (st->job) {
+					comp_job_free(st->job);
+					st->job = NULL;
 				}
 				st->flags &= ~COMP_STATE_PROCESSING;
 				__fallthrough;
@@ -362,6 +499,8 @@ comp_http_payload(struct stream *s, struct filter *filter, struct http_msg *msg,
 				sz -= offset;
 				if (sz > len)
 					sz = len;
+				if (st->capture && type == HTX_BLK_DATA)
+					comp_dict_capture(st, htx_get_blk_ptr(htx, blk) + offset, sz);
 				consumed += sz;
 				to_forward += sz;
 				len -= sz;
@@ -386,7 +525,7 @@ comp_http_payload(struct stream *s, struct filter *filter, struct http_msg *msg,
 			_HA_ATOMIC_ADD(&s->be_tgcounters->comp_out[dir], to_forward);
 		}
 		update_freq_ctr(&global.comp_bps_out, to_forward);
-	} else {
+	} else if (st->comp_algo) {
 		if (s->sess->fe_tgcounters)
 			_HA_ATOMIC_ADD(&s->sess->fe_tgcounters->comp_byp[dir], consumed);
 		if (s->be_tgcounters)
@@ -424,7 +563,15 @@ comp_res_http_end(struct stream *s, struct filter *filter,
 {
 	struct comp_state *st = filter->ctx;
 
-	if (!(msg->chn->flags & CF_ISRESP) || !st || !st->comp_algo)
+	if (!(msg->chn->flags & CF_ISRESP) || !st)
+		goto end;
+
+	if (st->capture) {
+		comp_dict_store(st);
+		ha_free(&st->capture);
+	}
+
+	if (!st->comp_algo)
 		goto end;
 
 	if (strm_fe(s)->mode == PR_MODE_HTTP && s->sess->fe_tgcounters)
@@ -437,12 +584,36 @@ comp_res_http_end(struct stream *s, struct filter *filter,
 }
 
 /***********************************************************************/
+/* Adds <value> to the Vary header of <htx> but only if it is not found.
+ * Returns 0 on failure.
+ */
+static int
+add_vary_header_value(struct htx *htx, struct ist value)
+{
+	struct http_hdr_ctx ctx, last_vary;
+
+	ctx.blk = NULL;
+	last_vary.blk = NULL;
+	while (http_find_header(htx, ist("Vary"), &ctx, 0)) {
+		if (isteqi(ctx.value, value))
+			return 1;
+		last_vary = ctx;
+	}
+
+	/* No Vary header found at all. Add our header */
+	if (last_vary.blk == NULL)
+		return http_add_header(htx, ist("Vary"), value);
+
+	/* At least one Vary header found. Append the value to the last one. */
+	return http_append_header_value(htx, &last_vary, value);
+}
+
 static int
 set_compression_header(struct comp_state *st, struct stream *s, struct http_msg *msg)
 {
 	struct htx *htx = htxbuf(&msg->chn->buf);
 	struct htx_sl *sl;
-	struct http_hdr_ctx ctx, last_vary;
+	struct http_hdr_ctx ctx;
 	struct comp_algo *comp_algo;
 
 	sl = http_get_stline(htx);
@@ -483,28 +654,12 @@ set_compression_header(struct comp_state *st, struct stream *s, struct http_msg
 	}
 
 	/* Add "Vary: Accept-Encoding" header but only if it is not found. */
-	ctx.blk = NULL;
-	last_vary.blk = NULL;
-	while (http_find_header(htx, ist("Vary"), &ctx, 0)) {
-		if (isteqi(ctx.value, ist("Accept-Encoding")))
-			break;
-		last_vary = ctx;
-	}
-	/* No "Accept-Encoding" value found. */
-	if (ctx.blk == NULL) {
-		if (last_vary.blk == NULL) {
-			/* No Vary header found at all. Add our header */
-			if (!http_add_header(htx, ist("Vary"), ist("Accept-Encoding")))
-				goto error;
-		}
-		else  {
-			/* At least one Vary header found. Append the value to
-			 * the last one.
-			 */
-			if (!http_append_header_value(htx, &last_vary, ist("Accept-Encoding")))
-				goto error;
-		}
-	}
+	if (!add_vary_header_value(htx, ist("Accept-Encoding")))
+		goto error;
+
+	/* The response also depends on the dictionary announced by the client */
+	if ((st->flags & COMP_STATE_DICT) && !add_vary_header_value(htx, ist("Available-Dictionary")))
+		goto error;
 
 	/*
 	 * Add Content-Encoding header when it's not identity encoding.
@@ -528,6 +683,106 @@ set_compression_header(struct comp_state *st, struct stream *s, struct http_msg
 	return 0;
 }
 
+/*
+ * Returns the algorithm of the <algos> list preferred by the client according
+ * to the Accept-Encoding headers of <htx>, or NULL if none is accepted. "*"
+ * only matches the algorithms when <wildcard> is set.
+ */
+static struct comp_algo *
+select_accepted_algo(struct htx *htx, struct comp_algo *algos, int wildcard)
+{
+	struct http_hdr_ctx ctx;
+	struct comp_algo *comp_algo, *best = NULL;
+	int best_q = 0;
+
+	ctx.blk = NULL;
+	while (http_find_header(htx, ist("Accept-Encoding"), &ctx, 0)) {
+		const char *qval;
+		int q;
+		int toklen;
+
+		/* try to isolate the token from the optional q-value */
+		toklen = 0;
+		while (toklen < ctx.value.len && HTTP_IS_TOKEN(*(ctx.value.ptr + toklen)))
+			toklen++;
+
+		qval = ctx.value.ptr + toklen;
+		while (1) {
+			while (qval < istend(ctx.value) && HTTP_IS_LWS(*qval))
+				qval++;
+
+			if (qval >= istend(ctx.value) || *qval != ';') {
+				qval = NULL;
+				break;
+			}
+			qval++;
+
+			while (qval < istend(ctx.value) && HTTP_IS_LWS(*qval))
+				qval++;
+
+			if (qval >= istend(ctx.value)) {
+				qval = NULL;
+				break;
+			}
+			if (strncmp(qval, "q=", MIN(istend(ctx.value) - qval, 2)) == 0)
+				break;
+
+			while (qval < istend(ctx.value) && *qval != ';')
+				qval++;
+		}
+
+		/* here we have qval pointing to the first "q=" attribute or NULL if not found */
+		q = qval ? http_parse_qvalue(qval + 2, NULL) : 1000;
+
+		if (q <= best_q)
+			continue;
+
+		for (comp_algo = algos; comp_algo; comp_algo = comp_algo->next) {
+			if ((wildcard && *(ctx.value.ptr) == '*') ||
+			    word_match(ctx.value.ptr, toklen, comp_algo->ua_name, comp_algo->ua_name_len)) {
+				best = comp_algo;
+				best_q = q;
+				break;
+			}
+		}
+	}
+	return best;
+}
+
+/*
+ * Checks whether the client announces a dictionary with the
+ * Available-Dictionary header and accepts one of the dictionary-based
+ * algorithms (RFC9842). If so, this algorithm and the hash of the dictionary
+ * are saved in <st>, the dictionary being looked up with the response.
+ */
+static void
+select_dict_request_header(struct comp_state *st, struct stream *s, struct htx *htx)
+{
+	struct comp_algo *algos = NULL;
+	struct http_hdr_ctx ctx;
+	struct ist v;
+
+	st->dict_algo = NULL;
+	if (!comp_dict_shctx)
+		return;
+
+	if (!((s->be->comp && (algos = s->be->comp->algos_dict)) ||
+	      (strm_fe(s)->comp && (algos = strm_fe(s)->comp->algos_dict))))
+		return;
+
+	/* the hash is a structured field byte sequence: ":<base64>:" */
+	ctx.blk = NULL;
+	if (!http_find_header(htx, ist("Available-Dictionary"), &ctx, 1))
+		return;
+
+	v = ctx.value;
+	if (v.len < 2 || v.ptr[0] != ':' || v.ptr[v.len - 1] != ':' ||
+	    base64dec(v.ptr + 1, v.len - 2, (char *)st->dict_hash, sizeof(st->dict_hash)) != COMP_DICT_HASH_LEN)
+		return;
+
+	st->dict_algo = select_accepted_algo(htx, algos, 0);
+}
+
 /*
  * Selects a compression algorithm depending on the client request.
  */
@@ -558,74 +813,27 @@ select_compression_request_header(struct comp_state *st, struct stream *s, struc
 
 	/* search for the algo in the backend in priority or the frontend */
 	if ((s->be->comp && (comp_algo_back = s->be->comp->algos_res)) ||
-	    (strm_fe(s)->comp && (comp_algo_back = strm_fe(s)->comp->algos_res))) {
-		int best_q = 0;
-
-		ctx.blk = NULL;
-		while (http_find_header(htx, ist("Accept-Encoding"), &ctx, 0)) {
-			const char *qval;
-			int q;
-			int toklen;
-
-			/* try to isolate the token from the optional q-value */
-			toklen = 0;
-			while (toklen < ctx.value.len && HTTP_IS_TOKEN(*(ctx.value.ptr + toklen)))
-				toklen++;
-
-			qval = ctx.value.ptr + toklen;
-			while (1) {
-				while (qval < istend(ctx.value) && HTTP_IS_LWS(*qval))
-					qval++;
-
-				if (qval >= istend(ctx.value) || *qval != ';') {
-					qval = NULL;
-					break;
-				}
-				qval++;
+	    (strm_fe(s)->comp && (comp_algo_back = strm_fe(s)->comp->algos_res)))
+		st->comp_algo = select_accepted_algo(htx, comp_algo_back, 1);
 
-				while (qval < istend(ctx.value) && HTTP_IS_LWS(*qval))
-					qval++;
+	select_dict_request_header(st, s, htx);
 
-				if (qval >= istend(ctx.value)) {
-					qval = NULL;
-					break;
-				}
-				if (strncmp(qval, "q=", MIN(istend(ctx.value) - qval, 2)) == 0)
-					break;
-
-				while (qval < istend(ctx.value) && *qval != ';')
-					qval++;
-			}
-
-			/* here we have qval pointing to the first "q=" attribute or NULL if not found */
-			q = qval ? http_parse_qvalue(qval + 2, NULL) : 1000;
-
-			if (q <= best_q)
-				continue;
-
-			for (comp_algo = comp_algo_back; comp_algo; comp_algo = comp_algo->next) {
-				if (*(ctx.value.ptr) == '*' ||
-				    word_match(ctx.value.ptr, toklen, comp_algo->ua_name, comp_algo->ua_name_len)) {
-					st->comp_algo = comp_algo;
-					best_q = q;
-					break;
-				}
-			}
-		}
-	}
-
-	/* remove all occurrences of the header when "compression offload" is set */
-	if (st->comp_algo) {
+	/* remove all occurrences of the headers when "compression offload" is set */
+	if (st->comp_algo || st->dict_algo) {
 		if ((s->be->comp && (s->be->comp->flags & COMP_FL_OFFLOAD)) ||
 		    (strm_fe(s)->comp && (strm_fe(s)->comp->flags & COMP_FL_OFFLOAD))) {
-			http_remove_header(htx, &ctx);
 			ctx.blk = NULL;
 			while (http_find_header(htx, ist("Accept-Encoding"), &ctx, 1))
 				http_remove_header(htx, &ctx);
+			ctx.blk = NULL;
+			while (http_find_header(htx, ist("Available-Dictionary"), &ctx, 1))
+				http_remove_header(htx, &ctx);
 		}
-		return 1;
 	}
 
+	if (st->comp_algo)
+		return 1;
+
 	/* identity is implicit does not require headers */
 	if ((s->be->comp && (comp_algo_back = s->be->comp->algos_res)) ||
 	    (strm_fe(s)->comp && (comp_algo_back = strm_fe(s)->comp->algos_res))) {
@@ -651,10 +859,11 @@ select_compression_response_header(struct comp_state *st, struct stream *s, stru
 	struct http_txn *txn = s->txn;
 	struct http_hdr_ctx ctx;
 	struct comp_type *comp_type;
+	struct comp_dict *dict;
 	unsigned int comp_minsize = 0;
 
 	/* no common compression algorithm was found in request header */
-	if (st->comp_algo == NULL)
+	if (st->comp_algo == NULL && st->dict_algo == NULL)
 		goto fail;
 
 	/* compression already in progress */
@@ -751,6 +960,20 @@ select_compression_response_header(struct comp_state *st, struct stream *s, stru
 	if (th_ctx->idle_pct < compress_min_idle)
 		goto fail;
 
+	/* prefer the dictionary announced by the client if it is known */
+	if (st->dict_algo && (dict = comp_dict_get(st->dict_hash))) {
+		if (st->dict_algo->init_dict(&st->comp_ctx, global.tune.comp_maxlevel, dict) == 0) {
+			st->comp_algo = st->dict_algo;
+			st->flags |= COMP_STATE_DICT;
+			msg->flags |= HTTP_MSGF_COMPRESSING;
+			return 1;
+		}
+		free(dict);
+	}
+
+	if (st->comp_algo == NULL)
+		goto fail;
+
 	/* initialize compression */
 	if (st->comp_algo->init(&st->comp_ctx, global.tune.comp_maxlevel) < 0)
 		goto fail;
@@ -794,6 +1017,346 @@ htx_compression_buffer_end(struct comp_state *st, struct buffer *out, int end, i
 		return st->comp_algo->flush(st->comp_ctx, out);
 }
 
+/***********************************************************************/
+
+/* Compresses the data of a job then flushes or finishes the stream. Called
+ * from a compression thread.
+ */
+static void comp_job_process(struct workq_job *wjob)
+{
+	struct comp_job *job = container_of(wjob, struct comp_job, job);
+	int ret = 0;
+
+	if (b_data(&job->in)) {
+		ret = job->algo->add_data(job->ctx, b_head(&job->in), b_data(&job->in), &job->out);
+		if (ret != b_data(&job->in))
+			ret = -1;
+	}
+	if (ret >= 0)
+		ret = job->last ? job->algo->finish(job->ctx, &job->out) : job->algo->flush(job->ctx, &job->out);
+	job->ret = ret;
+}
+
+/* Releases job <job> and its buffers. */
+static void comp_job_free(struct comp_job *job)
+{
+	workq_job_deinit(&job->job);
+	b_free(&job->in);
+	b_free(&job->out);
+	offer_buffers(NULL, 2);
+	pool_free(pool_head_comp_job, job);
+}
+
+/* Called on the thread of the stream once its job is processed, to wake the
+ * stream up, or to release the job and the compression context it took if the
+ * stream left. A stream waiting for a job slot is woken up as well. Returns 0
+ * if the job was released.
+ */
+static int comp_job_done(struct workq_job *wjob)
+{
+	struct comp_job *job = container_of(wjob, struct comp_job, job);
+	struct comp_state *st;
+
+	job->done = 1;
+	_HA_ATOMIC_DEC(&th_ctx->comp_jobs);
+
+	if (!LIST_ISEMPTY(&comp_waiters)) {
+		st = LIST_NEXT(&comp_waiters, struct comp_state *, wait);
+		LIST_DEL_INIT(&st->wait);
+		task_wakeup(st->strm->task, TASK_WOKEN_MSG);
+	}
+
+	if (!job->st) {
+		job->algo->end(&job->ctx);
+		comp_job_free(job);
+		return 0;
+	}
+	task_wakeup(job->st->strm->task, TASK_WOKEN_MSG);
+	return 1;
+}
+
+/* Tries to submit a job compressing <data> to the compression threads, which
+ * will also finish the stream if <last> is set. If the current thread already
+ * has too many jobs in flight, the stream is queued to be woken up once one of
+ * them is done. Returns 1 if the stream must wait for its job or for a job
+ * slot, or 0 if the data must be compressed synchronously, which is the case
+ * when offloading is disabled, not supported by the algorithm, or when memory
+ * is lacking.
+ */
+static int comp_offload(struct comp_state *st, struct ist data, int last)
+{
+	struct comp_job *job;
+
+	if (!comp_wq || !(st->comp_algo->flags & COMP_ALGO_FL_THREADSAFE))
+		return 0;
+
+	if (th_ctx->comp_jobs >= comp_max_jobs) {
+		if (!LIST_INLIST(&st->wait)) {
+			LIST_APPEND(&comp_waiters, &st->wait);
+			activity[tid].comp_wait++;
+		}
+		return 1;
+	}
+
+	job = pool_alloc(pool_head_comp_job);
+	if (!job)
+		return 0;
+
+	job->in = job->out = BUF_NULL;
+	if (!workq_job_init(&job->job, comp_job_process, comp_job_done) ||
+	    !b_alloc(&job->in, DB_UNLIKELY) || !b_alloc(&job->out, DB_UNLIKELY)) {
+		comp_job_free(job);
+		return 0;
+	}
+
+	if (istlen(data))
+		b_putblk(&job->in, istptr(data), istlen(data));
+	job->st = st;
+	job->algo = st->comp_algo;
+	job->ctx = st->comp_ctx;
+	job->last = last;
+	job->ret = 0;
+	job->done = 0;
+	st->job = job;
+
+	LIST_DEL_INIT(&st->wait);
+	_HA_ATOMIC_INC(&th_ctx->comp_jobs);
+	activity[tid].comp_offload++;
+	workq_submit(comp_wq, &job->job);
+	return 1;
+}
+
+/* Creates the compression threads if "tune.comp.threads" is set */
+static int comp_create_wq(void)
+{
+	char *err = NULL;
+
+	if (!comp_nbthreads)
+		return ERR_NONE;
+
+	comp_wq = workq_new("compression", comp_nbthreads, &err);
+	if (!comp_wq) {
+		ha_alert("%s.\n", err);
+		free(err);
+		return ERR_ALERT | ERR_FATAL;
+	}
+	return ERR_NONE;
+}
+
+REGISTER_POST_CHECK(comp_create_wq);
+
+static int comp_init_waiters(void)
+{
+	LIST_INIT(&comp_waiters);
+	return 1;
+}
+
+REGISTER_PER_THREAD_INIT(comp_init_waiters);
+
+/***********************************************************************/
+/* Removes the row <first> evicted from the shared context from the index of
+ * the dictionaries. Called with the lock held.
+ */
+static void comp_dict_free_blocks(struct shared_block *first, void *data)
+{
+	struct comp_dict_hdr *hdr = (struct comp_dict_hdr *)first->data;
+
+	ebmb_delete(&hdr->node);
+}
+
+/* Returns a copy of the dictionary whose hash is <hash>, to be released with
+ * free(), or NULL if it is unknown or on memory allocation failure.
+ */
+static struct comp_dict *comp_dict_get(const unsigned char *hash)
+{
+	struct shared_block *first;
+	struct comp_dict_hdr *hdr;
+	struct ebmb_node *node;
+	struct comp_dict *dict;
+	size_t len;
+
+	shctx_wrlock(comp_dict_shctx);
+	node = ebmb_lookup(comp_dict_tree, hash, COMP_DICT_HASH_LEN);
+	if (!node) {
+		shctx_wrunlock(comp_dict_shctx);
+		return NULL;
+	}
+
+	/* the row must not be evicted while it is copied */
+	hdr = ebmb_entry(node, struct comp_dict_hdr, node);
+	first = container_of((void *)hdr, struct shared_block, data);
+	shctx_row_detach(comp_dict_shctx, first);
+	shctx_wrunlock(comp_dict_shctx);
+
+	len = first->len - sizeof(*hdr);
+	dict = malloc(sizeof(*dict) + len);
+	if (dict) {
+		dict->len = len;
+		memcpy(dict->hash, hash, COMP_DICT_HASH_LEN);
+		shctx_row_data_get(comp_dict_shctx, first, (unsigned char *)dict->data, sizeof(*hdr), len);
+	}
+
+	shctx_wrlock(comp_dict_shctx);
+	shctx_row_reattach(comp_dict_shctx, first);
+	shctx_wrunlock(comp_dict_shctx);
+	return dict;
+}
+
+/* Stores the response body captured by <st> as a dictionary, indexed by its
+ * SHA-256, unless the same one is already known.
+ */
+static void comp_dict_store(struct comp_state *st)
+{
+	struct comp_dict *dict = st->capture;
+	struct shared_block *first;
+	struct comp_dict_hdr *hdr;
+
+	if (!dict->len)
+		return;
+
+#ifdef USE_OPENSSL
+	if (!EVP_Digest(dict->data, dict->len, dict->hash, NULL, EVP_sha256(), NULL))
+		return;
+#else
+	return;
+#endif
+
+	shctx_wrlock(comp_dict_shctx);
+	if (ebmb_lookup(comp_dict_tree, dict->hash, COMP_DICT_HASH_LEN)) {
+		shctx_wrunlock(comp_dict_shctx);
+		return;
+	}
+	shctx_wrunlock(comp_dict_shctx);
+
+	first = shctx_row_reserve_hot(comp_dict_shctx, NULL, sizeof(*hdr) + dict->len);
+	if (!first)
+		return;
+
+	/* the row is hot, so it may be filled without the lock */
+	hdr = (struct comp_dict_hdr *)first->data;
+	memcpy(hdr->hash, dict->hash, COMP_DICT_HASH_LEN);
+	first->len = sizeof(*hdr);
+	shctx_row_data_append(comp_dict_shctx, first, (unsigned char *)dict->data, dict->len);
+
+	shctx_wrlock(comp_dict_shctx);
+	if (ebmb_insert(comp_dict_tree, &hdr->node, COMP_DICT_HASH_LEN) != &hdr->node) {
+		/* stored by another stream in the mean time, the row is
+		 * released without calling the free_block callback.
+		 */
+		first->len = 0;
+	}
+	shctx_row_reattach(comp_dict_shctx, first);
+	shctx_wrunlock(comp_dict_shctx);
+}
+
+/* Starts capturing the response body to store it as a dictionary if the
+ * server offers it with the Use-As-Dictionary header. Only the uncompressed
+ * bodies of 200 responses to GET requests are captured, up to
+ * "tune.comp.dict-max-size" bytes.
+ */
+static void comp_dict_prepare_capture(struct comp_state *st, struct stream *s, struct http_msg *msg)
+{
+	struct htx *htx = htxbuf(&msg->chn->buf);
+	struct http_hdr_ctx ctx;
+	size_t room;
+
+	if (!comp_dict_shctx)
+		return;
+
+	if (!(s->be->comp && (s->be->comp->flags & COMP_FL_DICT)) &&
+	    !(strm_fe(s)->comp && (strm_fe(s)->comp->flags & COMP_FL_DICT)))
+		return;
+
+	if (s->txn->status != 200 || s->txn->meth != HTTP_METH_GET)
+		return;
+
+	if (!(msg->flags & HTTP_MSGF_XFER_LEN) || msg->flags & HTTP_MSGF_BODYLESS)
+		return;
+
+	ctx.blk = NULL;
+	if (!http_find_header(htx, ist("Use-As-Dictionary"), &ctx, 0))
+		return;
+
+	/* the dictionary is the decoded body */
+	ctx.blk = NULL;
+	if (http_find_header(htx, ist("Content-Encoding"), &ctx, 1))
+		return;
+
+	room = MIN(comp_dict_max_size, 65536);
+	if (msg->flags & HTTP_MSGF_CNT_LEN) {
+		unsigned long long kip = chn_prod(msg->chn)->sedesc->kip;
+
+		if (!kip || kip > comp_dict_max_size)
+			return;
+		room = kip;
+	}
+
+	st->capture = malloc(sizeof(*st->capture) + room);
+	if (!st->capture)
+		return;
+	st->capture->len = 0;
+	st->capture_room = room;
+}
+
+/* Appends <len> bytes from <data> to the body captured by <st>. The capture
+ * is abandoned if the body exceeds "tune.comp.dict-max-size".
+ */
+static void comp_dict_capture(struct comp_state *st, const char *data, size_t len)
+{
+	struct comp_dict *dict = st->capture;
+	size_t room = st->capture_room;
+
+	if (dict->len + len > room) {
+		if (dict->len + len > comp_dict_max_size)
+			goto abort;
+
+		while (room < dict->len + len)
+			room *= 2;
+		room = MIN(room, comp_dict_max_size);
+
+		dict = realloc(dict, sizeof(*dict) + room);
+		if (!dict)
+			goto abort;
+		st->capture = dict;
+		st->capture_room = room;
+	}
+
+	memcpy(dict->data + dict->len, data, len);
+	dict->len += len;
+	return;
+
+  abort:
+	ha_free(&st->capture);
+}
+
+/* Allocates the shared context of the dictionaries if a proxy uses them */
+static int comp_dict_init(void)
+{
+	struct proxy *px;
+
+	for (px = proxies_list; px; px = px->next) {
+		if (px->comp && (px->comp->flags & COMP_FL_DICT))
+			break;
+	}
+
+	if (!px)
+		return ERR_NONE;
+
+	if (shctx_init(&comp_dict_shctx, comp_dict_cache_size / COMP_DICT_BLOCKSIZE, COMP_DICT_BLOCKSIZE,
+	               sizeof(struct comp_dict_hdr) + comp_dict_max_size, sizeof(*comp_dict_tree),
+	               "comp dict") <= 0) {
+		ha_alert("Unable to allocate the cache of the compression dictionaries.\n");
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	comp_dict_shctx->free_block = comp_dict_free_blocks;
+	comp_dict_tree = (void *)comp_dict_shctx + sizeof(struct shared_context);
+	*comp_dict_tree = EB_ROOT_UNIQUE;
+	return ERR_NONE;
+}
+
+REGISTER_POST_CHECK(comp_dict_init);
+
 
 /***********************************************************************/
 
@@ -917,6 +1480,36 @@ parse_compression_options(char **args, int section, struct proxy *proxy,
 			goto end;
 		}
 	}
+	else if (strcmp(args[1], "dictionary") == 0) {
+		int cur_arg = 2;
+
+		if (!*args[cur_arg]) {
+			memprintf(err, "'%s %s' expects <algorithm>.", args[0], args[1]);
+			ret = -1;
+			goto end;
+		}
+#ifndef USE_OPENSSL
+		memprintf(err, "'%s %s' requires OpenSSL support to compute the hash of the dictionaries.",
+			  args[0], args[1]);
+		ret = -1;
+		goto end;
+#endif
+		while (*(args[cur_arg])) {
+			int retval = comp_append_dict_algo(&comp->algos_dict, args[cur_arg]);
+			if (retval) {
+				if (retval < 0)
+					memprintf(err, "'%s %s' : '%s' is not a supported dictionary algorithm.",
+						  args[0], args[1], args[cur_arg]);
+				else
+					memprintf(err, "'%s %s' : out of memory while parsing algo '%s'.",
+						  args[0], args[1], args[cur_arg]);
+				ret = -1;
+				goto end;
+			}
+			cur_arg++;
+		}
+		comp->flags |= COMP_FL_DICT;
+	}
 	else if (strcmp(args[1], "offload") == 0) {
 		if (proxy->cap & PR_CAP_DEF) {
 			memprintf(err, "'%s' : '%s' ignored in 'defaults' section.",
@@ -1008,7 +1601,7 @@ parse_compression_options(char **args, int section, struct proxy *proxy,
 		}
 	}
 	else {
-		memprintf(err, "'%s' expects 'algo', 'type', 'direction', 'offload', 'minsize-req' or 'minsize-res'.",
+		memprintf(err, "'%s' expects 'algo', 'type', 'direction', 'dictionary', 'offload', 'minsize-req' or 'minsize-res'.",
 			  args[0]);
 		ret = -1;
 		goto end;
@@ -1230,8 +1823,79 @@ smp_fetch_res_comp_algo(const struct arg *args, struct sample *smp,
 	return 0;
 }
 
+/* config parser for global "tune.comp.threads" and "tune.comp.max-jobs" */
+static int comp_parse_global_threads(char **args, int section_type, struct proxy *curpx,
+                                     const struct proxy *defpx, const char *file, int line,
+                                     char **err)
+{
+	int val;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	val = atoi(args[1]);
+	if (strcmp(args[0], "tune.comp.threads") == 0) {
+		if (*args[1] == 0 || val < 0 || val > 64) {
+			memprintf(err, "'%s' expects a numeric value between 0 and 64.", args[0]);
+			return -1;
+		}
+		comp_nbthreads = val;
+	}
+	else {
+		if (*args[1] == 0 || val < 1) {
+			memprintf(err, "'%s' expects a strictly positive numeric value.", args[0]);
+			return -1;
+		}
+		comp_max_jobs = val;
+	}
+	return 0;
+}
+
+/* config parser for global "tune.comp.dict-cache-size" and "tune.comp.dict-max-size" */
+static int comp_parse_global_dict_size(char **args, int section_type, struct proxy *curpx,
+                                       const struct proxy *defpx, const char *file, int line,
+                                       char **err)
+{
+	unsigned int val;
+	const char *res;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (*args[1] == 0) {
+		memprintf(err, "'%s' expects a size argument.", args[0]);
+		return -1;
+	}
+
+	res = parse_size_err(args[1], &val);
+	if (res != NULL) {
+		memprintf(err, "unexpected '%s' after size passed to '%s'", res, args[0]);
+		return -1;
+	}
+
+	if (strcmp(args[0], "tune.comp.dict-cache-size") == 0) {
+		if (val < COMP_DICT_BLOCKSIZE) {
+			memprintf(err, "'%s' expects a size of at least %d bytes.", args[0], COMP_DICT_BLOCKSIZE);
+			return -1;
+		}
+		comp_dict_cache_size = val;
+	}
+	else {
+		if (!val) {
+			memprintf(err, "'%s' expects a strictly positive size.", args[0]);
+			return -1;
+		}
+		comp_dict_max_size = val;
+	}
+	return 0;
+}
+
 /* Declare the config parser for "compression" keyword */
 static struct cfg_kw_list cfg_kws = {ILH, {
+		{ CFG_GLOBAL, "tune.comp.dict-cache-size", comp_parse_global_dict_size },
+		{ CFG_GLOBAL, "tune.comp.dict-max-size", comp_parse_global_dict_size },
+		{ CFG_GLOBAL, "tune.comp.max-jobs", comp_parse_global_threads },
+		{ CFG_GLOBAL, "tune.comp.threads", comp_parse_global_threads },
 		{ CFG_LISTEN, "compression", parse_compression_options },
 		{ 0, NULL, NULL },
 	}
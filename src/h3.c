@@ -20,9 +20,11 @@
 
 #include <haproxy/api.h>
 #include <haproxy/buf.h>
+#include <haproxy/cfgparse.h>
 #include <haproxy/chunk.h>
 #include <haproxy/connection.h>
 #include <haproxy/dynbuf.h>
+#include <haproxy/errors.h>
 #include <haproxy/h3.h>
 #include <haproxy/h3_stats.h>
 #include <haproxy/http.h>
@@ -36,6 +38,8 @@
 #include <haproxy/qmux_http.h>
 #include <haproxy/qpack-dec.h>
 #include <haproxy/qpack-enc.h>
+#include <haproxy/qpack-t.h>
+#include <haproxy/qpack-tbl.h>
 #include <haproxy/quic_conn.h>
 #include <haproxy/quic_enc.h>
 #include <haproxy/quic_fctl.h>
@@ -125,13 +129,21 @@ INITCALL1(STG_REGISTER, trace_register_source, TRACE_SOURCE);
 #define H3_CF_GOAWAY_SENT       0x00000020  /* GOAWAY sent on local control stream */
 
 /* Default settings */
-static uint64_t h3_settings_qpack_max_table_capacity = 0;
-static uint64_t h3_settings_qpack_blocked_streams = 4096;
+static uint64_t h3_settings_qpack_max_table_capacity = 4096;
+static uint64_t h3_settings_qpack_blocked_streams = 100;
 static uint64_t h3_settings_max_field_section_size = QUIC_VARINT_8_BYTE_MAX; /* Unlimited */
 
+/* Capacity of the QPACK encoder dynamic table, limited by the peer settings */
+static unsigned int h3_qpack_encoder_table_capacity = 4096;
+
+/* Minimum room left in the QPACK encoder stream buffer to perform insertions */
+#define H3_QPACK_INS_ROOM 512
+
 struct h3c {
 	struct qcc *qcc;
 	struct qcs *ctrl_strm; /* Control stream */
+	struct qcs *qpack_enc_strm; /* QPACK encoder stream */
+	struct qcs *qpack_dec_strm; /* QPACK decoder stream */
 	int err;
 	uint32_t flags;
 
@@ -142,6 +154,12 @@ struct h3c {
 
 	uint64_t id_goaway; /* stream ID used for a GOAWAY frame */
 
+	/* QPACK */
+	struct qpack_enc qpack_enc;    /* encoder context for emitted field sections */
+	struct qpack_dec qpack_dec;    /* decoder context for received field sections */
+	struct list qpack_blocked;     /* streams blocked on QPACK decoder, by arrival order */
+	unsigned int qpack_nb_blocked; /* number of elements in <qpack_blocked> */
+
 	struct buffer_wait buf_wait; /* wait list for buffer allocations */
 	/* Stats counters */
 	struct h3_counters *prx_counters;
@@ -154,9 +172,12 @@ DECLARE_STATIC_TYPED_POOL(pool_head_h3c, "h3c", struct h3c);
 #define H3_SF_HAVE_CLEN    0x00000004  /* content-length header is present; relevant either for request or response depending on the side of the connection */
 #define H3_SF_SENT_INTERIM 0x00000008  /* last response sent is 1xx interim. Used on FE side only. */
 #define H3_SF_RECV_INTERIM 0x00000010  /* last response sent is 1xx interim. Used on BE side only. */
+#define H3_SF_QPACK_BLOCKED 0x00000020 /* field section waiting for QPACK encoder instructions */
+#define H3_SF_QPACK_CANCEL 0x00000040  /* QPACK Stream Cancellation already emitted */
 
 struct h3s {
 	struct h3c *h3c;
+	struct qcs *qcs;
 
 	enum h3s_t type;
 	enum h3s_st_req st_req; /* only used for request streams */
@@ -166,12 +187,187 @@ struct h3s {
 	unsigned long long body_len; /* known request body length from content-length header if present */
 	unsigned long long data_len; /* total length of all parsed DATA */
 
+	uint64_t qpack_ric; /* Required Insert Count of the field section being decoded */
+	struct list qpack_el; /* element of h3c <qpack_blocked> list */
+
 	int flags;
 	int err; /* used for stream reset */
 };
 
 DECLARE_STATIC_TYPED_POOL(pool_head_h3s, "h3s", struct h3s);
 
+/* Returns the Tx buffer of local uni-stream <qcs> reserved for metadata with at
+ * least <room> bytes available. The buffer is renewed if needed, which is only
+ * possible once all its data was emitted. NULL is returned if no buffer is
+ * currently available.
+ */
+static struct buffer *h3_uni_strm_buf(struct qcs *qcs, size_t room)
+{
+	struct buffer *out;
+	int err;
+
+	if (!qcs || !qcc_stream_can_send(qcs))
+		return NULL;
+
+	out = qcc_get_stream_txbuf(qcs, &err, 0);
+	if (out && b_room(out) < room) {
+		if (qcc_release_stream_txbuf(qcs))
+			return NULL;
+		out = qcc_get_stream_txbuf(qcs, &err, 0);
+	}
+
+	return out;
+}
+
+/* Reports to the peer encoder the insertions processed by the QPACK decoder of
+ * <h3c> and wakes up the streams which are not blocked anymore.
+ */
+static void h3_qpack_dec_notify(struct h3c *h3c)
+{
+	struct qpack_dec *dec = &h3c->qpack_dec;
+	struct h3s *h3s, *back;
+	struct buffer *out;
+	size_t prev;
+
+	if (dec->st_ins || dec->st_evict) {
+		h3_add_qpack_tbl_cnt(h3c->prx_counters, 0, dec->st_ins, dec->st_evict);
+		dec->st_ins = dec->st_evict = 0;
+	}
+
+	if (dec->ic > dec->krc) {
+		out = h3_uni_strm_buf(h3c->qpack_dec_strm, QUIC_VARINT_MAX_SIZE);
+		if (out) {
+			prev = b_data(out);
+			if (!qpack_encode_insert_count_inc(out, dec->ic - dec->krc)) {
+				qcc_send_stream(h3c->qpack_dec_strm, 1, b_data(out) - prev);
+				dec->krc = dec->ic;
+			}
+		}
+	}
+
+	list_for_each_entry_safe(h3s, back, &h3c->qpack_blocked, qpack_el) {
+		if (h3s->qpack_ric > dec->ic)
+			continue;
+
+		TRACE_STATE("stream unblocked by QPACK decoder", H3_EV_RX_FRAME|H3_EV_RX_HDR, h3c->qcc->conn, h3s->qcs);
+		LIST_DEL_INIT(&h3s->qpack_el);
+		h3s->flags &= ~H3_SF_QPACK_BLOCKED;
+		h3c->qpack_nb_blocked--;
+		qcc_wakeup_recv(h3s->qcs);
+	}
+}
+
+/* Emits a QPACK Section Acknowledgment for the field section just decoded on
+ * <qcs>, if it referenced the dynamic table.
+ */
+static void h3_qpack_section_ack(struct qcs *qcs)
+{
+	struct h3s *h3s = qcs->ctx;
+	struct h3c *h3c = h3s->h3c;
+	struct qpack_dec *dec = &h3c->qpack_dec;
+	struct buffer *out;
+	size_t prev;
+
+	if (!h3s->qpack_ric)
+		return;
+
+	out = h3_uni_strm_buf(h3c->qpack_dec_strm, QUIC_VARINT_MAX_SIZE);
+	if (out) {
+		prev = b_data(out);
+		if (!qpack_encode_section_ack(out, qcs->id)) {
+			qcc_send_stream(h3c->qpack_dec_strm, 1, b_data(out) - prev);
+			if (h3s->qpack_ric > dec->krc)
+				dec->krc = h3s->qpack_ric;
+		}
+	}
+	h3s->qpack_ric = 0;
+}
+
+/* Emits a QPACK Stream Cancellation for <qcs> whose remaining field sections
+ * won't be decoded, so that the peer encoder may release its references to
+ * the dynamic table (RFC 9204 4.4.2). This is only relevant if the peer uses
+ * the dynamic table.
+ */
+static void h3_qpack_stream_cancel(struct qcs *qcs)
+{
+	struct h3s *h3s = qcs->ctx;
+	struct h3c *h3c = h3s->h3c;
+	struct buffer *out;
+	size_t prev;
+
+	if (!h3c->qpack_dec.dht || !quic_stream_is_bidi(qcs->id) ||
+	    h3s->flags & H3_SF_QPACK_CANCEL)
+		return;
+
+	out = h3_uni_strm_buf(h3c->qpack_dec_strm, QUIC_VARINT_MAX_SIZE);
+	if (out) {
+		prev = b_data(out);
+		if (!qpack_encode_stream_cancel(out, qcs->id)) {
+			qcc_send_stream(h3c->qpack_dec_strm, 1, b_data(out) - prev);
+			h3s->flags |= H3_SF_QPACK_CANCEL;
+		}
+	}
+}
+
+/* Enables the QPACK encoder dynamic table of <h3c> once the peer SETTINGS are
+ * known, if both sides allow it.
+ */
+static void h3_qpack_enc_setup(struct h3c *h3c)
+{
+	uint64_t cap = MIN(h3c->qpack_max_table_capacity, h3_qpack_encoder_table_capacity);
+	struct buffer *ins;
+	size_t prev;
+
+	ins = h3_uni_strm_buf(h3c->qpack_enc_strm, QUIC_VARINT_MAX_SIZE);
+	if (!ins)
+		return;
+
+	prev = b_data(ins);
+	if (!qpack_enc_set_capacity(&h3c->qpack_enc, h3c->qpack_max_table_capacity, cap, ins)) {
+		TRACE_STATE("QPACK encoder dynamic table enabled", H3_EV_RX_FRAME|H3_EV_RX_SETTINGS, h3c->qcc->conn);
+		qcc_send_stream(h3c->qpack_enc_strm, 1, b_data(ins) - prev);
+	}
+}
+
+/* Prepares the QPACK encoder of <h3c> for a new field section. Returns the
+ * encoder stream buffer usable for dynamic table insertions with its current
+ * data length in <len>, or NULL if no insertion is possible.
+ */
+static struct buffer *h3_qpack_start_section(struct h3c *h3c, size_t *len)
+{
+	struct buffer *ins = NULL;
+
+	if (h3c->qpack_enc.dht)
+		ins = h3_uni_strm_buf(h3c->qpack_enc_strm, H3_QPACK_INS_ROOM);
+	qpack_enc_start_section(&h3c->qpack_enc, ins);
+	*len = ins ? b_data(ins) : 0;
+	return ins;
+}
+
+/* Emits on the QPACK encoder stream of <h3c> the instructions written into
+ * <*ins> since it contained <len> bytes, and reports the encoder activity to
+ * the stats, including the compression ratio if <done> is set. <*ins> is reset
+ * so that this may safely be called several times.
+ */
+static void h3_qpack_flush(struct h3c *h3c, struct buffer **ins, size_t len, int done)
+{
+	struct qpack_enc *enc = &h3c->qpack_enc;
+
+	if (*ins && b_data(*ins) > len)
+		qcc_send_stream(h3c->qpack_enc_strm, 1, b_data(*ins) - len);
+	*ins = NULL;
+
+	if (enc->st_ins || enc->st_evict) {
+		h3_add_qpack_tbl_cnt(h3c->prx_counters, 1, enc->st_ins, enc->st_evict);
+		enc->st_ins = enc->st_evict = 0;
+	}
+
+	if (done && enc->st_raw) {
+		h3_add_qpack_enc_bytes(h3c->prx_counters, enc->st_raw, enc->st_enc);
+		enc->st_raw = enc->st_enc = 0;
+	}
+}
+
 /* Initialize an uni-stream <qcs> by reading its type from <b>.
  *
  * Returns the count of consumed bytes or a negative error code.
@@ -268,18 +464,20 @@ static ssize_t h3_init_uni_stream(struct h3c *h3c, struct qcs *qcs,
 static ssize_t h3_parse_uni_stream_no_h3(struct qcs *qcs, struct buffer *b, int fin)
 {
 	struct h3s *h3s = qcs->ctx;
+	struct h3c *h3c = h3s->h3c;
+	ssize_t ret;
 
 	/* Function reserved to non-HTTP/3 unidirectional streams. */
 	BUG_ON(!quic_stream_is_uni(qcs->id) || !(h3s->flags & H3_SF_UNI_NO_H3));
 
 	switch (h3s->type) {
 	case H3S_T_QPACK_DEC:
-		if (qpack_decode_dec(b, fin, qcs))
-			return -1;
+		ret = qpack_decode_dec(&h3c->qpack_enc, b, fin);
 		break;
 	case H3S_T_QPACK_ENC:
-		if (qpack_decode_enc(b, fin, qcs))
-			return -1;
+		ret = qpack_decode_enc(&h3c->qpack_dec, b, fin);
+		if (ret > 0)
+			h3_qpack_dec_notify(h3c);
 		break;
 	case H3S_T_UNKNOWN:
 	default:
@@ -287,8 +485,14 @@ static ssize_t h3_parse_uni_stream_no_h3(struct qcs *qcs, struct buffer *b, int
 		ABORT_NOW();
 	}
 
-	/* TODO adjust return code */
-	return 0;
+	if (ret < 0) {
+		TRACE_ERROR("QPACK instruction decoding error", H3_EV_RX_FRAME, qcs->qcc->conn, qcs);
+		qcc_set_error(qcs->qcc, -ret, 1);
+		if (ret != -H3_ERR_INTERNAL_ERROR)
+			qcc_report_glitch(qcs->qcc, 1);
+	}
+
+	return ret;
 }
 
 /* Decode a H3 frame header from <rxbuf> buffer. The frame type is stored in
@@ -405,6 +609,21 @@ static int h3_check_frame_valid(struct h3c *h3c, struct qcs *qcs, uint64_t ftype
 			ret = H3_ERR_FRAME_UNEXPECTED;
 		break;
 
+	case H3_FT_PRIORITY_UPDATE_REQ:
+	case H3_FT_PRIORITY_UPDATE_PUSH:
+		/* RFC 9218 7.2. HTTP/3 PRIORITY_UPDATE Frame
+		 *
+		 * The PRIORITY_UPDATE frame MUST be sent on the client control
+		 * stream. Receiving a PRIORITY_UPDATE frame on a stream other than
+		 * the client control stream MUST be treated as a connection error
+		 * of type H3_FRAME_UNEXPECTED.
+		 */
+		if (h3s->type != H3S_T_CTRL || conn_is_back(qcs->qcc->conn))
+			ret = H3_ERR_FRAME_UNEXPECTED;
+		else if (!(h3c->flags & H3_CF_SETTINGS_RECV))
+			ret = H3_ERR_MISSING_SETTINGS;
+		break;
+
 	case H3_FT_PUSH_PROMISE:
 		/* RFC 9114 7.2.5. PUSH_PROMISE
 		 *
@@ -589,6 +808,60 @@ static struct ist _h3_trim_header(struct ist value)
 	return v;
 }
 
+/* Decodes the QPACK field section of <len> bytes at the head of <buf> received
+ * on <qcs> into <list> of <list_size> entries, using <tmp> as storage. If the
+ * section references dynamic table entries not received yet, the stream is
+ * registered as blocked and will be woken up once they are available.
+ *
+ * Returns the number of decoded headers or a negative QPACK_RET_* code. On
+ * connection error, h3c.err is set.
+ */
+static int h3_decode_fs(struct qcs *qcs, const struct buffer *buf, uint64_t len,
+                        struct buffer *tmp, struct http_hdr *list, int list_size)
+{
+	struct h3s *h3s = qcs->ctx;
+	struct h3c *h3c = h3s->h3c;
+	int qpack_err;
+	int ret;
+
+	ret = qpack_decode_fs(&h3c->qpack_dec, (const unsigned char *)b_head(buf), len,
+	                      tmp, list, list_size, &h3s->qpack_ric);
+	if (ret == -QPACK_RET_BLOCKED) {
+		if (h3s->flags & H3_SF_QPACK_BLOCKED)
+			return ret;
+
+		/* RFC 9204 2.1.2. Blocked Streams
+		 *
+		 * If a decoder encounters more blocked streams than it promised
+		 * to support, it MUST treat this as a connection error of type
+		 * QPACK_DECOMPRESSION_FAILED.
+		 */
+		if (h3c->qpack_nb_blocked >= h3_settings_qpack_blocked_streams) {
+			TRACE_ERROR("too many streams blocked on QPACK decoder", H3_EV_RX_FRAME|H3_EV_RX_HDR, qcs->qcc->conn, qcs);
+			h3c->err = QPACK_ERR_DECOMPRESSION_FAILED;
+			qcc_report_glitch(qcs->qcc, 1);
+			return -QPACK_RET_DECOMP;
+		}
+
+		TRACE_STATE("stream blocked on QPACK decoder", H3_EV_RX_FRAME|H3_EV_RX_HDR, qcs->qcc->conn, qcs);
+		h3s->flags |= H3_SF_QPACK_BLOCKED;
+		LIST_APPEND(&h3c->qpack_blocked, &h3s->qpack_el);
+		h3c->qpack_nb_blocked++;
+		h3_inc_qpack_blocked_cnt(h3c->prx_counters);
+		return ret;
+	}
+
+	if (ret < 0) {
+		TRACE_ERROR("QPACK decoding error", H3_EV_RX_FRAME|H3_EV_RX_HDR, qcs->qcc->conn, qcs);
+		if ((qpack_err = qpack_err_decode(ret)) >= 0) {
+			h3c->err = qpack_err;
+			qcc_report_glitch(qcs->qcc, 1);
+		}
+	}
+
+	return ret;
+}
+
 /* Parse from buffer <buf> a H3 HEADERS frame of length <len>. Data are copied
  * in a local HTX buffer and transfer to the stream connector layer. <fin> must be
  * set if this is the last data to transfer from this stream.
@@ -614,7 +887,6 @@ static ssize_t h3_req_headers_to_htx(struct qcs *qcs, const struct buffer *buf,
 	int hdr_idx, ret;
 	int cookie = -1, last_cookie = -1, i;
 	int relaxed = !!(h3c->qcc->proxy->options2 & PR_O2_REQBUG_OK);
-	int qpack_err;
 
 	/* RFC 9114 4.1.2. Malformed Requests and Responses
 	 *
@@ -642,15 +914,10 @@ static ssize_t h3_req_headers_to_htx(struct qcs *qcs, const struct buffer *buf,
 
 	/* TODO support buffer wrapping */
 	BUG_ON(b_head(buf) + len >= b_wrap(buf));
-	ret = qpack_decode_fs((const unsigned char *)b_head(buf), len, tmp,
-	                    list, sizeof(list) / sizeof(list[0]));
+	ret = h3_decode_fs(qcs, buf, len, tmp, list, sizeof(list) / sizeof(list[0]));
 	if (ret < 0) {
-		TRACE_ERROR("QPACK decoding error", H3_EV_RX_FRAME|H3_EV_RX_HDR, qcs->qcc->conn, qcs);
-		if ((qpack_err = qpack_err_decode(ret)) >= 0) {
-			h3c->err = qpack_err;
-			qcc_report_glitch(qcs->qcc, 1);
-		}
-		len = -1;
+		/* nothing consumed if blocked, decoding will be retried */
+		len = (ret == -QPACK_RET_BLOCKED) ? 0 : -1;
 		goto out;
 	}
 
@@ -950,6 +1217,13 @@ static ssize_t h3_req_headers_to_htx(struct qcs *qcs, const struct buffer *buf,
 			++hdr_idx;
 			continue;
 		}
+		else if (isteq(list[hdr_idx].n, ist("priority"))) {
+			/* RFC 9218 5. The Priority HTTP Header Field */
+			int urg = qcs->urg, incr = qcs->incr;
+
+			http_parse_priority(list[hdr_idx].v, &urg, &incr);
+			qcs_set_prio(qcs, urg, incr);
+		}
 		else if (isteq(list[hdr_idx].n, ist("content-length"))) {
 			ret = http_parse_cont_len_header(&list[hdr_idx].v,
 			                                 &h3s->body_len,
@@ -1116,7 +1390,6 @@ static ssize_t h3_resp_headers_to_htx(struct qcs *qcs, const struct buffer *buf,
 	struct ist status = IST_NULL;
 	unsigned char h, t, u;
 	int hdr_idx, ret;
-	int qpack_err;
 
 	/* RFC 9114 4.1.2. Malformed Requests and Responses
 	 *
@@ -1142,15 +1415,10 @@ static ssize_t h3_resp_headers_to_htx(struct qcs *qcs, const struct buffer *buf,
 
 	/* TODO support buffer wrapping */
 	BUG_ON(b_head(buf) + len >= b_wrap(buf));
-	ret = qpack_decode_fs((const unsigned char *)b_head(buf), len, tmp,
-	                    list, sizeof(list) / sizeof(list[0]));
+	ret = h3_decode_fs(qcs, buf, len, tmp, list, sizeof(list) / sizeof(list[0]));
 	if (ret < 0) {
-		TRACE_ERROR("QPACK decoding error", H3_EV_RX_FRAME|H3_EV_RX_HDR, qcs->qcc->conn, qcs);
-		if ((qpack_err = qpack_err_decode(ret)) >= 0) {
-			h3c->err = qpack_err;
-			qcc_report_glitch(qcs->qcc, 1);
-		}
-		len = -1;
+		/* nothing consumed if blocked, decoding will be retried */
+		len = (ret == -QPACK_RET_BLOCKED) ? 0 : -1;
 		goto out;
 	}
 
@@ -1379,7 +1647,6 @@ static ssize_t h3_trailers_to_htx(struct qcs *qcs, const struct buffer *buf,
 	struct http_hdr list[global.tune.max_http_hdr * 2];
 	int hdr_idx, ret;
 	const char *ctl;
-	int qpack_err;
 	struct ist v;
 	int i;
 
@@ -1387,15 +1654,10 @@ static ssize_t h3_trailers_to_htx(struct qcs *qcs, const struct buffer *buf,
 
 	/* TODO support buffer wrapping */
 	BUG_ON(b_head(buf) + len >= b_wrap(buf));
-	ret = qpack_decode_fs((const unsigned char *)b_head(buf), len, tmp,
-	                    list, sizeof(list) / sizeof(list[0]));
+	ret = h3_decode_fs(qcs, buf, len, tmp, list, sizeof(list) / sizeof(list[0]));
 	if (ret < 0) {
-		TRACE_ERROR("QPACK decoding error", H3_EV_RX_FRAME|H3_EV_RX_HDR, qcs->qcc->conn, qcs);
-		if ((qpack_err = qpack_err_decode(ret)) >= 0) {
-			h3c->err = qpack_err;
-			qcc_report_glitch(qcs->qcc, 1);
-		}
-		len = -1;
+		/* nothing consumed if blocked, decoding will be retried */
+		len = (ret == -QPACK_RET_BLOCKED) ? 0 : -1;
 		goto out;
 	}
 
@@ -1604,6 +1866,67 @@ static ssize_t h3_data_to_htx(struct qcs *qcs, const struct buffer *buf,
 	return -1;
 }
 
+/* Parse a PRIORITY_UPDATE frame of type <ftype> and length <len> of payload
+ * <buf> and apply the new priority to the designated request stream if it is
+ * still opened. Updates for push streams or for streams not opened yet are
+ * ignored.
+ *
+ * Returns the number of consumed bytes or a negative error code.
+ */
+static ssize_t h3_parse_priority_update_frm(struct h3c *h3c, uint64_t ftype,
+                                            const struct buffer *buf, size_t len)
+{
+	struct qcc *qcc = h3c->qcc;
+	struct eb64_node *node;
+	struct buffer b, *tmp;
+	struct qcs *qcs;
+	uint64_t id;
+	size_t ret = 0;
+	int urg, incr;
+
+	TRACE_ENTER(H3_EV_RX_FRAME, qcc->conn);
+
+	/* Work on a copy of <buf>. */
+	b = b_make(b_orig(buf), b_size(buf), b_head_ofs(buf), len);
+	if (!b_quic_dec_int(&id, &b, &ret)) {
+		h3c->err = H3_ERR_FRAME_ERROR;
+		qcc_report_glitch(qcc, 1);
+		return -1;
+	}
+
+	if (ftype == H3_FT_PRIORITY_UPDATE_PUSH)
+		goto out;
+
+	/* RFC 9218 7.2. HTTP/3 PRIORITY_UPDATE Frame
+	 *
+	 * If a PRIORITY_UPDATE frame is received with a Prioritized Element ID
+	 * that refers to a push stream or to a non-request stream, the
+	 * recipient MUST respond with a connection error of type H3_ID_ERROR.
+	 */
+	if (!quic_stream_is_bidi(id) || !quic_stream_is_remote(qcc, id)) {
+		h3c->err = H3_ERR_ID_ERROR;
+		qcc_report_glitch(qcc, 1);
+		return -1;
+	}
+
+	node = eb64_lookup(&qcc->streams_by_id, id);
+	if (!node)
+		goto out;
+
+	qcs = eb64_entry(node, struct qcs, by_id);
+	tmp = get_trash_chunk();
+	tmp->data = b_getblk(&b, tmp->area, b_data(&b), 0);
+
+	urg = qcs->urg;
+	incr = qcs->incr;
+	http_parse_priority(ist2(tmp->area, tmp->data), &urg, &incr);
+	qcs_set_prio(qcs, urg, incr);
+
+ out:
+	TRACE_LEAVE(H3_EV_RX_FRAME, qcc->conn);
+	return len;
+}
+
 /* Parse a SETTINGS frame of length <len> of payload <buf>.
  *
  * Returns the number of consumed bytes or a negative error code.
@@ -1777,6 +2100,7 @@ static ssize_t h3_rcv_buf(struct qcs *qcs, struct buffer *b, int fin)
 				qcc_report_glitch(qcs->qcc, 1);
 				goto err;
 			}
+			h3_inc_frame_type_cnt(h3c->prx_counters, ftype);
 
 			if (h3s->type == H3S_T_REQ && ftype == H3_FT_DATA) {
 				h3s->data_len += flen;
@@ -1826,7 +2150,6 @@ static ssize_t h3_rcv_buf(struct qcs *qcs, struct buffer *b, int fin)
 		if (last_stream_frame && h3s->flags & H3_SF_HAVE_CLEN && h3_check_body_size(qcs, last_stream_frame))
 			break;
 
-		h3_inc_frame_type_cnt(h3c->prx_counters, ftype);
 		switch (ftype) {
 		case H3_FT_DATA:
 			ret = h3_data_to_htx(qcs, b, flen, last_stream_frame);
@@ -1836,10 +2159,14 @@ static ssize_t h3_rcv_buf(struct qcs *qcs, struct buffer *b, int fin)
 			if (h3s->st_req == H3S_ST_REQ_BEFORE) {
 				if (!conn_is_back(qcs->qcc->conn)) {
 					ret = h3_req_headers_to_htx(qcs, b, flen, last_stream_frame);
+					if (h3s->flags & H3_SF_QPACK_BLOCKED)
+						break;
 					h3s->st_req = H3S_ST_REQ_HEADERS;
 				}
 				else {
 					ret = h3_resp_headers_to_htx(qcs, b, flen, last_stream_frame);
+					if (h3s->flags & H3_SF_QPACK_BLOCKED)
+						break;
 
 					/* Check if an interim or final response was parsed. */
 					if (h3s->flags & H3_SF_RECV_INTERIM) {
@@ -1862,6 +2189,8 @@ static ssize_t h3_rcv_buf(struct qcs *qcs, struct buffer *b, int fin)
 			}
 			else {
 				ret = h3_trailers_to_htx(qcs, b, flen, last_stream_frame);
+				if (h3s->flags & H3_SF_QPACK_BLOCKED)
+					break;
 				h3s->st_req = H3S_ST_REQ_TRAILERS;
 			}
 			break;
@@ -1880,6 +2209,16 @@ static ssize_t h3_rcv_buf(struct qcs *qcs, struct buffer *b, int fin)
 				goto err;
 			}
 			h3c->flags |= H3_CF_SETTINGS_RECV;
+			h3_qpack_enc_setup(h3c);
+			break;
+		case H3_FT_PRIORITY_UPDATE_REQ:
+		case H3_FT_PRIORITY_UPDATE_PUSH:
+			ret = h3_parse_priority_update_frm(qcs->qcc->ctx, ftype, b, flen);
+			if (ret < 0) {
+				TRACE_ERROR("error on PRIORITY_UPDATE parsing", H3_EV_RX_FRAME, qcs->qcc->conn, qcs);
+				qcc_set_error(qcs->qcc, h3c->err, 1);
+				goto err;
+			}
 			break;
 		default:
 			/* draft-ietf-quic-http34 9. Extensions to HTTP/3
@@ -1896,7 +2235,15 @@ static ssize_t h3_rcv_buf(struct qcs *qcs, struct buffer *b, int fin)
 			h3s->demux_frame_len -= ret;
 			b_del(b, ret);
 			total += ret;
+
+			/* field section fully processed */
+			if (ftype == H3_FT_HEADERS && !h3s->demux_frame_len)
+				h3_qpack_section_ack(qcs);
 		}
+
+		/* wait for the QPACK encoder stream */
+		if (h3s->flags & H3_SF_QPACK_BLOCKED)
+			break;
 	}
 
 	/* Reset demux frame type for traces. */
@@ -1905,6 +2252,7 @@ static ssize_t h3_rcv_buf(struct qcs *qcs, struct buffer *b, int fin)
 
 	/* Interrupt decoding on stream/connection error detected. */
 	if (h3s->err) {
+		h3_qpack_stream_cancel(qcs);
 		qcc_abort_stream_read(qcs);
 		qcc_reset_stream(qcs, h3s->err);
 		total = b_data(b);
@@ -2003,12 +2351,13 @@ static int h3_control_send(struct qcs *qcs, void *ctx)
 	return -1;
 }
 
-/* Encode header field name <n> value <v> into <buf> buffer using QPACK. Strip
- * any leading/trailing WS in value prior to encoding.
+/* Encode header field name <n> value <v> into <buf> buffer using QPACK with
+ * the encoder context of <h3c>. Strip any leading/trailing WS in value prior
+ * to encoding.
  *
  * Returns 0 on success else non zero.
  */
-static int h3_encode_header(struct buffer *buf,
+static int h3_encode_header(struct h3c *h3c, struct buffer *buf,
                             const struct ist n, const struct ist v)
 {
 	struct ist v_strip;
@@ -2023,7 +2372,7 @@ static int h3_encode_header(struct buffer *buf,
 			break;
 	}
 
-	return qpack_encode_header(buf, n, v_strip);
+	return qpack_encode_header_dht(&h3c->qpack_enc, buf, n, v_strip);
 }
 
 /* Convert a HTX start-line and associated headers stored in <htx> into a
@@ -2035,10 +2384,13 @@ static int h3_encode_header(struct buffer *buf,
  */
 static int h3_req_headers_send(struct qcs *qcs, struct htx *htx)
 {
+	struct h3s *h3s = qcs->ctx;
+	struct h3c *h3c = h3s->h3c;
 	int err;
 	struct http_hdr list[global.tune.max_http_hdr * 2];
 	struct buffer headers_buf = BUF_NULL;
-	struct buffer *res;
+	struct buffer *res, *ins = NULL;
+	size_t ins_len = 0;
 	enum htx_blk_type type;
 	struct htx_blk *blk;
 	struct htx_sl *sl;
@@ -2113,6 +2465,7 @@ static int h3_req_headers_send(struct qcs *qcs, struct htx *htx)
 	           qcs->qcc->conn, qcs);
 	if (qpack_encode_field_section_line(&headers_buf))
 		goto err_full;
+	ins = h3_qpack_start_section(h3c, &ins_len);
 
 	if (qpack_encode_method(&headers_buf, sl->info.req.meth, meth))
 		goto err_full;
@@ -2152,7 +2505,8 @@ static int h3_req_headers_send(struct qcs *qcs, struct htx *htx)
 		goto err_full;
 
 	if (istlen(auth)) {
-		if (qpack_encode_auth(&headers_buf, auth))
+		/* the authority is usually the same for all requests */
+		if (qpack_encode_header_dht(&h3c->qpack_enc, &headers_buf, ist(":authority"), auth))
 			goto err_full;
 	}
 
@@ -2198,10 +2552,13 @@ static int h3_req_headers_send(struct qcs *qcs, struct htx *htx)
 		if (istlen(auth) && isteq(list[hdr].n, ist("host")))
 			continue;
 
-		if (h3_encode_header(&headers_buf, list[hdr].n, list[hdr].v))
+		if (h3_encode_header(h3c, &headers_buf, list[hdr].n, list[hdr].v))
 			goto err_full;
 	}
 
+	if (qpack_enc_end_section(&h3c->qpack_enc, &headers_buf))
+		goto err_full;
+
 	/* Now that all headers are encoded, we are certain that res buffer is
 	 * big enough
 	 */
@@ -2210,6 +2567,8 @@ static int h3_req_headers_send(struct qcs *qcs, struct htx *htx)
 	b_putchr(res, 0x01); /* h3 HEADERS frame type */
 	b_quic_enc_int(res, b_data(&headers_buf), 0);
 	b_add(res, b_data(&headers_buf));
+	qpack_enc_commit_section(&h3c->qpack_enc, qcs->id);
+	h3_qpack_flush(h3c, &ins, ins_len, 1);
 
 	ret = 0;
 	blk = htx_get_head_blk(htx);
@@ -2226,6 +2585,7 @@ static int h3_req_headers_send(struct qcs *qcs, struct htx *htx)
 	return ret;
 
  err_full:
+	h3_qpack_flush(h3c, &ins, ins_len, 0);
 	if (smallbuf) {
 		TRACE_DEVEL("retry with a full buffer", H3_EV_TX_FRAME|H3_EV_TX_HDR, qcs->qcc->conn, qcs);
 		smallbuf = 0;
@@ -2246,9 +2606,11 @@ static int h3_req_headers_send(struct qcs *qcs, struct htx *htx)
 static int h3_resp_headers_send(struct qcs *qcs, struct htx *htx)
 {
 	struct h3s *h3s = qcs->ctx;
+	struct h3c *h3c = h3s->h3c;
 	int err;
 	struct buffer headers_buf = BUF_NULL;
-	struct buffer *res;
+	struct buffer *res, *ins = NULL;
+	size_t ins_len = 0;
 	struct http_hdr list[global.tune.max_http_hdr * 2];
 	struct htx_sl *sl;
 	struct htx_blk *blk;
@@ -2344,6 +2706,8 @@ static int h3_resp_headers_send(struct qcs *qcs, struct htx *htx)
 	           qcs->qcc->conn, qcs);
 	if (qpack_encode_field_section_line(&headers_buf))
 		goto err_full;
+	ins = h3_qpack_start_section(h3c, &ins_len);
+
 	if (qpack_encode_int_status(&headers_buf, status)) {
 		TRACE_ERROR("error during status code encoding", H3_EV_TX_FRAME|H3_EV_TX_HDR, qcs->qcc->conn, qcs);
 		goto err_full;
@@ -2386,10 +2750,13 @@ static int h3_resp_headers_send(struct qcs *qcs, struct htx *htx)
 			list[hdr].v = ist("trailers");
 		}
 
-		if (h3_encode_header(&headers_buf, list[hdr].n, list[hdr].v))
+		if (h3_encode_header(h3c, &headers_buf, list[hdr].n, list[hdr].v))
 			goto err_full;
 	}
 
+	if (qpack_enc_end_section(&h3c->qpack_enc, &headers_buf))
+		goto err_full;
+
 	/* Now that all headers are encoded, we are certain that res buffer is
 	 * big enough
 	 */
@@ -2411,6 +2778,8 @@ static int h3_resp_headers_send(struct qcs *qcs, struct htx *htx)
 		b_quic_enc_int(res, b_data(&headers_buf), 4);
 	}
 	b_add(res, b_data(&headers_buf));
+	qpack_enc_commit_section(&h3c->qpack_enc, qcs->id);
+	h3_qpack_flush(h3c, &ins, ins_len, 1);
 
 	ret = 0;
 	blk = htx_get_head_blk(htx);
@@ -2427,6 +2796,7 @@ static int h3_resp_headers_send(struct qcs *qcs, struct htx *htx)
 	return ret;
 
  err_full:
+	h3_qpack_flush(h3c, &ins, ins_len, 0);
 	if (b_data(res)) {
 		/* Output buffer already contains data : this may happens after
 		 * HTTP interim response encoding. Try to release buffer to be
@@ -2464,9 +2834,11 @@ static int h3_resp_headers_send(struct qcs *qcs, struct htx *htx)
  */
 static int h3_resp_trailers_send(struct qcs *qcs, struct htx *htx)
 {
+	struct h3s *h3s = qcs->ctx;
+	struct h3c *h3c = h3s->h3c;
 	int err;
 	struct buffer headers_buf = BUF_NULL;
-	struct buffer *res;
+	struct buffer *res, *ins = NULL;
 	struct http_hdr list[global.tune.max_http_hdr];
 	struct htx_blk *blk;
 	enum htx_blk_type type;
@@ -2563,6 +2935,11 @@ static int h3_resp_trailers_send(struct qcs *qcs, struct htx *htx)
 		goto start;
 	}
 
+	/* Trailers are rarely repeated, they may only reference entries
+	 * already in the QPACK dynamic table.
+	 */
+	qpack_enc_start_section(&h3c->qpack_enc, NULL);
+
 	tail = b_tail(&headers_buf);
 	for (hdr = 0; hdr < sizeof(list) / sizeof(list[0]); ++hdr) {
 		if (isteq(list[hdr].n, ist("")))
@@ -2580,7 +2957,7 @@ static int h3_resp_trailers_send(struct qcs *qcs, struct htx *htx)
 			continue;
 		}
 
-		if (h3_encode_header(&headers_buf, list[hdr].n, list[hdr].v)) {
+		if (h3_encode_header(h3c, &headers_buf, list[hdr].n, list[hdr].v)) {
 			TRACE_STATE("not enough room for all trailers", H3_EV_TX_FRAME|H3_EV_TX_HDR, qcs->qcc->conn, qcs);
 			if (qcc_release_stream_txbuf(qcs))
 				goto end;
@@ -2603,9 +2980,20 @@ static int h3_resp_trailers_send(struct qcs *qcs, struct htx *htx)
 		 */
 		TRACE_DATA("encoding TRAILERS frame", H3_EV_TX_FRAME|H3_EV_TX_HDR,
 			   qcs->qcc->conn, qcs);
+		if (qpack_enc_end_section(&h3c->qpack_enc, &headers_buf)) {
+			TRACE_STATE("not enough room for trailers section prefix", H3_EV_TX_FRAME|H3_EV_TX_HDR, qcs->qcc->conn, qcs);
+			if (qcc_release_stream_txbuf(qcs))
+				goto end;
+
+			/* Buffer released, restart processing. */
+			goto start;
+		}
+
 		b_putchr(res, 0x01); /* h3 HEADERS frame type */
 		b_quic_enc_int(res, b_data(&headers_buf), 8);
 		b_add(res, b_data(&headers_buf));
+		qpack_enc_commit_section(&h3c->qpack_enc, qcs->id);
+		h3_qpack_flush(h3c, &ins, 0, 1);
 	}
 
 	/* Encoding success, truncate HTX blocks until EOT. */
@@ -2750,6 +3138,11 @@ static int h3_resp_data_send(struct qcs *qcs, struct htx *htx,
 	goto new_frame;
 
  end:
+	if (total) {
+		struct h3s *h3s = qcs->ctx;
+
+		h3_add_data_sent_cnt(h3s->h3c->prx_counters, qcs->urg, total);
+	}
 	TRACE_LEAVE(H3_EV_TX_FRAME|H3_EV_TX_DATA, qcs->qcc->conn, qcs);
 	return total;
 
@@ -2978,6 +3371,8 @@ static size_t h3_done_ff(struct qcs *qcs)
 		b_add(qcs->sd->iobuf.buf, qcs->sd->iobuf.data);
 
 		total = qcs->sd->iobuf.offset + qcs->sd->iobuf.data;
+		h3_add_data_sent_cnt(((struct h3s *)qcs->ctx)->h3c->prx_counters,
+		                     qcs->urg, qcs->sd->iobuf.data);
 	}
 
 	TRACE_LEAVE(H3_EV_STRM_SEND, qcs->qcc->conn, qcs);
@@ -3016,6 +3411,19 @@ static int h3_close(struct qcs *qcs, enum qcc_app_ops_close_side side)
 		return 1;
 	}
 
+	/* RFC 9204 4.2. Encoder and Decoder Streams
+	 *
+	 * Closure of either unidirectional stream type MUST be treated as a
+	 * connection error of type H3_CLOSED_CRITICAL_STREAM.
+	 */
+	if (qcs == h3c->qpack_enc_strm || qcs == h3c->qpack_dec_strm ||
+	    h3s->type == H3S_T_QPACK_ENC || h3s->type == H3S_T_QPACK_DEC) {
+		TRACE_ERROR("closure detected on QPACK stream", H3_EV_H3S_END, qcs->qcc->conn, qcs);
+		qcc_set_error(qcs->qcc, H3_ERR_CLOSED_CRITICAL_STREAM, 1);
+		qcc_report_glitch(qcs->qcc, 1);
+		return 1;
+	}
+
 	return 0;
 }
 
@@ -3039,6 +3447,7 @@ static int h3_attach(struct qcs *qcs, void *conn_ctx)
 
 	qcs->ctx = h3s;
 	h3s->h3c = conn_ctx;
+	h3s->qcs = qcs;
 
 	h3s->demux_frame_len = 0;
 	h3s->demux_frame_type = H3_FT_UNINIT;
@@ -3046,6 +3455,8 @@ static int h3_attach(struct qcs *qcs, void *conn_ctx)
 	h3s->data_len = 0;
 	h3s->flags = 0;
 	h3s->err = 0;
+	h3s->qpack_ric = 0;
+	LIST_INIT(&h3s->qpack_el);
 
 	if (quic_stream_is_bidi(qcs->id)) {
 		h3s->type = H3S_T_REQ;
@@ -3090,9 +3501,35 @@ static int h3_attach(struct qcs *qcs, void *conn_ctx)
 static void h3_detach(struct qcs *qcs)
 {
 	struct h3s *h3s = qcs->ctx;
+	struct h3c *h3c = h3s->h3c;
 
 	TRACE_ENTER(H3_EV_H3S_END, qcs->qcc->conn, qcs);
 
+	if (h3s->flags & H3_SF_QPACK_BLOCKED) {
+		LIST_DEL_INIT(&h3s->qpack_el);
+		h3c->qpack_nb_blocked--;
+	}
+
+	/* RFC 9204 4.4.2. Stream Cancellation
+	 *
+	 * When an endpoint receives a stream reset before the end of a stream
+	 * or before all encoded field sections are processed on that stream,
+	 * or when it abandons reading of a stream, it generates a Stream
+	 * Cancellation instruction.
+	 */
+	if (qcs->qcc->app_st == QCC_APP_ST_INIT &&
+	    !(qcs->qcc->flags & (QC_CF_ERRL|QC_CF_ERR_CONN)) &&
+	    (qcs->flags & (QC_SF_RECV_RESET|QC_SF_READ_ABORTED) || h3s->qpack_ric)) {
+		h3_qpack_stream_cancel(qcs);
+	}
+
+	if (qcs == h3c->ctrl_strm)
+		h3c->ctrl_strm = NULL;
+	else if (qcs == h3c->qpack_enc_strm)
+		h3c->qpack_enc_strm = NULL;
+	else if (qcs == h3c->qpack_dec_strm)
+		h3c->qpack_dec_strm = NULL;
+
 	pool_free(pool_head_h3s, h3s);
 	qcs->ctx = NULL;
 
@@ -3166,9 +3603,21 @@ static int h3_init(struct qcc *qcc)
 
 	h3c->qcc = qcc;
 	h3c->ctrl_strm = NULL;
+	h3c->qpack_enc_strm = NULL;
+	h3c->qpack_dec_strm = NULL;
 	h3c->err = 0;
 	h3c->flags = 0;
 	h3c->id_goaway = 0;
+	h3c->qpack_max_table_capacity = 0;
+	h3c->qpack_blocked_streams = 0;
+
+	qpack_enc_init(&h3c->qpack_enc);
+	h3c->qpack_dec.dht = NULL;
+	h3c->qpack_dec.max_cap = h3_settings_qpack_max_table_capacity;
+	h3c->qpack_dec.ic = h3c->qpack_dec.krc = 0;
+	h3c->qpack_dec.st_ins = h3c->qpack_dec.st_evict = 0;
+	LIST_INIT(&h3c->qpack_blocked);
+	h3c->qpack_nb_blocked = 0;
 
 	qcc->ctx = h3c;
 	h3c->prx_counters = qc_counters(qcc->conn->target, &h3_stats_module);
@@ -3183,8 +3632,40 @@ static int h3_init(struct qcc *qcc)
 	return 0;
 }
 
+/* Opens a local unidirectional stream of QPACK <type> for <h3c> connection and
+ * schedules the emission of its type. Returns the stream instance or NULL on
+ * error, in which case the connection error is set.
+ */
+static struct qcs *h3_qpack_open_stream(struct h3c *h3c, uint64_t type)
+{
+	struct qcc *qcc = h3c->qcc;
+	struct buffer *res;
+	struct qcs *qcs;
+	int err;
+
+	qcs = qcc_init_stream_local(qcc, 0);
+	if (!qcs) {
+		/* Error must be set by qcc_init_stream_local(). */
+		BUG_ON(!(qcc->flags & QC_CF_ERRL));
+		TRACE_ERROR("cannot init QPACK stream", H3_EV_H3C_NEW, qcc->conn);
+		return NULL;
+	}
+
+	qcs_send_metadata(qcs);
+	res = qcc_get_stream_txbuf(qcs, &err, 0);
+	if (!res) {
+		TRACE_ERROR("cannot allocate Tx buffer", H3_EV_H3C_NEW, qcc->conn, qcs);
+		qcc_set_error(qcc, H3_ERR_INTERNAL_ERROR, 1);
+		return NULL;
+	}
+
+	b_quic_enc_int(res, type, 0);
+	qcc_send_stream(qcs, 1, b_data(res));
+	return qcs;
+}
+
 /* Open control stream for <ctx> HTTP/3 connection and schedule a SETTINGS
- * frame emission on it.
+ * frame emission on it. QPACK encoder and decoder streams are opened too.
  *
  * Returns 0 on success. If a transient error was encountered, a positive value
  * is returned, finalize operation should be recalled later. A negative value is
@@ -3224,6 +3705,17 @@ static int h3_finalize(void *ctx)
 
 		qcs_send_metadata(qcs);
 		h3c->ctrl_strm = qcs;
+
+		/* QPACK encoder and decoder streams are only useful if the
+		 * dynamic table may be used in the corresponding direction.
+		 */
+		if (h3_qpack_encoder_table_capacity &&
+		    !(h3c->qpack_enc_strm = h3_qpack_open_stream(h3c, H3_UNI_S_T_QPACK_ENC)))
+			goto err;
+
+		if (h3_settings_qpack_max_table_capacity &&
+		    !(h3c->qpack_dec_strm = h3_qpack_open_stream(h3c, H3_UNI_S_T_QPACK_DEC)))
+			goto err;
 	}
 
 	if (qfctl_sblocked(&qcs->tx.fc) || qfctl_sblocked(&qcs->qcc->tx.fc)) {
@@ -3285,6 +3777,9 @@ static void h3_shutdown(void *ctx)
 static void h3_release(void *ctx)
 {
 	struct h3c *h3c = ctx;
+
+	qpack_enc_release(&h3c->qpack_enc);
+	qpack_dec_release(&h3c->qpack_dec);
 	pool_free(pool_head_h3c, h3c);
 }
 
@@ -3312,6 +3807,8 @@ static inline const char *h3_ft_str(uint64_t type)
 	case H3_FT_MAX_PUSH_ID:  return "MAX_PUSH_ID";
 	case H3_FT_CANCEL_PUSH:  return "CANCEL_PUSH";
 	case H3_FT_GOAWAY:       return "GOAWAY";
+	case H3_FT_PRIORITY_UPDATE_REQ:  return "PRIORITY_UPDATE";
+	case H3_FT_PRIORITY_UPDATE_PUSH: return "PRIORITY_UPDATE_PUSH";
 	default:                 return "_UNKNOWN_";
 	}
 }
@@ -3415,3 +3912,77 @@ const struct qcc_app_ops h3_ops = {
 	.release     = h3_release,
 	.strm_reject = h3_reject,
 };
+
+/* config parser for global "tune.h3.qpack.{max-table-capacity,encoder-table-capacity}" */
+static int h3_parse_qpack_table_capacity(char **args, int section_type, struct proxy *curpx,
+                                         const struct proxy *defpx, const char *file, int line,
+                                         char **err)
+{
+	int val;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	val = atoi(args[1]);
+	if (val < 0 || val > 65536) {
+		memprintf(err, "'%s' expects a numeric value between 0 and 65536.", args[0]);
+		return -1;
+	}
+
+	if (strcmp(args[0], "tune.h3.qpack.max-table-capacity") == 0)
+		h3_settings_qpack_max_table_capacity = val;
+	else
+		h3_qpack_encoder_table_capacity = val;
+	return 0;
+}
+
+/* config parser for global "tune.h3.qpack.blocked-streams" */
+static int h3_parse_qpack_blocked_streams(char **args, int section_type, struct proxy *curpx,
+                                          const struct proxy *defpx, const char *file, int line,
+                                          char **err)
+{
+	int val;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	val = atoi(args[1]);
+	if (val < 0 || val > 65536) {
+		memprintf(err, "'%s' expects a numeric value between 0 and 65536.", args[0]);
+		return -1;
+	}
+
+	h3_settings_qpack_blocked_streams = val;
+	return 0;
+}
+
+/* config keyword parsers */
+static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.h3.qpack.blocked-streams",        h3_parse_qpack_blocked_streams },
+	{ CFG_GLOBAL, "tune.h3.qpack.encoder-table-capacity", h3_parse_qpack_table_capacity  },
+	{ CFG_GLOBAL, "tune.h3.qpack.max-table-capacity",     h3_parse_qpack_table_capacity  },
+	{ 0, NULL, NULL }
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
+
+/* initialize internal structs after the config is parsed.
+ * Returns zero on success, non-zero on error.
+ */
+static int init_h3()
+{
+	size_t size = MAX(h3_settings_qpack_max_table_capacity, h3_qpack_encoder_table_capacity);
+
+	/* the same pool is used for decoding and encoding tables */
+	if (size && !pool_head_qpack_tbl) {
+		pool_head_qpack_tbl = create_pool("qpack_tbl", size, MEM_F_SHARED|MEM_F_EXACT);
+		if (!pool_head_qpack_tbl) {
+			ha_alert("failed to allocate qpack_tbl memory pool\n");
+			return (ERR_ALERT | ERR_FATAL);
+		}
+	}
+
+	return ERR_NONE;
+}
+
+REGISTER_POST_CHECK(init_h3);
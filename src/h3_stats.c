@@ -11,6 +11,7 @@ enum {
 	H3_ST_MAX_PUSH_ID,
 	H3_ST_GOAWAY,
 	H3_ST_SETTINGS,
+	H3_ST_PRIORITY_UPDATE,
 	/* h3 error counters */
 	H3_ST_H3_NO_ERROR,
 	H3_ST_H3_GENERAL_PROTOCOL_ERROR,
@@ -33,6 +34,24 @@ enum {
 	H3_ST_QPACK_DECOMPRESSION_FAILED,
 	H3_ST_QPACK_ENCODER_STREAM_ERROR,
 	H3_ST_QPACK_DECODER_STREAM_ERROR,
+	/* QPACK dynamic table counters */
+	H3_ST_QPACK_ENC_INSERT,
+	H3_ST_QPACK_ENC_EVICT,
+	H3_ST_QPACK_DEC_INSERT,
+	H3_ST_QPACK_DEC_EVICT,
+	H3_ST_QPACK_BLOCKED_STREAMS,
+	H3_ST_QPACK_ENC_RAW_BYTES,
+	H3_ST_QPACK_ENC_BYTES,
+	H3_ST_QPACK_ENC_RATIO,
+	/* RFC 9218 priorities counters */
+	H3_ST_DATA_SENT_URG0,
+	H3_ST_DATA_SENT_URG1,
+	H3_ST_DATA_SENT_URG2,
+	H3_ST_DATA_SENT_URG3,
+	H3_ST_DATA_SENT_URG4,
+	H3_ST_DATA_SENT_URG5,
+	H3_ST_DATA_SENT_URG6,
+	H3_ST_DATA_SENT_URG7,
 	H3_STATS_COUNT /* must be the last */
 };
 
@@ -52,6 +71,8 @@ static struct stat_col h3_stats[] = {
 	                         .desc = "Total number of GOAWAY frames received" },
 	[H3_ST_SETTINGS]     = { .name = "h3_settings",
 	                         .desc = "Total number of SETTINGS frames received" },
+	[H3_ST_PRIORITY_UPDATE] = { .name = "h3_priority_update",
+	                            .desc = "Total number of PRIORITY_UPDATE frames received" },
 	/* h3 error counters */
 	[H3_ST_H3_NO_ERROR]                = { .name = "h3_no_error",
 	                                       .desc = "Total number of H3_NO_ERROR errors received" },
@@ -94,6 +115,40 @@ static struct stat_col h3_stats[] = {
 	                                       .desc = "Total number of QPACK_ENCODER_STREAM_ERROR errors received" },
 	[H3_ST_QPACK_DECODER_STREAM_ERROR] = { .name = "qpack_decoder_stream_error",
 	                                       .desc = "Total number of QPACK_DECODER_STREAM_ERROR errors received" },
+	/* QPACK dynamic table counters */
+	[H3_ST_QPACK_ENC_INSERT]           = { .name = "qpack_enc_insert",
+	                                       .desc = "Total number of entries inserted into the QPACK encoder dynamic tables" },
+	[H3_ST_QPACK_ENC_EVICT]            = { .name = "qpack_enc_evict",
+	                                       .desc = "Total number of entries evicted from the QPACK encoder dynamic tables" },
+	[H3_ST_QPACK_DEC_INSERT]           = { .name = "qpack_dec_insert",
+	                                       .desc = "Total number of entries inserted into the QPACK decoder dynamic tables" },
+	[H3_ST_QPACK_DEC_EVICT]            = { .name = "qpack_dec_evict",
+	                                       .desc = "Total number of entries evicted from the QPACK decoder dynamic tables" },
+	[H3_ST_QPACK_BLOCKED_STREAMS]      = { .name = "qpack_blocked_streams",
+	                                       .desc = "Total number of streams blocked waiting for QPACK encoder instructions" },
+	[H3_ST_QPACK_ENC_RAW_BYTES]        = { .name = "qpack_enc_raw_bytes",
+	                                       .desc = "Total size of header field names and values before QPACK encoding" },
+	[H3_ST_QPACK_ENC_BYTES]            = { .name = "qpack_enc_bytes",
+	                                       .desc = "Total size of QPACK encoded header fields" },
+	[H3_ST_QPACK_ENC_RATIO]            = { .name = "qpack_enc_ratio",
+	                                       .desc = "Percentage of the size of QPACK encoded header fields relative to their raw size" },
+	/* RFC 9218 priorities counters */
+	[H3_ST_DATA_SENT_URG0]             = { .name = "h3_data_bytes_sent_urg0",
+	                                       .desc = "Total number of DATA bytes sent for streams of urgency 0" },
+	[H3_ST_DATA_SENT_URG1]             = { .name = "h3_data_bytes_sent_urg1",
+	                                       .desc = "Total number of DATA bytes sent for streams of urgency 1" },
+	[H3_ST_DATA_SENT_URG2]             = { .name = "h3_data_bytes_sent_urg2",
+	                                       .desc = "Total number of DATA bytes sent for streams of urgency 2" },
+	[H3_ST_DATA_SENT_URG3]             = { .name = "h3_data_bytes_sent_urg3",
+	                                       .desc = "Total number of DATA bytes sent for streams of urgency 3" },
+	[H3_ST_DATA_SENT_URG4]             = { .name = "h3_data_bytes_sent_urg4",
+	                                       .desc = "Total number of DATA bytes sent for streams of urgency 4" },
+	[H3_ST_DATA_SENT_URG5]             = { .name = "h3_data_bytes_sent_urg5",
+	                                       .desc = "Total number of DATA bytes sent for streams of urgency 5" },
+	[H3_ST_DATA_SENT_URG6]             = { .name = "h3_data_bytes_sent_urg6",
+	                                       .desc = "Total number of DATA bytes sent for streams of urgency 6" },
+	[H3_ST_DATA_SENT_URG7]             = { .name = "h3_data_bytes_sent_urg7",
+	                                       .desc = "Total number of DATA bytes sent for streams of urgency 7" },
 };
 
 static struct h3_counters {
@@ -105,6 +160,7 @@ static struct h3_counters {
 	long long h3_max_push_id;  /* total number of MAX_PUSH_ID frames received */
 	long long h3_goaway;       /* total number of GOAWAY frames received */
 	long long h3_settings;      /* total number of SETTINGS frames received */
+	long long h3_priority_update; /* total number of PRIORITY_UPDATE frames received */
 	/* h3 error counters */
 	long long h3_no_error;                /* total number of H3_NO_ERROR errors received */
 	long long h3_general_protocol_error;  /* total number of H3_GENERAL_PROTOCOL_ERROR errors received */
@@ -127,6 +183,16 @@ static struct h3_counters {
 	long long qpack_decompression_failed; /* total number of QPACK_DECOMPRESSION_FAILED errors received */
 	long long qpack_encoder_stream_error; /* total number of QPACK_ENCODER_STREAM_ERROR errors received */
 	long long qpack_decoder_stream_error; /* total number of QPACK_DECODER_STREAM_ERROR errors received */
+	/* QPACK dynamic table counters */
+	long long qpack_enc_insert;      /* total number of insertions into encoder dynamic tables */
+	long long qpack_enc_evict;       /* total number of evictions from encoder dynamic tables */
+	long long qpack_dec_insert;      /* total number of insertions into decoder dynamic tables */
+	long long qpack_dec_evict;       /* total number of evictions from decoder dynamic tables */
+	long long qpack_blocked_streams; /* total number of blocked streams */
+	long long qpack_enc_raw_bytes;   /* total size of header fields before encoding */
+	long long qpack_enc_bytes;       /* total size of encoded header fields */
+	/* RFC 9218 priorities counters */
+	long long data_sent_urg[8];      /* total DATA bytes sent per urgency */
 } h3_counters;
 
 static int h3_fill_stats(struct stats_module *mod, struct extra_counters *ctr,
@@ -166,6 +232,9 @@ static int h3_fill_stats(struct stats_module *mod, struct extra_counters *ctr,
 		case H3_ST_SETTINGS:
 			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->h3_settings));
 			break;
+		case H3_ST_PRIORITY_UPDATE:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->h3_priority_update));
+			break;
 
 		/* h3 error counters */
 		case H3_ST_H3_NO_ERROR:
@@ -230,6 +299,48 @@ static int h3_fill_stats(struct stats_module *mod, struct extra_counters *ctr,
 		case H3_ST_QPACK_DECODER_STREAM_ERROR:
 			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->qpack_decoder_stream_error));
 			break;
+
+		/* QPACK dynamic table counters */
+		case H3_ST_QPACK_ENC_INSERT:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->qpack_enc_insert));
+			break;
+		case H3_ST_QPACK_ENC_EVICT:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->qpack_enc_evict));
+			break;
+		case H3_ST_QPACK_DEC_INSERT:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->qpack_dec_insert));
+			break;
+		case H3_ST_QPACK_DEC_EVICT:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->qpack_dec_evict));
+			break;
+		case H3_ST_QPACK_BLOCKED_STREAMS:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->qpack_blocked_streams));
+			break;
+		case H3_ST_QPACK_ENC_RAW_BYTES:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->qpack_enc_raw_bytes));
+			break;
+		case H3_ST_QPACK_ENC_BYTES:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->qpack_enc_bytes));
+			break;
+		case H3_ST_QPACK_ENC_RATIO: {
+			unsigned long long raw = EXTRA_COUNTERS_AGGR(ctr, counters->qpack_enc_raw_bytes);
+			unsigned long long enc = EXTRA_COUNTERS_AGGR(ctr, counters->qpack_enc_bytes);
+
+			metric = mkf_u32(FN_AVG, raw ? enc * 100 / raw : 0);
+			break;
+		}
+
+		/* RFC 9218 priorities counters */
+		case H3_ST_DATA_SENT_URG0:
+		case H3_ST_DATA_SENT_URG1:
+		case H3_ST_DATA_SENT_URG2:
+		case H3_ST_DATA_SENT_URG3:
+		case H3_ST_DATA_SENT_URG4:
+		case H3_ST_DATA_SENT_URG5:
+		case H3_ST_DATA_SENT_URG6:
+		case H3_ST_DATA_SENT_URG7:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->data_sent_urg[current_field - H3_ST_DATA_SENT_URG0]));
+			break;
 		default:
 			/* not used for frontends. If a specific metric
 			 * is requested, return an error. Otherwise continue.
@@ -352,7 +463,44 @@ void h3_inc_frame_type_cnt(struct h3_counters *ctrs, int frm_type)
 	case H3_FT_SETTINGS:
 		HA_ATOMIC_INC(&ctrs->h3_settings);
 		break;
+	case H3_FT_PRIORITY_UPDATE_REQ:
+	case H3_FT_PRIORITY_UPDATE_PUSH:
+		HA_ATOMIC_INC(&ctrs->h3_priority_update);
+		break;
 	default:
 		break;
 	}
 }
+
+/* Reports QPACK dynamic table activity: <ins> insertions and <evict> evictions
+ * into an encoder table if <enc> is set, otherwise a decoder table.
+ */
+void h3_add_qpack_tbl_cnt(struct h3_counters *ctrs, int enc, unsigned int ins, unsigned int evict)
+{
+	if (enc) {
+		HA_ATOMIC_ADD(&ctrs->qpack_enc_insert, ins);
+		HA_ATOMIC_ADD(&ctrs->qpack_enc_evict, evict);
+	}
+	else {
+		HA_ATOMIC_ADD(&ctrs->qpack_dec_insert, ins);
+		HA_ATOMIC_ADD(&ctrs->qpack_dec_evict, evict);
+	}
+}
+
+/* Reports <raw> bytes of header fields encoded into <enc> bytes by QPACK. */
+void h3_add_qpack_enc_bytes(struct h3_counters *ctrs, unsigned long long raw, unsigned long long enc)
+{
+	HA_ATOMIC_ADD(&ctrs->qpack_enc_raw_bytes, raw);
+	HA_ATOMIC_ADD(&ctrs->qpack_enc_bytes, enc);
+}
+
+void h3_inc_qpack_blocked_cnt(struct h3_counters *ctrs)
+{
+	HA_ATOMIC_INC(&ctrs->qpack_blocked_streams);
+}
+
+/* Reports <bytes> of DATA frames payload sent for a stream of urgency <urg>. */
+void h3_add_data_sent_cnt(struct h3_counters *ctrs, int urg, unsigned long long bytes)
+{
+	HA_ATOMIC_ADD(&ctrs->data_sent_urg[urg & 7], bytes);
+}
@@ -756,6 +756,9 @@ static void usage(char *name)
 		"        -L set local peer name (default to hostname)\n"
 		"        -p writes pids of all children to this file\n"
 		"        -dC[[key],line] display the configuration file, if there is a key, the file will be anonymised\n"
+#if defined(USE_URING)
+		"        -du disables io_uring usage even when available\n"
+#endif
 #if defined(USE_EPOLL)
 		"        -de disables epoll() usage even when available\n"
 #endif
@@ -1536,6 +1539,10 @@ void haproxy_init_args(int argc, char **argv)
 					deinit_and_exit(0);
 				}
 			}
+#if defined(USE_URING)
+			else if (*flag == 'd' && flag[1] == 'u')
+				global.tune.options &= ~GTUNE_USE_URING;
+#endif
 #if defined(USE_EPOLL)
 			else if (*flag == 'd' && flag[1] == 'e')
 				global.tune.options &= ~GTUNE_USE_EPOLL;
@@ -1819,6 +1826,9 @@ static void init_args(int argc, char **argv)
 #if defined(USE_EPOLL)
 	global.tune.options |= GTUNE_USE_EPOLL;
 #endif
+#if defined(USE_URING)
+	global.tune.options |= GTUNE_USE_URING;
+#endif
 #if defined(USE_KQUEUE)
 	global.tune.options |= GTUNE_USE_KQUEUE;
 #endif
@@ -2439,6 +2449,9 @@ static void step_init_2(int argc, char** argv)
 	if (!(global.tune.options & GTUNE_USE_EVPORTS))
 		disable_poller("evports");
 
+	if (!(global.tune.options & GTUNE_USE_URING))
+		disable_poller("io_uring");
+
 	if (!(global.tune.options & GTUNE_USE_EPOLL))
 		disable_poller("epoll");
 
@@ -28,6 +28,7 @@
 #include <haproxy/hlua.h>
 #include <haproxy/hlua_fcn.h>
 #include <haproxy/http.h>
+#include <haproxy/mapsnap.h>
 #include <haproxy/net_helper.h>
 #include <haproxy/pattern.h>
 #include <haproxy/protocol.h>
@@ -3156,6 +3157,34 @@ static int _hlua_listable_patref_pairs_iterator(lua_State *L, int status, lua_KC
 	else
 		curr_gen = hctx->ref->ptr->curr_gen;
 
+	/* entries from a snapshot come first, as long as it is still there */
+	if (hctx->snap) {
+		const struct mapsnap *snap = hctx->snap;
+		const struct mapsnap_ent *ent;
+		struct buffer *key, *val;
+
+		if (snap == hctx->ref->ptr->snap && snap->gen_id == curr_gen &&
+		    hctx->snap_idx < snap->hdr->nb_ents) {
+			/* copy them before unlocking */
+			ent = &snap->ents[hctx->snap_idx++];
+			key = get_trash_chunk();
+			val = get_trash_chunk();
+			chunk_strcpy(key, mapsnap_key(snap, ent));
+			if (mapsnap_val(snap, ent))
+				chunk_strcpy(val, mapsnap_val(snap, ent));
+			else
+				val = NULL;
+			HA_RWLOCK_WRUNLOCK(PATREF_LOCK, &hctx->ref->ptr->lock);
+
+			lua_pushlstring(L, key->area, key->data);
+			if (!val)
+				return 1;
+			lua_pushlstring(L, val->area, val->data);
+			return 2;
+		}
+		hctx->snap = NULL;
+	}
+
 	if (LIST_ISEMPTY(&hctx->bref.users)) {
 		/* first iteration */
 		hctx->gen = pat_ref_gen_get(hctx->ref->ptr, curr_gen);
@@ -3217,6 +3246,10 @@ int hlua_listable_patref_pairs(lua_State *L)
 	ctx = lua_newuserdata(L, sizeof(*ctx));
 	ctx->ref = ref;
 	LIST_INIT(&ctx->bref.users);
+	HA_RWLOCK_RDLOCK(PATREF_LOCK, &ref->ptr->lock);
+	ctx->snap = ref->ptr->snap;
+	HA_RWLOCK_RDUNLOCK(PATREF_LOCK, &ref->ptr->lock);
+	ctx->snap_idx = 0;
 
 	lua_pushcclosure(L, hlua_listable_patref_pairs_iterator, 1);
 	return 1;
@@ -31,8 +31,14 @@
 #include <string.h>
 
 #include <import/ist.h>
+#include <haproxy/buf.h>
+#include <haproxy/h2.h>
+#include <haproxy/hpack-dec.h>
 #include <haproxy/hpack-enc.h>
+#include <haproxy/hpack-tbl.h>
 #include <haproxy/http-hdr-t.h>
+#include <haproxy/init.h>
+#include <haproxy/pool.h>
 
 /*
  * HPACK encoding: these tables were generated using gen-enc.c
@@ -138,6 +144,33 @@ const signed short hpack_pos_len[32] = {
          /*   24: */   -1,  609,   -1,  636,   -1,   -1,   -1,   -1,
 };
 
+/* Returns the static table index of the first entry named <n>, or zero if
+ * there is none.
+ */
+static int hpack_find_static_name(const struct ist n)
+{
+	int pos;
+
+	if (n.len >= sizeof(hpack_pos_len) / sizeof(hpack_pos_len[0]))
+		return 0;
+
+	pos = hpack_pos_len[n.len];
+	if (pos < 0)
+		return 0;
+
+	do {
+		char idx;
+
+		pos++;
+		idx = hpack_enc_stream[pos++];
+		pos += n.len;
+		if (isteq(ist2(&hpack_enc_stream[pos - n.len], n.len), n))
+			return (unsigned char)idx;
+	} while ((unsigned char)hpack_enc_stream[pos] == n.len);
+
+	return 0;
+}
+
 /* Tries to encode header whose name is <n> and value <v> into the chunk <out>.
  * Returns non-zero on success, 0 on failure (buffer full).
  */
@@ -152,29 +185,15 @@ int hpack_encode_header(struct buffer *out, const struct ist n,
 		return 0;
 
 	/* look for the header field <n> in the static table */
-	if (n.len >= sizeof(hpack_pos_len) / sizeof(hpack_pos_len[0]))
-		goto make_literal;
-
-	pos = hpack_pos_len[n.len];
-	if (pos >= 0) {
-		/* At least one header field of this length exist */
-		do {
-			char idx;
-
-			pos++;
-			idx = hpack_enc_stream[pos++];
-			pos += n.len;
-			if (isteq(ist2(&hpack_enc_stream[pos - n.len], n.len), n)) {
-				/* emit literal with indexing (7541#6.2.1) :
-				 * [ 0 | 1 | Index (6+) ]
-				 */
-				out->area[len++] = idx | 0x40;
-				goto emit_value;
-			}
-		} while ((unsigned char)hpack_enc_stream[pos] == n.len);
+	pos = hpack_find_static_name(n);
+	if (pos) {
+		/* emit literal with indexing (7541#6.2.1) :
+		 * [ 0 | 1 | Index (6+) ]
+		 */
+		out->area[len++] = pos | 0x40;
+		goto emit_value;
 	}
 
- make_literal:
 	if (likely(n.len < 127 && len + 2 + n.len <= size)) {
 		out->area[len++] = 0x00;      /* literal without indexing -- new name */
 		out->area[len++] = n.len;     /* single-byte length encoding */
@@ -208,3 +227,244 @@ int hpack_encode_header(struct buffer *out, const struct ist n,
 	out->data = len;
 	return 1;
 }
+
+/* Returns non-zero if header field <n> must never be indexed because its value
+ * is sensitive (RFC7541#7.1.3). These ones are emitted using the "never
+ * indexed" representation so that intermediaries do not index them either.
+ */
+static inline int hpack_never_index(const struct ist n)
+{
+	return isteq(n, ist("authorization")) ||
+	       isteq(n, ist("proxy-authorization")) ||
+	       isteq(n, ist("cookie")) ||
+	       isteq(n, ist("set-cookie"));
+}
+
+/* Returns non-zero if header field <n> with value <v> is worth inserting into
+ * dynamic table <dht>. Fields which are too large would flush most of the
+ * table, and some fields almost always carry a different value per message so
+ * they would only evict useful entries.
+ */
+static inline int hpack_worth_indexing(const struct hpack_dht *dht, const struct ist n, const struct ist v)
+{
+	if ((n.len + v.len + 32) * 4 > dht->size * 3)
+		return 0;
+
+	return !isteq(n, ist(":path")) &&
+	       !isteq(n, ist("age")) &&
+	       !isteq(n, ist("content-length")) &&
+	       !isteq(n, ist("etag")) &&
+	       !isteq(n, ist("if-modified-since")) &&
+	       !isteq(n, ist("if-none-match")) &&
+	       !isteq(n, ist("last-modified")) &&
+	       !isteq(n, ist("location"));
+}
+
+/* Tries to encode header whose name is <n> and value <v> into the chunk <out>,
+ * taking advantage of the encoder's dynamic table <dht> which must exactly
+ * mirror the peer's decoding table. Exact matches in the static or dynamic
+ * table are emitted as indexed fields, otherwise a literal is emitted with a
+ * name index when possible, either with incremental indexing, without
+ * indexing, or never indexed for sensitive fields. The table is never modified
+ * here. Instead, HPACK_ENC_INSERT is returned when the field was emitted with
+ * incremental indexing, in which case the caller must insert it into <dht>
+ * using hpack_dht_insert() before encoding any other field. HPACK_ENC_DONE is
+ * returned when no insertion is needed, and HPACK_ENC_FAIL if the buffer is
+ * full. If <saved> is not NULL, it receives the number of bytes saved compared
+ * to what the static table alone would have permitted.
+ */
+int hpack_encode_header_dht(struct buffer *out, const struct hpack_dht *dht,
+                            const struct ist n, const struct ist v, int *saved)
+{
+	const struct hpack_dte *dte;
+	int len = out->data;
+	int size = out->size;
+	int sidx, nidx, didx;
+	int base, i;
+	uint slot;
+	int ret = HPACK_ENC_DONE;
+	uint8_t opcode;
+	int bits;
+
+	/* look for the name, then for the whole field in the static table */
+	sidx = hpack_find_static_name(n);
+	for (i = sidx; sidx && i < HPACK_SHT_SIZE && isteq(hpack_sht[i].n, n); i++) {
+		if (hpack_sht[i].v.len && isteq(hpack_sht[i].v, v)) {
+			if (len >= size)
+				return HPACK_ENC_FAIL;
+			/* indexed field (7541#6.1) : [ 1 | Index (7+) ] */
+			out->area[len++] = 0x80 | i;
+			out->data = len;
+			if (saved)
+				*saved = 0;
+			return HPACK_ENC_DONE;
+		}
+	}
+
+	/* this is what the static table alone would have produced */
+	base = (sidx ? 1 : 1 + hpack_len_to_bytes(n.len) + n.len) + hpack_len_to_bytes(v.len) + v.len;
+
+	/* now look for the field in the dynamic table, newest first */
+	nidx = didx = 0;
+	for (i = 1, slot = dht->head; i <= dht->used; i++, slot = (slot ? slot : dht->wrap) - 1) {
+		dte = &dht->dte[slot];
+		if (dte->nlen != n.len || !isteq(hpack_get_name(dht, dte), n))
+			continue;
+
+		if (!nidx)
+			nidx = HPACK_SHT_SIZE - 1 + i;
+
+		if (dte->vlen == v.len && isteq(hpack_get_value(dht, dte), v)) {
+			didx = HPACK_SHT_SIZE - 1 + i;
+			break;
+		}
+	}
+
+	if (didx) {
+		if (len + hpack_int_to_bytes(7, didx) > size)
+			return HPACK_ENC_FAIL;
+		len = hpack_encode_int(out->area, len, 0x80, 7, didx);
+		goto done;
+	}
+
+	if (hpack_never_index(n)) {
+		/* literal never indexed (7541#6.2.3) : [ 0 | 0 | 0 | 1 | Index (4+) ] */
+		opcode = 0x10;
+		bits = 4;
+	}
+	else if (hpack_worth_indexing(dht, n, v)) {
+		/* literal with incremental indexing (7541#6.2.1) : [ 0 | 1 | Index (6+) ] */
+		opcode = 0x40;
+		bits = 6;
+		ret = HPACK_ENC_INSERT;
+	}
+	else {
+		/* literal without indexing (7541#6.2.2) : [ 0 | 0 | 0 | 0 | Index (4+) ] */
+		opcode = 0x00;
+		bits = 4;
+	}
+
+	/* the static name is always the cheapest, and a dynamic name is only
+	 * used when it's shorter than the literal name.
+	 */
+	if (sidx)
+		nidx = sidx;
+	else if (nidx && hpack_int_to_bytes(bits, nidx) >= 1 + hpack_len_to_bytes(n.len) + n.len)
+		nidx = 0;
+
+	if (nidx) {
+		if (len + hpack_int_to_bytes(bits, nidx) > size)
+			return HPACK_ENC_FAIL;
+		len = hpack_encode_int(out->area, len, opcode, bits, nidx);
+	}
+	else {
+		if (!hpack_len_to_bytes(n.len) ||
+		    len + 1 + hpack_len_to_bytes(n.len) + n.len > size)
+			return HPACK_ENC_FAIL;
+		out->area[len++] = opcode;
+		len = hpack_encode_len(out->area, len, n.len);
+		ist2bin(out->area + len, n);
+		len += n.len;
+	}
+
+	if (!hpack_len_to_bytes(v.len) ||
+	    len + hpack_len_to_bytes(v.len) + v.len > size)
+		return HPACK_ENC_FAIL;
+
+	len = hpack_encode_len(out->area, len, v.len);
+	memcpy(out->area + len, v.ptr, v.len);
+	len += v.len;
+
+ done:
+	if (saved)
+		*saved = base - (len - (int)out->data);
+	out->data = len;
+	return ret;
+}
+
+/* Encodes a series of header blocks using a dynamic table and checks that
+ * they are properly decoded by our decoder, whose table must remain in sync.
+ * Returns 0 on success, non-zero on failure.
+ */
+int hpack_enc_unittest(int argc, char **argv)
+{
+	static const struct http_hdr fields[] = {
+		{ IST(":status"),        IST("200")                         },
+		{ IST(":status"),        IST("302")                         },
+		{ IST("server"),         IST("haproxy")                     },
+		{ IST("content-type"),   IST("application/json")            },
+		{ IST("content-type"),   IST("text/html; charset=utf-8")    },
+		{ IST("cache-control"),  IST("private, max-age=0")          },
+		{ IST("content-length"), IST("1234")                        },
+		{ IST("set-cookie"),     IST("SESSID=0123456789abcdef")     },
+		{ IST("x-request-id"),   IST("ad8a1f0d-6f1b-4b8a-b1b9")     },
+		{ IST("x-custom"),       IST("some rather long value that will evict other entries from the table sooner") },
+		{ IST("accept-encoding"),IST("gzip, deflate")               },
+		{ IST("vary"),           IST("accept-encoding")             },
+	};
+	struct http_hdr list[32];
+	struct hpack_dht *edht = NULL, *ddht = NULL;
+	char out_area[1024], tmp_area[1024];
+	struct buffer out, tmp;
+	uint32_t rnd = 0x12345678;
+	int blk, fld, nbf, ret, saved;
+	int total_saved = 0;
+	int err = 1;
+
+	if (!pool_head_hpack_tbl)
+		pool_head_hpack_tbl = create_pool("hpack_tbl", 4096, MEM_F_SHARED|MEM_F_EXACT);
+
+	edht = hpack_dht_alloc();
+	ddht = hpack_dht_alloc();
+	if (!edht || !ddht)
+		goto out;
+
+	for (blk = 0; blk < 1000; blk++) {
+		int picked[8];
+
+		out = b_make(out_area, sizeof(out_area), 0, 0);
+		rnd = rnd * 1103515245 + 12345;
+		nbf = 1 + (rnd >> 16) % 8;
+		for (fld = 0; fld < nbf; fld++) {
+			rnd = rnd * 1103515245 + 12345;
+			picked[fld] = (rnd >> 16) % (sizeof(fields) / sizeof(fields[0]));
+			ret = hpack_encode_header_dht(&out, edht, fields[picked[fld]].n, fields[picked[fld]].v, &saved);
+			if (ret == HPACK_ENC_FAIL)
+				goto out;
+			if (ret == HPACK_ENC_INSERT &&
+			    hpack_dht_insert(edht, fields[picked[fld]].n, fields[picked[fld]].v) < 0)
+				goto out;
+			total_saved += saved;
+		}
+
+		tmp = b_make(tmp_area, sizeof(tmp_area), 0, 0);
+		ret = hpack_decode_frame(ddht, (const uint8_t *)out.area, out.data,
+		                         list, sizeof(list) / sizeof(list[0]), &tmp);
+		/* the end marker is counted */
+		if (ret != nbf + 1)
+			goto out;
+
+		for (fld = 0; fld < nbf; fld++) {
+			struct ist n = list[fld].n;
+
+			if (!isttest(n))
+				n = h2_phdr_to_ist(n.len);
+			if (!isteq(n, fields[picked[fld]].n) || !isteq(list[fld].v, fields[picked[fld]].v))
+				goto out;
+		}
+
+		if (edht->used != ddht->used || edht->total != ddht->total)
+			goto out;
+	}
+
+	/* shrinking the table must only evict the oldest entries */
+	if (hpack_dht_resize(edht, 256) < 0 || edht->used * 32 + edht->total > 256)
+		goto out;
+
+	err = !total_saved;
+ out:
+	hpack_dht_free(edht);
+	hpack_dht_free(ddht);
+	return err;
+}
+REGISTER_UNITTEST("hpack_enc", hpack_enc_unittest);
@@ -169,6 +169,8 @@ static struct hpack_dht *hpack_dht_defrag(struct hpack_dht *dht)
 	if (!alt_dht)
 		return NULL;
 
+	/* the table may be smaller than the pool's size (e.g. HPACK encoder) */
+	alt_dht->size = dht->size;
 	alt_dht->total = dht->total;
 	alt_dht->used = dht->used;
 	alt_dht->wrap = dht->used;
@@ -370,3 +372,31 @@ int hpack_dht_insert(struct hpack_dht *dht, struct ist name, struct ist value)
 	memcpy((void *)dht + dht->dte[head].addr + name.len, value.ptr, value.len);
 	return 0;
 }
+
+/* Changes the size of table <dht> to <size> bytes, as requested by a dynamic
+ * table size update (RFC7541#4.3). The new size must not be larger than the
+ * area allocated for the table. The oldest entries are evicted until the
+ * remaining ones fit, and the table is repacked at the end of its new area.
+ * Returns 0 on success or a negative value if the table could not be repacked,
+ * in which case it must not be used anymore.
+ */
+int hpack_dht_resize(struct hpack_dht *dht, uint32_t size)
+{
+	unsigned int tail;
+
+	while (dht->used && dht->used * 32 + dht->total > size) {
+		tail = hpack_dht_get_tail(dht);
+		dht->total -= dht->dte[tail].nlen + dht->dte[tail].vlen;
+		if (tail == dht->front)
+			dht->front = dht->head;
+		dht->used--;
+	}
+
+	dht->size = size;
+	if (!dht->used) {
+		dht->front = dht->head = 0;
+		return 0;
+	}
+
+	return hpack_dht_defrag(dht) ? 0 : -1;
+}
@@ -1154,6 +1154,59 @@ int http_parse_qvalue(const char *qvalue, const char **end)
 	return q;
 }
 
+/* Parses the value of an RFC9218 "priority" header field or of a
+ * PRIORITY_UPDATE frame's priority field value, which is a structured field
+ * dictionary. Only the "u" (urgency, 0 to 7) and "i" (incremental, boolean)
+ * members are considered, any other member, parameter or invalid value is
+ * silently ignored as mandated by the spec. <urg> and <incr> must be
+ * initialized by the caller to the values to preserve when the members are
+ * absent (3 and 0 by default). Always returns 1.
+ */
+int http_parse_priority(const struct ist value, int *urg, int *incr)
+{
+	const char *p = istptr(value);
+	const char *end = istend(value);
+
+	while (p < end) {
+		const char *key, *key_end;
+
+		while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+			p++;
+
+		key = p;
+		while (p < end && *p != '=' && *p != ';' && *p != ',')
+			p++;
+		key_end = p;
+		while (key_end > key && (key_end[-1] == ' ' || key_end[-1] == '\t'))
+			key_end--;
+
+		if (p < end && *p == '=') {
+			const char *val = ++p;
+
+			while (p < end && *p != ';' && *p != ',')
+				p++;
+
+			if (key_end - key == 1 && *key == 'u') {
+				if (p - val == 1 && *val >= '0' && *val <= '7')
+					*urg = *val - '0';
+			}
+			else if (key_end - key == 1 && *key == 'i') {
+				if (p - val == 2 && val[0] == '?' && (val[1] == '0' || val[1] == '1'))
+					*incr = val[1] - '0';
+			}
+		}
+		else if (key_end - key == 1 && *key == 'i') {
+			/* bare boolean member means true */
+			*incr = 1;
+		}
+
+		/* skip parameters up to the next member */
+		while (p < end && *p != ',')
+			p++;
+	}
+	return 1;
+}
+
 /*
  * Given a url parameter, find the starting position of the first occurrence,
  * or NULL if the parameter is not found.
@@ -1486,7 +1539,7 @@ struct ist http_trim_trailing_spht(struct ist value)
 {
 	struct ist ret = value;
 
-	while (ret.len && HTTP_IS_SPHT(ret.ptr[-1]))
+	while (ret.len && HTTP_IS_SPHT(ret.ptr[ret.len - 1]))
 		--ret.len;
 
 	return ret;
@@ -3958,11 +3958,6 @@ void http_check_request_for_cacheability(struct stream *s, struct channel *req)
 void http_check_response_for_cacheability(struct stream *s, struct channel *res)
 {
 	struct http_txn *txn = s->txn;
-	struct http_hdr_ctx ctx = { .blk = NULL };
-	struct htx *htx;
-	int has_freshness_info = 0;
-	int has_validator = 0;
-	int has_null_maxage = 0;
 
 	if (txn->status < 200) {
 		/* do not try to cache interim responses! */
@@ -3970,13 +3965,25 @@ void http_check_response_for_cacheability(struct stream *s, struct channel *res)
 		return;
 	}
 
-	htx = htxbuf(&res->buf);
+	txn->flags = http_check_htx_response_for_cacheability(htxbuf(&res->buf), txn->flags);
+}
+
+/*
+ * Check if the final response in <htx> is cacheable or not, based on its
+ * headers. Returns <flags> with the TX_CACHEABLE and TX_CACHE_COOK flags
+ * updated accordingly.
+ */
+unsigned int http_check_htx_response_for_cacheability(struct htx *htx, unsigned int flags)
+{
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	int has_freshness_info = 0;
+	int has_validator = 0;
+	int has_null_maxage = 0;
+
 	/* Check "pragma" header for HTTP/1.0 compatibility. */
 	if (http_find_header(htx, ist("pragma"), &ctx, 1)) {
-		if (isteqi(ctx.value, ist("no-cache"))) {
-			txn->flags &= ~TX_CACHEABLE & ~TX_CACHE_COOK;
-			return;
-		}
+		if (isteqi(ctx.value, ist("no-cache")))
+			return flags & ~TX_CACHEABLE & ~TX_CACHE_COOK;
 	}
 
 	/* Look for "cache-control" header and iterate over all the values
@@ -3984,7 +3991,7 @@ void http_check_response_for_cacheability(struct stream *s, struct channel *res)
 	ctx.blk = NULL;
 	while (http_find_header(htx, ist("cache-control"), &ctx, 0)) {
 		if (isteqi(ctx.value, ist("public"))) {
-			txn->flags |= TX_CACHEABLE | TX_CACHE_COOK;
+			flags |= TX_CACHEABLE | TX_CACHE_COOK;
 			continue;
 		}
 		/* This max-age might be overridden by a s-maxage directive, do
@@ -3998,12 +4005,12 @@ void http_check_response_for_cacheability(struct stream *s, struct channel *res)
 		    isteqi(ctx.value, ist("no-cache")) ||
 		    isteqi(ctx.value, ist("no-store")) ||
 		    isteqi(ctx.value, ist("s-maxage=0"))) {
-			txn->flags &= ~TX_CACHEABLE & ~TX_CACHE_COOK;
+			flags &= ~TX_CACHEABLE & ~TX_CACHE_COOK;
 			continue;
 		}
 		/* We might have a no-cache="set-cookie" form. */
 		if (istmatchi(ctx.value, ist("no-cache=\"set-cookie"))) {
-			txn->flags &= ~TX_CACHE_COOK;
+			flags &= ~TX_CACHE_COOK;
 			continue;
 		}
 
@@ -4021,7 +4028,7 @@ void http_check_response_for_cacheability(struct stream *s, struct channel *res)
 	/* We had a 'max-age=0' directive but no extra s-maxage, do not cache
 	 * the response. */
 	if (has_null_maxage) {
-		txn->flags &= ~TX_CACHEABLE & ~TX_CACHE_COOK;
+		flags &= ~TX_CACHEABLE & ~TX_CACHE_COOK;
 	}
 
 	/* If no freshness information could be found in Cache-Control values,
@@ -4046,7 +4053,9 @@ void http_check_response_for_cacheability(struct stream *s, struct channel *res)
 	/* We won't store an entry that has neither a cache validator nor an
 	 * explicit expiration time, as suggested in RFC 7234#3. */
 	if (!has_freshness_info && !has_validator)
-		txn->flags &= ~TX_CACHEABLE;
+		flags &= ~TX_CACHEABLE;
+
+	return flags;
 }
 
 /*
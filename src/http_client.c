@@ -277,6 +277,20 @@ int httpclient_set_dst(struct httpclient *hc, const char *dst)
 	return 0;
 }
 
+/*
+ * Makes the httpclient connect to server <srv> of another proxy with its own
+ * settings (address, SSL, PROXY protocol, source...) instead of the servers of
+ * its proxy, whatever the scheme of the URL. The destination is the server's
+ * address unless httpclient_set_dst() is used. A reference is kept on the
+ * server until the httpclient is destroyed.
+ */
+void httpclient_set_server(struct httpclient *hc, struct server *srv)
+{
+	srv_take(srv);
+	srv_drop(hc->srv);
+	hc->srv = srv;
+}
+
 /*
  * Split <url> in <scheme>, <host>, <port>
  */
@@ -424,6 +438,7 @@ void httpclient_destroy(struct httpclient *hc)
 
 	b_free(&hc->res.buf);
 	sockaddr_free(&hc->dst);
+	srv_drop(hc->srv);
 
 	free(hc);
 
@@ -910,6 +925,12 @@ int httpclient_applet_init(struct appctx *appctx)
 	if (hc->dst) {
 		/* if httpclient_set_dst() was used, sets the alternative address */
 		ss_dst = hc->dst;
+	} else if (hc->srv) {
+		/* the address of the server set by httpclient_set_server() */
+		ss_url = hc->srv->addr;
+		ss_dst = &ss_url;
+		if (is_inet_addr(ss_dst))
+			set_host_port(ss_dst, hc->srv->svc_port);
 	} else {
 		/* set the dst using the host, or 0.0.0.0 to resolve */
 		ist2str(trash.area, host);
@@ -924,24 +945,31 @@ int httpclient_applet_init(struct appctx *appctx)
 	if (!sockaddr_alloc(&addr, ss_dst, sizeof(*ss_dst)))
 		goto out_error;
 
-	/* choose the SSL server or not */
-	switch (scheme) {
-		case SCH_HTTP:
-			target = &hc->srv_raw->obj_type;
-			break;
-		case SCH_HTTPS:
+	/* a server set by httpclient_set_server() is used whatever the scheme,
+	 * otherwise choose the SSL server or not
+	 */
+	if (hc->srv) {
+		target = &hc->srv->obj_type;
+	}
+	else {
+		switch (scheme) {
+			case SCH_HTTP:
+				target = &hc->srv_raw->obj_type;
+				break;
+			case SCH_HTTPS:
 #ifdef USE_OPENSSL
-			if (hc->srv_ssl) {
-				target = &hc->srv_ssl->obj_type;
-			} else {
-				ha_alert("httpclient: SSL was disabled (wrong verify/ca-file)!\n");
-				goto out_free_addr;
-			}
+				if (hc->srv_ssl) {
+					target = &hc->srv_ssl->obj_type;
+				} else {
+					ha_alert("httpclient: SSL was disabled (wrong verify/ca-file)!\n");
+					goto out_free_addr;
+				}
 #else
-			ha_alert("httpclient: OpenSSL is not available %s:%d.\n", __FUNCTION__, __LINE__);
-			goto out_free_addr;
+				ha_alert("httpclient: OpenSSL is not available %s:%d.\n", __FUNCTION__, __LINE__);
+				goto out_free_addr;
 #endif
-			break;
+				break;
+		}
 	}
 
 	if (appctx_finalize_startup(appctx, hc->px, &hc->req.buf) == -1) {
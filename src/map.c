@@ -18,6 +18,7 @@
 #include <haproxy/arg.h>
 #include <haproxy/cli.h>
 #include <haproxy/map.h>
+#include <haproxy/mapsnap.h>
 #include <haproxy/pattern.h>
 #include <haproxy/regex.h>
 #include <haproxy/sample.h>
@@ -187,8 +188,11 @@ static int sample_conv_map_key(const struct arg *arg_p, struct sample *smp, void
 	if (pat) {
 		smp->data.type = SMP_T_STR;
 		smp->flags |= SMP_F_CONST;
-		smp->data.u.str.area = (char *)pat->ref->pattern;
-		smp->data.u.str.data = strlen(pat->ref->pattern);
+		if (pat->sflags & PAT_SF_SNAP)
+			smp->data.u.str.area = pat->ptr.str;
+		else
+			smp->data.u.str.area = (char *)pat->ref->pattern;
+		smp->data.u.str.data = strlen(smp->data.u.str.area);
 		return 1;
 	}
 	return 0;
@@ -362,8 +366,11 @@ struct show_map_ctx {
 	unsigned int curr_gen;  /* current/latest generation, for show/clear */
 	unsigned int prev_gen;  /* prev generation, for clear */
 	struct pat_ref_gen *gen; /* link to the generation being displayed, for show */
+	const struct mapsnap *snap; /* snapshot being displayed, for show */
+	unsigned int snap_idx;  /* next snapshot entry to display */
 	enum {
 		STATE_INIT = 0, /* initialize list and backrefs */
+		STATE_SNAP,     /* list snapshot entries */
 		STATE_LIST,     /* list entries */
 		STATE_DONE,     /* finished */
 	} state;                /* state of the dump */
@@ -373,10 +380,41 @@ struct show_map_ctx {
 static int cli_io_handler_pat_list(struct appctx *appctx)
 {
 	struct show_map_ctx *ctx = appctx->svcctx;
+	const struct mapsnap_ent *ent;
 	struct pat_ref_elt *elt;
 
 	switch (ctx->state) {
 	case STATE_INIT:
+		ctx->snap = ctx->ref->snap;
+		ctx->snap_idx = 0;
+		ctx->state = STATE_SNAP;
+		__fallthrough;
+
+	case STATE_SNAP:
+		/* the snapshot's entries come first. It may have been released
+		 * or converted to regular entries in the mean time.
+		 */
+		HA_RWLOCK_RDLOCK(PATREF_LOCK, &ctx->ref->lock);
+		while (ctx->snap && ctx->snap == ctx->ref->snap && ctx->snap->gen_id == ctx->curr_gen &&
+		       ctx->snap_idx < ctx->snap->hdr->nb_ents) {
+			chunk_reset(&trash);
+
+			ent = &ctx->snap->ents[ctx->snap_idx];
+			if (mapsnap_val(ctx->snap, ent))
+				chunk_appendf(&trash, "%p %s %s\n",
+				              ent, mapsnap_key(ctx->snap, ent),
+				              mapsnap_val(ctx->snap, ent));
+			else
+				chunk_appendf(&trash, "%p %s\n",
+				              ent, mapsnap_key(ctx->snap, ent));
+
+			if (applet_putchk(appctx, &trash) == -1) {
+				HA_RWLOCK_RDUNLOCK(PATREF_LOCK, &ctx->ref->lock);
+				return 0;
+			}
+			ctx->snap_idx++;
+		}
+		HA_RWLOCK_RDUNLOCK(PATREF_LOCK, &ctx->ref->lock);
 		ctx->state = STATE_LIST;
 		__fallthrough;
 
@@ -464,10 +502,12 @@ static int cli_io_handler_pats_list(struct appctx *appctx)
 			/* Build messages. If the reference is used by another category than
 			 * the listed categories, display the information in the message.
 			 */
-			chunk_appendf(&trash, "%d (%s) %s. curr_ver=%u next_ver=%u entry_cnt=%llu\n", ctx->ref->unique_id,
+			chunk_appendf(&trash, "%d (%s) %s. curr_ver=%u next_ver=%u entry_cnt=%llu", ctx->ref->unique_id,
 			              ctx->ref->reference ? ctx->ref->reference : "",
 			              ctx->ref->display, ctx->ref->curr_gen, ctx->ref->next_gen,
 			              ctx->ref->entry_cnt);
+			pat_ref_show_index(ctx->ref, &trash);
+			chunk_appendf(&trash, "\n");
 
 			if (applet_putchk(appctx, &trash) == -1) {
 				/* let's try again later from this stream. We add ourselves into
@@ -493,6 +533,8 @@ static int cli_io_handler_pats_list(struct appctx *appctx)
 static int cli_io_handler_map_lookup(struct appctx *appctx)
 {
 	struct show_map_ctx *ctx = appctx->svcctx;
+	const struct mapsnap_ent *ent;
+	const char *key, *value;
 	struct sample sample;
 	struct pattern *pat;
 	int match_method;
@@ -518,11 +560,14 @@ static int cli_io_handler_map_lookup(struct appctx *appctx)
 			sample.data.u.str.data = ctx->chunk.data;
 			sample.data.u.str.area = ctx->chunk.area;
 
+			/* the expression's indexes may be rebuilt meanwhile */
+			HA_RWLOCK_RDLOCK(PATEXP_LOCK, &ctx->expr->lock);
 			if (ctx->expr->pat_head->match &&
 			    sample_convert(&sample, ctx->expr->pat_head->expect_type))
 				pat = ctx->expr->pat_head->match(&sample, ctx->expr, 1);
 			else
 				pat = NULL;
+			HA_RWLOCK_RDUNLOCK(PATEXP_LOCK, &ctx->expr->lock);
 
 			/* build return message: set type of match */
 			for (match_method=0; match_method<PAT_MATCH_NUM; match_method++)
@@ -556,29 +601,46 @@ static int cli_io_handler_map_lookup(struct appctx *appctx)
 					chunk_appendf(&trash, ", match=yes");
 
 				/* display index mode */
-				if (pat->sflags & PAT_SF_TREE)
+				if (pat->sflags & PAT_SF_SNAP)
+					chunk_appendf(&trash, ", idx=snapshot");
+				else if (pat->sflags & PAT_SF_TREE)
 					chunk_appendf(&trash, ", idx=tree");
 				else
 					chunk_appendf(&trash, ", idx=list");
 
 				/* display pattern */
+				key = NULL;
+				if (pat->sflags & PAT_SF_SNAP)
+					key = pat->ptr.str;
+				else if (pat->ref)
+					key = pat->ref->pattern;
+
 				if (ctx->display_flags == PAT_REF_MAP) {
-					if (pat->ref)
-						chunk_appendf(&trash, ", key=\"%s\"", pat->ref->pattern);
+					if (key)
+						chunk_appendf(&trash, ", key=\"%s\"", key);
 					else
 						chunk_appendf(&trash, ", key=unknown");
 				}
 				else {
-					if (pat->ref)
-						chunk_appendf(&trash, ", pattern=\"%s\"", pat->ref->pattern);
+					if (key)
+						chunk_appendf(&trash, ", pattern=\"%s\"", key);
 					else
 						chunk_appendf(&trash, ", pattern=unknown");
 				}
 
 				/* display return value */
+				value = NULL;
+				if (!pat->data)
+					;
+				else if ((pat->sflags & PAT_SF_SNAP) && ctx->ref->snap &&
+				         (ent = mapsnap_lookup(ctx->ref->snap, key, strlen(key))))
+					value = mapsnap_val(ctx->ref->snap, ent);
+				else if (pat->ref)
+					value = pat->ref->sample;
+
 				if (ctx->display_flags == PAT_REF_MAP) {
-					if (pat->data && pat->ref && pat->ref->sample)
-						chunk_appendf(&trash, ", value=\"%s\", type=\"%s\"", pat->ref->sample,
+					if (value)
+						chunk_appendf(&trash, ", value=\"%s\", type=\"%s\"", value,
 						              smp_to_type[pat->data->type]);
 					else
 						chunk_appendf(&trash, ", value=none");
@@ -1014,8 +1076,12 @@ static int cli_parse_del_map(char **args, char *payload, struct appctx *appctx,
 		 */
 		HA_RWLOCK_WRLOCK(PATREF_LOCK, &ctx->ref->lock);
 		if (!pat_ref_delete(ctx->ref, args[3])) {
+			int snap = pat_ref_snap_holds(ctx->ref, ctx->ref->curr_gen, args[3]);
+
 			HA_RWLOCK_WRUNLOCK(PATREF_LOCK, &ctx->ref->lock);
-			/* The entry is not found, send message. */
+			/* The entry is not found or read-only, send message. */
+			if (snap)
+				return cli_err(appctx, "Key belongs to a read-only snapshot.\n");
 			return cli_err(appctx, "Key not found.\n");
 		}
 		HA_RWLOCK_WRUNLOCK(PATREF_LOCK, &ctx->ref->lock);
@@ -0,0 +1,142 @@
+/*
+ * Precompiled map/ACL snapshots.
+ *
+ * A snapshot is produced offline by dev/mapsnap/mapsnap from a pattern file,
+ * and mapped read-only by the pattern file loader when it recognizes one. See
+ * include/haproxy/mapsnap-t.h for the format. Since the file is mapped shared,
+ * the old and new processes of a reload use the same page cache pages.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <haproxy/api.h>
+#include <haproxy/mapsnap.h>
+#include <haproxy/tools.h>
+
+/* Returns non-zero if the area of <nb> items of <size> bytes at offset <ofs>
+ * fits in the file described by <hdr>.
+ */
+static int mapsnap_area_ok(const struct mapsnap_hdr *hdr, uint64_t ofs, uint64_t nb, uint64_t size)
+{
+	return !(ofs & 7) && ofs >= sizeof(*hdr) && ofs <= hdr->size &&
+	       nb <= (hdr->size - ofs) / size;
+}
+
+/* Checks the consistency of the snapshot mapped at <hdr>, whose file is
+ * <size> bytes long, so that lookups never access anything out of it. Returns
+ * NULL if it is valid, otherwise a description of the problem.
+ */
+static const char *mapsnap_check(const struct mapsnap_hdr *hdr, size_t size)
+{
+	const struct mapsnap_ent *ents;
+	const struct mapsnap_slot *slots;
+	const char *str;
+	uint32_t i;
+
+	if (hdr->version != MAPSNAP_VERSION)
+		return "unsupported version";
+	if (hdr->endian != MAPSNAP_ENDIAN)
+		return "compiled on a machine of different endianness";
+	if (hdr->size != size)
+		return "truncated file";
+	if (hdr->nb_keys > hdr->nb_ents || (hdr->nb_keys && !hdr->nb_buckets))
+		return "invalid header";
+	if (!mapsnap_area_ok(hdr, hdr->ents_ofs, hdr->nb_ents, sizeof(*ents)) ||
+	    !mapsnap_area_ok(hdr, hdr->disp_ofs, hdr->nb_buckets, sizeof(uint32_t)) ||
+	    !mapsnap_area_ok(hdr, hdr->slots_ofs, hdr->nb_keys, sizeof(*slots)) ||
+	    !mapsnap_area_ok(hdr, hdr->str_ofs, hdr->str_len, 1) || !hdr->str_len)
+		return "invalid area";
+
+	ents = (const void *)hdr + hdr->ents_ofs;
+	slots = (const void *)hdr + hdr->slots_ofs;
+	str = (const void *)hdr + hdr->str_ofs;
+
+	/* the last string is terminated, so no string may go past the end */
+	if (str[hdr->str_len - 1] != '\0')
+		return "unterminated strings";
+
+	for (i = 0; i < hdr->nb_ents; i++) {
+		if (ents[i].key >= hdr->str_len || ents[i].klen > hdr->str_len - 1 - ents[i].key ||
+		    ((hdr->flags & MAPSNAP_F_SMP) && ents[i].val >= hdr->str_len))
+			return "invalid entry";
+	}
+
+	for (i = 0; i < hdr->nb_keys; i++) {
+		if (slots[i].ent >= hdr->nb_ents)
+			return "invalid hash slot";
+	}
+	return NULL;
+}
+
+/* Maps the snapshot from file descriptor <fd> of file <path>. Returns 1 and
+ * sets <snap> on success, 0 if the file is not a snapshot, in which case the
+ * file descriptor was not modified and the file may be parsed as text, or -1
+ * on error, with <err> filled.
+ */
+int mapsnap_open(int fd, const char *path, struct mapsnap **snap, char **err)
+{
+	struct mapsnap_hdr hdr;
+	struct mapsnap *ret;
+	struct stat st;
+	const char *msg;
+	ssize_t ret_len;
+	void *area;
+
+	ret_len = pread(fd, &hdr, sizeof(hdr), 0);
+	if (ret_len < (ssize_t)sizeof(hdr.magic) ||
+	    memcmp(hdr.magic, MAPSNAP_MAGIC, sizeof(hdr.magic)) != 0)
+		return 0;
+
+	/* a file starting with the magic is a snapshot, even a broken one */
+	if (ret_len != sizeof(hdr)) {
+		memprintf(err, "invalid snapshot <%s> : truncated file", path);
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		memprintf(err, "failed to stat snapshot <%s> : %s", path, strerror(errno));
+		return -1;
+	}
+
+	area = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (area == MAP_FAILED) {
+		memprintf(err, "failed to map snapshot <%s> : %s", path, strerror(errno));
+		return -1;
+	}
+
+	msg = mapsnap_check(area, st.st_size);
+	if (msg) {
+		memprintf(err, "invalid snapshot <%s> : %s", path, msg);
+		munmap(area, st.st_size);
+		return -1;
+	}
+
+	ret = calloc(1, sizeof(*ret));
+	if (!ret) {
+		memprintf(err, "out of memory");
+		munmap(area, st.st_size);
+		return -1;
+	}
+
+	ret->hdr   = area;
+	ret->ents  = area + ret->hdr->ents_ofs;
+	ret->disp  = area + ret->hdr->disp_ofs;
+	ret->slots = area + ret->hdr->slots_ofs;
+	ret->str   = area + ret->hdr->str_ofs;
+	*snap = ret;
+	return 1;
+}
+
+/* Unmaps and releases snapshot <snap> */
+void mapsnap_close(struct mapsnap *snap)
+{
+	if (!snap)
+		return;
+	munmap((void *)snap->hdr, snap->hdr->size);
+	free(snap);
+}
+
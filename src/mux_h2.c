@@ -43,6 +43,18 @@ static const struct h2s *h2_refused_stream;
 static const struct h2s *h2_idle_stream;
 
 
+/* maximum number of PRIORITY_UPDATE frames remembered per connection for
+ * streams which are not opened yet (RFC9218#7.1).
+ */
+#define H2C_PRIO_PEND_MAX 4
+
+/* RFC9218 priority received for a stream which is not opened yet */
+struct h2_prio_pend {
+	uint32_t sid;  /* stream ID, 0 if unused */
+	uint8_t urg;   /* urgency (0..7) */
+	uint8_t incr;  /* incremental flag (0 or 1) */
+};
+
 /**** H2 connection descriptor ****/
 struct h2c {
 	struct connection *conn;
@@ -68,10 +80,14 @@ struct h2c {
 	int8_t  dft; /* demux frame type   (if dsi >= 0) */
 	int8_t  dff; /* demux frame flags  (if dsi >= 0) */
 	uint8_t dpl; /* demux pad length (part of dfl), init to 0 */
-	/* 8 bit hole here */
+	uint8_t prio_pend_next; /* next prio_pend[] entry to replace when full */
 	int32_t last_sid; /* last processed stream ID for GOAWAY, <0 before preface */
 
 	/* states for the mux direction */
+	struct hpack_dht *edht; /* mux dynamic header table (HPACK encoder), or NULL */
+	uint32_t shts;          /* peer's SETTINGS_HEADER_TABLE_SIZE */
+	/* 32 bit hole here */
+	uint64_t hpack_saved;   /* HEADERS bytes saved thanks to the encoder's dynamic table */
 	struct buffer mbuf[H2C_MBUF_CNT];   /* mux buffers (ring) */
 	struct bl_elem *shared_rx_bufs;     /* shared rx bufs */
 	int32_t miw; /* mux initial window size for all new streams */
@@ -97,6 +113,7 @@ struct h2c {
 	struct list send_list; /* list of blocked streams requesting to send */
 	struct list fctl_list; /* list of streams blocked by connection's fctl */
 	struct list blocked_list; /* list of streams blocked for other reasons (e.g. sfctl, dep) */
+	struct h2_prio_pend prio_pend[H2C_PRIO_PEND_MAX]; /* priorities of streams not opened yet */
 	struct buffer_wait buf_wait; /* wait list for buffer allocations */
 	struct wait_event wait_event;  /* To be used if we're waiting for I/Os */
 
@@ -124,7 +141,9 @@ struct h2s {
 	uint64_t next_max_ofs; /* max stream offset that next WU must permit (curr_rx_ofs+rx_win) */
 	uint rx_head, rx_tail; /* head and tail of rx buffer in the conn's shared rx buf */
 	uint rx_count;         /* total number of allocated rxbufs */
-	/* 4 bytes hole here */
+	uint8_t urg;           /* RFC9218 urgency (0..7, 3 by default) */
+	uint8_t incr;          /* RFC9218 incremental flag (0 or 1) */
+	/* 2 bytes hole here */
 	struct wait_event *subs;  /* recv wait_event the stream connector associated is waiting on (via h2_subscribe) */
 	struct list list; /* To be used when adding in h2c->send_list or h2c->fctl_lsit */
 	struct tasklet *shut_tl;  /* deferred shutdown tasklet, to retry to send an RST after we failed to,
@@ -319,6 +338,18 @@ enum {
 	H2_ST_TOTAL_CONN,
 	H2_ST_TOTAL_STREAM,
 
+	H2_ST_HPACK_SAVED,
+
+	H2_ST_PRIO_UPDATE_RCVD,
+	H2_ST_DATA_SENT_URG0,
+	H2_ST_DATA_SENT_URG1,
+	H2_ST_DATA_SENT_URG2,
+	H2_ST_DATA_SENT_URG3,
+	H2_ST_DATA_SENT_URG4,
+	H2_ST_DATA_SENT_URG5,
+	H2_ST_DATA_SENT_URG6,
+	H2_ST_DATA_SENT_URG7,
+
 	H2_STATS_COUNT /* must be the last member of the enum */
 };
 
@@ -351,6 +382,28 @@ static struct stat_col h2_stats[] = {
 	                         .desc = "Total number of connections" },
 	[H2_ST_TOTAL_STREAM] = { .name = "h2_backend_total_streams",
 	                         .desc = "Total number of streams" },
+
+	[H2_ST_HPACK_SAVED]  = { .name = "h2_hpack_bytes_saved",
+	                         .desc = "Total number of HEADERS bytes saved by the HPACK encoder's dynamic table" },
+
+	[H2_ST_PRIO_UPDATE_RCVD] = { .name = "h2_priority_update_rcvd",
+	                             .desc = "Total number of received PRIORITY_UPDATE frames" },
+	[H2_ST_DATA_SENT_URG0]   = { .name = "h2_data_bytes_sent_urg0",
+	                             .desc = "Total number of DATA bytes sent for streams of urgency 0" },
+	[H2_ST_DATA_SENT_URG1]   = { .name = "h2_data_bytes_sent_urg1",
+	                             .desc = "Total number of DATA bytes sent for streams of urgency 1" },
+	[H2_ST_DATA_SENT_URG2]   = { .name = "h2_data_bytes_sent_urg2",
+	                             .desc = "Total number of DATA bytes sent for streams of urgency 2" },
+	[H2_ST_DATA_SENT_URG3]   = { .name = "h2_data_bytes_sent_urg3",
+	                             .desc = "Total number of DATA bytes sent for streams of urgency 3" },
+	[H2_ST_DATA_SENT_URG4]   = { .name = "h2_data_bytes_sent_urg4",
+	                             .desc = "Total number of DATA bytes sent for streams of urgency 4" },
+	[H2_ST_DATA_SENT_URG5]   = { .name = "h2_data_bytes_sent_urg5",
+	                             .desc = "Total number of DATA bytes sent for streams of urgency 5" },
+	[H2_ST_DATA_SENT_URG6]   = { .name = "h2_data_bytes_sent_urg6",
+	                             .desc = "Total number of DATA bytes sent for streams of urgency 6" },
+	[H2_ST_DATA_SENT_URG7]   = { .name = "h2_data_bytes_sent_urg7",
+	                             .desc = "Total number of DATA bytes sent for streams of urgency 7" },
 };
 
 static struct h2_counters {
@@ -369,6 +422,11 @@ static struct h2_counters {
 	long long open_streams;  /* count of currently open streams */
 	long long total_conns;   /* total number of connections */
 	long long total_streams; /* total number of streams */
+
+	long long hpack_saved;   /* total HEADERS bytes saved by the encoder's dynamic table */
+
+	long long prio_update_rcvd;  /* total number of PRIORITY_UPDATE frame received */
+	long long data_sent_urg[8];  /* total DATA bytes sent per RFC9218 urgency */
 } h2_counters;
 
 static int h2_fill_stats(struct stats_module *mod, struct extra_counters *ctr,
@@ -425,6 +483,22 @@ static int h2_fill_stats(struct stats_module *mod, struct extra_counters *ctr,
 		case H2_ST_TOTAL_STREAM:
 			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->total_streams));
 			break;
+		case H2_ST_HPACK_SAVED:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->hpack_saved));
+			break;
+		case H2_ST_PRIO_UPDATE_RCVD:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->prio_update_rcvd));
+			break;
+		case H2_ST_DATA_SENT_URG0:
+		case H2_ST_DATA_SENT_URG1:
+		case H2_ST_DATA_SENT_URG2:
+		case H2_ST_DATA_SENT_URG3:
+		case H2_ST_DATA_SENT_URG4:
+		case H2_ST_DATA_SENT_URG5:
+		case H2_ST_DATA_SENT_URG6:
+		case H2_ST_DATA_SENT_URG7:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->data_sent_urg[current_field - H2_ST_DATA_SENT_URG0]));
+			break;
 		default:
 			/* not used for frontends. If a specific metric
 			 * is requested, return an error. Otherwise continue.
@@ -481,6 +555,8 @@ enum {
 
 /* a few settings from the global section */
 static int h2_settings_header_table_size      =  4096; /* initial value */
+static int h2_be_encoder_table_size           =  4096; /* backend HPACK encoder's dynamic table size, 0=off */
+static int h2_fe_encoder_table_size           =  4096; /* frontend HPACK encoder's dynamic table size, 0=off */
 static int h2_settings_initial_window_size    =     0; /* default initial value: bufsize */
 static int h2_be_settings_initial_window_size =     0; /* backend's default initial value */
 static int h2_fe_settings_initial_window_size =     0; /* frontend's default initial value */
@@ -496,6 +572,20 @@ static int h2_settings_log_errors             = H2_ERR_LOG_ERR_STRM;
 
 /* other non-protocol settings */
 static unsigned int h2_fe_max_total_streams =   0;      /* frontend value */
+static int h2_fe_priorities                 =   1;      /* frontend RFC9218 scheduling, 0=off */
+
+/* State of the header block being encoded by the current thread for a
+ * connection using an HPACK encoder's dynamic table. Since the block may have
+ * to be restarted when the output buffer is full, a copy of the table is made
+ * before its first modification so that it can be restored.
+ */
+static THREAD_LOCAL struct {
+	const struct h2c *h2c;  /* connection the block is being built for */
+	struct hpack_dht *dht;  /* copy of the table, valid if <copied> is set */
+	int copied;             /* the table was modified and copied into <dht> */
+	int dtsu;               /* a DTSU was emitted in this block */
+	int saved;              /* bytes saved in this block so far */
+} h2_hblk;
 
 /* a dummy closed endpoint */
 static const struct sedesc closed_ep = {
@@ -1308,6 +1398,130 @@ static inline void h2_trace_header(const struct ist hn, const struct ist hv,
 		_h2_trace_header(hn, hv, mask, trc_loc, func, h2c, h2s);
 }
 
+/* Returns the maximum size of the HPACK encoder's dynamic table for <h2c> */
+static inline uint h2c_max_edht_size(const struct h2c *h2c)
+{
+	return (h2c->flags & H2_CF_IS_BACK) ? h2_be_encoder_table_size : h2_fe_encoder_table_size;
+}
+
+/* Stops using the HPACK encoder's dynamic table on connection <h2c>. This is
+ * only used when the table cannot be kept in sync with the peer's anymore
+ * (allocation failures), and only before a header block referencing it is
+ * committed. Since the table is never referenced after this, the entries
+ * already inserted by the peer are harmless.
+ */
+static void h2c_disable_edht(struct h2c *h2c)
+{
+	TRACE_ERROR("disabling HPACK encoder's dynamic table", H2_EV_TX_FRAME|H2_EV_TX_HDR|H2_EV_H2C_ERR, h2c->conn);
+	hpack_dht_free(h2c->edht);
+	h2c->edht = NULL;
+	h2_hblk.h2c = NULL;
+}
+
+/* Saves a copy of the HPACK encoder's dynamic table of <h2c> if it was not
+ * yet done for the current header block, so that it can be restored if the
+ * block has to be restarted. The whole area is copied since the table's size
+ * is the peer's limit, which may be lower than the area in use or even zero.
+ */
+static inline void h2c_save_edht(struct h2c *h2c)
+{
+	if (h2_hblk.h2c == h2c && !h2_hblk.copied) {
+		memcpy(h2_hblk.dht, h2c->edht, pool_head_hpack_tbl->size);
+		h2_hblk.copied = 1;
+	}
+}
+
+/* Starts a new header block for connection <h2c> in buffer <out>, which must
+ * be aligned and only contain the frame header. When the connection uses an
+ * HPACK encoder's dynamic table and a new SETTINGS_HEADER_TABLE_SIZE was
+ * received, a dynamic table size update is emitted and the table is resized
+ * accordingly (RFC7541#4.2). Returns non-zero on success or 0 if the output
+ * buffer is full or the table was disabled, in which case the block must be
+ * restarted after calling h2c_abort_hblk().
+ */
+static int h2c_start_hblk(struct h2c *h2c, struct buffer *out)
+{
+	uint size;
+
+	if (!h2c->edht)
+		return 1;
+
+	h2_hblk.h2c = h2c;
+	h2_hblk.copied = 0;
+	h2_hblk.dtsu = 0;
+	h2_hblk.saved = 0;
+
+	if (!(h2c->flags & H2_CF_SHTS_UPDATED))
+		return 1;
+
+	size = MIN(h2c->shts, h2c_max_edht_size(h2c));
+	if (!hpack_encode_dtsu(out, size))
+		return 0;
+
+	h2c_save_edht(h2c);
+	if (hpack_dht_resize(h2c->edht, size) < 0) {
+		h2c_disable_edht(h2c);
+		return 0;
+	}
+	h2_hblk.dtsu = 1;
+	return 1;
+}
+
+/* Aborts the header block being built for connection <h2c>, restoring the
+ * HPACK encoder's dynamic table to the state it had before the block was
+ * started. Must be called before restarting a block.
+ */
+static void h2c_abort_hblk(struct h2c *h2c)
+{
+	if (h2_hblk.h2c != h2c)
+		return;
+
+	if (h2_hblk.copied && h2c->edht)
+		memcpy(h2c->edht, h2_hblk.dht, pool_head_hpack_tbl->size);
+	h2_hblk.h2c = NULL;
+}
+
+/* Commits the header block built for connection <h2c> once it was placed into
+ * the mux buffer, and accounts for the bytes saved by the dynamic table.
+ */
+static void h2c_commit_hblk(struct h2c *h2c)
+{
+	if (h2_hblk.h2c != h2c)
+		return;
+
+	if (h2_hblk.dtsu)
+		h2c->flags &= ~H2_CF_SHTS_UPDATED;
+
+	if (h2_hblk.saved) {
+		h2c->hpack_saved += h2_hblk.saved;
+		HA_ATOMIC_ADD(&h2c->px_counters->hpack_saved, h2_hblk.saved);
+	}
+	h2_hblk.h2c = NULL;
+}
+
+/* hpack-encode header name <n> and value <v> into <out> for connection <h2c>
+ * which uses an HPACK encoder's dynamic table, updating the table when the
+ * field is indexed. Returns non-zero on success, 0 on failure (buffer full, or
+ * table disabled after an allocation failure). In any case of failure, the
+ * whole header block must be restarted after calling h2c_abort_hblk().
+ */
+static int h2c_hpack_encode(struct h2c *h2c, struct buffer *out, const struct ist n, const struct ist v)
+{
+	int saved = 0;
+	int ret;
+
+	ret = hpack_encode_header_dht(out, h2c->edht, n, v, &saved);
+	if (ret == HPACK_ENC_INSERT) {
+		h2c_save_edht(h2c);
+		if (hpack_dht_insert(h2c->edht, n, v) < 0) {
+			h2c_disable_edht(h2c);
+			return 0;
+		}
+	}
+	h2_hblk.saved += saved;
+	return ret != HPACK_ENC_FAIL;
+}
+
 /* hpack-encode header name <hn> and value <hv>, possibly emitting a trace if
  * currently enabled. This is done on behalf of function <func> at <trc_loc>
  * passed as ist(TRC_LOC), h2c <h2c>, and h2s <h2s>, all of which may be NULL.
@@ -1317,7 +1531,7 @@ static inline void h2_trace_header(const struct ist hn, const struct ist hv,
  */
 static inline int h2_encode_header(struct buffer *buf, const struct ist hn, const struct ist hv,
 				   uint64_t mask, const struct ist trc_loc, const char *func,
-				   const struct h2c *h2c, const struct h2s *h2s)
+				   struct h2c *h2c, const struct h2s *h2s)
 {
 	struct ist v;
 	int ret;
@@ -1330,7 +1544,10 @@ static inline int h2_encode_header(struct buffer *buf, const struct ist hn, cons
 			break;
 	}
 
-	ret = hpack_encode_header(buf, hn, v);
+	if (h2c && h2c->edht)
+		ret = h2c_hpack_encode(h2c, buf, hn, v);
+	else
+		ret = hpack_encode_header(buf, hn, v);
 	if (ret)
 		h2_trace_header(hn, v, mask, trc_loc, func, h2c, h2s);
 
@@ -1422,6 +1639,24 @@ static int h2_init(struct connection *conn, struct proxy *prx, struct session *s
 	if (!h2c->ddht)
 		goto fail;
 
+	/* the pool may be larger than our decoding table when it is also used
+	 * for encoding tables.
+	 */
+	hpack_dht_init(h2c->ddht, h2_settings_header_table_size);
+
+	/* the peer's decoding table starts with 4096 bytes (RFC7541#6.5.2), and
+	 * ours may remain smaller without having to announce it since we only
+	 * reference the entries we know of.
+	 */
+	h2c->shts = 4096;
+	h2c->hpack_saved = 0;
+	h2c->edht = NULL;
+	if (h2c_max_edht_size(h2c)) {
+		h2c->edht = hpack_dht_alloc();
+		if (h2c->edht)
+			hpack_dht_init(h2c->edht, MIN(h2c->shts, h2c_max_edht_size(h2c)));
+	}
+
 	/* Initialise the context. */
 	h2c->st0 = H2_CS_PREFACE;
 	h2c->conn = conn;
@@ -1448,6 +1683,8 @@ static int h2_init(struct connection *conn, struct proxy *prx, struct session *s
 	h2c->dsi = -1;
 
 	h2c->last_sid = -1;
+	h2c->prio_pend_next = 0;
+	memset(h2c->prio_pend, 0, sizeof(h2c->prio_pend));
 
 	br_init(h2c->mbuf, sizeof(h2c->mbuf) / sizeof(h2c->mbuf[0]));
 	h2c->miw = 65535; /* mux initial window size */
@@ -1493,6 +1730,7 @@ static int h2_init(struct connection *conn, struct proxy *prx, struct session *s
 	TRACE_LEAVE(H2_EV_H2C_NEW, conn);
 	return 0;
   fail_stream:
+	hpack_dht_free(h2c->edht);
 	hpack_dht_free(h2c->ddht);
   fail:
 	task_destroy(t);
@@ -1547,6 +1785,7 @@ static void h2_release(struct h2c *h2c)
 
 	BUG_ON_STRESS(LIST_INLIST(&conn->idle_list) && conn->flags & CO_FL_LIST_MASK);
 	hpack_dht_free(h2c->ddht);
+	hpack_dht_free(h2c->edht);
 
 	b_dequeue(&h2c->buf_wait);
 
@@ -1619,6 +1858,106 @@ static inline int h2s_mws(const struct h2s *h2s)
 	return h2s->sws + h2s->h2c->miw;
 }
 
+/* queues stream <h2s> into the connection's list <head>, which is either
+ * send_list or fctl_list. On frontend connections with RFC9218 priorities
+ * enabled, the stream is placed after all streams of lower urgency value.
+ * Within the same urgency, non-incremental streams are served first by
+ * increasing stream ID, and incremental ones are appended after them so that
+ * they are served round-robin each time they re-queue. Otherwise the stream is
+ * simply appended.
+ */
+static inline void h2s_queue(struct h2s *h2s, struct list *head)
+{
+	struct list *pos;
+
+	h2s->flags &= ~(H2_SF_IN_FCTL_LIST | H2_SF_IN_BLK_LIST);
+	if (head == &h2s->h2c->fctl_list)
+		h2s->flags |= H2_SF_IN_FCTL_LIST;
+
+	if ((h2s->h2c->flags & H2_CF_IS_BACK) || !h2_fe_priorities) {
+		LIST_APPEND(head, &h2s->list);
+		return;
+	}
+
+	for (pos = head->p; pos != head; pos = pos->p) {
+		const struct h2s *e = LIST_ELEM(pos, struct h2s *, list);
+
+		if (e->urg < h2s->urg ||
+		    (e->urg == h2s->urg && (h2s->incr || (!e->incr && e->id < h2s->id))))
+			break;
+	}
+	LIST_INSERT(pos, &h2s->list);
+}
+
+/* updates the RFC9218 priority of stream <h2s> and repositions it if it was
+ * already waiting in the connection's send_list or fctl_list.
+ */
+static void h2s_set_prio(struct h2s *h2s, int urg, int incr)
+{
+	struct h2c *h2c = h2s->h2c;
+
+	if (h2s->urg == urg && h2s->incr == incr)
+		return;
+
+	h2s->urg  = urg;
+	h2s->incr = incr;
+
+	if (!LIST_INLIST(&h2s->list) || (h2s->flags & H2_SF_IN_BLK_LIST))
+		return;
+
+	LIST_DEL_INIT(&h2s->list);
+	h2s_queue(h2s, (h2s->flags & H2_SF_IN_FCTL_LIST) ? &h2c->fctl_list : &h2c->send_list);
+}
+
+/* remembers the RFC9218 priority <urg>,<incr> received for stream <sid> which
+ * is not opened yet, so that it is applied when the stream opens. Only the
+ * last H2C_PRIO_PEND_MAX ones are kept: an entry for the same stream, or one
+ * which is unused or was left by a stream opened since, is reused first,
+ * otherwise the entries are replaced in turn.
+ */
+static void h2c_save_prio(struct h2c *h2c, uint32_t sid, int urg, int incr)
+{
+	struct h2_prio_pend *pp = NULL;
+	int i;
+
+	for (i = 0; i < H2C_PRIO_PEND_MAX; i++) {
+		if (h2c->prio_pend[i].sid == sid) {
+			pp = &h2c->prio_pend[i];
+			break;
+		}
+		if (!pp && (int32_t)h2c->prio_pend[i].sid <= h2c->max_id)
+			pp = &h2c->prio_pend[i];
+	}
+
+	if (!pp) {
+		pp = &h2c->prio_pend[h2c->prio_pend_next];
+		h2c->prio_pend_next = (h2c->prio_pend_next + 1) % H2C_PRIO_PEND_MAX;
+	}
+
+	pp->sid  = sid;
+	pp->urg  = urg;
+	pp->incr = incr;
+}
+
+/* looks up a priority saved by h2c_save_prio() for stream <sid>. If found, it
+ * is stored into <urg> and <incr>, the entry is released and non-zero is
+ * returned. Otherwise zero is returned.
+ */
+static int h2c_take_prio(struct h2c *h2c, uint32_t sid, int *urg, int *incr)
+{
+	int i;
+
+	for (i = 0; i < H2C_PRIO_PEND_MAX; i++) {
+		if (h2c->prio_pend[i].sid == sid) {
+			*urg  = h2c->prio_pend[i].urg;
+			*incr = h2c->prio_pend[i].incr;
+			h2c->prio_pend[i].sid = 0;
+			return 1;
+		}
+	}
+	return 0;
+}
+
 /* Returns 1 if the H2 error of the opposite side is forwardable to the peer.
  * Otherwise 0 is returned.
  * For now, only CANCEL from the client is forwardable to the server.
@@ -2060,6 +2399,8 @@ static struct h2s *h2s_new(struct h2c *h2c, int id)
 	h2s->rx_tail   = 0;
 	h2s->rx_head   = 0;
 	h2s->rx_count  = 0;
+	h2s->urg       = 3;
+	h2s->incr      = 0;
 	memset(h2s->upgrade_protocol, 0, sizeof(h2s->upgrade_protocol));
 
 	h2s->by_id.key = h2s->id = id;
@@ -2268,6 +2609,12 @@ static int h2c_send_settings(struct h2c *h2c)
 	if (!(global.tune.options & GTUNE_DISABLE_H2_WEBSOCKET))
 		chunk_memcat(&buf, "\x00\x08\x00\x00\x00\x01", 6);
 
+	/* rfc 9218 #2.1 SETTINGS_NO_RFC7540_PRIORITIES=1, sent by frontends
+	 * when extensible priorities are used (7540 ones were never supported).
+	 */
+	if (!(h2c->flags & H2_CF_IS_BACK) && h2_fe_priorities)
+		chunk_memcat(&buf, "\x00\x09\x00\x00\x00\x01", 6);
+
 	if (h2_settings_header_table_size != 4096) {
 		char str[6] = "\x00\x01"; /* header_table_size */
 
@@ -2819,7 +3166,7 @@ static void h2c_unblock_sfctl(struct h2c *h2c)
 			LIST_DEL_INIT(&h2s->list);
 			if ((h2s->subs && h2s->subs->events & SUB_RETRY_SEND) ||
 			    h2s->flags & (H2_SF_WANT_SHUTR|H2_SF_WANT_SHUTW))
-				LIST_APPEND(&h2c->send_list, &h2s->list);
+				h2s_queue(h2s, &h2c->send_list);
 		}
 		node = eb32_next(node);
 	}
@@ -2894,6 +3241,7 @@ static int h2c_handle_settings(struct h2c *h2c)
 			h2c->mfs = arg;
 			break;
 		case H2_SETTINGS_HEADER_TABLE_SIZE:
+			h2c->shts = arg;
 			h2c->flags |= H2_CF_SHTS_UPDATED;
 			break;
 		case H2_SETTINGS_ENABLE_PUSH:
@@ -3327,7 +3675,7 @@ static int h2c_handle_window_update(struct h2c *h2c, struct h2s *h2s)
 			LIST_DEL_INIT(&h2s->list);
 			if ((h2s->subs && h2s->subs->events & SUB_RETRY_SEND) ||
 			    h2s->flags & (H2_SF_WANT_SHUTR|H2_SF_WANT_SHUTW))
-				LIST_APPEND(&h2c->send_list, &h2s->list);
+				h2s_queue(h2s, &h2c->send_list);
 		}
 	}
 	else {
@@ -3423,6 +3771,92 @@ static int h2c_handle_priority(struct h2c *h2c)
 	return 1;
 }
 
+/* processes a PRIORITY_UPDATE frame received on a frontend connection and
+ * updates the urgency and incremental flag of the designated stream. Returns
+ * > 0 on success or zero on missing data. It may return an error in h2c. The
+ * caller must have already verified that the frame fits in the demux buffer.
+ * Updates for client streams which are not opened yet are remembered and
+ * applied when they open, those for closed streams are ignored. Described in
+ * RFC9218#7.1.
+ */
+static int h2c_handle_priority_update(struct h2c *h2c)
+{
+	struct buffer *tmp;
+	struct h2s *h2s;
+	uint32_t sid;
+	int urg, incr;
+	int error;
+
+	TRACE_ENTER(H2_EV_RX_FRAME|H2_EV_RX_PRIO, h2c->conn);
+
+	if (h2c->dsi != 0) {
+		error = H2_ERR_PROTOCOL_ERROR;
+		h2c_report_glitch(h2c, 1, "PRIORITY_UPDATE on non-zero stream");
+		goto conn_err;
+	}
+
+	if (h2c->dfl < 4) {
+		error = H2_ERR_FRAME_SIZE_ERROR;
+		h2c_report_glitch(h2c, 1, "PRIORITY_UPDATE frame too short");
+		goto conn_err;
+	}
+
+	/* process full frame only */
+	if (b_data(&h2c->dbuf) < h2c->dfl) {
+		TRACE_DEVEL("leaving on missing data", H2_EV_RX_FRAME|H2_EV_RX_PRIO, h2c->conn);
+		h2c->flags |= H2_CF_DEM_SHORT_READ;
+		return 0;
+	}
+
+	sid = h2_get_n32(&h2c->dbuf, 0) & 0x7FFFFFFF;
+	if (!sid) {
+		error = H2_ERR_PROTOCOL_ERROR;
+		h2c_report_glitch(h2c, 1, "PRIORITY_UPDATE for stream zero");
+		goto conn_err;
+	}
+
+	HA_ATOMIC_INC(&h2c->px_counters->prio_update_rcvd);
+
+	if (!h2_fe_priorities)
+		goto end;
+
+	h2s = h2c_st_by_id(h2c, sid);
+	if (h2s->st == H2_SS_CLOSED ||
+	    (h2s->st == H2_SS_IDLE && ((int32_t)sid <= h2c->max_id || !(sid & 1))))
+		goto end;
+
+	/* the field value may wrap in the demux buffer */
+	tmp = get_trash_chunk();
+	tmp->data = b_getblk(&h2c->dbuf, tmp->area, h2c->dfl - 4, 4);
+
+	if (h2s->st == H2_SS_IDLE) {
+		urg  = 3;
+		incr = 0;
+		http_parse_priority(ist2(tmp->area, tmp->data), &urg, &incr);
+		TRACE_PROTO("saving priority of idle stream", H2_EV_RX_FRAME|H2_EV_RX_PRIO, h2c->conn);
+		h2c_save_prio(h2c, sid, urg, incr);
+		goto end;
+	}
+
+	urg  = h2s->urg;
+	incr = h2s->incr;
+	http_parse_priority(ist2(tmp->area, tmp->data), &urg, &incr);
+	TRACE_PROTO("updating stream priority", H2_EV_RX_FRAME|H2_EV_RX_PRIO, h2c->conn, h2s);
+	h2s_set_prio(h2s, urg, incr);
+
+ end:
+	TRACE_LEAVE(H2_EV_RX_FRAME|H2_EV_RX_PRIO, h2c->conn);
+	return 1;
+
+ conn_err:
+	TRACE_ERROR("invalid PRIORITY_UPDATE frame", H2_EV_RX_FRAME|H2_EV_RX_PRIO, h2c->conn);
+	h2c_error(h2c, error);
+	h2_sess_log_conn(h2c->conn->owner);
+	HA_ATOMIC_INC(&h2c->px_counters->conn_proto_err);
+	TRACE_DEVEL("leaving on error", H2_EV_RX_FRAME|H2_EV_RX_PRIO, h2c->conn);
+	return 0;
+}
+
 /* processes an RST_STREAM frame, and sets the 32-bit error code on the stream.
  * Returns > 0 on success or zero on missing data. The caller must have already
  * verified frame length and stream ID validity. Described in RFC7540#6.4.
@@ -3483,6 +3917,7 @@ static struct h2s *h2c_frt_handle_headers(struct h2c *h2c, struct h2s *h2s)
 	struct buffer rxbuf = BUF_NULL;
 	unsigned long long body_len = ULLONG_MAX;
 	uint32_t flags = 0;
+	int urg = 3, incr = 0;
 	int error;
 
 	TRACE_ENTER(H2_EV_RX_FRAME|H2_EV_RX_HDR, h2c->conn, h2s);
@@ -3620,6 +4055,17 @@ static struct h2s *h2c_frt_handle_headers(struct h2c *h2c, struct h2s *h2s)
 
 	TRACE_USER("rcvd H2 request  ", H2_EV_RX_FRAME|H2_EV_RX_HDR|H2_EV_STRM_NEW, h2c->conn, 0, &rxbuf);
 
+	/* retrieve the RFC9218 priority before the rxbuf is transferred. A
+	 * PRIORITY_UPDATE frame received before the stream was opened takes
+	 * precedence over the header field (RFC9218#7.1).
+	 */
+	if (h2_fe_priorities && !h2c_take_prio(h2c, h2c->dsi, &urg, &incr)) {
+		struct http_hdr_ctx ctx = { .blk = NULL };
+
+		while (http_find_header(htxbuf(&rxbuf), ist("priority"), &ctx, 1))
+			http_parse_priority(ctx.value, &urg, &incr);
+	}
+
 	/* Note: we don't emit any other logs below because if we return
 	 * positively from h2c_frt_stream_new(), the stream will report the error,
 	 * and if we return in error, h2c_frt_stream_new() will emit the error.
@@ -3637,6 +4083,8 @@ static struct h2s *h2c_frt_handle_headers(struct h2c *h2c, struct h2s *h2s)
 	h2s->st = H2_SS_OPEN;
 	h2s->flags |= flags;
 	h2s->body_len = body_len;
+	h2s->urg = urg;
+	h2s->incr = incr;
 	if (h2s->flags & H2_SF_DATA_CLEN)
 		h2s->sd->kip = h2s->body_len;
 	h2s_propagate_term_flags(h2c, h2s);
@@ -4568,6 +5016,19 @@ static void h2_process_demux(struct h2c *h2c)
 			HA_ATOMIC_INC(&h2c->px_counters->goaway_rcvd);
 			break;
 
+		case H2_FT_PRIORITY_UPDATE:
+			/* only supported on the frontend side and as long as
+			 * it fits into the buffer, otherwise it's dropped.
+			 */
+			if (!(h2c->flags & H2_CF_IS_BACK) && h2c->dfl <= b_size(&h2c->dbuf)) {
+				if (h2c->st0 == H2_CS_FRAME_P) {
+					TRACE_PROTO("receiving H2 PRIORITY_UPDATE frame", H2_EV_RX_FRAME|H2_EV_RX_PRIO, h2c->conn, h2s);
+					ret = h2c_handle_priority_update(h2c);
+				}
+				break;
+			}
+			__fallthrough;
+
 			/* implement all extra frame types here */
 		default:
 			TRACE_PROTO("receiving H2 ignored frame", H2_EV_RX_FRAME, h2c->conn, h2s);
@@ -4664,10 +5125,15 @@ static void h2_process_demux(struct h2c *h2c)
 	return;
 }
 
-/* resume each h2s eligible for sending in list head <head> */
+/* resume each h2s eligible for sending in list head <head>. When RFC9218
+ * priorities are in use, the list is sorted by urgency and only the streams
+ * of the most urgent class found are woken up, the following ones will be
+ * resumed once these ones have nothing left to send.
+ */
 static void h2_resume_each_sending_h2s(struct h2c *h2c, struct list *head)
 {
 	struct h2s *h2s, *h2s_back;
+	int urg = -1;
 
 	TRACE_ENTER(H2_EV_H2C_SEND|H2_EV_H2S_WAKE, h2c->conn);
 
@@ -4677,10 +5143,16 @@ static void h2_resume_each_sending_h2s(struct h2c *h2c, struct list *head)
 		    h2c->st0 >= H2_CS_ERROR)
 			break;
 
+		if (urg >= 0 && h2s->urg != urg &&
+		    !(h2c->flags & H2_CF_IS_BACK) && h2_fe_priorities)
+			break;
+
 		h2s->flags &= ~H2_SF_BLK_ANY;
 
-		if (h2s->flags & H2_SF_NOTIFIED)
+		if (h2s->flags & H2_SF_NOTIFIED) {
+			urg = h2s->urg;
 			continue;
+		}
 
 		/* If the sender changed his mind and unsubscribed, let's just
 		 * remove the stream from the send_list.
@@ -4691,6 +5163,7 @@ static void h2_resume_each_sending_h2s(struct h2c *h2c, struct list *head)
 			continue;
 		}
 
+		urg = h2s->urg;
 		h2s_notify_send(h2s);
 	}
 
@@ -4704,7 +5177,9 @@ static void h2_resume_each_sending_h2s(struct h2c *h2c, struct list *head)
  * this condition, and we try to resume sending streams if it happens. Note
  * that we don't need to do it for fctl_list as this list is relevant before
  * (only consulted after) a window update on the connection, and not because
- * of any competition with other streams.
+ * of any competition with other streams. This is not true anymore with RFC9218
+ * priorities, since a resume pass stops at the first less urgent stream, so
+ * both lists are resumed in this case.
  */
 static inline void h2_remove_from_list(struct h2s *h2s)
 {
@@ -4714,7 +5189,15 @@ static inline void h2_remove_from_list(struct h2s *h2s)
 		return;
 
 	LIST_DEL_INIT(&h2s->list);
-	if (h2c->flags & H2_CF_WAIT_INLIST) {
+	if (!(h2c->flags & H2_CF_IS_BACK) && h2_fe_priorities) {
+		/* streams of a lower urgency may have been held back behind
+		 * this one, in either list, and may have to be resumed now.
+		 */
+		h2c->flags &= ~H2_CF_WAIT_INLIST;
+		h2_resume_each_sending_h2s(h2c, &h2c->fctl_list);
+		h2_resume_each_sending_h2s(h2c, &h2c->send_list);
+	}
+	else if (h2c->flags & H2_CF_WAIT_INLIST) {
 		h2c->flags &= ~H2_CF_WAIT_INLIST;
 		h2_resume_each_sending_h2s(h2c, &h2c->send_list);
 	}
@@ -5823,9 +6306,9 @@ static void h2_do_shutr(struct h2s *h2s, struct se_abort_info *reason)
 	h2s->flags |= H2_SF_WANT_SHUTR;
 	if (!LIST_INLIST(&h2s->list)) {
 		if (h2s->flags & H2_SF_BLK_MFCTL)
-			LIST_APPEND(&h2c->fctl_list, &h2s->list);
+			h2s_queue(h2s, &h2c->fctl_list);
 		else if (h2s->flags & (H2_SF_BLK_MBUSY|H2_SF_BLK_MROOM))
-			LIST_APPEND(&h2c->send_list, &h2s->list);
+			h2s_queue(h2s, &h2c->send_list);
 	}
 	TRACE_LEAVE(H2_EV_STRM_SHUT, h2c->conn, h2s);
 	return;
@@ -5913,9 +6396,9 @@ static void h2_do_shutw(struct h2s *h2s, struct se_abort_info *reason)
 	h2s->flags |= H2_SF_WANT_SHUTW;
 	if (!LIST_INLIST(&h2s->list)) {
 		if (h2s->flags & H2_SF_BLK_MFCTL)
-			LIST_APPEND(&h2c->fctl_list, &h2s->list);
+			h2s_queue(h2s, &h2c->fctl_list);
 		else if (h2s->flags & (H2_SF_BLK_MBUSY|H2_SF_BLK_MROOM))
-			LIST_APPEND(&h2c->send_list, &h2s->list);
+			h2s_queue(h2s, &h2c->send_list);
 	}
 	TRACE_LEAVE(H2_EV_STRM_SHUT, h2c->conn, h2s);
 	return;
@@ -6571,6 +7054,7 @@ static size_t h2s_snd_fhdrs(struct h2s *h2s, struct htx *htx)
 		if (outbuf.size >= 9 || !b_space_wraps(mbuf))
 			break;
 	realign_again:
+		h2c_abort_hblk(h2c);
 		b_slow_realign(mbuf, trash.area, b_data(mbuf));
 	}
 
@@ -6582,7 +7066,14 @@ static size_t h2s_snd_fhdrs(struct h2s *h2s, struct htx *htx)
 	write_n32(outbuf.area + 5, h2s->id); // 4 bytes
 	outbuf.data = 9;
 
-	if ((h2c->flags & (H2_CF_SHTS_UPDATED|H2_CF_DTSU_EMITTED)) == H2_CF_SHTS_UPDATED) {
+	if (!h2c_start_hblk(h2c, &outbuf)) {
+		if (b_space_wraps(mbuf))
+			goto realign_again;
+		goto full;
+	}
+
+	if (!h2c->edht &&
+	    (h2c->flags & (H2_CF_SHTS_UPDATED|H2_CF_DTSU_EMITTED)) == H2_CF_SHTS_UPDATED) {
 		/* SETTINGS_HEADER_TABLE_SIZE changed, we must send an HPACK
 		 * dynamic table size update so that some clients are not
 		 * confused. In practice we only need to send the DTSU when the
@@ -6603,13 +7094,22 @@ static size_t h2s_snd_fhdrs(struct h2s *h2s, struct htx *htx)
 	}
 
 	/* encode status, which necessarily is the first one */
-	if (!hpack_encode_int_status(&outbuf, h2s->status)) {
+	if (h2c->edht) {
+		char sts[4];
+
+		if (!h2_encode_header(&outbuf, ist(":status"), ist(ultoa_r(h2s->status, sts, sizeof(sts))),
+		                      H2_EV_TX_FRAME|H2_EV_TX_HDR, ist(TRC_LOC), __FUNCTION__, h2c, h2s)) {
+			if (b_space_wraps(mbuf))
+				goto realign_again;
+			goto full;
+		}
+	}
+	else if (!hpack_encode_int_status(&outbuf, h2s->status)) {
 		if (b_space_wraps(mbuf))
 			goto realign_again;
 		goto full;
 	}
-
-	if ((TRACE_SOURCE)->verbosity >= H2_VERB_ADVANCED) {
+	else if ((TRACE_SOURCE)->verbosity >= H2_VERB_ADVANCED) {
 		char sts[4];
 
 		h2_trace_header(ist(":status"), ist(ultoa_r(h2s->status, sts, sizeof(sts))),
@@ -6689,6 +7189,7 @@ static size_t h2s_snd_fhdrs(struct h2s *h2s, struct htx *htx)
 
 	/* commit the H2 response */
 	b_add(mbuf, outbuf.data);
+	h2c_commit_hblk(h2c);
 	h2c->flags |= H2_CF_MBUF_HAS_DATA;
 
 	/* indicates the HEADERS frame was sent, except for 1xx responses. For
@@ -6717,6 +7218,7 @@ static size_t h2s_snd_fhdrs(struct h2s *h2s, struct htx *htx)
 	TRACE_LEAVE(H2_EV_TX_FRAME|H2_EV_TX_HDR, h2c->conn, h2s);
 	return ret;
  full:
+	h2c_abort_hblk(h2c);
 	if ((mbuf = br_tail_add(h2c->mbuf)) != NULL)
 		goto retry;
 	h2c->flags |= H2_CF_MUX_MFULL;
@@ -6895,6 +7397,7 @@ static size_t h2s_snd_bhdrs(struct h2s *h2s, struct htx *htx)
 		if (outbuf.size >= 9 || !b_space_wraps(mbuf))
 			break;
 	realign_again:
+		h2c_abort_hblk(h2c);
 		b_slow_realign(mbuf, trash.area, b_data(mbuf));
 	}
 
@@ -6906,14 +7409,28 @@ static size_t h2s_snd_bhdrs(struct h2s *h2s, struct htx *htx)
 	write_n32(outbuf.area + 5, h2s->id); // 4 bytes
 	outbuf.data = 9;
 
-	/* encode the method, which necessarily is the first one */
-	if (!hpack_encode_method(&outbuf, sl->info.req.meth, meth)) {
+	if (!h2c_start_hblk(h2c, &outbuf)) {
 		if (b_space_wraps(mbuf))
 			goto realign_again;
 		goto full;
 	}
 
-	h2_trace_header(ist(":method"), meth, H2_EV_TX_FRAME|H2_EV_TX_HDR, ist(TRC_LOC), __FUNCTION__, h2c, h2s);
+	/* encode the method, which necessarily is the first one */
+	if (h2c->edht) {
+		if (!h2_encode_header(&outbuf, ist(":method"), meth, H2_EV_TX_FRAME|H2_EV_TX_HDR,
+		                      ist(TRC_LOC), __FUNCTION__, h2c, h2s)) {
+			if (b_space_wraps(mbuf))
+				goto realign_again;
+			goto full;
+		}
+	}
+	else if (!hpack_encode_method(&outbuf, sl->info.req.meth, meth)) {
+		if (b_space_wraps(mbuf))
+			goto realign_again;
+		goto full;
+	}
+	else
+		h2_trace_header(ist(":method"), meth, H2_EV_TX_FRAME|H2_EV_TX_HDR, ist(TRC_LOC), __FUNCTION__, h2c, h2s);
 
 	auth = ist(NULL);
 
@@ -6988,7 +7505,10 @@ static size_t h2s_snd_bhdrs(struct h2s *h2s, struct htx *htx)
 				scheme = ist("https");
 		}
 
-		if (!hpack_encode_scheme(&outbuf, scheme)) {
+		if (h2c->edht ?
+		    !h2_encode_header(&outbuf, ist(":scheme"), scheme, H2_EV_TX_FRAME|H2_EV_TX_HDR,
+		                      ist(TRC_LOC), __FUNCTION__, h2c, h2s) :
+		    !hpack_encode_scheme(&outbuf, scheme)) {
 			/* output full */
 			if (b_space_wraps(mbuf))
 				goto realign_again;
@@ -7014,14 +7534,23 @@ static size_t h2s_snd_bhdrs(struct h2s *h2s, struct htx *htx)
 				uri = ist("/");
 		}
 
-		if (!hpack_encode_path(&outbuf, uri)) {
+		if (h2c->edht) {
+			if (!h2_encode_header(&outbuf, ist(":path"), uri, H2_EV_TX_FRAME|H2_EV_TX_HDR,
+			                      ist(TRC_LOC), __FUNCTION__, h2c, h2s)) {
+				/* output full */
+				if (b_space_wraps(mbuf))
+					goto realign_again;
+				goto full;
+			}
+		}
+		else if (!hpack_encode_path(&outbuf, uri)) {
 			/* output full */
 			if (b_space_wraps(mbuf))
 				goto realign_again;
 			goto full;
 		}
-
-		h2_trace_header(ist(":path"), uri, H2_EV_TX_FRAME|H2_EV_TX_HDR, ist(TRC_LOC), __FUNCTION__, h2c, h2s);
+		else
+			h2_trace_header(ist(":path"), uri, H2_EV_TX_FRAME|H2_EV_TX_HDR, ist(TRC_LOC), __FUNCTION__, h2c, h2s);
 
 		/* encode the pseudo-header protocol from rfc8441 if using
 		 * Extended CONNECT method.
@@ -7127,6 +7656,7 @@ static size_t h2s_snd_bhdrs(struct h2s *h2s, struct htx *htx)
 
 	/* commit the H2 response */
 	b_add(mbuf, outbuf.data);
+	h2c_commit_hblk(h2c);
 	h2c->flags |= H2_CF_MBUF_HAS_DATA;
 	h2s->flags |= H2_SF_HEADERS_SENT;
 	h2s->st = H2_SS_OPEN;
@@ -7141,6 +7671,7 @@ static size_t h2s_snd_bhdrs(struct h2s *h2s, struct htx *htx)
  end:
 	return ret;
  full:
+	h2c_abort_hblk(h2c);
 	if ((mbuf = br_tail_add(h2c->mbuf)) != NULL)
 		goto retry;
 	h2c->flags |= H2_CF_MUX_MFULL;
@@ -7362,6 +7893,7 @@ static size_t h2s_make_data(struct h2s *h2s, struct buffer *buf, size_t count)
 		if (LIST_INLIST(&h2s->list))
 			h2_remove_from_list(h2s);
 		LIST_APPEND(&h2c->blocked_list, &h2s->list);
+		h2s->flags |= H2_SF_IN_BLK_LIST;
 		TRACE_STATE("stream window <=0, flow-controlled", H2_EV_TX_FRAME|H2_EV_TX_DATA|H2_EV_H2S_FCTL, h2c->conn, h2s);
 		goto end;
 	}
@@ -7464,6 +7996,8 @@ static size_t h2s_make_data(struct h2s *h2s, struct buffer *buf, size_t count)
 	}
 
  end:
+	if (total)
+		HA_ATOMIC_ADD(&h2c->px_counters->data_sent_urg[h2s->urg], total);
 	TRACE_LEAVE(H2_EV_TX_FRAME|H2_EV_TX_DATA, h2c->conn, h2s);
 	return total;
 }
@@ -7613,6 +8147,7 @@ static size_t h2s_make_trailers(struct h2s *h2s, struct htx *htx)
 		if (outbuf.size >= 9 || !b_space_wraps(mbuf))
 			break;
 	realign_again:
+		h2c_abort_hblk(h2c);
 		b_slow_realign(mbuf, trash.area, b_data(mbuf));
 	}
 
@@ -7624,6 +8159,12 @@ static size_t h2s_make_trailers(struct h2s *h2s, struct htx *htx)
 	write_n32(outbuf.area + 5, h2s->id); // 4 bytes
 	outbuf.data = 9;
 
+	if (!h2c_start_hblk(h2c, &outbuf)) {
+		if (b_space_wraps(mbuf))
+			goto realign_again;
+		goto full;
+	}
+
 	/* encode all headers */
 	for (idx = 0; idx < hdr; idx++) {
 		/* these ones do not exist in H2 or must not appear in
@@ -7678,6 +8219,7 @@ static size_t h2s_make_trailers(struct h2s *h2s, struct htx *htx)
 	/* commit the H2 response */
 	TRACE_PROTO("sent H2 trailers HEADERS frame", H2_EV_TX_FRAME|H2_EV_TX_HDR|H2_EV_TX_EOI, h2c->conn, h2s);
 	b_add(mbuf, outbuf.data);
+	h2c_commit_hblk(h2c);
 	h2c->flags |= H2_CF_MBUF_HAS_DATA;
 	h2s->flags |= H2_SF_ES_SENT;
 
@@ -7704,6 +8246,7 @@ static size_t h2s_make_trailers(struct h2s *h2s, struct htx *htx)
 	TRACE_LEAVE(H2_EV_TX_FRAME|H2_EV_TX_HDR, h2c->conn, h2s);
 	return ret;
  full:
+	h2c_abort_hblk(h2c);
 	if ((mbuf = br_tail_add(h2c->mbuf)) != NULL)
 		goto retry;
 	h2c->flags |= H2_CF_MUX_MFULL;
@@ -7747,11 +8290,11 @@ static int h2_subscribe(struct stconn *sc, int event_type, struct wait_event *es
 		    !LIST_INLIST(&h2s->list)) {
 			if (h2s->flags & H2_SF_BLK_MFCTL) {
 				TRACE_DEVEL("Adding to fctl list", H2_EV_STRM_SEND, h2c->conn, h2s);
-				LIST_APPEND(&h2c->fctl_list, &h2s->list);
+				h2s_queue(h2s, &h2c->fctl_list);
 			}
 			else {
 				TRACE_DEVEL("Adding to send list", H2_EV_STRM_SEND, h2c->conn, h2s);
-				LIST_APPEND(&h2c->send_list, &h2s->list);
+				h2s_queue(h2s, &h2c->send_list);
 			}
 		}
 	}
@@ -8158,6 +8701,7 @@ static size_t h2_nego_ff(struct stconn *sc, struct buffer *input, size_t count,
 		if (LIST_INLIST(&h2s->list))
 			LIST_DEL_INIT(&h2s->list);
 		LIST_APPEND(&h2c->blocked_list, &h2s->list);
+		h2s->flags |= H2_SF_IN_BLK_LIST;
 		h2s->sd->iobuf.flags |= IOBUF_FL_FF_BLOCKED;
 		TRACE_STATE("stream window <=0, flow-controlled", H2_EV_H2S_SEND|H2_EV_H2S_FCTL, h2c->conn, h2s);
 		goto end;
@@ -8308,6 +8852,7 @@ static size_t h2_done_ff(struct stconn *sc)
 	b_add(mbuf, 9);
 	h2s->sws -= total;
 	h2c->mws -= total;
+	HA_ATOMIC_ADD(&h2c->px_counters->data_sent_urg[h2s->urg], total);
 	if (h2_send(h2s->h2c))
 		tasklet_wakeup(h2s->h2c->wait_event.tasklet);
 
@@ -8361,8 +8906,8 @@ static int h2_dump_h2s_info(struct buffer *msg, const struct h2s *h2s, const cha
 	head = h2s_rxbuf_head(h2s);
 	tail = h2s_rxbuf_tail(h2s);
 
-	chunk_appendf(msg, " h2s.id=%d .st=%s .flg=0x%04x .rxwin=%u .rxbuf.c=%u .t=%u@%p+%u/%u .h=%u@%p+%u/%u",
-		      h2s->id, h2s_st_to_str(h2s->st), h2s->flags,
+	chunk_appendf(msg, " h2s.id=%d .st=%s .flg=0x%04x .urg=%u .incr=%u .rxwin=%u .rxbuf.c=%u .t=%u@%p+%u/%u .h=%u@%p+%u/%u",
+		      h2s->id, h2s_st_to_str(h2s->st), h2s->flags, h2s->urg, h2s->incr,
 		      (uint)(h2s->next_max_ofs - h2s->curr_rx_ofs),
 		      h2s_rxbuf_cnt(h2s),
 		      tail ? (uint)b_data(tail) : 0,
@@ -8444,6 +8989,11 @@ static int h2_dump_h2c_info(struct buffer *msg, struct h2c *h2c, const char *pfx
 		      h2c->nb_streams, h2c->nb_sc, h2c->receiving_streams, h2c->glitches,
 		      tevt_evts2str(h2c->term_evts_log));
 
+	if (h2c->edht)
+		chunk_appendf(msg, " .edht=%u/%u .hpack_saved=%llu",
+			      h2c->edht->used, h2c->edht->size,
+			      (unsigned long long)h2c->hpack_saved);
+
 	if (pfx)
 		chunk_appendf(msg, "\n%s", pfx);
 
@@ -8615,6 +9165,27 @@ static int h2_takeover(struct connection *conn, int orig_tid, int release)
 /* functions below are dedicated to the config parsers */
 /*******************************************************/
 
+/* config parser for global "tune.h2.{fe,be}.encoder-table-size" */
+static int h2_parse_encoder_table_size(char **args, int section_type, struct proxy *curpx,
+				       const struct proxy *defpx, const char *file, int line,
+				       char **err)
+{
+	int *vptr;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	/* backend/frontend */
+	vptr = (args[0][8] == 'b') ? &h2_be_encoder_table_size : &h2_fe_encoder_table_size;
+
+	*vptr = atoi(args[1]);
+	if (*vptr < 0 || *vptr > 65536) {
+		memprintf(err, "'%s' expects a numeric value between 0 and 65536.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
 /* config parser for global "tune.h2.{fe,be}.glitches-threshold" */
 static int h2_parse_glitches_threshold(char **args, int section_type, struct proxy *curpx,
 				       const struct proxy *defpx, const char *file, int line,
@@ -8782,6 +9353,25 @@ static int h2_parse_rxbuf(char **args, int section_type, struct proxy *curpx,
 	return 0;
 }
 
+/* config parser for global "tune.h2.fe.priorities" */
+static int h2_parse_fe_priorities(char **args, int section_type, struct proxy *curpx,
+                                  const struct proxy *defpx, const char *file, int line,
+                                  char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[1], "on") == 0)
+		h2_fe_priorities = 1;
+	else if (strcmp(args[1], "off") == 0)
+		h2_fe_priorities = 0;
+	else {
+		memprintf(err, "'%s' expects 'on' or 'off'.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
 /* config parser for global "tune.h2.zero-copy-fwd-send" */
 static int h2_parse_zero_copy_fwd_snd(char **args, int section_type, struct proxy *curpx,
 					  const struct proxy *defpx, const char *file, int line,
@@ -8839,14 +9429,17 @@ INITCALL1(STG_REGISTER, register_mux_proto, &mux_proto_h2);
 
 /* config keyword parsers */
 static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.h2.be.encoder-table-size",  h2_parse_encoder_table_size     },
 	{ CFG_GLOBAL, "tune.h2.be.glitches-threshold",  h2_parse_glitches_threshold     },
 	{ CFG_GLOBAL, "tune.h2.be.initial-window-size", h2_parse_initial_window_size    },
 	{ CFG_GLOBAL, "tune.h2.be.max-concurrent-streams", h2_parse_max_concurrent_streams },
 	{ CFG_GLOBAL, "tune.h2.be.rxbuf",               h2_parse_rxbuf                  },
+	{ CFG_GLOBAL, "tune.h2.fe.encoder-table-size",  h2_parse_encoder_table_size     },
 	{ CFG_GLOBAL, "tune.h2.fe.glitches-threshold",  h2_parse_glitches_threshold     },
 	{ CFG_GLOBAL, "tune.h2.fe.initial-window-size", h2_parse_initial_window_size    },
 	{ CFG_GLOBAL, "tune.h2.fe.max-concurrent-streams", h2_parse_max_concurrent_streams },
 	{ CFG_GLOBAL, "tune.h2.fe.max-total-streams",   h2_parse_max_total_streams      },
+	{ CFG_GLOBAL, "tune.h2.fe.priorities",          h2_parse_fe_priorities          },
 	{ CFG_GLOBAL, "tune.h2.fe.rxbuf",               h2_parse_rxbuf                  },
 	{ CFG_GLOBAL, "tune.h2.header-table-size",      h2_parse_header_table_size      },
 	{ CFG_GLOBAL, "tune.h2.initial-window-size",    h2_parse_initial_window_size    },
@@ -8867,8 +9460,10 @@ static int init_h2()
 	uint max_bufs;
 	uint rx_bufs;
 
+	/* the same pool is used for decoding and encoding tables */
 	pool_head_hpack_tbl = create_pool("hpack_tbl",
-	                                  h2_settings_header_table_size,
+	                                  MAX(h2_settings_header_table_size,
+	                                      MAX(h2_fe_encoder_table_size, h2_be_encoder_table_size)),
 	                                  MEM_F_SHARED|MEM_F_EXACT);
 	if (!pool_head_hpack_tbl) {
 		ha_alert("failed to allocate hpack_tbl memory pool\n");
@@ -8904,3 +9499,117 @@ static int init_h2()
 }
 
 REGISTER_POST_CHECK(init_h2);
+
+/* allocate the per-thread copy of the HPACK encoder's dynamic table, used to
+ * restart header blocks. Returns non-zero on success, zero on failure.
+ */
+static int h2_alloc_hblk_per_thread()
+{
+	if (!h2_fe_encoder_table_size && !h2_be_encoder_table_size)
+		return 1;
+
+	h2_hblk.dht = malloc(pool_head_hpack_tbl->size);
+	return h2_hblk.dht != NULL;
+}
+
+static void h2_free_hblk_per_thread()
+{
+	ha_free(&h2_hblk.dht);
+}
+
+REGISTER_PER_THREAD_ALLOC(h2_alloc_hblk_per_thread);
+REGISTER_PER_THREAD_FREE(h2_free_hblk_per_thread);
+
+/* Encodes header blocks with the HPACK encoder's dynamic table of a fake
+ * connection whose peer shrinks its table to zero then enlarges it again, the
+ * first block following the enlargement being aborted then restarted. The
+ * decoder's table must remain in sync with the encoder's one. Returns 0 on
+ * success, non-zero on failure.
+ */
+int h2_hblk_unittest(int argc, char **argv)
+{
+	static const struct http_hdr fields[] = {
+		{ IST("server"),        IST("haproxy")            },
+		{ IST("content-type"),  IST("application/json")   },
+		{ IST("cache-control"), IST("private, max-age=0") },
+		{ IST("x-request-id"),  IST("ad8a1f0d-6f1b-4b8a") },
+	};
+	/* peer's SETTINGS_HEADER_TABLE_SIZE before each block, and whether a
+	 * first attempt of the block is aborted.
+	 */
+	static const struct { uint32_t shts; int abort; } steps[] = {
+		{ 4096, 0 }, { 4096, 0 }, { 0, 0 }, { 4096, 1 }, { 4096, 0 }, { 256, 1 },
+	};
+	const int nbf = sizeof(fields) / sizeof(fields[0]);
+	struct h2_counters counters = { };
+	struct h2c h2c = { };
+	struct http_hdr list[16];
+	struct hpack_dht *ddht = NULL;
+	char out_area[1024], tmp_area[1024];
+	struct buffer out, tmp;
+	int step, fld, attempt;
+	int err = 1;
+
+	if (!pool_head_hpack_tbl)
+		pool_head_hpack_tbl = create_pool("hpack_tbl", 4096, MEM_F_SHARED|MEM_F_EXACT);
+
+	h2_hblk.dht = malloc(pool_head_hpack_tbl->size);
+	h2c.edht = hpack_dht_alloc();
+	ddht = hpack_dht_alloc();
+	if (!h2_hblk.dht || !h2c.edht || !ddht)
+		goto out;
+
+	hpack_dht_init(h2c.edht, 4096);
+	h2c.shts = 4096;
+	h2c.px_counters = &counters;
+
+	for (step = 0; step < sizeof(steps) / sizeof(steps[0]); step++) {
+		if (steps[step].shts != h2c.shts) {
+			h2c.shts = steps[step].shts;
+			h2c.flags |= H2_CF_SHTS_UPDATED;
+		}
+
+		for (attempt = steps[step].abort; attempt >= 0; attempt--) {
+			out = b_make(out_area, sizeof(out_area), 0, 0);
+			if (!h2c_start_hblk(&h2c, &out))
+				goto out;
+			for (fld = 0; fld < nbf; fld++) {
+				if (!h2c_hpack_encode(&h2c, &out, fields[fld].n, fields[fld].v))
+					goto out;
+			}
+			if (attempt)
+				h2c_abort_hblk(&h2c);
+		}
+		h2c_commit_hblk(&h2c);
+
+		/* our decoder ignores the size updates, apply it as the peer
+		 * would before decoding the block.
+		 */
+		if (ddht->size != h2c.shts && hpack_dht_resize(ddht, h2c.shts) < 0)
+			goto out;
+
+		tmp = b_make(tmp_area, sizeof(tmp_area), 0, 0);
+		/* the end marker is counted */
+		if (hpack_decode_frame(ddht, (const uint8_t *)out.area, out.data,
+		                       list, sizeof(list) / sizeof(list[0]), &tmp) != nbf + 1)
+			goto out;
+
+		for (fld = 0; fld < nbf; fld++) {
+			if (!isteq(list[fld].n, fields[fld].n) || !isteq(list[fld].v, fields[fld].v))
+				goto out;
+		}
+
+		if (h2c.edht->size != ddht->size || h2c.edht->used != ddht->used ||
+		    h2c.edht->total != ddht->total)
+			goto out;
+	}
+
+	err = 0;
+ out:
+	hpack_dht_free(ddht);
+	hpack_dht_free(h2c.edht);
+	ha_free(&h2_hblk.dht);
+	return err;
+}
+
+REGISTER_UNITTEST("h2_hblk", h2_hblk_unittest);
@@ -139,6 +139,11 @@ static struct qcs *qcs_new(struct qcc *qcc, uint64_t id, enum qcs_type type)
 	qcs->sd = NULL;
 	qcs->flags = QC_SF_NONE;
 	qcs->st = QC_SS_IDLE;
+	/* RFC9218 default priority for request streams, unidirectional ones
+	 * carry control data and are always served first.
+	 */
+	qcs->urg = quic_stream_is_uni(id) ? 0 : 3;
+	qcs->incr = 0;
 	qcs->ctx = NULL;
 
 	/* App callback attach may register the stream for http-request wait.
@@ -1582,6 +1587,64 @@ static void qcc_clear_frms(struct qcc *qcc)
 	}
 }
 
+/* Returns true if RFC9218 priorities are used to order <qcc> send_list. */
+static inline int qcc_use_prio(const struct qcc *qcc)
+{
+	return !(qcc->flags & QC_CF_IS_BACK) &&
+	       !(quic_tune.fe.opts & QUIC_TUNE_FE_PRIO_OFF);
+}
+
+/* Inserts <qcs> into <head> send list. If RFC9218 priorities are used, the
+ * stream is placed after streams with a lower urgency value and after
+ * reset/aborted/out-of-band ones which must remain in front. Within the same
+ * urgency, non-incremental streams are sorted by ID and incremental ones are
+ * appended after them so that they are served round-robin. Otherwise the
+ * stream is simply appended.
+ */
+static void qcs_insert_send_list(struct list *head, struct qcs *qcs)
+{
+	struct list *pos;
+
+	if (!qcc_use_prio(qcs->qcc)) {
+		LIST_APPEND(head, &qcs->el_send);
+		return;
+	}
+
+	for (pos = head->p; pos != head; pos = pos->p) {
+		const struct qcs *e = LIST_ELEM(pos, struct qcs *, el_send);
+
+		if ((e->flags & (QC_SF_TO_RESET|QC_SF_TO_STOP_SENDING|QC_SF_TXBUB_OOB)) ||
+		    e->urg < qcs->urg ||
+		    (e->urg == qcs->urg && (qcs->incr || (!e->incr && e->id < qcs->id))))
+			break;
+	}
+	LIST_INSERT(pos, &qcs->el_send);
+}
+
+/* Updates the RFC9218 priority of <qcs>. If the stream is already registered
+ * for emission, it is repositioned in its connection send_list. Nothing is
+ * done if priorities are disabled.
+ */
+void qcs_set_prio(struct qcs *qcs, int urg, int incr)
+{
+	struct qcc *qcc = qcs->qcc;
+
+	if (!qcc_use_prio(qcc) || (qcs->urg == urg && qcs->incr == incr))
+		return;
+
+	TRACE_STATE("updating stream priority", QMUX_EV_QCS_SEND, qcc->conn, qcs);
+	qcs->urg = urg;
+	qcs->incr = incr;
+
+	if (LIST_INLIST(&qcs->el_send) &&
+	    !(qcs->flags & (QC_SF_TO_RESET|QC_SF_TO_STOP_SENDING|QC_SF_TXBUB_OOB))) {
+		/* Prepared frames follow the previous order. */
+		qcc_clear_frms(qcc);
+		LIST_DEL_INIT(&qcs->el_send);
+		qcs_insert_send_list(&qcc->send_list, qcs);
+	}
+}
+
 /* Register <qcs> stream for emission of STREAM, STOP_SENDING or RESET_STREAM.
  * Set <urg> to true if stream should be emitted in priority. This is useful
  * when sending STOP_SENDING or RESET_STREAM, or for emission on an application
@@ -1602,7 +1665,7 @@ static void _qcc_send_stream(struct qcs *qcs, int urg)
 	}
 	else {
 		if (!LIST_INLIST(&qcs->el_send))
-			LIST_APPEND(&qcs->qcc->send_list, &qcs->el_send);
+			qcs_insert_send_list(&qcc->send_list, qcs);
 	}
 }
 
@@ -1672,6 +1735,23 @@ void qcc_send_stream(struct qcs *qcs, int urg, int count)
 	TRACE_LEAVE(QMUX_EV_QCS_SEND, qcc->conn, qcs);
 }
 
+/* Schedules a new decoding of <qcs> Rx data which the application layer was
+ * previously unable to process, for example due to a dependency on another
+ * stream. Nothing is done if no data is available or on connection error.
+ */
+void qcc_wakeup_recv(struct qcs *qcs)
+{
+	struct qcc *qcc = qcs->qcc;
+
+	if (qcc->flags & QC_CF_ERRL || LIST_INLIST(&qcs->el_recv) ||
+	    !qcs_rx_avail_data(qcs))
+		return;
+
+	TRACE_STATE("schedule stream decoding", QMUX_EV_QCS_RECV, qcc->conn, qcs);
+	LIST_APPEND(&qcc->recv_list, &qcs->el_recv);
+	tasklet_wakeup(qcc->wait_event.tasklet);
+}
+
 /* Prepare for the emission of STOP_SENDING on <qcs>. */
 void qcc_abort_stream_read(struct qcs *qcs)
 {
@@ -2855,7 +2935,8 @@ static int qcc_emit_rs_ss(struct qcc *qcc)
 static int qcc_build_frms(struct qcc *qcc, struct list *qcs_failed)
 {
 	struct list *frms = &qcc->tx.frms;
-	struct qcs *qcs, *qcs_tmp, *first_qcs = NULL;
+	struct list moved = LIST_HEAD_INIT(moved);
+	struct qcs *qcs, *qcs_tmp;
 	uint64_t window_conn = qfctl_rcap(&qcc->tx.fc);
 	int ret = 0, total = 0;
 
@@ -2865,10 +2946,6 @@ static int qcc_build_frms(struct qcc *qcc, struct list *qcs_failed)
 	BUG_ON(!LIST_ISEMPTY(&qcc->tx.frms));
 
 	list_for_each_entry_safe(qcs, qcs_tmp, &qcc->send_list, el_send) {
-		/* Check if all QCS were processed. */
-		if (qcs == first_qcs)
-			break;
-
 		TRACE_DATA("prepare for data transfer", QMUX_EV_QCC_SEND, qcc->conn, qcs);
 
 		/* Streams with RS/SS must be handled via qcc_emit_rs_ss(). */
@@ -2891,17 +2968,20 @@ static int qcc_build_frms(struct qcc *qcc, struct list *qcs_failed)
 			total += ret;
 			if (ret) {
 				/* Move QCS with some bytes transferred at the
-				 * end of send-list for next iterations.
+				 * end of send-list (or of its urgency class) for
+				 * next iterations, once all streams are processed.
 				 */
 				LIST_DEL_INIT(&qcs->el_send);
-				LIST_APPEND(&qcc->send_list, &qcs->el_send);
-				/* Remember first moved QCS as checkpoint to interrupt loop */
-				if (!first_qcs)
-					first_qcs = qcs;
+				LIST_APPEND(&moved, &qcs->el_send);
 			}
 		}
 	}
 
+	list_for_each_entry_safe(qcs, qcs_tmp, &moved, el_send) {
+		LIST_DEL_INIT(&qcs->el_send);
+		qcs_insert_send_list(&qcc->send_list, qcs);
+	}
+
 	TRACE_LEAVE(QMUX_EV_QCC_SEND, qcc->conn);
 	return total;
 }
@@ -3079,7 +3159,7 @@ static int qcc_io_send(struct qcc *qcc)
 	if (!LIST_ISEMPTY(&qcs_failed)) {
 		list_for_each_entry_safe(qcs, qcs_tmp, &qcs_failed, el_send) {
 			LIST_DEL_INIT(&qcs->el_send);
-			LIST_APPEND(&qcc->send_list, &qcs->el_send);
+			qcs_insert_send_list(&qcc->send_list, qcs);
 		}
 
 		if (!qfctl_rblocked(&qcc->tx.fc))
@@ -3159,8 +3239,11 @@ static int qcc_io_recv(struct qcc *qcc)
 			ret = qcc_decode_qcs(qcc, qcs);
 			LIST_DEL_INIT(&qcs->el_recv);
 
-			if (ret <= 0)
+			if (ret < 0)
 				goto done;
+			/* stream cannot progress, continue with the next one */
+			if (!ret)
+				break;
 		}
 	}
 
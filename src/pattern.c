@@ -22,12 +22,17 @@
 #include <import/lru.h>
 
 #include <haproxy/api.h>
+#include <haproxy/cfgparse.h>
+#include <haproxy/clock.h>
 #include <haproxy/global.h>
 #include <haproxy/log.h>
+#include <haproxy/mapsnap.h>
 #include <haproxy/net_helper.h>
 #include <haproxy/pattern.h>
 #include <haproxy/regex.h>
 #include <haproxy/sample.h>
+#include <haproxy/task.h>
+#include <haproxy/ticks.h>
 #include <haproxy/tools.h>
 #include <haproxy/xxhash.h>
 
@@ -87,10 +92,10 @@ int (*const pat_index_fcts[PAT_MATCH_NUM])(struct pattern_expr *, struct pattern
 	[PAT_MATCH_LEN]   = pat_idx_list_val,
 	[PAT_MATCH_STR]   = pat_idx_tree_str,
 	[PAT_MATCH_BEG]   = pat_idx_tree_pfx,
-	[PAT_MATCH_SUB]   = pat_idx_list_str,
+	[PAT_MATCH_SUB]   = pat_idx_acm_str,
 	[PAT_MATCH_DIR]   = pat_idx_list_str,
 	[PAT_MATCH_DOM]   = pat_idx_list_str,
-	[PAT_MATCH_END]   = pat_idx_list_str,
+	[PAT_MATCH_END]   = pat_idx_acm_str,
 	[PAT_MATCH_REG]   = pat_idx_list_reg,
 	[PAT_MATCH_REGM]  = pat_idx_list_regm,
 };
@@ -157,6 +162,75 @@ struct list pattern_reference = LIST_HEAD_INIT(pattern_reference);
 static THREAD_LOCAL struct lru64_head *pat_lru_tree;
 static unsigned long long pat_lru_seed __read_mostly;
 
+/* bitmap of the candidate regex during a prefiltered lookup, and its size */
+static THREAD_LOCAL long *pat_acm_cand;
+static THREAD_LOCAL uint pat_acm_cand_words;
+
+/* counts the perfect hash lookups to time some of them */
+static THREAD_LOCAL uint pat_phash_sample;
+
+/* Value of the last entry found in a snapshot. It is distinct from
+ * static_sample_data so that pattern_exec_match() copies it out of the
+ * snapshot, which may be released once the expression is unlocked.
+ */
+static THREAD_LOCAL struct sample_data pat_snap_data;
+
+/* Below this number of patterns, walking the list is cheaper than building
+ * and using an Aho-Corasick automaton.
+ */
+#define PAT_ACM_MIN_ENTRIES 8
+
+/* Minimum delay between two rebuilds of the same automaton, in milliseconds.
+ * This bounds the cost of frequent updates at run time, the list being walked
+ * while the automaton is outdated.
+ */
+#define PAT_ACM_REBUILD_DELAY 1000
+
+/* Below this number of prefixes in an expression's IP trees, these trees are
+ * looked up directly, which saves the memory of their index.
+ */
+#define PAT_LPM_MIN_ENTRIES 1024
+
+/* Number of leading address bits directly indexed in the IPv4 and IPv6 LPM
+ * tables. 18 bits make /24 networks end on the first trie level.
+ */
+#define PAT_LPM_DBITS_V4 18
+#define PAT_LPM_DBITS_V6 16
+
+/* Minimum delay between two rebuilds of the same IP index, in milliseconds. */
+#define PAT_LPM_REBUILD_DELAY 1000
+
+/* Number of tree nodes and prefixes processed by the IP index rebuild task
+ * before yielding.
+ */
+#define PAT_LPM_BUILD_BATCH 65536
+
+/* Below this number of keys in an expression's string tree, the tree is
+ * looked up directly, which saves the memory of its perfect hash.
+ */
+#define PAT_PHASH_MIN_ENTRIES 1024
+
+/* Average number of keys per bucket of the perfect hash, which costs 4 bytes
+ * per bucket. Larger buckets are harder to place.
+ */
+#define PAT_PHASH_BUCKET_LOAD 2
+
+/* Largest bucket of the perfect hash, and number of seeds tried before giving
+ * up when buckets are too large or cannot be placed.
+ */
+#define PAT_PHASH_MAX_BUCKET 32
+#define PAT_PHASH_MAX_SEEDS  8
+
+/* Minimum delay between two rebuilds of the same perfect hash, in
+ * milliseconds, and number of tree nodes, keys or placement attempts processed
+ * by the rebuild task before yielding.
+ */
+#define PAT_PHASH_REBUILD_DELAY 1000
+#define PAT_PHASH_BUILD_BATCH   65536
+
+/* One perfect hash lookup out of this number plus one is timed for "show map" */
+#define PAT_PHASH_SAMPLE_MASK 1023
+
 unsigned long long patterns_added = 0;
 unsigned long long patterns_freed = 0;
 
@@ -477,22 +551,472 @@ static inline int pat_match_ensure_str(struct sample *smp)
 	return 1;
 }
 
+/* A key collected from a string tree to build its perfect hash */
+struct pat_phash_ent {
+	uint64_t hash;              /* hash of the key */
+	struct pattern_tree *elt;   /* tree entry */
+};
+
+/* Steps of a perfect hash build */
+enum pat_phash_step {
+	PAT_PHASH_STEP_START = 0,   /* start with a new seed */
+	PAT_PHASH_STEP_COLLECT,     /* collect and hash the tree's keys */
+	PAT_PHASH_STEP_PREPARE,     /* group them by bucket */
+	PAT_PHASH_STEP_PLACE,       /* find the displacement of each bucket */
+};
+
+/* State of a perfect hash build, which may be spread over several calls. As
+ * for the IP index, the tree is looked up while collecting its keys so the
+ * build must be restarted if it changes between two calls.
+ */
+struct pat_phash_job {
+	struct pat_phash new;       /* index being built */
+	struct pat_phash_ent *ents; /* collected keys */
+	uint32_t *order;            /* keys sorted by bucket */
+	uint32_t *start;            /* first key of each bucket in <order> */
+	uint32_t *buckets;          /* buckets sorted by decreasing size */
+	long *taken;                /* slots already used */
+	struct ebmb_node *next;     /* next tree node to collect */
+	uint32_t ents_room;         /* allocated keys */
+	uint32_t cursor;            /* next bucket to place in <buckets> */
+	uint32_t seeds;             /* number of seeds tried */
+	enum pat_phash_step step;   /* current step */
+};
+
+/* Returns the tree entry holding key <key> of length <len> in perfect hash
+ * <ph>, or NULL if it is not there. <key> must be zero-terminated, and the
+ * hash must be built.
+ */
+static inline struct pattern_tree *pat_phash_lookup(const struct pat_phash *ph, const char *key, size_t len)
+{
+	const struct pat_phash_slot *slot;
+	uint64_t hash = XXH3(key, len, ph->seed);
+
+	slot = &ph->slots[mapsnap_hash_pos(hash, ph->disp[mapsnap_hash_bucket(hash, ph->nb_buckets)], ph->nb_keys)];
+	if (slot->check != (uint32_t)(hash >> 32) || strcmp((const char *)slot->elt->node.key, key) != 0)
+		return NULL;
+	return slot->elt;
+}
+
+/* Returns non-zero if the perfect hash of expression <expr> was built for the
+ * current state of its reference, in which case it needs no rebuild.
+ */
+static inline int pat_phash_valid(const struct pattern_expr *expr)
+{
+	const struct pat_phash *ph = expr->phash;
+
+	return ph->revision == HA_ATOMIC_LOAD(&expr->ref->revision) &&
+	       ph->gen_id == HA_ATOMIC_LOAD(&expr->ref->curr_gen);
+}
+
+/* Returns 2 if the perfect hash of expression <expr> may be looked up instead
+ * of its tree, 1 if only the keys found there may be trusted because entries
+ * were added since it was built, or 0 if it must not be used.
+ */
+static inline int pat_phash_usable(const struct pattern_expr *expr)
+{
+	const struct pat_phash *ph = expr->phash;
+
+	if (!ph->disp || ph->gen_id != HA_ATOMIC_LOAD(&expr->ref->curr_gen) ||
+	    ph->removals != HA_ATOMIC_LOAD(&expr->ref->removals))
+		return 0;
+	return ph->revision == HA_ATOMIC_LOAD(&expr->ref->revision) ? 2 : 1;
+}
+
+/* Releases the tables of perfect hash <ph>, leaving it in the "not built" state */
+static void pat_phash_free_tbl(struct pat_phash *ph)
+{
+	ha_free(&ph->disp);
+	ha_free(&ph->slots);
+	ph->nb_keys = ph->nb_buckets = 0;
+}
+
+/* Releases the work areas of <job>, and the tables it built if <all> is set */
+static void pat_phash_job_reset(struct pat_phash_job *job, int all)
+{
+	ha_free(&job->ents);
+	ha_free(&job->order);
+	ha_free(&job->start);
+	ha_free(&job->buckets);
+	ha_free(&job->taken);
+	job->ents_room = 0;
+	if (all)
+		pat_phash_free_tbl(&job->new);
+}
+
+/* Prepares <job> to build the perfect hash of the string tree of expression
+ * <expr> for the current state of its reference.
+ */
+static void pat_phash_job_init(struct pattern_expr *expr, struct pat_phash_job *job)
+{
+	memset(job, 0, sizeof(*job));
+	job->new.revision = expr->ref->revision;
+	job->new.removals = expr->ref->removals;
+	job->new.gen_id = expr->ref->curr_gen;
+}
+
+/* Installs the tables built by <job> into <ph>, and leaves the previous ones
+ * in the job so that they're released with it.
+ */
+static void pat_phash_job_commit(struct pat_phash *ph, struct pat_phash_job *job)
+{
+	SWAP(ph->disp, job->new.disp);
+	SWAP(ph->slots, job->new.slots);
+	SWAP(ph->nb_keys, job->new.nb_keys);
+	SWAP(ph->nb_buckets, job->new.nb_buckets);
+	ph->seed = job->new.seed;
+	ph->revision = job->new.revision;
+	ph->removals = job->new.removals;
+	ph->gen_id = job->new.gen_id;
+}
+
+/* Runs <job> building the perfect hash of the string tree of expression
+ * <expr>, with the same budget, locking and return value semantics as
+ * pat_lpm_job_run(). Too small trees are not indexed.
+ */
+static int pat_phash_job_run(struct pattern_expr *expr, struct pat_phash_job *job, uint budget)
+{
+	struct pat_phash *ph = &job->new;
+	struct pat_phash_ent *ent;
+	struct pattern_tree *elt;
+	struct ebmb_node *node;
+	uint32_t pos[PAT_PHASH_MAX_BUCKET];
+	uint32_t i, j, b, first, cnt, disp;
+	uint64_t done = 0, max_disp;
+
+ restart:
+	switch (job->step) {
+	case PAT_PHASH_STEP_START:
+		if (job->seeds++ >= PAT_PHASH_MAX_SEEDS)
+			goto fail;
+		ph->seed = ha_random64();
+		ph->nb_keys = 0;
+		job->next = ebmb_first(&expr->pattern_tree);
+		job->step = PAT_PHASH_STEP_COLLECT;
+		__fallthrough;
+
+	case PAT_PHASH_STEP_COLLECT:
+		for (node = job->next; node; node = ebmb_next(node)) {
+			if (budget && done++ >= budget) {
+				job->next = node;
+				return 0;
+			}
+
+			/* only keep the first entry of the current generation
+			 * for each key, which is the one the tree lookup returns.
+			 * Duplicates are adjacent.
+			 */
+			elt = ebmb_entry(node, struct pattern_tree, node);
+			if (elt->ref->gen_id != ph->gen_id)
+				continue;
+			if (ph->nb_keys &&
+			    strcmp((const char *)job->ents[ph->nb_keys - 1].elt->node.key, (const char *)elt->node.key) == 0)
+				continue;
+
+			if (ph->nb_keys == job->ents_room) {
+				uint32_t room = MAX(job->ents_room * 2, PAT_PHASH_MIN_ENTRIES);
+
+				ent = realloc(job->ents, (size_t)room * sizeof(*ent));
+				if (!ent)
+					goto fail;
+				job->ents = ent;
+				job->ents_room = room;
+			}
+
+			ent = &job->ents[ph->nb_keys++];
+			ent->elt = elt;
+			ent->hash = XXH3(elt->node.key, strlen((const char *)elt->node.key), ph->seed);
+		}
+
+		if (ph->nb_keys < PAT_PHASH_MIN_ENTRIES) {
+			ph->nb_keys = 0;
+			goto done;
+		}
+		job->step = PAT_PHASH_STEP_PREPARE;
+		__fallthrough;
+
+	case PAT_PHASH_STEP_PREPARE:
+		/* sort the keys by bucket, then the buckets by decreasing size,
+		 * both with a counting sort.
+		 */
+		ph->nb_buckets = (ph->nb_keys + PAT_PHASH_BUCKET_LOAD - 1) / PAT_PHASH_BUCKET_LOAD;
+		ph->disp = calloc(ph->nb_buckets, sizeof(*ph->disp));
+		ph->slots = calloc(ph->nb_keys, sizeof(*ph->slots));
+		job->order = malloc(ph->nb_keys * sizeof(*job->order));
+		job->start = calloc(ph->nb_buckets + 1, sizeof(*job->start));
+		job->buckets = malloc(ph->nb_buckets * sizeof(*job->buckets));
+		job->taken = calloc((ph->nb_keys + LONGBITS - 1) / LONGBITS, sizeof(*job->taken));
+		if (!ph->disp || !ph->slots || !job->order || !job->start || !job->buckets || !job->taken)
+			goto fail;
+
+		for (i = 0; i < ph->nb_keys; i++)
+			job->start[mapsnap_hash_bucket(job->ents[i].hash, ph->nb_buckets) + 1]++;
+
+		for (b = 0; b < ph->nb_buckets; b++) {
+			if (job->start[b + 1] > PAT_PHASH_MAX_BUCKET) {
+				/* unlucky seed */
+				pat_phash_job_reset(job, 1);
+				job->step = PAT_PHASH_STEP_START;
+				goto restart;
+			}
+			job->start[b + 1] += job->start[b];
+		}
+
+		for (i = 0; i < ph->nb_keys; i++)
+			job->order[job->start[mapsnap_hash_bucket(job->ents[i].hash, ph->nb_buckets)]++] = i;
+		for (b = ph->nb_buckets; b; b--)
+			job->start[b] = job->start[b - 1];
+		job->start[0] = 0;
+
+		{
+			uint32_t sizes[PAT_PHASH_MAX_BUCKET + 2] = { };
+
+			for (b = 0; b < ph->nb_buckets; b++)
+				sizes[PAT_PHASH_MAX_BUCKET - (job->start[b + 1] - job->start[b]) + 1]++;
+			for (i = 1; i < PAT_PHASH_MAX_BUCKET + 2; i++)
+				sizes[i] += sizes[i - 1];
+			for (b = 0; b < ph->nb_buckets; b++)
+				job->buckets[sizes[PAT_PHASH_MAX_BUCKET - (job->start[b + 1] - job->start[b])]++] = b;
+		}
+
+		done += ph->nb_keys;
+		job->cursor = 0;
+		job->step = PAT_PHASH_STEP_PLACE;
+		__fallthrough;
+
+	case PAT_PHASH_STEP_PLACE:
+		/* the last buckets need about as many attempts as there are keys
+		 * to find a free slot, so failing to place a bucket after many
+		 * more means that two of its keys cannot be separated.
+		 */
+		max_disp = MIN((uint64_t)ph->nb_keys * 32 + 1024, 0xffffffffULL);
+		for (; job->cursor < ph->nb_buckets; job->cursor++) {
+			if (budget && done >= budget)
+				return 0;
+
+			b = job->buckets[job->cursor];
+			first = job->start[b];
+			cnt = job->start[b + 1] - first;
+			if (!cnt)
+				break;
+
+			for (disp = 0; ; disp++) {
+				if (disp >= max_disp) {
+					pat_phash_job_reset(job, 1);
+					job->step = PAT_PHASH_STEP_START;
+					goto restart;
+				}
+
+				for (i = 0; i < cnt; i++) {
+					pos[i] = mapsnap_hash_pos(job->ents[job->order[first + i]].hash, disp, ph->nb_keys);
+					if (ha_bit_test(pos[i], job->taken))
+						break;
+					for (j = 0; j < i && pos[j] != pos[i]; j++)
+						;
+					if (j < i)
+						break;
+				}
+				if (i == cnt)
+					break;
+			}
+
+			for (i = 0; i < cnt; i++) {
+				ent = &job->ents[job->order[first + i]];
+				ha_bit_set(pos[i], job->taken);
+				ph->slots[pos[i]].elt = ent->elt;
+				ph->slots[pos[i]].check = ent->hash >> 32;
+			}
+			ph->disp[b] = disp;
+			done += disp + 1;
+		}
+	}
+
+ done:
+	pat_phash_job_reset(job, 0);
+	return 1;
+
+ fail:
+	pat_phash_job_reset(job, 1);
+	return -1;
+}
+
+/* Builds at once into <ph> the perfect hash of the string tree of expression
+ * <expr> for the current state of its reference. The expression must at least
+ * be locked for reading, or not shared yet. Returns non-zero on success, or
+ * zero on memory allocation failure, in which case the tree will be used.
+ */
+static int pat_phash_build(struct pattern_expr *expr, struct pat_phash *ph)
+{
+	struct pat_phash_job job;
+	int ret;
+
+	pat_phash_job_init(expr, &job);
+	ret = pat_phash_job_run(expr, &job, 0);
+	pat_phash_job_commit(ph, &job);
+	pat_phash_job_reset(&job, 1);
+	return ret > 0;
+}
+
+/* Rebuilds the outdated perfect hash of the expression passed in <context>,
+ * in batches of PAT_PHASH_BUILD_BATCH steps, the same way as pat_lpm_task().
+ */
+static struct task *pat_phash_task(struct task *t, void *context, unsigned int state)
+{
+	struct pattern_expr *expr = context;
+	struct pat_phash *ph = expr->phash;
+	struct pat_phash_job *job = ph->job;
+	int ret;
+
+	HA_RWLOCK_RDLOCK(PATEXP_LOCK, &expr->lock);
+	if (!job) {
+		if (pat_phash_valid(expr)) {
+			HA_RWLOCK_RDUNLOCK(PATEXP_LOCK, &expr->lock);
+			return t;
+		}
+		job = malloc(sizeof(*job));
+		if (!job) {
+			HA_RWLOCK_RDUNLOCK(PATEXP_LOCK, &expr->lock);
+			return t;
+		}
+		pat_phash_job_init(expr, job);
+		ph->job = job;
+	}
+	else if (job->new.revision != expr->ref->revision || job->new.gen_id != expr->ref->curr_gen) {
+		pat_phash_job_reset(job, 1);
+		pat_phash_job_init(expr, job);
+	}
+	ret = pat_phash_job_run(expr, job, PAT_PHASH_BUILD_BATCH);
+	HA_RWLOCK_RDUNLOCK(PATEXP_LOCK, &expr->lock);
+
+	if (!ret) {
+		task_wakeup(t, TASK_WOKEN_OTHER);
+		return t;
+	}
+
+	/* on failure the tables are empty and the tree will be used */
+	HA_RWLOCK_WRLOCK(PATEXP_LOCK, &expr->lock);
+	pat_phash_job_commit(ph, job);
+	ph->next_build = tick_add(now_ms, MS_TO_TICKS(PAT_PHASH_REBUILD_DELAY));
+	ph->job = NULL;
+	HA_RWLOCK_WRUNLOCK(PATEXP_LOCK, &expr->lock);
+
+	pat_phash_job_reset(job, 1);
+	free(job);
+	return t;
+}
+
+/* Wakes up the task rebuilding the perfect hash of expression <expr>, unless
+ * it was already rebuilt less than PAT_PHASH_REBUILD_DELAY ago.
+ */
+static void pat_phash_refresh(struct pattern_expr *expr)
+{
+	struct pat_phash *ph = expr->phash;
+
+	if (!ph->task)
+		return;
+	if (tick_isset(ph->next_build) && !tick_is_expired(ph->next_build, now_ms))
+		return;
+	task_wakeup(ph->task, TASK_WOKEN_OTHER);
+}
+
+/* Appends to <out> the size of the snapshot of reference <ref> and the size
+ * and average lookup time of the perfect hashes of its expressions, for "show
+ * map".
+ */
+void pat_ref_show_index(struct pat_ref *ref, struct buffer *out)
+{
+	struct pattern_expr *expr;
+	struct pat_phash *ph;
+
+	HA_RWLOCK_RDLOCK(PATREF_LOCK, &ref->lock);
+	if (ref->snap)
+		chunk_appendf(out, " snap_ver=%u snap_entries=%u snap_mem=%llukB",
+		              ref->snap->gen_id, ref->snap->hdr->nb_ents,
+		              (ullong)ref->snap->hdr->size >> 10);
+	HA_RWLOCK_RDUNLOCK(PATREF_LOCK, &ref->lock);
+
+	list_for_each_entry(expr, &ref->pat, list) {
+		ph = expr->phash;
+		if (!ph)
+			continue;
+
+		HA_RWLOCK_RDLOCK(PATEXP_LOCK, &expr->lock);
+		if (ph->disp) {
+			ullong lookups = HA_ATOMIC_LOAD(&ph->lookups);
+
+			chunk_appendf(out, " phash_keys=%u phash_mem=%llukB phash_lookup=%lluns",
+			              ph->nb_keys,
+			              (ullong)(ph->nb_buckets * sizeof(*ph->disp) + ph->nb_keys * sizeof(*ph->slots)) >> 10,
+			              lookups ? (ullong)(HA_ATOMIC_LOAD(&ph->lookup_ns) / lookups) : 0ULL);
+		}
+		HA_RWLOCK_RDUNLOCK(PATEXP_LOCK, &expr->lock);
+	}
+}
+
 /* NB: For two strings to be identical, it is required that their length match */
 struct pattern *pat_match_str(struct sample *smp, struct pattern_expr *expr, int fill)
 {
-	int icase;
+	int icase, usable;
 	struct ebmb_node *node;
 	struct pattern_tree *elt;
 	struct pattern_list *lst;
 	struct pattern *pattern;
 	struct pattern *ret = NULL;
 	struct lru64 *lru = NULL;
+	const struct mapsnap *snap = expr->ref->snap;
 
-	/* Lookup a string in the expression's pattern tree. */
+	/* The entries of a snapshot precede all other ones. Only expressions
+	 * which may look it up directly remain attached to it, see
+	 * pat_snap_usable().
+	 */
+	if (snap && snap->gen_id == expr->ref->curr_gen) {
+		const struct mapsnap_ent *ent;
+		const char *val;
+
+		if (!pat_match_ensure_str(smp))
+			return NULL;
+
+		ent = mapsnap_lookup(snap, smp->data.u.str.area, strlen(smp->data.u.str.area));
+		if (ent) {
+			if (fill) {
+				static_pattern.data = NULL;
+				val = mapsnap_val(snap, ent);
+				if (val && expr->pat_head->parse_smp &&
+				    expr->pat_head->parse_smp(val, &pat_snap_data))
+					static_pattern.data = &pat_snap_data;
+				static_pattern.ref = NULL;
+				static_pattern.sflags = PAT_SF_SNAP;
+				static_pattern.type = SMP_T_STR;
+				static_pattern.ptr.str = (char *)mapsnap_key(snap, ent);
+			}
+			return &static_pattern;
+		}
+	}
+
+	/* Lookup a string in the expression's pattern tree, or in its perfect
+	 * hash when possible, in which case only misses are checked in the
+	 * tree if entries were added since the hash was built.
+	 */
 	if (!eb_is_empty(&expr->pattern_tree)) {
 		if (!pat_match_ensure_str(smp))
 			return NULL;
 
+		if (expr->phash && (usable = pat_phash_usable(expr))) {
+			uint64_t start = 0;
+
+			if (unlikely(!(++pat_phash_sample & PAT_PHASH_SAMPLE_MASK)))
+				start = now_mono_time();
+			elt = pat_phash_lookup(expr->phash, smp->data.u.str.area, strlen(smp->data.u.str.area));
+			if (unlikely(start)) {
+				HA_ATOMIC_ADD(&expr->phash->lookup_ns, now_mono_time() - start);
+				HA_ATOMIC_INC(&expr->phash->lookups);
+			}
+			if (elt)
+				goto found;
+			if (usable == 2)
+				goto list;
+		}
+
 		node = ebst_lookup(&expr->pattern_tree, smp->data.u.str.area);
 
 		while (node) {
@@ -501,6 +1025,7 @@ struct pattern *pat_match_str(struct sample *smp, struct pattern_expr *expr, int
 				node = ebmb_next_dup(node);
 				continue;
 			}
+		found:
 			if (fill) {
 				static_pattern.data = elt->data;
 				static_pattern.ref = elt->ref;
@@ -512,6 +1037,7 @@ struct pattern *pat_match_str(struct sample *smp, struct pattern_expr *expr, int
 		}
 	}
 
+ list:
 	/* look in the list */
 	if (pat_lru_tree && !LIST_ISEMPTY(&expr->patterns) && expr->ref->entry_cnt >= 20) {
 		unsigned long long seed = pat_lru_seed ^ (long)expr;
@@ -588,6 +1114,331 @@ struct pattern *pat_match_bin(struct sample *smp, struct pattern_expr *expr, int
 	return ret;
 }
 
+/* Releases the nodes and pattern index of automaton <acm>, leaving it in the
+ * "not built" state.
+ */
+static void pat_acm_reset(struct pat_acm *acm)
+{
+	ha_free(&acm->nodes);
+	ha_free(&acm->root);
+	ha_free(&acm->pats);
+	ha_free(&acm->same);
+	ha_free(&acm->dict);
+	ha_free(&acm->always);
+	acm->nb_nodes = acm->nb_pats = 0;
+}
+
+/* Returns non-zero if the automaton of expression <expr> matches the current
+ * state of its reference, in which case it may be used instead of the list.
+ */
+static inline int pat_acm_valid(const struct pattern_expr *expr)
+{
+	const struct pat_acm *acm = expr->acm;
+
+	return acm->revision == HA_ATOMIC_LOAD(&expr->ref->revision) &&
+	       acm->gen_id == HA_ATOMIC_LOAD(&expr->ref->curr_gen);
+}
+
+/* Returns the node reached from node <state> of automaton <acm> after
+ * consuming byte <c>, following failure links as needed.
+ */
+static inline uint32_t pat_acm_step(const struct pat_acm *acm, uint32_t state, unsigned char c)
+{
+	uint32_t n;
+
+	while (state) {
+		for (n = acm->nodes[state].child; n; n = acm->nodes[n].next) {
+			if (acm->nodes[n].c == c)
+				return n;
+		}
+		state = acm->nodes[state].fail;
+	}
+	return acm->root[c];
+}
+
+/* Stores into <rank> the lowest of <rank> and <other>, 0 meaning "none". */
+static inline void pat_acm_best(uint32_t *rank, uint32_t other)
+{
+	if (other && (!*rank || other < *rank))
+		*rank = other;
+}
+
+/* Sets <key> to the string to index for pattern <pat> of expression <expr>
+ * and returns its length. For regex, it is the literal the regex requires, if
+ * any, stored into <buf> of size <size>.
+ */
+static int pat_acm_key(const struct pattern_expr *expr, const struct pattern *pat,
+                       const char **key, char *buf, int size)
+{
+	if (!expr->acm->reg) {
+		*key = pat->ptr.str;
+		return pat->len;
+	}
+	*key = buf;
+	return regex_find_literal(pat->ref->pattern, !(expr->mflags & PAT_MF_IGNORE_CASE), buf, size);
+}
+
+/* (Re)builds the automaton of expression <expr> from the patterns of the
+ * reference's current generation, in list order so that the lowest rank is
+ * the first pattern the list walk would have returned. If there are too few
+ * patterns or an empty one, the automaton is left empty and the list will be
+ * walked. The same goes for regex when the prefilter is disabled or when none
+ * of them has a literal. The expression must be locked for writing, or not
+ * shared yet. Returns non-zero on success, or zero on memory allocation
+ * failure, in which case the list will be walked as well.
+ */
+static int pat_acm_build(struct pattern_expr *expr)
+{
+	struct pat_acm *acm = expr->acm;
+	struct pat_acm_node *nodes;
+	struct pattern_list *lst;
+	int icase = expr->mflags & PAT_MF_IGNORE_CASE;
+	uint32_t *queue = NULL;
+	uint32_t head, tail;
+	uint32_t state, n;
+	size_t chars = 0;
+	uint nb_pats = 0;
+	const char *key;
+	char lit[64];
+	int len, i;
+
+	pat_acm_reset(acm);
+	acm->revision = expr->ref->revision;
+	acm->gen_id = expr->ref->curr_gen;
+
+	if (acm->reg && !(global.tune.options & GTUNE_REGEX_PREFILTER))
+		return 1;
+
+	list_for_each_entry(lst, &expr->patterns, list) {
+		if (lst->pat.ref->gen_id != acm->gen_id)
+			continue;
+		len = pat_acm_key(expr, &lst->pat, &key, lit, sizeof(lit));
+		/* the list walk has its own view of empty patterns, keep it */
+		if (!len && !acm->reg)
+			return 1;
+		chars += len;
+		nb_pats++;
+	}
+
+	if (nb_pats < PAT_ACM_MIN_ENTRIES || !chars || chars >= UINT32_MAX)
+		return 1;
+
+	/* there cannot be more nodes than bytes plus the root */
+	acm->nodes = calloc(chars + 1, sizeof(*acm->nodes));
+	acm->root  = calloc(256, sizeof(*acm->root));
+	acm->pats  = calloc(nb_pats, sizeof(*acm->pats));
+	if (!acm->nodes || !acm->root || !acm->pats)
+		goto fail;
+
+	if (acm->reg) {
+		acm->same   = calloc(nb_pats, sizeof(*acm->same));
+		acm->dict   = calloc(chars + 1, sizeof(*acm->dict));
+		acm->always = calloc((nb_pats + LONGBITS - 1) / LONGBITS, sizeof(*acm->always));
+		if (!acm->same || !acm->dict || !acm->always)
+			goto fail;
+	}
+
+	/* insert all patterns into the trie */
+	nodes = acm->nodes;
+	acm->nb_nodes = 1;
+	list_for_each_entry(lst, &expr->patterns, list) {
+		if (lst->pat.ref->gen_id != acm->gen_id)
+			continue;
+
+		acm->pats[acm->nb_pats++] = &lst->pat;
+		len = pat_acm_key(expr, &lst->pat, &key, lit, sizeof(lit));
+		if (!len) {
+			/* a regex which must always be tried */
+			ha_bit_set(acm->nb_pats - 1, acm->always);
+			continue;
+		}
+
+		state = 0;
+		for (i = 0; i < len; i++) {
+			unsigned char c = key[i];
+
+			if (icase)
+				c = tolower(c);
+
+			if (!state)
+				n = acm->root[c];
+			else
+				for (n = nodes[state].child; n && nodes[n].c != c; n = nodes[n].next)
+					;
+
+			if (!n) {
+				n = acm->nb_nodes++;
+				nodes[n].c = c;
+				if (!state)
+					acm->root[c] = n;
+				else {
+					nodes[n].next = nodes[state].child;
+					nodes[state].child = n;
+				}
+			}
+			state = n;
+		}
+
+		if (acm->reg) {
+			/* all regex sharing a literal are chained */
+			acm->same[acm->nb_pats - 1] = nodes[state].best;
+			nodes[state].best = acm->nb_pats;
+		}
+		else
+			pat_acm_best(&nodes[state].best, acm->nb_pats);
+	}
+
+	/* compute the failure links in breadth-first order, so that a node's
+	 * failure target always has its own links and rank already set.
+	 */
+	queue = malloc(acm->nb_nodes * sizeof(*queue));
+	if (!queue)
+		goto fail;
+
+	head = tail = 0;
+	for (i = 0; i < 256; i++) {
+		n = acm->root[i];
+		if (n)
+			queue[tail++] = n;
+	}
+
+	while (head < tail) {
+		state = queue[head++];
+		for (n = nodes[state].child; n; n = nodes[n].next) {
+			nodes[n].fail = pat_acm_step(acm, nodes[state].fail, nodes[n].c);
+			if (acm->reg)
+				acm->dict[n] = nodes[nodes[n].fail].best ? nodes[n].fail : acm->dict[nodes[n].fail];
+			else
+				pat_acm_best(&nodes[n].best, nodes[nodes[n].fail].best);
+			queue[tail++] = n;
+		}
+	}
+	free(queue);
+
+	/* patterns usually share prefixes, release the unused nodes */
+	nodes = realloc(acm->nodes, acm->nb_nodes * sizeof(*nodes));
+	if (nodes)
+		acm->nodes = nodes;
+	if (acm->reg) {
+		uint32_t *dict = realloc(acm->dict, acm->nb_nodes * sizeof(*dict));
+
+		if (dict)
+			acm->dict = dict;
+	}
+	return 1;
+
+ fail:
+	pat_acm_reset(acm);
+	return 0;
+}
+
+/* Rebuilds the automaton of expression <expr> if it is outdated, unless it
+ * was already rebuilt less than PAT_ACM_REBUILD_DELAY ago. The expression must
+ * not be locked by the caller.
+ */
+static void pat_acm_refresh(struct pattern_expr *expr)
+{
+	struct pat_acm *acm = expr->acm;
+
+	if (tick_isset(acm->next_build) && !tick_is_expired(acm->next_build, now_ms))
+		return;
+
+	HA_RWLOCK_WRLOCK(PATEXP_LOCK, &expr->lock);
+	if (!pat_acm_valid(expr) &&
+	    (!tick_isset(acm->next_build) || tick_is_expired(acm->next_build, now_ms))) {
+		pat_acm_build(expr);
+		acm->next_build = tick_add(now_ms, MS_TO_TICKS(PAT_ACM_REBUILD_DELAY));
+	}
+	HA_RWLOCK_WRUNLOCK(PATEXP_LOCK, &expr->lock);
+}
+
+/* Looks up sample <smp> in the automaton of expression <expr>, which must be
+ * built and valid. If <end> is set, only patterns matching the end of the
+ * sample are considered, otherwise any pattern contained in the sample is.
+ * Returns the first matching pattern in list order, or NULL if none matches.
+ */
+static struct pattern *pat_acm_lookup(const struct pattern_expr *expr, const struct sample *smp, int end)
+{
+	const struct pat_acm *acm = expr->acm;
+	const unsigned char *c = (const unsigned char *)smp->data.u.str.area;
+	const unsigned char *e = c + smp->data.u.str.data;
+	int icase = expr->mflags & PAT_MF_IGNORE_CASE;
+	uint32_t best = acm->nodes[0].best;
+	uint32_t state = 0;
+
+	for (; c < e; c++) {
+		state = pat_acm_step(acm, state, icase ? tolower(*c) : *c);
+		if (!end) {
+			pat_acm_best(&best, acm->nodes[state].best);
+			if (best == 1)
+				break;
+		}
+	}
+
+	/* the final node's rank covers all patterns which are suffixes */
+	if (end)
+		best = acm->nodes[state].best;
+
+	return best ? acm->pats[best - 1] : NULL;
+}
+
+/* Looks up sample <smp> against the regex of expression <expr>, whose
+ * automaton must be built and valid: only the regex whose literal appears in
+ * the sample, or which have none, are run, in list order. The first matching
+ * pattern, or NULL if none matches, is stored into <ret>. Returns zero if the
+ * lookup could not be performed for lack of memory, in which case the list
+ * must be walked instead.
+ */
+static int pat_acm_match_reg(const struct pattern_expr *expr, struct sample *smp, struct pattern **ret)
+{
+	const struct pat_acm *acm = expr->acm;
+	const unsigned char *c = (const unsigned char *)smp->data.u.str.area;
+	const unsigned char *e = c + smp->data.u.str.data;
+	int icase = expr->mflags & PAT_MF_IGNORE_CASE;
+	uint words = (acm->nb_pats + LONGBITS - 1) / LONGBITS;
+	struct pattern *pattern;
+	long *cand = pat_acm_cand;
+	unsigned long bits;
+	uint32_t state = 0;
+	uint32_t s, r;
+	uint w;
+
+	if (unlikely(words > pat_acm_cand_words)) {
+		cand = realloc(pat_acm_cand, words * sizeof(*cand));
+		if (!cand)
+			return 0;
+		pat_acm_cand = cand;
+		pat_acm_cand_words = words;
+	}
+	memcpy(cand, acm->always, words * sizeof(*cand));
+
+	for (; c < e; c++) {
+		state = pat_acm_step(acm, state, icase ? tolower(*c) : *c);
+		s = acm->nodes[state].best ? state : acm->dict[state];
+		while (s) {
+			r = acm->nodes[s].best;
+			/* the rest of the chain was already visited as well */
+			if (ha_bit_test(r - 1, cand))
+				break;
+			for (; r; r = acm->same[r - 1])
+				ha_bit_set(r - 1, cand);
+			s = acm->dict[s];
+		}
+	}
+
+	*ret = NULL;
+	for (w = 0; w < words; w++) {
+		for (bits = cand[w]; bits; bits &= bits - 1) {
+			pattern = acm->pats[w * LONGBITS + my_ffsl(bits) - 1];
+			if (regex_exec2(pattern->ptr.reg, smp->data.u.str.area, smp->data.u.str.data)) {
+				*ret = pattern;
+				return 1;
+			}
+		}
+	}
+	return 1;
+}
+
 /* Executes a regex. It temporarily changes the data to add a trailing zero,
  * and restores the previous character when leaving. This function fills
  * a matching array.
@@ -636,6 +1487,10 @@ struct pattern *pat_match_reg(struct sample *smp, struct pattern_expr *expr, int
 		}
 	}
 
+	if (expr->acm && expr->acm->nodes && pat_acm_valid(expr) &&
+	    pat_acm_match_reg(expr, smp, &ret))
+		goto leave;
+
 	list_for_each_entry(lst, &expr->patterns, list) {
 		pattern = &lst->pat;
 
@@ -647,7 +1502,7 @@ struct pattern *pat_match_reg(struct sample *smp, struct pattern_expr *expr, int
 			break;
 		}
 	}
-
+ leave:
 	if (lru)
 		lru64_commit(lru, ret, expr, expr->ref->revision, NULL);
 
@@ -726,7 +1581,10 @@ struct pattern *pat_match_beg(struct sample *smp, struct pattern_expr *expr, int
 	return ret;
 }
 
-/* Checks that the pattern matches the end of the tested string. */
+/* Checks that the pattern matches the end of the tested string. Large lists
+ * are looked up using the expression's Aho-Corasick automaton when it is up
+ * to date.
+ */
 struct pattern *pat_match_end(struct sample *smp, struct pattern_expr *expr, int fill)
 {
 	int icase;
@@ -746,6 +1604,11 @@ struct pattern *pat_match_end(struct sample *smp, struct pattern_expr *expr, int
 		}
 	}
 
+	if (expr->acm && expr->acm->nodes && pat_acm_valid(expr)) {
+		ret = pat_acm_lookup(expr, smp, 1);
+		goto leave;
+	}
+
 	list_for_each_entry(lst, &expr->patterns, list) {
 		pattern = &lst->pat;
 
@@ -763,15 +1626,16 @@ struct pattern *pat_match_end(struct sample *smp, struct pattern_expr *expr, int
 		ret = pattern;
 		break;
 	}
-
+ leave:
 	if (lru)
 		lru64_commit(lru, ret, expr, expr->ref->revision, NULL);
 
 	return ret;
 }
 
-/* Checks that the pattern is included inside the tested string.
- * NB: Suboptimal, should be rewritten using a Boyer-Moore method.
+/* Checks that the pattern is included inside the tested string. Large lists
+ * are looked up using the expression's Aho-Corasick automaton when it is up
+ * to date, otherwise each pattern is searched in turn.
  */
 struct pattern *pat_match_sub(struct sample *smp, struct pattern_expr *expr, int fill)
 {
@@ -794,6 +1658,11 @@ struct pattern *pat_match_sub(struct sample *smp, struct pattern_expr *expr, int
 		}
 	}
 
+	if (expr->acm && expr->acm->nodes && pat_acm_valid(expr)) {
+		ret = pat_acm_lookup(expr, smp, 0);
+		goto leave;
+	}
+
 	list_for_each_entry(lst, &expr->patterns, list) {
 		pattern = &lst->pat;
 
@@ -967,6 +1836,538 @@ struct pattern *pat_match_len(struct sample *smp, struct pattern_expr *expr, int
 	return NULL;
 }
 
+/* A prefix collected from an IP tree to build its index */
+struct pat_lpm_ent {
+	uint64_t hi, lo;            /* masked address, starting from the most significant bit */
+	struct pattern_tree *elt;   /* tree entry */
+	uint32_t order;             /* position in the tree, to break ties */
+	int pfx;                    /* prefix length */
+};
+
+/* Context of an IP index build */
+struct pat_lpm_ctx {
+	struct pat_lpm_tbl *t;      /* table being built */
+	struct pat_lpm_ent *ents;   /* sorted distinct prefixes */
+	uint32_t nodes_room;        /* allocated nodes */
+	uint32_t leaves_room;       /* allocated leaves */
+};
+
+/* Steps of an IP index build, for each address family */
+enum pat_lpm_step {
+	PAT_LPM_STEP_START = 0,     /* start the table */
+	PAT_LPM_STEP_COLLECT,       /* collect the tree's prefixes */
+	PAT_LPM_STEP_PREPARE,       /* sort them and fill the direct table */
+	PAT_LPM_STEP_NODES,         /* build the trie nodes */
+};
+
+/* State of an IP index build, which may be spread over several calls. The
+ * trees are only looked up while collecting their prefixes, so the build must
+ * be restarted if they change between two calls.
+ */
+struct pat_lpm_job {
+	struct pat_lpm new;         /* index being built */
+	struct pat_lpm_ctx ctx;     /* context of the table being built */
+	struct ebmb_node *next;     /* next tree node to collect */
+	uint32_t nb_ents;           /* number of collected prefixes */
+	uint32_t ents_room;         /* allocated prefixes */
+	uint32_t cursor;            /* next prefix to build the nodes of */
+	int family;                 /* 0 for IPv4, 1 for IPv6, 2 once done */
+	enum pat_lpm_step step;     /* current step for this family */
+};
+
+/* Returns the number of bits set in <map> */
+static inline uint pat_lpm_count(uint64_t map)
+{
+	if (sizeof(long) >= sizeof(map))
+		return my_popcountl(map);
+	return my_popcountl((ulong)map) + my_popcountl((ulong)(map >> 32));
+}
+
+/* Returns the <n> bits of address <hi>:<lo> found from bit <pos>, bit 0 being
+ * the most significant one. Bits past the end of the address are zero. <n>
+ * must be between 1 and 32.
+ */
+static inline uint pat_lpm_bits(uint64_t hi, uint64_t lo, uint pos, uint n)
+{
+	uint64_t v;
+
+	if (pos >= 128)
+		return 0;
+	else if (pos >= 64)
+		v = lo << (pos - 64);
+	else if (pos)
+		v = (hi << pos) | (lo >> (64 - pos));
+	else
+		v = hi;
+	return v >> (64 - n);
+}
+
+/* Returns the tree entry holding the longest prefix of table <t> matching
+ * address <hi>:<lo>, or NULL if none matches. The table must be built.
+ */
+static inline struct pattern_tree *pat_lpm_lookup(const struct pat_lpm_tbl *t, uint64_t hi, uint64_t lo)
+{
+	const struct pat_lpm_node *node;
+	uint32_t e = t->direct[hi >> (64 - t->dbits)];
+	uint pos = t->dbits;
+	uint64_t below;
+	uint slot;
+
+	while (e & PAT_LPM_NODE) {
+		node = &t->nodes[e & ~PAT_LPM_NODE];
+		slot = pat_lpm_bits(hi, lo, pos, PAT_LPM_STRIDE);
+		below = ~0ULL >> (63 - slot);
+		if (node->children & (1ULL << slot))
+			e = (node->node_base + pat_lpm_count(node->children & below) - 1) | PAT_LPM_NODE;
+		else
+			e = t->leaves[node->leaf_base + pat_lpm_count(node->leaves & below) - 1];
+		pos += PAT_LPM_STRIDE;
+	}
+	return e ? t->elts[e - 1] : NULL;
+}
+
+/* Returns non-zero if the IP index of expression <expr> matches the current
+ * state of its reference, in which case it may be used instead of the trees.
+ */
+static inline int pat_lpm_valid(const struct pattern_expr *expr)
+{
+	const struct pat_lpm *lpm = expr->lpm;
+
+	return lpm->revision == HA_ATOMIC_LOAD(&expr->ref->revision) &&
+	       lpm->gen_id == HA_ATOMIC_LOAD(&expr->ref->curr_gen);
+}
+
+/* Releases the tables of LPM table <t>, leaving it in the "not built" state */
+static void pat_lpm_free_tbl(struct pat_lpm_tbl *t)
+{
+	ha_free(&t->direct);
+	ha_free(&t->nodes);
+	ha_free(&t->leaves);
+	ha_free(&t->elts);
+	t->nb_nodes = t->nb_leaves = t->nb_elts = 0;
+}
+
+/* Compares two prefixes by address, then length, then tree position */
+static int pat_lpm_cmp(const void *a, const void *b)
+{
+	const struct pat_lpm_ent *ea = a, *eb = b;
+
+	if (ea->hi != eb->hi)
+		return ea->hi < eb->hi ? -1 : 1;
+	if (ea->lo != eb->lo)
+		return ea->lo < eb->lo ? -1 : 1;
+	if (ea->pfx != eb->pfx)
+		return ea->pfx - eb->pfx;
+	return ea->order < eb->order ? -1 : ea->order > eb->order;
+}
+
+/* Reserves <n> contiguous nodes (<leaves> == 0) or leaves (<leaves> != 0) in
+ * the table being built by <ctx>. Returns the index of the first one, or -1 on
+ * memory allocation failure.
+ */
+static int64_t pat_lpm_reserve(struct pat_lpm_ctx *ctx, int leaves, uint32_t n)
+{
+	struct pat_lpm_tbl *t = ctx->t;
+	uint32_t *nb   = leaves ? &t->nb_leaves : &t->nb_nodes;
+	uint32_t *room = leaves ? &ctx->leaves_room : &ctx->nodes_room;
+	void **area    = leaves ? (void **)&t->leaves : (void **)&t->nodes;
+	size_t size    = leaves ? sizeof(*t->leaves) : sizeof(*t->nodes);
+	uint32_t first = *nb;
+
+	if ((uint64_t)first + n >= PAT_LPM_NODE)
+		return -1;
+
+	if (first + n > *room) {
+		uint32_t new_room = MAX(*room * 2, first + n);
+		void *new_area;
+
+		new_room = MAX(new_room, 256);
+		if (new_room >= PAT_LPM_NODE)
+			new_room = PAT_LPM_NODE - 1;
+		new_area = realloc(*area, (size_t)new_room * size);
+		if (!new_area)
+			return -1;
+		*area = new_area;
+		*room = new_room;
+	}
+	*nb += n;
+	return first;
+}
+
+/* Fills the <1 << bits> slots <slots> covering the <bits> address bits from
+ * bit <pos> for the prefixes <lo> to <hi> (excluded) of the context, which all
+ * share their first <pos> bits. Slots not covered by any of these prefixes
+ * get <leaf>, inherited from shorter ones. Since a prefix is sorted before
+ * those it contains, applying them in order lets longer ones override shorter
+ * ones. Prefixes longer than <pos> + <bits> are left for the lower levels, and
+ * if <children> is not NULL, the bits of their slots are set there.
+ */
+static void pat_lpm_fill(struct pat_lpm_ctx *ctx, uint32_t *slots, uint pos, uint bits,
+                         uint32_t lo, uint32_t hi, uint32_t leaf, uint64_t *children)
+{
+	const struct pat_lpm_ent *ent;
+	uint32_t first, count, i, j;
+
+	for (i = 0; i < (1U << bits); i++)
+		slots[i] = leaf;
+
+	for (i = lo; i < hi; i++) {
+		ent = &ctx->ents[i];
+		first = pat_lpm_bits(ent->hi, ent->lo, pos, bits);
+		if (ent->pfx > pos + bits) {
+			if (children)
+				*children |= 1ULL << first;
+			continue;
+		}
+		if (ent->pfx <= pos)
+			continue;
+		count = 1U << (pos + bits - ent->pfx);
+		first &= ~(count - 1);
+		for (j = 0; j < count; j++)
+			slots[first + j] = i + 1;
+	}
+}
+
+/* Returns the end of the group of prefixes starting at <lo> and sharing the
+ * same <bits> address bits from bit <pos>, without going past <hi>. <*deeper>
+ * is set if any of them is longer than <pos> + <bits>.
+ */
+static uint32_t pat_lpm_group(const struct pat_lpm_ctx *ctx, uint pos, uint bits,
+                              uint32_t lo, uint32_t hi, int *deeper)
+{
+	const struct pat_lpm_ent *ents = ctx->ents;
+	uint slot = pat_lpm_bits(ents[lo].hi, ents[lo].lo, pos, bits);
+	uint32_t i;
+
+	*deeper = 0;
+	for (i = lo; i < hi && pat_lpm_bits(ents[i].hi, ents[i].lo, pos, bits) == slot; i++)
+		*deeper |= ents[i].pfx > pos + bits;
+	return i;
+}
+
+/* Builds node <idx> of the table being built by <ctx>, covering the address
+ * bits from bit <pos> for the prefixes <lo> to <hi> (excluded) of the context,
+ * with <leaf> inherited from shorter prefixes. Returns non-zero on success or
+ * zero on memory allocation failure.
+ */
+static int pat_lpm_build_node(struct pat_lpm_ctx *ctx, uint32_t idx, uint pos,
+                              uint32_t lo, uint32_t hi, uint32_t leaf)
+{
+	struct pat_lpm_node node = { };
+	uint32_t slots[1 << PAT_LPM_STRIDE];
+	uint32_t i, end, last = 0;
+	int64_t base;
+	int deeper, nb = 0;
+	uint slot;
+
+	pat_lpm_fill(ctx, slots, pos, PAT_LPM_STRIDE, lo, hi, leaf, &node.children);
+
+	for (slot = 0; slot < (1 << PAT_LPM_STRIDE); slot++) {
+		if (node.children & (1ULL << slot))
+			continue;
+		if (!nb || slots[slot] != last) {
+			node.leaves |= 1ULL << slot;
+			last = slots[slot];
+			nb++;
+		}
+	}
+
+	base = pat_lpm_reserve(ctx, 1, nb);
+	if (base < 0)
+		return 0;
+	node.leaf_base = base;
+	for (slot = 0; slot < (1 << PAT_LPM_STRIDE); slot++) {
+		if (node.leaves & (1ULL << slot))
+			ctx->t->leaves[base++] = slots[slot];
+	}
+
+	base = pat_lpm_reserve(ctx, 0, pat_lpm_count(node.children));
+	if (base < 0)
+		return 0;
+	node.node_base = base;
+	ctx->t->nodes[idx] = node;
+
+	for (i = lo; i < hi; i = end) {
+		end = pat_lpm_group(ctx, pos, PAT_LPM_STRIDE, i, hi, &deeper);
+		if (!deeper)
+			continue;
+		slot = pat_lpm_bits(ctx->ents[i].hi, ctx->ents[i].lo, pos, PAT_LPM_STRIDE);
+		if (!pat_lpm_build_node(ctx, base++, pos + PAT_LPM_STRIDE, i, end, slots[slot]))
+			return 0;
+	}
+	return 1;
+}
+
+/* Prepares <job> to build the index of the IP trees of expression <expr> for
+ * the current state of its reference.
+ */
+static void pat_lpm_job_init(struct pattern_expr *expr, struct pat_lpm_job *job)
+{
+	memset(job, 0, sizeof(*job));
+	job->new.revision = expr->ref->revision;
+	job->new.gen_id = expr->ref->curr_gen;
+}
+
+/* Releases everything <job> allocated, including the tables it built */
+static void pat_lpm_job_reset(struct pat_lpm_job *job)
+{
+	ha_free(&job->ctx.ents);
+	pat_lpm_free_tbl(&job->new.v4);
+	pat_lpm_free_tbl(&job->new.v6);
+	job->nb_ents = job->ents_room = 0;
+}
+
+/* Installs the tables built by <job> into <lpm>, and leaves the previous ones
+ * in the job so that they're released with it.
+ */
+static void pat_lpm_job_commit(struct pat_lpm *lpm, struct pat_lpm_job *job)
+{
+	SWAP(lpm->v4, job->new.v4);
+	SWAP(lpm->v6, job->new.v6);
+	lpm->revision = job->new.revision;
+	lpm->gen_id = job->new.gen_id;
+}
+
+/* Runs <job> building the IP index of expression <expr>, stopping after about
+ * <budget> tree nodes and prefixes were processed if <budget> is not zero. The
+ * expression must at least be locked for reading, or not shared yet, and must
+ * not have changed since the job was initialized. Returns 1 once the job is
+ * complete, 0 if it must be called again, or -1 on memory allocation failure,
+ * in which case the job is reset and the trees will be used instead. Too small
+ * trees are not indexed.
+ */
+static int pat_lpm_job_run(struct pattern_expr *expr, struct pat_lpm_job *job, uint budget)
+{
+	struct pat_lpm_ctx *ctx = &job->ctx;
+	struct pat_lpm_tbl *t;
+	struct pat_lpm_ent *ent;
+	struct ebmb_node *node;
+	struct pattern_tree *elt;
+	uint32_t i, end, leaf;
+	uint64_t done = 0;
+	int deeper;
+	int64_t idx;
+
+	while (job->family < 2) {
+		t = job->family ? &job->new.v6 : &job->new.v4;
+
+		switch (job->step) {
+		case PAT_LPM_STEP_START:
+			ctx->t = t;
+			ctx->nodes_room = ctx->leaves_room = 0;
+			t->dbits = job->family ? PAT_LPM_DBITS_V6 : PAT_LPM_DBITS_V4;
+			job->next = ebmb_first(job->family ? &expr->pattern_tree_2 : &expr->pattern_tree);
+			job->nb_ents = 0;
+			job->step = PAT_LPM_STEP_COLLECT;
+			__fallthrough;
+
+		case PAT_LPM_STEP_COLLECT:
+			for (node = job->next; node; node = ebmb_next(node)) {
+				if (budget && done++ >= budget) {
+					job->next = node;
+					return 0;
+				}
+
+				elt = ebmb_entry(node, struct pattern_tree, node);
+				if (elt->ref->gen_id != job->new.gen_id)
+					continue;
+
+				if (job->nb_ents == job->ents_room) {
+					uint32_t room = MAX(job->ents_room * 2, PAT_LPM_MIN_ENTRIES);
+
+					ent = realloc(ctx->ents, (size_t)room * sizeof(*ent));
+					if (!ent)
+						goto fail;
+					ctx->ents = ent;
+					job->ents_room = room;
+				}
+
+				ent = &ctx->ents[job->nb_ents];
+				ent->elt = elt;
+				ent->order = job->nb_ents++;
+				ent->pfx = node->node.pfx;
+				if (!job->family) {
+					ent->hi = (uint64_t)read_n32(node->key) << 32;
+					ent->lo = 0;
+				} else {
+					ent->hi = read_n64(node->key);
+					ent->lo = read_n64(node->key + 8);
+				}
+
+				/* only keep the network part */
+				if (ent->pfx <= 64) {
+					ent->hi &= ent->pfx ? ~0ULL << (64 - ent->pfx) : 0;
+					ent->lo = 0;
+				}
+				else if (ent->pfx < 128)
+					ent->lo &= ~0ULL << (128 - ent->pfx);
+			}
+
+			if (job->nb_ents < PAT_LPM_MIN_ENTRIES) {
+				job->family++;
+				job->step = PAT_LPM_STEP_START;
+				break;
+			}
+			job->step = PAT_LPM_STEP_PREPARE;
+			__fallthrough;
+
+		case PAT_LPM_STEP_PREPARE:
+			/* the tree already returns the prefixes sorted by address
+			 * then length, so sorting is rarely needed. Then only the
+			 * first of identical prefixes is kept, which is the one the
+			 * tree lookup would return.
+			 */
+			ent = ctx->ents;
+			for (i = 1; i < job->nb_ents && pat_lpm_cmp(&ent[i - 1], &ent[i]) <= 0; i++)
+				;
+			if (i < job->nb_ents)
+				qsort(ent, job->nb_ents, sizeof(*ent), pat_lpm_cmp);
+
+			for (i = end = 0; i < job->nb_ents; i++) {
+				if (end && ent[end - 1].hi == ent[i].hi &&
+				    ent[end - 1].lo == ent[i].lo && ent[end - 1].pfx == ent[i].pfx)
+					continue;
+				ent[end++] = ent[i];
+			}
+			job->nb_ents = end;
+
+			t->elts = malloc(job->nb_ents * sizeof(*t->elts));
+			t->direct = malloc(sizeof(*t->direct) << t->dbits);
+			if (!t->elts || !t->direct)
+				goto fail;
+
+			for (i = leaf = 0; i < job->nb_ents; i++) {
+				t->elts[i] = ent[i].elt;
+				if (!ent[i].pfx)
+					leaf = i + 1;
+			}
+			t->nb_elts = job->nb_ents;
+
+			pat_lpm_fill(ctx, t->direct, 0, t->dbits, 0, job->nb_ents, leaf, NULL);
+			done += job->nb_ents;
+			job->cursor = 0;
+			job->step = PAT_LPM_STEP_NODES;
+			__fallthrough;
+
+		case PAT_LPM_STEP_NODES:
+			for (i = job->cursor; i < job->nb_ents; i = end) {
+				if (budget && done >= budget) {
+					job->cursor = i;
+					return 0;
+				}
+
+				end = pat_lpm_group(ctx, 0, t->dbits, i, job->nb_ents, &deeper);
+				done += end - i;
+				if (!deeper)
+					continue;
+
+				idx = pat_lpm_reserve(ctx, 0, 1);
+				if (idx < 0)
+					goto fail;
+				leaf = pat_lpm_bits(ctx->ents[i].hi, ctx->ents[i].lo, 0, t->dbits);
+				if (!pat_lpm_build_node(ctx, idx, t->dbits, i, end, t->direct[leaf]))
+					goto fail;
+				t->direct[leaf] = idx | PAT_LPM_NODE;
+			}
+			job->family++;
+			job->step = PAT_LPM_STEP_START;
+			break;
+		}
+	}
+
+	ha_free(&ctx->ents);
+	job->nb_ents = job->ents_room = 0;
+	return 1;
+
+ fail:
+	pat_lpm_job_reset(job);
+	job->family = 2;
+	return -1;
+}
+
+/* Builds at once into <lpm> the index of the IP trees of expression <expr> for
+ * the current state of its reference. The expression must at least be locked
+ * for reading, or not shared yet. Returns non-zero on success, or zero on
+ * memory allocation failure, in which case the trees will be used instead.
+ */
+static int pat_lpm_build(struct pattern_expr *expr, struct pat_lpm *lpm)
+{
+	struct pat_lpm_job job;
+	int ret;
+
+	pat_lpm_job_init(expr, &job);
+	ret = pat_lpm_job_run(expr, &job, 0);
+	pat_lpm_job_commit(lpm, &job);
+	pat_lpm_job_reset(&job);
+	return ret > 0;
+}
+
+/* Rebuilds the outdated IP index of the expression passed in <context>. The
+ * work is split in batches of PAT_LPM_BUILD_BATCH entries, between which the
+ * task yields, and the trees are only locked for reading during a batch so
+ * that lookups may continue using them meanwhile. If the trees change between
+ * two batches, the build starts over. The new tables are finally swapped under
+ * the write lock.
+ */
+static struct task *pat_lpm_task(struct task *t, void *context, unsigned int state)
+{
+	struct pattern_expr *expr = context;
+	struct pat_lpm *lpm = expr->lpm;
+	struct pat_lpm_job *job = lpm->job;
+	int ret;
+
+	HA_RWLOCK_RDLOCK(PATEXP_LOCK, &expr->lock);
+	if (!job) {
+		if (pat_lpm_valid(expr)) {
+			HA_RWLOCK_RDUNLOCK(PATEXP_LOCK, &expr->lock);
+			return t;
+		}
+		job = malloc(sizeof(*job));
+		if (!job) {
+			HA_RWLOCK_RDUNLOCK(PATEXP_LOCK, &expr->lock);
+			return t;
+		}
+		pat_lpm_job_init(expr, job);
+		lpm->job = job;
+	}
+	else if (job->new.revision != expr->ref->revision || job->new.gen_id != expr->ref->curr_gen) {
+		pat_lpm_job_reset(job);
+		pat_lpm_job_init(expr, job);
+	}
+	ret = pat_lpm_job_run(expr, job, PAT_LPM_BUILD_BATCH);
+	HA_RWLOCK_RDUNLOCK(PATEXP_LOCK, &expr->lock);
+
+	if (!ret) {
+		task_wakeup(t, TASK_WOKEN_OTHER);
+		return t;
+	}
+
+	/* on failure the tables are empty and the trees will be used */
+	HA_RWLOCK_WRLOCK(PATEXP_LOCK, &expr->lock);
+	pat_lpm_job_commit(lpm, job);
+	lpm->next_build = tick_add(now_ms, MS_TO_TICKS(PAT_LPM_REBUILD_DELAY));
+	lpm->job = NULL;
+	HA_RWLOCK_WRUNLOCK(PATEXP_LOCK, &expr->lock);
+
+	pat_lpm_job_reset(job);
+	free(job);
+	return t;
+}
+
+/* Wakes up the task rebuilding the IP index of expression <expr>, unless it
+ * was already rebuilt less than PAT_LPM_REBUILD_DELAY ago.
+ */
+static void pat_lpm_refresh(struct pattern_expr *expr)
+{
+	struct pat_lpm *lpm = expr->lpm;
+
+	if (!lpm->task)
+		return;
+	if (tick_isset(lpm->next_build) && !tick_is_expired(lpm->next_build, now_ms))
+		return;
+	task_wakeup(lpm->task, TASK_WOKEN_OTHER);
+}
+
 /* Performs ipv4 key lookup in <expr> ipv4 tree
  * Returns NULL on failure
  */
@@ -975,6 +2376,14 @@ static struct pattern *_pat_match_tree_ipv4(struct in_addr *key, struct pattern_
 	struct ebmb_node *node;
 	struct pattern_tree *elt;
 
+	/* Use the index when it is up to date */
+	if (expr->lpm && expr->lpm->v4.direct && pat_lpm_valid(expr)) {
+		elt = pat_lpm_lookup(&expr->lpm->v4, (uint64_t)read_n32(key) << 32, 0);
+		if (!elt)
+			return NULL;
+		goto found;
+	}
+
 	/* Lookup an IPv4 address in the expression's pattern tree using
 	 * the longest match method.
 	 */
@@ -985,6 +2394,7 @@ static struct pattern *_pat_match_tree_ipv4(struct in_addr *key, struct pattern_
 			node = ebmb_lookup_shorter(node);
 			continue;
 		}
+	found:
 		if (fill) {
 			static_pattern.data = elt->data;
 			static_pattern.ref = elt->ref;
@@ -1007,6 +2417,14 @@ static struct pattern *_pat_match_tree_ipv6(struct in6_addr *key, struct pattern
 	struct ebmb_node *node;
 	struct pattern_tree *elt;
 
+	/* Use the index when it is up to date */
+	if (expr->lpm && expr->lpm->v6.direct && pat_lpm_valid(expr)) {
+		elt = pat_lpm_lookup(&expr->lpm->v6, read_n64(key), read_n64((char *)key + 8));
+		if (!elt)
+			return NULL;
+		goto found;
+	}
+
 	/* Lookup an IPv6 address in the expression's pattern tree using
 	 * the longest match method.
 	 */
@@ -1017,6 +2435,7 @@ static struct pattern *_pat_match_tree_ipv6(struct in6_addr *key, struct pattern
 			node = ebmb_lookup_shorter(node);
 			continue;
 		}
+	found:
 		if (fill) {
 			static_pattern.data = elt->data;
 			static_pattern.ref = elt->ref;
@@ -1140,6 +2559,29 @@ void pat_prune_gen(struct pattern_expr *expr)
 	free_pattern_tree(&expr->pattern_tree);
 	free_pattern_tree(&expr->pattern_tree_2);
 	LIST_INIT(&expr->patterns);
+	if (expr->acm) {
+		pat_acm_reset(expr->acm);
+		ha_free(&expr->acm);
+	}
+	if (expr->lpm) {
+		task_destroy(expr->lpm->task);
+		if (expr->lpm->job) {
+			pat_lpm_job_reset(expr->lpm->job);
+			ha_free(&expr->lpm->job);
+		}
+		pat_lpm_free_tbl(&expr->lpm->v4);
+		pat_lpm_free_tbl(&expr->lpm->v6);
+		ha_free(&expr->lpm);
+	}
+	if (expr->phash) {
+		task_destroy(expr->phash->task);
+		if (expr->phash->job) {
+			pat_phash_job_reset(expr->phash->job, 1);
+			ha_free(&expr->phash->job);
+		}
+		pat_phash_free_tbl(expr->phash);
+		ha_free(&expr->phash);
+	}
 	expr->ref->revision = rdtsc();
 	expr->ref->entry_cnt = 0;
 }
@@ -1242,8 +2684,26 @@ int pat_idx_list_str(struct pattern_expr *expr, struct pattern *pat, char **err)
 	expr->ref->revision = rdtsc();
 	expr->ref->entry_cnt++;
 
-	/* that's ok */
-	return 1;
+	/* that's ok */
+	return 1;
+}
+
+/* Indexes string pattern <pat> into the list of expression <expr>, which is
+ * additionally looked up using an Aho-Corasick automaton once large enough.
+ * The automaton is only built later, when the expression is first used after
+ * an update, in order not to rebuild it for each of a batch of additions.
+ */
+int pat_idx_acm_str(struct pattern_expr *expr, struct pattern *pat, char **err)
+{
+	if (!expr->acm) {
+		expr->acm = calloc(1, sizeof(*expr->acm));
+		if (!expr->acm) {
+			memprintf(err, "out of memory while indexing pattern");
+			return 0;
+		}
+	}
+
+	return pat_idx_list_str(expr, pat, err);
 }
 
 int pat_idx_list_reg_cap(struct pattern_expr *expr, struct pattern *pat, int cap, char **err)
@@ -1281,8 +2741,20 @@ int pat_idx_list_reg_cap(struct pattern_expr *expr, struct pattern *pat, int cap
 	return 1;
 }
 
+/* Indexes regex pattern <pat> into expression <expr>, which may then be
+ * looked up through an automaton of the literals the regex require.
+ */
 int pat_idx_list_reg(struct pattern_expr *expr, struct pattern *pat, char **err)
 {
+	if (!expr->acm) {
+		expr->acm = calloc(1, sizeof(*expr->acm));
+		if (!expr->acm) {
+			memprintf(err, "out of memory while indexing pattern");
+			return 0;
+		}
+		expr->acm->reg = 1;
+	}
+
 	return pat_idx_list_reg_cap(expr, pat, 0, err);
 }
 
@@ -1296,6 +2768,14 @@ int pat_idx_tree_ip(struct pattern_expr *expr, struct pattern *pat, char **err)
 	unsigned int mask;
 	struct pattern_tree *node;
 
+	if (!expr->lpm) {
+		expr->lpm = calloc(1, sizeof(*expr->lpm));
+		if (!expr->lpm) {
+			memprintf(err, "out of memory while loading pattern");
+			return 0;
+		}
+	}
+
 	/* Only IPv4 can be indexed */
 	if (pat->type == SMP_T_IPV4) {
 		/* in IPv4 case, check if the mask is contiguous so that we can
@@ -1387,6 +2867,15 @@ int pat_idx_tree_str(struct pattern_expr *expr, struct pattern *pat, char **err)
 	if (expr->mflags & PAT_MF_IGNORE_CASE)
 		return pat_idx_list_str(expr, pat, err);
 
+	/* the perfect hash is built once the tree is complete */
+	if (!expr->phash) {
+		expr->phash = calloc(1, sizeof(*expr->phash));
+		if (!expr->phash) {
+			memprintf(err, "out of memory while loading pattern");
+			return 0;
+		}
+	}
+
 	/* Process the key len */
 	len = strlen(pat->ptr.str) + 1;
 
@@ -1502,6 +2991,7 @@ void pat_delete_gen(struct pat_ref *ref, struct pat_ref_elt *elt)
 
 	/* update revision number to refresh the cache */
 	ref->revision = rdtsc();
+	ref->removals++;
 	ref->entry_cnt--;
 	elt->tree_head = NULL;
 	elt->list_head = NULL;
@@ -1512,6 +3002,9 @@ void pattern_init_expr(struct pattern_expr *expr)
 	LIST_INIT(&expr->patterns);
 	expr->pattern_tree = EB_ROOT;
 	expr->pattern_tree_2 = EB_ROOT;
+	expr->acm = NULL;
+	expr->lpm = NULL;
+	expr->phash = NULL;
 }
 
 void pattern_init_head(struct pattern_head *head)
@@ -1686,6 +3179,17 @@ struct pat_ref_gen *pat_ref_gen_get(struct pat_ref *ref, unsigned int gen_id)
 	return gen;
 }
 
+/* Returns non-zero if <key> belongs to the entries of generation <gen_id> of
+ * reference <ref> which come from its snapshot. These ones are read-only, and
+ * take precedence over any other entry with the same key. The reference must
+ * be locked.
+ */
+int pat_ref_snap_holds(const struct pat_ref *ref, unsigned int gen_id, const char *key)
+{
+	return ref->snap && ref->snap->gen_id == gen_id &&
+	       mapsnap_lookup(ref->snap, key, strlen(key));
+}
+
 /* This function removes all elements belonging to <gen_id> and matching <key>
  * from the reference <ref>.
  * This function returns 1 if the deletion is done and returns 0 if
@@ -1696,6 +3200,9 @@ int pat_ref_gen_delete(struct pat_ref *ref, unsigned int gen_id, const char *key
 	struct pat_ref_gen *gen;
 	struct pat_ref_elt *elt;
 
+	if (pat_ref_snap_holds(ref, gen_id, key))
+		return 0;
+
 	gen = pat_ref_gen_get(ref, gen_id);
 	if (!gen)
 		return 0;
@@ -1903,6 +3410,11 @@ int pat_ref_gen_set(struct pat_ref *ref, unsigned int gen_id,
 	struct pat_ref_gen *gen;
 	struct pat_ref_elt *elt;
 
+	if (pat_ref_snap_holds(ref, gen_id, key)) {
+		memprintf(err, "entry '%s' belongs to a read-only snapshot", key);
+		return 0;
+	}
+
 	/* Look for pattern in the reference. */
 	gen = pat_ref_gen_get(ref, gen_id);
 	if (gen)
@@ -1949,6 +3461,8 @@ static struct pat_ref *_pat_ref_new(const char *display, unsigned int flags)
         ref->next_gen = 0;
 	ref->unique_id = -1;
 	ref->revision = 0;
+	ref->removals = 0;
+	ref->snap = NULL;
 	ref->entry_cnt = 0;
 	ceb_init_root(&ref->gen_root);
 	ref->cached_gen.id = ref->curr_gen;
@@ -1965,6 +3479,7 @@ static void pat_ref_free(struct pat_ref *ref)
 {
 	ha_free(&ref->reference);
 	ha_free(&ref->display);
+	mapsnap_close(ref->snap);
 	event_hdl_sub_list_destroy(&ref->e_subs);
 	free(ref);
 }
@@ -2207,6 +3722,7 @@ int pat_ref_purge_range(struct pat_ref *ref, uint from, uint to, int budget)
 	struct pat_ref_elt *elt, *elt_bck;
 	struct bref *bref, *bref_bck;
 	struct pattern_expr *expr;
+	struct mapsnap *snap = NULL;
 	int done;
 
 	list_for_each_entry(expr, &ref->pat, list)
@@ -2214,6 +3730,9 @@ int pat_ref_purge_range(struct pat_ref *ref, uint from, uint to, int budget)
 
 	/* all expr are locked, we can safely remove all pat_ref */
 
+	if (ref->snap && ref->snap->gen_id - from <= to - from)
+		SWAP(snap, ref->snap);
+
 	/* assume completion for e.g. empty lists */
 	done = 1;
 	pat_ref_gen_foreach_safe(gen, gen2, ref) {
@@ -2268,6 +3787,8 @@ int pat_ref_purge_range(struct pat_ref *ref, uint from, uint to, int budget)
 	list_for_each_entry(expr, &ref->pat, list)
 		HA_RWLOCK_WRUNLOCK(PATEXP_LOCK, &expr->lock);
 
+	mapsnap_close(snap);
+
 	/* only publish when we're done and if curr_gen was impacted by the
 	 * purge
 	 */
@@ -2386,6 +3907,107 @@ struct pattern_expr *pattern_new_expr(struct pattern_head *head, struct pat_ref
 	return expr;
 }
 
+/* Loads the file of reference <ref> open as <fd> if it is a snapshot, which
+ * must have values if <smp> is set, and none otherwise. Returns 1 on success,
+ * 0 if it is not a snapshot and must be parsed as text, or -1 on error with
+ * <err> filled.
+ */
+static int pat_ref_read_snapshot(struct pat_ref *ref, int fd, int smp, char **err)
+{
+	struct mapsnap *snap;
+	int ret;
+
+	ret = mapsnap_open(fd, ref->reference, &snap, err);
+	if (ret <= 0)
+		return ret;
+
+	if (!(snap->hdr->flags & MAPSNAP_F_SMP) != !smp) {
+		memprintf(err, "snapshot <%s> was compiled from a %s file and cannot be used as a %s file",
+		          ref->reference, smp ? "one column" : "two column", smp ? "two column" : "one column");
+		mapsnap_close(snap);
+		return -1;
+	}
+
+	snap->gen_id = ref->curr_gen;
+	ref->snap = snap;
+	return 1;
+}
+
+/* Returns non-zero if expression <expr> may look the snapshot of its reference
+ * up directly, which is the case of case-sensitive exact string matching.
+ */
+static inline int pat_snap_usable(const struct pattern_expr *expr)
+{
+	const struct pattern_head *head = expr->pat_head;
+
+	return head->parse == pat_parse_str && head->index == pat_idx_tree_str &&
+	       head->match == pat_match_str && !(expr->mflags & PAT_MF_IGNORE_CASE);
+}
+
+/* Converts the entries of the snapshot of reference <ref> to regular entries,
+ * indexed in all the reference's expressions but <skip>, and releases the
+ * snapshot. This is as expensive as loading the source file, so it is only
+ * done while loading the configuration, when the reference has no other
+ * entries. Returns zero on error with <err> filled.
+ */
+static int pat_ref_snap_convert(struct pat_ref *ref, struct pattern_expr *skip, char **err)
+{
+	struct mapsnap *snap = ref->snap;
+	const struct mapsnap_ent *ent;
+	struct pattern_expr *expr;
+	struct pat_ref_elt *elt;
+	uint32_t i;
+
+	for (i = 0; i < snap->hdr->nb_ents; i++) {
+		ent = &snap->ents[i];
+		elt = pat_ref_append(ref, snap->gen_id, mapsnap_key(snap, ent), mapsnap_val(snap, ent), ent->line);
+		if (!elt) {
+			memprintf(err, "out of memory when loading patterns from file <%s>", ref->reference);
+			return 0;
+		}
+
+		list_for_each_entry(expr, &ref->pat, list) {
+			if (expr != skip && !pat_ref_push(elt, expr, 0, err)) {
+				memprintf(err, "%s at line %u of file '%s'", *err, ent->line, ref->reference);
+				return 0;
+			}
+		}
+	}
+
+	ref->snap = NULL;
+	mapsnap_close(snap);
+	return 1;
+}
+
+/* Attaches the snapshot of reference <ref> to its new expression <expr>, whose
+ * entries must still be loaded. It is converted to regular entries if <expr>
+ * cannot look it up, otherwise the values are checked once for all since they
+ * are parsed on each lookup. Returns zero on error with <err> filled.
+ */
+static int pat_ref_snap_attach(struct pat_ref *ref, struct pattern_expr *expr, char **err)
+{
+	struct mapsnap *snap = ref->snap;
+	struct sample_data data;
+	const char *val;
+	uint32_t i;
+
+	if (!pat_snap_usable(expr))
+		return pat_ref_snap_convert(ref, expr, err);
+
+	if (!expr->pat_head->parse_smp || !(snap->hdr->flags & MAPSNAP_F_SMP))
+		return 1;
+
+	for (i = 0; i < snap->hdr->nb_ents; i++) {
+		val = mapsnap_val(snap, &snap->ents[i]);
+		if (!expr->pat_head->parse_smp(val, &data)) {
+			memprintf(err, "unable to parse '%s' at line %u of file '%s'",
+			          val, snap->ents[i].line, ref->reference);
+			return 0;
+		}
+	}
+	return 1;
+}
+
 /* Reads patterns from a file. If <err_msg> is non-NULL, an error message will
  * be returned there on errors and the caller will have to free it.
  *
@@ -2431,6 +4053,12 @@ int pat_ref_read_from_file_smp(struct pat_ref *ref, char **err)
 	}
 	ref->flags |= PAT_REF_FILE;
 
+	ret = pat_ref_read_snapshot(ref, fileno(file), 1, err);
+	if (ret) {
+		ret = ret > 0;
+		goto out_close;
+	}
+
 	/* now parse all patterns. The file may contain only one pattern
 	 * followed by one value per line. The start spaces, separator spaces
 	 * and and spaces are stripped. Each can contain comment started by '#'
@@ -2518,6 +4146,12 @@ int pat_ref_read_from_file(struct pat_ref *ref, char **err)
 		return 0;
 	}
 
+	ret = pat_ref_read_snapshot(ref, fileno(file), 0, err);
+	if (ret) {
+		ret = ret > 0;
+		goto out_close;
+	}
+
 	/* now parse all patterns. The file may contain only one pattern per
 	 * line. If the line contains spaces, they will be part of the pattern.
 	 * The pattern stops at the first CR, LF or EOF encountered.
@@ -2662,6 +4296,9 @@ int pattern_read_from_file(struct pattern_head *head, unsigned int refflags,
 	if (reuse)
 		return 1;
 
+	if (ref->snap && !pat_ref_snap_attach(ref, expr, err))
+		return 0;
+
 	/* Load reference content in the pattern expression.
 	 * We need to load elements in the same order they were seen in the
 	 * file. Indeed, some list-based matching types may rely on it as the
@@ -2710,6 +4347,13 @@ struct pattern *pattern_exec_match(struct pattern_head *head, struct sample *smp
 		return NULL;
 
 	list_for_each_entry(list, &head->head, list) {
+		if (list->expr->acm && !pat_acm_valid(list->expr))
+			pat_acm_refresh(list->expr);
+		if (list->expr->lpm && !pat_lpm_valid(list->expr))
+			pat_lpm_refresh(list->expr);
+		if (list->expr->phash && !pat_phash_valid(list->expr))
+			pat_phash_refresh(list->expr);
+
 		HA_RWLOCK_RDLOCK(PATEXP_LOCK, &list->expr->lock);
 		pat = head->match(smp, list->expr, fill);
 		if (pat) {
@@ -2853,7 +4497,39 @@ int pattern_finalize_config(void)
 	LIST_DELETE(&pr);
 
 	free(arr);
+
+	/* build the automatons and IP indexes now so that they're ready for
+	 * the first lookup.
+	 */
+	list_for_each_entry(ref, &pattern_reference, list) {
+		struct pattern_expr *expr;
+
+		list_for_each_entry(expr, &ref->pat, list) {
+			if (expr->acm && !pat_acm_build(expr))
+				goto oom;
+
+			if (expr->lpm) {
+				expr->lpm->task = task_new_anywhere();
+				if (!expr->lpm->task || !pat_lpm_build(expr, expr->lpm))
+					goto oom;
+				expr->lpm->task->process = pat_lpm_task;
+				expr->lpm->task->context = expr;
+			}
+
+			if (expr->phash) {
+				expr->phash->task = task_new_anywhere();
+				if (!expr->phash->task || !pat_phash_build(expr, expr->phash))
+					goto oom;
+				expr->phash->task->process = pat_phash_task;
+				expr->phash->task->context = expr;
+			}
+		}
+	}
 	return 0;
+
+ oom:
+	ha_alert("Out of memory error.\n");
+	return ERR_ALERT | ERR_FATAL;
 }
 
 static int pattern_per_thread_lru_alloc()
@@ -2869,5 +4545,741 @@ static void pattern_per_thread_lru_free()
 	lru64_destroy(pat_lru_tree);
 }
 
+static void pattern_per_thread_acm_free()
+{
+	ha_free(&pat_acm_cand);
+	pat_acm_cand_words = 0;
+}
+
 REGISTER_PER_THREAD_ALLOC(pattern_per_thread_lru_alloc);
 REGISTER_PER_THREAD_FREE(pattern_per_thread_lru_free);
+REGISTER_PER_THREAD_FREE(pattern_per_thread_acm_free);
+
+/* config parser for global "tune.pattern.regex-prefilter", accepts "on" or "off" */
+static int cfg_parse_tune_pattern_regex_prefilter(char **args, int section_type, struct proxy *curpx,
+                                                  const struct proxy *defpx, const char *file, int line,
+                                                  char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[1], "on") == 0)
+		global.tune.options |= GTUNE_REGEX_PREFILTER;
+	else if (strcmp(args[1], "off") == 0)
+		global.tune.options &= ~GTUNE_REGEX_PREFILTER;
+	else {
+		memprintf(err, "'%s' expects either 'on' or 'off' but got '%s'.", args[0], args[1]);
+		return -1;
+	}
+	return 0;
+}
+
+/* config keyword parsers */
+static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.pattern.regex-prefilter", cfg_parse_tune_pattern_regex_prefilter },
+	{ 0, NULL, NULL }
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
+
+/* Compares the automaton lookups of sub and end string patterns against the
+ * list walk on random pattern sets and samples. Returns 0 on success.
+ */
+int pattern_acm_unittest(int argc, char **argv)
+{
+	static const char alphabet[] = "abcAB";
+	struct pat_ref ref = { };
+	struct pat_ref_elt *elts;
+	struct pattern_expr expr;
+	struct pattern pat;
+	struct pat_acm *acm;
+	struct pattern *exp, *got;
+	struct sample smp;
+	char keys[64][8];
+	char str[16];
+	uint32_t rnd = 0x12345678;
+	int round, i, j, nb, len, end;
+	char *err = NULL;
+	int ret = 1;
+
+	elts = calloc(64, sizeof(*elts));
+	if (!elts)
+		return 1;
+
+	for (round = 0; round < 200; round++) {
+		ref.curr_gen = 0;
+		ref.revision = round + 1;
+		pattern_init_expr(&expr);
+		expr.ref = &ref;
+		expr.mflags = (round & 1) ? PAT_MF_IGNORE_CASE : 0;
+
+		rnd = rnd * 1103515245 + 12345;
+		nb = PAT_ACM_MIN_ENTRIES + (rnd >> 16) % 56;
+		for (i = 0; i < nb; i++) {
+			memset(&elts[i], 0, sizeof(elts[i]));
+			rnd = rnd * 1103515245 + 12345;
+			/* a few entries belong to a pending generation */
+			elts[i].gen_id = ((rnd >> 16) % 8) == 0;
+			len = 1 + (rnd >> 20) % 4;
+			for (j = 0; j < len; j++) {
+				rnd = rnd * 1103515245 + 12345;
+				keys[i][j] = alphabet[(rnd >> 16) % (sizeof(alphabet) - 1)];
+			}
+			keys[i][len] = 0;
+
+			memset(&pat, 0, sizeof(pat));
+			pat.ref = &elts[i];
+			pat.type = SMP_T_STR;
+			pat.ptr.str = keys[i];
+			pat.len = len;
+			if (!pat_idx_acm_str(&expr, &pat, &err))
+				goto fail;
+		}
+
+		if (!pat_acm_build(&expr))
+			goto fail;
+		acm = expr.acm;
+		if (!acm->nodes)
+			goto next;
+
+		for (i = 0; i < 1000; i++) {
+			rnd = rnd * 1103515245 + 12345;
+			len = (rnd >> 16) % sizeof(str);
+			for (j = 0; j < len; j++) {
+				rnd = rnd * 1103515245 + 12345;
+				str[j] = alphabet[(rnd >> 16) % (sizeof(alphabet) - 1)];
+			}
+
+			memset(&smp, 0, sizeof(smp));
+			smp.data.type = SMP_T_STR;
+			smp.data.u.str.area = str;
+			smp.data.u.str.data = len;
+
+			for (end = 0; end < 2; end++) {
+				got = pat_acm_lookup(&expr, &smp, end);
+				expr.acm = NULL;
+				exp = end ? pat_match_end(&smp, &expr, 0) : pat_match_sub(&smp, &expr, 0);
+				expr.acm = acm;
+				if (got != exp) {
+					printf("round %d: %s lookup of '%.*s' returned '%s' instead of '%s'\n",
+					       round, end ? "end" : "sub", len, str,
+					       got ? got->ptr.str : "<none>", exp ? exp->ptr.str : "<none>");
+					goto fail;
+				}
+			}
+		}
+	  next:
+		pat_prune_gen(&expr);
+	}
+	ret = 0;
+	goto out;
+
+ fail:
+	pat_prune_gen(&expr);
+ out:
+	free(err);
+	free(elts);
+	return ret;
+}
+
+REGISTER_UNITTEST("pattern_acm", pattern_acm_unittest);
+
+/* Fills <out> of size <size> with a random regex built from a few letters,
+ * classes, groups, anchors and quantifiers, using and updating <rnd>.
+ */
+static void pattern_reg_random(char *out, size_t size, uint32_t *rnd)
+{
+	static const char *const atoms[] = {
+		"a", "b", "c", "a", "b", "c", "\\.", ".", "[ab]", "(a|bc)", "\\d",
+	};
+	static const char *const quants[] = {
+		"?", "*", "+", "{0,2}", "{2}", "{1,}", "+?",
+	};
+	size_t len = 0;
+	int nb, i;
+
+	*out = 0;
+	*rnd = *rnd * 1103515245 + 12345;
+	if ((*rnd >> 16) % 8 == 0)
+		len += snprintf(out + len, size - len, "^");
+
+	nb = 1 + (*rnd >> 20) % 6;
+	for (i = 0; i < nb && len < size / 2; i++) {
+		*rnd = *rnd * 1103515245 + 12345;
+		len += snprintf(out + len, size - len, "%s%s%s",
+		                atoms[(*rnd >> 16) % (sizeof(atoms) / sizeof(*atoms))],
+		                ((*rnd >> 24) % 4 == 0) ? quants[(*rnd >> 8) % (sizeof(quants) / sizeof(*quants))] : "",
+		                ((*rnd >> 28) == 0) ? "|" : "");
+	}
+}
+
+/* Checks the literals extracted from a few regex, then compares prefiltered
+ * regex lookups against the list walk on random regex lists and samples.
+ * Returns 0 on success. With "bench [<regex> [<lookups>]]" as arguments, it
+ * instead measures both methods on a large list of regex.
+ */
+int pattern_reg_unittest(int argc, char **argv)
+{
+	static const struct {
+		const char *re;
+		const char *lit;
+	} lits[] = {
+		{ "abc",                     "abc"          },
+		{ "^/api/v[0-9]+/users",     "/api/v"       },
+		{ "ab?c",                    "a"            },
+		{ "ab{0,3}cd",               "cd"           },
+		{ "x{2}yy",                  "yy"           },
+		{ "abc+",                    "abc"          },
+		{ "foo(bar|baz)qux",         "foo"          },
+		{ "[a-z]+\\.example\\.com$", ".example.com" },
+		{ "a\\d+bcd",                "bcd"          },
+		{ "a|bcd",                   ""             },
+		{ "(?i)abc",                 ""             },
+		{ "x{,3}yz",                 ""             },
+		{ "\\x41BC",                 ""             },
+		{ "[[:alpha:]]xyz",          ""             },
+	};
+	static const char alphabet[] = "abc.AB1";
+	struct pat_ref ref = { };
+	struct pat_ref_elt **elts;
+	struct pattern_expr expr;
+	struct pattern pat;
+	struct pat_acm *acm;
+	struct pattern *exp, *got;
+	struct sample smp;
+	char re[128], str[64], lit[64];
+	uint32_t rnd = 0x12345678;
+	int bench = argc > 1 && strcmp(argv[1], "bench") == 0;
+	int nb_pats = bench ? 2000 : 64;
+	int round, i, j, nb, len;
+	char *err = NULL;
+	int ret = 1;
+
+	for (i = 0; i < sizeof(lits) / sizeof(*lits); i++) {
+		regex_find_literal(lits[i].re, 1, lit, sizeof(lit));
+		if (strcmp(lit, lits[i].lit) != 0) {
+			printf("regex '%s': found literal '%s' instead of '%s'\n", lits[i].re, lit, lits[i].lit);
+			return 1;
+		}
+	}
+
+	if (bench) {
+		if (argc > 2)
+			nb_pats = atoi(argv[2]);
+		if (nb_pats <= 0)
+			return 1;
+	}
+
+	elts = calloc(nb_pats, sizeof(*elts));
+	if (!elts)
+		return 1;
+
+	global.tune.options |= GTUNE_REGEX_PREFILTER;
+	pattern_init_expr(&expr);
+	expr.ref = &ref;
+
+	for (round = 0; round < (bench ? 1 : 200); round++) {
+		ref.curr_gen = 0;
+		ref.revision = round + 1;
+		pattern_init_expr(&expr);
+		expr.ref = &ref;
+		expr.mflags = (round & 1) ? PAT_MF_IGNORE_CASE : 0;
+
+		rnd = rnd * 1103515245 + 12345;
+		nb = bench ? nb_pats : PAT_ACM_MIN_ENTRIES + (rnd >> 16) % 56;
+		for (i = 0; i < nb; i++) {
+			if (bench) {
+				/* typical signatures, some sharing a literal, a few without */
+				if (i % 100 == 99)
+					snprintf(re, sizeof(re), "^/(admin|wp)[0-9]*/sig%d", i);
+				else if (i % 10 == 9)
+					snprintf(re, sizeof(re), "\\.(php|asp)%d$", i % 50);
+				else
+					snprintf(re, sizeof(re), "[?&]sig%04d=[^&]*(select|union)", i);
+			}
+			else
+				pattern_reg_random(re, sizeof(re), &rnd);
+
+			len = strlen(re);
+			free(elts[i]);
+			elts[i] = calloc(1, sizeof(**elts) + len + 1);
+			if (!elts[i])
+				goto fail;
+			memcpy((char *)elts[i]->pattern, re, len + 1);
+			if (!bench) {
+				rnd = rnd * 1103515245 + 12345;
+				/* a few entries belong to a pending generation */
+				elts[i]->gen_id = ((rnd >> 16) % 8) == 0;
+			}
+
+			memset(&pat, 0, sizeof(pat));
+			pat.ref = elts[i];
+			pat.type = SMP_T_STR;
+			pat.ptr.str = re;
+			if (!pat_idx_list_reg(&expr, &pat, &err)) {
+				printf("regex '%s': %s\n", re, err);
+				goto fail;
+			}
+		}
+
+		if (!pat_acm_build(&expr))
+			goto fail;
+		acm = expr.acm;
+		if (!acm->nodes)
+			goto next;
+
+		if (bench)
+			break;
+
+		for (i = 0; i < 1000; i++) {
+			rnd = rnd * 1103515245 + 12345;
+			len = (rnd >> 16) % sizeof(str);
+			for (j = 0; j < len; j++) {
+				rnd = rnd * 1103515245 + 12345;
+				str[j] = alphabet[(rnd >> 16) % (sizeof(alphabet) - 1)];
+			}
+
+			memset(&smp, 0, sizeof(smp));
+			smp.data.type = SMP_T_STR;
+			smp.data.u.str.area = str;
+			smp.data.u.str.data = len;
+
+			if (!pat_acm_match_reg(&expr, &smp, &got))
+				goto fail;
+			expr.acm = NULL;
+			exp = pat_match_reg(&smp, &expr, 0);
+			expr.acm = acm;
+			if (got != exp) {
+				printf("round %d: lookup of '%.*s' returned '%s' instead of '%s'\n",
+				       round, len, str,
+				       got ? got->ref->pattern : "<none>", exp ? exp->ref->pattern : "<none>");
+				goto fail;
+			}
+		}
+	  next:
+		pat_prune_gen(&expr);
+	}
+
+	if (bench) {
+		static const char *const urls[] = {
+			"/static/img/logo.png?v=42",
+			"/search?q=haproxy&page=2&sig0042=1+union+all",
+			"/index.php3",
+			"/wp/sig1999",
+			"/api/v1/users/1234/orders?limit=50&sort=desc",
+		};
+		int lookups = argc > 3 ? atoi(argv[3]) : 100000;
+		uint64_t start, list_ns = 0, acm_ns = 0;
+		int hits[2] = { 0, 0 };
+
+		if (!expr.acm->nodes) {
+			printf("no automaton was built\n");
+			goto fail;
+		}
+
+		for (j = 0; j < 2; j++) {
+			acm = expr.acm;
+			if (!j)
+				expr.acm = NULL;
+			start = now_mono_time();
+			for (i = 0; i < lookups; i++) {
+				memset(&smp, 0, sizeof(smp));
+				smp.data.type = SMP_T_STR;
+				strlcpy2(str, urls[i % (sizeof(urls) / sizeof(*urls))], sizeof(str));
+				smp.data.u.str.area = str;
+				smp.data.u.str.data = strlen(str);
+				hits[j] += !!pat_match_reg(&smp, &expr, 0);
+			}
+			expr.acm = acm;
+			if (!j)
+				list_ns = now_mono_time() - start;
+			else
+				acm_ns = now_mono_time() - start;
+		}
+
+		printf("%d regex, %d lookups: list walk %llu ns/lookup, prefilter %llu ns/lookup, %d/%d matches\n",
+		       nb_pats, lookups,
+		       (ullong)(list_ns / (lookups ? lookups : 1)),
+		       (ullong)(acm_ns / (lookups ? lookups : 1)),
+		       hits[0], hits[1]);
+		if (hits[0] != hits[1])
+			goto fail;
+		pat_prune_gen(&expr);
+	}
+
+	ret = 0;
+	goto out;
+
+ fail:
+	pat_prune_gen(&expr);
+ out:
+	for (i = 0; i < nb_pats; i++)
+		free(elts[i]);
+	free(elts);
+	free(err);
+	return ret;
+}
+
+REGISTER_UNITTEST("pattern_reg", pattern_reg_unittest);
+
+/* Compares the IP index lookups against the tree lookups on random IPv4 and
+ * IPv6 prefix sets, including duplicates and entries of another generation.
+ * Returns 0 on success. With "bench [<prefixes> [<lookups>]]" as arguments,
+ * it instead measures both methods on a large IPv4 set.
+ */
+int pattern_lpm_unittest(int argc, char **argv)
+{
+	struct pat_ref ref = { };
+	struct pat_ref_elt *elts;
+	struct pattern_expr expr;
+	struct pattern_tree *exp, *got;
+	struct ebmb_node *node;
+	struct pattern pat;
+	struct pat_lpm_job job;
+	uint64_t rnd = 0x123456789abcdefULL;
+	int bench = argc > 1 && strcmp(argv[1], "bench") == 0;
+	int nb_pats = bench ? 1000000 : 8192;
+	int round, i, j, v6;
+	uint64_t build_ns = 0;
+	uint8_t addr[16];
+	char *err = NULL;
+	int ret = 1;
+
+	if (bench && argc > 2)
+		nb_pats = atoi(argv[2]);
+	if (nb_pats < PAT_LPM_MIN_ENTRIES)
+		return 1;
+
+	elts = calloc(nb_pats, sizeof(*elts));
+	if (!elts)
+		return 1;
+
+	pattern_init_expr(&expr);
+	expr.ref = &ref;
+
+	for (round = 0; round < (bench ? 1 : 8); round++) {
+		v6 = !bench && (round & 1);
+		ref.curr_gen = 0;
+		ref.revision = round + 1;
+		pattern_init_expr(&expr);
+		expr.ref = &ref;
+
+		for (i = 0; i < nb_pats; i++) {
+			rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+			memset(&elts[i], 0, sizeof(elts[i]));
+			/* a few entries belong to a pending generation */
+			elts[i].gen_id = !bench && ((rnd >> 20) % 16) == 0;
+
+			/* addresses are taken from a narrow space to get many
+			 * nested prefixes and some duplicates.
+			 */
+			memset(&pat, 0, sizeof(pat));
+			pat.ref = &elts[i];
+			for (j = 0; j < 16; j++)
+				addr[j] = (rnd >> (8 * (j % 8))) ^ j;
+			if (!v6) {
+				pat.type = SMP_T_IPV4;
+				addr[0] = bench ? addr[0] : 10;
+				addr[1] &= bench ? 0xff : 0x0f;
+				memcpy(&pat.val.ipv4.addr, addr, 4);
+				j = bench ? 16 + (rnd >> 40) % 17 : (rnd >> 40) % 33;
+				pat.val.ipv4.mask.s_addr = htonl(j ? ~0U << (32 - j) : 0);
+				pat.val.ipv4.addr.s_addr &= pat.val.ipv4.mask.s_addr;
+			} else {
+				pat.type = SMP_T_IPV6;
+				addr[0] = 0x20;
+				addr[1] = 0x01;
+				addr[2] &= 0x03;
+				memcpy(&pat.val.ipv6.addr, addr, 16);
+				pat.val.ipv6.mask = (rnd >> 40) % 129;
+			}
+			if (!pat_idx_tree_ip(&expr, &pat, &err))
+				goto fail;
+		}
+
+		/* odd rounds build the index in small batches, as the task does */
+		build_ns = now_mono_time();
+		pat_lpm_job_init(&expr, &job);
+		while (!(i = pat_lpm_job_run(&expr, &job, (round & 1) ? 997 : 0)))
+			;
+		pat_lpm_job_commit(expr.lpm, &job);
+		pat_lpm_job_reset(&job);
+		if (i < 0)
+			goto fail;
+		build_ns = now_mono_time() - build_ns;
+		if (!(v6 ? expr.lpm->v6.direct : expr.lpm->v4.direct)) {
+			printf("round %d: no index was built\n", round);
+			goto fail;
+		}
+
+		if (bench)
+			break;
+
+		for (i = 0; i < 100000; i++) {
+			rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+			for (j = 0; j < 16; j++)
+				addr[j] = (rnd >> (8 * (j % 8))) ^ (j * 3);
+			if (!v6) {
+				addr[0] = (i & 7) ? 10 : addr[0];
+				addr[1] &= 0x0f;
+				node = ebmb_lookup_longest(&expr.pattern_tree, addr);
+				got = pat_lpm_lookup(&expr.lpm->v4, (uint64_t)read_n32(addr) << 32, 0);
+			} else {
+				addr[0] = 0x20;
+				addr[1] = (i & 7) ? 0x01 : addr[1];
+				addr[2] &= 0x03;
+				node = ebmb_lookup_longest(&expr.pattern_tree_2, addr);
+				got = pat_lpm_lookup(&expr.lpm->v6, read_n64(addr), read_n64(addr + 8));
+			}
+
+			/* the tree lookup, as done by _pat_match_tree_ipv4/6() */
+			while (node && ebmb_entry(node, struct pattern_tree, node)->ref->gen_id != ref.curr_gen)
+				node = ebmb_lookup_shorter(node);
+			exp = node ? ebmb_entry(node, struct pattern_tree, node) : NULL;
+
+			if (got != exp) {
+				printf("round %d: lookup %d returned %p/%d instead of %p/%d\n", round, i,
+				       got, got ? got->node.node.pfx : -1, exp, exp ? exp->node.node.pfx : -1);
+				goto fail;
+			}
+		}
+		pat_prune_gen(&expr);
+	}
+
+	if (bench) {
+		int lookups = argc > 3 ? atoi(argv[3]) : 1000000;
+		uint64_t start, tree_ns, lpm_ns;
+		uint32_t sum[2] = { 0, 0 };
+
+		start = now_mono_time();
+		for (i = 0; i < lookups; i++) {
+			rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+			write_u32(addr, rnd >> 32);
+			node = ebmb_lookup_longest(&expr.pattern_tree, addr);
+			sum[0] += node ? node->node.pfx : 0;
+		}
+		tree_ns = now_mono_time() - start;
+
+		start = now_mono_time();
+		for (i = 0; i < lookups; i++) {
+			rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+			write_u32(addr, rnd >> 32);
+			got = pat_lpm_lookup(&expr.lpm->v4, (uint64_t)read_n32(addr) << 32, 0);
+			sum[1] += got ? got->node.node.pfx : 0;
+		}
+		lpm_ns = now_mono_time() - start;
+
+		printf("%d prefixes (%u distinct), %d lookups: tree %llu ns/lookup, index %llu ns/lookup, "
+		       "index built in %llu ms, size %llu kB (%u nodes, %u leaves)\n",
+		       nb_pats, expr.lpm->v4.nb_elts, lookups,
+		       (ullong)(tree_ns / (lookups ? lookups : 1)), (ullong)(lpm_ns / (lookups ? lookups : 1)),
+		       (ullong)(build_ns / 1000000),
+		       (ullong)(((sizeof(uint32_t) << expr.lpm->v4.dbits) +
+		                 expr.lpm->v4.nb_nodes * sizeof(struct pat_lpm_node) +
+		                 expr.lpm->v4.nb_leaves * sizeof(uint32_t) +
+		                 expr.lpm->v4.nb_elts * sizeof(void *)) >> 10),
+		       expr.lpm->v4.nb_nodes, expr.lpm->v4.nb_leaves);
+		pat_prune_gen(&expr);
+	}
+
+	ret = 0;
+	goto out;
+
+ fail:
+	if (err)
+		printf("%s\n", err);
+	pat_prune_gen(&expr);
+ out:
+	free(err);
+	free(elts);
+	return ret;
+}
+
+REGISTER_UNITTEST("pattern_lpm", pattern_lpm_unittest);
+
+/* Checks that the perfect hash of exact strings returns the same entries as
+ * the tree lookup, on keys with duplicates, entries of another generation and
+ * entries added after the build, or compares their lookup times with
+ * "bench [keys [lookups]]".
+ */
+int pattern_phash_unittest(int argc, char **argv)
+{
+	struct pat_ref ref = { };
+	struct pat_ref_elt *elts;
+	struct pattern_expr expr;
+	struct pattern_tree *exp, *got;
+	struct ebmb_node *node;
+	struct pattern pat;
+	struct pattern *match;
+	struct pat_phash_job job;
+	struct sample smp;
+	uint64_t rnd = 0x123456789abcdefULL;
+	int bench = argc > 1 && strcmp(argv[1], "bench") == 0;
+	int nb_keys = bench ? 1000000 : 20000;
+	int nb_added = bench ? 0 : 500;
+	int round, i, usable;
+	uint64_t build_ns = 0;
+	char *keys = NULL;
+	char key[64];
+	char *err = NULL;
+	int ret = 1;
+
+	if (bench && argc > 2)
+		nb_keys = atoi(argv[2]);
+	if (nb_keys < PAT_PHASH_MIN_ENTRIES)
+		return 1;
+
+	elts = calloc(nb_keys + nb_added, sizeof(*elts));
+	keys = malloc((size_t)nb_keys * 32);
+	if (!elts || !keys)
+		goto out;
+
+	memset(&expr, 0, sizeof(expr));
+	pattern_init_expr(&expr);
+	expr.ref = &ref;
+
+	for (round = 0; round < (bench ? 1 : 8); round++) {
+		ref.curr_gen = 0;
+		ref.revision = round + 1;
+		ref.removals = 0;
+		pattern_init_expr(&expr);
+		expr.ref = &ref;
+
+		/* keys are taken from a space a bit larger than their number so
+		 * that there are duplicates and that lookups also miss.
+		 */
+		for (i = 0; i < nb_keys + nb_added; i++) {
+			rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+			memset(&elts[i], 0, sizeof(elts[i]));
+			/* a few entries belong to a pending generation */
+			elts[i].gen_id = !bench && ((rnd >> 20) % 16) == 0;
+
+			if (bench)
+				snprintf(key, sizeof(key), "www%d.example.com", i);
+			else
+				snprintf(key, sizeof(key), "www%u.example.com", (uint)((rnd >> 32) % (nb_keys * 5 / 4)));
+
+			/* the last entries are added once the hash is built */
+			if (i == nb_keys) {
+				build_ns = now_mono_time();
+				pat_phash_job_init(&expr, &job);
+				while (!(usable = pat_phash_job_run(&expr, &job, (round & 1) ? 997 : 0)))
+					;
+				pat_phash_job_commit(expr.phash, &job);
+				pat_phash_job_reset(&job, 1);
+				if (usable < 0)
+					goto fail;
+				build_ns = now_mono_time() - build_ns;
+				if (!expr.phash->disp) {
+					printf("round %d: no hash was built\n", round);
+					goto fail;
+				}
+			}
+
+			if (round < 4 && i >= nb_keys)
+				break;
+
+			memset(&pat, 0, sizeof(pat));
+			pat.type = SMP_T_STR;
+			pat.ref = &elts[i];
+			pat.ptr.str = key;
+			if (!pat_idx_tree_str(&expr, &pat, &err))
+				goto fail;
+			if (bench)
+				strlcpy2(keys + (size_t)i * 32, key, 32);
+		}
+
+		if (!nb_added) {
+			/* no addition, the hash must have been built here */
+			build_ns = now_mono_time();
+			if (!pat_phash_build(&expr, expr.phash) || !expr.phash->disp) {
+				printf("round %d: no hash was built\n", round);
+				goto fail;
+			}
+			build_ns = now_mono_time() - build_ns;
+		}
+
+		if (bench)
+			break;
+
+		usable = pat_phash_usable(&expr);
+		if (usable != (round >= 4 ? 1 : 2)) {
+			printf("round %d: hash usable=%d\n", round, usable);
+			goto fail;
+		}
+
+		for (i = 0; i < 100000; i++) {
+			rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+			snprintf(key, sizeof(key), "www%u.example.com", (uint)((rnd >> 32) % (nb_keys * 3 / 2)));
+
+			/* the tree lookup, as done by pat_match_str() */
+			node = ebst_lookup(&expr.pattern_tree, key);
+			while (node && ebmb_entry(node, struct pattern_tree, node)->ref->gen_id != ref.curr_gen)
+				node = ebmb_next_dup(node);
+			exp = node ? ebmb_entry(node, struct pattern_tree, node) : NULL;
+
+			memset(&smp, 0, sizeof(smp));
+			smp.data.type = SMP_T_STR;
+			smp.data.u.str.area = key;
+			smp.data.u.str.data = strlen(key);
+			smp.data.u.str.size = sizeof(key);
+			match = pat_match_str(&smp, &expr, 1);
+
+			if ((match ? match->ref : NULL) != (exp ? exp->ref : NULL)) {
+				printf("round %d: lookup %d of %s returned %p instead of %p\n", round, i,
+				       key, match ? match->ref : NULL, exp ? exp->ref : NULL);
+				goto fail;
+			}
+		}
+		pat_prune_gen(&expr);
+	}
+
+	if (bench) {
+		int lookups = argc > 3 ? atoi(argv[3]) : 1000000;
+		uint64_t start, tree_ns, phash_ns;
+		uint32_t sum[2] = { 0, 0 };
+		const char *k;
+
+		start = now_mono_time();
+		for (i = 0; i < lookups; i++) {
+			rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+			k = keys + ((rnd >> 32) % nb_keys) * 32;
+			node = ebst_lookup(&expr.pattern_tree, k);
+			sum[0] += !!node;
+		}
+		tree_ns = now_mono_time() - start;
+
+		start = now_mono_time();
+		for (i = 0; i < lookups; i++) {
+			rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+			k = keys + ((rnd >> 32) % nb_keys) * 32;
+			got = pat_phash_lookup(expr.phash, k, strlen(k));
+			sum[1] += !!got;
+		}
+		phash_ns = now_mono_time() - start;
+
+		printf("%d keys, %d lookups (%u/%u found): tree %llu ns/lookup, hash %llu ns/lookup, "
+		       "hash built in %llu ms, size %llu kB\n",
+		       nb_keys, lookups, sum[0], sum[1],
+		       (ullong)(tree_ns / (lookups ? lookups : 1)), (ullong)(phash_ns / (lookups ? lookups : 1)),
+		       (ullong)(build_ns / 1000000),
+		       (ullong)((expr.phash->nb_buckets * sizeof(*expr.phash->disp) +
+		                 expr.phash->nb_keys * sizeof(*expr.phash->slots)) >> 10));
+		pat_prune_gen(&expr);
+	}
+
+	ret = 0;
+	goto out;
+
+ fail:
+	if (err)
+		printf("%s\n", err);
+	pat_prune_gen(&expr);
+ out:
+	free(err);
+	free(keys);
+	free(elts);
+	return ret;
+}
+
+REGISTER_UNITTEST("pattern_phash", pattern_phash_unittest);
@@ -31,6 +31,7 @@
 #include <haproxy/dict.h>
 #include <haproxy/errors.h>
 #include <haproxy/fd.h>
+#include <haproxy/freq_ctr.h>
 #include <haproxy/frontend.h>
 #include <haproxy/net_helper.h>
 #include <haproxy/obj_type-t.h>
@@ -38,7 +39,11 @@
 #include <haproxy/proxy.h>
 #include <haproxy/sc_strm.h>
 #include <haproxy/session-t.h>
+#include <haproxy/shctx-t.h>
 #include <haproxy/signal.h>
+#ifdef USE_OPENSSL
+#include <haproxy/ssl_sock.h>
+#endif
 #include <haproxy/stconn.h>
 #include <haproxy/stick_table.h>
 #include <haproxy/stream.h>
@@ -63,6 +68,9 @@
 /* default maximum of updates sent at once */
 #define PEER_DEF_MAX_UPDATES_AT_ONCE      200
 
+/* default number of TLS sessions kept for replication */
+#define PEER_DEF_SSL_SYNC_QUEUE          1024
+
 /* flags for "show peers" */
 #define PEERS_SHOW_F_DICT           0x00000001 /* also show the contents of the dictionary */
 
@@ -73,6 +81,7 @@ enum {
 	PEER_MSG_CLASS_CONTROL = 0,
 	PEER_MSG_CLASS_ERROR,
 	PEER_MSG_CLASS_STICKTABLE = 10,
+	PEER_MSG_CLASS_SSL,
 	PEER_MSG_CLASS_RESERVED = 255,
 };
 
@@ -160,6 +169,15 @@ struct peer_prep_params {
 	struct {
 		struct shared_table *shared_table;
 	} ack;
+	struct {
+		struct peers_ssl_sess *sess;
+	} ssl_sess;
+	struct {
+		const char *name;
+		const char *keys;
+		size_t len;
+		unsigned int gen;
+	} ssl_keys;
 	struct {
 		unsigned char head[2];
 	} control;
@@ -184,6 +202,12 @@ struct peer_prep_params {
 #define PEER_MSG_STKT_BIT                 7
 #define PEER_MSG_STKT_BIT_MASK         (1 << PEER_MSG_STKT_BIT)
 
+/*******************************/
+/* TLS sync mesg types         */
+/*******************************/
+#define PEER_MSG_SSL_SESS              0x80
+#define PEER_MSG_SSL_TLSKEYS           0x81
+
 /* The maximum length of an encoded data length. */
 #define PEER_MSG_ENC_LENGTH_MAXLEN    5
 
@@ -261,6 +285,9 @@ enum {
 static size_t proto_len = sizeof(PEER_SESSION_PROTO_NAME) - 1;
 struct peers *cfg_peers = NULL;
 static int peers_max_updates_at_once = PEER_DEF_MAX_UPDATES_AT_ONCE;
+#ifdef USE_OPENSSL
+static struct peers_ssl_sync ssl_sync;
+#endif
 static void peer_session_forceshutdown(struct peer *peer);
 
 static struct ebpt_node *dcache_tx_insert(struct dcache *dc,
@@ -1240,20 +1267,18 @@ static inline int peer_getline(struct appctx  *appctx)
 }
 
 /*
- * Send a message after having called <peer_prepare_msg> to build it.
+ * Send the message of <msglen> bytes already built into the trash, <msglen>
+ * being 0 if it could not be built.
  * Return 0 if the message could not be built modifying the appcxt st0 to PEER_SESS_ST_END value.
  * Returns -1 if there was not enough room left to send the message,
  * any other negative returned value must  be considered as an error with an appcxt st0
  * returned value equal to PEER_SESS_ST_END.
  */
-static inline int peer_send_msg(struct appctx *appctx,
-                                int (*peer_prepare_msg)(char *, size_t, struct peer_prep_params *),
-                                struct peer_prep_params *params)
+static inline int peer_send_prepared_msg(struct appctx *appctx, int msglen)
 {
-	int ret, msglen;
+	int ret;
 
 	TRACE_ENTER(PEERS_EV_SESS_IO|PEERS_EV_TX_MSG, appctx);
-	msglen = peer_prepare_msg(trash.area, trash.size, params);
 	if (!msglen) {
 		/* internal error: message does not fit in trash */
 		appctx->st0 = PEER_SESS_ST_END;
@@ -1274,6 +1299,17 @@ static inline int peer_send_msg(struct appctx *appctx,
 	return ret;
 }
 
+/*
+ * Build a message with <peer_prepare_msg> and <params>, then send it as
+ * peer_send_prepared_msg() does.
+ */
+static inline int peer_send_msg(struct appctx *appctx,
+                                int (*peer_prepare_msg)(char *, size_t, struct peer_prep_params *),
+                                struct peer_prep_params *params)
+{
+	return peer_send_prepared_msg(appctx, peer_prepare_msg(trash.area, trash.size, params));
+}
+
 /*
  * Send a hello message.
  * Return 0 if the message could not be built modifying the appcxt st0 to PEER_SESS_ST_END value.
@@ -1521,6 +1557,130 @@ static inline int peer_send_error_protomsg(struct appctx *appctx)
 	return peer_send_msg(appctx, peer_prepare_error_msg, &p);
 }
 
+#ifdef USE_OPENSSL
+/*
+ * Build a TLS session replication message for the <p->ssl_sess.sess> queued
+ * session, made of the encoded session id length, the session id and the ASN1
+ * encoded session.
+ * Returns the number of written bytes used to build the message if succeeded,
+ * 0 if not.
+ */
+static int peer_prepare_ssl_sessmsg(char *msg, size_t size, struct peer_prep_params *p)
+{
+	struct peers_ssl_sess *sess = p->ssl_sess.sess;
+	char *cursor;
+	size_t datalen;
+
+	/* the session id length always fits on one byte */
+	datalen = 1 + sess->len;
+	if (size < PEER_MSG_HEADER_LEN + PEER_MSG_ENC_LENGTH_MAXLEN + datalen)
+		return 0;
+
+	msg[0] = PEER_MSG_CLASS_SSL;
+	msg[1] = PEER_MSG_SSL_SESS;
+	cursor = &msg[2];
+	intencode(datalen, &cursor);
+	intencode(SSL_MAX_SSL_SESSION_ID_LENGTH, &cursor);
+	memcpy(cursor, sess->data, sess->len);
+	cursor += sess->len;
+
+	return cursor - msg;
+}
+
+/*
+ * Build a TLS ticket keys message for the keys found in <p->ssl_keys>, made of
+ * the encoded length of the keys file name, this name, the encoded generation
+ * of the keys and the keys themselves.
+ * Returns the number of written bytes used to build the message if succeeded,
+ * 0 if not.
+ */
+static int peer_prepare_ssl_keysmsg(char *msg, size_t size, struct peer_prep_params *p)
+{
+	size_t namelen = strlen(p->ssl_keys.name);
+	size_t datalen;
+	char *cursor, *datamsg;
+
+	if (size < PEER_MSG_HEADER_LEN + 3 * PEER_MSG_ENC_LENGTH_MAXLEN + namelen + p->ssl_keys.len)
+		return 0;
+
+	cursor = datamsg = msg + PEER_MSG_HEADER_LEN + PEER_MSG_ENC_LENGTH_MAXLEN;
+	intencode(namelen, &cursor);
+	memcpy(cursor, p->ssl_keys.name, namelen);
+	cursor += namelen;
+	intencode(p->ssl_keys.gen, &cursor);
+	memcpy(cursor, p->ssl_keys.keys, p->ssl_keys.len);
+	cursor += p->ssl_keys.len;
+
+	/* Compute datalen */
+	datalen = (cursor - datamsg);
+
+	/*  prepare message header */
+	msg[0] = PEER_MSG_CLASS_SSL;
+	msg[1] = PEER_MSG_SSL_TLSKEYS;
+	cursor = &msg[2];
+	intencode(datalen, &cursor);
+
+	/* move data after header */
+	memmove(cursor, datamsg, datalen);
+
+	/* return header size + data_len */
+	return (cursor - msg) + datalen;
+}
+
+/*
+ * Build into the trash the TLS session replication message for <sess>. This
+ * must be called with the sessions queue locked, and the message sent using
+ * peer_send_ssl_sessmsg() once it is unlocked. Returns the message length, or
+ * 0 if it could not be built.
+ */
+static inline int peer_build_ssl_sessmsg(struct peers_ssl_sess *sess)
+{
+	struct peer_prep_params p = {
+		.ssl_sess.sess = sess,
+	};
+
+	return peer_prepare_ssl_sessmsg(trash.area, trash.size, &p);
+}
+
+/*
+ * Send the TLS session replication message of <msglen> bytes built into the
+ * trash by peer_build_ssl_sessmsg().
+ * Return 0 if the message could not be built modifying the appcxt st0 to PEER_SESS_ST_END value.
+ * Returns -1 if there was not enough room left to send the message,
+ * any other negative returned value must  be considered as an error with an appcxt st0
+ * returned value equal to PEER_SESS_ST_END.
+ */
+static inline int peer_send_ssl_sessmsg(struct appctx *appctx, struct peer *peer, int msglen)
+{
+	TRACE_PROTO("send TLS session message", PEERS_EV_SESS_IO|PEERS_EV_TX_MSG, appctx, peer);
+	return peer_send_prepared_msg(appctx, msglen);
+}
+
+#if (defined SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB && TLS_TICKETS_NO > 0)
+/*
+ * Send the current TLS ticket keys of <ref>.
+ * Return 0 if the message could not be built modifying the appcxt st0 to PEER_SESS_ST_END value.
+ * Returns -1 if there was not enough room left to send the message,
+ * any other negative returned value must  be considered as an error with an appcxt st0
+ * returned value equal to PEER_SESS_ST_END.
+ */
+static inline int peer_send_ssl_keysmsg(struct appctx *appctx, struct peer *peer,
+                                        struct tls_keys_ref *ref)
+{
+	char keys[TLS_TICKETS_NO * sizeof(union tls_sess_key)];
+	struct peer_prep_params p = {
+		.ssl_keys.name = ref->filename,
+		.ssl_keys.keys = keys,
+	};
+
+	p.ssl_keys.len = ssl_sock_dump_tlskeys_ref(ref, keys, sizeof(keys), &p.ssl_keys.gen);
+
+	TRACE_PROTO("send TLS ticket keys message", PEERS_EV_SESS_IO|PEERS_EV_TX_MSG, appctx, peer);
+	return peer_send_msg(appctx, peer_prepare_ssl_keysmsg, &p);
+}
+#endif
+#endif /* USE_OPENSSL */
+
 /*
  * Function used to lookup for recent stick-table updates associated with
  * <st> shared stick-table when a lesson must be taught a peer (learn state is not PEER_LR_ST_NOTASSIGNED).
@@ -2484,6 +2644,95 @@ static inline int peer_treat_definemsg(struct appctx *appctx, struct peer *p,
 	return 0;
 }
 
+#ifdef USE_OPENSSL
+/*
+ * Function used to parse a TLS session replication message after it has been
+ * received by <p> peer with <msg_cur> as address of the pointer to the position
+ * in the receipt buffer with <msg_end> being the position of the end of the
+ * message. The session is stored into the local shared session cache without
+ * being propagated any further.
+ * Return 1 if succeeded, 0 if not with the appctx state st0 set to PEER_SESS_ST_ERRPROTO.
+ */
+static inline int peer_treat_ssl_sessmsg(struct appctx *appctx, struct peer *p,
+                                         char **msg_cur, char *msg_end)
+{
+	unsigned char sid[SSL_MAX_SSL_SESSION_ID_LENGTH];
+	uint64_t sid_len;
+
+	TRACE_ENTER(PEERS_EV_SESS_IO|PEERS_EV_RX_MSG, appctx, p);
+	sid_len = intdecode(msg_cur, msg_end);
+	if (!*msg_cur || sid_len > sizeof(sid) || sid_len > msg_end - *msg_cur) {
+		TRACE_ERROR("malformed TLS session message: bad session id", PEERS_EV_SESS_IO|PEERS_EV_RX_MSG|PEERS_EV_PROTO_ERR, appctx, p);
+		appctx->st0 = PEER_SESS_ST_ERRPROTO;
+		return 0;
+	}
+
+	/* the cache is indexed on zero-padded session ids */
+	memcpy(sid, *msg_cur, sid_len);
+	memset(sid + sid_len, 0, sizeof(sid) - sid_len);
+	*msg_cur += sid_len;
+
+	if (ssl_sync.peers == p->peers && (ssl_sync.flags & PEERS_SSL_SYNC_SESS) && *msg_cur < msg_end &&
+	    ssl_sock_store_peer_sess(sid, (unsigned char *)*msg_cur, msg_end - *msg_cur))
+		p->ssl_sess_rx++;
+
+	*msg_cur = msg_end;
+	TRACE_LEAVE(PEERS_EV_SESS_IO|PEERS_EV_RX_MSG, appctx, p);
+	return 1;
+}
+
+/*
+ * Function used to parse a TLS ticket keys message after it has been received
+ * by <p> peer with <msg_cur> as address of the pointer to the position in the
+ * receipt buffer with <msg_end> being the position of the end of the message.
+ * The keys are installed if they are more recent than the local ones. Keys for
+ * an unknown file or with a different size are silently ignored.
+ * Return 1 if succeeded, 0 if not with the appctx state st0 set to PEER_SESS_ST_ERRPROTO.
+ */
+static inline int peer_treat_ssl_keysmsg(struct appctx *appctx, struct peer *p,
+                                         char **msg_cur, char *msg_end)
+{
+	uint64_t namelen;
+	unsigned int gen;
+	char *name;
+
+	TRACE_ENTER(PEERS_EV_SESS_IO|PEERS_EV_RX_MSG, appctx, p);
+	namelen = intdecode(msg_cur, msg_end);
+	if (!*msg_cur || namelen > msg_end - *msg_cur)
+		goto malformed;
+
+	name = *msg_cur;
+	*msg_cur += namelen;
+	gen = intdecode(msg_cur, msg_end);
+	if (!*msg_cur)
+		goto malformed;
+
+#if (defined SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB && TLS_TICKETS_NO > 0)
+	if (ssl_sync.peers == p->peers && (ssl_sync.flags & PEERS_SSL_SYNC_TLSKEYS)) {
+		struct tls_keys_ref *ref;
+
+		list_for_each_entry(ref, &tlskeys_reference, list) {
+			if (!ref->filename || strlen(ref->filename) != namelen ||
+			    memcmp(ref->filename, name, namelen) != 0)
+				continue;
+			if (ssl_sock_load_tlskeys_ref(ref, *msg_cur, msg_end - *msg_cur, gen) > 0)
+				p->ssl_keys_rx++;
+			break;
+		}
+	}
+#endif
+
+	*msg_cur = msg_end;
+	TRACE_LEAVE(PEERS_EV_SESS_IO|PEERS_EV_RX_MSG, appctx, p);
+	return 1;
+
+  malformed:
+	TRACE_ERROR("malformed TLS ticket keys message", PEERS_EV_SESS_IO|PEERS_EV_RX_MSG|PEERS_EV_PROTO_ERR, appctx, p);
+	appctx->st0 = PEER_SESS_ST_ERRPROTO;
+	return 0;
+}
+#endif /* USE_OPENSSL */
+
 /*
  * Receive a stick-table message or pre-parse any other message.
  * The message's header will be sent into <msg_head> which must be at least
@@ -2677,6 +2926,20 @@ static inline int peer_treat_awaited_msg(struct appctx *appctx, struct peer *pee
 				return 0;
 		}
 	}
+#ifdef USE_OPENSSL
+	else if (msg_head[0] == PEER_MSG_CLASS_SSL) {
+		if (msg_head[1] == PEER_MSG_SSL_SESS) {
+			TRACE_PROTO("TLS session message received", PEERS_EV_SESS_IO|PEERS_EV_RX_MSG, appctx, peer);
+			if (!peer_treat_ssl_sessmsg(appctx, peer, msg_cur, msg_end))
+				return 0;
+		}
+		else if (msg_head[1] == PEER_MSG_SSL_TLSKEYS) {
+			TRACE_PROTO("TLS ticket keys message received", PEERS_EV_SESS_IO|PEERS_EV_RX_MSG, appctx, peer);
+			if (!peer_treat_ssl_keysmsg(appctx, peer, msg_cur, msg_end))
+				return 0;
+		}
+	}
+#endif
 	else if (msg_head[0] == PEER_MSG_CLASS_RESERVED) {
 		appctx->st0 = PEER_SESS_ST_ERRPROTO;
 		TRACE_PROTO("malformed message: reserved", PEERS_EV_SESS_IO|PEERS_EV_RX_MSG|PEERS_EV_PROTO_ERR, appctx, peer);
@@ -2688,6 +2951,114 @@ static inline int peer_treat_awaited_msg(struct appctx *appctx, struct peer *pee
 }
 
 
+#ifdef USE_OPENSSL
+/*
+ * Send the TLS ticket keys and the queued TLS sessions not yet sent to <peer>,
+ * the latter within the limits of the configured bandwidth. Sessions which
+ * were evicted from the queue before being sent are accounted as dropped.
+ * Returns 1 if succeeded, or -1 or 0 if failed, like peer_send_msgs().
+ */
+static int peer_send_ssl_msgs(struct appctx *appctx, struct peer *peer, struct peers *peers)
+{
+	int updates = 0;
+	int repl;
+
+	if (ssl_sync.peers != peers)
+		return 1;
+
+#if (defined SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB && TLS_TICKETS_NO > 0)
+	if (peer->ssl_keys_pushed != HA_ATOMIC_LOAD(&ssl_sync.keys_ver)) {
+		unsigned int ver = HA_ATOMIC_LOAD(&ssl_sync.keys_ver);
+		struct tls_keys_ref *ref;
+
+		list_for_each_entry(ref, &tlskeys_reference, list) {
+			if (!ref->filename)
+				continue;
+			repl = peer_send_ssl_keysmsg(appctx, peer, ref);
+			if (repl <= 0)
+				return repl;
+			peer->ssl_keys_tx++;
+		}
+		peer->ssl_keys_pushed = ver;
+	}
+#endif
+
+	while (peer->ssl_sess_pushed != HA_ATOMIC_LOAD(&ssl_sync.seq)) {
+		struct peers_ssl_sess *sess;
+		int msglen;
+
+		if (updates >= peers_max_updates_at_once) {
+			applet_have_more_data(appctx);
+			return -1;
+		}
+
+		HA_SPIN_LOCK(PEER_LOCK, &ssl_sync.lock);
+		if (ssl_sync.seq - peer->ssl_sess_pushed > ssl_sync.qsize) {
+			/* the oldest sessions were overwritten before being sent */
+			peer->ssl_sess_drop += ssl_sync.seq - peer->ssl_sess_pushed - ssl_sync.qsize;
+			peer->ssl_sess_pushed = ssl_sync.seq - ssl_sync.qsize;
+		}
+
+		sess = &ssl_sync.queue[(peer->ssl_sess_pushed + 1) % ssl_sync.qsize];
+		if (ssl_sync.max_rate &&
+		    next_event_delay(&peer->ssl_tx_rate, ssl_sync.max_rate, sess->len)) {
+			HA_SPIN_UNLOCK(PEER_LOCK, &ssl_sync.lock);
+			/* the sync task will wake us up once the bandwidth allows it */
+			task_wakeup(peers->sync_task, TASK_WOKEN_MSG);
+			break;
+		}
+
+		/* the session may be overwritten once unlocked, so the message
+		 * is built now but only sent after the lock is released.
+		 */
+		msglen = peer_build_ssl_sessmsg(sess);
+		HA_SPIN_UNLOCK(PEER_LOCK, &ssl_sync.lock);
+
+		repl = peer_send_ssl_sessmsg(appctx, peer, msglen);
+		if (repl <= 0)
+			return repl;
+
+		update_freq_ctr(&peer->ssl_tx_rate, repl);
+		peer->ssl_sess_pushed++;
+		peer->ssl_sess_tx++;
+		updates++;
+	}
+	return 1;
+}
+
+/*
+ * Returns non-zero if there are TLS ticket keys or TLS sessions to send to
+ * <peer>. If the sessions are held back by the bandwidth limit, 0 is returned
+ * and <exp> is set to the date when the next one may be sent.
+ */
+static int peer_ssl_must_push(struct peers *peers, struct peer *peer, int *exp)
+{
+	unsigned int wait = 0;
+
+	if (ssl_sync.peers != peers)
+		return 0;
+
+	if (peer->ssl_keys_pushed != HA_ATOMIC_LOAD(&ssl_sync.keys_ver))
+		return 1;
+
+	if (peer->ssl_sess_pushed == HA_ATOMIC_LOAD(&ssl_sync.seq))
+		return 0;
+
+	if (ssl_sync.max_rate) {
+		HA_SPIN_LOCK(PEER_LOCK, &ssl_sync.lock);
+		wait = next_event_delay(&peer->ssl_tx_rate, ssl_sync.max_rate,
+		                        ssl_sync.queue[(peer->ssl_sess_pushed + 1) % ssl_sync.qsize].len);
+		HA_SPIN_UNLOCK(PEER_LOCK, &ssl_sync.lock);
+	}
+
+	if (wait) {
+		*exp = tick_add(now_ms, MS_TO_TICKS(wait));
+		return 0;
+	}
+	return 1;
+}
+#endif /* USE_OPENSSL */
+
 /*
  * Send any message to <peer> peer.
  * Returns 1 if succeeded, or -1 or 0 if failed.
@@ -2835,6 +3206,12 @@ int peer_send_msgs(struct appctx *appctx,
 		peer->confirm--;
 	}
 
+#ifdef USE_OPENSSL
+	repl = peer_send_ssl_msgs(appctx, peer, peers);
+	if (repl <= 0)
+		goto end;
+#endif
+
 	repl = 1;
   end:
 	TRACE_LEAVE(PEERS_EV_SESS_IO, appctx, peer);
@@ -2987,6 +3364,16 @@ static inline void init_connected_peer(struct peer *peer, struct peers *peers)
 		HA_RWLOCK_WRUNLOCK(STK_TABLE_UPDT_LOCK, &st->table->updt_lock);
 	}
 
+#ifdef USE_OPENSSL
+	if (ssl_sync.peers == peers) {
+		/* replay the queued TLS sessions and send all ticket keys */
+		unsigned int seq = HA_ATOMIC_LOAD(&ssl_sync.seq);
+
+		peer->ssl_sess_pushed = seq - MIN(seq, ssl_sync.qsize);
+		peer->ssl_keys_pushed = 0;
+	}
+#endif
+
 	/* Awake main task to ack the new peer state */
 	task_wakeup(peers->sync_task, TASK_WOKEN_MSG);
 
@@ -3682,32 +4069,39 @@ static void __process_running_peer_sync(struct task *task, struct peers *peers,
 				}
 				else {
 					int update_to_push = 0;
+					int ssl_exp = TICK_ETERNITY;
 
 					/* Awake session if there is data to push */
 					for (st = peer->tables; st ; st = st->next) {
 						if (st->last_pushed != st->table->localupdate) {
-							/* wake up the peer handler to push local updates */
 							update_to_push = 1;
-							/* There is no need to send a heartbeat message
-							 * when some updates must be pushed. The remote
-							 * peer will consider <peer> peer as alive when it will
-							 * receive these updates.
-							 */
-							peer->flags &= ~PEER_F_HEARTBEAT;
-							/* Re-schedule another one later. */
-							peer->heartbeat = tick_add(now_ms, MS_TO_TICKS(PEER_HEARTBEAT_TIMEOUT));
-							/* Refresh reconnect if necessary */
-							if (tick_is_expired(peer->reconnect, now_ms))
-								peer->reconnect = tick_add(now_ms, MS_TO_TICKS(PEER_RECONNECT_TIMEOUT));
-							/* We are going to send updates, let's ensure we will
-							 * come back to send heartbeat messages or to reconnect.
-							 */
-							TRACE_DEVEL("wakeup peer session to send update", PEERS_EV_SESS_WAKE, NULL, peer);
-							task->expire = tick_first(peer->reconnect, peer->heartbeat);
-							appctx_wakeup(peer->appctx);
 							break;
 						}
 					}
+#ifdef USE_OPENSSL
+					if (!update_to_push)
+						update_to_push = peer_ssl_must_push(peers, peer, &ssl_exp);
+#endif
+					if (update_to_push) {
+						/* wake up the peer handler to push local updates */
+						/* There is no need to send a heartbeat message
+						 * when some updates must be pushed. The remote
+						 * peer will consider <peer> peer as alive when it will
+						 * receive these updates.
+						 */
+						peer->flags &= ~PEER_F_HEARTBEAT;
+						/* Re-schedule another one later. */
+						peer->heartbeat = tick_add(now_ms, MS_TO_TICKS(PEER_HEARTBEAT_TIMEOUT));
+						/* Refresh reconnect if necessary */
+						if (tick_is_expired(peer->reconnect, now_ms))
+							peer->reconnect = tick_add(now_ms, MS_TO_TICKS(PEER_RECONNECT_TIMEOUT));
+						/* We are going to send updates, let's ensure we will
+						 * come back to send heartbeat messages or to reconnect.
+						 */
+						TRACE_DEVEL("wakeup peer session to send update", PEERS_EV_SESS_WAKE, NULL, peer);
+						task->expire = tick_first(peer->reconnect, peer->heartbeat);
+						appctx_wakeup(peer->appctx);
+					}
 					/* When there are updates to send we do not reconnect
 					 * and do not send heartbeat message either.
 					 */
@@ -3738,6 +4132,8 @@ static void __process_running_peer_sync(struct task *task, struct peers *peers,
 						}
 						task->expire = tick_first(peer->reconnect, peer->heartbeat);
 					}
+					/* come back when the bandwidth allows to push TLS sessions */
+					task->expire = tick_first(task->expire, ssl_exp);
 				}
 				/* else do nothing */
 			} /* SUCCESSCODE */
@@ -4242,6 +4638,13 @@ static int peers_dump_peer(struct buffer *msg, struct appctx *appctx, struct pee
 	              peer->confirm, peer->tx_hbt, peer->rx_hbt,
 	              peer->no_hbt, peer->new_conn, peer->proto_err, peer->coll);
 
+#ifdef USE_OPENSSL
+	if (ssl_sync.peers == peer->peers)
+		chunk_appendf(msg, "        ssl_sess_tx=%u ssl_sess_rx=%u ssl_sess_drop=%u ssl_keys_tx=%u ssl_keys_rx=%u ssl_tx_rate=%u\n",
+		              peer->ssl_sess_tx, peer->ssl_sess_rx, peer->ssl_sess_drop,
+		              peer->ssl_keys_tx, peer->ssl_keys_rx, read_freq_ctr(&peer->ssl_tx_rate));
+#endif
+
 	chunk_appendf(&trash, "        flags=0x%x", peer->flags);
 
 	if (!peer->appctx)
@@ -4430,6 +4833,146 @@ static int cli_io_handler_show_peers(struct appctx *appctx)
 }
 
 
+#ifdef USE_OPENSSL
+/* Queue the new TLS session <data> of length <len> identified by <sid>, padded
+ * with zeroes to SSL_MAX_SSL_SESSION_ID_LENGTH, so that it gets replicated to
+ * all the peers. When the queue is full, the oldest session is overwritten.
+ */
+void peers_ssl_sess_push(const unsigned char *sid, const unsigned char *data, int len)
+{
+	struct peers_ssl_sess *sess;
+	unsigned char *blob, *old;
+	unsigned int seq;
+
+	if (!(ssl_sync.flags & PEERS_SSL_SYNC_SESS) || !ssl_sync.queue)
+		return;
+
+	blob = malloc(SSL_MAX_SSL_SESSION_ID_LENGTH + len);
+	if (!blob)
+		return;
+	memcpy(blob, sid, SSL_MAX_SSL_SESSION_ID_LENGTH);
+	memcpy(blob + SSL_MAX_SSL_SESSION_ID_LENGTH, data, len);
+
+	HA_SPIN_LOCK(PEER_LOCK, &ssl_sync.lock);
+	seq = ssl_sync.seq + 1;
+	sess = &ssl_sync.queue[seq % ssl_sync.qsize];
+	old = sess->data;
+	sess->data = blob;
+	sess->len = SSL_MAX_SSL_SESSION_ID_LENGTH + len;
+	sess->seq = seq;
+	HA_ATOMIC_STORE(&ssl_sync.seq, seq);
+	HA_SPIN_UNLOCK(PEER_LOCK, &ssl_sync.lock);
+
+	free(old);
+	task_wakeup(ssl_sync.peers->sync_task, TASK_WOKEN_MSG);
+}
+
+/* Signal that the TLS ticket keys were locally updated so that they get sent to
+ * all the peers.
+ */
+void peers_ssl_tlskeys_updated(void)
+{
+	if (!(ssl_sync.flags & PEERS_SSL_SYNC_TLSKEYS) || !ssl_sync.peers->sync_task)
+		return;
+
+	HA_ATOMIC_INC(&ssl_sync.keys_ver);
+	task_wakeup(ssl_sync.peers->sync_task, TASK_WOKEN_MSG);
+}
+
+#if (defined SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB && TLS_TICKETS_NO > 0)
+/* Task rotating the TLS ticket keys which were not updated, neither locally nor
+ * by a peer, for the configured interval.
+ */
+static struct task *peers_ssl_rotate_tlskeys(struct task *t, void *context, unsigned int state)
+{
+	struct tls_keys_ref *ref;
+	int exp;
+
+	t->expire = TICK_ETERNITY;
+	list_for_each_entry(ref, &tlskeys_reference, list) {
+		if (!ref->filename)
+			continue;
+
+		exp = tick_add(HA_ATOMIC_LOAD(&ref->last_update), MS_TO_TICKS(ssl_sync.rotate));
+		if (tick_is_expired(exp, now_ms)) {
+			if (ssl_sock_rotate_tlskey_ref(ref) < 0)
+				ha_warning("peers: failed to rotate TLS ticket keys '%s'.\n", ref->filename);
+			exp = tick_add(now_ms, MS_TO_TICKS(ssl_sync.rotate));
+		}
+		t->expire = tick_first(t->expire, exp);
+	}
+	return t;
+}
+#endif
+
+/* Allocates the TLS sessions queue and starts the ticket keys rotation if
+ * "ssl-sync" is used in an enabled peers section.
+ */
+static int peers_ssl_sync_init(void)
+{
+	if (!ssl_sync.peers)
+		return ERR_NONE;
+
+	if (ssl_sync.peers->disabled || !ssl_sync.peers->sync_task) {
+		ssl_sync.peers = NULL;
+		ssl_sync.flags = 0;
+		return ERR_NONE;
+	}
+
+	if (ssl_sync.flags & PEERS_SSL_SYNC_SESS) {
+		ssl_sync.queue = calloc(ssl_sync.qsize, sizeof(*ssl_sync.queue));
+		if (!ssl_sync.queue) {
+			ha_alert("peers '%s': out of memory while allocating the TLS sessions queue.\n", ssl_sync.peers->id);
+			return ERR_ALERT | ERR_FATAL;
+		}
+	}
+
+#if (defined SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB && TLS_TICKETS_NO > 0)
+	if (ssl_sync.flags & PEERS_SSL_SYNC_TLSKEYS) {
+		struct tls_keys_ref *ref;
+
+		if (LIST_ISEMPTY(&tlskeys_reference)) {
+			ha_warning("peers '%s': 'ssl-sync tls-keys' has no effect without 'tls-ticket-keys' on a bind line.\n",
+			           ssl_sync.peers->id);
+			return ERR_WARN;
+		}
+
+		list_for_each_entry(ref, &tlskeys_reference, list)
+			ref->last_update = now_ms;
+
+		if (ssl_sync.rotate) {
+			ssl_sync.rotate_task = task_new_anywhere();
+			if (!ssl_sync.rotate_task) {
+				ha_alert("peers '%s': out of memory while allocating the TLS ticket keys rotation task.\n",
+				         ssl_sync.peers->id);
+				return ERR_ALERT | ERR_FATAL;
+			}
+			ssl_sync.rotate_task->process = peers_ssl_rotate_tlskeys;
+			ssl_sync.rotate_task->expire = tick_add(now_ms, MS_TO_TICKS(ssl_sync.rotate));
+			task_queue(ssl_sync.rotate_task);
+		}
+	}
+#endif
+	return ERR_NONE;
+}
+
+static void peers_ssl_sync_deinit(void)
+{
+	unsigned int i;
+
+	task_destroy(ssl_sync.rotate_task);
+	ssl_sync.rotate_task = NULL;
+	if (ssl_sync.queue) {
+		for (i = 0; i < ssl_sync.qsize; i++)
+			free(ssl_sync.queue[i].data);
+		ha_free(&ssl_sync.queue);
+	}
+}
+
+REGISTER_POST_CHECK(peers_ssl_sync_init);
+REGISTER_POST_DEINIT(peers_ssl_sync_deinit);
+#endif /* USE_OPENSSL */
+
 struct peers_kw_list peers_keywords = {
 	.list = LIST_HEAD_INIT(peers_keywords.list)
 };
@@ -4439,6 +4982,111 @@ void peers_register_keywords(struct peers_kw_list *pkwl)
 	LIST_APPEND(&peers_keywords.list, &pkwl->list);
 }
 
+#ifdef USE_OPENSSL
+/* config parser for the "ssl-sync" peers section keyword:
+ *   ssl-sync [sessions] [tls-keys] [rotate <time>] [max-rate <size>] [queue <entries>]
+ */
+static int peers_parse_ssl_sync(char **args, struct peers *curpeers, const char *file, int line, char **err)
+{
+	const char *res;
+	int cur_arg;
+
+	if (ssl_sync.peers) {
+		memprintf(err, "'%s' is already enabled in peers section '%s' (%s:%d).",
+		          args[0], ssl_sync.peers->id, ssl_sync.peers->conf.file, ssl_sync.peers->conf.line);
+		return -1;
+	}
+
+	ssl_sync.qsize = PEER_DEF_SSL_SYNC_QUEUE;
+	for (cur_arg = 1; *args[cur_arg]; cur_arg++) {
+		if (strcmp(args[cur_arg], "sessions") == 0)
+			ssl_sync.flags |= PEERS_SSL_SYNC_SESS;
+		else if (strcmp(args[cur_arg], "tls-keys") == 0) {
+#if (defined SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB && TLS_TICKETS_NO > 0)
+			ssl_sync.flags |= PEERS_SSL_SYNC_TLSKEYS;
+#else
+			memprintf(err, "'%s %s' is not supported by this build.", args[0], args[cur_arg]);
+			return -1;
+#endif
+		}
+		else if (strcmp(args[cur_arg], "rotate") == 0) {
+			if (!*args[cur_arg + 1]) {
+				memprintf(err, "'%s %s' expects a time argument.", args[0], args[cur_arg]);
+				return -1;
+			}
+			res = parse_time_err(args[cur_arg + 1], &ssl_sync.rotate, TIME_UNIT_MS);
+			if (res == PARSE_TIME_OVER) {
+				memprintf(err, "timer overflow in argument '%s' to '%s %s' (maximum value is 2147483647 ms or ~24.8 days)",
+				          args[cur_arg + 1], args[0], args[cur_arg]);
+				return -1;
+			}
+			else if (res == PARSE_TIME_UNDER || (!res && ssl_sync.rotate < 1000)) {
+				memprintf(err, "'%s %s' expects a time of at least one second.", args[0], args[cur_arg]);
+				return -1;
+			}
+			else if (res) {
+				memprintf(err, "unexpected character '%c' in argument to '%s %s'.", *res, args[0], args[cur_arg]);
+				return -1;
+			}
+			cur_arg++;
+		}
+		else if (strcmp(args[cur_arg], "max-rate") == 0) {
+			if (!*args[cur_arg + 1]) {
+				memprintf(err, "'%s %s' expects a size argument.", args[0], args[cur_arg]);
+				return -1;
+			}
+			res = parse_size_err(args[cur_arg + 1], &ssl_sync.max_rate);
+			if (res) {
+				memprintf(err, "unexpected '%s' after size passed to '%s %s'.", res, args[0], args[cur_arg]);
+				return -1;
+			}
+			/* a session must always fit in the bandwidth of one second */
+			if (ssl_sync.max_rate && ssl_sync.max_rate < 2 * SHSESS_MAX_DATA_LEN) {
+				memprintf(err, "'%s %s' expects a bandwidth of at least %d bytes per second.",
+				          args[0], args[cur_arg], 2 * SHSESS_MAX_DATA_LEN);
+				return -1;
+			}
+			cur_arg++;
+		}
+		else if (strcmp(args[cur_arg], "queue") == 0) {
+			if (!*args[cur_arg + 1] || atoi(args[cur_arg + 1]) < 1) {
+				memprintf(err, "'%s %s' expects a strictly positive number of entries.", args[0], args[cur_arg]);
+				return -1;
+			}
+			ssl_sync.qsize = atoi(args[cur_arg + 1]);
+			cur_arg++;
+		}
+		else {
+			memprintf(err, "'%s' only supports 'sessions', 'tls-keys', 'rotate', 'max-rate' and 'queue' (got '%s').",
+			          args[0], args[cur_arg]);
+			return -1;
+		}
+	}
+
+	if (!(ssl_sync.flags & (PEERS_SSL_SYNC_SESS|PEERS_SSL_SYNC_TLSKEYS)))
+		ssl_sync.flags |= PEERS_SSL_SYNC_SESS;
+
+	if (ssl_sync.rotate && !(ssl_sync.flags & PEERS_SSL_SYNC_TLSKEYS)) {
+		memprintf(err, "'%s rotate' requires 'tls-keys'.", args[0]);
+		return -1;
+	}
+
+	/* peers start with no keys sent */
+	if (ssl_sync.flags & PEERS_SSL_SYNC_TLSKEYS)
+		ssl_sync.keys_ver = 1;
+	ssl_sync.peers = curpeers;
+	HA_SPIN_INIT(&ssl_sync.lock);
+	return 0;
+}
+
+static struct peers_kw_list peers_kws = {{ }, {
+	{ "ssl-sync", peers_parse_ssl_sync },
+	{ NULL, NULL }
+}};
+
+INITCALL1(STG_REGISTER, peers_register_keywords, &peers_kws);
+#endif /* USE_OPENSSL */
+
 /* config parser for global "tune.peers.max-updates-at-once" */
 static int cfg_parse_max_updt_at_once(char **args, int section_type, struct proxy *curpx,
                                       const struct proxy *defpx, const char *file, int line,
@@ -535,6 +535,12 @@ static int quic_bind_listener(struct listener *listener, char *errmsg, int errle
 		break;
 	}
 
+#ifdef UDP_GRO
+	/* Receive datagrams coalesced by the kernel, split on reception. */
+	if (quic_tune.fe.opts & QUIC_TUNE_FE_RX_UDP_GRO)
+		setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one));
+#endif
+
 	if (!quic_alloc_rxbufs_listener(listener)) {
 		msg = "could not initialize tx/rx rings";
 		err |= ERR_WARN;
@@ -761,6 +767,33 @@ static int quic_test_gso(void)
 	return ret;
 }
 
+/* Returns 1 if GRO is supported, 0 if not, or a negative error code if unknown. */
+static int quic_test_gro(void)
+{
+	int fdtest = -1;
+	int ret = 1;
+
+	if ((fdtest = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+		ret = -1;
+		goto end;
+	}
+
+#ifdef UDP_GRO
+	if (setsockopt(fdtest, SOL_UDP, UDP_GRO, &one, sizeof(one))) {
+		ret = 0;
+		goto end;
+	}
+#else
+	ret = 0;
+	goto end;
+#endif
+
+ end:
+	if (fdtest >= 0)
+		close(fdtest);
+	return ret;
+}
+
 /* Check for platform support of every advanced UDP network API features used
  * by the QUIC stack. For every unsupported feature, switch to a fallback
  * mechanism. A message is notified in this case when running in diagnostic
@@ -801,6 +834,19 @@ static int quic_test_socketopts(void)
 		}
 	}
 
+	/* Check for UDP GRO support. */
+	if (quic_tune.fe.opts & QUIC_TUNE_FE_RX_UDP_GRO) {
+		ret = quic_test_gro();
+		if (ret < 0) {
+			goto err;
+		}
+		else if (!ret) {
+			ha_diag_warning("Your platform does not support UDP GRO. "
+			                "This will be automatically disabled for QUIC reception.\n");
+			quic_tune.fe.opts &= ~QUIC_TUNE_FE_RX_UDP_GRO;
+		}
+	}
+
 	return ERR_NONE;
 
  err:
@@ -821,8 +867,19 @@ static void quic_register_build_options(void)
 
 	ret = quic_test_gso();
 	memprintf(&ptr, "%sQUIC: GSO emission support : ", ptr);
-	memprintf(&ptr, "%s%s", ptr, ret > 0 ? "yes" :
-	                             !ret ? "no" : "unknown");
+	memprintf(&ptr, "%s%s\n", ptr, ret > 0 ? "yes" :
+	                               !ret ? "no" : "unknown");
+
+	ret = quic_test_gro();
+	memprintf(&ptr, "%sQUIC: GRO reception support : ", ptr);
+	memprintf(&ptr, "%s%s\n", ptr, ret > 0 ? "yes" :
+	                               !ret ? "no" : "unknown");
+
+#ifdef HA_HAVE_RECVMMSG
+	memprintf(&ptr, "%sQUIC: batched reception support : yes", ptr);
+#else
+	memprintf(&ptr, "%sQUIC: batched reception support : no", ptr);
+#endif
 
 	hap_register_build_opts(ptr, 1);
 }
@@ -3543,6 +3543,7 @@ static int proxy_defproxy_cpy(struct proxy *curproxy, const struct proxy *defpro
 		}
 		curproxy->comp->algos_res = defproxy->comp->algos_res;
 		curproxy->comp->algo_req = defproxy->comp->algo_req;
+		curproxy->comp->algos_dict = defproxy->comp->algos_dict;
 		curproxy->comp->types_res = defproxy->comp->types_res;
 		curproxy->comp->types_req = defproxy->comp->types_req;
 		curproxy->comp->minsize_res = defproxy->comp->minsize_res;
@@ -30,6 +30,7 @@
 #include <haproxy/mux_quic.h>
 #include <haproxy/qpack-t.h>
 #include <haproxy/qpack-dec.h>
+#include <haproxy/qpack-enc.h>
 #include <haproxy/qpack-tbl.h>
 #include <haproxy/hpack-huff.h>
 #include <haproxy/hpack-tbl.h>
@@ -99,49 +100,126 @@ static uint64_t qpack_get_varint(const unsigned char **buf, uint64_t *len_in, in
 	return 0;
 }
 
-/* Decode an encoder stream.
- *
- * Returns 0 on success else non-zero.
+/* Reads a string literal whose length is encoded with a <b>-bit prefix, the
+ * Huffman flag being the bit just above the prefix. Huffman-encoded strings are
+ * decoded into <tmp>, others directly point to the input. <max> is the largest
+ * acceptable string length. On success, 1 is returned and <raw> and <len> are
+ * updated past the string. 0 is returned if the input is incomplete, or a
+ * negative QPACK_RET_* code on error.
  */
-int qpack_decode_enc(struct buffer *buf, int fin, void *ctx)
+static int qpack_get_str(const unsigned char **raw, uint64_t *len, int b,
+                         struct buffer *tmp, uint64_t max, struct ist *str)
 {
-	struct qcs *qcs = ctx;
-	size_t len;
-	unsigned char inst;
+	unsigned int h = **raw & (1 << b);
+	uint64_t slen;
 
-	/* RFC 9204 4.2. Encoder and Decoder Streams
-	 *
-	 * The sender MUST NOT close either of these streams, and the receiver
-	 * MUST NOT request that the sender close either of these streams.
-	 * Closure of either unidirectional stream type MUST be treated as a
-	 * connection error of type H3_CLOSED_CRITICAL_STREAM.
-	 */
-	if (fin) {
-		qcc_set_error(qcs->qcc, H3_ERR_CLOSED_CRITICAL_STREAM, 1);
-		return -1;
-	}
+	slen = qpack_get_varint(raw, len, b);
+	if (*len == (uint64_t)-1)
+		return 0;
 
-	len = b_data(buf);
-	qpack_debug_hexdump(stderr, "[QPACK-DEC-ENC] ", b_head(buf), 0, len);
+	if (slen > max)
+		return -QPACK_RET_TOO_LARGE;
 
-	if (!len) {
-		qpack_debug_printf(stderr, "[QPACK-DEC-ENC] empty stream\n");
+	if (*len < slen)
 		return 0;
-	}
 
-	inst = (unsigned char)*b_head(buf) & QPACK_ENC_INST_BITMASK;
-	if (inst == QPACK_ENC_INST_DUP) {
-		/* Duplicate */
+	if (h) {
+		char *trash = b_tail(tmp);
+		int nlen;
+
+		nlen = huff_dec(*raw, slen, trash, b_room(tmp));
+		if (nlen == (uint32_t)-1)
+			return -QPACK_RET_HUFFMAN;
+
+		b_add(tmp, nlen);
+		*str = ist2(trash, nlen);
 	}
-	else if (inst & QPACK_ENC_INST_IWNR_BIT) {
+	else {
+		*str = ist2(*raw, slen);
+	}
+
+	*raw += slen;
+	*len -= slen;
+	return 1;
+}
+
+/* Copies name and value of dynamic table entry <dte> of <dht> into <tmp> so
+ * that they survive the insertion of a new entry. Returns 0 on success or
+ * non-zero if <tmp> is too small.
+ */
+static int qpack_dte_dup(const struct qpack_dht *dht, const struct qpack_dte *dte,
+                         struct buffer *tmp, struct ist *name, struct ist *value)
+{
+	if (b_room(tmp) < dte->nlen + dte->vlen)
+		return 1;
+
+	*name = ist2(b_tail(tmp), dte->nlen);
+	b_putblk(tmp, istptr(qpack_get_name(dht, dte)), dte->nlen);
+	*value = ist2(b_tail(tmp), dte->vlen);
+	b_putblk(tmp, istptr(qpack_get_value(dht, dte)), dte->vlen);
+	return 0;
+}
+
+/* Decodes one encoder stream instruction starting at <raw> for <len> bytes
+ * and applies it to the dynamic table of decoder <dec>. On success, 1 is
+ * returned and <raw> and <len> are updated past the instruction. 0 is returned
+ * if the instruction is incomplete, or a negative error code to be used to
+ * close the connection.
+ */
+static int qpack_decode_enc_inst(struct qpack_dec *dec, const unsigned char **raw, uint64_t *len)
+{
+	struct buffer *tmp = get_trash_chunk();
+	const struct qpack_dte *dte;
+	struct ist name, value;
+	unsigned char inst = **raw;
+	unsigned int used;
+	uint64_t idx;
+	int ret;
+
+	if (inst & QPACK_ENC_INST_IWNR_BIT) {
 		/* Insert With Name Reference */
+		unsigned int static_tbl = inst & 0x40;
+
+		idx = qpack_get_varint(raw, len, 6);
+		if (*len == (uint64_t)-1)
+			return 0;
+
+		if (static_tbl) {
+			if (idx >= QPACK_SHT_SIZE)
+				return -QPACK_ERR_ENCODER_STREAM_ERROR;
+			name = qpack_sht[idx].n;
+		}
+		else {
+			/* relative index 0 is the most recent insertion */
+			if (!dec->dht || !(dte = qpack_dht_get_by_age(dec->dht, idx)) ||
+			    qpack_dte_dup(dec->dht, dte, tmp, &name, &value))
+				return -QPACK_ERR_ENCODER_STREAM_ERROR;
+		}
+
+		ret = qpack_get_str(raw, len, 7, tmp, dec->max_cap, &value);
+		if (ret <= 0)
+			return ret ? -QPACK_ERR_ENCODER_STREAM_ERROR : 0;
 	}
 	else if (inst & QPACK_ENC_INST_IWLN_BIT) {
-		/* Insert with literal name */
+		/* Insert With Literal Name */
+		ret = qpack_get_str(raw, len, 5, tmp, dec->max_cap, &name);
+		if (ret <= 0)
+			return ret ? -QPACK_ERR_ENCODER_STREAM_ERROR : 0;
+
+		if (!*len)
+			return 0;
+
+		ret = qpack_get_str(raw, len, 7, tmp, dec->max_cap, &value);
+		if (ret <= 0)
+			return ret ? -QPACK_ERR_ENCODER_STREAM_ERROR : 0;
 	}
 	else if (inst & QPACK_ENC_INST_SDTC_BIT) {
-		/* Set dynamic table capacity */
-		int capacity = *b_head(buf) & 0x1f;
+		/* Set Dynamic Table Capacity */
+		uint64_t capacity;
+
+		capacity = qpack_get_varint(raw, len, 5);
+		if (*len == (uint64_t)-1)
+			return 0;
 
 		/* RFC 9204 4.3.1. Set Dynamic Table Capacity
 		 *
@@ -149,25 +227,69 @@ int qpack_decode_enc(struct buffer *buf, int fin, void *ctx)
 		 * value that exceeds this limit as a connection error of type
 		 * QPACK_ENCODER_STREAM_ERROR.
 		 */
-		if (capacity) {
-			qcc_set_error(qcs->qcc, QPACK_ERR_ENCODER_STREAM_ERROR, 1);
-			return -1;
+		if (capacity > dec->max_cap)
+			return -QPACK_ERR_ENCODER_STREAM_ERROR;
+
+		if (!dec->dht) {
+			if (!capacity)
+				return 1;
+
+			dec->dht = qpack_dht_alloc();
+			if (!dec->dht)
+				return -H3_ERR_INTERNAL_ERROR;
+			qpack_dht_init(dec->dht, capacity);
+		}
+		else {
+			ret = qpack_dht_resize(dec->dht, capacity);
+			if (ret < 0)
+				return -H3_ERR_INTERNAL_ERROR;
+			dec->st_evict += ret;
 		}
 
+		return 1;
 	}
+	else {
+		/* Duplicate */
+		idx = qpack_get_varint(raw, len, 5);
+		if (*len == (uint64_t)-1)
+			return 0;
 
-	return 0;
+		if (!dec->dht || !(dte = qpack_dht_get_by_age(dec->dht, idx)) ||
+		    qpack_dte_dup(dec->dht, dte, tmp, &name, &value))
+			return -QPACK_ERR_ENCODER_STREAM_ERROR;
+	}
+
+	/* RFC 9204 3.2.2. Dynamic Table Capacity and Eviction
+	 *
+	 * It is an error if the encoder attempts to add an entry that is
+	 * larger than the dynamic table capacity; the decoder MUST treat this
+	 * as a connection error of type QPACK_ENCODER_STREAM_ERROR.
+	 */
+	if (!dec->dht || name.len + value.len + 32 > dec->dht->size)
+		return -QPACK_ERR_ENCODER_STREAM_ERROR;
+
+	used = dec->dht->used;
+	if (qpack_dht_insert(dec->dht, name, value) < 0)
+		return -H3_ERR_INTERNAL_ERROR;
+
+	dec->ic++;
+	dec->st_ins++;
+	dec->st_evict += used + 1 - dec->dht->used;
+	return 1;
 }
 
-/* Decode an decoder stream.
+/* Decode an encoder stream. Only complete instructions are consumed, the
+ * remaining ones are left in <buf> until more data is received.
  *
- * Returns 0 on success else non-zero.
+ * Returns the number of bytes consumed from <buf>, or a negative error code
+ * to be used to close the connection.
  */
-int qpack_decode_dec(struct buffer *buf, int fin, void *ctx)
+ssize_t qpack_decode_enc(struct qpack_dec *dec, struct buffer *buf, int fin)
 {
-	struct qcs *qcs = ctx;
-	size_t len;
-	unsigned char inst;
+	const unsigned char *raw;
+	uint64_t len;
+	ssize_t total = 0;
+	int ret;
 
 	/* RFC 9204 4.2. Encoder and Decoder Streams
 	 *
@@ -176,43 +298,114 @@ int qpack_decode_dec(struct buffer *buf, int fin, void *ctx)
 	 * Closure of either unidirectional stream type MUST be treated as a
 	 * connection error of type H3_CLOSED_CRITICAL_STREAM.
 	 */
-	if (fin) {
-		qcc_set_error(qcs->qcc, H3_ERR_CLOSED_CRITICAL_STREAM, 1);
-		return -1;
+	if (fin)
+		return -H3_ERR_CLOSED_CRITICAL_STREAM;
+
+	raw = (const unsigned char *)b_head(buf);
+	len = b_contig_data(buf, 0);
+	qpack_debug_hexdump(stderr, "[QPACK-DEC-ENC] ", b_head(buf), 0, len);
+
+	while (len) {
+		const unsigned char *ptr = raw;
+		uint64_t left = len;
+
+		ret = qpack_decode_enc_inst(dec, &ptr, &left);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			break;
+
+		total += len - left;
+		raw = ptr;
+		len = left;
 	}
 
-	len = b_data(buf);
+	return total;
+}
+
+/* Decode a decoder stream. Only complete instructions are consumed, the
+ * remaining ones are left in <buf> until more data is received. Instructions
+ * are applied to the encoder context <enc>.
+ *
+ * Returns the number of bytes consumed from <buf>, or a negative error code
+ * to be used to close the connection.
+ */
+ssize_t qpack_decode_dec(struct qpack_enc *enc, struct buffer *buf, int fin)
+{
+	const unsigned char *raw;
+	uint64_t len, val;
+	ssize_t total = 0;
+	unsigned char inst;
+	int err;
+
+	/* RFC 9204 4.2. Encoder and Decoder Streams
+	 *
+	 * The sender MUST NOT close either of these streams, and the receiver
+	 * MUST NOT request that the sender close either of these streams.
+	 * Closure of either unidirectional stream type MUST be treated as a
+	 * connection error of type H3_CLOSED_CRITICAL_STREAM.
+	 */
+	if (fin)
+		return -H3_ERR_CLOSED_CRITICAL_STREAM;
+
+	raw = (const unsigned char *)b_head(buf);
+	len = b_contig_data(buf, 0);
 	qpack_debug_hexdump(stderr, "[QPACK-DEC-DEC] ", b_head(buf), 0, len);
 
-	if (!len) {
-		qpack_debug_printf(stderr, "[QPACK-DEC-DEC] empty stream\n");
-		return 0;
-	}
+	while (len) {
+		const unsigned char *ptr = raw;
+		uint64_t left = len;
+
+		inst = *ptr;
+		if (inst & QPACK_DEC_INST_SACK) {
+			/* Section Acknowledgment */
+			val = qpack_get_varint(&ptr, &left, 7);
+			if (left == (uint64_t)-1)
+				break;
+			err = qpack_enc_section_ack(enc, val);
+		}
+		else if (inst & QPACK_DEC_INST_SCCL) {
+			/* Stream cancellation */
+			val = qpack_get_varint(&ptr, &left, 6);
+			if (left == (uint64_t)-1)
+				break;
+			qpack_enc_stream_cancel(enc, val);
+			err = 0;
+		}
+		else {
+			/* Insert count increment */
+			val = qpack_get_varint(&ptr, &left, 6);
+			if (left == (uint64_t)-1)
+				break;
 
-	inst = (unsigned char)*b_head(buf) & QPACK_DEC_INST_BITMASK;
-	if (inst == QPACK_DEC_INST_ICINC) {
-		/* Insert count increment */
+			/* RFC 9204 4.4.3. Insert Count Increment
+			 *
+			 * An encoder that receives an Increment field equal to zero, or one
+			 * that increases the Known Received Count beyond what the encoder has
+			 * sent, MUST treat this as a connection error of type
+			 * QPACK_DECODER_STREAM_ERROR.
+			 */
+			err = qpack_enc_insert_count_inc(enc, val);
+		}
 
-		/* RFC 9204 4.4.3. Insert Count Increment
-		 *
-		 * An encoder that receives an Increment field equal to zero, or one
-		 * that increases the Known Received Count beyond what the encoder has
-		 * sent, MUST treat this as a connection error of type
-		 * QPACK_DECODER_STREAM_ERROR.
-		 */
+		if (err)
+			return -QPACK_ERR_DECODER_STREAM_ERROR;
 
-		/* For the moment haproxy does not emit dynamic table insertion. */
-		qcc_set_error(qcs->qcc, QPACK_ERR_DECODER_STREAM_ERROR, 1);
-		return -1;
-	}
-	else if (inst & QPACK_DEC_INST_SACK) {
-		/* Section Acknowledgment */
-	}
-	else if (inst & QPACK_DEC_INST_SCCL) {
-		/* Stream cancellation */
+		total += len - left;
+		raw = ptr;
+		len = left;
 	}
 
-	return 0;
+	return total;
+}
+
+/* Releases the resources attached to QPACK decoder context <dec>. */
+void qpack_dec_release(struct qpack_dec *dec)
+{
+	if (dec->dht) {
+		qpack_dht_free(dec->dht);
+		dec->dht = NULL;
+	}
 }
 
 /* Decode a field section prefix made of <enc_ric> and <db> two varints.
@@ -233,7 +426,7 @@ static int qpack_decode_fs_pfx(uint64_t *enc_ric, uint64_t *db, int *sign_bit,
 		return -QPACK_RET_TRUNCATED;
 
 	/* Safe access to the sign bit thanks to the check above */
-	*sign_bit = **raw & 0x8;
+	*sign_bit = **raw & 0x80;
 	*db = qpack_get_varint(raw, len, 7);
 	if (*len == (uint64_t)-1)
 		return -QPACK_RET_DB;
@@ -241,19 +434,136 @@ static int qpack_decode_fs_pfx(uint64_t *enc_ric, uint64_t *db, int *sign_bit,
 	return 0;
 }
 
-/* Decode a field section from the <raw> buffer of <len> bytes. Each parsed
- * header is inserted into <list> of <list_size> entries max and uses <tmp> as
- * a storage for some elements pointing into it. An end marker is inserted at
- * the end of the list with empty strings as name/value.
+/* Reconstructs the Required Insert Count of a field section from its encoded
+ * value <enc_ric> as described in RFC 9204 4.5.1.1, based on the current state
+ * of decoder <dec>. Returns 0 on success with the result in <ric>, or a
+ * negative QPACK_RET_* code if the encoded value is invalid.
+ */
+static int qpack_decode_ric(const struct qpack_dec *dec, uint64_t enc_ric, uint64_t *ric)
+{
+	uint64_t max_entries = dec->max_cap / 32;
+	uint64_t full_range = 2 * max_entries;
+	uint64_t max_value, max_wrapped, req;
+
+	*ric = 0;
+	if (!enc_ric)
+		return 0;
+
+	if (enc_ric > full_range)
+		return -QPACK_RET_DECOMP;
+
+	max_value = dec->ic + max_entries;
+	max_wrapped = (max_value / full_range) * full_range;
+	req = max_wrapped + enc_ric - 1;
+
+	if (req > max_value) {
+		if (req <= full_range)
+			return -QPACK_RET_DECOMP;
+		req -= full_range;
+	}
+
+	/* RIC value of 0 must be encoded as 0 */
+	if (!req)
+		return -QPACK_RET_DECOMP;
+
+	*ric = req;
+	return 0;
+}
+
+/* Returns the dynamic table entry of decoder <dec> with absolute index <abs>
+ * referenced from a field section whose Required Insert Count is <ric>, or
+ * NULL if this is an invalid reference.
+ *
+ * RFC9204 2.2.3 Invalid References
+ *
+ * If the decoder encounters a reference in a field line representation
+ * to a dynamic table entry that has already been evicted or that has an
+ * absolute index greater than or equal to the declared Required Insert
+ * Count (Section 4.5.1), it MUST treat this as a connection error of
+ * type QPACK_DECOMPRESSION_FAILED.
+ */
+static const struct qpack_dte *qpack_dec_get_dte(const struct qpack_dec *dec,
+                                                 uint64_t abs, uint64_t ric)
+{
+	if (abs >= ric || !dec->dht)
+		return NULL;
+
+	/* ric <= ic is guaranteed by the caller */
+	return qpack_dht_get_by_age(dec->dht, dec->ic - 1 - abs);
+}
+
+/* Decodes the value of a literal field line from <raw> for <len> bytes,
+ * Huffman-decoding it into <tmp> if needed. Returns 0 on success with <raw>
+ * and <len> updated, otherwise a negative QPACK_RET_* error code.
+ */
+static int qpack_decode_fs_value(const unsigned char **raw, uint64_t *len,
+                                 struct buffer *tmp, struct ist *value)
+{
+	uint64_t length;
+	unsigned int h;
+
+	if (!*len)
+		return -QPACK_RET_TRUNCATED;
+
+	h = **raw & 0x80;
+	length = qpack_get_varint(raw, len, 7);
+	if (*len == (uint64_t)-1 || *len < length) {
+		qpack_debug_printf(stderr, "##ERR@%d\n", __LINE__);
+		return -QPACK_RET_TRUNCATED;
+	}
+
+	qpack_debug_printf(stderr, " h=%d length=%llu", !!h, (unsigned long long)length);
+	if (h) {
+		char *trash;
+		int nlen;
+
+		trash = chunk_newstr(tmp);
+		if (!trash) {
+			qpack_debug_printf(stderr, "##ERR@%d\n", __LINE__);
+			return -QPACK_RET_TOO_LARGE;
+		}
+
+		nlen = huff_dec(*raw, length, trash, tmp->size - tmp->data);
+		if (nlen == (uint32_t)-1) {
+			qpack_debug_printf(stderr, " can't decode huffman.\n");
+			return -QPACK_RET_HUFFMAN;
+		}
+
+		qpack_debug_printf(stderr, " [name huff %d->%d '%s']", (int)length, (int)nlen, trash);
+		/* makes an ist from tmp storage */
+		b_add(tmp, nlen);
+		*value = ist2(trash, nlen);
+	}
+	else {
+		*value = ist2(*raw, length);
+	}
+
+	*raw += length;
+	*len -= length;
+	return 0;
+}
+
+/* Decode a field section from the <raw> buffer of <len> bytes using the state
+ * of decoder <dec>. Each parsed header is inserted into <list> of <list_size>
+ * entries max and uses <tmp> as a storage for some elements pointing into it.
+ * An end marker is inserted at the end of the list with empty strings as
+ * name/value. Entries of the dynamic table are directly referenced so <list>
+ * must be consumed before any further encoder stream instruction is processed.
+ * The Required Insert Count of the section is stored into <ric>, it must be
+ * acknowledged on the decoder stream if not null.
  *
  * Returns the number of headers inserted into list excluding the end marker.
- * In case of error, a negative code QPACK_RET_* is returned.
+ * In case of error, a negative code QPACK_RET_* is returned. If the section
+ * references entries not received yet, -QPACK_RET_BLOCKED is returned and
+ * decoding must be retried once the insert count reaches <ric>.
  */
-int qpack_decode_fs(const unsigned char *raw, uint64_t len, struct buffer *tmp,
-                    struct http_hdr *list, int list_size)
+int qpack_decode_fs(struct qpack_dec *dec, const unsigned char *raw, uint64_t len,
+                    struct buffer *tmp, struct http_hdr *list, int list_size,
+                    uint64_t *ric)
 {
+	const struct qpack_dte *dte;
 	struct ist name, value;
-	uint64_t enc_ric, db;
+	uint64_t enc_ric, db, base;
 	int s;
 	unsigned int efl_type;
 	int ret;
@@ -268,6 +578,35 @@ int qpack_decode_fs(const unsigned char *raw, uint64_t len, struct buffer *tmp,
 		goto out;
 	}
 
+	ret = qpack_decode_ric(dec, enc_ric, ric);
+	if (ret < 0) {
+		qpack_debug_printf(stderr, "##ERR@%d(%d)\n", __LINE__, ret);
+		goto out;
+	}
+
+	/* RFC 9204 2.1.2. Blocked Streams
+	 *
+	 * When the decoder receives an encoded field section with a Required
+	 * Insert Count greater than its own Insert Count, the stream cannot be
+	 * processed immediately and is considered "blocked".
+	 */
+	if (*ric > dec->ic) {
+		ret = -QPACK_RET_BLOCKED;
+		goto out;
+	}
+
+	/* RFC 9204 4.5.1.2. Base */
+	if (s) {
+		if (db >= *ric) {
+			ret = -QPACK_RET_DECOMP;
+			goto out;
+		}
+		base = *ric - db - 1;
+	}
+	else {
+		base = *ric + db;
+	}
+
 	chunk_reset(tmp);
 	qpack_debug_printf(stderr, "enc_ric: %llu db: %llu s=%d\n", 
 	                   (unsigned long long)enc_ric, (unsigned long long)db, !!s);
@@ -284,12 +623,9 @@ int qpack_decode_fs(const unsigned char *raw, uint64_t len, struct buffer *tmp,
 		qpack_debug_printf(stderr, "efl_type=0x%02x\n", efl_type);
 
 		if (efl_type == QPACK_LFL_WPBNM) {
-			/* Literal field line with post-base name reference
-			 * TODO adjust this when dynamic table support is implemented.
-			 */
-#if 0
-			uint64_t index __maybe_unused, length;
-			unsigned int n __maybe_unused, h __maybe_unused;
+			/* Literal field line with post-base name reference */
+			uint64_t index;
+			unsigned int n __maybe_unused;
 
 			qpack_debug_printf(stderr, "literal field line with post-base name reference:");
 			n = *raw & 0x08;
@@ -301,42 +637,18 @@ int qpack_decode_fs(const unsigned char *raw, uint64_t len, struct buffer *tmp,
 			}
 
 			qpack_debug_printf(stderr, " n=%d index=%llu", !!n, (unsigned long long)index);
-			h = *raw & 0x80;
-			length = qpack_get_varint(&raw, &len, 7);
-			if (len == (uint64_t)-1) {
-				qpack_debug_printf(stderr, "##ERR@%d\n", __LINE__);
-				ret = -QPACK_RET_TRUNCATED;
-				goto out;
-			}
-
-			qpack_debug_printf(stderr, " h=%d length=%llu", !!h, (unsigned long long)length);
+			dte = qpack_dec_get_dte(dec, base + index, *ric);
+			if (!dte)
+				return -QPACK_RET_DECOMP;
+			name = qpack_get_name(dec->dht, dte);
 
-			if (len < length) {
-				qpack_debug_printf(stderr, "##ERR@%d\n", __LINE__);
-				ret = -QPACK_RET_TRUNCATED;
+			ret = qpack_decode_fs_value(&raw, &len, tmp, &value);
+			if (ret < 0)
 				goto out;
-			}
-
-			raw += length;
-			len -= length;
-#endif
-
-			/* RFC9204 2.2.3 Invalid References
-			 *
-			 * If the decoder encounters a reference in a field line representation
-			 * to a dynamic table entry that has already been evicted or that has an
-			 * absolute index greater than or equal to the declared Required Insert
-			 * Count (Section 4.5.1), it MUST treat this as a connection error of
-			 * type QPACK_DECOMPRESSION_FAILED.
-			 */
-			return -QPACK_RET_DECOMP;
 		}
 		else if (efl_type == QPACK_IFL_WPBI) {
-			/* Indexed field line with post-base index
-			 * TODO adjust this when dynamic table support is implemented.
-			 */
-#if 0
-			uint64_t index __maybe_unused;
+			/* Indexed field line with post-base index */
+			uint64_t index;
 
 			qpack_debug_printf(stderr, "indexed field line with post-base index:");
 			index = qpack_get_varint(&raw, &len, 4);
@@ -347,17 +659,11 @@ int qpack_decode_fs(const unsigned char *raw, uint64_t len, struct buffer *tmp,
 			}
 
 			qpack_debug_printf(stderr, " index=%llu", (unsigned long long)index);
-#endif
-
-			/* RFC9204 2.2.3 Invalid References
-			 *
-			 * If the decoder encounters a reference in a field line representation
-			 * to a dynamic table entry that has already been evicted or that has an
-			 * absolute index greater than or equal to the declared Required Insert
-			 * Count (Section 4.5.1), it MUST treat this as a connection error of
-			 * type QPACK_DECOMPRESSION_FAILED.
-			 */
-			return -QPACK_RET_DECOMP;
+			dte = qpack_dec_get_dte(dec, base + index, *ric);
+			if (!dte)
+				return -QPACK_RET_DECOMP;
+			name = qpack_get_name(dec->dht, dte);
+			value = qpack_get_value(dec->dht, dte);
 		}
 		else if (efl_type & QPACK_IFL_BIT) {
 			/* Indexed field line */
@@ -377,17 +683,12 @@ int qpack_decode_fs(const unsigned char *raw, uint64_t len, struct buffer *tmp,
 				name = qpack_sht[index].n;
 				value = qpack_sht[index].v;
 			}
+			else if (!static_tbl && index < base &&
+			         (dte = qpack_dec_get_dte(dec, base - 1 - index, *ric))) {
+				name = qpack_get_name(dec->dht, dte);
+				value = qpack_get_value(dec->dht, dte);
+			}
 			else {
-				/* RFC9204 2.2.3 Invalid References
-				 *
-				 * If the decoder encounters a reference in a field line representation
-				 * to a dynamic table entry that has already been evicted or that has an
-				 * absolute index greater than or equal to the declared Required Insert
-				 * Count (Section 4.5.1), it MUST treat this as a connection error of
-				 * type QPACK_DECOMPRESSION_FAILED.
-				 *
-				 * TODO adjust this when dynamic table support is implemented.
-				 */
 				return -QPACK_RET_DECOMP;
 			}
 
@@ -395,8 +696,8 @@ int qpack_decode_fs(const unsigned char *raw, uint64_t len, struct buffer *tmp,
 		}
 		else if (efl_type & QPACK_LFL_WNR_BIT) {
 			/* Literal field line with name reference */
-			uint64_t index, length;
-			unsigned int static_tbl, n __maybe_unused, h;
+			uint64_t index;
+			unsigned int static_tbl, n __maybe_unused;
 
 			qpack_debug_printf(stderr, "Literal field line with name reference:");
 			n = efl_type & 0x20;
@@ -411,59 +712,18 @@ int qpack_decode_fs(const unsigned char *raw, uint64_t len, struct buffer *tmp,
 			if (static_tbl && index < QPACK_SHT_SIZE) {
 				name = qpack_sht[index].n;
 			}
+			else if (!static_tbl && index < base &&
+			         (dte = qpack_dec_get_dte(dec, base - 1 - index, *ric))) {
+				name = qpack_get_name(dec->dht, dte);
+			}
 			else {
-				/* RFC9204 2.2.3 Invalid References
-				 *
-				 * If the decoder encounters a reference in a field line representation
-				 * to a dynamic table entry that has already been evicted or that has an
-				 * absolute index greater than or equal to the declared Required Insert
-				 * Count (Section 4.5.1), it MUST treat this as a connection error of
-				 * type QPACK_DECOMPRESSION_FAILED.
-				 *
-				 * TODO adjust this when dynamic table support is implemented.
-				 */
 				return -QPACK_RET_DECOMP;
 			}
 
 			qpack_debug_printf(stderr, " n=%d t=%d index=%llu", !!n, !!static_tbl, (unsigned long long)index);
-			h = *raw & 0x80;
-			length = qpack_get_varint(&raw, &len, 7);
-			if (len == (uint64_t)-1 || len < length) {
-				qpack_debug_printf(stderr, "##ERR@%d\n", __LINE__);
-				ret = -QPACK_RET_TRUNCATED;
+			ret = qpack_decode_fs_value(&raw, &len, tmp, &value);
+			if (ret < 0)
 				goto out;
-			}
-
-			qpack_debug_printf(stderr, " h=%d length=%llu", !!h, (unsigned long long)length);
-			if (h) {
-				char *trash;
-				int nlen;
-
-				trash = chunk_newstr(tmp);
-				if (!trash) {
-					qpack_debug_printf(stderr, "##ERR@%d\n", __LINE__);
-					ret = -QPACK_RET_TOO_LARGE;
-					goto out;
-				}
-
-				nlen = huff_dec(raw, length, trash, tmp->size - tmp->data);
-				if (nlen == (uint32_t)-1) {
-					qpack_debug_printf(stderr, " can't decode huffman.\n");
-					ret = -QPACK_RET_HUFFMAN;
-					goto out;
-				}
-
-				qpack_debug_printf(stderr, " [name huff %d->%d '%s']", (int)length, (int)nlen, trash);
-				/* makes an ist from tmp storage */
-				b_add(tmp, nlen);
-				value = ist2(trash, nlen);
-			}
-			else {
-				value = ist2(raw, length);
-			}
-
-			raw += length;
-			len -= length;
 		}
 		else if (efl_type & QPACK_LFL_WLN_BIT) {
 			/* Literal field line with literal name */
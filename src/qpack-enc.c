@@ -1,52 +1,52 @@
 #include <haproxy/qpack-enc.h>
 
 #include <haproxy/buf.h>
+#include <haproxy/http-hdr-t.h>
+#include <haproxy/init.h>
 #include <haproxy/intops.h>
+#include <haproxy/list.h>
+#include <haproxy/pool.h>
+#include <haproxy/qpack-dec.h>
+#include <haproxy/qpack-tbl.h>
+
+DECLARE_STATIC_TYPED_POOL(pool_head_qpack_enc_sec, "qpack_enc_sec", struct qpack_enc_sec);
 
 /* Returns the byte size required to encode <i> as a <prefix_size>-prefix
  * integer.
  */
-static size_t qpack_get_prefix_int_size(int i, int prefix_size)
+static size_t qpack_get_prefix_int_size(uint64_t i, int prefix_size)
 {
-	int n = (1 << prefix_size) - 1;
-	if (i < n) {
+	const uint64_t n = (1ULL << prefix_size) - 1;
+	size_t result = 2;
+
+	if (i < n)
 		return 1;
-	}
-	else {
-		size_t result = 0;
-		while (i) {
-			++result;
-			i >>= 7;
-		}
-		return 1 + result;
-	}
+
+	for (i -= n; i >= 0x80; i >>= 7)
+		result++;
+	return result;
 }
 
 /* Encode the integer <i> in the buffer <out> in a <prefix_size>-bit prefix
- * integer. The caller must ensure there is enough size in the buffer. The
- * prefix is OR-ed with <before_prefix> byte.
+ * integer. The prefix is OR-ed with <before_prefix> byte.
  *
- * Returns 0 if success else non-zero.
+ * Returns 0 if success else non-zero if there is not enough room in <out>.
  */
-static int qpack_encode_prefix_integer(struct buffer *out, int i,
+static int qpack_encode_prefix_integer(struct buffer *out, uint64_t i,
                                        int prefix_size,
                                        unsigned char before_prefix)
 {
-	const int mod = (1 << prefix_size) - 1;
+	const uint64_t mod = (1ULL << prefix_size) - 1;
 	BUG_ON_HOT(!prefix_size);
 
-	if (i < mod) {
-		if (b_room(out) < 1)
-			return 1;
+	if (b_room(out) < qpack_get_prefix_int_size(i, prefix_size))
+		return 1;
 
+	if (i < mod) {
 		b_putchr(out, before_prefix | i);
 	}
 	else {
-		int to_encode = i - mod;
-		const size_t sz = to_encode / mod;
-
-		if (b_room(out) < sz)
-			return 1;
+		uint64_t to_encode = i - mod;
 
 		b_putchr(out, before_prefix | mod);
 		while (1) {
@@ -300,3 +300,604 @@ int qpack_encode_header(struct buffer *out, const struct ist n, const struct ist
 
 	return 0;
 }
+
+/* Returns non-zero if header field <n> is sensitive and must never be inserted
+ * into any dynamic table, including by intermediaries (RFC9204#7.1.3).
+ */
+static inline int qpack_never_index(const struct ist n)
+{
+	return isteq(n, ist("authorization")) ||
+	       isteq(n, ist("proxy-authorization")) ||
+	       isteq(n, ist("cookie")) ||
+	       isteq(n, ist("set-cookie"));
+}
+
+/* Returns non-zero if header field <n> with value <v> is worth inserting into
+ * dynamic table <dht>. Fields which are too large would flush most of the
+ * table, and some fields almost always carry a different value per message so
+ * they would only evict useful entries and waste encoder stream bandwidth.
+ */
+static inline int qpack_worth_indexing(const struct qpack_dht *dht, const struct ist n, const struct ist v)
+{
+	if ((n.len + v.len + 32) * 4 > dht->size * 3)
+		return 0;
+
+	return !isteq(n, ist("age")) &&
+	       !isteq(n, ist("content-length")) &&
+	       !isteq(n, ist("date")) &&
+	       !isteq(n, ist("etag")) &&
+	       !isteq(n, ist("expires")) &&
+	       !isteq(n, ist("if-modified-since")) &&
+	       !isteq(n, ist("if-none-match")) &&
+	       !isteq(n, ist("last-modified")) &&
+	       !isteq(n, ist("location"));
+}
+
+/* Looks up header field <n>:<v> in the static table. Returns the index of an
+ * exact match with <exact> set to 1, otherwise the index of the first entry
+ * with the same name with <exact> set to 0, or -1 if the name is not there.
+ */
+static int qpack_find_static(const struct ist n, const struct ist v, int *exact)
+{
+	int idx = -1;
+	int i;
+
+	*exact = 0;
+	for (i = 0; i < QPACK_SHT_SIZE; i++) {
+		if (!isteq(qpack_sht[i].n, n))
+			continue;
+
+		if (isteq(qpack_sht[i].v, v)) {
+			*exact = 1;
+			return i;
+		}
+
+		if (idx < 0)
+			idx = i;
+	}
+
+	return idx;
+}
+
+/* Initializes QPACK encoder context <enc>. The dynamic table remains disabled
+ * until qpack_enc_set_capacity() is called.
+ */
+void qpack_enc_init(struct qpack_enc *enc)
+{
+	enc->dht = NULL;
+	enc->ins = NULL;
+	enc->sec = NULL;
+	LIST_INIT(&enc->sections);
+	enc->max_cap = 0;
+	enc->ic = enc->krc = enc->base = 0;
+	enc->nb_sections = 0;
+	enc->st_ins = enc->st_evict = 0;
+	enc->st_raw = enc->st_enc = 0;
+}
+
+/* Releases all the resources attached to QPACK encoder context <enc>. */
+void qpack_enc_release(struct qpack_enc *enc)
+{
+	struct qpack_enc_sec *sec, *back;
+
+	list_for_each_entry_safe(sec, back, &enc->sections, list) {
+		LIST_DELETE(&sec->list);
+		pool_free(pool_head_qpack_enc_sec, sec);
+	}
+	enc->nb_sections = 0;
+
+	pool_free(pool_head_qpack_enc_sec, enc->sec);
+	enc->sec = NULL;
+
+	if (enc->dht) {
+		qpack_dht_free(enc->dht);
+		enc->dht = NULL;
+	}
+}
+
+/* Enables the dynamic table of encoder <enc> with a capacity of <cap> bytes,
+ * which must not exceed neither the peer's <max_cap> advertised capacity nor
+ * the size of the QPACK table pool. The Set Dynamic Table Capacity instruction
+ * is emitted into encoder stream buffer <ins>. Tables smaller than a single
+ * entry overhead are not worth being used. Returns 0 on success or non-zero if
+ * the table remains disabled.
+ */
+int qpack_enc_set_capacity(struct qpack_enc *enc, uint64_t max_cap, uint32_t cap,
+                           struct buffer *ins)
+{
+	enc->max_cap = max_cap;
+	if (enc->dht || cap < 64 || cap > max_cap)
+		return 1;
+
+	enc->dht = qpack_dht_alloc();
+	if (!enc->dht)
+		return 1;
+
+	qpack_dht_init(enc->dht, cap);
+
+	/* Set Dynamic Table Capacity : | 0 | 0 | 1 | Capacity (5+) | */
+	if (qpack_encode_prefix_integer(ins, cap, 5, 0x20)) {
+		qpack_dht_free(enc->dht);
+		enc->dht = NULL;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Prepares encoder <enc> to encode a new field section. Insertions into the
+ * dynamic table are only performed if encoder stream buffer <ins> is not NULL.
+ * Only entries acknowledged by the decoder will be referenced, so the Base of
+ * the section is the current Known Received Count. A previous section which
+ * was not committed is simply forgotten.
+ */
+void qpack_enc_start_section(struct qpack_enc *enc, struct buffer *ins)
+{
+	enc->ins = ins;
+	enc->base = 0;
+
+	if (!enc->dht)
+		return;
+
+	if (!enc->sec && enc->nb_sections < QPACK_ENC_MAX_SECTIONS)
+		enc->sec = pool_alloc(pool_head_qpack_enc_sec);
+
+	if (enc->sec) {
+		enc->sec->ric = 0;
+		enc->sec->min = ~0ULL;
+		enc->base = enc->krc;
+	}
+}
+
+/* Records a reference to the dynamic table entry with absolute index <abs>
+ * into the field section being encoded by <enc>.
+ */
+static inline void qpack_enc_ref(struct qpack_enc *enc, uint64_t abs)
+{
+	if (abs + 1 > enc->sec->ric)
+		enc->sec->ric = abs + 1;
+	if (abs < enc->sec->min)
+		enc->sec->min = abs;
+}
+
+/* Returns non-zero if a new entry of <len> bytes (name plus value) may be
+ * inserted into the dynamic table of <enc>, which requires that none of the
+ * entries which would be evicted for this is referenced by an unacknowledged
+ * field section, including the one being encoded (RFC9204#2.1.1).
+ */
+static int qpack_enc_can_insert(const struct qpack_enc *enc, uint64_t len)
+{
+	const struct qpack_dht *dht = enc->dht;
+	const struct qpack_enc_sec *sec;
+	uint64_t pinned = ~0ULL;
+	unsigned int used = dht->used;
+	uint32_t total = dht->total;
+	unsigned int slot;
+
+	if (len + 32 > dht->size)
+		return 0;
+
+	if (enc->sec && enc->sec->ric)
+		pinned = enc->sec->min;
+
+	list_for_each_entry(sec, &enc->sections, list) {
+		if (sec->min < pinned)
+			pinned = sec->min;
+	}
+
+	slot = used ? qpack_dht_get_tail(dht) : 0;
+	while (used && used * 32 + total + len + 32 > dht->size) {
+		/* the oldest entry's absolute index is <ic - used> */
+		if (enc->ic - used >= pinned)
+			return 0;
+
+		total -= dht->dte[slot].nlen + dht->dte[slot].vlen;
+		used--;
+		if (++slot >= dht->wrap)
+			slot = 0;
+	}
+
+	return 1;
+}
+
+/* Inserts header field <n>:<v> into the dynamic table of <enc> and emits the
+ * corresponding instruction into the encoder stream buffer, using static name
+ * index <sidx> if not negative. Nothing is done if the instruction does not fit
+ * or if some entries to be evicted are still referenced. Returns non-zero if
+ * the entry was inserted.
+ */
+static int qpack_enc_insert(struct qpack_enc *enc, int sidx, const struct ist n, const struct ist v)
+{
+	struct buffer *ins = enc->ins;
+	unsigned int used;
+	size_t sz;
+
+	if (sidx >= 0)
+		sz = qpack_get_prefix_int_size(sidx, 6);
+	else
+		sz = qpack_get_prefix_int_size(n.len, 5) + n.len;
+	sz += qpack_get_prefix_int_size(v.len, 7) + v.len;
+
+	if (b_room(ins) < sz || !qpack_enc_can_insert(enc, n.len + v.len))
+		return 0;
+
+	used = enc->dht->used;
+	if (qpack_dht_insert(enc->dht, n, v) < 0) {
+		/* Some entries may have been evicted, and the table doesn't
+		 * mirror the decoder's one anymore: stop using it.
+		 */
+		qpack_dht_free(enc->dht);
+		enc->dht = NULL;
+		enc->base = 0;
+		return 0;
+	}
+
+	enc->ic++;
+	enc->st_ins++;
+	enc->st_evict += used + 1 - enc->dht->used;
+
+	if (sidx >= 0) {
+		/* Insert with Name Reference : | 1 | T=1 | Name Index (6+) | */
+		qpack_encode_prefix_integer(ins, sidx, 6, 0xc0);
+	}
+	else {
+		/* Insert with Literal Name : | 0 | 1 | H | Name Length (5+) | */
+		qpack_encode_prefix_integer(ins, n.len, 5, 0x40);
+		b_putblk(ins, n.ptr, n.len);
+	}
+	/* value : | H | Value Length (7+) | */
+	qpack_encode_prefix_integer(ins, v.len, 7, 0x00);
+	b_putblk(ins, v.ptr, v.len);
+
+	return 1;
+}
+
+/* Encodes header field <n>:<v> into <out>, using the static table and the
+ * dynamic table of encoder <enc> when it is enabled. New entries are inserted
+ * into the dynamic table when they're worth it, but they will only be
+ * referenced by future field sections once acknowledged by the decoder.
+ * Sensitive fields are always emitted as never indexed literals.
+ *
+ * Returns 0 on success else non-zero if <out> is full.
+ */
+int qpack_encode_header_dht(struct qpack_enc *enc, struct buffer *out,
+                            const struct ist n, const struct ist v)
+{
+	const struct qpack_dht *dht = enc->dht;
+	size_t prev = b_data(out);
+	int64_t didx = -1, nidx = -1; /* absolute dynamic indexes */
+	int sidx, exact, never;
+	int pending = 0;
+
+	sidx = qpack_find_static(n, v, &exact);
+	if (exact) {
+		/* Indexed Field Line : | 1 | T=1 | Index (6+) | */
+		if (qpack_encode_prefix_integer(out, sidx, 6, 0xc0))
+			return 1;
+		goto end;
+	}
+
+	never = qpack_never_index(n);
+	if (dht && !never) {
+		unsigned int slot = dht->head;
+		uint64_t abs = enc->ic;
+		unsigned int i;
+
+		/* newest entries first, only acknowledged ones may be used */
+		for (i = 0; i < dht->used; i++) {
+			const struct qpack_dte *dte = &dht->dte[slot];
+
+			abs--;
+			slot = (slot ? slot : dht->wrap) - 1;
+
+			if (dte->nlen != n.len || !isteq(qpack_get_name(dht, dte), n))
+				continue;
+
+			if (dte->vlen == v.len && isteq(qpack_get_value(dht, dte), v)) {
+				if (abs < enc->base) {
+					didx = abs;
+					break;
+				}
+				/* already inserted, awaiting acknowledgment */
+				pending = 1;
+			}
+			else if (nidx < 0 && abs < enc->base)
+				nidx = abs;
+		}
+	}
+
+	if (didx >= 0) {
+		/* Indexed Field Line : | 1 | T=0 | Index (6+) | */
+		if (qpack_encode_prefix_integer(out, enc->base - 1 - didx, 6, 0x80))
+			return 1;
+		qpack_enc_ref(enc, didx);
+		goto end;
+	}
+
+	if (dht && !never && !pending && enc->ins && qpack_worth_indexing(dht, n, v))
+		qpack_enc_insert(enc, sidx, n, v);
+
+	/* The static name is always the cheapest, and a dynamic name is only
+	 * used when it's shorter than the literal name.
+	 */
+	if (sidx >= 0) {
+		/* Literal Field Line with Name Reference : | 0 | 1 | N | T=1 | Index (4+) | */
+		if (qpack_encode_prefix_integer(out, sidx, 4, 0x50 | (never ? 0x20 : 0)))
+			return 1;
+	}
+	else if (nidx >= 0 && enc->dht &&
+	         qpack_get_prefix_int_size(enc->base - 1 - nidx, 4) < qpack_get_prefix_int_size(n.len, 3) + n.len) {
+		/* Literal Field Line with Name Reference : | 0 | 1 | N | T=0 | Index (4+) | */
+		if (qpack_encode_prefix_integer(out, enc->base - 1 - nidx, 4, 0x40))
+			return 1;
+		qpack_enc_ref(enc, nidx);
+	}
+	else {
+		/* Literal Field Line with Literal Name : | 0 | 0 | 1 | N | H | NameLen (3+) | */
+		if (qpack_encode_prefix_integer(out, n.len, 3, 0x20 | (never ? 0x10 : 0)) ||
+		    b_room(out) < n.len)
+			return 1;
+		b_putblk(out, n.ptr, n.len);
+	}
+
+	/* value : | H | Value Length (7+) | */
+	if (qpack_encode_prefix_integer(out, v.len, 7, 0x00) || b_room(out) < v.len)
+		return 1;
+	b_putblk(out, v.ptr, v.len);
+
+ end:
+	enc->st_raw += n.len + v.len;
+	enc->st_enc += b_data(out) - prev;
+	return 0;
+}
+
+/* Finalizes the field section encoded into <out> by <enc>. The section prefix
+ * reserved by qpack_encode_field_section_line() at the beginning of <out> is
+ * rewritten if the dynamic table was referenced, in which case it may need to
+ * grow. <out> must only contain the field section and must not wrap.
+ *
+ * Returns 0 on success else non-zero if <out> is full.
+ */
+int qpack_enc_end_section(struct qpack_enc *enc, struct buffer *out)
+{
+	uint64_t ric = enc->sec ? enc->sec->ric : 0;
+	uint64_t max_entries, eric;
+	struct buffer pfx;
+	size_t len;
+
+	enc->ins = NULL;
+	if (!ric)
+		return 0;
+
+	/* RFC9204#4.5.1.1 Encoded Required Insert Count. Base is never lower
+	 * than RIC so the Delta Base is always positive (S=0).
+	 */
+	max_entries = enc->max_cap / 32;
+	eric = (ric % (2 * max_entries)) + 1;
+	len = qpack_get_prefix_int_size(eric, 8) +
+	      qpack_get_prefix_int_size(enc->base - ric, 7);
+
+	if (len > 2) {
+		if (b_room(out) < len - 2)
+			return 1;
+		memmove(b_head(out) + len, b_head(out) + 2, b_data(out) - 2);
+		b_add(out, len - 2);
+	}
+
+	pfx = b_make(b_head(out), len, 0, 0);
+	qpack_encode_prefix_integer(&pfx, eric, 8, 0x00);
+	qpack_encode_prefix_integer(&pfx, enc->base - ric, 7, 0x00);
+	return 0;
+}
+
+/* Reports that the field section just encoded by <enc> was emitted on stream
+ * <id>. If it references the dynamic table, it is kept until the decoder
+ * acknowledges it so that the referenced entries are not evicted.
+ */
+void qpack_enc_commit_section(struct qpack_enc *enc, uint64_t id)
+{
+	if (!enc->sec || !enc->sec->ric)
+		return;
+
+	enc->sec->id = id;
+	LIST_APPEND(&enc->sections, &enc->sec->list);
+	enc->nb_sections++;
+	enc->sec = NULL;
+}
+
+/* Handles a Section Acknowledgment for stream <id> received on the decoder
+ * stream. Returns 0 on success or non-zero if no field section was pending on
+ * this stream, which is a decoder stream error (RFC9204#4.4.1).
+ */
+int qpack_enc_section_ack(struct qpack_enc *enc, uint64_t id)
+{
+	struct qpack_enc_sec *sec;
+
+	list_for_each_entry(sec, &enc->sections, list) {
+		if (sec->id != id)
+			continue;
+
+		if (sec->ric > enc->krc)
+			enc->krc = sec->ric;
+		LIST_DELETE(&sec->list);
+		pool_free(pool_head_qpack_enc_sec, sec);
+		enc->nb_sections--;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Handles a Stream Cancellation for stream <id> received on the decoder
+ * stream: all the field sections pending on this stream are released.
+ */
+void qpack_enc_stream_cancel(struct qpack_enc *enc, uint64_t id)
+{
+	struct qpack_enc_sec *sec, *back;
+
+	list_for_each_entry_safe(sec, back, &enc->sections, list) {
+		if (sec->id != id)
+			continue;
+
+		LIST_DELETE(&sec->list);
+		pool_free(pool_head_qpack_enc_sec, sec);
+		enc->nb_sections--;
+	}
+}
+
+/* Handles an Insert Count Increment of <inc> received on the decoder stream.
+ * Returns 0 on success or non-zero on a null increment or one beyond the
+ * number of insertions, which is a decoder stream error (RFC9204#4.4.3).
+ */
+int qpack_enc_insert_count_inc(struct qpack_enc *enc, uint64_t inc)
+{
+	if (!inc || inc > enc->ic - enc->krc)
+		return 1;
+
+	enc->krc += inc;
+	return 0;
+}
+
+/* Encodes a Section Acknowledgment decoder instruction for stream <id> into
+ * <out>. Returns 0 on success else non-zero.
+ */
+int qpack_encode_section_ack(struct buffer *out, uint64_t id)
+{
+	/* | 1 | Stream ID (7+) | */
+	return qpack_encode_prefix_integer(out, id, 7, 0x80);
+}
+
+/* Encodes a Stream Cancellation decoder instruction for stream <id> into
+ * <out>. Returns 0 on success else non-zero.
+ */
+int qpack_encode_stream_cancel(struct buffer *out, uint64_t id)
+{
+	/* | 0 | 1 | Stream ID (6+) | */
+	return qpack_encode_prefix_integer(out, id, 6, 0x40);
+}
+
+/* Encodes an Insert Count Increment decoder instruction of <inc> into <out>.
+ * Returns 0 on success else non-zero.
+ */
+int qpack_encode_insert_count_inc(struct buffer *out, uint64_t inc)
+{
+	/* | 0 | 0 | Increment (6+) | */
+	return qpack_encode_prefix_integer(out, inc, 6, 0x00);
+}
+
+/* Encodes a series of field sections using a dynamic table and checks that
+ * they are properly decoded by our decoder, whose table must remain in sync
+ * via the encoder and decoder streams. Returns 0 on success, non-zero on
+ * failure.
+ */
+int qpack_enc_unittest(int argc, char **argv)
+{
+	static const struct http_hdr fields[] = {
+		{ IST(":status"),        IST("200")                         },
+		{ IST(":status"),        IST("302")                         },
+		{ IST("server"),         IST("haproxy")                     },
+		{ IST("content-type"),   IST("application/json")            },
+		{ IST("content-type"),   IST("text/html; charset=utf-8")    },
+		{ IST("cache-control"),  IST("private, max-age=0")          },
+		{ IST("content-length"), IST("1234")                        },
+		{ IST("set-cookie"),     IST("SESSID=0123456789abcdef")     },
+		{ IST("x-request-id"),   IST("ad8a1f0d-6f1b-4b8a-b1b9")     },
+		{ IST("x-custom"),       IST("some rather long value that will evict other entries from the table sooner") },
+		{ IST("accept-encoding"),IST("gzip, deflate")               },
+		{ IST("vary"),           IST("accept-encoding")             },
+	};
+	struct http_hdr list[32];
+	struct qpack_enc enc;
+	struct qpack_dec dec = { .max_cap = 4096 };
+	char out_area[1024], tmp_area[1024], ins_area[4096], dst_area[64];
+	struct buffer out, tmp, ins, dst;
+	uint32_t rnd = 0x12345678;
+	uint64_t ric;
+	int blk, fld, nbf, ret;
+	int refs = 0;
+	int err = 1;
+
+	if (!pool_head_qpack_tbl)
+		pool_head_qpack_tbl = create_pool("qpack_tbl", 4096, MEM_F_SHARED|MEM_F_EXACT);
+
+	qpack_enc_init(&enc);
+	ins = b_make(ins_area, sizeof(ins_area), 0, 0);
+	dst = b_make(dst_area, sizeof(dst_area), 0, 0);
+
+	/* a small table to exercise evictions */
+	if (qpack_enc_set_capacity(&enc, dec.max_cap, 256, &ins))
+		goto out;
+
+	for (blk = 0; blk < 1000; blk++) {
+		int picked[8];
+
+		out = b_make(out_area, sizeof(out_area), 0, 0);
+		if (qpack_encode_field_section_line(&out))
+			goto out;
+
+		qpack_enc_start_section(&enc, &ins);
+		rnd = rnd * 1103515245 + 12345;
+		nbf = 1 + (rnd >> 16) % 8;
+		for (fld = 0; fld < nbf; fld++) {
+			rnd = rnd * 1103515245 + 12345;
+			picked[fld] = (rnd >> 16) % (sizeof(fields) / sizeof(fields[0]));
+			if (qpack_encode_header_dht(&enc, &out, fields[picked[fld]].n, fields[picked[fld]].v))
+				goto out;
+		}
+
+		if (qpack_enc_end_section(&enc, &out))
+			goto out;
+		qpack_enc_commit_section(&enc, blk * 4);
+
+		/* transfer encoder stream */
+		ret = qpack_decode_enc(&dec, &ins, 0);
+		if (ret != b_data(&ins))
+			goto out;
+		b_reset(&ins);
+
+		tmp = b_make(tmp_area, sizeof(tmp_area), 0, 0);
+		ret = qpack_decode_fs(&dec, (const unsigned char *)b_head(&out), b_data(&out),
+		                      &tmp, list, sizeof(list) / sizeof(list[0]), &ric);
+		if (ret != nbf)
+			goto out;
+
+		for (fld = 0; fld < nbf; fld++) {
+			if (!isteq(list[fld].n, fields[picked[fld]].n) ||
+			    !isteq(list[fld].v, fields[picked[fld]].v))
+				goto out;
+		}
+
+		/* acknowledge the section, and the insertions from time to time */
+		if (ric) {
+			refs++;
+			if (qpack_encode_section_ack(&dst, blk * 4))
+				goto out;
+			if (ric > dec.krc)
+				dec.krc = ric;
+		}
+
+		if (blk % 3 == 0 && dec.ic > dec.krc) {
+			if (qpack_encode_insert_count_inc(&dst, dec.ic - dec.krc))
+				goto out;
+			dec.krc = dec.ic;
+		}
+
+		/* transfer decoder stream */
+		ret = qpack_decode_dec(&enc, &dst, 0);
+		if (ret != b_data(&dst))
+			goto out;
+		b_reset(&dst);
+
+		if (!enc.dht || !dec.dht || enc.ic != dec.ic ||
+		    enc.dht->used != dec.dht->used || enc.dht->total != dec.dht->total)
+			goto out;
+	}
+
+	/* the dynamic table must have been used and must have saved space */
+	err = !refs || !enc.st_evict || enc.st_enc >= enc.st_raw;
+ out:
+	qpack_enc_release(&enc);
+	qpack_dec_release(&dec);
+	return err;
+}
+REGISTER_UNITTEST("qpack_enc", qpack_enc_unittest);
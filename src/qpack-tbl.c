@@ -212,6 +212,7 @@ static struct qpack_dht *qpack_dht_defrag(struct qpack_dht *dht)
 	if (!alt_dht)
 		return NULL;
 
+	alt_dht->size = dht->size;
 	alt_dht->total = dht->total;
 	alt_dht->used = dht->used;
 	alt_dht->wrap = dht->used;
@@ -394,6 +395,8 @@ int qpack_dht_insert(struct qpack_dht *dht, struct ist name, struct ist value)
 	else {
 		/* need to defragment the table before inserting upfront */
 		dht = qpack_dht_defrag(dht);
+		if (!dht)
+			return -1;
 		wrap = dht->wrap + 1;
 		head = dht->head + 1;
 		dht->dte[head].addr = dht->dte[dht->front].addr - (name.len + value.len);
@@ -413,3 +416,33 @@ int qpack_dht_insert(struct qpack_dht *dht, struct ist name, struct ist value)
 	memcpy((void *)dht + dht->dte[head].addr + name.len, value.ptr, value.len);
 	return 0;
 }
+
+/* Changes the capacity of dynamic table <dht> to <size> bytes, following a Set
+ * Dynamic Table Capacity instruction (RFC9204#4.3.1). The new size must not be
+ * larger than the area allocated for the table. The oldest entries are evicted
+ * until the remaining ones fit, and the table is repacked at the end of its new
+ * area. Returns the number of evicted entries, or a negative value if the
+ * table could not be repacked, in which case it must not be used anymore.
+ */
+int qpack_dht_resize(struct qpack_dht *dht, uint32_t size)
+{
+	unsigned int tail;
+	int evicted = 0;
+
+	while (dht->used && dht->used * 32 + dht->total > size) {
+		tail = qpack_dht_get_tail(dht);
+		dht->total -= dht->dte[tail].nlen + dht->dte[tail].vlen;
+		if (tail == dht->front)
+			dht->front = dht->head;
+		dht->used--;
+		evicted++;
+	}
+
+	dht->size = size;
+	if (!dht->used) {
+		dht->front = dht->head = 0;
+		return evicted;
+	}
+
+	return qpack_dht_defrag(dht) ? evicted : -1;
+}
@@ -42,6 +42,7 @@
 #include <haproxy/quic_stats.h>
 #include <haproxy/quic_tp-t.h>
 #include <haproxy/quic_trace.h>
+#include <haproxy/quic_tune.h>
 #include <haproxy/session.h>
 #include <haproxy/task.h>
 #include <haproxy/trace.h>
@@ -349,6 +350,124 @@ static struct quic_dgram *quic_rxbuf_purge_dgrams(struct quic_receiver_buf *rbuf
 	return prev;
 }
 
+/* Ancillary data which may be retrieved with received datagrams. */
+union quic_pktinfo {
+#ifdef IP_PKTINFO
+	struct in_pktinfo in;
+#else /* !IP_PKTINFO */
+	struct in_addr addr;
+#endif
+#ifdef IPV6_RECVPKTINFO
+	struct in6_pktinfo in6;
+#endif
+};
+
+/* Size of the ancillary data buffer for a single received message, with room
+ * for the destination address and the UDP GRO segment size.
+ */
+#define QUIC_RX_CMSG_SZ (CMSG_SPACE(sizeof(union quic_pktinfo)) + CMSG_SPACE(sizeof(int)))
+
+/* Maximum length of a buffer coalesced by UDP GRO, which never exceeds the
+ * size of an IP packet.
+ */
+#define QUIC_RX_GRO_MAX_SZ 65535
+
+/* A message received by quic_recv_batch(). */
+struct quic_rx_msg {
+	struct sockaddr_storage saddr; /* peer address */
+	struct sockaddr_storage daddr; /* reception address */
+	size_t len;                    /* received length, 0 if ignored */
+	size_t gro_size;               /* UDP GRO segment size, 0 if not coalesced */
+};
+
+/* Per-thread context of quic_recv_batch(), too large to live on the stack. */
+struct quic_rx_batch {
+	struct quic_rx_msg msgs[QUIC_MAX_FE_RX_BATCH];
+#ifdef HA_HAVE_RECVMMSG
+	struct mmsghdr mmsg[QUIC_MAX_FE_RX_BATCH];
+#else
+	struct { struct msghdr msg_hdr; unsigned int msg_len; } mmsg[1];
+#endif
+	struct iovec vec[QUIC_MAX_FE_RX_BATCH];
+	char cdata[QUIC_MAX_FE_RX_BATCH][QUIC_RX_CMSG_SZ];
+};
+
+static THREAD_LOCAL struct quic_rx_batch *quic_rx_batch;
+
+/* Parse the ancillary data of message <msg> received on a datagram socket.
+ * The reception address is stored into <to> of length <to_len> if it could be
+ * retrieved, with <dst_port> as port. If the message contains several
+ * datagrams coalesced by UDP GRO, the size of each segment is stored into
+ * <gro_size> if not NULL.
+ */
+static void quic_recv_cmsg(struct msghdr *msg,
+                           struct sockaddr *to, socklen_t to_len,
+                           uint16_t dst_port, size_t *gro_size)
+{
+	struct cmsghdr *cmsg;
+
+	clear_addr((struct sockaddr_storage *)to);
+	if (gro_size)
+		*gro_size = 0;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		switch (cmsg->cmsg_level) {
+		case IPPROTO_IP:
+#if defined(IP_PKTINFO)
+			if (cmsg->cmsg_type == IP_PKTINFO) {
+				struct sockaddr_in *in = (struct sockaddr_in *)to;
+				struct in_pktinfo *info = (struct in_pktinfo *)CMSG_DATA(cmsg);
+
+				if (to_len >= sizeof(struct sockaddr_in)) {
+					in->sin_family = AF_INET;
+					in->sin_addr = info->ipi_addr;
+					in->sin_port = dst_port;
+				}
+			}
+#elif defined(IP_RECVDSTADDR)
+			if (cmsg->cmsg_type == IP_RECVDSTADDR) {
+				struct sockaddr_in *in = (struct sockaddr_in *)to;
+				struct in_addr *info = (struct in_addr *)CMSG_DATA(cmsg);
+
+				if (to_len >= sizeof(struct sockaddr_in)) {
+					in->sin_family = AF_INET;
+					in->sin_addr.s_addr = info->s_addr;
+					in->sin_port = dst_port;
+				}
+			}
+#endif /* IP_PKTINFO || IP_RECVDSTADDR */
+			break;
+
+		case IPPROTO_IPV6:
+#ifdef IPV6_RECVPKTINFO
+			if (cmsg->cmsg_type == IPV6_PKTINFO) {
+				struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)to;
+				struct in6_pktinfo *info6 = (struct in6_pktinfo *)CMSG_DATA(cmsg);
+
+				if (to_len >= sizeof(struct sockaddr_in6)) {
+					in6->sin6_family = AF_INET6;
+					memcpy(&in6->sin6_addr, &info6->ipi6_addr, sizeof(in6->sin6_addr));
+					in6->sin6_port = dst_port;
+				}
+			}
+#endif
+			break;
+
+		case IPPROTO_UDP:
+#ifdef UDP_GRO
+			if (cmsg->cmsg_type == UDP_GRO && gro_size) {
+				int seg;
+
+				memcpy(&seg, CMSG_DATA(cmsg), sizeof(seg));
+				if (seg > 0)
+					*gro_size = seg;
+			}
+#endif
+			break;
+		}
+	}
+}
+
 /* Receive a single message from datagram socket <fd>. Data are placed in <out>
  * buffer of length <len>.
  *
@@ -369,20 +488,9 @@ static ssize_t quic_recv(int fd, void *out, size_t len,
                          struct sockaddr *to, socklen_t to_len,
                          uint16_t dst_port, int check_port)
 {
-	union pktinfo {
-#ifdef IP_PKTINFO
-		struct in_pktinfo in;
-#else /* !IP_PKTINFO */
-		struct in_addr addr;
-#endif
-#ifdef IPV6_RECVPKTINFO
-		struct in6_pktinfo in6;
-#endif
-	};
-	char cdata[CMSG_SPACE(sizeof(union pktinfo))];
+	char cdata[CMSG_SPACE(sizeof(union quic_pktinfo))];
 	struct msghdr msg;
 	struct iovec vec;
-	struct cmsghdr *cmsg;
 	ssize_t ret;
 
 	vec.iov_base = out;
@@ -414,71 +522,100 @@ static ssize_t quic_recv(int fd, void *out, size_t len,
 		goto end;
 	}
 
-	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-		switch (cmsg->cmsg_level) {
-		case IPPROTO_IP:
-#if defined(IP_PKTINFO)
-			if (cmsg->cmsg_type == IP_PKTINFO) {
-				struct sockaddr_in *in = (struct sockaddr_in *)to;
-				struct in_pktinfo *info = (struct in_pktinfo *)CMSG_DATA(cmsg);
+	quic_recv_cmsg(&msg, to, to_len, dst_port, NULL);
 
-				if (to_len >= sizeof(struct sockaddr_in)) {
-					in->sin_family = AF_INET;
-					in->sin_addr = info->ipi_addr;
-					in->sin_port = dst_port;
-				}
-			}
-#elif defined(IP_RECVDSTADDR)
-			if (cmsg->cmsg_type == IP_RECVDSTADDR) {
-				struct sockaddr_in *in = (struct sockaddr_in *)to;
-				struct in_addr *info = (struct in_addr *)CMSG_DATA(cmsg);
+ end:
+	return ret;
+}
 
-				if (to_len >= sizeof(struct sockaddr_in)) {
-					in->sin_family = AF_INET;
-					in->sin_addr.s_addr = info->s_addr;
-					in->sin_port = dst_port;
-				}
-			}
-#endif /* IP_PKTINFO || IP_RECVDSTADDR */
-			break;
+/* Receive up to <count> messages from listener socket <fd>, using a single
+ * syscall when possible. The messages are placed into <out> buffer, each one
+ * at the beginning of its own <slot> bytes area, and described by the <msgs>
+ * array. <dst_port> is used to fill the reception addresses. Messages coming
+ * from a restricted port are ignored and reported with a null length. If a
+ * message coalesced by UDP GRO was truncated, its trailing partial segment is
+ * dropped.
+ *
+ * Returns the number of messages received, or a negative value on error.
+ */
+static int quic_recv_batch(int fd, unsigned char *out, size_t slot, int count,
+                           struct quic_rx_msg *msgs, uint16_t dst_port)
+{
+	typeof(quic_rx_batch->mmsg[0]) *mmsg = quic_rx_batch->mmsg;
+	struct iovec *vec = quic_rx_batch->vec;
+	char (*cdata)[QUIC_RX_CMSG_SZ] = quic_rx_batch->cdata;
+	int i, ret;
 
-		case IPPROTO_IPV6:
-#ifdef IPV6_RECVPKTINFO
-			if (cmsg->cmsg_type == IPV6_PKTINFO) {
-				struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)to;
-				struct in6_pktinfo *info6 = (struct in6_pktinfo *)CMSG_DATA(cmsg);
+#ifndef HA_HAVE_RECVMMSG
+	count = 1;
+#endif
+	BUG_ON_HOT(count < 1 || count > QUIC_MAX_FE_RX_BATCH);
 
-				if (to_len >= sizeof(struct sockaddr_in6)) {
-					in6->sin6_family = AF_INET6;
-					memcpy(&in6->sin6_addr, &info6->ipi6_addr, sizeof(in6->sin6_addr));
-					in6->sin6_port = dst_port;
-				}
-			}
+	for (i = 0; i < count; i++) {
+		struct msghdr *msg = &mmsg[i].msg_hdr;
+
+		vec[i].iov_base = out + i * slot;
+		vec[i].iov_len  = slot;
+
+		memset(msg, 0, sizeof(*msg));
+		msg->msg_name       = &msgs[i].saddr;
+		msg->msg_namelen    = sizeof(msgs[i].saddr);
+		msg->msg_iov        = &vec[i];
+		msg->msg_iovlen     = 1;
+		msg->msg_control    = cdata[i];
+		msg->msg_controllen = sizeof(cdata[i]);
+	}
+
+	do {
+#ifdef HA_HAVE_RECVMMSG
+		if (count > 1)
+			ret = recvmmsg(fd, mmsg, count, 0, NULL);
+		else
 #endif
-			break;
+		{
+			ret = recvmsg(fd, &mmsg[0].msg_hdr, 0);
+			if (ret >= 0) {
+				mmsg[0].msg_len = ret;
+				ret = 1;
+			}
 		}
+	} while (ret < 0 && errno == EINTR);
+
+	for (i = 0; i < ret; i++) {
+		struct quic_rx_msg *rx = &msgs[i];
+
+		rx->len = mmsg[i].msg_len;
+		quic_recv_cmsg(&mmsg[i].msg_hdr, (struct sockaddr *)&rx->daddr,
+		               sizeof(rx->daddr), dst_port, &rx->gro_size);
+
+		if (unlikely(port_is_restricted(&rx->saddr, HA_PROTO_QUIC)))
+			rx->len = 0;
+		else if (rx->gro_size && (mmsg[i].msg_hdr.msg_flags & MSG_TRUNC))
+			rx->len -= rx->len % rx->gro_size;
 	}
 
- end:
 	return ret;
 }
 
 /* Function called on a read event from a listening socket. It tries
- * to handle as many connections as possible.
+ * to handle as many connections as possible. Several datagrams are retrieved
+ * per syscall when supported, as configured by "tune.quic.fe.rx.batch". With
+ * UDP GRO, each received buffer may contain several datagrams which are split
+ * before being dispatched.
  */
 void quic_lstnr_sock_fd_iocb(int fd)
 {
-	ssize_t ret;
+	int ret;
 	struct quic_receiver_buf *rxbuf;
 	struct buffer *buf;
 	struct listener *l = objt_listener(fdtab[fd].owner);
 	struct quic_transport_params *params;
-	/* Source address */
-	struct sockaddr_storage saddr = {0}, daddr = {0};
-	size_t max_sz, cspace;
+	struct quic_counters *prx_counters;
+	struct quic_rx_msg *msgs = quic_rx_batch->msgs;
+	size_t max_sz, cspace, slot;
 	struct quic_dgram *new_dgram;
-	unsigned char *dgram_buf;
-	int max_dgrams;
+	unsigned char *dgram_buf, *base, *pos;
+	int max_dgrams, count, nb_dgrams, gro_dgrams, i;
 
 	BUG_ON(!l);
 
@@ -494,6 +631,7 @@ void quic_lstnr_sock_fd_iocb(int fd)
 		goto out;
 
 	buf = &rxbuf->buf;
+	prx_counters = EXTRA_COUNTERS_GET(l->bind_conf->frontend->extra_counters_fe, &quic_stats_module);
 
 	max_dgrams = global.tune.maxpollevents;
  start:
@@ -507,8 +645,6 @@ void quic_lstnr_sock_fd_iocb(int fd)
 	max_sz = params->max_udp_payload_size;
 	cspace = b_contig_space(buf);
 	if (cspace < max_sz) {
-		struct proxy *px = l->bind_conf->frontend;
-		struct quic_counters *prx_counters = EXTRA_COUNTERS_GET(px->extra_counters_fe, &quic_stats_module);
 		struct quic_dgram *dgram;
 
 		/* Do no mark <buf> as full, and do not try to consume it
@@ -536,34 +672,92 @@ void quic_lstnr_sock_fd_iocb(int fd)
 
 		/* Consume the remaining space */
 		b_add(buf, cspace);
-		if (b_contig_space(buf) < max_sz) {
+		cspace = b_contig_space(buf);
+		if (cspace < max_sz) {
 			HA_ATOMIC_INC(&prx_counters->rxbuf_full);
 			goto out;
 		}
 	}
 
-	dgram_buf = (unsigned char *)b_tail(buf);
-	ret = quic_recv(fd, dgram_buf, max_sz,
-	                (struct sockaddr *)&saddr, sizeof(saddr),
-	                (struct sockaddr *)&daddr, sizeof(daddr),
-	                get_net_port(&l->rx.addr), 1);
+	/* Each message is received into its own slot of the contiguous free
+	 * space. With UDP GRO, a slot must be able to hold a whole coalesced
+	 * buffer, otherwise the trailing segments would be lost. This limits
+	 * the batch to the few 64kB slots fitting in the RX buffer, but each
+	 * of them may carry many datagrams.
+	 */
+	slot = (quic_tune.fe.opts & QUIC_TUNE_FE_RX_UDP_GRO) ?
+	       MIN(cspace, QUIC_RX_GRO_MAX_SZ) : max_sz;
+	count = MIN(quic_tune.fe.rx_batch, cspace / slot);
+	count = MAX(MIN(count, max_dgrams), 1);
+
+	base = (unsigned char *)b_tail(buf);
+	ret = quic_recv_batch(fd, base, slot, count, msgs, get_net_port(&l->rx.addr));
 	if (ret <= 0)
 		goto out;
 
-	b_add(buf, ret);
-	if (!quic_lstnr_dgram_dispatch(dgram_buf, ret, l, &saddr, &daddr,
-	                               new_dgram, &rxbuf->dgram_list)) {
-		/* If wrong, consume this datagram */
-		b_sub(buf, ret);
+	/* Datagrams are moved to the buffer tail so that they remain
+	 * contiguous, as expected by quic_rxbuf_purge_dgrams().
+	 */
+	nb_dgrams = gro_dgrams = 0;
+	for (i = 0; i < ret; i++) {
+		size_t len = msgs[i].len;
+		size_t seg = msgs[i].gro_size ? msgs[i].gro_size : len;
+
+		pos = base + i * slot;
+		while (len) {
+			size_t sz = MIN(seg, len);
+
+			dgram_buf = (unsigned char *)b_tail(buf);
+			if (dgram_buf != pos)
+				memmove(dgram_buf, pos, sz);
+
+			b_add(buf, sz);
+			if (!quic_lstnr_dgram_dispatch(dgram_buf, sz, l, &msgs[i].saddr, &msgs[i].daddr,
+			                               new_dgram, &rxbuf->dgram_list)) {
+				/* If wrong, consume this datagram */
+				b_sub(buf, sz);
+			}
+			new_dgram = NULL;
+
+			pos += sz;
+			len -= sz;
+			nb_dgrams++;
+			if (msgs[i].gro_size)
+				gro_dgrams++;
+		}
 	}
-	new_dgram = NULL;
-	if (--max_dgrams > 0)
+
+	HA_ATOMIC_INC(&prx_counters->rx_calls);
+	HA_ATOMIC_ADD(&prx_counters->rx_dgrams, nb_dgrams);
+	if (ret == count && count > 1)
+		HA_ATOMIC_INC(&prx_counters->rx_batch_full);
+	if (gro_dgrams)
+		HA_ATOMIC_ADD(&prx_counters->rx_gro_dgrams, gro_dgrams);
+
+	/* A partial batch indicates that the socket was drained. */
+	max_dgrams -= nb_dgrams;
+	if (ret == count && max_dgrams > 0)
 		goto start;
  out:
 	pool_free(pool_head_quic_dgram, new_dgram);
 	MT_LIST_APPEND(&l->rx.rxbuf_list, &rxbuf->rxbuf_el);
 }
 
+/* Allocates the per-thread context of quic_recv_batch(). Returns 0 on error. */
+static int quic_alloc_rx_batch_per_thread()
+{
+	quic_rx_batch = calloc(1, sizeof(*quic_rx_batch));
+	return !!quic_rx_batch;
+}
+
+static void quic_free_rx_batch_per_thread()
+{
+	ha_free(&quic_rx_batch);
+}
+
+REGISTER_PER_THREAD_ALLOC(quic_alloc_rx_batch_per_thread);
+REGISTER_PER_THREAD_FREE(quic_free_rx_batch_per_thread);
+
 /* FD-owned quic-conn socket callback. */
 void quic_conn_sock_fd_iocb(int fd)
 {
@@ -88,6 +88,17 @@ static struct stat_col quic_stats[] = {
 	                                        .desc = "Total number of received STREAMS_BLOCKED_UNI frames" },
 	[QUIC_ST_NCBUF_GAP_LIMIT]           = { .name = "quic_ncbuf_gap_limit",
 	                                        .desc = "Total number of failures to add to ncbuf because of gap size limit" },
+	/* Datagrams reception on listener sockets */
+	[QUIC_ST_RX_CALLS]                  = { .name = "quic_rx_calls",
+	                                        .desc = "Total number of receive syscalls which returned datagrams on listener sockets" },
+	[QUIC_ST_RX_DGRAMS]                 = { .name = "quic_rx_dgrams",
+	                                        .desc = "Total number of datagrams received on listener sockets" },
+	[QUIC_ST_RX_DGRAMS_PER_CALL]        = { .name = "quic_rx_dgrams_per_call",
+	                                        .desc = "Average number of datagrams received per syscall on listener sockets, multiplied by 100" },
+	[QUIC_ST_RX_BATCH_FULL]             = { .name = "quic_rx_batch_full",
+	                                        .desc = "Total number of receive syscalls which filled the whole batch (see tune.quic.fe.rx.batch)" },
+	[QUIC_ST_RX_GRO_DGRAMS]             = { .name = "quic_rx_gro_dgrams",
+	                                        .desc = "Total number of datagrams extracted from UDP GRO coalesced buffers" },
 };
 
 struct quic_counters quic_counters;
@@ -236,6 +247,25 @@ static int quic_fill_stats(struct stats_module *mod, struct extra_counters *ctr,
 		case QUIC_ST_NCBUF_GAP_LIMIT:
 			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->ncbuf_gap_limit));
 			break;
+		case QUIC_ST_RX_CALLS:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->rx_calls));
+			break;
+		case QUIC_ST_RX_DGRAMS:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->rx_dgrams));
+			break;
+		case QUIC_ST_RX_DGRAMS_PER_CALL: {
+			ullong calls = EXTRA_COUNTERS_AGGR(ctr, counters->rx_calls);
+			ullong dgrams = EXTRA_COUNTERS_AGGR(ctr, counters->rx_dgrams);
+
+			metric = mkf_u32(FN_AVG, calls ? dgrams * 100 / calls : 0);
+			break;
+		}
+		case QUIC_ST_RX_BATCH_FULL:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->rx_batch_full));
+			break;
+		case QUIC_ST_RX_GRO_DGRAMS:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->rx_gro_dgrams));
+			break;
 		default:
 			/* not used for frontends. If a specific metric
 			 * is requested, return an error. Otherwise continue.
@@ -393,6 +393,200 @@ struct my_regex *regex_comp(const char *str, int cs, int cap, char **err)
 	return NULL;
 }
 
+/* Skips the bracket expression starting at <p>, which must point to '['.
+ * Returns a pointer to the character following the closing bracket, or NULL
+ * if the expression is not terminated or uses escapes or nested classes whose
+ * meaning depends on the regex engine.
+ */
+static const char *regex_skip_class(const char *p)
+{
+	p++;
+	if (*p == '^')
+		p++;
+	if (*p == ']')
+		p++;
+	for (; *p != ']'; p++) {
+		if (!*p || *p == '\\' || *p == '[')
+			return NULL;
+	}
+	return p + 1;
+}
+
+/* Skips the group starting at <p>, which must point to '('. Returns a pointer
+ * to the character following the closing parenthesis, or NULL if the group is
+ * not terminated.
+ */
+static const char *regex_skip_group(const char *p)
+{
+	int depth = 0;
+
+	while (*p) {
+		if (*p == '\\') {
+			if (!p[1])
+				return NULL;
+			p += 2;
+			continue;
+		}
+		if (*p == '[') {
+			p = regex_skip_class(p);
+			if (!p)
+				return NULL;
+			continue;
+		}
+		if (*p == '(')
+			depth++;
+		else if (*p == ')' && !--depth)
+			return p + 1;
+		p++;
+	}
+	return NULL;
+}
+
+/* Looks for the longest string that any subject matched by regex <str> must
+ * contain, so that subjects not containing it may be rejected without running
+ * the regex. Only a simple subset of the syntax is understood: sequences of
+ * plain or escaped characters, optionally quantified, separated by classes,
+ * groups, anchors and dots. Anything else, such as alternations at the top
+ * level, inline options or engine-specific escapes, makes the function give
+ * up. If <cs> is zero the regex is case-insensitive, and non-ASCII characters
+ * are not retained since their case folding depends on the engine. At most
+ * <size>-1 bytes are copied into <out>, which is always zero-terminated if
+ * <size> is not null. Returns the length of the string copied, or 0 if none
+ * was found.
+ */
+int regex_find_literal(const char *str, int cs, char *out, int size)
+{
+	const char *p = str;
+	char cur[64];
+	int len = 0;   /* length of the current literal */
+	int best = 0;  /* length of the longest literal found so far */
+	int lit = 0;   /* the last atom is the last byte of cur[] */
+	unsigned char c;
+
+	if (size <= 0)
+		return 0;
+	if (size > sizeof(cur))
+		size = sizeof(cur);
+	*out = 0;
+
+	while (1) {
+		c = *p;
+
+		if (c == '*' || c == '?' || c == '+' || c == '{') {
+			int min = (c == '+');
+
+			p++;
+			if (c == '{') {
+				/* only plain intervals are supported, as engines
+				 * disagree on the meaning of the other forms.
+				 */
+				if (!isdigit((unsigned char)*p))
+					return 0;
+				while (isdigit((unsigned char)*p))
+					min |= *p++ != '0';
+				if (*p == ',')
+					for (p++; isdigit((unsigned char)*p); p++)
+						;
+				if (*p != '}')
+					return 0;
+				p++;
+			}
+			/* lazy and possessive forms in PCRE, but nested repeats
+			 * in POSIX regex, which may make the atom optional.
+			 */
+			while (*p == '?' || *p == '*' || *p == '+' || *p == '{') {
+				if (*p != '+')
+					min = 0;
+				if (*p == '{')
+					break;
+				p++;
+			}
+			if (lit && !min) {
+				/* the last character is optional, including all the
+				 * bytes of a multi-byte one.
+				 */
+				len--;
+				while (len && (unsigned char)cur[len] >= 0x80 &&
+				       (unsigned char)cur[len - 1] >= 0x80)
+					len--;
+			}
+			goto end;
+		}
+
+		switch (c) {
+		case 0:
+			goto end;
+		case '|':
+		case ')':
+			return 0;
+		case '(':
+			/* options, lookarounds, verbs... */
+			if (p[1] == '?' || p[1] == '*')
+				return 0;
+			p = regex_skip_group(p);
+			if (!p)
+				return 0;
+			goto end;
+		case '[':
+			p = regex_skip_class(p);
+			if (!p)
+				return 0;
+			goto end;
+		case '.':
+		case '^':
+		case '$':
+			p++;
+			goto end;
+		case '\\':
+			c = p[1];
+			if (c && strchr("dDwWsSbB", c)) {
+				p += 2;
+				goto end;
+			}
+			if (!c || isalnum(c) || c >= 0x80 || strchr("<>`'", c))
+				return 0;
+			p += 2;
+			break;
+		default:
+			p++;
+			break;
+		}
+
+		/* <c> is a literal character */
+		if (!cs && c >= 0x80)
+			goto end;
+		if (len == sizeof(cur)) {
+			/* flush it without a trailing multi-byte character,
+			 * which could still be made optional.
+			 */
+			while (len && (unsigned char)cur[len - 1] >= 0x80)
+				len--;
+			if (len > best) {
+				best = len;
+				memcpy(out, cur, MIN(len, size - 1));
+			}
+			len = 0;
+		}
+		cur[len++] = c;
+		lit = 1;
+		continue;
+
+	end:
+		/* the current literal is complete */
+		if (len > best) {
+			best = len;
+			memcpy(out, cur, MIN(len, size - 1));
+		}
+		len = lit = 0;
+		if (!c)
+			break;
+	}
+
+	best = MIN(best, size - 1);
+	out[best] = 0;
+	return best;
+}
+
 static void regex_register_build_options(void)
 {
 	char *ptr = NULL;
@@ -11,22 +11,170 @@
  * 2 of the License, or (at your option) any later version.
  */
 
+#include <stdio.h>
 #include <sys/mman.h>
 #include <arpa/inet.h>
 #include <import/ebmbtree.h>
+#include <haproxy/init.h>
 #include <haproxy/list.h>
 #include <haproxy/shctx.h>
 #include <haproxy/tools.h>
 
+/* Returns the index in row <row> of the frequency sketch <sketch> of the
+ * counter of key <key>.
+ */
+static inline unsigned int shctx_sketch_idx(const struct shctx_sketch *sketch, unsigned int key, int row)
+{
+	static const unsigned int seeds[SHCTX_SKETCH_DEPTH] = {
+		0x9e3779b1, 0x85ebca77, 0xc2b2ae3d, 0x27d4eb2f
+	};
+	unsigned int h = key * seeds[row];
+
+	h ^= h >> 15;
+	return row * (sketch->mask + 1) + (h & sketch->mask);
+}
+
+/* Returns the estimated access frequency of key <key> in <sketch> */
+static unsigned int shctx_sketch_freq(const struct shctx_sketch *sketch, unsigned int key)
+{
+	unsigned int freq = SHCTX_SKETCH_MAX, cnt;
+	int row;
+
+	for (row = 0; row < SHCTX_SKETCH_DEPTH; row++) {
+		cnt = HA_ATOMIC_LOAD(&sketch->counters[shctx_sketch_idx(sketch, key, row)]);
+		freq = MIN(freq, cnt);
+	}
+	return freq;
+}
+
+/* Records an access to the row of key <key> of <shctx>, which is used by the
+ * admission policy. Nothing is done if the policy does not need it. It may be
+ * called without the lock.
+ */
+void shctx_key_access(struct shared_context *shctx, unsigned int key)
+{
+	struct shctx_sketch *sketch = shctx->sketch;
+	unsigned int freq, idx, i;
+	int row;
+
+	if (!sketch)
+		return;
+
+	/* conservative update: only the smallest counters are incremented */
+	freq = shctx_sketch_freq(sketch, key);
+	if (freq >= SHCTX_SKETCH_MAX)
+		return;
+
+	for (row = 0; row < SHCTX_SKETCH_DEPTH; row++) {
+		idx = shctx_sketch_idx(sketch, key, row);
+		if (HA_ATOMIC_LOAD(&sketch->counters[idx]) == freq)
+			_HA_ATOMIC_INC(&sketch->counters[idx]);
+	}
+
+	/* aging: the thread completing a period halves all counters */
+	if (_HA_ATOMIC_ADD_FETCH(&sketch->samples, 1) != sketch->period)
+		return;
+
+	for (i = 0; i < SHCTX_SKETCH_DEPTH * (sketch->mask + 1); i++)
+		HA_ATOMIC_STORE(&sketch->counters[i], HA_ATOMIC_LOAD(&sketch->counters[i]) >> 1);
+	HA_ATOMIC_STORE(&sketch->samples, 0);
+}
+
+/* Sets the eviction policy of <shctx>, which must be called once after
+ * shctx_init(). With SHCTX_POLICY_TINYLFU, the rows which were used again
+ * after they were stored are moved to a protected list, which is only
+ * evicted when nothing else may be, and new rows are only admitted if their
+ * key was requested at least as often as the key of the row they would evict
+ * first. Returns 0 on memory allocation error.
+ */
+int shctx_set_policy(struct shared_context *shctx, int policy)
+{
+	unsigned int width = 256;
+
+	shctx->policy = policy;
+	if (policy != SHCTX_POLICY_TINYLFU)
+		return 1;
+
+	/* a counter per block in each row is enough since rows use one
+	 * block at least.
+	 */
+	while (width < shctx->nbav && width < (1U << 24))
+		width <<= 1;
+
+	shctx->sketch = calloc(1, sizeof(*shctx->sketch) + SHCTX_SKETCH_DEPTH * width);
+	if (!shctx->sketch)
+		return 0;
+
+	shctx->sketch->mask = width - 1;
+	shctx->sketch->period = 10 * width;
+	shctx->maxprot = shctx->nbav / 5 * 4;
+	return 1;
+}
+
+/* Unlinks the row starting at <first> from its list, leaving it as a detached
+ * list which may be spliced into another one.
+ */
+static inline void shctx_row_unlink(struct shared_block *first)
+{
+	first->list.p->n = first->last_reserved->list.n;
+	first->last_reserved->list.n->p = first->list.p;
+
+	first->list.p = &first->last_reserved->list;
+	first->last_reserved->list.n = &first->list;
+}
+
+/* Moves the oldest rows of the protected list of <shctx> at the end of the
+ * avail list, until at least <blocks> blocks are in the avail list and the
+ * protected list does not exceed its size. Must be called under the lock.
+ */
+static void shctx_demote(struct shared_context *shctx, unsigned int blocks)
+{
+	struct shared_block *first;
+
+	while (!LIST_ISEMPTY(&shctx->protected) &&
+	       (shctx->nbav - shctx->nbprot < blocks || shctx->nbprot > shctx->maxprot)) {
+		first = LIST_NEXT(&shctx->protected, struct shared_block *, list);
+		shctx_row_unlink(first);
+		LIST_SPLICE_END_DETACHED(&shctx->avail, &first->list);
+		first->flags &= ~(SHCTX_BLK_F_HIT | SHCTX_BLK_F_PROTECTED);
+		shctx->nbprot -= first->block_count;
+	}
+}
+
+/* Returns non-zero if a row of key <key> needing <data_len> more bytes may be
+ * stored in <shctx>, according to its admission policy: either they fit in
+ * free blocks, or its key is at least as frequent as the key of the first row
+ * it would evict. As it is checked again each time a row grows, a large row
+ * stored in several steps may be rejected after its first blocks, once it
+ * would evict a more frequent one. Must be called under the lock.
+ */
+static int shctx_admit(struct shared_context *shctx, unsigned int key, int data_len)
+{
+	struct shared_block *block;
+
+	list_for_each_entry(block, &shctx->avail, list) {
+		if (block->len)
+			return (shctx_sketch_freq(shctx->sketch, key) >=
+				shctx_sketch_freq(shctx->sketch, block->key));
+		data_len -= shctx->block_size;
+		if (data_len <= 0)
+			break;
+	}
+	return 1;
+}
+
 /*
  * Reserve a new row if <first> is null, put it in the hotlist, set the refcount to 1
  * or append new blocks to the row with <first> as first block if non null.
+ * When a new row is reserved and <key> is not null, the admission policy of
+ * <shctx> may reject it.
  *
  * Reserve blocks in the avail list and put them in the hot list
  * Return the first block put in the hot list or NULL if not enough blocks available
  */
-struct shared_block *shctx_row_reserve_hot(struct shared_context *shctx,
-                                           struct shared_block *first, int data_len)
+static struct shared_block *__shctx_row_reserve_hot(struct shared_context *shctx,
+                                                    struct shared_block *first,
+                                                    unsigned int key, int data_len)
 {
 	struct shared_block *last = NULL, *block, *sblock;
 	struct shared_block *ret = first;
@@ -70,6 +218,17 @@ struct shared_block *shctx_row_reserve_hot(struct shared_context *shctx,
 	}
 
 
+	if (shctx->policy == SHCTX_POLICY_TINYLFU) {
+		if (first)
+			key = first->key;
+		shctx_demote(shctx, (data_len + shctx->block_size - 1) / shctx->block_size);
+		if (key && data_len > 0 && !shctx_admit(shctx, key, data_len)) {
+			shctx->rejected++;
+			shctx_wrunlock(shctx);
+			goto out;
+		}
+	}
+
 	if (data_len <= 0 || LIST_ISEMPTY(&shctx->avail)) {
 		ret = NULL;
 		shctx_wrunlock(shctx);
@@ -79,8 +238,11 @@ struct shared_block *shctx_row_reserve_hot(struct shared_context *shctx,
 	list_for_each_entry_safe(block, sblock, &shctx->avail, list) {
 
 		/* release callback */
-		if (block->len && shctx->free_block)
-			shctx->free_block(block, shctx->cb_data);
+		if (block->len) {
+			shctx->evicted++;
+			if (shctx->free_block)
+				shctx->free_block(block, shctx->cb_data);
+		}
 		block->len = 0;
 
 		if (ret) {
@@ -95,6 +257,8 @@ struct shared_block *shctx_row_reserve_hot(struct shared_context *shctx,
 			ret->block_count = 0;
 			ret->last_append = NULL;
 			ret->refcount = 1;
+			ret->key = key;
+			ret->flags = 0;
 		}
 
 		++ret->block_count;
@@ -116,6 +280,24 @@ struct shared_block *shctx_row_reserve_hot(struct shared_context *shctx,
 	return ret;
 }
 
+struct shared_block *shctx_row_reserve_hot(struct shared_context *shctx,
+                                           struct shared_block *first, int data_len)
+{
+	return __shctx_row_reserve_hot(shctx, first, 0, data_len);
+}
+
+/* Reserves a new row for <data_len> bytes and key <key> like
+ * shctx_row_reserve_hot(), except that the admission policy of <shctx> may
+ * reject it, in which case NULL is returned. The policy also applies when the
+ * row is extended by shctx_row_reserve_hot(). <key> is a hash of the row's
+ * key, also passed to shctx_key_access() when the row is looked up.
+ */
+struct shared_block *shctx_row_reserve_key(struct shared_context *shctx,
+                                           unsigned int key, int data_len)
+{
+	return __shctx_row_reserve_hot(shctx, NULL, key, data_len);
+}
+
 /*
  * if the refcount is 0 move the row to the hot list. Increment the refcount
  */
@@ -128,13 +310,12 @@ void shctx_row_detach(struct shared_context *shctx, struct shared_block *first)
 		/* Detach row from avail list, link first item's prev to last
 		 * item's next. This allows to use the LIST_SPLICE_END_DETACHED
 		 * macro. */
-		first->list.p->n = first->last_reserved->list.n;
-		first->last_reserved->list.n->p = first->list.p;
-
-		first->list.p = &first->last_reserved->list;
-		first->last_reserved->list.n = &first->list;
+		shctx_row_unlink(first);
 
 		shctx->nbav -= first->block_count;
+		if (first->flags & SHCTX_BLK_F_PROTECTED)
+			shctx->nbprot -= first->block_count;
+		first->flags = (first->flags & ~SHCTX_BLK_F_PROTECTED) | SHCTX_BLK_F_HIT;
 	}
 
 	first->refcount++;
@@ -151,11 +332,23 @@ void shctx_row_reattach(struct shared_context *shctx, struct shared_block *first
 
 		BUG_ON(!first->last_reserved);
 
-		/* Reattach to avail list */
 		first->list.p = &first->last_reserved->list;
-		LIST_SPLICE_END_DETACHED(&shctx->avail, &first->list);
-
 		shctx->nbav += first->block_count;
+
+		/* With the TinyLFU policy, the rows used again go to the
+		 * protected list.
+		 */
+		if (shctx->policy == SHCTX_POLICY_TINYLFU && first->len &&
+		    (first->flags & SHCTX_BLK_F_HIT)) {
+			LIST_SPLICE_END_DETACHED(&shctx->protected, &first->list);
+			first->flags |= SHCTX_BLK_F_PROTECTED;
+			shctx->nbprot += first->block_count;
+			shctx_demote(shctx, 0);
+			return;
+		}
+
+		/* Reattach to avail list */
+		LIST_SPLICE_END_DETACHED(&shctx->avail, &first->list);
 	}
 }
 
@@ -301,6 +494,7 @@ int shctx_init(struct shared_context **orig_shctx, int maxblocks, int blocksize,
 	shctx->nbav = 0;
 
 	LIST_INIT(&shctx->avail);
+	LIST_INIT(&shctx->protected);
 	HA_RWLOCK_INIT(&shctx->lock);
 
 	shctx->block_size = blocksize;
@@ -324,3 +518,115 @@ int shctx_init(struct shared_context **orig_shctx, int maxblocks, int blocksize,
 	return ret;
 }
 
+
+/* Stores a row of <blocks> blocks of key <key> in <shctx>, after recording
+ * <hits> accesses to its key, in one reservation. Returns the row, released,
+ * or NULL if it was rejected.
+ */
+static struct shared_block *shctx_unittest_store(struct shared_context *shctx, unsigned int key,
+                                                 int hits, int blocks)
+{
+	unsigned char data[1024] = { };
+	struct shared_block *first;
+	int len = blocks * shctx->block_size;
+
+	while (hits--)
+		shctx_key_access(shctx, key);
+
+	first = shctx_row_reserve_key(shctx, key, len);
+	if (!first)
+		return NULL;
+	BUG_ON(shctx_row_data_append(shctx, first, data, len) != 0);
+	shctx_wrlock(shctx);
+	shctx_row_reattach(shctx, first);
+	shctx_wrunlock(shctx);
+	return first;
+}
+
+/* Checks the eviction policies of the shared contexts. With TinyLFU, a row
+ * which is used again must survive a scan of new keys, and a row of a rarely
+ * requested key must not evict a more frequent one, neither when it is
+ * reserved nor when it grows. With LRU, such a row evicts the oldest one.
+ * Returns 0 on success.
+ */
+int shctx_policy_unittest(int argc, char **argv)
+{
+	unsigned char data[64] = { };
+	struct shared_context *shctx;
+	struct shared_block *hot, *first, *old = NULL;
+	int policy, i;
+
+	/* scan resistance */
+	if (shctx_init(&shctx, 16, 64, 0, 0, "unittest") != 16 ||
+	    !shctx_set_policy(shctx, SHCTX_POLICY_TINYLFU))
+		return 1;
+
+	hot = shctx_unittest_store(shctx, 1, 1, 1);
+	if (!hot)
+		return 1;
+	shctx_key_access(shctx, 1);
+	shctx_wrlock(shctx);
+	shctx_row_detach(shctx, hot);
+	shctx_row_reattach(shctx, hot);
+	shctx_wrunlock(shctx);
+
+	for (i = 0; i < 100; i++)
+		shctx_unittest_store(shctx, 100 + i, 1, 1);
+
+	if (!(hot->flags & SHCTX_BLK_F_PROTECTED) || hot->key != 1 || hot->len != 64) {
+		printf("a protected row was evicted by a scan\n");
+		return 1;
+	}
+
+	/* admission of a new row and of the growth of a row */
+	for (policy = SHCTX_POLICY_LRU; policy <= SHCTX_POLICY_TINYLFU; policy++) {
+		if (shctx_init(&shctx, 16, 64, 0, 0, "unittest") != 16 ||
+		    !shctx_set_policy(shctx, policy))
+			return 1;
+
+		/* 12 frequent rows, leaving 4 free blocks */
+		for (i = 0; i < 12; i++) {
+			first = shctx_unittest_store(shctx, 10 + i, 3, 1);
+			if (!first)
+				return 1;
+			if (!i)
+				old = first;
+		}
+
+		/* a rare row may use the free blocks */
+		first = shctx_row_reserve_key(shctx, 50, 64);
+		if (!first || shctx_row_data_append(shctx, first, data, 64) != 0 ||
+		    !shctx_row_reserve_hot(shctx, first, 3 * 64)) {
+			printf("policy %d: a row was rejected while free blocks remain\n", policy);
+			return 1;
+		}
+
+		/* but not evict a frequent one when growing */
+		for (i = 0; i < 3; i++)
+			BUG_ON(shctx_row_data_append(shctx, first, data, 64) != 0);
+
+		/* on failure, the reservation returns the row and the append fails */
+		shctx_row_reserve_hot(shctx, first, 64);
+		if (policy == SHCTX_POLICY_TINYLFU &&
+		    (shctx_row_data_append(shctx, first, data, 64) >= 0 ||
+		     old->key != 10 || old->len != 64 || shctx->rejected != 1 || shctx->evicted)) {
+			printf("policy %d: a growing row evicted a more frequent one\n", policy);
+			return 1;
+		}
+
+		if (policy == SHCTX_POLICY_LRU &&
+		    (shctx_row_data_append(shctx, first, data, 64) != 0 || shctx->evicted != 1)) {
+			printf("policy %d: a growing row could not evict the oldest one\n", policy);
+			return 1;
+		}
+
+		/* neither when it is reserved */
+		if (policy == SHCTX_POLICY_TINYLFU && shctx_unittest_store(shctx, 51, 0, 1)) {
+			printf("policy %d: a new row evicted a more frequent one\n", policy);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+REGISTER_UNITTEST("shctx_policy", shctx_policy_unittest);
@@ -28,6 +28,25 @@
 #include <import/slz.h>
 #include <import/slz-tables.h>
 
+/* HAProxy-specific: the accelerated CRC32 implementations below and their
+ * runtime selection are not part of upstream libslz. They are kept local to
+ * this file so that include/import/slz.h stays identical to upstream, and must
+ * be preserved when updating libslz. They are enabled depending on the CPU:
+ *  - x86-64: carry-less multiplications (PCLMULQDQ) folding 64 bytes at once
+ *  - aarch64: the optional ARMv8.0 CRC32 instructions, when not already
+ *    enabled at build time.
+ */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SLZ_HAVE_CRC32_CLMUL
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__linux__) && defined(__GNUC__) && !defined(__ARM_FEATURE_CRC32)
+#define SLZ_HAVE_CRC32_ARMV8
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
 /* First, RFC1951-specific declarations and extracts from the RFC.
  *
  * RFC1951 - deflate stream format
@@ -1049,11 +1068,154 @@ uint32_t slz_crc32_by4(uint32_t crc, const unsigned char *buf, int len)
 	return crc;
 }
 
+#if defined(SLZ_HAVE_CRC32_CLMUL)
+/* Computes the crc32 of <buf> over <len> bytes using carry-less multiplications
+ * to fold four 128-bit lanes in parallel, then reduces the result using the
+ * Barrett method, as described in Intel's paper "Fast CRC Computation for
+ * Generic Polynomials Using PCLMULQDQ Instruction". The constants are those of
+ * the bit-reflected CRC32 polynomial. <len> must be at least 64 and a multiple
+ * of 16. As everywhere else, <crc> is not inverted.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_clmul_fold(uint32_t crc, const unsigned char *buf, long len)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596ULL, 0x0154442bd4ULL);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eULL, 0x01751997d0ULL);
+	const __m128i k5k0 = _mm_set_epi64x(0x0000000000ULL, 0x0163cd6124ULL);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641ULL, 0x01db710641ULL);
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(~crc));
+	buf += 64;
+	len -= 64;
+
+	/* fold 64 bytes at once */
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(buf + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(buf + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(buf + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(buf + 0x30)));
+		buf += 64;
+		len -= 64;
+	}
+
+	/* fold the 4 lanes into a single one */
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), x2);
+
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), x3);
+
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), x4);
+
+	/* fold the remaining 16-byte blocks */
+	while (len >= 16) {
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)buf));
+		buf += 16;
+		len -= 16;
+	}
+
+	/* fold 128 to 64 bits, then 64 to 32 bits */
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction */
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return ~(uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+/* This version computes the crc32 of <buf> over <len> bytes, folding the
+ * largest multiple of 16 bytes with carry-less multiplications when there are
+ * at least 64 bytes. The CPU must support PCLMULQDQ and SSE4.1.
+ */
+static uint32_t slz_crc32_clmul(uint32_t crc, const unsigned char *buf, int len)
+{
+	long blk = len & -16L;
+
+	if (len >= 64) {
+		crc = crc32_clmul_fold(crc, buf, blk);
+		buf += blk;
+		len -= blk;
+	}
+	return slz_crc32_by4(crc, buf, len);
+}
+#endif /* SLZ_HAVE_CRC32_CLMUL */
+
+#if defined(SLZ_HAVE_CRC32_ARMV8)
+/* This version computes the crc32 of <buf> over <len> bytes using the ARMv8
+ * CRC32 instructions 8 bytes at a time. They are optional before ARMv8.1, so
+ * the assembler is told to accept them here and the CPU must support them.
+ */
+static uint32_t slz_crc32_armv8(uint32_t crc, const unsigned char *buf, int len)
+{
+	const unsigned char *end = buf + len;
+
+	crc = ~crc;
+	while (buf <= end - 8) {
+		__asm__ (".arch_extension crc\n\tcrc32x %w0,%w0,%x1" : "+r"(crc) : "r"(*(uint64_t *)buf));
+		buf += 8;
+	}
+	while (buf < end) {
+		__asm__ (".arch_extension crc\n\tcrc32b %w0,%w0,%w1" : "+r"(crc) : "r"((uint32_t)*buf));
+		buf++;
+	}
+	return ~crc;
+}
+#endif /* SLZ_HAVE_CRC32_ARMV8 */
+
+/* the most suitable crc32 function for this CPU, set by __slz_initialize() */
+static uint32_t (*slz_crc32_fct)(uint32_t crc, const unsigned char *buf, int len) = slz_crc32_by4;
+
 /* uses the most suitable crc32 function to update crc on <buf, len> */
 static inline uint32_t update_crc(uint32_t crc, const void *buf, int len)
 {
-	return slz_crc32_by4(crc, buf, len);
+	return slz_crc32_fct(crc, buf, len);
+}
+
+/* selects the fastest crc32 function supported by the CPU */
+static void __slz_select_crc32(void)
+{
+#if defined(SLZ_HAVE_CRC32_CLMUL)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"))
+		slz_crc32_fct = slz_crc32_clmul;
+#elif defined(SLZ_HAVE_CRC32_ARMV8)
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+		slz_crc32_fct = slz_crc32_armv8;
+#endif
 }
+/* end of HAProxy-specific CRC32 code */
 
 /* Sends the gzip header for stream <strm> into buffer <buf>. When it's done,
  * the stream state is updated to SLZ_ST_EOB. It returns the number of bytes
@@ -1429,4 +1591,5 @@ static void __slz_initialize(void)
 	__slz_make_crc_table();
 #endif
 	__slz_prepare_dist_table();
+	__slz_select_crc32(); /* HAProxy-specific */
 }
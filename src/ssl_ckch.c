@@ -1171,7 +1171,8 @@ struct ckch_store *ckch_store_new_load_files_path(char *path, char **err)
 
 /*
  * This function allocate a ckch_store and populate it with certificates using
- * the ckch_conf structure.
+ * the ckch_conf structure. The store is not inserted in the ckchs tree, this
+ * is left to the caller.
  */
 struct ckch_store *ckch_store_new_load_files_conf(char *name, struct ckch_conf *conf, const char *file, int linenum, char **err)
 {
@@ -1204,9 +1205,6 @@ struct ckch_store *ckch_store_new_load_files_conf(char *name, struct ckch_conf *
 
 	conf->crt = tmpcrt;
 
-	/* insert into the ckchs tree */
-	memcpy(ckchs->path, name, strlen(name) + 1);
-	ebst_insert(&ckchs_tree, &ckchs->node);
 	return ckchs;
 
 end:
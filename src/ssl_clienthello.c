@@ -20,6 +20,7 @@
 #include <haproxy/quic_tp.h>
 #include <haproxy/ssl_ckch.h>
 #include <haproxy/ssl_gencert.h>
+#include <haproxy/ssl_lazy.h>
 #include <haproxy/ssl_sock.h>
 #include <haproxy/trace.h>
 #include <haproxy/ssl_trace.h>
@@ -466,6 +467,40 @@ int ssl_sock_switchctx_cbk(SSL *ssl, int *al, void *arg)
 	}
 
 	HA_RWLOCK_RDUNLOCK(SNI_LOCK, &s->sni_lock);
+
+	if (s->lazy_crt && !default_lookup) {
+		/* this may load the certificate, and pause the async job */
+		struct ssl_sock_ctx *sctx = conn ? conn_get_ssl_sock_ctx(conn) : NULL;
+		struct ssl_bind_conf *conf;
+		SSL_CTX *ctx;
+		int retry;
+
+		if (sctx)
+			ssl_lazy_unsubscribe(sctx);
+		ctx = ssl_lazy_get_ctx(s, trash.area, &conf, sctx, &retry);
+		if (retry) {
+			TRACE_STATE("Lazy certificate not available yet, retrying later", SSL_EV_CONN_SWITCHCTX_CB, conn, ssl, trash.area);
+#if defined(OPENSSL_IS_BORINGSSL) || defined(OPENSSL_IS_AWSLC)
+			return ssl_select_cert_retry;
+#else
+			return SSL_CLIENT_HELLO_RETRY;
+#endif
+		}
+
+		if (ctx) {
+			ssl_sock_switchctx_set(ssl, ctx);
+			SSL_CTX_free(ctx);
+			if (conf) {
+				methodVersions[conf->ssl_methods.min].ssl_set_version(ssl, SET_MIN);
+				methodVersions[conf->ssl_methods.max].ssl_set_version(ssl, SET_MAX);
+				if (conf->early_data)
+					allow_early = 1;
+			}
+			TRACE_STATE("Lazy certificate found", SSL_EV_CONN_SWITCHCTX_CB, conn, ssl, trash.area);
+			goto allow_early;
+		}
+	}
+
 #if (!defined SSL_NO_GENERATE_CERTIFICATES)
 	if (s->options & BC_O_GENERATE_CERTS && ssl_sock_generate_certificate(trash.area, s, ssl)) {
 		/* switch ctx done in ssl_sock_generate_certificate */
@@ -543,6 +543,9 @@ int crtlist_load_crt(char *crt_path, struct ckch_conf *cc, struct crtlist *newli
 				goto error;
 			}
 
+			/* insert into the ckchs tree */
+			ebst_insert(&ckchs_tree, &ckchs->node);
+
 			ckchs->conf = *cc;
 
 			entry->node.key = ckchs;
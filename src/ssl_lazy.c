@@ -0,0 +1,787 @@
+/*
+ * On-demand loading of the certificates of lazy crt-lists.
+ *
+ * The "crt-list-lazy" bind keyword parses a crt-list but only indexes the SNI
+ * filters of its lines at startup, without reading any certificate. The first
+ * ClientHello for one of these names which does not match a regular
+ * certificate loads the certificate, key and SSL_CTX of its line, and keeps
+ * the result in an LRU cache shared by all the bind lines, whose size is set
+ * by "tune.ssl.lazy-ctx-cache-size". The least recently used contexts are
+ * released when the cache is full, and loaded again on their next use.
+ *
+ * With "tune.ssl.cert-loader-threads", the handshakes run in async mode and
+ * the files of the certificate are first read by a loader thread while the
+ * async job of the handshake is paused, so that the thread processing the
+ * traffic never waits for the disk. The files are then parsed from the page
+ * cache by the handshake's thread, since the loading functions rely on the
+ * thread-local storage and pools of the haproxy threads.
+ *
+ * A certificate is loaded by a single handshake at a time. The other ones
+ * needing it meanwhile, as well as those needing the CA or CRL files while a
+ * CLI transaction holds them, return a retry from the ClientHello callback and
+ * are woken up once they may try again, instead of using the default
+ * certificate.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+
+#include <import/ebsttree.h>
+#include <import/lru.h>
+
+#include <haproxy/api.h>
+#include <haproxy/applet.h>
+#include <haproxy/cli.h>
+#include <haproxy/errors.h>
+#include <haproxy/global.h>
+#include <haproxy/listener.h>
+#include <haproxy/log.h>
+#include <haproxy/openssl-compat.h>
+#include <haproxy/ssl_ckch.h>
+#include <haproxy/ssl_crtlist.h>
+#include <haproxy/ssl_lazy.h>
+#include <haproxy/ssl_offload.h>
+#include <haproxy/ssl_sock.h>
+#include <haproxy/task.h>
+#include <haproxy/ticks.h>
+#include <haproxy/tools.h>
+#include <haproxy/workq.h>
+
+/* a lazy crt-list file, kept for the error reports */
+struct ssl_lazy_file {
+	struct list list;              /* element of the index' list of files */
+	char path[VAR_ARRAY];          /* path of the crt-list */
+};
+
+/* a line of a lazy crt-list */
+struct ssl_lazy_crt {
+	struct list list;              /* element of the index' list of certificates */
+	struct crtlist_entry *entry;   /* SSL options and SNI filters of the line */
+	struct ckch_conf conf;         /* crt-store options of the line */
+	const struct ssl_lazy_file *file; /* crt-list the line comes from */
+	unsigned long long id;         /* key of the SSL_CTX in the LRU cache */
+	unsigned int loading;          /* a handshake is loading it, under the ssl_lazy_lock */
+	char path[VAR_ARRAY];          /* path of the certificate */
+};
+
+/* a server name of a lazy crt-list */
+struct ssl_lazy_name {
+	struct ssl_lazy_crt *crt;      /* certificate to load for this name */
+	struct ebmb_node node;         /* key is the lowercase name */
+};
+
+/* the lazy certificates of a bind_conf */
+struct ssl_lazy_index {
+	struct eb_root names;          /* full names, the first line wins */
+	struct eb_root wild;           /* wildcards, without their leading '*' */
+	struct list crts;              /* all the certificates */
+	struct list files;             /* all the crt-lists */
+};
+
+/* a prefetch job submitted to the loader threads. It is allocated on the
+ * stack of the paused async job, which is not resumed before the eventfd is
+ * signaled.
+ */
+struct ssl_lazy_job {
+	struct workq_job job;
+	const struct ssl_lazy_crt *crt; /* certificate whose files must be read */
+	int efd;                        /* eventfd to signal once done */
+};
+
+/* lazy certificates activity, reported by "show ssl lazy-certs" */
+static struct {
+	unsigned int crts;              /* indexed certificates */
+	unsigned int names;             /* indexed names */
+	unsigned long long hits;        /* contexts found in the cache */
+	unsigned long long loads;       /* contexts loaded */
+	unsigned long long prefetches;  /* files read by the loader threads */
+	unsigned long long evictions;   /* contexts released from the cache */
+	unsigned long long failures;    /* failed loads */
+	unsigned long long retries;     /* handshakes told to retry later */
+} ssl_lazy_stats;
+
+/* delay before retrying the handshakes waiting for the end of a CLI transaction */
+#define SSL_LAZY_RETRY_DELAY 10
+
+static struct lru64_head *ssl_lazy_lru;
+static struct workq *ssl_lazy_wq;
+static struct list ssl_lazy_waiters = LIST_HEAD_INIT(ssl_lazy_waiters); /* ssl_sock_ctx waiting for a certificate */
+static struct task *ssl_lazy_retry_task;
+__decl_thread(static HA_RWLOCK_T ssl_lazy_lock);
+
+/* Reads the file <path> entirely to bring it into the page cache */
+static void ssl_lazy_read_file(const char *path)
+{
+	char buf[16384];
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+	close(fd);
+}
+
+/* Work queue callback, called from a loader thread. It reads the files which
+ * will be needed to load the certificate. The job may vanish as soon as the
+ * eventfd is signaled.
+ */
+static void ssl_lazy_process(struct workq_job *wjob)
+{
+	struct ssl_lazy_job *job = container_of(wjob, struct ssl_lazy_job, job);
+	const struct ssl_lazy_crt *crt = job->crt;
+	static const struct { int flag; const char *ext; } extra[] = {
+		{ SSL_GF_KEY,         "key"    },
+		{ SSL_GF_OCSP,        "ocsp"   },
+		{ SSL_GF_OCSP_ISSUER, "issuer" },
+		{ SSL_GF_SCTL,        "sctl"   },
+	};
+	char path[MAXPATHLEN + 1];
+	int efd = job->efd;
+	int i;
+
+	ssl_lazy_read_file(crt->path);
+	if (crt->conf.key)
+		ssl_lazy_read_file(crt->conf.key);
+	if (crt->conf.ocsp)
+		ssl_lazy_read_file(crt->conf.ocsp);
+	if (crt->conf.issuer)
+		ssl_lazy_read_file(crt->conf.issuer);
+	if (crt->conf.sctl)
+		ssl_lazy_read_file(crt->conf.sctl);
+
+	for (i = 0; i < sizeof(extra) / sizeof(*extra); i++) {
+		if (!(global_ssl.extra_files & extra[i].flag))
+			continue;
+		if (snprintf(path, sizeof(path), "%s.%s", crt->path, extra[i].ext) >= sizeof(path))
+			continue;
+		ssl_lazy_read_file(path);
+	}
+
+	eventfd_write(efd, 1);
+}
+
+/* Has the files of <crt> read by a loader thread when called from an async
+ * job, and pauses the latter until it is done. Does nothing otherwise.
+ */
+static void ssl_lazy_prefetch(const struct ssl_lazy_crt *crt)
+{
+	struct ssl_lazy_job job;
+
+	if (!ssl_lazy_wq || (job.efd = ssl_offload_async_fd()) < 0)
+		return;
+
+	job.crt = crt;
+	workq_job_init(&job.job, ssl_lazy_process, NULL);
+	workq_submit(ssl_lazy_wq, &job.job);
+	ssl_offload_async_wait(job.efd);
+	_HA_ATOMIC_INC(&ssl_lazy_stats.prefetches);
+}
+
+/* Returns the SSL_CTX of a store loaded by ssl_lazy_load() */
+static inline SSL_CTX *ssl_lazy_store_ctx(struct ckch_store *store)
+{
+	return LIST_NEXT(&store->ckch_inst, struct ckch_inst *, by_ckchs)->ctx;
+}
+
+/* Releases a store evicted from the LRU cache. The SSL sessions still using
+ * its SSL_CTX hold their own reference on it.
+ */
+static void ssl_lazy_free_store(void *data)
+{
+	ckch_store_free(data);
+	_HA_ATOMIC_INC(&ssl_lazy_stats.evictions);
+}
+
+/* Wakes up all the handshakes waiting for a lazy certificate. They stay in the
+ * list until their thread removes them. Must be called under the ssl_lazy_lock.
+ */
+static void ssl_lazy_wake_waiters(void)
+{
+	struct ssl_sock_ctx *ctx;
+
+	list_for_each_entry(ctx, &ssl_lazy_waiters, lazy_wait)
+		tasklet_wakeup(ctx->wait_event.tasklet);
+}
+
+/* Appends <ctx> to the handshakes waiting for a lazy certificate. Must be
+ * called under the ssl_lazy_lock by the thread owning <ctx>.
+ */
+static void ssl_lazy_subscribe(struct ssl_sock_ctx *ctx)
+{
+	LIST_APPEND(&ssl_lazy_waiters, &ctx->lazy_wait);
+	_HA_ATOMIC_INC(&ssl_lazy_stats.retries);
+}
+
+/* Removes <ctx> from the handshakes waiting for a lazy certificate. Use
+ * ssl_lazy_unsubscribe() instead, which first checks it is there.
+ */
+void __ssl_lazy_unsubscribe(struct ssl_sock_ctx *ctx)
+{
+	HA_RWLOCK_WRLOCK(SSL_LAZY_LOCK, &ssl_lazy_lock);
+	LIST_DEL_INIT(&ctx->lazy_wait);
+	HA_RWLOCK_WRUNLOCK(SSL_LAZY_LOCK, &ssl_lazy_lock);
+}
+
+/* Periodically wakes up the handshakes waiting for a lazy certificate while
+ * a CLI transaction prevents it from being loaded. They subscribe again and
+ * re-arm the task if it is still in progress.
+ */
+static struct task *ssl_lazy_retry(struct task *t, void *context, unsigned int state)
+{
+	HA_RWLOCK_RDLOCK(SSL_LAZY_LOCK, &ssl_lazy_lock);
+	ssl_lazy_wake_waiters();
+	HA_RWLOCK_RDUNLOCK(SSL_LAZY_LOCK, &ssl_lazy_lock);
+	t->expire = TICK_ETERNITY;
+	return t;
+}
+
+/* Returns non-zero if the SSL_CTX of <crt> uses CA or CRL files, which are
+ * shared with the CLI and may only be looked up under the ckch_lock.
+ */
+static int ssl_lazy_needs_ckch_lock(const struct bind_conf *bind_conf, const struct ssl_lazy_crt *crt)
+{
+	const struct ssl_bind_conf *conf = crt->entry->ssl_conf;
+
+	if (conf && (conf->ca_file || conf->ca_verify_file || conf->crl_file))
+		return 1;
+	return bind_conf->ssl_conf.ca_file || bind_conf->ssl_conf.ca_verify_file || bind_conf->ssl_conf.crl_file;
+}
+
+/* Loads the certificate of <crt> into a new ckch_store holding a single
+ * instance for <bind_conf>, with a prepared SSL_CTX. The store is neither
+ * referenced by the ckchs tree nor its instance by the SNI trees, so that they
+ * are invisible to the CLI and only reachable from the LRU cache. The caller
+ * must hold the ckch_lock if ssl_lazy_needs_ckch_lock() says so. Returns the
+ * store, or NULL on error with a message in <err>.
+ */
+static struct ckch_store *ssl_lazy_load(struct bind_conf *bind_conf, struct ssl_lazy_crt *crt, char **err)
+{
+	struct ckch_store *store;
+	struct ckch_inst *inst = NULL;
+	int errcode;
+
+	store = ckch_store_new_load_files_conf(crt->path, &crt->conf, crt->file->path, crt->entry->linenum, err);
+	if (!store)
+		return NULL;
+
+	store->conf.ocsp_update_mode = crt->conf.ocsp_update_mode;
+
+	errcode = ckch_inst_new_load_store(store->path, store, bind_conf, crt->entry->ssl_conf,
+	                                   crt->entry->filters, crt->entry->fcount, 0, &inst, err);
+	if (errcode & ERR_CODE)
+		goto error;
+	LIST_APPEND(&store->ckch_inst, &inst->by_ckchs);
+
+	/* the CA files are not linked to the instance, so that a CA file
+	 * update doesn't try to rebuild it.
+	 */
+	errcode = ssl_sock_prep_ctx_and_inst(bind_conf, crt->entry->ssl_conf, inst->ctx, NULL, err);
+	if (errcode & ERR_CODE)
+		goto error;
+
+	return store;
+
+error:
+	ckch_store_free(store);
+	return NULL;
+}
+
+/* Looks up the SSL_CTX of <crt> in the LRU cache, and returns it with a new
+ * reference if it is resident. Otherwise, if another handshake is loading it,
+ * <waiter> is subscribed to be woken up once it is done and <retry> is set. If
+ * not, and <load> is not NULL, the loading is claimed by the caller, which must
+ * release it without pausing, and <load> is set. Returns NULL if the SSL_CTX is
+ * not resident.
+ */
+static SSL_CTX *ssl_lazy_lookup(struct ssl_lazy_crt *crt, struct ssl_sock_ctx *waiter, int *retry, int *load)
+{
+	struct lru64 *lru;
+	SSL_CTX *ctx = NULL;
+
+	HA_RWLOCK_WRLOCK(SSL_LAZY_LOCK, &ssl_lazy_lock);
+	lru = lru64_lookup(crt->id, ssl_lazy_lru, crt, 0);
+	if (lru) {
+		ctx = ssl_lazy_store_ctx(lru->data);
+		SSL_CTX_up_ref(ctx);
+	}
+	else if (crt->loading) {
+		if (waiter) {
+			ssl_lazy_subscribe(waiter);
+			*retry = 1;
+		}
+	}
+	else if (load)
+		crt->loading = *load = 1;
+	HA_RWLOCK_WRUNLOCK(SSL_LAZY_LOCK, &ssl_lazy_lock);
+
+	if (ctx)
+		_HA_ATOMIC_INC(&ssl_lazy_stats.hits);
+	return ctx;
+}
+
+/* Looks up <servername> (lowercase) in the lazy certificates of <bind_conf>,
+ * and loads the matching one if it is not resident yet. The trash may be used
+ * by the loading, but <servername> is preserved even if it points to it. On
+ * success, returns an SSL_CTX the caller must release once it has switched to
+ * it, and sets <conf> to the SSL options of the crt-list line. Returns NULL if
+ * no lazy certificate matches or if it could not be loaded. When it can't be
+ * loaded right now, because another handshake is loading it or because a CLI
+ * transaction holds the ckch_lock, <waiter> is subscribed to be woken up once
+ * it may retry, <retry> is set, and NULL is returned.
+ */
+SSL_CTX *ssl_lazy_get_ctx(struct bind_conf *bind_conf, char *servername, struct ssl_bind_conf **conf,
+                          struct ssl_sock_ctx *waiter, int *retry)
+{
+	struct ssl_lazy_index *idx = bind_conf->lazy_crt;
+	struct ckch_store *store = NULL;
+	struct ssl_lazy_crt *crt;
+	struct ebmb_node *node;
+	struct lru64 *lru;
+	char name[TLSEXT_MAXLEN_host_name + 1];
+	const char *wildp;
+	char *err = NULL;
+	SSL_CTX *ctx = NULL;
+	int ckch_locked = 0;
+	int load = 0;
+	size_t len;
+
+	*retry = 0;
+	if (!idx || !*servername)
+		return NULL;
+
+	node = ebst_lookup(&idx->names, servername);
+	if (!node && (wildp = strchr(servername, '.')) != NULL)
+		node = ebst_lookup(&idx->wild, wildp);
+	if (!node)
+		return NULL;
+
+	crt = ebmb_entry(node, struct ssl_lazy_name, node)->crt;
+	*conf = crt->entry->ssl_conf;
+
+	len = strlen(servername);
+	if (len >= sizeof(name))
+		return NULL;
+
+	ctx = ssl_lazy_lookup(crt, waiter, retry, NULL);
+	if (ctx || *retry)
+		return ctx;
+
+	memcpy(name, servername, len + 1);
+
+	/* the files are read before claiming the loading, since the async job
+	 * is paused there and never resumed if the connection is closed in the
+	 * mean time.
+	 */
+	ssl_lazy_prefetch(crt);
+	ctx = ssl_lazy_lookup(crt, waiter, retry, &load);
+	if (!load)
+		goto out;
+
+	/* the CLI keeps this lock across yields during its transactions, so
+	 * it must never be waited for here.
+	 */
+	if (ssl_lazy_needs_ckch_lock(bind_conf, crt)) {
+		if (HA_SPIN_TRYLOCK(CKCH_LOCK, &ckch_lock)) {
+			HA_RWLOCK_WRLOCK(SSL_LAZY_LOCK, &ssl_lazy_lock);
+			crt->loading = 0;
+			/* the other waiters will retry with the timer as well */
+			if (waiter) {
+				ssl_lazy_subscribe(waiter);
+				*retry = 1;
+			}
+			task_schedule(ssl_lazy_retry_task, tick_add(now_ms, MS_TO_TICKS(SSL_LAZY_RETRY_DELAY)));
+			HA_RWLOCK_WRUNLOCK(SSL_LAZY_LOCK, &ssl_lazy_lock);
+			goto out;
+		}
+		ckch_locked = 1;
+	}
+	store = ssl_lazy_load(bind_conf, crt, &err);
+	if (ckch_locked)
+		HA_SPIN_UNLOCK(CKCH_LOCK, &ckch_lock);
+
+	if (!store) {
+		char *p;
+
+		/* the error may span several lines */
+		for (p = err; p && *p; p++) {
+			if (*p == '\n')
+				*p = ' ';
+		}
+		_HA_ATOMIC_INC(&ssl_lazy_stats.failures);
+		send_log(bind_conf->frontend, LOG_ERR, "Failed to load certificate '%s' from crt-list '%s' line %d: %s",
+		         crt->path, crt->file->path, crt->entry->linenum, err ? err : "unknown error");
+	}
+	else {
+		_HA_ATOMIC_INC(&ssl_lazy_stats.loads);
+		ctx = ssl_lazy_store_ctx(store);
+		SSL_CTX_up_ref(ctx);
+	}
+
+	HA_RWLOCK_WRLOCK(SSL_LAZY_LOCK, &ssl_lazy_lock);
+	if (store) {
+		lru = lru64_get(crt->id, ssl_lazy_lru, crt, 0);
+		if (lru) {
+			lru64_commit(lru, store, crt, 0, ssl_lazy_free_store);
+			store = NULL;
+		}
+	}
+	crt->loading = 0;
+	ssl_lazy_wake_waiters();
+	HA_RWLOCK_WRUNLOCK(SSL_LAZY_LOCK, &ssl_lazy_lock);
+
+ out:
+	/* not cached, the caller's reference keeps the SSL_CTX alive */
+	ckch_store_free(store);
+	ha_free(&err);
+	memcpy(servername, name, len + 1);
+	return ctx;
+}
+
+/* Indexes the lowercase server name <name> of <crt> into <idx>. A leading '*'
+ * makes it a wildcard. Returns 0 on success, -1 on memory error.
+ */
+static int ssl_lazy_index_name(struct ssl_lazy_index *idx, struct ssl_lazy_crt *crt, const char *name)
+{
+	struct ssl_lazy_name *ln;
+	struct eb_root *root = &idx->names;
+	size_t len;
+	int i;
+
+	if (*name == '*') {
+		root = &idx->wild;
+		name++;
+	}
+
+	len = strlen(name);
+	ln = malloc(sizeof(*ln) + len + 1);
+	if (!ln)
+		return -1;
+
+	for (i = 0; i < len; i++)
+		ln->node.key[i] = tolower((unsigned char)name[i]);
+	ln->node.key[len] = 0;
+	ln->crt = crt;
+
+	/* the first line declaring a name wins */
+	if (ebst_insert(root, &ln->node) != &ln->node)
+		free(ln);
+	else
+		ssl_lazy_stats.names++;
+	return 0;
+}
+
+/* Returns the lazy index of <bind_conf>, allocating it if needed, or NULL on
+ * memory error.
+ */
+static struct ssl_lazy_index *ssl_lazy_get_index(struct bind_conf *bind_conf)
+{
+	struct ssl_lazy_index *idx = bind_conf->lazy_crt;
+
+	if (idx)
+		return idx;
+
+	idx = calloc(1, sizeof(*idx));
+	if (!idx)
+		return NULL;
+
+	idx->names = EB_ROOT_UNIQUE;
+	idx->wild = EB_ROOT_UNIQUE;
+	LIST_INIT(&idx->crts);
+	LIST_INIT(&idx->files);
+	bind_conf->lazy_crt = idx;
+	return idx;
+}
+
+/* Parses the lazy crt-list <file> and indexes the SNI filters of its lines in
+ * <bind_conf>, without loading any certificate. The lines use the crt-list
+ * syntax but must declare at least one SNI filter, none of them being negative
+ * nor the default "*" one, and must point to certificate files rather than to
+ * crt-store entries.
+ *
+ * Returns a set of ERR_* flags possibly with an error in <err>.
+ */
+int ssl_lazy_load_crt_list(char *file, struct bind_conf *bind_conf, char **err)
+{
+	struct ssl_lazy_index *idx;
+	struct ssl_lazy_file *lf;
+	struct crtlist_entry *entry = NULL;
+	struct ssl_lazy_crt *crt;
+	char *thisline = NULL;
+	FILE *f = NULL;
+	int linenum = 0;
+	int cfgerr = 0;
+	int i;
+
+#ifndef HAVE_SSL_CLIENT_HELLO_CB
+	memprintf(err, "the SSL library does not support the ClientHello callback");
+	return ERR_ALERT | ERR_FATAL;
+#endif
+
+	idx = ssl_lazy_get_index(bind_conf);
+	thisline = malloc(CRT_LINESIZE);
+	lf = idx ? calloc(1, sizeof(*lf) + strlen(file) + 1) : NULL;
+	if (!thisline || !lf) {
+		free(lf);
+		memprintf(err, "Not enough memory!");
+		cfgerr |= ERR_ALERT | ERR_FATAL;
+		goto end;
+	}
+	strcpy(lf->path, file);
+	LIST_APPEND(&idx->files, &lf->list);
+
+	if ((f = fopen(file, "r")) == NULL) {
+		memprintf(err, "cannot open file '%s' : %s", file, strerror(errno));
+		cfgerr |= ERR_ALERT | ERR_FATAL;
+		goto end;
+	}
+
+	while (fgets(thisline, CRT_LINESIZE, f) != NULL) {
+		char *end;
+		char *crt_path;
+		char path[MAXPATHLEN+1];
+		struct ckch_conf cc = {};
+
+		linenum++;
+		end = thisline + strlen(thisline);
+		if (end - thisline == CRT_LINESIZE - 1 && *(end - 1) != '\n') {
+			memprintf(err, "parsing [%s:%d]: line too long, limit is %d characters",
+			          file, linenum, CRT_LINESIZE - 1);
+			cfgerr |= ERR_ALERT | ERR_FATAL;
+			goto end;
+		}
+
+		if (*thisline == '#' || *thisline == '\n' || *thisline == '\r')
+			continue;
+
+		if (end > thisline && *(end - 1) == '\n')
+			*(end - 1) = 0;
+
+		entry = crtlist_entry_new();
+		if (entry == NULL) {
+			memprintf(err, "Not enough memory!");
+			cfgerr |= ERR_ALERT | ERR_FATAL;
+			goto end;
+		}
+
+		cfgerr |= crtlist_parse_line(thisline, &crt_path, entry, &cc, file, linenum, 0, err);
+		if (cfgerr & ERR_CODE) {
+			ckch_conf_clean(&cc);
+			goto end;
+		}
+
+		/* empty line */
+		if (!crt_path || !*crt_path) {
+			crtlist_entry_free(entry);
+			entry = NULL;
+			continue;
+		}
+
+		if (*crt_path == '@' || cc.acme.id || cc.gencrt.on || !entry->fcount) {
+			memprintf(err, "parsing [%s:%d]: '%s' : a lazy crt-list line requires a certificate file, "
+			          "at least one SNI filter, and neither 'acme' nor 'generate-dummy'",
+			          file, linenum, crt_path);
+			cfgerr |= ERR_ALERT | ERR_FATAL;
+			ckch_conf_clean(&cc);
+			goto end;
+		}
+
+		for (i = 0; i < entry->fcount; i++) {
+			if (*entry->filters[i] == '!' || strcmp(entry->filters[i], "*") == 0) {
+				memprintf(err, "parsing [%s:%d]: '%s' : negative and default SNI filters are not supported in lazy crt-lists",
+				          file, linenum, entry->filters[i]);
+				cfgerr |= ERR_ALERT | ERR_FATAL;
+				ckch_conf_clean(&cc);
+				goto end;
+			}
+		}
+
+		if (*crt_path != '/' && global_ssl.crt_base) {
+			if ((strlen(global_ssl.crt_base) + 1 + strlen(crt_path)) > sizeof(path) ||
+			    snprintf(path, sizeof(path), "%s/%s",  global_ssl.crt_base, crt_path) > sizeof(path)) {
+				memprintf(err, "parsing [%s:%d]: '%s' : path too long",
+					  file, linenum, crt_path);
+				cfgerr |= ERR_ALERT | ERR_FATAL;
+				ckch_conf_clean(&cc);
+				goto end;
+			}
+			crt_path = path;
+		}
+
+		crt = calloc(1, sizeof(*crt) + strlen(crt_path) + 1);
+		if (!crt) {
+			memprintf(err, "Not enough memory!");
+			cfgerr |= ERR_ALERT | ERR_FATAL;
+			ckch_conf_clean(&cc);
+			goto end;
+		}
+		strcpy(crt->path, crt_path);
+		crt->entry = entry;
+		crt->file = lf;
+		crt->conf = cc;
+		crt->id = ++ssl_lazy_stats.crts;
+		LIST_APPEND(&idx->crts, &crt->list);
+		entry = NULL;
+
+		free(crt->conf.crt);
+		crt->conf.crt = strdup(crt->path);
+		if (!crt->conf.crt) {
+			memprintf(err, "Not enough memory!");
+			cfgerr |= ERR_ALERT | ERR_FATAL;
+			goto end;
+		}
+
+		for (i = 0; i < crt->entry->fcount; i++) {
+			if (ssl_lazy_index_name(idx, crt, crt->entry->filters[i]) < 0) {
+				memprintf(err, "Not enough memory!");
+				cfgerr |= ERR_ALERT | ERR_FATAL;
+				goto end;
+			}
+		}
+	}
+
+ end:
+	/* the index is released with the bind_conf on error */
+	crtlist_entry_free(entry);
+	if (f)
+		fclose(f);
+	free(thisline);
+	return cfgerr;
+}
+
+/* Releases the lazy index of <bind_conf>. The resident contexts are released
+ * with the LRU cache.
+ */
+void ssl_lazy_free_index(struct bind_conf *bind_conf)
+{
+	struct ssl_lazy_index *idx = bind_conf->lazy_crt;
+	struct ssl_lazy_crt *crt, *crt_back;
+	struct ssl_lazy_file *lf, *lf_back;
+	struct eb_root *roots[2];
+	struct ebmb_node *node, *back;
+	int i;
+
+	if (!idx)
+		return;
+
+	roots[0] = &idx->names;
+	roots[1] = &idx->wild;
+	for (i = 0; i < 2; i++) {
+		node = ebmb_first(roots[i]);
+		while (node) {
+			back = ebmb_next(node);
+			ebmb_delete(node);
+			free(ebmb_entry(node, struct ssl_lazy_name, node));
+			node = back;
+		}
+	}
+
+	list_for_each_entry_safe(crt, crt_back, &idx->crts, list) {
+		LIST_DELETE(&crt->list);
+		crtlist_entry_free(crt->entry);
+		ckch_conf_clean(&crt->conf);
+		free(crt);
+	}
+
+	list_for_each_entry_safe(lf, lf_back, &idx->files, list) {
+		LIST_DELETE(&lf->list);
+		free(lf);
+	}
+
+	ha_free(&bind_conf->lazy_crt);
+}
+
+/* Creates the LRU cache and the loader threads once the configuration is
+ * known to use lazy crt-lists.
+ */
+static int ssl_lazy_init(void)
+{
+	char *err = NULL;
+
+	if (!ssl_lazy_stats.crts)
+		return ERR_NONE;
+
+	ssl_lazy_lru = lru64_new(global_ssl.lazy_ctx_cache);
+	if (!ssl_lazy_lru) {
+		ha_alert("Failed to allocate the cache of the lazy certificates.\n");
+		return ERR_ALERT | ERR_FATAL;
+	}
+	HA_RWLOCK_INIT(&ssl_lazy_lock);
+
+	ssl_lazy_retry_task = task_new_anywhere();
+	if (!ssl_lazy_retry_task) {
+		ha_alert("Failed to allocate the retry task of the lazy certificates.\n");
+		return ERR_ALERT | ERR_FATAL;
+	}
+	ssl_lazy_retry_task->process = ssl_lazy_retry;
+
+	if (!global_ssl.loader_threads)
+		return ERR_NONE;
+
+	ssl_lazy_wq = workq_new("cert-loader", global_ssl.loader_threads, &err);
+	if (!ssl_lazy_wq) {
+		ha_alert("%s.\n", err);
+		free(err);
+		return ERR_ALERT | ERR_FATAL;
+	}
+	return ERR_NONE;
+}
+
+static void ssl_lazy_deinit(void)
+{
+	task_destroy(ssl_lazy_retry_task);
+	ssl_lazy_retry_task = NULL;
+	lru64_destroy(ssl_lazy_lru);
+	ssl_lazy_lru = NULL;
+}
+
+REGISTER_POST_CHECK(ssl_lazy_init);
+REGISTER_POST_DEINIT(ssl_lazy_deinit);
+
+/* I/O handler of "show ssl lazy-certs" */
+static int cli_io_handler_show_lazy_certs(struct appctx *appctx)
+{
+	struct buffer *trash = get_trash_chunk();
+	unsigned int resident = 0;
+
+	if (ssl_lazy_lru) {
+		HA_RWLOCK_RDLOCK(SSL_LAZY_LOCK, &ssl_lazy_lock);
+		resident = ssl_lazy_lru->cache_usage;
+		HA_RWLOCK_RDUNLOCK(SSL_LAZY_LOCK, &ssl_lazy_lock);
+	}
+
+	chunk_appendf(trash, "Indexed certificates: %u\n", ssl_lazy_stats.crts);
+	chunk_appendf(trash, "Indexed names: %u\n", ssl_lazy_stats.names);
+	chunk_appendf(trash, "Resident contexts: %u (max %d)\n", resident, global_ssl.lazy_ctx_cache);
+	chunk_appendf(trash, "Loader threads: %d\n", global_ssl.loader_threads);
+	chunk_appendf(trash, "Hits: %llu\n", HA_ATOMIC_LOAD(&ssl_lazy_stats.hits));
+	chunk_appendf(trash, "Loads: %llu\n", HA_ATOMIC_LOAD(&ssl_lazy_stats.loads));
+	chunk_appendf(trash, "Prefetches: %llu\n", HA_ATOMIC_LOAD(&ssl_lazy_stats.prefetches));
+	chunk_appendf(trash, "Evictions: %llu\n", HA_ATOMIC_LOAD(&ssl_lazy_stats.evictions));
+	chunk_appendf(trash, "Failures: %llu\n", HA_ATOMIC_LOAD(&ssl_lazy_stats.failures));
+	chunk_appendf(trash, "Retries: %llu\n", HA_ATOMIC_LOAD(&ssl_lazy_stats.retries));
+
+	if (applet_putchk(appctx, trash) == -1)
+		return 0;
+	return 1;
+}
+
+static struct cli_kw_list cli_kws = {{ },{
+	{ { "show", "ssl", "lazy-certs", NULL }, "show ssl lazy-certs                     : show the activity of the lazy crt-lists", NULL, cli_io_handler_show_lazy_certs },
+	{ { NULL }, NULL, NULL, NULL }
+}};
+
+INITCALL1(STG_REGISTER, cli_register_kw, &cli_kws);
@@ -0,0 +1,470 @@
+/*
+ * Offload of the TLS private key operations to crypto threads.
+ *
+ * With "tune.ssl.crypto-threads", the private keys loaded into the frontend
+ * SSL contexts are replaced by copies using an RSA or EC_KEY method which
+ * submits the signature and decryption operations to a work queue. The
+ * handshakes run in SSL_MODE_ASYNC, so that the calling async job is paused
+ * until the crypto thread signals the completion on an eventfd registered in
+ * the job's wait context. This eventfd is polled by the regular async engine
+ * code in ssl_sock.c, which resumes the handshake once it is readable. This
+ * way the threads processing the traffic never compute private key
+ * operations during handshake bursts.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+/* RSA_METHOD and EC_KEY_METHOD are deprecated since OpenSSL 3.0 but remain
+ * the only way to intercept the private key operations of the default
+ * implementation.
+ */
+#define OPENSSL_SUPPRESS_DEPRECATED
+
+#include <unistd.h>
+
+#include <haproxy/activity.h>
+#include <haproxy/api.h>
+#include <haproxy/applet.h>
+#include <haproxy/cli.h>
+#include <haproxy/clock.h>
+#include <haproxy/errors.h>
+#include <haproxy/freq_ctr.h>
+#include <haproxy/global.h>
+#include <haproxy/openssl-compat.h>
+#include <haproxy/ssl_offload.h>
+#include <haproxy/ssl_sock.h>
+#include <haproxy/tools.h>
+#include <haproxy/workq.h>
+
+#if defined(SSL_MODE_ASYNC) && defined(HAVE_VANILLA_OPENSSL)
+
+#include <sys/eventfd.h>
+
+/* the private key operations which may be offloaded */
+enum ssl_offload_op {
+	SSL_OFFLOAD_RSA_PRIV_ENC = 0,
+	SSL_OFFLOAD_RSA_PRIV_DEC,
+	SSL_OFFLOAD_ECDSA_SIGN,
+};
+
+/* A private key operation submitted to the crypto threads. It is allocated on
+ * the stack of the paused async job, which is not resumed before the eventfd
+ * is signaled, so that nothing may touch it once the operation is performed.
+ */
+struct ssl_offload_job {
+	struct workq_job job;
+	enum ssl_offload_op op;
+	union {
+		struct {
+			int flen;
+			const unsigned char *from;
+			unsigned char *to;
+			RSA *rsa;
+			int padding;
+		} rsa;
+		struct {
+			int type;
+			const unsigned char *dgst;
+			int dlen;
+			unsigned char *sig;
+			unsigned int *siglen;
+			const BIGNUM *kinv;
+			const BIGNUM *r;
+			EC_KEY *eckey;
+		} ec;
+	};
+	int ret;                   /* return value of the operation */
+	int efd;                   /* eventfd to signal once done */
+	uint64_t submit_date;      /* date of submission, in ns */
+	uint64_t start_date;       /* date of processing by a crypto thread, in ns */
+};
+
+static struct workq *ssl_offload_wq;
+static RSA_METHOD *ssl_offload_rsa_meth;
+static EC_KEY_METHOD *ssl_offload_ec_meth;
+
+/* the default ECDSA sign function, called by the crypto threads */
+static int (*ssl_offload_ec_sign)(int type, const unsigned char *dgst, int dlen,
+                                  unsigned char *sig, unsigned int *siglen,
+                                  const BIGNUM *kinv, const BIGNUM *r, EC_KEY *eckey);
+
+/* key of the eventfd in the async wait contexts */
+static const char ssl_offload_fd_key[] = "haproxy crypto threads";
+
+/* Performs the private key operation of <job> using the default methods */
+static void ssl_offload_exec(struct ssl_offload_job *job)
+{
+	switch (job->op) {
+	case SSL_OFFLOAD_RSA_PRIV_ENC:
+		job->ret = RSA_meth_get_priv_enc(RSA_PKCS1_OpenSSL())(job->rsa.flen, job->rsa.from, job->rsa.to,
+		                                                      job->rsa.rsa, job->rsa.padding);
+		break;
+	case SSL_OFFLOAD_RSA_PRIV_DEC:
+		job->ret = RSA_meth_get_priv_dec(RSA_PKCS1_OpenSSL())(job->rsa.flen, job->rsa.from, job->rsa.to,
+		                                                      job->rsa.rsa, job->rsa.padding);
+		break;
+	case SSL_OFFLOAD_ECDSA_SIGN:
+		job->ret = ssl_offload_ec_sign(job->ec.type, job->ec.dgst, job->ec.dlen, job->ec.sig,
+		                               job->ec.siglen, job->ec.kinv, job->ec.r, job->ec.eckey);
+		break;
+	}
+}
+
+/* Work queue callback, called from a crypto thread. The job may vanish as
+ * soon as the eventfd is signaled.
+ */
+static void ssl_offload_process(struct workq_job *wjob)
+{
+	struct ssl_offload_job *job = container_of(wjob, struct ssl_offload_job, job);
+	int efd = job->efd;
+
+	job->start_date = now_mono_time();
+	ssl_offload_exec(job);
+	eventfd_write(efd, 1);
+}
+
+/* Closes the eventfd of an async wait context when it is released */
+static void ssl_offload_fd_cleanup(ASYNC_WAIT_CTX *wctx, const void *key,
+                                   OSSL_ASYNC_FD fd, void *custom)
+{
+	close(fd);
+}
+
+/* Returns the eventfd of the wait context of async job <ajob>, which is
+ * created on first use and kept until the wait context is released. It
+ * returns -1 on error.
+ */
+static int ssl_offload_get_fd(ASYNC_JOB *ajob)
+{
+	ASYNC_WAIT_CTX *wctx = ASYNC_get_wait_ctx(ajob);
+	OSSL_ASYNC_FD efd;
+	void *custom;
+
+	if (!wctx)
+		return -1;
+
+	if (ASYNC_WAIT_CTX_get_fd(wctx, ssl_offload_fd_key, &efd, &custom))
+		return efd;
+
+	efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (efd < 0)
+		return -1;
+
+	if (efd >= global.maxsock ||
+	    !ASYNC_WAIT_CTX_set_wait_fd(wctx, ssl_offload_fd_key, efd, NULL, ssl_offload_fd_cleanup)) {
+		close(efd);
+		return -1;
+	}
+	return efd;
+}
+
+/* Returns the eventfd a worker thread must signal to resume the current async
+ * job once the work it waits for is done, or -1 if the caller is not running
+ * from an async job or on error.
+ */
+int ssl_offload_async_fd(void)
+{
+	ASYNC_JOB *ajob = ASYNC_get_current_job();
+
+	return ajob ? ssl_offload_get_fd(ajob) : -1;
+}
+
+/* Pauses the current async job until <efd> is signaled */
+void ssl_offload_async_wait(int efd)
+{
+	uint64_t val;
+
+	/* the job may be resumed before the work is done, in which case the
+	 * eventfd is not readable yet.
+	 */
+	do {
+		ASYNC_pause_job();
+	} while (eventfd_read(efd, &val) != 0);
+}
+
+/* Runs the private key operation of <job>. When called from an async job, the
+ * operation is submitted to the crypto threads and the async job is paused
+ * until it is done. Otherwise, or on error, it is performed by the current
+ * thread. Returns the operation's return value.
+ */
+static int ssl_offload_run(struct ssl_offload_job *job)
+{
+	ASYNC_JOB *ajob = ASYNC_get_current_job();
+
+	if (!ajob || !ssl_offload_wq || (job->efd = ssl_offload_get_fd(ajob)) < 0) {
+		activity[tid].crypto_inline++;
+		ssl_offload_exec(job);
+		return job->ret;
+	}
+
+	workq_job_init(&job->job, ssl_offload_process, NULL);
+	job->submit_date = now_mono_time();
+	th_ctx->crypto_jobs++;
+	activity[tid].crypto_offload++;
+	workq_submit(ssl_offload_wq, &job->job);
+	ssl_offload_async_wait(job->efd);
+
+	th_ctx->crypto_jobs--;
+	swrate_add(&activity[tid].crypto_queue_us, TIME_STATS_SAMPLES,
+	           (job->start_date - job->submit_date) / 1000);
+	swrate_add(&activity[tid].crypto_lat_us, TIME_STATS_SAMPLES,
+	           (now_mono_time() - job->submit_date) / 1000);
+	return job->ret;
+}
+
+static int ssl_offload_rsa_priv_enc(int flen, const unsigned char *from,
+                                    unsigned char *to, RSA *rsa, int padding)
+{
+	struct ssl_offload_job job = {
+		.op  = SSL_OFFLOAD_RSA_PRIV_ENC,
+		.rsa = { .flen = flen, .from = from, .to = to, .rsa = rsa, .padding = padding },
+	};
+
+	return ssl_offload_run(&job);
+}
+
+static int ssl_offload_rsa_priv_dec(int flen, const unsigned char *from,
+                                    unsigned char *to, RSA *rsa, int padding)
+{
+	struct ssl_offload_job job = {
+		.op  = SSL_OFFLOAD_RSA_PRIV_DEC,
+		.rsa = { .flen = flen, .from = from, .to = to, .rsa = rsa, .padding = padding },
+	};
+
+	return ssl_offload_run(&job);
+}
+
+static int ssl_offload_ecdsa_sign(int type, const unsigned char *dgst, int dlen,
+                                  unsigned char *sig, unsigned int *siglen,
+                                  const BIGNUM *kinv, const BIGNUM *r, EC_KEY *eckey)
+{
+	struct ssl_offload_job job = {
+		.op = SSL_OFFLOAD_ECDSA_SIGN,
+		.ec = { .type = type, .dgst = dgst, .dlen = dlen, .sig = sig, .siglen = siglen,
+		        .kinv = kinv, .r = r, .eckey = eckey },
+	};
+
+	return ssl_offload_run(&job);
+}
+
+/* Creates the RSA and EC_KEY methods on first use. Returns 0 on error. */
+static int ssl_offload_init_methods(void)
+{
+	int (*sign_setup)(EC_KEY *, BN_CTX *, BIGNUM **, BIGNUM **);
+	ECDSA_SIG *(*sign_sig)(const unsigned char *, int, const BIGNUM *, const BIGNUM *, EC_KEY *);
+
+	if (ssl_offload_rsa_meth)
+		return 1;
+
+	ssl_offload_rsa_meth = RSA_meth_dup(RSA_PKCS1_OpenSSL());
+	ssl_offload_ec_meth = EC_KEY_METHOD_new(EC_KEY_OpenSSL());
+	if (!ssl_offload_rsa_meth || !ssl_offload_ec_meth)
+		goto fail;
+
+	if (!RSA_meth_set1_name(ssl_offload_rsa_meth, ssl_offload_fd_key) ||
+	    !RSA_meth_set_priv_enc(ssl_offload_rsa_meth, ssl_offload_rsa_priv_enc) ||
+	    !RSA_meth_set_priv_dec(ssl_offload_rsa_meth, ssl_offload_rsa_priv_dec))
+		goto fail;
+
+	EC_KEY_METHOD_get_sign(ssl_offload_ec_meth, &ssl_offload_ec_sign, &sign_setup, &sign_sig);
+	EC_KEY_METHOD_set_sign(ssl_offload_ec_meth, ssl_offload_ecdsa_sign, sign_setup, sign_sig);
+	return 1;
+
+ fail:
+	RSA_meth_free(ssl_offload_rsa_meth);
+	if (ssl_offload_ec_meth)
+		EC_KEY_METHOD_free(ssl_offload_ec_meth);
+	ssl_offload_rsa_meth = NULL;
+	ssl_offload_ec_meth = NULL;
+	return 0;
+}
+
+/* the security callback of the SSL contexts before it was replaced */
+static int (*ssl_offload_default_secb)(const SSL *s, const SSL_CTX *ctx, int op, int bits,
+                                       int nid, void *other, void *ex);
+
+/* Security callback of the SSL contexts using an offloaded RSA key. Since
+ * OpenSSL 3.0, the RSA key exchange relies on parameters only supported by the
+ * providers, so that it fails with such keys, which are handled by the legacy
+ * code. These ciphers are thus not negotiated on these contexts.
+ */
+static int ssl_offload_secb(const SSL *s, const SSL_CTX *ctx, int op, int bits,
+                            int nid, void *other, void *ex)
+{
+	if (op == SSL_SECOP_CIPHER_SHARED && other &&
+	    SSL_CIPHER_get_kx_nid(other) == NID_kx_rsa)
+		return 0;
+	return ssl_offload_default_secb(s, ctx, op, bits, nid, other, ex);
+}
+
+/* Returns a new reference to a copy of private key <pkey> whose private key
+ * operations are offloaded to the crypto threads, or NULL if the offload is
+ * disabled or not supported for this type of key, in which case <pkey> must
+ * be used as-is. Only RSA and ECDSA keys are supported.
+ */
+static EVP_PKEY *ssl_offload_wrap_pkey(EVP_PKEY *pkey)
+{
+	EVP_PKEY *ret = NULL;
+	RSA *rsa, *rsa_dup = NULL;
+	EC_KEY *ec, *ec_dup = NULL;
+
+	if (!global_ssl.crypto_threads || !ssl_offload_init_methods())
+		return NULL;
+
+	switch (EVP_PKEY_base_id(pkey)) {
+	case EVP_PKEY_RSA:
+		rsa = EVP_PKEY_get1_RSA(pkey);
+		if (!rsa)
+			break;
+		rsa_dup = RSAPrivateKey_dup(rsa);
+		RSA_free(rsa);
+		if (!rsa_dup || !RSA_set_method(rsa_dup, ssl_offload_rsa_meth))
+			break;
+		ret = EVP_PKEY_new();
+		if (ret && EVP_PKEY_assign_RSA(ret, rsa_dup))
+			return ret;
+		break;
+
+	case EVP_PKEY_EC:
+		ec = EVP_PKEY_get1_EC_KEY(pkey);
+		if (!ec)
+			break;
+		ec_dup = EC_KEY_dup(ec);
+		EC_KEY_free(ec);
+		if (!ec_dup || !EC_KEY_set_method(ec_dup, ssl_offload_ec_meth))
+			break;
+		ret = EVP_PKEY_new();
+		if (ret && EVP_PKEY_assign_EC_KEY(ret, ec_dup))
+			return ret;
+		break;
+	}
+
+	EVP_PKEY_free(ret);
+	RSA_free(rsa_dup);
+	EC_KEY_free(ec_dup);
+	ERR_clear_error();
+	return NULL;
+}
+
+/* Installs into <ctx> a copy of private key <pkey> whose operations are
+ * offloaded to the crypto threads, once the certificate was loaded. Returns 1
+ * on success, 0 if the offload is not supported for this key in which case
+ * <pkey> remains in use, or -1 on error.
+ */
+int ssl_offload_use_pkey(SSL_CTX *ctx, EVP_PKEY *pkey)
+{
+	EVP_PKEY *wrapped;
+	int ret = 1;
+
+	wrapped = ssl_offload_wrap_pkey(pkey);
+	if (!wrapped)
+		return 0;
+
+	if (SSL_CTX_use_PrivateKey(ctx, wrapped) <= 0) {
+		ERR_clear_error();
+		ret = -1;
+	}
+#if (OPENSSL_VERSION_NUMBER >= 0x3000000fL)
+	else if (EVP_PKEY_base_id(wrapped) == EVP_PKEY_RSA) {
+		if (!ssl_offload_default_secb)
+			ssl_offload_default_secb = SSL_CTX_get_security_callback(ctx);
+		SSL_CTX_set_security_callback(ctx, ssl_offload_secb);
+	}
+#endif
+	EVP_PKEY_free(wrapped);
+	return ret;
+}
+
+/* Creates the crypto threads if "tune.ssl.crypto-threads" is set */
+static int ssl_offload_create_wq(void)
+{
+	char *err = NULL;
+
+	if (!global_ssl.crypto_threads)
+		return ERR_NONE;
+
+	ssl_offload_wq = workq_new("crypto", global_ssl.crypto_threads, &err);
+	if (!ssl_offload_wq) {
+		ha_alert("%s.\n", err);
+		free(err);
+		return ERR_ALERT | ERR_FATAL;
+	}
+	return ERR_NONE;
+}
+
+static void ssl_offload_deinit(void)
+{
+	RSA_meth_free(ssl_offload_rsa_meth);
+	/* unlike RSA_meth_free(), this one doesn't accept NULL */
+	if (ssl_offload_ec_meth)
+		EC_KEY_METHOD_free(ssl_offload_ec_meth);
+	ssl_offload_rsa_meth = NULL;
+	ssl_offload_ec_meth = NULL;
+}
+
+REGISTER_POST_CHECK(ssl_offload_create_wq);
+REGISTER_POST_DEINIT(ssl_offload_deinit);
+
+/* I/O handler of "show ssl crypto-threads". The counters are those of the
+ * threads submitting the operations, which are summed, and whose averages are
+ * averaged over the threads which offloaded operations.
+ */
+static int cli_io_handler_show_crypto_threads(struct appctx *appctx)
+{
+	struct buffer *trash = get_trash_chunk();
+	unsigned long long offloaded = 0, inlined = 0;
+	unsigned int inflight = 0, queue_us = 0, lat_us = 0;
+	int thr, nbthr = 0;
+
+	for (thr = 0; thr < global.nbthread; thr++) {
+		inflight  += _HA_ATOMIC_LOAD(&ha_thread_ctx[thr].crypto_jobs);
+		inlined   += activity[thr].crypto_inline;
+		if (!activity[thr].crypto_offload)
+			continue;
+		offloaded += activity[thr].crypto_offload;
+		queue_us  += swrate_avg(activity[thr].crypto_queue_us, TIME_STATS_SAMPLES);
+		lat_us    += swrate_avg(activity[thr].crypto_lat_us, TIME_STATS_SAMPLES);
+		nbthr++;
+	}
+
+	chunk_appendf(trash, "Crypto threads: %d\n", global_ssl.crypto_threads);
+	chunk_appendf(trash, "Queued: %u\n", ssl_offload_wq ? workq_queued(ssl_offload_wq) : 0);
+	chunk_appendf(trash, "In flight: %u\n", inflight);
+	chunk_appendf(trash, "Offloaded operations: %llu\n", offloaded);
+	chunk_appendf(trash, "Inline operations: %llu\n", inlined);
+	chunk_appendf(trash, "Avg queue time: %u us\n", nbthr ? queue_us / nbthr : 0);
+	chunk_appendf(trash, "Avg latency: %u us\n", nbthr ? lat_us / nbthr : 0);
+
+	if (applet_putchk(appctx, trash) == -1)
+		return 0;
+	return 1;
+}
+
+static struct cli_kw_list cli_kws = {{ },{
+	{ { "show", "ssl", "crypto-threads", NULL }, "show ssl crypto-threads                 : show the activity of the TLS crypto threads", NULL, cli_io_handler_show_crypto_threads },
+	{ { NULL }, NULL, NULL, NULL }
+}};
+
+INITCALL1(STG_REGISTER, cli_register_kw, &cli_kws);
+
+#else /* !SSL_MODE_ASYNC || !HAVE_VANILLA_OPENSSL */
+
+/* The offload relies on the OpenSSL ASYNC API */
+int ssl_offload_use_pkey(SSL_CTX *ctx, EVP_PKEY *pkey)
+{
+	return 0;
+}
+
+int ssl_offload_async_fd(void)
+{
+	return -1;
+}
+
+void ssl_offload_async_wait(int efd)
+{
+}
+
+#endif
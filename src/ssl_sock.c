@@ -62,6 +62,7 @@
 #include <haproxy/log.h>
 #include <haproxy/openssl-compat.h>
 #include <haproxy/pattern-t.h>
+#include <haproxy/peers.h>
 #include <haproxy/proto_tcp.h>
 #include <haproxy/proxy.h>
 #include <haproxy/quic_conn.h>
@@ -75,6 +76,7 @@
 #include <haproxy/ssl_ckch.h>
 #include <haproxy/ssl_crtlist.h>
 #include <haproxy/ssl_gencert.h>
+#include <haproxy/ssl_lazy.h>
 #include <haproxy/ssl_sock.h>
 #include <haproxy/ssl_utils.h>
 #include <haproxy/stats.h>
@@ -88,6 +90,7 @@
 #include <haproxy/xxhash.h>
 #include <haproxy/istbuf.h>
 #include <haproxy/ssl_ocsp.h>
+#include <haproxy/ssl_offload.h>
 #include <haproxy/trace.h>
 #include <haproxy/ssl_trace.h>
 #ifdef USE_ECH
@@ -135,8 +138,12 @@ struct global_ssl global_ssl = {
 	.max_record = DEFAULT_SSL_MAX_RECORD,
 #endif
 	.hard_max_record = 0,
+	.dynrec_threshold = 0,
+	.dynrec_size = DEFAULT_SSL_DYNREC_SIZE,
+	.dynrec_idle = DEFAULT_SSL_DYNREC_IDLE,
 	.default_dh_param = SSL_DEFAULT_DH_PARAM,
 	.ctx_cache = DEFAULT_SSL_CTX_CACHE,
+	.lazy_ctx_cache = DEFAULT_SSL_LAZY_CTX_CACHE,
 	.capture_buffer_size = 0,
 	.extra_files = SSL_GF_ALL,
 	.extra_files_noext = 0,
@@ -175,6 +182,10 @@ enum {
 	SSL_ST_FAILED_HANDSHAKE,
 	SSL_ST_OCSP_STAPLE,
 	SSL_ST_FAILED_OCSP_STAPLE,
+	SSL_ST_REC_SMALL,
+	SSL_ST_REC_MEDIUM,
+	SSL_ST_REC_LARGE,
+	SSL_ST_DYNREC_RESET,
 
 	SSL_ST_STATS_COUNT /* must be the last member of the enum */
 };
@@ -190,6 +201,14 @@ static struct stat_col ssl_stats[] = {
 	                              .desc = "Total number of stapled OCSP responses" },
 	[SSL_ST_FAILED_OCSP_STAPLE] = { .name = "ssl_failed_ocsp_staple",
 	                              .desc = "Total number of failed OCSP stapling (expired or error)" },
+	[SSL_ST_REC_SMALL]        = { .name = "ssl_records_small",
+	                              .desc = "Total number of TLS records sent carrying at most 1500 bytes" },
+	[SSL_ST_REC_MEDIUM]       = { .name = "ssl_records_medium",
+	                              .desc = "Total number of TLS records sent carrying 1501 to 8192 bytes" },
+	[SSL_ST_REC_LARGE]        = { .name = "ssl_records_large",
+	                              .desc = "Total number of TLS records sent carrying more than 8192 bytes" },
+	[SSL_ST_DYNREC_RESET]     = { .name = "ssl_dynrec_reset",
+	                              .desc = "Total number of record size resets after an idle period" },
 };
 
 static struct ssl_counters ssl_counters;
@@ -224,6 +243,18 @@ static int ssl_fill_stats(struct stats_module *mod, struct extra_counters *ctr,
 		case SSL_ST_FAILED_OCSP_STAPLE:
 			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->failed_ocsp_staple));
 			break;
+		case SSL_ST_REC_SMALL:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->rec_small));
+			break;
+		case SSL_ST_REC_MEDIUM:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->rec_medium));
+			break;
+		case SSL_ST_REC_LARGE:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->rec_large));
+			break;
+		case SSL_ST_DYNREC_RESET:
+			metric = mkf_u64(FN_COUNTER, EXTRA_COUNTERS_AGGR(ctr, counters->dynrec_reset));
+			break;
 
 		default:
 			/* not used for frontends. If a specific metric
@@ -1271,11 +1302,89 @@ int ssl_sock_update_tlskey_ref(struct tls_keys_ref *ref,
 	memcpy((char *) (ref->tlskeys + ((ref->tls_ticket_enc_index + 2) % TLS_TICKETS_NO)),
 	       tlskey->area, tlskey->data);
 	ref->tls_ticket_enc_index = (ref->tls_ticket_enc_index + 1) % TLS_TICKETS_NO;
+	ref->generation++;
+	ref->last_update = now_ms;
 	HA_RWLOCK_WRUNLOCK(TLSKEYS_REF_LOCK, &ref->lock);
 
+	/* let the peers know about this new key */
+	peers_ssl_tlskeys_updated();
 	return 0;
 }
 
+/* Replace the key of <ref> by a new random one, as would be done with "set ssl
+ * tls-key". Returns 0 on success, -1 on failure.
+ */
+int ssl_sock_rotate_tlskey_ref(struct tls_keys_ref *ref)
+{
+	union tls_sess_key key;
+	struct buffer buf;
+
+	chunk_init(&buf, (char *)&key, sizeof(key));
+	buf.data = (ref->key_size_bits == 128) ? sizeof(struct tls_sess_key_128) : sizeof(struct tls_sess_key_256);
+	if (RAND_bytes((unsigned char *)&key, buf.data) != 1)
+		return -1;
+	return ssl_sock_update_tlskey_ref(ref, &buf);
+}
+
+/* Copy all the keys of <ref> to <out> starting with the encryption one, and
+ * set <gen> to the keys generation. Returns the number of bytes copied, or 0
+ * if <size> is too small.
+ */
+size_t ssl_sock_dump_tlskeys_ref(struct tls_keys_ref *ref, char *out, size_t size, unsigned int *gen)
+{
+	size_t keylen = (ref->key_size_bits == 128) ? sizeof(struct tls_sess_key_128) : sizeof(struct tls_sess_key_256);
+	int i;
+
+	if (size < keylen * TLS_TICKETS_NO)
+		return 0;
+
+	HA_RWLOCK_RDLOCK(TLSKEYS_REF_LOCK, &ref->lock);
+	for (i = 0; i < TLS_TICKETS_NO; i++)
+		memcpy(out + i * keylen, ref->tlskeys + ((ref->tls_ticket_enc_index + i) % TLS_TICKETS_NO), keylen);
+	*gen = ref->generation;
+	HA_RWLOCK_RDUNLOCK(TLSKEYS_REF_LOCK, &ref->lock);
+	return keylen * TLS_TICKETS_NO;
+}
+
+/* Install the keys <keys> of generation <gen> received from a peer into <ref>,
+ * in the format produced by ssl_sock_dump_tlskeys_ref(). They replace the local
+ * ones if <gen> is more recent, or if it is the same but the keys differ and
+ * compare lower, so that all the nodes converge to the same keys even after
+ * concurrent updates. Returns 1 if the keys were installed, 0 if they were
+ * ignored and -1 if they do not match the keys size of <ref>.
+ */
+int ssl_sock_load_tlskeys_ref(struct tls_keys_ref *ref, const char *keys, size_t len, unsigned int gen)
+{
+	size_t keylen = (ref->key_size_bits == 128) ? sizeof(struct tls_sess_key_128) : sizeof(struct tls_sess_key_256);
+	int i, ret = 0;
+
+	if (len != keylen * TLS_TICKETS_NO)
+		return -1;
+
+	HA_RWLOCK_WRLOCK(TLSKEYS_REF_LOCK, &ref->lock);
+	if ((int)(gen - ref->generation) < 0)
+		goto end;
+
+	if (gen == ref->generation) {
+		int cmp = 0;
+
+		for (i = 0; i < TLS_TICKETS_NO && !cmp; i++)
+			cmp = memcmp(keys + i * keylen, ref->tlskeys + ((ref->tls_ticket_enc_index + i) % TLS_TICKETS_NO), keylen);
+		if (cmp >= 0)
+			goto end;
+	}
+
+	for (i = 0; i < TLS_TICKETS_NO; i++)
+		memcpy(ref->tlskeys + i, keys + i * keylen, keylen);
+	ref->tls_ticket_enc_index = 0;
+	ref->generation = gen;
+	ref->last_update = now_ms;
+	ret = 1;
+  end:
+	HA_RWLOCK_WRUNLOCK(TLSKEYS_REF_LOCK, &ref->lock);
+	return ret;
+}
+
 int ssl_sock_update_tlskey(char *filename, struct buffer *tlskey, char **err)
 {
 	struct tls_keys_ref *ref = tlskeys_ref_lookup(filename);
@@ -3051,6 +3160,16 @@ static int ssl_sock_put_ckch_into_ctx(const char *path, struct ckch_store *store
 	if (errcode & ERR_CODE)
 		goto end;
 
+	/* replace the private key with a copy whose operations are performed
+	 * by the crypto threads. This is done once the certificate is loaded
+	 * so that the key is checked against it.
+	 */
+	if (global_ssl.crypto_threads && ssl_offload_use_pkey(ctx, data->key) < 0) {
+		memprintf(err, "%sunable to offload the private key operations of '%s' to the crypto threads.\n",
+		          err && *err ? *err : "", path);
+		errcode |= ERR_WARN;
+	}
+
 #ifndef OPENSSL_NO_DH
 	/* store a NULL pointer to indicate we have not yet loaded
 	   a custom DH param file */
@@ -4154,8 +4273,10 @@ static int sh_ssl_sess_store(unsigned char *s_id, unsigned char *data, int data_
 {
 	struct shared_block *first;
 	struct sh_ssl_sess_hdr *sh_ssl_sess, *oldsh_ssl_sess;
+	unsigned int key = XXH32(s_id, SSL_MAX_SSL_SESSION_ID_LENGTH, 0);
 
-	first = shctx_row_reserve_hot(ssl_shctx, NULL, data_len + sizeof(struct sh_ssl_sess_hdr));
+	shctx_key_access(ssl_shctx, key);
+	first = shctx_row_reserve_key(ssl_shctx, key, data_len + sizeof(struct sh_ssl_sess_hdr));
 	if (!first) {
 		/* Could not retrieve enough free blocks to store that session */
 		return 0;
@@ -4196,6 +4317,17 @@ static int sh_ssl_sess_store(unsigned char *s_id, unsigned char *data, int data_
 	return 1;
 }
 
+/* Store into the shared cache a session received from a peer. <s_id> is the
+ * session id padded with zeroes to SSL_MAX_SSL_SESSION_ID_LENGTH and <data> the
+ * ASN1 encoded session. Returns 1 if the session was stored, otherwise 0.
+ */
+int ssl_sock_store_peer_sess(unsigned char *s_id, unsigned char *data, int data_len)
+{
+	if (!ssl_shctx || data_len > SHSESS_MAX_DATA_LEN)
+		return 0;
+	return sh_ssl_sess_store(s_id, data, data_len);
+}
+
 /* SSL callback used when a new session is created while connecting to a server */
 static int ssl_sess_new_srv_cb(SSL *ssl, SSL_SESSION *sess)
 {
@@ -4356,7 +4488,8 @@ static int sh_ssl_sess_new_cb(SSL *ssl, SSL_SESSION *sess)
 
 
 	/* store to cache */
-	sh_ssl_sess_store(encid, encsess, data_len);
+	if (sh_ssl_sess_store(encid, encsess, data_len))
+		peers_ssl_sess_push(encid, encsess, data_len);
 err:
 	/* reset original length values */
 	SSL_SESSION_set1_id(sess, encid, sid_length);
@@ -4386,6 +4519,8 @@ static SSL_SESSION *sh_ssl_sess_get_cb(SSL *ssl, __OPENSSL_110_CONST__ unsigned
 		key = tmpkey;
 	}
 
+	shctx_key_access(ssl_shctx, XXH32(key, SSL_MAX_SSL_SESSION_ID_LENGTH, 0));
+
 	/* lock cache */
 	shctx_wrlock(ssl_shctx);
 
@@ -4401,6 +4536,12 @@ static SSL_SESSION *sh_ssl_sess_get_cb(SSL *ssl, __OPENSSL_110_CONST__ unsigned
 	/* sh_ssl_sess (shared_block->data) is at the end of shared_block */
 	first = sh_ssl_sess_first_block(sh_ssl_sess);
 
+	/* the segmented LRU needs to know the sessions which are reused */
+	if (ssl_shctx->policy == SHCTX_POLICY_TINYLFU) {
+		shctx_row_detach(ssl_shctx, first);
+		shctx_row_reattach(ssl_shctx, first);
+	}
+
 	shctx_row_data_get(ssl_shctx, first, data, sizeof(struct sh_ssl_sess_hdr), first->len-sizeof(struct sh_ssl_sess_hdr));
 
 	shctx_wrunlock(ssl_shctx);
@@ -5413,6 +5554,15 @@ int ssl_sock_prepare_bind_conf(struct bind_conf *bind_conf)
 		}
 	}
 
+#ifdef USE_QUIC
+	/* the QUIC handshakes can't be retried while a lazy certificate is loaded */
+	if (bind_conf->lazy_crt && bind_conf->xprt == xprt_get(XPRT_QUIC)) {
+		ha_alert("Proxy '%s': 'crt-list-lazy' is not supported on QUIC bind '%s' at [%s:%d].\n",
+			 px->id, bind_conf->arg, bind_conf->file, bind_conf->line);
+		return -1;
+	}
+#endif
+
 	/* check that we didn't use "strict-sni" and "default-crt" together */
 	if (bind_conf->ssl_options & BC_SSL_O_STRICT_SNI) {
 		struct ebmb_node *node, *n;
@@ -5464,6 +5614,10 @@ int ssl_sock_prepare_bind_conf(struct bind_conf *bind_conf)
 				ha_alert("Unable to allocate SSL session cache.\n");
 			return -1;
 		}
+		if (!shctx_set_policy(ssl_shctx, global_ssl.cache_policy)) {
+			ha_alert("Unable to allocate the eviction policy of the SSL session cache.\n");
+			return -1;
+		}
 		/* free block callback */
 		ssl_shctx->free_block = sh_ssl_sess_free_blocks;
 		/* init the root tree within the extra space */
@@ -5571,6 +5725,7 @@ void ssl_sock_destroy_bind_conf(struct bind_conf *bind_conf)
 	ssl_sock_gencert_free_ca(bind_conf);
 #endif
 	ssl_sock_free_all_ctx(bind_conf);
+	ssl_lazy_free_index(bind_conf);
 	ssl_sock_free_ssl_conf(&bind_conf->ssl_conf);
 	free(bind_conf->ca_sign_file);
 	free(bind_conf->ca_sign_pass);
@@ -5823,6 +5978,9 @@ static int ssl_sock_init(struct connection *conn, void **xprt_ctx)
 #ifdef HA_USE_KTLS
 	ctx->record_type = 0;
 #endif
+	ctx->dynrec_sent = 0;
+	ctx->last_send = now_ms;
+	LIST_INIT(&ctx->lazy_wait);
 #ifdef USE_QUIC
 	ctx->qc = NULL;
 #endif
@@ -6238,6 +6396,15 @@ static int ssl_sock_handshake(struct connection *conn, unsigned int flag)
 			TRACE_ERROR("Want async error", SSL_EV_CONN_HNDSHK, conn, ctx->ssl);
 			return 0;
 		}
+#endif
+#ifdef SSL_ERROR_WANT_CLIENT_HELLO_CB
+		else if (ret == SSL_ERROR_WANT_CLIENT_HELLO_CB) {
+			/* the ClientHello callback waits for a lazy certificate,
+			 * the tasklet will be woken up once it may be retried.
+			 */
+			TRACE_DEVEL("Want lazy certificate (post SSL_do_handshake)", SSL_EV_CONN_HNDSHK, conn, ctx->ssl);
+			return 0;
+		}
 #endif
 		else if (ret == SSL_ERROR_SYSCALL) {
 			/* if errno is null, then connection was successfully established */
@@ -7223,6 +7390,42 @@ static size_t ssl_sock_to_buf(struct connection *conn, void *xprt_ctx, struct bu
 }
 
 
+/* Classify the TLS records needed to carry <len> bytes of application data
+ * into the three size classes of <recs> (small, medium, large). The SSL
+ * library splits the data into records of at most SSL3_RT_MAX_PLAIN_LENGTH
+ * bytes.
+ */
+static inline void ssl_sock_count_records(unsigned int *recs, size_t len)
+{
+	recs[2] += len / SSL3_RT_MAX_PLAIN_LENGTH;
+	len %= SSL3_RT_MAX_PLAIN_LENGTH;
+	if (!len)
+		return;
+	if (len <= SSL_REC_SMALL)
+		recs[0]++;
+	else if (len <= SSL_REC_MEDIUM)
+		recs[1]++;
+	else
+		recs[2]++;
+}
+
+/* Add the record counts <recs> and the number of dynamic record size resets
+ * <resets> to the ssl counters <counters>.
+ */
+static inline void ssl_sock_add_records(struct ssl_counters *counters,
+                                        const unsigned int *recs,
+                                        unsigned int resets)
+{
+	if (recs[0])
+		_HA_ATOMIC_ADD(&counters->rec_small, recs[0]);
+	if (recs[1])
+		_HA_ATOMIC_ADD(&counters->rec_medium, recs[1]);
+	if (recs[2])
+		_HA_ATOMIC_ADD(&counters->rec_large, recs[2]);
+	if (resets)
+		_HA_ATOMIC_ADD(&counters->dynrec_reset, resets);
+}
+
 /* Send up to <count> pending bytes from buffer <buf> to connection <conn>'s
  * socket. <flags> may contain some CO_SFL_* flags to hint the system about
  * other pending data for example, but this flag is ignored at the moment.
@@ -7238,6 +7441,8 @@ static size_t ssl_sock_to_buf(struct connection *conn, void *xprt_ctx, struct bu
 static size_t ssl_sock_from_buf(struct connection *conn, void *xprt_ctx, const struct buffer *buf, size_t count, void *msg_control, size_t msg_controllen, int flags)
 {
 	struct ssl_sock_ctx *ctx = xprt_ctx;
+	unsigned int recs[3] = { 0, 0, 0 };
+	unsigned int dynrec_resets = 0;
 	ssize_t ret;
 	size_t try, done;
 
@@ -7278,7 +7483,23 @@ static size_t ssl_sock_from_buf(struct connection *conn, void *xprt_ctx, const s
 		if (global_ssl.hard_max_record && try > global_ssl.hard_max_record)
 			try = global_ssl.hard_max_record;
 
-		if (!(flags & CO_SFL_STREAMER) &&
+		/* dynamic record sizing: the first <dynrec_threshold> bytes
+		 * are sent using small records so that the client may start
+		 * to decipher them after one segment, and so is the traffic
+		 * restarting after an idle period.
+		 */
+		if (global_ssl.dynrec_threshold && ctx->dynrec_sent && global_ssl.dynrec_idle &&
+		    tick_is_expired(tick_add(ctx->last_send, global_ssl.dynrec_idle), now_ms)) {
+			ctx->dynrec_sent = 0;
+			dynrec_resets++;
+		}
+
+		if (!(ctx->xprt_st & SSL_SOCK_SEND_UNLIMITED) &&
+		    ctx->dynrec_sent < global_ssl.dynrec_threshold &&
+		    try > global_ssl.dynrec_size) {
+			try = global_ssl.dynrec_size;
+		}
+		else if (!(flags & CO_SFL_STREAMER) &&
 		    !(ctx->xprt_st & SSL_SOCK_SEND_UNLIMITED) &&
 		    global_ssl.max_record && try > global_ssl.max_record) {
 			try = global_ssl.max_record;
@@ -7365,6 +7586,13 @@ static size_t ssl_sock_from_buf(struct connection *conn, void *xprt_ctx, const s
 			ctx->xprt_st &= ~SSL_SOCK_SEND_UNLIMITED;
 			count -= ret;
 			done += ret;
+
+			if (global_ssl.dynrec_threshold) {
+				ctx->last_send = now_ms;
+				if (ctx->dynrec_sent < global_ssl.dynrec_threshold)
+					ctx->dynrec_sent += ret;
+			}
+			ssl_sock_count_records(recs, ret);
 			TRACE_DEVEL("Post SSL_write success", SSL_EV_CONN_SEND, conn, &ret);
 		}
 		else {
@@ -7418,6 +7646,16 @@ static size_t ssl_sock_from_buf(struct connection *conn, void *xprt_ctx, const s
 		}
 	}
  leave:
+	if (recs[0] + recs[1] + recs[2] + dynrec_resets) {
+		struct ssl_counters *counters = NULL;
+		struct ssl_counters *counters_px = NULL;
+
+		ssl_sock_get_stats_counters(conn, &counters, &counters_px);
+		if (counters) {
+			ssl_sock_add_records(counters, recs, dynrec_resets);
+			ssl_sock_add_records(counters_px, recs, dynrec_resets);
+		}
+	}
 	TRACE_LEAVE(SSL_EV_CONN_SEND, conn);
 	return done;
 
@@ -7438,6 +7676,7 @@ static void ssl_sock_close(struct connection *conn, void *xprt_ctx) {
 	TRACE_ENTER(SSL_EV_CONN_CLOSE, conn);
 
 	if (ctx) {
+		ssl_lazy_unsubscribe(ctx);
 		if (ctx->wait_event.events != 0)
 			ctx->xprt->unsubscribe(ctx->conn, ctx->xprt_ctx,
 			                       ctx->wait_event.events,
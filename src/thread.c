@@ -414,6 +414,7 @@ const char *lock_label(enum lock_label label)
 	case SHCTX_LOCK:           return "SHCTX";
 	case SSL_LOCK:             return "SSL";
 	case SSL_GEN_CERTS_LOCK:   return "SSL_GEN_CERTS";
+	case SSL_LAZY_LOCK:        return "SSL_LAZY";
 	case PATREF_LOCK:          return "PATREF";
 	case PATEXP_LOCK:          return "PATEXP";
 	case VARS_LOCK:            return "VARS";
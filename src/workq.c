@@ -0,0 +1,248 @@
+/*
+ * Work queues: threads processing blocking jobs out of the event loop.
+ *
+ * A job is submitted from an haproxy thread, processed by one of the work
+ * queue's threads, then its tasklet is woken up so that its completion is
+ * handled on the submitting thread. Jobs are dequeued in submission order, so
+ * that a work queue made of a single thread processes them sequentially.
+ */
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <haproxy/api.h>
+#include <haproxy/errors.h>
+#include <haproxy/list.h>
+#include <haproxy/task.h>
+#include <haproxy/thread.h>
+#include <haproxy/tools.h>
+#include <haproxy/workq.h>
+
+/* list of all work queues */
+static struct list workqs = LIST_HEAD_INIT(workqs);
+
+/* Allocates a work queue of <nbthreads> threads named <name>, whose threads
+ * will start with the haproxy threads. It must be called during the
+ * configuration parsing. Returns the work queue or NULL with <err> filled.
+ */
+struct workq *workq_new(const char *name, int nbthreads, char **err)
+{
+	struct workq *wq;
+
+	wq = calloc(1, sizeof(*wq));
+	if (!wq || !(wq->name = strdup(name))) {
+		memprintf(err, "out of memory while allocating work queue '%s'", name);
+		free(wq);
+		return NULL;
+	}
+
+	wq->nbthreads = nbthreads;
+	LIST_INIT(&wq->jobs);
+#ifdef USE_THREAD
+	pthread_mutex_init(&wq->lock, NULL);
+	pthread_cond_init(&wq->cond, NULL);
+#endif
+	LIST_APPEND(&workqs, &wq->list);
+	return wq;
+}
+
+/* Tasklet handler calling the ->done callback of the job in <context> */
+static struct task *workq_job_done(struct task *t, void *context, unsigned int state)
+{
+	struct workq_job *job = context;
+
+	if (!job->done(job))
+		return NULL;
+	return t;
+}
+
+/* Initializes job <job> which will call <process> from a worker thread, then
+ * <done> if not NULL on the current thread. The tasklet needed to notify the
+ * current thread is allocated here, and must be released with
+ * workq_job_deinit(). Returns 1 on success, 0 on memory allocation error.
+ */
+int workq_job_init(struct workq_job *job, void (*process)(struct workq_job *),
+                   int (*done)(struct workq_job *))
+{
+	LIST_INIT(&job->list);
+	job->process = process;
+	job->done = done;
+	job->tl = NULL;
+	if (!done)
+		return 1;
+
+	job->tl = tasklet_new();
+	if (!job->tl)
+		return 0;
+	job->tl->process = workq_job_done;
+	job->tl->context = job;
+	tasklet_set_tid(job->tl, tid);
+	return 1;
+}
+
+/* Releases the resources allocated by workq_job_init() for job <job>, which
+ * must not be queued nor being processed. It may be called from its ->done
+ * callback, which must then return 0.
+ */
+void workq_job_deinit(struct workq_job *job)
+{
+	tasklet_free(job->tl);
+	job->tl = NULL;
+}
+
+#ifdef USE_THREAD
+
+/* The main function of the worker threads of work queue <arg> */
+static void *workq_thread(void *arg)
+{
+	struct workq *wq = arg;
+	struct workq_job *job;
+	struct tasklet *tl;
+
+	pthread_mutex_lock(&wq->lock);
+	while (1) {
+		while (wq->state == WORKQ_ST_RUNNING && LIST_ISEMPTY(&wq->jobs))
+			pthread_cond_wait(&wq->cond, &wq->lock);
+
+		if (wq->state != WORKQ_ST_RUNNING)
+			break;
+
+		job = LIST_NEXT(&wq->jobs, struct workq_job *, list);
+		LIST_DEL_INIT(&job->list);
+		wq->queued--;
+		pthread_mutex_unlock(&wq->lock);
+
+		/* a job without tasklet may be released by ->process */
+		tl = job->tl;
+		job->process(job);
+		if (tl)
+			tasklet_wakeup(tl);
+
+		pthread_mutex_lock(&wq->lock);
+		wq->processed++;
+	}
+	pthread_mutex_unlock(&wq->lock);
+	return NULL;
+}
+
+/* Queues job <job> to work queue <wq>. The job's ->process callback will be
+ * called from one of the worker threads, then its ->done callback from the
+ * current thread.
+ */
+void workq_submit(struct workq *wq, struct workq_job *job)
+{
+	pthread_mutex_lock(&wq->lock);
+	LIST_APPEND(&wq->jobs, &job->list);
+	wq->queued++;
+	pthread_cond_signal(&wq->cond);
+	pthread_mutex_unlock(&wq->lock);
+}
+
+/* Starts the threads of all work queues from the first thread, with all
+ * signals blocked since they are not meant to handle them.
+ */
+static int workq_start_all()
+{
+	sigset_t blocked_sig, old_sig;
+	struct workq *wq;
+	int i, ret = 1;
+
+	if (tid != 0)
+		return 1;
+
+	sigfillset(&blocked_sig);
+	sigdelset(&blocked_sig, SIGBUS);
+	sigdelset(&blocked_sig, SIGFPE);
+	sigdelset(&blocked_sig, SIGILL);
+	sigdelset(&blocked_sig, SIGSEGV);
+	pthread_sigmask(SIG_SETMASK, &blocked_sig, &old_sig);
+
+	list_for_each_entry(wq, &workqs, list) {
+		wq->threads = calloc(wq->nbthreads, sizeof(*wq->threads));
+		if (!wq->threads) {
+			ha_alert("Out of memory while starting work queue '%s'.\n", wq->name);
+			ret = 0;
+			break;
+		}
+
+		wq->state = WORKQ_ST_RUNNING;
+		for (i = 0; i < wq->nbthreads; i++) {
+			if (pthread_create(&wq->threads[i], NULL, workq_thread, wq) != 0) {
+				ha_alert("Failed to start thread %d of work queue '%s'.\n", i + 1, wq->name);
+				wq->nbthreads = i;
+				ret = 0;
+				break;
+			}
+		}
+		if (!ret)
+			break;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old_sig, NULL);
+	return ret;
+}
+
+/* Stops and waits for the threads of all work queues from the first thread.
+ * Jobs still queued are not processed.
+ */
+static void workq_stop_all()
+{
+	struct workq *wq;
+	int i;
+
+	if (tid != 0)
+		return;
+
+	list_for_each_entry(wq, &workqs, list) {
+		if (!wq->threads)
+			continue;
+
+		pthread_mutex_lock(&wq->lock);
+		wq->state = WORKQ_ST_STOPPING;
+		pthread_cond_broadcast(&wq->cond);
+		pthread_mutex_unlock(&wq->lock);
+
+		for (i = 0; i < wq->nbthreads; i++)
+			pthread_join(wq->threads[i], NULL);
+		ha_free(&wq->threads);
+	}
+}
+
+REGISTER_PER_THREAD_INIT(workq_start_all);
+REGISTER_PER_THREAD_DEINIT(workq_stop_all);
+
+#else /* !USE_THREAD */
+
+/* Without threads, jobs are processed immediately, and their ->done callback
+ * is called from the scheduler as usual.
+ */
+void workq_submit(struct workq *wq, struct workq_job *job)
+{
+	struct tasklet *tl = job->tl;
+
+	job->process(job);
+	if (tl)
+		tasklet_wakeup(tl);
+	wq->processed++;
+}
+
+#endif /* USE_THREAD */
+
+/* Releases all work queues */
+static void workq_deinit()
+{
+	struct workq *wq, *back;
+
+	list_for_each_entry_safe(wq, back, &workqs, list) {
+		LIST_DELETE(&wq->list);
+#ifdef USE_THREAD
+		pthread_mutex_destroy(&wq->lock);
+		pthread_cond_destroy(&wq->cond);
+#endif
+		free(wq->name);
+		free(wq);
+	}
+}
+
+REGISTER_POST_DEINIT(workq_deinit);
@@ -0,0 +1,18 @@
+#!/bin/sh
+
+check() {
+	${HAPROXY_PROGRAM} -vv | grep -E '^Unit tests list :' | grep -q "h2_hblk"
+}
+
+run() {
+	${HAPROXY_PROGRAM} -U h2_hblk
+}
+
+case "$1" in
+	"check")
+		check
+	;;
+	"run")
+		run
+	;;
+esac
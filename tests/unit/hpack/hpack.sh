@@ -0,0 +1,18 @@
+#!/bin/sh
+
+check() {
+	${HAPROXY_PROGRAM} -vv | grep -E '^Unit tests list :' | grep -q "hpack_enc"
+}
+
+run() {
+	${HAPROXY_PROGRAM} -U hpack_enc
+}
+
+case "$1" in
+	"check")
+		check
+	;;
+	"run")
+		run
+	;;
+esac
@@ -0,0 +1,18 @@
+#!/bin/sh
+
+check() {
+	${HAPROXY_PROGRAM} -vv | grep -E '^Unit tests list :' | grep -q "pattern_acm"
+}
+
+run() {
+	${HAPROXY_PROGRAM} -U pattern_acm
+}
+
+case "$1" in
+	"check")
+		check
+	;;
+	"run")
+		run
+	;;
+esac